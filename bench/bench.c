@@ -0,0 +1,603 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <euicc/euicc.h>
+#include <euicc/interface.h>
+#include <euicc/base64.h>
+#include <euicc/derutil.h>
+#include <euicc/hexutil.h>
+#include <euicc/sha256.h>
+#include <euicc/es10b.h>
+#include <euicc/es10c.h>
+
+#define BENCH_MIN_TIME_NS 200000000ULL
+#define BENCH_BUFFER_SIZE 4096
+#define BENCH_PROFILES 8
+#define BENCH_ICON_SIZE 1024
+#define BENCH_BPP_ELEMENTS 32
+#define BENCH_BPP_ELEMENT_SIZE 1000
+
+static uint64_t bench_allocs;
+static uint64_t bench_alloc_bytes;
+// Live heap bytes, and the most there were since bench_run last lowered it to them
+static int64_t bench_live_bytes;
+static int64_t bench_peak_bytes;
+
+#ifdef __GLIBC__
+#include <malloc.h>
+
+// Counts every heap allocation made by libeuicc and libc, with the usable size of each block
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static void bench_count_alloc(void *ptr)
+{
+    size_t size;
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+    size = malloc_usable_size(ptr);
+    bench_allocs++;
+    bench_alloc_bytes += size;
+    bench_live_bytes += size;
+    if (bench_live_bytes > bench_peak_bytes)
+    {
+        bench_peak_bytes = bench_live_bytes;
+    }
+}
+
+static void bench_count_free(void *ptr)
+{
+    if (ptr)
+    {
+        bench_live_bytes -= malloc_usable_size(ptr);
+    }
+}
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+
+    bench_count_alloc(ptr);
+    return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr = __libc_calloc(nmemb, size);
+
+    bench_count_alloc(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *ptr_new;
+
+    bench_count_free(ptr);
+    ptr_new = __libc_realloc(ptr, size);
+    if (ptr_new == NULL && size)
+    {
+        bench_live_bytes += malloc_usable_size(ptr);
+        return NULL;
+    }
+    bench_count_alloc(ptr_new);
+    return ptr_new;
+}
+
+void free(void *ptr)
+{
+    bench_count_free(ptr);
+    __libc_free(ptr);
+}
+
+#define BENCH_COUNT_ALLOCS 1
+#endif
+
+static uint8_t buffer[BENCH_BUFFER_SIZE];
+static char buffer_b64[BENCH_BUFFER_SIZE * 2];
+static char buffer_hex[BENCH_BUFFER_SIZE * 2 + 1];
+static uint8_t scratch[BENCH_BUFFER_SIZE * 2];
+
+static uint8_t profiles_storage[BENCH_PROFILES * (BENCH_ICON_SIZE + 128) + 64];
+static const uint8_t *profiles;
+static uint32_t profiles_len;
+static struct euicc_derutil_node profiles_nodes[3 + BENCH_PROFILES * 10];
+
+static struct euicc_blob bpp;
+
+static struct euicc_ctx ctx;
+static volatile uint32_t sink;
+
+// Loopback card answering every ES10 command with the fixture response selected by the benchmark
+struct loopback
+{
+    const uint8_t *response;
+    uint32_t response_len;
+    const uint8_t *pending;
+    uint32_t pending_len;
+};
+
+static struct loopback loopback;
+
+static int loopback_connect(struct euicc_ctx *ctx)
+{
+    return 0;
+}
+
+static void loopback_disconnect(struct euicc_ctx *ctx)
+{
+}
+
+static int loopback_logic_channel_open(struct euicc_ctx *ctx, const uint8_t *aid, uint8_t aid_len)
+{
+    return 1;
+}
+
+static void loopback_logic_channel_close(struct euicc_ctx *ctx, uint8_t channel)
+{
+}
+
+static int loopback_transmit_into(struct euicc_ctx *ctx, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    uint32_t chunk = 0;
+
+    if (tx[1] == 0xE2 && (tx[2] & 0x80))
+    {
+        loopback.pending = loopback.response;
+        loopback.pending_len = loopback.response_len;
+    }
+    else if (tx[1] == 0xC0)
+    {
+        chunk = loopback.pending_len < 256 ? loopback.pending_len : 256;
+        memcpy(rx, loopback.pending, chunk);
+        loopback.pending += chunk;
+        loopback.pending_len -= chunk;
+    }
+    else
+    {
+        rx[0] = 0x90;
+        rx[1] = 0x00;
+        *rx_len = 2;
+        return 0;
+    }
+
+    if (loopback.pending_len)
+    {
+        rx[chunk] = 0x61;
+        rx[chunk + 1] = loopback.pending_len < 256 ? loopback.pending_len : 0x00;
+    }
+    else
+    {
+        rx[chunk] = 0x90;
+        rx[chunk + 1] = 0x00;
+    }
+    *rx_len = chunk + 2;
+
+    return 0;
+}
+
+static int loopback_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    *rx = malloc(256 + 2);
+    if (*rx == NULL)
+    {
+        return -1;
+    }
+    return loopback_transmit_into(ctx, *rx, 256 + 2, rx_len, tx, tx_len);
+}
+
+static struct euicc_apdu_interface loopback_interface = {
+    .connect = loopback_connect,
+    .disconnect = loopback_disconnect,
+    .logic_channel_open = loopback_logic_channel_open,
+    .logic_channel_close = loopback_logic_channel_close,
+    .transmit = loopback_transmit,
+    .transmit_into = loopback_transmit_into,
+};
+
+static uint64_t bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// ProfileInfoListResponse with BENCH_PROFILES profiles carrying BENCH_ICON_SIZE byte icons
+static void fixture_profiles(void)
+{
+    struct euicc_derutil_writer writer;
+    static uint8_t icon[BENCH_ICON_SIZE];
+    uint8_t iccid[10] = {0x98, 0x00, 0x10, 0x32, 0x54, 0x76, 0x98, 0x10, 0x32, 0x00};
+    uint8_t aid[16] = {0xA0, 0x00, 0x00, 0x05, 0x59, 0x10, 0x10, 0xFF, 0xFF, 0xFF, 0xFF, 0x89, 0x00, 0x00, 0x10, 0x00};
+    uint8_t state, icon_type = 1, profile_class = 2;
+
+    for (uint32_t i = 0; i < sizeof(icon); i++)
+    {
+        icon[i] = i * 7;
+    }
+
+    euicc_derutil_writer_init(&writer, profiles_storage, sizeof(profiles_storage));
+    for (int i = BENCH_PROFILES - 1; i >= 0; i--)
+    {
+        uint32_t mark = euicc_derutil_writer_mark(&writer);
+
+        iccid[9] = aid[15] = i;
+        state = i == 0;
+        euicc_derutil_writer_tlv(&writer, 0x95, &profile_class, 1);
+        euicc_derutil_writer_tlv(&writer, 0x94, icon, sizeof(icon));
+        euicc_derutil_writer_tlv(&writer, 0x93, &icon_type, 1);
+        euicc_derutil_writer_tlv(&writer, 0x92, "Bench Profile", 13);
+        euicc_derutil_writer_tlv(&writer, 0x91, "Bench Operator", 14);
+        euicc_derutil_writer_tlv(&writer, 0x90, "nickname", 8);
+        euicc_derutil_writer_tlv(&writer, 0x9F70, &state, 1);
+        euicc_derutil_writer_tlv(&writer, 0x4F, aid, sizeof(aid));
+        euicc_derutil_writer_tlv(&writer, 0x5A, iccid, sizeof(iccid));
+        euicc_derutil_writer_wrap(&writer, 0xE3, mark);
+    }
+    euicc_derutil_writer_wrap(&writer, 0xA0, 0);
+    euicc_derutil_writer_wrap(&writer, 0xBF2D, 0);
+    if (euicc_derutil_writer_finish(&writer, &profiles, &profiles_len) < 0)
+    {
+        abort();
+    }
+}
+
+// The same response as a node tree for euicc_derutil_pack
+static struct euicc_derutil_node *fixture_profiles_nodes(void)
+{
+    struct euicc_derutil_node *root = &profiles_nodes[0];
+    struct euicc_derutil_node *list = &profiles_nodes[1];
+    struct euicc_derutil_node *prev = NULL;
+    struct euicc_derutil_node n_list, n_info, tmpnode;
+    uint32_t used = 2;
+
+    memset(profiles_nodes, 0, sizeof(profiles_nodes));
+    root->tag = 0xBF2D;
+    root->pack.child = list;
+    list->tag = 0xA0;
+
+    euicc_derutil_unpack_find_tag(&n_list, 0xBF2D, profiles, profiles_len);
+    euicc_derutil_unpack_find_tag(&n_list, 0xA0, n_list.value, n_list.length);
+
+    n_info.self.ptr = n_list.value;
+    n_info.self.length = 0;
+    while (euicc_derutil_unpack_next(&n_info, &n_info, n_list.value, n_list.length) == 0)
+    {
+        struct euicc_derutil_node *info = &profiles_nodes[used++];
+        struct euicc_derutil_node *child_prev = NULL;
+
+        info->tag = 0xE3;
+        if (prev)
+            prev->pack.next = info;
+        else
+            list->pack.child = info;
+        prev = info;
+
+        tmpnode.self.ptr = n_info.value;
+        tmpnode.self.length = 0;
+        while (euicc_derutil_unpack_next(&tmpnode, &tmpnode, n_info.value, n_info.length) == 0)
+        {
+            struct euicc_derutil_node *child = &profiles_nodes[used++];
+
+            child->tag = tmpnode.tag;
+            child->length = tmpnode.length;
+            child->value = tmpnode.value;
+            if (child_prev)
+                child_prev->pack.next = child;
+            else
+                info->pack.child = child;
+            child_prev = child;
+        }
+    }
+
+    return root;
+}
+
+// BoundProfilePackage shaped like an SM-DP+ one, already decoded from its ES9+ base64
+static void fixture_bpp(void)
+{
+    struct euicc_derutil_writer writer;
+    static uint8_t element[BENCH_BPP_ELEMENT_SIZE];
+    static uint8_t storage[BENCH_BPP_ELEMENTS * (BENCH_BPP_ELEMENT_SIZE + 8) + 512];
+    const uint8_t *der;
+    uint32_t mark;
+
+    memset(element, 0x86, sizeof(element));
+    euicc_derutil_writer_init(&writer, storage, sizeof(storage));
+
+    for (int i = 0; i < BENCH_BPP_ELEMENTS; i++)
+    {
+        euicc_derutil_writer_tlv(&writer, 0x86, element, sizeof(element));
+    }
+    euicc_derutil_writer_wrap(&writer, 0xA3, 0);
+    mark = euicc_derutil_writer_mark(&writer);
+    euicc_derutil_writer_tlv(&writer, 0x88, element, 60);
+    euicc_derutil_writer_wrap(&writer, 0xA1, mark);
+    mark = euicc_derutil_writer_mark(&writer);
+    euicc_derutil_writer_tlv(&writer, 0x87, element, 40);
+    euicc_derutil_writer_wrap(&writer, 0xA0, mark);
+    mark = euicc_derutil_writer_mark(&writer);
+    euicc_derutil_writer_tlv(&writer, 0x80, element, 16);
+    euicc_derutil_writer_wrap(&writer, 0xBF23, mark);
+    euicc_derutil_writer_wrap(&writer, 0xBF36, 0);
+    if (euicc_derutil_writer_finish(&writer, &der, &bpp.length) < 0)
+    {
+        abort();
+    }
+    bpp.data = (uint8_t *)der;
+}
+
+static uint32_t bench_derutil_unpack(void)
+{
+    struct euicc_derutil_node n_list, n_info, tmpnode;
+    uint32_t count = 0;
+
+    euicc_derutil_unpack_find_tag(&n_list, 0xBF2D, profiles, profiles_len);
+    euicc_derutil_unpack_find_tag(&n_list, 0xA0, n_list.value, n_list.length);
+
+    n_info.self.ptr = n_list.value;
+    n_info.self.length = 0;
+    while (euicc_derutil_unpack_next(&n_info, &n_info, n_list.value, n_list.length) == 0)
+    {
+        tmpnode.self.ptr = n_info.value;
+        tmpnode.self.length = 0;
+        while (euicc_derutil_unpack_next(&tmpnode, &tmpnode, n_info.value, n_info.length) == 0)
+        {
+            count += tmpnode.length;
+        }
+    }
+    sink = count;
+
+    return profiles_len;
+}
+
+static uint32_t bench_derutil_index(void)
+{
+    struct euicc_derutil_node n_list, n_infos[BENCH_PROFILES], n_children[16];
+    struct euicc_derutil_index_table table;
+    const struct euicc_derutil_node *n_iccid;
+    int count, children_count;
+
+    euicc_derutil_unpack_find_tag(&n_list, 0xBF2D, profiles, profiles_len);
+    euicc_derutil_unpack_find_tag(&n_list, 0xA0, n_list.value, n_list.length);
+
+    count = euicc_derutil_index(n_infos, BENCH_PROFILES, n_list.value, n_list.length);
+    for (int i = 0; i < count; i++)
+    {
+        children_count = euicc_derutil_index(n_children, 16, n_infos[i].value, n_infos[i].length);
+        if (children_count < 0 || euicc_derutil_index_table_init(&table, n_children, children_count) < 0)
+        {
+            abort();
+        }
+        n_iccid = euicc_derutil_index_find(&table, 0x5A);
+        sink = n_iccid ? n_iccid->length : 0;
+    }
+
+    return profiles_len;
+}
+
+static uint32_t bench_derutil_pack(void)
+{
+    static struct euicc_derutil_node *root;
+    uint8_t *packed;
+    uint32_t packed_len;
+
+    if (root == NULL)
+    {
+        root = fixture_profiles_nodes();
+    }
+
+    if (euicc_derutil_pack_alloc(&packed, &packed_len, root) < 0)
+    {
+        abort();
+    }
+    sink = packed[packed_len - 1];
+    free(packed);
+
+    return packed_len;
+}
+
+static uint32_t bench_derutil_writer(void)
+{
+    fixture_profiles();
+    sink = profiles[0];
+
+    return profiles_len;
+}
+
+static uint32_t bench_base64_encode(void)
+{
+    sink = euicc_base64_encode(buffer_b64, buffer, sizeof(buffer));
+
+    return sizeof(buffer);
+}
+
+static uint32_t bench_base64_decode(void)
+{
+    sink = euicc_base64_decode(scratch, buffer_b64);
+
+    return sizeof(buffer);
+}
+
+static uint32_t bench_hexutil_bin2hex(void)
+{
+    sink = euicc_hexutil_bin2hex(buffer_hex, sizeof(buffer_hex), buffer, sizeof(buffer));
+
+    return sizeof(buffer);
+}
+
+static uint32_t bench_hexutil_hex2bin(void)
+{
+    sink = euicc_hexutil_hex2bin(scratch, sizeof(scratch), buffer_hex);
+
+    return sizeof(buffer);
+}
+
+static uint32_t bench_sha256(void)
+{
+    EUICC_SHA256_CTX sha256;
+    uint8_t hash[32];
+
+    euicc_sha256_init(&sha256);
+    euicc_sha256_update(&sha256, buffer, sizeof(buffer));
+    euicc_sha256_final(&sha256, hash);
+    sink = hash[0];
+
+    return sizeof(buffer);
+}
+
+static uint32_t bench_es10c_get_profiles_info(void)
+{
+    struct es10c_profile_info_list *list = NULL;
+
+    loopback.response = profiles;
+    loopback.response_len = profiles_len;
+    if (es10c_get_profiles_info(&ctx, &list) < 0)
+    {
+        abort();
+    }
+    sink = list != NULL;
+    es10c_profile_info_list_free_all(list);
+
+    return profiles_len;
+}
+
+static uint32_t bench_es10b_load_bound_profile_package(void)
+{
+    struct es10b_load_bound_profile_package_result result;
+
+    loopback.response = NULL;
+    loopback.response_len = 0;
+    if (es10b_load_bound_profile_package_r(&ctx, &result, &bpp) < 0)
+    {
+        abort();
+    }
+    sink = result.bppCommandId;
+
+    return bpp.length;
+}
+
+struct bench
+{
+    const char *name;
+    // Runs one operation and returns how many bytes it processed
+    uint32_t (*run)(void);
+};
+
+static const struct bench benches[] = {
+    {"derutil_unpack", bench_derutil_unpack},
+    {"derutil_index", bench_derutil_index},
+    {"derutil_pack", bench_derutil_pack},
+    {"derutil_writer", bench_derutil_writer},
+    {"base64_encode", bench_base64_encode},
+    {"base64_decode", bench_base64_decode},
+    {"hexutil_bin2hex", bench_hexutil_bin2hex},
+    {"hexutil_hex2bin", bench_hexutil_hex2bin},
+    {"sha256", bench_sha256},
+    {"es10c_get_profiles_info", bench_es10c_get_profiles_info},
+    {"es10b_load_bound_profile_package", bench_es10b_load_bound_profile_package},
+    {NULL, NULL},
+};
+
+// Doubles the iteration count until one pass takes at least min_time, and reports that pass
+static void bench_run(const struct bench *bench, uint64_t min_time)
+{
+    uint64_t iterations = 1, elapsed, bytes, allocs, alloc_bytes;
+    int64_t peak;
+
+    for (;;)
+    {
+        uint64_t start;
+
+        bytes = 0;
+        allocs = bench_allocs;
+        alloc_bytes = bench_alloc_bytes;
+        peak = bench_peak_bytes = bench_live_bytes;
+        start = bench_now();
+        for (uint64_t i = 0; i < iterations; i++)
+        {
+            bytes += bench->run();
+        }
+        elapsed = bench_now() - start;
+        allocs = bench_allocs - allocs;
+        alloc_bytes = bench_alloc_bytes - alloc_bytes;
+        peak = bench_peak_bytes - peak;
+
+        if (elapsed >= min_time)
+        {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    printf("%-34s %10" PRIu64 " %12.1f %10.1f", bench->name, iterations, (double)elapsed / iterations, bytes * 1e3 / elapsed);
+#ifdef BENCH_COUNT_ALLOCS
+    // Peak is the most heap held above where the pass started, which a single operation reaches unless it leaks
+    printf(" %10.2f %10.1f %10" PRId64 "\n", (double)allocs / iterations, (double)alloc_bytes / iterations, peak);
+#else
+    printf(" %10s %10s %10s\n", "n/a", "n/a", "n/a");
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t min_time = BENCH_MIN_TIME_NS;
+    const char *filter = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            min_time = strtoull(argv[++i], NULL, 10) * 1000000ULL;
+        }
+        else if (strcmp(argv[i], "-h") == 0)
+        {
+            printf("Usage: %s [-t <milliseconds per benchmark>] [name filter]\n", argv[0]);
+            return 0;
+        }
+        else
+        {
+            filter = argv[i];
+        }
+    }
+
+    // Fixed content, so every run measures the same work
+    for (uint32_t i = 0; i < sizeof(buffer); i++)
+    {
+        buffer[i] = (i * 31 + 7) & 0xFF;
+    }
+    euicc_base64_encode(buffer_b64, buffer, sizeof(buffer));
+    euicc_hexutil_bin2hex(buffer_hex, sizeof(buffer_hex), buffer, sizeof(buffer));
+    fixture_profiles();
+    fixture_bpp();
+
+    ctx.apdu.interface = &loopback_interface;
+    if (euicc_init(&ctx))
+    {
+        fprintf(stderr, "euicc_init failed\n");
+        return 1;
+    }
+
+    printf("%-34s %10s %12s %10s %10s %10s %10s\n", "benchmark", "iterations", "ns/op", "MB/s", "allocs/op", "bytes/op", "peak");
+    for (const struct bench *bench = benches; bench->name; bench++)
+    {
+        if (filter && strstr(bench->name, filter) == NULL)
+        {
+            continue;
+        }
+        bench_run(bench, min_time);
+    }
+
+    euicc_fini(&ctx);
+
+    return 0;
+}
@@ -1,231 +1,1565 @@
 #include "at.h"
 
 #include <inttypes.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#endif
+
+#include <euicc/euicc.h>
 #include <euicc/interface.h>
 #include <euicc/hexutil.h>
 
-static FILE *fuart;
-static int logic_channel = 0;
+#include "lock.h"
+#include "bind.h"
+#include "driver.h"
+
+#define AT_BAUDRATE_DEFAULT 115200
+#define AT_TIMEOUT_DEFAULT 10000
+#define AT_READ_BUFFER_SIZE 4096
+#define AT_COMMAND_SIZE 64
+#define AT_IDENTITY_SIZE 512
 
-static int at_expect(char **response, const char *expected)
+struct at_userdata
 {
-    char buffer[1024];
+#ifdef _WIN32
+    HANDLE huart;
+#else
+    int fd;
+#endif
+    int logic_channel;
+    int probed;
+    char *device;
+    // Held from connect to disconnect, so another lpac on the port waits instead of interleaving its commands
+    int lock;
+    char identity[AT_IDENTITY_SIZE];
+    int baudrate;
+    int timeout;
+    int timeout_default;
+    int debug;
+    char *line;
+    uint32_t line_capacity;
+    uint8_t rbuf[AT_READ_BUFFER_SIZE];
+    uint32_t rbuf_start;
+    uint32_t rbuf_len;
+    char *response;
+    uint32_t response_len;
+    uint32_t response_capacity;
+    // response holds a whole line, the next one starts over
+    uint8_t response_done;
+};
 
-    if (response)
-        *response = NULL;
+#ifdef _WIN32
+static int at_device_open(struct at_userdata *userdata)
+{
+    char path[MAX_PATH];
+    DCB dcb;
 
-    while (1)
+    // COM10 and above are only reachable through the device namespace
+    if (strncmp(userdata->device, "\\\\.\\", 4) == 0)
     {
-        fgets(buffer, sizeof(buffer), fuart);
-        buffer[strcspn(buffer, "\r\n")] = 0;
-        if (getenv("AT_DEBUG"))
-            printf("AT_DEBUG: %s\r\n", buffer);
-        if (strcmp(buffer, "ERROR") == 0)
-        {
-            return -1;
-        }
-        else if (strcmp(buffer, "OK") == 0)
-        {
-            return 0;
-        }
-        else if (expected && strncmp(buffer, expected, strlen(expected)) == 0)
-        {
-            if (response)
-                *response = strdup(buffer + strlen(expected));
-        }
+        snprintf(path, sizeof(path), "%s", userdata->device);
     }
+    else
+    {
+        snprintf(path, sizeof(path), "\\\\.\\%s", userdata->device);
+    }
+
+    userdata->huart = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    if (userdata->huart == INVALID_HANDLE_VALUE)
+    {
+        return -1;
+    }
+
+    memset(&dcb, 0, sizeof(dcb));
+    dcb.DCBlength = sizeof(dcb);
+    if (GetCommState(userdata->huart, &dcb))
+    {
+        dcb.BaudRate = userdata->baudrate;
+        dcb.ByteSize = 8;
+        dcb.Parity = NOPARITY;
+        dcb.StopBits = ONESTOPBIT;
+        dcb.fBinary = TRUE;
+        dcb.fOutxCtsFlow = FALSE;
+        dcb.fOutX = FALSE;
+        dcb.fInX = FALSE;
+        SetCommState(userdata->huart, &dcb);
+    }
+    PurgeComm(userdata->huart, PURGE_RXCLEAR | PURGE_TXCLEAR);
+
     return 0;
 }
 
-static int apdu_interface_connect(struct euicc_ctx *ctx)
+static void at_device_close(struct at_userdata *userdata)
+{
+    if (userdata->huart != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(userdata->huart);
+    }
+    userdata->huart = INVALID_HANDLE_VALUE;
+}
+
+// Returns the number of bytes read, 0 on timeout
+static int at_device_read(struct at_userdata *userdata, uint8_t *buffer, uint32_t buffer_len)
 {
-    const char *device;
+    COMMTIMEOUTS timeouts;
+    DWORD n;
 
-    logic_channel = 0;
+    // Return as soon as anything arrives, or after the timeout
+    memset(&timeouts, 0, sizeof(timeouts));
+    timeouts.ReadIntervalTimeout = MAXDWORD;
+    timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+    timeouts.ReadTotalTimeoutConstant = userdata->timeout;
+    timeouts.WriteTotalTimeoutConstant = userdata->timeout;
+    SetCommTimeouts(userdata->huart, &timeouts);
 
-    if (!(device = getenv("AT_DEVICE")))
+    if (!ReadFile(userdata->huart, buffer, buffer_len, &n, NULL))
     {
-        device = "/dev/ttyUSB0";
+        return -1;
     }
+    return n;
+}
+
+static int at_device_write(struct at_userdata *userdata, const char *data, uint32_t data_len)
+{
+    DWORD n;
 
-    fuart = fopen(device, "r+");
-    if (fuart == NULL)
+    while (data_len > 0)
     {
-        fprintf(stderr, "Failed to open device: %s\n", device);
-        return -1;
+        if (!WriteFile(userdata->huart, data, data_len, &n, NULL) || n == 0)
+        {
+            return -1;
+        }
+        data += n;
+        data_len -= n;
     }
+    return 0;
+}
 
-    fprintf(fuart, "AT+CCHO=?\r\n");
-    if (at_expect(NULL, NULL))
+static void at_device_discard(struct at_userdata *userdata)
+{
+    PurgeComm(userdata->huart, PURGE_RXCLEAR);
+}
+#else
+static speed_t at_baudrate_speed(int baudrate)
+{
+    switch (baudrate)
     {
-        fprintf(stderr, "Device missing AT+CCHO support\n");
-        return -1;
+    case 9600:
+        return B9600;
+    case 19200:
+        return B19200;
+    case 38400:
+        return B38400;
+    case 57600:
+        return B57600;
+    case 115200:
+        return B115200;
+    case 230400:
+        return B230400;
+#ifdef B460800
+    case 460800:
+        return B460800;
+#endif
+#ifdef B921600
+    case 921600:
+        return B921600;
+#endif
+    default:
+        return 0;
     }
-    fprintf(fuart, "AT+CCHC=?\r\n");
-    if (at_expect(NULL, NULL))
+}
+
+static int at_device_open(struct at_userdata *userdata)
+{
+    struct termios tio;
+    speed_t speed;
+
+    userdata->fd = open(userdata->device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (userdata->fd < 0)
     {
-        fprintf(stderr, "Device missing AT+CCHC support\n");
         return -1;
     }
-    fprintf(fuart, "AT+CGLA=?\r\n");
-    if (at_expect(NULL, NULL))
+
+    // Plain files and pipes used for testing have no line settings
+    if (isatty(userdata->fd))
     {
-        fprintf(stderr, "Device missing AT+CGLA support\n");
-        return -1;
+        if (tcgetattr(userdata->fd, &tio) < 0)
+        {
+            goto err;
+        }
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+        speed = at_baudrate_speed(userdata->baudrate);
+        if (speed == 0)
+        {
+            fprintf(stderr, "Unsupported baud rate: %d\n", userdata->baudrate);
+            goto err;
+        }
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+        if (tcsetattr(userdata->fd, TCSANOW, &tio) < 0)
+        {
+            goto err;
+        }
+        tcflush(userdata->fd, TCIOFLUSH);
     }
 
     return 0;
+
+err:
+    close(userdata->fd);
+    userdata->fd = -1;
+    return -1;
 }
 
-static void apdu_interface_disconnect(struct euicc_ctx *ctx)
+static void at_device_close(struct at_userdata *userdata)
 {
-    fclose(fuart);
-    fuart = NULL;
-    logic_channel = 0;
+    if (userdata->fd >= 0)
+    {
+        close(userdata->fd);
+    }
+    userdata->fd = -1;
 }
 
-static int apdu_interface_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+// Returns the number of bytes read, 0 on timeout
+static int at_device_read(struct at_userdata *userdata, uint8_t *buffer, uint32_t buffer_len)
 {
-    int fret = 0;
+    struct pollfd pfd;
+    ssize_t n;
     int ret;
-    char *response = NULL;
-    char *hexstr = NULL;
-
-    *rx = NULL;
-    *rx_len = 0;
 
-    if (!logic_channel)
+    while (1)
     {
-        return -1;
+        pfd.fd = userdata->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        ret = poll(&pfd, 1, userdata->timeout);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return ret;
+        }
+
+        n = read(userdata->fd, buffer, buffer_len);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            // The device went away (USB modem reset, etc.)
+            return -1;
+        }
+        return n;
     }
+}
 
-    fprintf(fuart, "AT+CGLA=%d,%u,\"", logic_channel, tx_len * 2);
-    for (uint32_t i = 0; i < tx_len; i++)
+static int at_device_write(struct at_userdata *userdata, const char *data, uint32_t data_len)
+{
+    struct pollfd pfd;
+    ssize_t n;
+    int ret;
+
+    while (data_len > 0)
     {
-        fprintf(fuart, "%02X", (uint8_t)(tx[i] & 0xFF));
+        n = write(userdata->fd, data, data_len);
+        if (n > 0)
+        {
+            data += n;
+            data_len -= n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN)
+        {
+            return -1;
+        }
+
+        pfd.fd = userdata->fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        ret = poll(&pfd, 1, userdata->timeout);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return -1;
+        }
     }
-    fprintf(fuart, "\"\r\n");
-    if (at_expect(&response, "+CGLA: "))
+    return 0;
+}
+
+static void at_device_discard(struct at_userdata *userdata)
+{
+    if (isatty(userdata->fd))
     {
-        goto err;
+        tcflush(userdata->fd, TCIFLUSH);
     }
-    if (response == NULL)
+}
+#endif
+
+// Takes the next line out of the ring into userdata->response, without the line terminator. Returns 1 while the ring
+// holds no complete line, the part that arrived stays in response for the next call.
+static int at_take_line(struct at_userdata *userdata)
+{
+    if (userdata->response_done)
     {
-        goto err;
+        userdata->response_len = 0;
+        userdata->response_done = 0;
     }
 
-    strtok(response, ",");
-    hexstr = strtok(NULL, ",");
-    if (!hexstr)
+    while (userdata->rbuf_len > 0)
     {
-        goto err;
+        char c = userdata->rbuf[userdata->rbuf_start];
+
+        userdata->rbuf_start = (userdata->rbuf_start + 1) % AT_READ_BUFFER_SIZE;
+        userdata->rbuf_len--;
+
+        if (c == '\r' || c == '\n')
+        {
+            if (userdata->response_len == 0)
+            {
+                continue;
+            }
+            userdata->response[userdata->response_len] = '\0';
+            userdata->response_done = 1;
+            return 0;
+        }
+
+        if (userdata->response_len + 1 >= userdata->response_capacity)
+        {
+            uint32_t capacity = userdata->response_capacity ? userdata->response_capacity * 2 : 256;
+            char *response_new = realloc(userdata->response, capacity);
+            if (response_new == NULL)
+            {
+                return -1;
+            }
+            userdata->response = response_new;
+            userdata->response_capacity = capacity;
+        }
+        userdata->response[userdata->response_len++] = c;
     }
-    if (hexstr[0] == '"')
+
+    return 1;
+}
+
+// Refills the free part of the ring, at most up to its physical end. Returns the number of bytes read, 0 on timeout
+static int at_fill(struct at_userdata *userdata)
+{
+    uint32_t tail = (userdata->rbuf_start + userdata->rbuf_len) % AT_READ_BUFFER_SIZE;
+    uint32_t space = AT_READ_BUFFER_SIZE - userdata->rbuf_len;
+    int n;
+
+    if (tail + space > AT_READ_BUFFER_SIZE)
     {
-        hexstr++;
+        space = AT_READ_BUFFER_SIZE - tail;
     }
-    hexstr[strcspn(hexstr, "\"")] = '\0';
 
-    *rx_len = strlen(hexstr) / 2;
-    *rx = malloc(*rx_len);
-    if (!*rx)
+    n = at_device_read(userdata, userdata->rbuf + tail, space);
+    if (n > 0)
     {
-        goto err;
+        userdata->rbuf_len += n;
     }
+    return n;
+}
 
-    ret = euicc_hexutil_hex2bin_r(*rx, *rx_len, hexstr, strlen(hexstr));
-    if (ret < 0)
+// Reads one line into userdata->response, without the line terminator
+static int at_read_line(struct at_userdata *userdata)
+{
+    int ret;
+
+    while ((ret = at_take_line(userdata)) == 1)
     {
-        goto err;
+        int n = at_fill(userdata);
+
+        if (n == 0)
+        {
+            fprintf(stderr, "AT response timed out after %d ms\n", userdata->timeout);
+            return -1;
+        }
+        if (n < 0)
+        {
+            return -1;
+        }
     }
-    *rx_len = ret;
 
-    goto exit;
+    return ret;
+}
+
+static int at_is_final_error(const char *line)
+{
+    return strcmp(line, "ERROR") == 0 || strncmp(line, "+CME ERROR", 10) == 0 || strncmp(line, "+CMS ERROR", 10) == 0;
+}
+
+static int at_expect(struct at_userdata *userdata, char **response, const char *expected)
+{
+    if (response)
+        *response = NULL;
+
+    while (1)
+    {
+        if (at_read_line(userdata) < 0)
+        {
+            goto err;
+        }
+        if (userdata->debug)
+            printf("AT_DEBUG: %s\r\n", userdata->response);
+        if (at_is_final_error(userdata->response))
+        {
+            goto err;
+        }
+        else if (strcmp(userdata->response, "OK") == 0)
+        {
+            return 0;
+        }
+        else if (expected && response && *response == NULL && strncmp(userdata->response, expected, strlen(expected)) == 0)
+        {
+            *response = strdup(userdata->response + strlen(expected));
+        }
+        // Anything else is command echo or an unsolicited result code
+    }
 
 err:
-    fret = -1;
-    free(*rx);
-    *rx = NULL;
-    *rx_len = 0;
-exit:
-    free(response);
-    return fret;
+    if (response)
+    {
+        free(*response);
+        *response = NULL;
+    }
+    return -1;
 }
 
-static int apdu_interface_logic_channel_open(struct euicc_ctx *ctx, const uint8_t *aid, uint8_t aid_len)
+// Whatever is still pending belongs to an earlier command that timed out, or is a URC
+static void at_discard(struct at_userdata *userdata)
 {
-    char *response;
+    userdata->rbuf_start = 0;
+    userdata->rbuf_len = 0;
+    userdata->response_len = 0;
+    userdata->response_done = 0;
+    at_device_discard(userdata);
+}
+
+static int at_write(struct at_userdata *userdata, const char *data, uint32_t data_len)
+{
+    at_discard(userdata);
+
+    return at_device_write(userdata, data, data_len);
+}
+
+static int at_line_reserve(struct at_userdata *userdata, uint32_t need)
+{
+    char *line_new;
 
-    if (logic_channel)
+    if (userdata->line_capacity >= need)
+    {
+        return 0;
+    }
+    line_new = realloc(userdata->line, need);
+    if (line_new == NULL)
     {
-        return logic_channel;
+        return -1;
     }
+    userdata->line = line_new;
+    userdata->line_capacity = need;
+    return 0;
+}
 
-    for (int i = 1; i <= 4; i++)
+// Formats one command line into userdata->line, returns its length
+static int at_line_vcommand(struct at_userdata *userdata, const char *fmt, va_list args)
+{
+    int len;
+
+    if (at_line_reserve(userdata, AT_COMMAND_SIZE) < 0)
     {
-        fprintf(fuart, "AT+CCHC=%d\r\n", i);
-        at_expect(NULL, NULL);
+        return -1;
     }
-    fprintf(fuart, "AT+CCHO=\"");
-    for (int i = 0; i < aid_len; i++)
+    len = vsnprintf(userdata->line, AT_COMMAND_SIZE - 2, fmt, args);
+    if (len < 0 || len >= AT_COMMAND_SIZE - 2)
     {
-        fprintf(fuart, "%02X", (uint8_t)(aid[i] & 0xFF));
+        return -1;
     }
-    fprintf(fuart, "\"\r\n");
-    if (at_expect(&response, "+CCHO: "))
+    userdata->line[len++] = '\r';
+    userdata->line[len++] = '\n';
+
+    return len;
+}
+
+// Puts prefix, data in hex and the closing quote into userdata->line as a single line, so the modem never sees it
+// dribble in. Returns its length.
+static int at_line_hex(struct at_userdata *userdata, const char *prefix, const uint8_t *data, uint32_t data_len)
+{
+    static const char suffix[] = "\"\r\n";
+    uint32_t prefix_len = strlen(prefix);
+    uint32_t need = prefix_len + 2 * data_len + sizeof(suffix);
+    uint32_t len;
+
+    if (at_line_reserve(userdata, need) < 0)
     {
         return -1;
     }
-    if (response == NULL)
+
+    memcpy(userdata->line, prefix, prefix_len);
+    if (euicc_hexutil_bin2hex_upper(userdata->line + prefix_len, need - prefix_len, data, data_len) < 0)
     {
         return -1;
     }
-    logic_channel = atoi(response);
+    len = prefix_len + 2 * data_len;
+    memcpy(userdata->line + len, suffix, sizeof(suffix) - 1);
+    len += sizeof(suffix) - 1;
 
-    return logic_channel;
+    return len;
 }
 
-static void apdu_interface_logic_channel_close(struct euicc_ctx *ctx, uint8_t channel)
+static int at_command(struct at_userdata *userdata, const char *fmt, ...)
 {
-    if (!logic_channel)
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = at_line_vcommand(userdata, fmt, args);
+    va_end(args);
+    if (len < 0)
     {
-        return;
+        return -1;
     }
-    fprintf(fuart, "AT+CCHC=%d\r\n", logic_channel);
-    at_expect(NULL, NULL);
+
+    return at_write(userdata, userdata->line, len);
 }
 
-static int libapduinterface_init(struct euicc_apdu_interface *ifstruct)
+static int at_send_hex(struct at_userdata *userdata, const char *prefix, const uint8_t *data, uint32_t data_len)
 {
-    memset(ifstruct, 0, sizeof(struct euicc_apdu_interface));
+    int len = at_line_hex(userdata, prefix, data, data_len);
 
-    ifstruct->connect = apdu_interface_connect;
-    ifstruct->disconnect = apdu_interface_disconnect;
-    ifstruct->logic_channel_open = apdu_interface_logic_channel_open;
-    ifstruct->logic_channel_close = apdu_interface_logic_channel_close;
-    ifstruct->transmit = apdu_interface_transmit;
+    if (len < 0)
+    {
+        return -1;
+    }
 
-    return 0;
+    return at_write(userdata, userdata->line, len);
 }
 
-static int libapduinterface_main(int argc, char **argv)
+// Identifies the modem with ATI and AT+CGSN in one round trip, all information lines joined by '|'
+static int at_identity(struct at_userdata *userdata, char *identity, uint32_t identity_len)
 {
-    return 0;
+    uint32_t len = 0;
+
+    identity[0] = '\0';
+
+    if (at_command(userdata, "ATI;+CGSN") < 0)
+    {
+        return -1;
+    }
+
+    while (1)
+    {
+        uint32_t n;
+
+        if (at_read_line(userdata) < 0)
+        {
+            return -1;
+        }
+        if (userdata->debug)
+            printf("AT_DEBUG: %s\r\n", userdata->response);
+        if (at_is_final_error(userdata->response))
+        {
+            return -1;
+        }
+        if (strcmp(userdata->response, "OK") == 0)
+        {
+            break;
+        }
+        if (strncmp(userdata->response, "AT", 2) == 0)
+        {
+            continue;
+        }
+
+        n = strlen(userdata->response);
+        if (len + n + 2 > identity_len)
+        {
+            return -1;
+        }
+        if (len > 0)
+        {
+            identity[len++] = '|';
+        }
+        memcpy(identity + len, userdata->response, n + 1);
+        len += n;
+    }
+
+    return len > 0 ? 0 : -1;
 }
 
-static void libapduinterface_fini(void)
+static int at_cache_lookup(const char *path, const char *identity)
 {
+    FILE *fcache;
+    char line[AT_IDENTITY_SIZE + 2];
+    int found = 0;
+
+    fcache = fopen(path, "r");
+    if (fcache == NULL)
+    {
+        return 0;
+    }
+
+    while (!found && fgets(line, sizeof(line), fcache))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        found = strcmp(line, identity) == 0;
+    }
+
+    fclose(fcache);
+    return found;
+}
+
+static void at_cache_store(const char *path, const char *identity)
+{
+    FILE *fcache;
+
+    fcache = fopen(path, "a");
+    if (fcache == NULL)
+    {
+        return;
+    }
+    fprintf(fcache, "%s\n", identity);
+    fclose(fcache);
+}
+
+static int at_probe(struct at_userdata *userdata)
+{
+    if (at_command(userdata, "AT+CCHO=?") < 0 || at_expect(userdata, NULL, NULL))
+    {
+        fprintf(stderr, "Device missing AT+CCHO support\n");
+        return -1;
+    }
+    if (at_command(userdata, "AT+CCHC=?") < 0 || at_expect(userdata, NULL, NULL))
+    {
+        fprintf(stderr, "Device missing AT+CCHC support\n");
+        return -1;
+    }
+    if (at_command(userdata, "AT+CGLA=?") < 0 || at_expect(userdata, NULL, NULL))
+    {
+        fprintf(stderr, "Device missing AT+CGLA support\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int apdu_interface_connect(struct euicc_ctx *ctx)
+{
+    struct at_userdata *userdata = ctx->apdu.interface->userdata;
+    const char *cache_path = getenv("AT_CACHE_FILE");
+    char identity[AT_IDENTITY_SIZE];
+
+    userdata->logic_channel = 0;
+    userdata->rbuf_start = 0;
+    userdata->rbuf_len = 0;
+
+    if (userdata->lock == APDU_LOCK_NONE && (userdata->lock = apdu_lock_acquire(ctx, "at", userdata->device)) == -1)
+    {
+        userdata->lock = APDU_LOCK_NONE;
+        return -1;
+    }
+
+    if (at_device_open(userdata) < 0)
+    {
+        fprintf(stderr, "Failed to open device: %s\n", userdata->device);
+        return -1;
+    }
+
+    // The same instance reconnecting talks to the modem it already probed
+    if (userdata->probed)
+    {
+        return 0;
+    }
+
+    if (cache_path == NULL)
+    {
+        if (at_probe(userdata) < 0)
+        {
+            return -1;
+        }
+        userdata->probed = 1;
+        return 0;
+    }
+
+    if (getenv("AT_CACHE_INVALIDATE"))
+    {
+        remove(cache_path);
+    }
+
+    // Modems that cannot identify themselves are probed every time
+    if (at_identity(userdata, identity, sizeof(identity)) < 0)
+    {
+        identity[0] = '\0';
+    }
+    strcpy(userdata->identity, identity);
+
+    if (identity[0] == '\0' || !at_cache_lookup(cache_path, identity))
+    {
+        if (at_probe(userdata) < 0)
+        {
+            return -1;
+        }
+        if (identity[0] != '\0')
+        {
+            at_cache_store(cache_path, identity);
+        }
+    }
+    userdata->probed = 1;
+
+    return 0;
+}
+
+// The modem the card sits in, asked once per instance
+static int apdu_interface_identity(struct euicc_ctx *ctx, char *identity, uint32_t identity_len)
+{
+    struct at_userdata *userdata = ctx->apdu.interface->userdata;
+
+    if (userdata->identity[0] == '\0' && at_identity(userdata, userdata->identity, sizeof(userdata->identity)) < 0)
+    {
+        userdata->identity[0] = '\0';
+        return -1;
+    }
+    if (strlen(userdata->identity) >= identity_len)
+    {
+        return -1;
+    }
+    strcpy(identity, userdata->identity);
+    return 0;
+}
+
+static void apdu_interface_disconnect(struct euicc_ctx *ctx)
+{
+    struct at_userdata *userdata = ctx->apdu.interface->userdata;
+
+    at_device_close(userdata);
+    userdata->logic_channel = 0;
+    apdu_lock_release(userdata->lock);
+    userdata->lock = APDU_LOCK_NONE;
+}
+
+// The modem stays open and probed, it reset the card itself and only the channel went away with it
+static int apdu_interface_reconnect(struct euicc_ctx *ctx)
+{
+    struct at_userdata *userdata = ctx->apdu.interface->userdata;
+
+    userdata->logic_channel = 0;
+    return 0;
+}
+
+// The hex string of a +CGLA: <length>,"<response>" line, cut out in place
+static char *at_cgla_hexstr(char *response)
+{
+    char *hexstr;
+
+    strtok(response, ",");
+    hexstr = strtok(NULL, ",");
+    if (!hexstr)
+    {
+        return NULL;
+    }
+    if (hexstr[0] == '"')
+    {
+        hexstr++;
+    }
+    hexstr[strcspn(hexstr, "\"")] = '\0';
+
+    return hexstr;
+}
+
+static int at_transmit_cgla(struct at_userdata *userdata, char **response, char **hexstr, const uint8_t *tx, uint32_t tx_len)
+{
+    char prefix[32];
+
+    *response = NULL;
+    *hexstr = NULL;
+
+    if (!userdata->logic_channel)
+    {
+        return -1;
+    }
+
+    snprintf(prefix, sizeof(prefix), "AT+CGLA=%d,%u,\"", userdata->logic_channel, tx_len * 2);
+    if (at_send_hex(userdata, prefix, tx, tx_len) < 0)
+    {
+        return -1;
+    }
+    if (at_expect(userdata, response, "+CGLA: "))
+    {
+        return -1;
+    }
+    if (*response == NULL)
+    {
+        return -1;
+    }
+
+    *hexstr = at_cgla_hexstr(*response);
+
+    return *hexstr ? 0 : -1;
+}
+
+static int at_transmit_lowlevel(struct euicc_ctx *ctx, char **response, char **hexstr, const uint8_t *tx, uint32_t tx_len)
+{
+    struct at_userdata *userdata = ctx->apdu.interface->userdata;
+    int ret;
+
+    // ctx may ask for less than AT_TIMEOUT, or its deadline may be closer
+    userdata->timeout = euicc_timeout_ms(ctx, ctx->apdu.timeout_ms ? ctx->apdu.timeout_ms : (uint32_t)userdata->timeout_default);
+    ret = at_transmit_cgla(userdata, response, hexstr, tx, tx_len);
+    userdata->timeout = userdata->timeout_default;
+
+    return ret;
+}
+
+static int apdu_interface_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    int fret = 0;
+    int ret;
+    char *response = NULL;
+    char *hexstr = NULL;
+
+    *rx = NULL;
+    *rx_len = 0;
+
+    if (at_transmit_lowlevel(ctx, &response, &hexstr, tx, tx_len) < 0)
+    {
+        goto err;
+    }
+
+    *rx_len = strlen(hexstr) / 2;
+    *rx = malloc(*rx_len);
+    if (!*rx)
+    {
+        goto err;
+    }
+
+    ret = euicc_hexutil_hex2bin_r(*rx, *rx_len, hexstr, strlen(hexstr));
+    if (ret < 0)
+    {
+        goto err;
+    }
+    *rx_len = ret;
+
+    goto exit;
+
+err:
+    fret = -1;
+    free(*rx);
+    *rx = NULL;
+    *rx_len = 0;
+exit:
+    free(response);
+    return fret;
+}
+
+static int apdu_interface_transmit_into(struct euicc_ctx *ctx, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    int fret = 0;
+    int ret;
+    char *response = NULL;
+    char *hexstr = NULL;
+
+    *rx_len = 0;
+
+    if (at_transmit_lowlevel(ctx, &response, &hexstr, tx, tx_len) < 0)
+    {
+        goto err;
+    }
+
+    ret = euicc_hexutil_hex2bin_r(rx, rx_cap, hexstr, strlen(hexstr));
+    if (ret < 0)
+    {
+        goto err;
+    }
+    *rx_len = ret;
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    free(response);
+    return fret;
+}
+
+static int apdu_interface_logic_channel_open(struct euicc_ctx *ctx, const uint8_t *aid, uint8_t aid_len)
+{
+    struct at_userdata *userdata = ctx->apdu.interface->userdata;
+    char *response;
+
+    if (userdata->logic_channel)
+    {
+        return userdata->logic_channel;
+    }
+
+    for (int i = 1; i <= 4; i++)
+    {
+        if (at_command(userdata, "AT+CCHC=%d", i) < 0)
+        {
+            return -1;
+        }
+        at_expect(userdata, NULL, NULL);
+    }
+    if (at_send_hex(userdata, "AT+CCHO=\"", aid, aid_len) < 0)
+    {
+        return -1;
+    }
+    if (at_expect(userdata, &response, "+CCHO: "))
+    {
+        return -1;
+    }
+    if (response == NULL)
+    {
+        return -1;
+    }
+    userdata->logic_channel = atoi(response);
+    free(response);
+
+    return userdata->logic_channel;
+}
+
+static void apdu_interface_logic_channel_close(struct euicc_ctx *ctx, uint8_t channel)
+{
+    struct at_userdata *userdata = ctx->apdu.interface->userdata;
+
+    if (!userdata->logic_channel)
+    {
+        return;
+    }
+    if (at_command(userdata, "AT+CCHC=%d", userdata->logic_channel) == 0)
+    {
+        at_expect(userdata, NULL, NULL);
+    }
+}
+
+LPAC_BIND_APDU_DEFINE(apdu_interface_transmit, apdu_interface_transmit_into)
+
+// Settings from the environment, the device is not opened yet
+static int at_userdata_init(struct at_userdata *userdata, const char *device)
+{
+    userdata->device = strdup(device);
+    if (userdata->device == NULL)
+    {
+        return -1;
+    }
+#ifdef _WIN32
+    userdata->huart = INVALID_HANDLE_VALUE;
+#else
+    userdata->fd = -1;
+#endif
+    userdata->lock = APDU_LOCK_NONE;
+
+    userdata->baudrate = getenv("AT_BAUDRATE") ? atoi(getenv("AT_BAUDRATE")) : AT_BAUDRATE_DEFAULT;
+    if (userdata->baudrate <= 0)
+    {
+        userdata->baudrate = AT_BAUDRATE_DEFAULT;
+    }
+    userdata->timeout_default = getenv("AT_TIMEOUT") ? atoi(getenv("AT_TIMEOUT")) : AT_TIMEOUT_DEFAULT;
+    if (userdata->timeout_default <= 0)
+    {
+        userdata->timeout_default = AT_TIMEOUT_DEFAULT;
+    }
+    userdata->timeout = userdata->timeout_default;
+    userdata->debug = getenv("AT_DEBUG") != NULL;
+
+    return 0;
+}
+
+static void at_userdata_fini(struct at_userdata *userdata)
+{
+    at_device_close(userdata);
+    apdu_lock_release(userdata->lock);
+    userdata->lock = APDU_LOCK_NONE;
+    free(userdata->device);
+    free(userdata->line);
+    free(userdata->response);
+}
+
+static int libapduinterface_init(struct euicc_apdu_interface *ifstruct, const char *device)
+{
+    struct at_userdata *userdata;
+
+    memset(ifstruct, 0, sizeof(struct euicc_apdu_interface));
+
+    if (device == NULL)
+    {
+        device = getenv("AT_DEVICE");
+    }
+    if (device == NULL)
+    {
+        device = "/dev/ttyUSB0";
+    }
+
+    userdata = calloc(1, sizeof(struct at_userdata));
+    if (userdata == NULL)
+    {
+        return -1;
+    }
+    if (at_userdata_init(userdata, device) < 0)
+    {
+        free(userdata);
+        return -1;
+    }
+
+    ifstruct->connect = apdu_interface_connect;
+    ifstruct->disconnect = apdu_interface_disconnect;
+    ifstruct->logic_channel_open = apdu_interface_logic_channel_open;
+    ifstruct->logic_channel_close = apdu_interface_logic_channel_close;
+    ifstruct->transmit = LPAC_BIND_APDU_TRANSMIT(apdu_interface_transmit);
+    ifstruct->transmit_into = LPAC_BIND_APDU_TRANSMIT_INTO(apdu_interface_transmit_into);
+    ifstruct->identity = apdu_interface_identity;
+    ifstruct->reconnect = apdu_interface_reconnect;
+    ifstruct->extended_length = 1;
+    ifstruct->userdata = userdata;
+
+    return 0;
+}
+
+static int libapduinterface_main(struct euicc_apdu_interface *ifstruct, int argc, char **argv)
+{
+    return 0;
+}
+
+static void libapduinterface_fini(struct euicc_apdu_interface *ifstruct)
+{
+    struct at_userdata *userdata = ifstruct->userdata;
+
+    if (userdata == NULL)
+    {
+        return;
+    }
+
+    at_userdata_fini(userdata);
+    free(userdata);
+    ifstruct->userdata = NULL;
+}
+
+#if !defined(_WIN32) && !defined(LPAC_BIND_APDU)
+/*
+ * The AT engine of lpac fleet. The fleet process owns every modem and runs their AT+CCHO, AT+CGLA and AT+CCHC exchanges
+ * from its own poll loop: each modem is a small state machine that writes a command line, frames the answer as it
+ * arrives and moves on to the next command, so no modem ever waits for another. The workers hand over their requests
+ * as STDIO_APDU_FRAMED bodies and get the response ecode and data back, one request per modem at a time.
+ */
+#define AT_ENGINE_FUNC_CONNECT 'c'
+#define AT_ENGINE_FUNC_DISCONNECT 'd'
+#define AT_ENGINE_FUNC_LOGIC_CHANNEL_OPEN 'o'
+#define AT_ENGINE_FUNC_LOGIC_CHANNEL_CLOSE 'x'
+#define AT_ENGINE_FUNC_TRANSMIT 't'
+
+struct at_engine_modem
+{
+    struct at_userdata at;
+    // The request being worked on, 0 when idle, and which of its commands is out
+    uint8_t func;
+    uint8_t *param;
+    uint32_t param_len;
+    int step;
+    // What of the command line in at.line is still to be written
+    uint32_t write_off;
+    uint32_t write_len;
+    uint64_t deadline_us;
+    // The information line the command answers with, what followed it, and whether ERROR only ends the command
+    const char *expect;
+    char *found;
+    uint8_t tolerant;
+    void (*done)(void *userdata, int ecode, const uint8_t *data, uint32_t data_len);
+    void *userdata;
+};
+
+static const char *const at_engine_probes[] = {"AT+CCHO=?", "AT+CCHC=?", "AT+CGLA=?"};
+
+struct euicc_driver_at_engine
+{
+    struct at_engine_modem *modems;
+    int count;
+    // Only asked whether to give up waiting for a lock, LPAC_APDU_LOCK_TIMEOUT bounds the wait
+    struct euicc_ctx lock_ctx;
+};
+
+static void at_engine_finish(struct at_engine_modem *modem, int ecode, const uint8_t *data, uint32_t data_len)
+{
+    void (*done)(void *userdata, int ecode, const uint8_t *data, uint32_t data_len) = modem->done;
+
+    modem->func = 0;
+    modem->done = NULL;
+    free(modem->param);
+    modem->param = NULL;
+    modem->param_len = 0;
+    free(modem->found);
+    modem->found = NULL;
+
+    if (done)
+    {
+        done(modem->userdata, ecode, data, data_len);
+    }
+}
+
+static int at_engine_line(struct at_userdata *userdata, const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = at_line_vcommand(userdata, fmt, args);
+    va_end(args);
+
+    return len;
+}
+
+// Puts the command for modem->step of the request into at.line, 1 once the request has none left
+static int at_engine_command(struct at_engine_modem *modem)
+{
+    struct at_userdata *at = &modem->at;
+    char prefix[32];
+    int len = -1;
+
+    modem->expect = NULL;
+    modem->tolerant = 0;
+
+    switch (modem->func)
+    {
+    case AT_ENGINE_FUNC_CONNECT:
+        if (at->probed || modem->step >= (int)(sizeof(at_engine_probes) / sizeof(at_engine_probes[0])))
+        {
+            return 1;
+        }
+        len = at_engine_line(at, "%s", at_engine_probes[modem->step]);
+        break;
+    case AT_ENGINE_FUNC_LOGIC_CHANNEL_OPEN:
+        // Channels left open by an earlier run are closed first, as the AT backend does
+        if (modem->step < 4)
+        {
+            len = at_engine_line(at, "AT+CCHC=%d", modem->step + 1);
+            modem->tolerant = 1;
+        }
+        else if (modem->step == 4)
+        {
+            len = at_line_hex(at, "AT+CCHO=\"", modem->param, modem->param_len);
+            modem->expect = "+CCHO: ";
+        }
+        else
+        {
+            return 1;
+        }
+        break;
+    case AT_ENGINE_FUNC_LOGIC_CHANNEL_CLOSE:
+        if (modem->step >= 1)
+        {
+            return 1;
+        }
+        len = at_engine_line(at, "AT+CCHC=%d", at->logic_channel);
+        modem->tolerant = 1;
+        break;
+    case AT_ENGINE_FUNC_TRANSMIT:
+        if (modem->step >= 1)
+        {
+            return 1;
+        }
+        snprintf(prefix, sizeof(prefix), "AT+CGLA=%d,%u,\"", at->logic_channel, modem->param_len * 2);
+        len = at_line_hex(at, prefix, modem->param, modem->param_len);
+        modem->expect = "+CGLA: ";
+        break;
+    }
+    if (len < 0)
+    {
+        return -1;
+    }
+
+    at_discard(at);
+    modem->write_off = 0;
+    modem->write_len = len;
+    modem->deadline_us = euicc_now_us() + (uint64_t)at->timeout_default * 1000;
+
+    return 0;
+}
+
+// Every command of the request went through
+static void at_engine_complete(struct at_engine_modem *modem)
+{
+    struct at_userdata *at = &modem->at;
+    uint8_t *rx;
+    char *hexstr;
+    int ret;
+
+    switch (modem->func)
+    {
+    case AT_ENGINE_FUNC_CONNECT:
+        at->probed = 1;
+        at_engine_finish(modem, 0, NULL, 0);
+        return;
+    case AT_ENGINE_FUNC_LOGIC_CHANNEL_OPEN:
+        at->logic_channel = modem->found ? atoi(modem->found) : 0;
+        at_engine_finish(modem, at->logic_channel ? at->logic_channel : -1, NULL, 0);
+        return;
+    case AT_ENGINE_FUNC_LOGIC_CHANNEL_CLOSE:
+        at->logic_channel = 0;
+        at_engine_finish(modem, 0, NULL, 0);
+        return;
+    case AT_ENGINE_FUNC_TRANSMIT:
+        hexstr = modem->found ? at_cgla_hexstr(modem->found) : NULL;
+        rx = hexstr ? malloc(strlen(hexstr) / 2 + 1) : NULL;
+        ret = rx ? euicc_hexutil_hex2bin_r(rx, strlen(hexstr) / 2 + 1, hexstr, strlen(hexstr)) : -1;
+        if (ret < 0)
+        {
+            at_engine_finish(modem, -1, NULL, 0);
+        }
+        else
+        {
+            at_engine_finish(modem, 0, rx, ret);
+        }
+        free(rx);
+        return;
+    }
+}
+
+// Runs the request on for as long as it does not have to wait for the modem
+static void at_engine_advance(struct at_engine_modem *modem)
+{
+    struct at_userdata *at = &modem->at;
+    ssize_t n;
+    int ret;
+
+    while (modem->func)
+    {
+        if (modem->write_off < modem->write_len)
+        {
+            n = write(at->fd, at->line + modem->write_off, modem->write_len - modem->write_off);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0 && errno == EAGAIN)
+            {
+                return;
+            }
+            if (n <= 0)
+            {
+                at_engine_finish(modem, -1, NULL, 0);
+                return;
+            }
+            modem->write_off += n;
+            continue;
+        }
+
+        ret = at_take_line(at);
+        if (ret == 1)
+        {
+            // at.timeout is 0, the read only takes what already arrived
+            n = at_fill(at);
+            if (n == 0)
+            {
+                return;
+            }
+            if (n < 0)
+            {
+                at_engine_finish(modem, -1, NULL, 0);
+                return;
+            }
+            continue;
+        }
+        if (ret < 0)
+        {
+            at_engine_finish(modem, -1, NULL, 0);
+            return;
+        }
+
+        if (at->debug)
+            printf("AT_DEBUG: %s\r\n", at->response);
+        if (at_is_final_error(at->response))
+        {
+            if (!modem->tolerant)
+            {
+                if (modem->func == AT_ENGINE_FUNC_CONNECT)
+                {
+                    fprintf(stderr, "Device missing %.7s support\n", at_engine_probes[modem->step]);
+                }
+                at_engine_finish(modem, -1, NULL, 0);
+                return;
+            }
+        }
+        else if (strcmp(at->response, "OK") != 0)
+        {
+            // Anything else is command echo or an unsolicited result code
+            if (modem->expect && modem->found == NULL && strncmp(at->response, modem->expect, strlen(modem->expect)) == 0)
+            {
+                modem->found = strdup(at->response + strlen(modem->expect));
+            }
+            continue;
+        }
+
+        modem->step++;
+        ret = at_engine_command(modem);
+        if (ret < 0)
+        {
+            at_engine_finish(modem, -1, NULL, 0);
+            return;
+        }
+        if (ret == 1)
+        {
+            at_engine_complete(modem);
+            return;
+        }
+    }
+}
+
+struct euicc_driver_at_engine *euicc_driver_at_engine_new(const char *const *devices, int count)
+{
+    struct euicc_driver_at_engine *engine;
+
+    engine = calloc(1, sizeof(struct euicc_driver_at_engine));
+    if (engine == NULL)
+    {
+        return NULL;
+    }
+    engine->modems = calloc(count ? count : 1, sizeof(struct at_engine_modem));
+    if (engine->modems == NULL)
+    {
+        free(engine);
+        return NULL;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (at_userdata_init(&engine->modems[i].at, devices[i]) < 0)
+        {
+            euicc_driver_at_engine_free(engine);
+            return NULL;
+        }
+        engine->modems[i].at.timeout = 0;
+        engine->count++;
+    }
+
+    return engine;
+}
+
+void euicc_driver_at_engine_free(struct euicc_driver_at_engine *engine)
+{
+    if (engine == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < engine->count; i++)
+    {
+        euicc_driver_at_engine_reset(engine, i);
+        at_userdata_fini(&engine->modems[i].at);
+    }
+    free(engine->modems);
+    free(engine);
+}
+
+int euicc_driver_at_engine_submit(struct euicc_driver_at_engine *engine, int index, const uint8_t *body, uint32_t body_len, void (*done)(void *userdata, int ecode, const uint8_t *data, uint32_t data_len), void *userdata)
+{
+    struct at_engine_modem *modem;
+    struct at_userdata *at;
+    int ret;
+
+    if (index < 0 || index >= engine->count || body_len < 1 || engine->modems[index].func)
+    {
+        return -1;
+    }
+    modem = &engine->modems[index];
+    at = &modem->at;
+
+    modem->param = malloc(body_len);
+    if (modem->param == NULL)
+    {
+        return -1;
+    }
+    memcpy(modem->param, body + 1, body_len - 1);
+    modem->param_len = body_len - 1;
+    modem->func = body[0];
+    modem->step = 0;
+    modem->done = done;
+    modem->userdata = userdata;
+
+    switch (modem->func)
+    {
+    case AT_ENGINE_FUNC_CONNECT:
+        at->logic_channel = 0;
+        if (at->fd >= 0)
+        {
+            break;
+        }
+        // Waits here, and holds up the other modems, only while another process has this one
+        if (at->lock == APDU_LOCK_NONE && (at->lock = apdu_lock_acquire(&engine->lock_ctx, "at", at->device)) == -1)
+        {
+            at->lock = APDU_LOCK_NONE;
+            at_engine_finish(modem, -1, NULL, 0);
+            return 0;
+        }
+        if (at_device_open(at) < 0)
+        {
+            fprintf(stderr, "Failed to open device: %s\n", at->device);
+            at_engine_finish(modem, -1, NULL, 0);
+            return 0;
+        }
+        break;
+    case AT_ENGINE_FUNC_DISCONNECT:
+        at_device_close(at);
+        at->logic_channel = 0;
+        apdu_lock_release(at->lock);
+        at->lock = APDU_LOCK_NONE;
+        at_engine_finish(modem, 0, NULL, 0);
+        return 0;
+    case AT_ENGINE_FUNC_LOGIC_CHANNEL_OPEN:
+        if (at->logic_channel)
+        {
+            at_engine_finish(modem, at->logic_channel, NULL, 0);
+            return 0;
+        }
+        break;
+    case AT_ENGINE_FUNC_LOGIC_CHANNEL_CLOSE:
+        if (!at->logic_channel)
+        {
+            at_engine_finish(modem, 0, NULL, 0);
+            return 0;
+        }
+        break;
+    case AT_ENGINE_FUNC_TRANSMIT:
+        if (!at->logic_channel)
+        {
+            at_engine_finish(modem, -1, NULL, 0);
+            return 0;
+        }
+        break;
+    default:
+        // transmit_batch is not offered to the workers
+        at_engine_finish(modem, -1, NULL, 0);
+        return 0;
+    }
+
+    if (at->fd < 0)
+    {
+        at_engine_finish(modem, -1, NULL, 0);
+        return 0;
+    }
+    ret = at_engine_command(modem);
+    if (ret < 0)
+    {
+        at_engine_finish(modem, -1, NULL, 0);
+    }
+    else if (ret == 1)
+    {
+        at_engine_complete(modem);
+    }
+    else
+    {
+        at_engine_advance(modem);
+    }
+
+    return 0;
+}
+
+void euicc_driver_at_engine_reset(struct euicc_driver_at_engine *engine, int index)
+{
+    struct at_engine_modem *modem;
+
+    if (index < 0 || index >= engine->count)
+    {
+        return;
+    }
+    modem = &engine->modems[index];
+
+    modem->done = NULL;
+    at_engine_finish(modem, -1, NULL, 0);
+    at_device_close(&modem->at);
+    modem->at.logic_channel = 0;
+    apdu_lock_release(modem->at.lock);
+    modem->at.lock = APDU_LOCK_NONE;
+}
+
+int euicc_driver_at_engine_poll(struct euicc_driver_at_engine *engine, struct pollfd *pfds, int pfds_max, int *timeout_ms)
+{
+    uint64_t now = euicc_now_us();
+    int count = 0;
+
+    for (int i = 0; i < engine->count && count < pfds_max; i++)
+    {
+        struct at_engine_modem *modem = &engine->modems[i];
+        int wait;
+
+        if (!modem->func)
+        {
+            continue;
+        }
+
+        pfds[count].fd = modem->at.fd;
+        pfds[count].events = modem->write_off < modem->write_len ? POLLOUT : POLLIN;
+        pfds[count].revents = 0;
+        count++;
+
+        wait = modem->deadline_us > now ? (int)((modem->deadline_us - now + 999) / 1000) : 0;
+        if (*timeout_ms < 0 || wait < *timeout_ms)
+        {
+            *timeout_ms = wait;
+        }
+    }
+
+    return count;
+}
+
+void euicc_driver_at_engine_dispatch(struct euicc_driver_at_engine *engine, const struct pollfd *pfds, int pfds_count)
+{
+    uint64_t now;
+
+    for (int i = 0; i < pfds_count; i++)
+    {
+        if (!pfds[i].revents)
+        {
+            continue;
+        }
+        for (int j = 0; j < engine->count; j++)
+        {
+            if (engine->modems[j].func && engine->modems[j].at.fd == pfds[i].fd)
+            {
+                at_engine_advance(&engine->modems[j]);
+                break;
+            }
+        }
+    }
+
+    now = euicc_now_us();
+    for (int i = 0; i < engine->count; i++)
+    {
+        struct at_engine_modem *modem = &engine->modems[i];
+
+        if (modem->func && now >= modem->deadline_us)
+        {
+            fprintf(stderr, "AT response timed out after %d ms on %s\n", modem->at.timeout_default, modem->at.device);
+            at_engine_finish(modem, -1, NULL, 0);
+        }
+    }
 }
+#endif
 
 const struct euicc_driver driver_apdu_at = {
     .type = DRIVER_APDU,
     .name = "at",
-    .init = (int (*)(void *))libapduinterface_init,
-    .main = libapduinterface_main,
-    .fini = libapduinterface_fini,
+    .init = (int (*)(void *, const char *))libapduinterface_init,
+    .main = (int (*)(void *, int, char **))libapduinterface_main,
+    .fini = (void (*)(void *))libapduinterface_fini,
 };
@@ -0,0 +1,39 @@
+#pragma once
+#include <euicc/interface.h>
+
+// Builds with LPAC_BIND_APDU_DRIVER compile the source of that driver with LPAC_BIND_APDU_SELF. Its transmit
+// functions are then exported under the names libeuicc, built with EUICC_BIND_APDU, calls directly instead of
+// through the interface, so LTO can inline the transmit path. Elsewhere these leave the driver as it is.
+int euicc_bound_apdu_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len);
+int euicc_bound_apdu_transmit_into(struct euicc_ctx *ctx, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len);
+
+#ifdef LPAC_BIND_APDU_SELF
+// For the interface the driver hands out
+#define LPAC_BIND_APDU_TRANSMIT(fn) euicc_bound_apdu_transmit
+#define LPAC_BIND_APDU_TRANSMIT_INTO(fn) euicc_bound_apdu_transmit_into
+// Once in the driver, after its transmit functions
+#define LPAC_BIND_APDU_DEFINE(transmit, transmit_into)                                                                                     \
+    int euicc_bound_apdu_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)               \
+    {                                                                                                                                      \
+        return transmit(ctx, rx, rx_len, tx, tx_len);                                                                                      \
+    }                                                                                                                                      \
+    int euicc_bound_apdu_transmit_into(struct euicc_ctx *ctx, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len) \
+    {                                                                                                                                      \
+        return transmit_into(ctx, rx, rx_cap, rx_len, tx, tx_len);                                                                         \
+    }
+// For a driver without transmit_into, which libeuicc then never finds in the interface
+#define LPAC_BIND_APDU_DEFINE_TRANSMIT(transmit)                                                                                           \
+    int euicc_bound_apdu_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)               \
+    {                                                                                                                                      \
+        return transmit(ctx, rx, rx_len, tx, tx_len);                                                                                      \
+    }                                                                                                                                      \
+    int euicc_bound_apdu_transmit_into(struct euicc_ctx *ctx, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len) \
+    {                                                                                                                                      \
+        return -1;                                                                                                                         \
+    }
+#else
+#define LPAC_BIND_APDU_TRANSMIT(fn) fn
+#define LPAC_BIND_APDU_TRANSMIT_INTO(fn) fn
+#define LPAC_BIND_APDU_DEFINE(transmit, transmit_into)
+#define LPAC_BIND_APDU_DEFINE_TRANSMIT(transmit)
+#endif
@@ -8,6 +8,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "bind.h"
+
 #define DEBUG (getenv("GBINDER_APDU_DEBUG") != NULL && strcmp("true", getenv("GBINDER_APDU_DEBUG")) == 0)
 
 #define HIDL_SERVICE_DEVICE "/dev/hwbinder"
@@ -25,7 +27,8 @@
 #define HIDL_SERVICE_ICC_CLOSE_LOGICAL_CHANNEL_CALLBACK (GBINDER_FIRST_CALL_TRANSACTION + 105)
 #define HIDL_SERVICE_ICC_TRANSMIT_APDU_LOGICAL_CHANNEL_CALLBACK (GBINDER_FIRST_CALL_TRANSACTION + 106)
 
-static int lastChannelId = -1;
+#define GBINDER_PIPELINE_DEPTH_DEFAULT 4
+#define GBINDER_SLOT_MAX 2
 
 struct radio_response_info {
     int32_t type;
@@ -58,128 +61,253 @@ static const GBinderWriterType sim_apdu_t = {
     GBINDER_WRITER_STRUCT_NAME_AND_SIZE(struct sim_apdu), sim_apdu_f
 };
 
-static GBinderServiceManager *sm;
-// IRadioResponse
-static GBinderLocalObject *response_callback;
-// IRadio
-static GBinderRemoteObject *remote;
-static GBinderClient *client;
+// One outstanding IRadio request, completed by the response carrying its serial
+struct gbinder_hidl_request {
+    int32_t serial;
+    int done;
+    int32_t error;
+    int32_t intResp;
+    int32_t sw1;
+    int32_t sw2;
+    char *simResponse;
+    uint32_t simResponseLen;
+};
+
+struct gbinder_hidl_userdata {
+    // IRadioResponse
+    GBinderLocalObject *response_callback;
+    // IRadio
+    GBinderRemoteObject *remote;
+    GBinderClient *client;
+
+    // Requested slot, 0 to find the one holding the eUICC
+    int slot;
+    // Slot the IRadio objects above belong to, kept from the first open until fini
+    int boundSlot;
+    int lastChannelId;
+    int32_t lastSerial;
+    int pipelineDepth;
+    char *txHex;
+    uint32_t txHexCapacity;
+
+    // Requests waiting for a response
+    struct gbinder_hidl_request *pending;
+    uint32_t pending_count;
+
+    struct gbinder_hidl_userdata *next;
+};
 
-static GMainLoop *binder_loop;
+// Live instances, so that leaked channels can be closed on exit
+static struct gbinder_hidl_userdata *instances = NULL;
 
-static int lastIntResp = -1;
-static int lastRadioErr = 0;
-static struct icc_io_result lastIccIoResult = {0};
+// Shared by every instance, one per slot is enough for the IRadio proxies
+static GBinderServiceManager *service_manager = NULL;
+static int service_manager_users = 0;
+
+static struct gbinder_hidl_request *find_request(struct gbinder_hidl_userdata *userdata, int32_t serial)
+{
+    for (uint32_t i = 0; i < userdata->pending_count; i++) {
+        if (userdata->pending[i].serial == serial && !userdata->pending[i].done)
+            return &userdata->pending[i];
+    }
+    return NULL;
+}
 
 static GBinderLocalReply *radio_response_transact(
         GBinderLocalObject *obj,
         GBinderRemoteRequest *req,
         guint code, guint flags, int *status, void *user_data)
 {
+    struct gbinder_hidl_userdata *userdata = user_data;
+    struct gbinder_hidl_request *request;
     GBinderReader reader;
 
     gbinder_remote_request_init_reader(req, &reader);
     const struct radio_response_info *resp =
         gbinder_reader_read_hidl_struct(&reader, struct radio_response_info);
-    lastRadioErr = resp->error;
+    if (resp == NULL)
+        return NULL;
+
+    // Responses to requests we are no longer waiting for (e.g. unsolicited ones) are dropped
+    request = find_request(userdata, resp->serial);
+    if (request == NULL)
+        return NULL;
 
-    if (lastRadioErr != 0)
+    request->error = resp->error;
+    if (request->error != 0)
         goto out;
 
     switch (code) {
         case HIDL_SERVICE_ICC_OPEN_LOGICAL_CHANNEL_CALLBACK:
-            gbinder_reader_read_int32(&reader, &lastIntResp);
+            gbinder_reader_read_int32(&reader, &request->intResp);
             break;
         case HIDL_SERVICE_ICC_TRANSMIT_APDU_LOGICAL_CHANNEL_CALLBACK:
             const struct icc_io_result *icc_io_res = gbinder_reader_read_hidl_struct(&reader, struct icc_io_result);
+            if (icc_io_res == NULL) {
+                request->error = -1;
+                break;
+            }
             // We cannot rely on the *req pointer being valid after we return
-            lastIccIoResult.sw1 = icc_io_res->sw1;
-            lastIccIoResult.sw2 = icc_io_res->sw2;
-            lastIccIoResult.simResponse.data.str = strndup(icc_io_res->simResponse.data.str, icc_io_res->simResponse.len);
-            lastIccIoResult.simResponse.len = icc_io_res->simResponse.len;
-            lastIccIoResult.simResponse.owns_buffer = TRUE;
+            request->sw1 = icc_io_res->sw1;
+            request->sw2 = icc_io_res->sw2;
+            request->simResponse = strndup(icc_io_res->simResponse.data.str ? icc_io_res->simResponse.data.str : "", icc_io_res->simResponse.len);
+            request->simResponseLen = request->simResponse ? strlen(request->simResponse) : 0;
             break;
     }
 
 out:
-    g_main_loop_quit(binder_loop);
+    request->done = 1;
     return NULL;
 }
 
-static void cleanup_channel(int id)
+static int32_t next_serial(struct gbinder_hidl_userdata *userdata)
 {
-    GBinderLocalRequest *req = gbinder_client_new_request(client);
+    if (++userdata->lastSerial <= 0)
+        userdata->lastSerial = 1;
+    return userdata->lastSerial;
+}
+
+// Dispatches binder callbacks until the request is answered, without spinning up a main loop each time
+static void wait_request(struct gbinder_hidl_request *request)
+{
+    while (!request->done)
+        g_main_context_iteration(NULL, TRUE);
+}
+
+// Runs one request that is not part of an APDU pipeline
+static int transact_single(struct gbinder_hidl_userdata *userdata, struct gbinder_hidl_request *request, guint code, GBinderLocalRequest *req)
+{
+    int status;
+
+    userdata->pending = request;
+    userdata->pending_count = 1;
+
+    status = gbinder_client_transact_sync_oneway(userdata->client, code, req);
+    if (status >= 0)
+        wait_request(request);
+
+    userdata->pending = NULL;
+    userdata->pending_count = 0;
+    return status;
+}
+
+static void cleanup_channel(struct gbinder_hidl_userdata *userdata, int id)
+{
+    struct gbinder_hidl_request request = { .serial = next_serial(userdata) };
+    GBinderLocalRequest *req = gbinder_client_new_request(userdata->client);
     GBinderWriter writer;
     gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, 1000);
+    gbinder_writer_append_int32(&writer, request.serial);
     gbinder_writer_append_int32(&writer, id);
-    gbinder_client_transact_sync_oneway(client, HIDL_SERVICE_ICC_CLOSE_LOGICAL_CHANNEL, req);
+    transact_single(userdata, &request, HIDL_SERVICE_ICC_CLOSE_LOGICAL_CHANNEL, req);
     gbinder_local_request_unref(req);
-    g_main_loop_run(binder_loop);
 }
 
-static void cleanup(void)
+static void cleanup_instance(struct gbinder_hidl_userdata *userdata)
 {
-    if (lastChannelId != -1) {
-        fprintf(stderr, "Cleaning up leaked APDU channel %d\n", lastChannelId);
-        cleanup_channel(lastChannelId);
-        lastChannelId = -1;
+    if (userdata->lastChannelId != -1) {
+        fprintf(stderr, "Cleaning up leaked APDU channel %d\n", userdata->lastChannelId);
+        cleanup_channel(userdata, userdata->lastChannelId);
+        userdata->lastChannelId = -1;
     }
 }
 
+static void cleanup(void)
+{
+    for (struct gbinder_hidl_userdata *userdata = instances; userdata != NULL; userdata = userdata->next)
+        cleanup_instance(userdata);
+}
+
 static void sighandler(int sig)
 {
     // This would trigger atexit() hooks
     exit(0);
 }
 
-static int try_open_slot(int slotId, const uint8_t *aid, uint32_t aid_len)
+static void unbind_slot(struct gbinder_hidl_userdata *userdata)
+{
+    if (userdata->response_callback) {
+        gbinder_local_object_drop(userdata->response_callback);
+        userdata->response_callback = NULL;
+    }
+    gbinder_client_unref(userdata->client);
+    gbinder_remote_object_unref(userdata->remote);
+    userdata->client = NULL;
+    userdata->remote = NULL;
+    userdata->boundSlot = 0;
+}
+
+// Looks the IRadio service of the slot up and registers our IRadioResponse with it
+static int bind_slot(struct gbinder_hidl_userdata *userdata, int slotId)
 {
-    // First, try to connect to the HIDL service for this slot
     char fqname[255];
+    int status = 0;
+
+    if (userdata->boundSlot == slotId)
+        return 0;
+    unbind_slot(userdata);
+
+    if (service_manager == NULL) {
+        service_manager = gbinder_servicemanager_new(HIDL_SERVICE_DEVICE);
+        if (service_manager == NULL) {
+            fprintf(stderr, "Failed to connect to %s\n", HIDL_SERVICE_DEVICE);
+            return -1;
+        }
+    }
+
     snprintf(fqname, 255, "%s/slot%d", HIDL_SERVICE_IFACE, slotId);
     fprintf(stderr, "Attempting to connect to %s\n", fqname);
 
-    int status = 0;
-    sm = gbinder_servicemanager_new(HIDL_SERVICE_DEVICE);
-    remote = gbinder_remote_object_ref(
-            gbinder_servicemanager_get_service_sync(sm, fqname, &status));
-    client = gbinder_client_new(remote, HIDL_SERVICE_IFACE);
+    userdata->remote = gbinder_remote_object_ref(
+            gbinder_servicemanager_get_service_sync(service_manager, fqname, &status));
+    userdata->client = gbinder_client_new(userdata->remote, HIDL_SERVICE_IFACE);
 
-    if (!client) {
+    if (!userdata->client) {
         fprintf(stderr, "Failed to connect to IRadio\n");
-        gbinder_client_unref(client);
-        gbinder_remote_object_unref(remote);
-        gbinder_servicemanager_unref(sm);
+        unbind_slot(userdata);
         return -1;
     }
 
-    response_callback = gbinder_servicemanager_new_local_object(
-            sm, HIDL_SERVICE_IFACE_CALLBACK, radio_response_transact, NULL);
+    userdata->response_callback = gbinder_servicemanager_new_local_object(
+            service_manager, HIDL_SERVICE_IFACE_CALLBACK, radio_response_transact, userdata);
 
-    GBinderLocalRequest *req = gbinder_client_new_request(client);
+    GBinderLocalRequest *req = gbinder_client_new_request(userdata->client);
     GBinderWriter writer;
     gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_local_object(&writer, response_callback);
+    gbinder_writer_append_local_object(&writer, userdata->response_callback);
     gbinder_writer_append_local_object(&writer, NULL);
-    gbinder_client_transact_sync_reply(client, HIDL_SERVICE_SET_RESPONSE_FUNCTIONS, req, &status);
+    gbinder_client_transact_sync_reply(userdata->client, HIDL_SERVICE_SET_RESPONSE_FUNCTIONS, req, &status);
     gbinder_local_request_unref(req);
 
     if (status < 0) {
-        fprintf(stderr, "Failed to call IRadio::setResponseFunctions");
+        fprintf(stderr, "Failed to call IRadio::setResponseFunctions\n");
+        unbind_slot(userdata);
         return -1;
     }
 
+    userdata->boundSlot = slotId;
+    return 0;
+}
+
+static int try_open_slot(struct gbinder_hidl_userdata *userdata, int slotId, const uint8_t *aid, uint32_t aid_len)
+{
+    int status;
+
+    if (bind_slot(userdata, slotId) < 0)
+        return -1;
+
     // Now, try to open the AID
     uint8_t aid_hex[255];
+    struct gbinder_hidl_request request = { .serial = next_serial(userdata), .intResp = -1 };
     euicc_hexutil_bin2hex(aid_hex, 255, aid, aid_len);
 
-    req = gbinder_client_new_request(client);
+    GBinderLocalRequest *req = gbinder_client_new_request(userdata->client);
+    GBinderWriter writer;
     gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, 1000);
+    gbinder_writer_append_int32(&writer, request.serial);
     gbinder_writer_append_hidl_string_copy(&writer, aid_hex);
     gbinder_writer_append_int32(&writer, 0);
-    status = gbinder_client_transact_sync_oneway(client, HIDL_SERVICE_ICC_OPEN_LOGICAL_CHANNEL, req);
+    status = transact_single(userdata, &request, HIDL_SERVICE_ICC_OPEN_LOGICAL_CHANNEL, req);
     gbinder_local_request_unref(req);
 
     if (status < 0) {
@@ -187,15 +315,39 @@ static int try_open_slot(int slotId, const uint8_t *aid, uint32_t aid_len)
         return status;
     }
 
-    g_main_loop_run(binder_loop);
-
-    if (lastRadioErr != 0) {
-        fprintf(stderr, "Failed to open APDU logical channel: %d\n", lastRadioErr);
-        return -lastRadioErr;
+    if (request.error != 0) {
+        fprintf(stderr, "Failed to open APDU logical channel: %d\n", request.error);
+        return -request.error;
     }
-    fprintf(stderr, "opened logical channel id: %d\n", lastIntResp);
+    fprintf(stderr, "opened logical channel id: %d\n", request.intResp);
+
+    return request.intResp;
+}
+
+// GBINDER_SLOT_CACHE_FILE holds the slot the eUICC was found in last time, 0 when unknown
+static int slot_cache_read(void)
+{
+    const char *path = getenv("GBINDER_SLOT_CACHE_FILE");
+    FILE *fp;
+    int slot = 0;
+
+    if (path == NULL || (fp = fopen(path, "r")) == NULL)
+        return 0;
+    if (fscanf(fp, "%d", &slot) != 1 || slot < 1 || slot > GBINDER_SLOT_MAX)
+        slot = 0;
+    fclose(fp);
+    return slot;
+}
 
-    return lastIntResp;
+static void slot_cache_write(int slot)
+{
+    const char *path = getenv("GBINDER_SLOT_CACHE_FILE");
+    FILE *fp;
+
+    if (path == NULL || slot_cache_read() == slot || (fp = fopen(path, "w")) == NULL)
+        return;
+    fprintf(fp, "%d\n", slot);
+    fclose(fp);
 }
 
 static int apdu_interface_connect(struct euicc_ctx *ctx)
@@ -205,123 +357,293 @@ static int apdu_interface_connect(struct euicc_ctx *ctx)
 
 static void apdu_interface_disconnect(struct euicc_ctx *ctx)
 {
-    cleanup();
+    cleanup_instance(ctx->apdu.interface->userdata);
 }
 
 static int apdu_interface_logic_channel_open(struct euicc_ctx *ctx, const uint8_t *aid, uint8_t aid_len)
 {
+    struct gbinder_hidl_userdata *userdata = ctx->apdu.interface->userdata;
+    int cached;
+    int res;
+
     // We only start to use gbinder connection here, because only now can we detect whether
     // a given slot is a valid eSIM slot. This way we can automatically fall back in the case
     // where a device has only one eSIM -- we don't want to force the user to choose in this case.
-    int res = try_open_slot(1, aid, aid_len);
-    if (res < 0)
-        res = try_open_slot(2, aid, aid_len);
+    // A reconnect goes back to the slot bound before, without looking the service up again.
+    if (userdata->slot > 0) {
+        res = try_open_slot(userdata, userdata->slot, aid, aid_len);
+    } else if (userdata->boundSlot > 0) {
+        res = try_open_slot(userdata, userdata->boundSlot, aid, aid_len);
+    } else {
+        res = -1;
+        cached = slot_cache_read();
+        if (cached > 0)
+            res = try_open_slot(userdata, cached, aid, aid_len);
+        for (int slot = 1; res < 0 && slot <= GBINDER_SLOT_MAX; slot++) {
+            if (slot != cached)
+                res = try_open_slot(userdata, slot, aid, aid_len);
+        }
+        if (res >= 0)
+            slot_cache_write(userdata->boundSlot);
+        else
+            unbind_slot(userdata);
+    }
     if (res >= 0)
-        lastChannelId = res;
+        userdata->lastChannelId = res;
     return res;
 }
 
 static void apdu_interface_logic_channel_close(struct euicc_ctx *ctx, uint8_t channel)
 {
-    cleanup_channel(channel);
-    if (lastChannelId == channel)
-        lastChannelId = -1;
-
-    // Only do this cleanup here, because on exit these objects will be destroyed anyway
-    gbinder_client_unref(client);
-    gbinder_remote_object_unref(remote);
-    gbinder_servicemanager_unref(sm);
+    struct gbinder_hidl_userdata *userdata = ctx->apdu.interface->userdata;
+
+    cleanup_channel(userdata, channel);
+    if (userdata->lastChannelId == channel)
+        userdata->lastChannelId = -1;
 }
 
-static int apdu_interface_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+// Sends one APDU as a oneway iccTransmitApduLogicalChannel, the response arrives later with request->serial
+static int send_apdu(struct gbinder_hidl_userdata *userdata, struct gbinder_hidl_request *request, const uint8_t *tx, uint32_t tx_len)
 {
-    GBinderLocalRequest *req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, 1000);
+    uint32_t data_len = tx_len > 5 ? tx_len - 5 : 0;
+    uint32_t need = data_len * 2 + 1;
+
+    if (tx_len < 4)
+        return -1;
 
-    uint8_t tx_hex[4096] = {0};
-    euicc_hexutil_bin2hex(tx_hex, 4096, &tx[5], tx_len - 5);
+    if (userdata->txHexCapacity < need) {
+        char *tx_hex_new = realloc(userdata->txHex, need);
+        if (tx_hex_new == NULL)
+            return -1;
+        userdata->txHex = tx_hex_new;
+        userdata->txHexCapacity = need;
+    }
+    userdata->txHex[0] = '\0';
+    if (data_len > 0)
+        euicc_hexutil_bin2hex(userdata->txHex, need, &tx[5], data_len);
 
     if (DEBUG)
-        fprintf(stderr, "APDU req: %s\n", tx_hex);
+        fprintf(stderr, "APDU req: %s\n", userdata->txHex);
+
+    GBinderLocalRequest *req = gbinder_client_new_request(userdata->client);
+    GBinderWriter writer;
+    gbinder_local_request_init_writer(req, &writer);
+    gbinder_writer_append_int32(&writer, request->serial);
 
     struct sim_apdu apdu = {
-        .sessionId = lastChannelId,
+        .sessionId = userdata->lastChannelId,
         .cla = tx[0],
         .instruction = tx[1],
         .p1 = tx[2],
         .p2 = tx[3],
-        .p3 = tx[4],
+        .p3 = tx_len > 4 ? tx[4] : -1,
         .data = {
             .data = {
-                .str = (const char *) tx_hex
+                .str = (const char *) userdata->txHex
             },
-            .len = strlen(tx_hex) + 1,
+            .len = strlen(userdata->txHex) + 1,
             .owns_buffer = FALSE,
         },
     };
     gbinder_writer_append_struct(&writer, &apdu, &sim_apdu_t, NULL);
-    int status = gbinder_client_transact_sync_oneway(client, HIDL_SERVICE_ICC_TRANSMIT_APDU_LOGICAL_CHANNEL, req);
+    // The parcel is flattened before this returns, so txHex can be reused right away
+    int status = gbinder_client_transact_sync_oneway(userdata->client, HIDL_SERVICE_ICC_TRANSMIT_APDU_LOGICAL_CHANNEL, req);
     gbinder_local_request_unref(req);
 
     if (status < 0) {
         fprintf(stderr, "Failed to call IRadio::iccTransmitApduLogicalChannel: %d\n", status);
         return status;
     }
+    return 0;
+}
 
-    g_main_loop_run(binder_loop);
-
-    if (lastRadioErr != 0) {
-        return -lastRadioErr;
-    }
+static int apdu_result(struct gbinder_hidl_request *request, uint8_t **rx, uint32_t *rx_len)
+{
+    if (request->error != 0)
+        return -request->error;
 
     if (DEBUG)
-        fprintf(stderr, "APDU resp: %d%d %d %s\n", lastIccIoResult.sw1, lastIccIoResult.sw2, lastIccIoResult.simResponse.len, lastIccIoResult.simResponse.data.str);
+        fprintf(stderr, "APDU resp: %d%d %u %s\n", request->sw1, request->sw2, request->simResponseLen, request->simResponse);
 
-    *rx_len = lastIccIoResult.simResponse.len / 2 + 2;
+    *rx_len = request->simResponseLen / 2 + 2;
     *rx = calloc(*rx_len, sizeof(uint8_t));
-    euicc_hexutil_hex2bin_r(*rx, *rx_len, lastIccIoResult.simResponse.data.str, lastIccIoResult.simResponse.len);
-    (*rx)[*rx_len - 2] = lastIccIoResult.sw1;
-    (*rx)[*rx_len - 1] = lastIccIoResult.sw2;
+    if (*rx == NULL)
+        return -1;
+    euicc_hexutil_hex2bin_r(*rx, *rx_len, request->simResponse, request->simResponseLen);
+    (*rx)[*rx_len - 2] = request->sw1;
+    (*rx)[*rx_len - 1] = request->sw2;
+
+    return 0;
+}
 
+static int apdu_interface_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    struct gbinder_hidl_userdata *userdata = ctx->apdu.interface->userdata;
+    struct gbinder_hidl_request request = { .serial = next_serial(userdata) };
+    int ret;
+
+    userdata->pending = &request;
+    userdata->pending_count = 1;
+
+    ret = send_apdu(userdata, &request, tx, tx_len);
+    if (ret == 0) {
+        wait_request(&request);
+        ret = apdu_result(&request, rx, rx_len);
+    }
+
+    userdata->pending = NULL;
+    userdata->pending_count = 0;
     // see radio_response_transact -- this is our buffer.
-    free((void *) lastIccIoResult.simResponse.data.str);
+    free(request.simResponse);
 
-    return 0;
+    return ret;
 }
 
-static int libapduinterface_init(struct euicc_apdu_interface *ifstruct)
+// Keeps up to pipelineDepth requests queued at the RIL, matching each response to its request by serial. Requests
+// sent behind one not answered 90 00 still run on the card, the batch then ends with the count sent and no response,
+// and later batches go one request at a time.
+static int apdu_interface_transmit_batch(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *const *tx, const uint32_t *tx_len, uint32_t tx_count)
 {
+    struct gbinder_hidl_userdata *userdata = ctx->apdu.interface->userdata;
+    struct gbinder_hidl_request *requests;
+    uint32_t issued = 0;
+    int fret = -1;
+
+    *rx = NULL;
+    *rx_len = 0;
+
+    if (tx_count == 0)
+        return -1;
+
+    requests = calloc(tx_count, sizeof(struct gbinder_hidl_request));
+    if (requests == NULL)
+        return -1;
+
+    userdata->pending = requests;
+    userdata->pending_count = tx_count;
+
+    for (uint32_t i = 0; i < tx_count; i++) {
+        while (issued < tx_count && issued - i < (uint32_t) userdata->pipelineDepth) {
+            requests[issued].serial = next_serial(userdata);
+            if (send_apdu(userdata, &requests[issued], tx[issued], tx_len[issued]) < 0)
+                goto exit;
+            issued++;
+        }
+
+        wait_request(&requests[i]);
+
+        if (apdu_result(&requests[i], rx, rx_len) < 0)
+            goto exit;
+
+        if (i + 1 == tx_count || *rx_len != 2 || (*rx)[0] != 0x90 || (*rx)[1] != 0x00) {
+            if (issued > i + 1) {
+                fprintf(stderr, "iccTransmitApduLogicalChannel #%u answered %02X%02X with %u more already sent, no longer pipelining\n", i, (*rx)[*rx_len - 2], (*rx)[*rx_len - 1], issued - i - 1);
+                userdata->pipelineDepth = 1;
+                free(*rx);
+                *rx = NULL;
+                *rx_len = 0;
+                fret = issued;
+                goto exit;
+            }
+            fret = i + 1;
+            goto exit;
+        }
+        free(*rx);
+        *rx = NULL;
+        *rx_len = 0;
+    }
+
+exit:
+    if (fret < 0) {
+        free(*rx);
+        *rx = NULL;
+        *rx_len = 0;
+    }
+    // Requests already sent must be answered before their slots go away
+    for (uint32_t i = 0; i < issued; i++) {
+        wait_request(&requests[i]);
+        free(requests[i].simResponse);
+    }
+    userdata->pending = NULL;
+    userdata->pending_count = 0;
+    free(requests);
+    return fret;
+}
+
+LPAC_BIND_APDU_DEFINE_TRANSMIT(apdu_interface_transmit)
+
+static int libapduinterface_init(struct euicc_apdu_interface *ifstruct, const char *device)
+{
+    static int cleanup_installed = 0;
+    struct gbinder_hidl_userdata *userdata;
+
+    userdata = calloc(1, sizeof(struct gbinder_hidl_userdata));
+    if (userdata == NULL)
+        return -1;
+    userdata->lastChannelId = -1;
+    userdata->lastSerial = 1000;
+    userdata->pipelineDepth = getenv("GBINDER_PIPELINE_DEPTH") ? atoi(getenv("GBINDER_PIPELINE_DEPTH")) : GBINDER_PIPELINE_DEPTH_DEFAULT;
+    if (userdata->pipelineDepth < 1)
+        userdata->pipelineDepth = 1;
+    // A specific slot may be requested; otherwise the cached slot, slot 1 and then slot 2 are tried
+    userdata->slot = device ? atoi(device) : 0;
+
     ifstruct->connect = apdu_interface_connect;
     ifstruct->disconnect = apdu_interface_disconnect;
     ifstruct->logic_channel_open = apdu_interface_logic_channel_open;
     ifstruct->logic_channel_close = apdu_interface_logic_channel_close;
-    ifstruct->transmit = apdu_interface_transmit;
+    ifstruct->transmit = LPAC_BIND_APDU_TRANSMIT(apdu_interface_transmit);
+    ifstruct->transmit_batch = apdu_interface_transmit_batch;
 
     // Install cleanup routine
-    atexit(cleanup);
-    signal(SIGINT, sighandler);
+    if (!cleanup_installed) {
+        atexit(cleanup);
+        signal(SIGINT, sighandler);
+        cleanup_installed = 1;
+    }
 
-    // The glib loop is detached from any client object, so create it here.
-    binder_loop = g_main_loop_new(NULL, FALSE);
+    userdata->next = instances;
+    instances = userdata;
+    service_manager_users++;
+    ifstruct->userdata = userdata;
 
     return 0;
 }
 
-static int libapduinterface_main(int argc, char **argv)
+static int libapduinterface_main(struct euicc_apdu_interface *ifstruct, int argc, char **argv)
 {
     return 0;
 }
 
-static void libapduinterface_fini(void)
+static void libapduinterface_fini(struct euicc_apdu_interface *ifstruct)
 {
+    struct gbinder_hidl_userdata *userdata = ifstruct->userdata;
+
+    if (userdata == NULL)
+        return;
+
+    for (struct gbinder_hidl_userdata **pp = &instances; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == userdata) {
+            *pp = userdata->next;
+            break;
+        }
+    }
+
+    unbind_slot(userdata);
+    if (--service_manager_users == 0 && service_manager != NULL) {
+        gbinder_servicemanager_unref(service_manager);
+        service_manager = NULL;
+    }
+
+    free(userdata->txHex);
+    free(userdata);
+    ifstruct->userdata = NULL;
 }
 
 const struct euicc_driver driver_apdu_gbinder_hidl = {
     .type = DRIVER_APDU,
     .name = "gbinder_hidl",
-    .init = libapduinterface_init,
-    .main = libapduinterface_main,
-    .fini = libapduinterface_fini,
+    .init = (int (*)(void *, const char *))libapduinterface_init,
+    .main = (int (*)(void *, int, char **))libapduinterface_main,
+    .fini = (void (*)(void *))libapduinterface_fini,
 };
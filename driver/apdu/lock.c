@@ -0,0 +1,279 @@
+#include "lock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#endif
+
+#define APDU_LOCK_DIR_SYSTEM "/run/lpac"
+#define APDU_LOCK_TIMEOUT_DEFAULT 60000
+#define APDU_LOCK_POLL_US 10000
+#define APDU_LOCK_QUEUE_MAX 256
+
+#ifndef _WIN32
+// <dir>/lpac-<driver>-<device>, with everything but letters, digits, '.' and '-' in the device name turned into '_'
+static char *apdu_lock_path(const char *dir, const char *driver, const char *device, const char *suffix)
+{
+    char resolved[PATH_MAX];
+    char *path, *p;
+
+    // Symlinks such as /dev/serial/by-id name the same port
+    if (realpath(device, resolved))
+    {
+        device = resolved;
+    }
+
+    path = malloc(strlen(dir) + strlen(driver) + strlen(device) + strlen(suffix) + sizeof("/lpac--"));
+    if (path == NULL)
+    {
+        return NULL;
+    }
+    p = path + sprintf(path, "%s/lpac-%s-", dir, driver);
+    for (; *device; device++)
+    {
+        char c = *device;
+        *p++ = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '.' || c == '-' ? c : '_';
+    }
+    strcpy(p, suffix);
+
+    return path;
+}
+
+// The directory shared by every user of the devices, made on first use for the group of whoever made it. Refused
+// when it is not a real directory, or anyone could write into it and queue ahead of everybody.
+static int apdu_lock_dir_system(void)
+{
+    struct stat st;
+
+    if (mkdir(APDU_LOCK_DIR_SYSTEM, 0770) == 0)
+    {
+        chmod(APDU_LOCK_DIR_SYSTEM, 01770);
+    }
+    else if (errno != EEXIST)
+    {
+        return -1;
+    }
+    if (lstat(APDU_LOCK_DIR_SYSTEM, &st) < 0 || !S_ISDIR(st.st_mode) || (st.st_mode & S_IWOTH) || (st.st_uid != 0 && st.st_uid != geteuid()))
+    {
+        return -1;
+    }
+    return access(APDU_LOCK_DIR_SYSTEM, W_OK | X_OK);
+}
+
+// Opens a lock or queue file, never through a symlink and only when it is a regular file. One created in the
+// system directory is opened up to its group, past the umask.
+static int apdu_lock_open(const char *path, int shared)
+{
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if (fd >= 0)
+    {
+        if (shared)
+        {
+            fchmod(fd, 0660);
+        }
+        return fd;
+    }
+    if (errno != EEXIST)
+    {
+        return -1;
+    }
+
+    fd = open(path, O_RDWR | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// The queue file lists the PIDs of the waiting processes in the order they came, and drops those that died waiting.
+// Adds add and removes remove (0 for none) under its own lock, and hands back the first one left.
+static int apdu_lock_queue(int fd, pid_t add, pid_t remove, pid_t *head)
+{
+    pid_t pids[APDU_LOCK_QUEUE_MAX];
+    char buf[APDU_LOCK_QUEUE_MAX * 12 + 1], *line, *saveptr;
+    int count = 0, len = 0, changed = 0;
+    ssize_t n;
+
+    if (flock(fd, LOCK_EX) < 0)
+    {
+        return -1;
+    }
+
+    if (lseek(fd, 0, SEEK_SET) == 0 && (n = read(fd, buf, sizeof(buf) - 1)) >= 0)
+    {
+        buf[n] = '\0';
+        for (line = strtok_r(buf, "\n", &saveptr); line && count < APDU_LOCK_QUEUE_MAX; line = strtok_r(NULL, "\n", &saveptr))
+        {
+            pid_t pid = (pid_t)strtol(line, NULL, 10);
+
+            if (pid <= 0 || pid == remove || (kill(pid, 0) < 0 && errno == ESRCH))
+            {
+                changed = 1;
+                continue;
+            }
+            pids[count++] = pid;
+        }
+    }
+    if (add && count < APDU_LOCK_QUEUE_MAX)
+    {
+        pids[count++] = add;
+        changed = 1;
+    }
+
+    if (changed)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            len += sprintf(buf + len, "%ld\n", (long)pids[i]);
+        }
+        if (ftruncate(fd, 0) < 0 || pwrite(fd, buf, len, 0) != len)
+        {
+            flock(fd, LOCK_UN);
+            return -1;
+        }
+    }
+    *head = count ? pids[0] : 0;
+
+    flock(fd, LOCK_UN);
+    return 0;
+}
+#endif
+
+int apdu_lock_acquire(struct euicc_ctx *ctx, const char *driver, const char *device)
+{
+#ifndef _WIN32
+    const char *dir = getenv("LPAC_APDU_LOCK_DIR");
+    uint64_t deadline;
+    char *lock_path = NULL, *queue_path = NULL;
+    int lock = -1, queue = -1;
+    pid_t self = getpid(), head;
+    int shared = 0;
+
+    if (device == NULL)
+    {
+        return APDU_LOCK_NONE;
+    }
+    // The system directory by default, so processes of every user and service take turns. The user's runtime
+    // directory only keeps the processes of one user apart.
+    if (dir == NULL)
+    {
+        if (apdu_lock_dir_system() == 0)
+        {
+            dir = APDU_LOCK_DIR_SYSTEM;
+            shared = 1;
+        }
+        else if ((dir = getenv("XDG_RUNTIME_DIR")) != NULL && dir[0] != '\0')
+        {
+            fprintf(stderr, "Cannot use %s, %s is only locked against processes of this user\n", APDU_LOCK_DIR_SYSTEM, device);
+        }
+        else
+        {
+            fprintf(stderr, "Cannot use %s and XDG_RUNTIME_DIR is not set, %s is not locked\n", APDU_LOCK_DIR_SYSTEM, device);
+            return APDU_LOCK_NONE;
+        }
+    }
+    if (dir[0] == '\0')
+    {
+        return APDU_LOCK_NONE;
+    }
+    deadline = euicc_now_us() + (getenv("LPAC_APDU_LOCK_TIMEOUT") ? strtoull(getenv("LPAC_APDU_LOCK_TIMEOUT"), NULL, 10) : APDU_LOCK_TIMEOUT_DEFAULT) * 1000;
+
+    lock_path = apdu_lock_path(dir, driver, device, ".lock");
+    queue_path = apdu_lock_path(dir, driver, device, ".queue");
+    if (lock_path == NULL || queue_path == NULL)
+    {
+        goto err;
+    }
+    lock = apdu_lock_open(lock_path, shared);
+    queue = apdu_lock_open(queue_path, shared);
+    if (lock < 0 || queue < 0)
+    {
+        // Files another user made without letting us in, go on unlocked as before
+        fprintf(stderr, "Cannot open %s, %s is not locked\n", lock < 0 ? lock_path : queue_path, device);
+        if (lock >= 0)
+        {
+            close(lock);
+        }
+        lock = APDU_LOCK_NONE;
+        goto exit;
+    }
+    // Taken at once when nobody holds or waits for the device, as most of the time
+    if (apdu_lock_queue(queue, 0, 0, &head) == 0 && head == 0 && flock(lock, LOCK_EX | LOCK_NB) == 0)
+    {
+        goto exit;
+    }
+
+    if (apdu_lock_queue(queue, self, 0, &head) < 0)
+    {
+        goto err;
+    }
+    for (;;)
+    {
+        // The holder left the queue once it had the lock, and the kernel drops the lock of one that dies
+        if (head == self && flock(lock, LOCK_EX | LOCK_NB) == 0)
+        {
+            apdu_lock_queue(queue, 0, self, &head);
+            goto exit;
+        }
+        if (euicc_now_us() >= deadline || euicc_aborted(ctx))
+        {
+            fprintf(stderr, "Timed out waiting for %s, held by another process\n", device);
+            apdu_lock_queue(queue, 0, self, &head);
+            goto err;
+        }
+        usleep(APDU_LOCK_POLL_US);
+        if (apdu_lock_queue(queue, 0, 0, &head) < 0)
+        {
+            goto err;
+        }
+    }
+
+err:
+    if (lock >= 0)
+    {
+        close(lock);
+    }
+    lock = -1;
+exit:
+    if (queue >= 0)
+    {
+        close(queue);
+    }
+    free(lock_path);
+    free(queue_path);
+    return lock;
+#else
+    (void)ctx;
+    (void)driver;
+    (void)device;
+    return APDU_LOCK_NONE;
+#endif
+}
+
+void apdu_lock_release(int lock)
+{
+#ifndef _WIN32
+    if (lock >= 0)
+    {
+        close(lock);
+    }
+#endif
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <euicc/euicc.h>
+
+#define APDU_LOCK_NONE -2
+
+// Advisory lock on a card reader or modem, shared by the backends whose device cannot take two processes at once.
+// Waits its turn behind the processes that asked first, for at most LPAC_APDU_LOCK_TIMEOUT or until ctx is aborted,
+// and returns the descriptor holding the lock, -1 when it was not taken, or APDU_LOCK_NONE where locking is off.
+int apdu_lock_acquire(struct euicc_ctx *ctx, const char *driver, const char *device);
+void apdu_lock_release(int lock);
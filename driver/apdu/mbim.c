@@ -0,0 +1,367 @@
+#include "mbim.h"
+
+#include <euicc/euicc.h>
+#include <euicc/interface.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libmbim-glib.h>
+
+#include "bind.h"
+
+#define MBIM_TIMEOUT 10
+#define MBIM_CHANNEL_GROUP 1
+
+struct mbim_userdata
+{
+    char *device_path;
+    GMainContext *context;
+    MbimDevice *device;
+    int lastChannelId;
+};
+
+static void async_result_ready(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    GAsyncResult **result_out = user_data;
+
+    *result_out = g_object_ref(res);
+}
+
+static MbimDevice *mbim_device_new_sync(GFile *file, GMainContext *context, GError **error)
+{
+    g_autoptr(GMainContextPusher) pusher = NULL;
+    g_autoptr(GAsyncResult) result = NULL;
+
+    pusher = g_main_context_pusher_new(context);
+
+    mbim_device_new(file, NULL, async_result_ready, &result);
+
+    while (result == NULL)
+        g_main_context_iteration(context, TRUE);
+
+    return mbim_device_new_finish(result, error);
+}
+
+static gboolean mbim_device_open_sync(MbimDevice *device, GMainContext *context, GError **error)
+{
+    g_autoptr(GMainContextPusher) pusher = NULL;
+    g_autoptr(GAsyncResult) result = NULL;
+
+    pusher = g_main_context_pusher_new(context);
+
+    // Through mbim-proxy, so ModemManager keeps its own session on the same control channel
+    mbim_device_open_full(device, MBIM_DEVICE_OPEN_FLAGS_PROXY, MBIM_TIMEOUT, NULL, async_result_ready, &result);
+
+    while (result == NULL)
+        g_main_context_iteration(context, TRUE);
+
+    return mbim_device_open_full_finish(device, result, error);
+}
+
+static gboolean mbim_device_close_sync(MbimDevice *device, GMainContext *context, GError **error)
+{
+    g_autoptr(GMainContextPusher) pusher = NULL;
+    g_autoptr(GAsyncResult) result = NULL;
+
+    pusher = g_main_context_pusher_new(context);
+
+    mbim_device_close(device, MBIM_TIMEOUT, NULL, async_result_ready, &result);
+
+    while (result == NULL)
+        g_main_context_iteration(context, TRUE);
+
+    return mbim_device_close_finish(device, result, error);
+}
+
+// Returns the COMMAND_DONE response, or NULL with *error set
+static MbimMessage *mbim_command_sync(struct mbim_userdata *userdata, MbimMessage *request, GError **error)
+{
+    g_autoptr(GMainContextPusher) pusher = NULL;
+    g_autoptr(GAsyncResult) result = NULL;
+    MbimMessage *response;
+
+    pusher = g_main_context_pusher_new(userdata->context);
+
+    mbim_device_command(userdata->device, request, MBIM_TIMEOUT, NULL, async_result_ready, &result);
+
+    while (result == NULL)
+        g_main_context_iteration(userdata->context, TRUE);
+
+    response = mbim_device_command_finish(userdata->device, result, error);
+    if (response == NULL)
+    {
+        return NULL;
+    }
+
+    if (!mbim_message_response_get_result(response, MBIM_MESSAGE_TYPE_COMMAND_DONE, error))
+    {
+        mbim_message_unref(response);
+        return NULL;
+    }
+
+    return response;
+}
+
+// The UICC status word travels separately from the response data
+static int mbim_build_rx(uint8_t **rx, uint32_t *rx_len, guint32 status, const guint8 *data, guint32 data_len)
+{
+    *rx_len = data_len + 2;
+    *rx = malloc(*rx_len);
+    if (*rx == NULL)
+    {
+        *rx_len = 0;
+        return -1;
+    }
+
+    if (data_len > 0)
+    {
+        memcpy(*rx, data, data_len);
+    }
+    (*rx)[data_len] = (status >> 8) & 0xFF;
+    (*rx)[data_len + 1] = status & 0xFF;
+
+    return 0;
+}
+
+static int apdu_interface_connect(struct euicc_ctx *ctx)
+{
+    struct mbim_userdata *userdata = ctx->apdu.interface->userdata;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GFile) file = NULL;
+
+    userdata->context = g_main_context_new();
+
+    file = g_file_new_for_path(userdata->device_path);
+
+    userdata->device = mbim_device_new_sync(file, userdata->context, &error);
+    if (userdata->device == NULL)
+    {
+        fprintf(stderr, "error: create MBIM device from %s failed: %s\n", userdata->device_path, error->message);
+        return -1;
+    }
+
+    if (!mbim_device_open_sync(userdata->device, userdata->context, &error))
+    {
+        fprintf(stderr, "error: open MBIM device failed: %s\n", error->message);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void mbim_logic_channel_close(struct mbim_userdata *userdata, uint8_t channel)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(MbimMessage) request = NULL;
+    g_autoptr(MbimMessage) response = NULL;
+    guint32 status;
+
+    request = mbim_message_ms_uicc_low_level_access_close_channel_set_new(channel, MBIM_CHANNEL_GROUP, &error);
+    if (request == NULL)
+    {
+        fprintf(stderr, "error: build Close Channel request failed: %s\n", error->message);
+        return;
+    }
+
+    response = mbim_command_sync(userdata, request, &error);
+    if (response == NULL)
+    {
+        fprintf(stderr, "error: send Close Channel command failed: %s\n", error->message);
+        return;
+    }
+
+    if (!mbim_message_ms_uicc_low_level_access_close_channel_response_parse(response, &status, &error))
+    {
+        fprintf(stderr, "error: parse Close Channel response failed: %s\n", error->message);
+        return;
+    }
+
+    if (channel == userdata->lastChannelId)
+    {
+        userdata->lastChannelId = -1;
+    }
+}
+
+static void apdu_interface_disconnect(struct euicc_ctx *ctx)
+{
+    struct mbim_userdata *userdata = ctx->apdu.interface->userdata;
+    g_autoptr(GError) error = NULL;
+
+    if (userdata->device)
+    {
+        if (userdata->lastChannelId != -1)
+        {
+            fprintf(stderr, "Cleaning up leaked APDU channel %d\n", userdata->lastChannelId);
+            mbim_logic_channel_close(userdata, userdata->lastChannelId);
+        }
+        mbim_device_close_sync(userdata->device, userdata->context, &error);
+        g_object_unref(userdata->device);
+        userdata->device = NULL;
+    }
+
+    if (userdata->context)
+    {
+        g_main_context_unref(userdata->context);
+        userdata->context = NULL;
+    }
+}
+
+static int apdu_interface_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    struct mbim_userdata *userdata = ctx->apdu.interface->userdata;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(MbimMessage) request = NULL;
+    g_autoptr(MbimMessage) response = NULL;
+    guint32 status;
+    guint32 response_size = 0;
+    const guint8 *response_data = NULL;
+
+    *rx = NULL;
+    *rx_len = 0;
+
+    if (userdata->lastChannelId == -1)
+    {
+        return -1;
+    }
+
+    request = mbim_message_ms_uicc_low_level_access_apdu_set_new(userdata->lastChannelId, MBIM_UICC_SECURE_MESSAGING_NONE, MBIM_UICC_CLASS_BYTE_TYPE_EXTENDED, tx_len, tx, &error);
+    if (request == NULL)
+    {
+        fprintf(stderr, "error: build APDU request failed: %s\n", error->message);
+        return -1;
+    }
+
+    response = mbim_command_sync(userdata, request, &error);
+    if (response == NULL)
+    {
+        fprintf(stderr, "error: send APDU command failed: %s\n", error->message);
+        return -1;
+    }
+
+    if (!mbim_message_ms_uicc_low_level_access_apdu_response_parse(response, &status, &response_size, &response_data, &error))
+    {
+        fprintf(stderr, "error: parse APDU response failed: %s\n", error->message);
+        return -1;
+    }
+
+    return mbim_build_rx(rx, rx_len, status, response_data, response_size);
+}
+
+static int apdu_interface_logic_channel_open(struct euicc_ctx *ctx, const uint8_t *aid, uint8_t aid_len)
+{
+    struct mbim_userdata *userdata = ctx->apdu.interface->userdata;
+    g_autoptr(GError) error = NULL;
+    g_autoptr(MbimMessage) request = NULL;
+    g_autoptr(MbimMessage) response = NULL;
+    guint32 status;
+    guint32 channel;
+    guint32 response_size = 0;
+    const guint8 *response_data = NULL;
+
+    if (userdata->lastChannelId != -1)
+    {
+        return userdata->lastChannelId;
+    }
+
+    request = mbim_message_ms_uicc_low_level_access_open_channel_set_new(aid_len, aid, 0x00, MBIM_CHANNEL_GROUP, &error);
+    if (request == NULL)
+    {
+        fprintf(stderr, "error: build Open Channel request failed: %s\n", error->message);
+        return -1;
+    }
+
+    response = mbim_command_sync(userdata, request, &error);
+    if (response == NULL)
+    {
+        fprintf(stderr, "error: send Open Channel command failed: %s\n", error->message);
+        return -1;
+    }
+
+    if (!mbim_message_ms_uicc_low_level_access_open_channel_response_parse(response, &status, &channel, &response_size, &response_data, &error))
+    {
+        fprintf(stderr, "error: parse Open Channel response failed: %s\n", error->message);
+        return -1;
+    }
+
+    if (status != 0x9000 && (status >> 8) != 0x61)
+    {
+        fprintf(stderr, "error: open logical channel failed: %04X\n", status);
+        return -1;
+    }
+
+    userdata->lastChannelId = channel;
+
+    return channel;
+}
+
+static void apdu_interface_logic_channel_close(struct euicc_ctx *ctx, uint8_t channel)
+{
+    mbim_logic_channel_close(ctx->apdu.interface->userdata, channel);
+}
+
+LPAC_BIND_APDU_DEFINE_TRANSMIT(apdu_interface_transmit)
+
+static int libapduinterface_init(struct euicc_apdu_interface *ifstruct, const char *device)
+{
+    struct mbim_userdata *userdata;
+
+    memset(ifstruct, 0, sizeof(struct euicc_apdu_interface));
+
+    if (device == NULL)
+    {
+        device = getenv("MBIM_DEVICE");
+    }
+    if (device == NULL)
+    {
+        device = "/dev/cdc-wdm0";
+    }
+
+    userdata = calloc(1, sizeof(struct mbim_userdata));
+    if (userdata == NULL)
+    {
+        return -1;
+    }
+    userdata->device_path = strdup(device);
+    if (userdata->device_path == NULL)
+    {
+        free(userdata);
+        return -1;
+    }
+    userdata->lastChannelId = -1;
+
+    ifstruct->connect = apdu_interface_connect;
+    ifstruct->disconnect = apdu_interface_disconnect;
+    ifstruct->logic_channel_open = apdu_interface_logic_channel_open;
+    ifstruct->logic_channel_close = apdu_interface_logic_channel_close;
+    ifstruct->transmit = LPAC_BIND_APDU_TRANSMIT(apdu_interface_transmit);
+    ifstruct->userdata = userdata;
+
+    return 0;
+}
+
+static int libapduinterface_main(struct euicc_apdu_interface *ifstruct, int argc, char **argv)
+{
+    return 0;
+}
+
+static void libapduinterface_fini(struct euicc_apdu_interface *ifstruct)
+{
+    struct mbim_userdata *userdata = ifstruct->userdata;
+
+    if (userdata == NULL)
+    {
+        return;
+    }
+
+    free(userdata->device_path);
+    free(userdata);
+    ifstruct->userdata = NULL;
+}
+
+const struct euicc_driver driver_apdu_mbim = {
+    .type = DRIVER_APDU,
+    .name = "mbim",
+    .init = (int (*)(void *, const char *))libapduinterface_init,
+    .main = (int (*)(void *, int, char **))libapduinterface_main,
+    .fini = (void (*)(void *))libapduinterface_fini,
+};
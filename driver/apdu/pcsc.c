@@ -13,11 +13,18 @@
 #endif
 
 #include <cjson/cJSON_ex.h>
+#include <euicc/euicc.h>
 #include <euicc/interface.h>
+#include <euicc/hexutil.h>
+
+#include "lock.h"
+#include "bind.h"
 
 #define INTERFACE_SELECT_ENV "DRIVER_IFID"
+#define INTERFACE_SHARED_ENV "PCSC_SHARED"
 
 #define EUICC_INTERFACE_BUFSZ 264
+#define EUICC_INTERFACE_BUFSZ_EXTENDED (65536 + 2)
 
 // #define APDU_ST33_MAGIC "\x90\xBD\x36\xBB\x00"
 #define APDU_TERMINAL_CAPABILITIES "\x80\xAA\x00\x00\x0A\xA9\x08\x81\x00\x82\x01\x01\x83\x01\x07"
@@ -25,48 +32,74 @@
 #define APDU_CLOSELOGICCHANNEL "\x00\x70\x80\xFF\x00"
 #define APDU_SELECT_HEADER "\x00\xA4\x04\x00\xFF"
 
-static SCARDCONTEXT pcsc_ctx;
-static SCARDHANDLE pcsc_hCard;
-static LPSTR pcsc_mszReaders;
+struct pcsc_userdata
+{
+    SCARDCONTEXT ctx;
+    SCARDHANDLE hCard;
+    DWORD dwActiveProtocol;
+    LPSTR mszReaders;
+    int index;
+    int shared;
+    // Held from connect to disconnect, so another lpac on the reader waits instead of failing with a sharing violation
+    int lock;
+    struct euicc_apdu_interface *ifstruct;
+};
 
-static int pcsc_ctx_open(void)
+static void pcsc_free_readers(struct pcsc_userdata *userdata)
+{
+    if (userdata->mszReaders)
+    {
+// macOS does not support SCARD_AUTOALLOCATE, so we need to free the buffer manually.
+#ifdef SCARD_AUTOALLOCATE
+        SCardFreeMemory(userdata->ctx, userdata->mszReaders);
+#else
+        // on macOS, mszReaders is allocated by malloc()
+        free(userdata->mszReaders);
+#endif
+    }
+    userdata->mszReaders = NULL;
+}
+
+// Having no reader attached is not an error here, mszReaders is left NULL
+static int pcsc_list_readers(struct pcsc_userdata *userdata)
 {
     int ret;
     DWORD dwReaders;
 
-    pcsc_ctx = 0;
-    pcsc_hCard = 0;
-    pcsc_mszReaders = NULL;
-
-    ret = SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL, &pcsc_ctx);
-    if (ret != SCARD_S_SUCCESS)
-    {
-        fprintf(stderr, "SCardEstablishContext() failed: %08X\n", ret);
-        return -1;
-    }
+    pcsc_free_readers(userdata);
 
 #ifdef SCARD_AUTOALLOCATE
     dwReaders = SCARD_AUTOALLOCATE;
-    ret = SCardListReaders(pcsc_ctx, NULL, (LPSTR)&pcsc_mszReaders, &dwReaders);
+    ret = SCardListReaders(userdata->ctx, NULL, (LPSTR)&userdata->mszReaders, &dwReaders);
 #else
     // macOS does not support SCARD_AUTOALLOCATE, so we need to call SCardListReaders twice.
     // First call to get the size of the buffer, second call to get the actual data.
-    ret = SCardListReaders(pcsc_ctx, NULL, NULL, &dwReaders);
+    ret = SCardListReaders(userdata->ctx, NULL, NULL, &dwReaders);
+    if (ret == SCARD_E_NO_READERS_AVAILABLE)
+    {
+        return 0;
+    }
     if (ret != SCARD_S_SUCCESS)
     {
         fprintf(stderr, "SCardListReaders() failed: %08X\n", ret);
         return -1;
     }
-    pcsc_mszReaders = malloc(sizeof(char) * dwReaders);
-    if (pcsc_mszReaders == NULL)
+    userdata->mszReaders = malloc(sizeof(char) * dwReaders);
+    if (userdata->mszReaders == NULL)
     {
         fprintf(stderr, "malloc: not enough memory\n");
         return -1;
     }
-    ret = SCardListReaders(pcsc_ctx, NULL, pcsc_mszReaders, &dwReaders);
+    ret = SCardListReaders(userdata->ctx, NULL, userdata->mszReaders, &dwReaders);
 #endif
+    if (ret == SCARD_E_NO_READERS_AVAILABLE)
+    {
+        pcsc_free_readers(userdata);
+        return 0;
+    }
     if (ret != SCARD_S_SUCCESS)
     {
+        userdata->mszReaders = NULL;
         fprintf(stderr, "SCardListReaders() failed: %08X\n", ret);
         return -1;
     }
@@ -74,18 +107,41 @@ static int pcsc_ctx_open(void)
     return 0;
 }
 
-static int pcsc_iter_reader(int (*callback)(int index, const char *reader, void *userdata), void *userdata)
+static int pcsc_ctx_open(struct pcsc_userdata *userdata)
+{
+    int ret;
+
+    userdata->ctx = 0;
+    userdata->hCard = 0;
+    userdata->mszReaders = NULL;
+
+    ret = SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL, &userdata->ctx);
+    if (ret != SCARD_S_SUCCESS)
+    {
+        fprintf(stderr, "SCardEstablishContext() failed: %08X\n", ret);
+        return -1;
+    }
+
+    return pcsc_list_readers(userdata);
+}
+
+static int pcsc_iter_reader(struct pcsc_userdata *userdata, int (*callback)(struct pcsc_userdata *userdata, int index, const char *reader, void *context), void *context)
 {
     int ret;
     LPSTR psReader;
 
-    psReader = pcsc_mszReaders;
+    if (userdata->mszReaders == NULL)
+    {
+        return -1;
+    }
+
+    psReader = userdata->mszReaders;
     for (int i = 0, n = 0;; i++)
     {
-        char *p = pcsc_mszReaders + i;
+        char *p = userdata->mszReaders + i;
         if (*p == '\0')
         {
-            ret = callback(n, psReader, userdata);
+            ret = callback(userdata, n, psReader, context);
             if (ret < 0)
                 return -1;
             if (ret > 0)
@@ -101,71 +157,74 @@ static int pcsc_iter_reader(int (*callback)(int index, const char *reader, void
     return -1;
 }
 
-static int pcsc_open_hCard_iter(int index, const char *reader, void *userdata)
+static int pcsc_open_hCard_iter(struct pcsc_userdata *userdata, int index, const char *reader, void *context)
 {
     int ret;
-    int id;
-    DWORD dwActiveProtocol;
 
-    id = 0;
-    if (getenv(INTERFACE_SELECT_ENV))
+    if (userdata->index != index)
     {
-        id = atoi(getenv(INTERFACE_SELECT_ENV));
+        return 0;
     }
 
-    if (id != index)
+    userdata->lock = apdu_lock_acquire(context, "pcsc", reader);
+    if (userdata->lock == -1)
     {
-        return 0;
+        userdata->lock = APDU_LOCK_NONE;
+        return -1;
     }
 
-    ret = SCardConnect(pcsc_ctx, reader, SCARD_SHARE_EXCLUSIVE, SCARD_PROTOCOL_T0, &pcsc_hCard, &dwActiveProtocol);
+    ret = SCardConnect(userdata->ctx, reader, userdata->shared ? SCARD_SHARE_SHARED : SCARD_SHARE_EXCLUSIVE, SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1, &userdata->hCard, &userdata->dwActiveProtocol);
     if (ret != SCARD_S_SUCCESS)
     {
         fprintf(stderr, "SCardConnect() failed: %08X\n", ret);
+        apdu_lock_release(userdata->lock);
+        userdata->lock = APDU_LOCK_NONE;
         return -1;
     }
 
+    // T=1 carries case 4 responses directly and extended length APDUs unchanged, T=0 needs GET RESPONSE for both
+    userdata->ifstruct->extended_length = userdata->dwActiveProtocol == SCARD_PROTOCOL_T1;
+
     return 1;
 }
 
-static int pcsc_open_hCard(void)
+static int pcsc_open_hCard(struct pcsc_userdata *userdata, struct euicc_ctx *ctx)
 {
-    return pcsc_iter_reader(pcsc_open_hCard_iter, NULL);
+    return pcsc_iter_reader(userdata, pcsc_open_hCard_iter, ctx);
 }
 
-static void pcsc_close(void)
+static void pcsc_disconnect(struct pcsc_userdata *userdata)
 {
-    if (pcsc_mszReaders)
+    if (userdata->hCard)
     {
-// macOS does not support SCARD_AUTOALLOCATE, so we need to free the buffer manually.
-#ifdef SCARD_AUTOALLOCATE
-        SCardFreeMemory(pcsc_ctx, pcsc_mszReaders);
-#else
-        // on macOS, pcsc_mszReaders is allocated by malloc()
-        free(pcsc_mszReaders);
-#endif
+        // A shared card stays powered so the next process skips the cold reset
+        SCardDisconnect(userdata->hCard, userdata->shared ? SCARD_LEAVE_CARD : SCARD_UNPOWER_CARD);
     }
+    userdata->hCard = 0;
+    userdata->dwActiveProtocol = 0;
+    apdu_lock_release(userdata->lock);
+    userdata->lock = APDU_LOCK_NONE;
+}
 
-    if (pcsc_hCard)
-    {
-        SCardDisconnect(pcsc_hCard, SCARD_UNPOWER_CARD);
-    }
-    if (pcsc_ctx)
+static void pcsc_close(struct pcsc_userdata *userdata)
+{
+    pcsc_disconnect(userdata);
+    pcsc_free_readers(userdata);
+
+    if (userdata->ctx)
     {
-        SCardReleaseContext(pcsc_ctx);
+        SCardReleaseContext(userdata->ctx);
     }
-    pcsc_ctx = 0;
-    pcsc_hCard = 0;
-    pcsc_mszReaders = NULL;
+    userdata->ctx = 0;
 }
 
-static int pcsc_transmit_lowlevel(uint8_t *rx, uint32_t *rx_len, const uint8_t *tx, const uint8_t tx_len)
+static int pcsc_transmit_lowlevel(struct pcsc_userdata *userdata, uint8_t *rx, uint32_t *rx_len, const uint8_t *tx, const uint32_t tx_len)
 {
     int ret;
     DWORD rx_len_merged;
 
     rx_len_merged = *rx_len;
-    ret = SCardTransmit(pcsc_hCard, SCARD_PCI_T0, tx, tx_len, NULL, rx, &rx_len_merged);
+    ret = SCardTransmit(userdata->hCard, userdata->dwActiveProtocol == SCARD_PROTOCOL_T1 ? SCARD_PCI_T1 : SCARD_PCI_T0, tx, tx_len, NULL, rx, &rx_len_merged);
     if (ret != SCARD_S_SUCCESS)
     {
         fprintf(stderr, "SCardTransmit() failed: %08X\n", ret);
@@ -176,7 +235,7 @@ static int pcsc_transmit_lowlevel(uint8_t *rx, uint32_t *rx_len, const uint8_t *
     return 0;
 }
 
-static void pcsc_logic_channel_close(uint8_t channel)
+static void pcsc_logic_channel_close(struct pcsc_userdata *userdata, uint8_t channel)
 {
     uint8_t tx[sizeof(APDU_CLOSELOGICCHANNEL) - 1];
     uint8_t rx[EUICC_INTERFACE_BUFSZ];
@@ -187,10 +246,10 @@ static void pcsc_logic_channel_close(uint8_t channel)
 
     rx_len = sizeof(rx);
 
-    pcsc_transmit_lowlevel(rx, &rx_len, tx, sizeof(tx));
+    pcsc_transmit_lowlevel(userdata, rx, &rx_len, tx, sizeof(tx));
 }
 
-static int pcsc_logic_channel_open(const uint8_t *aid, uint8_t aid_len)
+static int pcsc_logic_channel_open(struct pcsc_userdata *userdata, const uint8_t *aid, uint8_t aid_len)
 {
     int channel = 0;
     uint8_t tx[EUICC_INTERFACE_BUFSZ];
@@ -204,7 +263,7 @@ static int pcsc_logic_channel_open(const uint8_t *aid, uint8_t aid_len)
     }
 
     rx_len = sizeof(rx);
-    if (pcsc_transmit_lowlevel(rx, &rx_len, (const uint8_t *)APDU_OPENLOGICCHANNEL, sizeof(APDU_OPENLOGICCHANNEL) - 1) < 0)
+    if (pcsc_transmit_lowlevel(userdata, rx, &rx_len, (const uint8_t *)APDU_OPENLOGICCHANNEL, sizeof(APDU_OPENLOGICCHANNEL) - 1) < 0)
     {
         goto err;
     }
@@ -231,7 +290,7 @@ static int pcsc_logic_channel_open(const uint8_t *aid, uint8_t aid_len)
     tx[4] = aid_len;
 
     rx_len = sizeof(rx);
-    if (pcsc_transmit_lowlevel(rx, &rx_len, tx, tx_wptr - tx) < 0)
+    if (pcsc_transmit_lowlevel(userdata, rx, &rx_len, tx, tx_wptr - tx) < 0)
     {
         goto err;
     }
@@ -253,7 +312,7 @@ static int pcsc_logic_channel_open(const uint8_t *aid, uint8_t aid_len)
 err:
     if (channel)
     {
-        pcsc_logic_channel_close(channel);
+        pcsc_logic_channel_close(userdata, channel);
     }
 
     return -1;
@@ -307,38 +366,137 @@ err:
     return -1;
 }
 
-static int apdu_interface_connect(struct euicc_ctx *ctx)
+static int pcsc_transaction_begin(struct pcsc_userdata *userdata)
+{
+    int ret;
+
+    ret = SCardBeginTransaction(userdata->hCard);
+    if (ret == SCARD_W_RESET_CARD)
+    {
+        // Another process reset the card, reconnecting acknowledges it
+        ret = SCardReconnect(userdata->hCard, SCARD_SHARE_SHARED, SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1, SCARD_LEAVE_CARD, &userdata->dwActiveProtocol);
+        if (ret == SCARD_S_SUCCESS)
+        {
+            ret = SCardBeginTransaction(userdata->hCard);
+        }
+    }
+    if (ret != SCARD_S_SUCCESS)
+    {
+        fprintf(stderr, "SCardBeginTransaction() failed: %08X\n", ret);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void pcsc_transaction_end(struct pcsc_userdata *userdata)
+{
+    SCardEndTransaction(userdata->hCard, SCARD_LEAVE_CARD);
+}
+
+// Sent once the card is powered, every reset forgets it
+static int pcsc_terminal_capabilities(struct pcsc_userdata *userdata)
 {
     uint8_t rx[EUICC_INTERFACE_BUFSZ];
     uint32_t rx_len;
 
-    if (pcsc_open_hCard() < 0)
+    if (userdata->shared && pcsc_transaction_begin(userdata) < 0)
     {
         return -1;
     }
 
     rx_len = sizeof(rx);
-    pcsc_transmit_lowlevel(rx, &rx_len, (const uint8_t *)APDU_TERMINAL_CAPABILITIES, sizeof(APDU_TERMINAL_CAPABILITIES) - 1);
+    pcsc_transmit_lowlevel(userdata, rx, &rx_len, (const uint8_t *)APDU_TERMINAL_CAPABILITIES, sizeof(APDU_TERMINAL_CAPABILITIES) - 1);
+
+    if (userdata->shared)
+    {
+        pcsc_transaction_end(userdata);
+    }
 
     return 0;
 }
 
+static int apdu_interface_connect(struct euicc_ctx *ctx)
+{
+    struct pcsc_userdata *userdata = ctx->apdu.interface->userdata;
+
+    if (pcsc_open_hCard(userdata, ctx) < 0)
+    {
+        return -1;
+    }
+
+    if (pcsc_terminal_capabilities(userdata) < 0)
+    {
+        pcsc_disconnect(userdata);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Warm reset on the handle already held, without listing the readers and connecting again
+static int apdu_interface_reconnect(struct euicc_ctx *ctx)
+{
+    struct pcsc_userdata *userdata = ctx->apdu.interface->userdata;
+    int ret;
+
+    ret = SCardReconnect(userdata->hCard, userdata->shared ? SCARD_SHARE_SHARED : SCARD_SHARE_EXCLUSIVE, SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1, SCARD_RESET_CARD, &userdata->dwActiveProtocol);
+    if (ret != SCARD_S_SUCCESS)
+    {
+        fprintf(stderr, "SCardReconnect() failed: %08X\n", ret);
+        return -1;
+    }
+    userdata->ifstruct->extended_length = userdata->dwActiveProtocol == SCARD_PROTOCOL_T1;
+
+    return pcsc_terminal_capabilities(userdata);
+}
+
+// The ATR, which names the card model rather than the reader it sits in
+static int apdu_interface_identity(struct euicc_ctx *ctx, char *identity, uint32_t identity_len)
+{
+    struct pcsc_userdata *userdata = ctx->apdu.interface->userdata;
+    BYTE atr[64];
+    DWORD atr_len = sizeof(atr);
+    DWORD reader_len = 0, state, protocol;
+    int ret;
+
+    ret = SCardStatus(userdata->hCard, NULL, &reader_len, &state, &protocol, atr, &atr_len);
+    if (ret != SCARD_S_SUCCESS || atr_len == 0)
+    {
+        return -1;
+    }
+
+    return euicc_hexutil_bin2hex(identity, identity_len, atr, atr_len);
+}
+
+static int apdu_interface_transaction_begin(struct euicc_ctx *ctx)
+{
+    return pcsc_transaction_begin(ctx->apdu.interface->userdata);
+}
+
+static void apdu_interface_transaction_end(struct euicc_ctx *ctx)
+{
+    pcsc_transaction_end(ctx->apdu.interface->userdata);
+}
+
 static void apdu_interface_disconnect(struct euicc_ctx *ctx)
 {
-    pcsc_close();
+    pcsc_disconnect(ctx->apdu.interface->userdata);
 }
 
 static int apdu_interface_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
 {
-    *rx = malloc(EUICC_INTERFACE_BUFSZ);
+    uint32_t rx_cap = ctx->apdu.interface->extended_length ? EUICC_INTERFACE_BUFSZ_EXTENDED : EUICC_INTERFACE_BUFSZ;
+
+    *rx = malloc(rx_cap);
     if (!*rx)
     {
         fprintf(stderr, "SCardTransmit() RX buffer alloc failed\n");
         return -1;
     }
-    *rx_len = EUICC_INTERFACE_BUFSZ;
+    *rx_len = rx_cap;
 
-    if (pcsc_transmit_lowlevel(*rx, rx_len, tx, tx_len) < 0)
+    if (pcsc_transmit_lowlevel(ctx->apdu.interface->userdata, *rx, rx_len, tx, tx_len) < 0)
     {
         free(*rx);
         *rx_len = 0;
@@ -348,19 +506,32 @@ static int apdu_interface_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t
     return 0;
 }
 
+static int apdu_interface_transmit_into(struct euicc_ctx *ctx, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    *rx_len = rx_cap;
+
+    if (pcsc_transmit_lowlevel(ctx->apdu.interface->userdata, rx, rx_len, tx, tx_len) < 0)
+    {
+        *rx_len = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
 static int apdu_interface_logic_channel_open(struct euicc_ctx *ctx, const uint8_t *aid, uint8_t aid_len)
 {
-    return pcsc_logic_channel_open(aid, aid_len);
+    return pcsc_logic_channel_open(ctx->apdu.interface->userdata, aid, aid_len);
 }
 
 static void apdu_interface_logic_channel_close(struct euicc_ctx *ctx, uint8_t channel)
 {
-    pcsc_logic_channel_close(channel);
+    pcsc_logic_channel_close(ctx->apdu.interface->userdata, channel);
 }
 
-static int pcsc_list_iter(int index, const char *reader, void *userdata)
+static int pcsc_list_iter(struct pcsc_userdata *userdata, int index, const char *reader, void *context)
 {
-    cJSON *json = userdata;
+    cJSON *json = context;
     cJSON *jreader;
     char index_str[16];
 
@@ -390,29 +561,290 @@ static int pcsc_list_iter(int index, const char *reader, void *userdata)
     return 0;
 }
 
-static int libapduinterface_init(struct euicc_apdu_interface *ifstruct)
+#define PCSC_PNP_NOTIFICATION "\\\\?PnP?\\Notification"
+#define PCSC_WATCH_POLL_MS 1000
+
+static void pcsc_watch_emit(const char *event, int index, const char *reader, const SCARD_READERSTATE *state)
+{
+    cJSON *payload;
+    char index_str[16];
+    char atr[sizeof(state->rgbAtr) * 2 + 1];
+
+    snprintf(index_str, sizeof(index_str), "%d", index);
+
+    payload = cJSON_CreateObject();
+    if (!payload)
+    {
+        return;
+    }
+
+    cJSON_AddStringOrNullToObject(payload, "event", event);
+    cJSON_AddStringOrNullToObject(payload, "env", index_str);
+    cJSON_AddStringOrNullToObject(payload, "name", reader);
+    if (state && state->cbAtr > 0 && state->cbAtr <= sizeof(state->rgbAtr) && euicc_hexutil_bin2hex(atr, sizeof(atr), state->rgbAtr, state->cbAtr) == 0)
+    {
+        cJSON_AddStringOrNullToObject(payload, "atr", atr);
+    }
+
+    json_print(payload);
+    cJSON_Delete(payload);
+    fflush(stdout);
+}
+
+// Runs the queued command against the reader a card was just inserted into
+static void pcsc_watch_trigger(int index, const char *command)
+{
+    char index_str[16];
+
+    if (command == NULL)
+    {
+        return;
+    }
+
+    snprintf(index_str, sizeof(index_str), "%d", index);
+#ifdef _WIN32
+    _putenv_s(INTERFACE_SELECT_ENV, index_str);
+#else
+    setenv(INTERFACE_SELECT_ENV, index_str, 1);
+#endif
+
+    fflush(stdout);
+    if (system(command) != 0)
+    {
+        fprintf(stderr, "watch: command failed for reader %d\n", index);
+    }
+}
+
+// Rebuilds the reader table from a fresh SCardListReaders, keeping the known state of readers that are still there.
+// states[0] is always the PnP pseudo reader.
+static int pcsc_watch_refresh(struct pcsc_userdata *userdata, SCARD_READERSTATE **states, DWORD *count)
+{
+    SCARD_READERSTATE *nstates = NULL;
+    DWORD ncount = 1;
+    const char *p;
+
+    if (pcsc_list_readers(userdata) < 0)
+    {
+        return -1;
+    }
+
+    for (p = userdata->mszReaders; p && *p; p += strlen(p) + 1)
+    {
+        ncount++;
+    }
+
+    nstates = calloc(ncount, sizeof(SCARD_READERSTATE));
+    if (nstates == NULL)
+    {
+        return -1;
+    }
+    nstates[0] = (*states)[0];
+
+    ncount = 1;
+    for (p = userdata->mszReaders; p && *p; p += strlen(p) + 1, ncount++)
+    {
+        DWORD i;
+
+        for (i = 1; i < *count; i++)
+        {
+            if ((*states)[i].szReader && strcmp((*states)[i].szReader, p) == 0)
+            {
+                break;
+            }
+        }
+
+        if (i < *count)
+        {
+            nstates[ncount] = (*states)[i];
+            (*states)[i].szReader = NULL;
+            continue;
+        }
+
+        nstates[ncount].szReader = strdup(p);
+        if (nstates[ncount].szReader == NULL)
+        {
+            goto err;
+        }
+        nstates[ncount].dwCurrentState = SCARD_STATE_UNAWARE;
+        pcsc_watch_emit("reader_add", ncount - 1, p, NULL);
+    }
+
+    for (DWORD i = 1; i < *count; i++)
+    {
+        if ((*states)[i].szReader == NULL)
+        {
+            continue;
+        }
+        if ((*states)[i].dwCurrentState & SCARD_STATE_PRESENT)
+        {
+            pcsc_watch_emit("card_remove", -1, (*states)[i].szReader, NULL);
+        }
+        pcsc_watch_emit("reader_remove", -1, (*states)[i].szReader, NULL);
+        free((void *)(*states)[i].szReader);
+    }
+
+    free(*states);
+    *states = nstates;
+    *count = ncount;
+    return 0;
+
+err:
+    for (DWORD i = 1; i < ncount; i++)
+    {
+        free((void *)nstates[i].szReader);
+    }
+    free(nstates);
+    return -1;
+}
+
+// Reports readers and cards coming and going until the PC/SC service goes away
+static int pcsc_watch(struct pcsc_userdata *userdata, const char *command)
+{
+    int fret = 0;
+    int ret;
+    SCARD_READERSTATE *states;
+    DWORD count = 1;
+    int pnp = 1;
+
+    states = calloc(1, sizeof(SCARD_READERSTATE));
+    if (states == NULL)
+    {
+        return -1;
+    }
+    states[0].szReader = PCSC_PNP_NOTIFICATION;
+    states[0].dwCurrentState = SCARD_STATE_UNAWARE;
+
+    // Start from an empty table so readers already attached are reported as well
+    pcsc_free_readers(userdata);
+    if (pcsc_watch_refresh(userdata, &states, &count) < 0)
+    {
+        goto err;
+    }
+
+    while (1)
+    {
+        int refresh = 0;
+
+        // Without PnP support the table is refreshed on every poll instead
+        ret = SCardGetStatusChange(userdata->ctx, pnp ? INFINITE : PCSC_WATCH_POLL_MS, pnp ? states : states + 1, pnp ? count : count - 1);
+        if (ret == SCARD_E_TIMEOUT)
+        {
+            refresh = 1;
+        }
+        else if (ret != SCARD_S_SUCCESS)
+        {
+            fprintf(stderr, "SCardGetStatusChange() failed: %08X\n", ret);
+            goto err;
+        }
+
+        if (pnp && ret == SCARD_S_SUCCESS && (states[0].dwEventState & SCARD_STATE_CHANGED))
+        {
+            if (states[0].dwEventState & SCARD_STATE_UNKNOWN)
+            {
+                pnp = 0;
+            }
+            states[0].dwCurrentState = states[0].dwEventState & ~SCARD_STATE_CHANGED;
+            refresh = 1;
+        }
+
+        for (DWORD i = 1; ret == SCARD_S_SUCCESS && i < count; i++)
+        {
+            DWORD was = states[i].dwCurrentState & SCARD_STATE_PRESENT;
+            DWORD now = states[i].dwEventState & SCARD_STATE_PRESENT;
+
+            if (!(states[i].dwEventState & SCARD_STATE_CHANGED))
+            {
+                continue;
+            }
+            states[i].dwCurrentState = states[i].dwEventState & ~SCARD_STATE_CHANGED;
+
+            if (now && !was)
+            {
+                pcsc_watch_emit("card_insert", i - 1, states[i].szReader, &states[i]);
+                pcsc_watch_trigger(i - 1, command);
+            }
+            else if (!now && was)
+            {
+                pcsc_watch_emit("card_remove", i - 1, states[i].szReader, NULL);
+            }
+            if (states[i].dwEventState & (SCARD_STATE_UNKNOWN | SCARD_STATE_UNAVAILABLE))
+            {
+                refresh = 1;
+            }
+        }
+
+        if (refresh && pcsc_watch_refresh(userdata, &states, &count) < 0)
+        {
+            goto err;
+        }
+    }
+
+err:
+    fret = -1;
+    for (DWORD i = 1; i < count; i++)
+    {
+        free((void *)states[i].szReader);
+    }
+    free(states);
+    return fret;
+}
+
+LPAC_BIND_APDU_DEFINE(apdu_interface_transmit, apdu_interface_transmit_into)
+
+static int libapduinterface_init(struct euicc_apdu_interface *ifstruct, const char *device)
 {
+    struct pcsc_userdata *userdata;
+
     memset(ifstruct, 0, sizeof(struct euicc_apdu_interface));
 
-    if (pcsc_ctx_open() < 0)
+    userdata = calloc(1, sizeof(struct pcsc_userdata));
+    if (userdata == NULL)
     {
         return -1;
     }
 
+    if (device == NULL)
+    {
+        device = getenv(INTERFACE_SELECT_ENV);
+    }
+    if (device != NULL)
+    {
+        userdata->index = atoi(device);
+    }
+    userdata->shared = getenv(INTERFACE_SHARED_ENV) != NULL;
+    userdata->lock = APDU_LOCK_NONE;
+
+    if (pcsc_ctx_open(userdata) < 0)
+    {
+        pcsc_close(userdata);
+        free(userdata);
+        return -1;
+    }
+
     ifstruct->connect = apdu_interface_connect;
     ifstruct->disconnect = apdu_interface_disconnect;
     ifstruct->logic_channel_open = apdu_interface_logic_channel_open;
     ifstruct->logic_channel_close = apdu_interface_logic_channel_close;
-    ifstruct->transmit = apdu_interface_transmit;
+    ifstruct->transmit = LPAC_BIND_APDU_TRANSMIT(apdu_interface_transmit);
+    ifstruct->transmit_into = LPAC_BIND_APDU_TRANSMIT_INTO(apdu_interface_transmit_into);
+    ifstruct->identity = apdu_interface_identity;
+    ifstruct->reconnect = apdu_interface_reconnect;
+    if (userdata->shared)
+    {
+        ifstruct->transaction_begin = apdu_interface_transaction_begin;
+        ifstruct->transaction_end = apdu_interface_transaction_end;
+    }
+    ifstruct->userdata = userdata;
+    userdata->ifstruct = ifstruct;
 
     return 0;
 }
 
-static int libapduinterface_main(int argc, char **argv)
+static int libapduinterface_main(struct euicc_apdu_interface *ifstruct, int argc, char **argv)
 {
     if (argc < 2)
     {
-        fprintf(stderr, "Usage: %s <list>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <list|watch [command]>\n", argv[0]);
         return -1;
     }
 
@@ -438,7 +870,7 @@ static int libapduinterface_main(int argc, char **argv)
             return -1;
         }
 
-        pcsc_iter_reader(pcsc_list_iter, data);
+        pcsc_iter_reader(ifstruct->userdata, pcsc_list_iter, data);
 
         if (!cJSON_AddItemToObject(payload, "data", data))
         {
@@ -450,17 +882,32 @@ static int libapduinterface_main(int argc, char **argv)
         return 0;
     }
 
+    if (strcmp(argv[1], "watch") == 0)
+    {
+        return pcsc_watch(ifstruct->userdata, argc > 2 ? argv[2] : NULL);
+    }
+
     return 0;
 }
 
-static void libapduinterface_fini(void)
+static void libapduinterface_fini(struct euicc_apdu_interface *ifstruct)
 {
+    struct pcsc_userdata *userdata = ifstruct->userdata;
+
+    if (userdata == NULL)
+    {
+        return;
+    }
+
+    pcsc_close(userdata);
+    free(userdata);
+    ifstruct->userdata = NULL;
 }
 
 const struct euicc_driver driver_apdu_pcsc = {
     .type = DRIVER_APDU,
     .name = "pcsc",
-    .init = (int (*)(void *))libapduinterface_init,
-    .main = libapduinterface_main,
-    .fini = libapduinterface_fini,
+    .init = (int (*)(void *, const char *))libapduinterface_init,
+    .main = (int (*)(void *, int, char **))libapduinterface_main,
+    .fini = (void (*)(void *))libapduinterface_fini,
 };
@@ -0,0 +1,202 @@
+#include "qmi.h"
+
+#include <euicc/euicc.h>
+#include <euicc/interface.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "qmi_common.h"
+#include "qmi_helpers.h"
+
+struct qmi_userdata
+{
+    struct qmi_data qmi;
+    char *device;
+    QmiDevice *qmiDevice;
+};
+
+static guint8 qmi_cid_load(const char *path)
+{
+    FILE *fcid;
+    unsigned int cid;
+    guint8 ret = QMI_CID_NONE;
+
+    if (path == NULL)
+    {
+        return QMI_CID_NONE;
+    }
+
+    fcid = fopen(path, "r");
+    if (fcid == NULL)
+    {
+        return QMI_CID_NONE;
+    }
+    if (fscanf(fcid, "%u", &cid) == 1 && cid > 0 && cid <= 0xFF)
+    {
+        ret = cid;
+    }
+    fclose(fcid);
+
+    return ret;
+}
+
+static void qmi_cid_store(const char *path, guint8 cid)
+{
+    FILE *fcid;
+
+    fcid = fopen(path, "w");
+    if (fcid == NULL)
+    {
+        return;
+    }
+    fprintf(fcid, "%u\n", cid);
+    fclose(fcid);
+}
+
+static int apdu_interface_connect(struct euicc_ctx *ctx)
+{
+    struct qmi_userdata *userdata = ctx->apdu.interface->userdata;
+    struct qmi_data *qmi_priv = &userdata->qmi;
+    const char *cid_path = getenv("QMI_CID_FILE");
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GFile) file = NULL;
+    QmiClient *client = NULL;
+    guint8 cid;
+
+    qmi_priv->context = g_main_context_new();
+
+    file = g_file_new_for_path(userdata->device);
+
+    userdata->qmiDevice = qmi_device_new_sync(file, qmi_priv->context, &error);
+    if (!userdata->qmiDevice)
+    {
+        fprintf(stderr, "error: create QMI device from %s failed: %s\n", userdata->device, error->message);
+        return -1;
+    }
+
+    // Go through qmi-proxy, so ModemManager and lpac share the control channel
+    qmi_device_open_sync(userdata->qmiDevice, QMI_DEVICE_OPEN_FLAGS_PROXY, qmi_priv->context, &error);
+    if (error)
+    {
+        fprintf(stderr, "error: open QMI device failed: %s\n", error->message);
+        return -1;
+    }
+
+    cid = qmi_cid_load(cid_path);
+    client = qmi_device_allocate_client_sync(userdata->qmiDevice, cid, qmi_priv->context, &error);
+    if (!client && cid != QMI_CID_NONE)
+    {
+        // The stored client is gone, e.g. the modem was reset
+        g_clear_error(&error);
+        client = qmi_device_allocate_client_sync(userdata->qmiDevice, QMI_CID_NONE, qmi_priv->context, &error);
+    }
+    if (!client)
+    {
+        fprintf(stderr, "error: allocate QMI client failed: %s\n", error->message);
+        return -1;
+    }
+
+    if (cid_path)
+    {
+        qmi_cid_store(cid_path, qmi_client_get_cid(client));
+    }
+
+    qmi_priv->uimClient = QMI_CLIENT_UIM(client);
+
+    return 0;
+}
+
+static void apdu_interface_disconnect(struct euicc_ctx *ctx)
+{
+    struct qmi_userdata *userdata = ctx->apdu.interface->userdata;
+    struct qmi_data *qmi_priv = &userdata->qmi;
+    g_autoptr(GError) error = NULL;
+    QmiDeviceReleaseClientFlags flags = QMI_DEVICE_RELEASE_CLIENT_FLAGS_RELEASE_CID;
+
+    // A persistent client keeps its ID allocated in the modem for the next run
+    if (getenv("QMI_CID_FILE"))
+    {
+        flags = QMI_DEVICE_RELEASE_CLIENT_FLAGS_NONE;
+    }
+
+    if (qmi_priv->uimClient)
+    {
+        qmi_device_release_client_sync(userdata->qmiDevice, QMI_CLIENT(qmi_priv->uimClient), flags, qmi_priv->context, &error);
+        qmi_priv->uimClient = NULL;
+    }
+
+    qmi_data_release_input(qmi_priv);
+
+    if (userdata->qmiDevice)
+    {
+        g_object_unref(userdata->qmiDevice);
+        userdata->qmiDevice = NULL;
+    }
+
+    g_main_context_unref(qmi_priv->context);
+    qmi_priv->context = NULL;
+}
+
+static int libapduinterface_init(struct euicc_apdu_interface *ifstruct, const char *device)
+{
+    struct qmi_userdata *userdata;
+
+    memset(ifstruct, 0, sizeof(struct euicc_apdu_interface));
+
+    if (device == NULL)
+    {
+        device = getenv("QMI_DEVICE");
+    }
+    if (device == NULL)
+    {
+        device = "/dev/cdc-wdm0";
+    }
+
+    userdata = calloc(1, sizeof(struct qmi_userdata));
+    if (userdata == NULL)
+    {
+        return -1;
+    }
+    userdata->device = strdup(device);
+    if (userdata->device == NULL)
+    {
+        free(userdata);
+        return -1;
+    }
+    qmi_data_init(&userdata->qmi);
+
+    ifstruct->connect = apdu_interface_connect;
+    ifstruct->disconnect = apdu_interface_disconnect;
+    qmi_apdu_interface_setup(ifstruct);
+    ifstruct->userdata = userdata;
+
+    return 0;
+}
+
+static int libapduinterface_main(struct euicc_apdu_interface *ifstruct, int argc, char **argv)
+{
+    return 0;
+}
+
+static void libapduinterface_fini(struct euicc_apdu_interface *ifstruct)
+{
+    struct qmi_userdata *userdata = ifstruct->userdata;
+
+    if (userdata == NULL)
+    {
+        return;
+    }
+
+    qmi_data_fini(&userdata->qmi);
+    free(userdata->device);
+    free(userdata);
+    ifstruct->userdata = NULL;
+}
+
+const struct euicc_driver driver_apdu_qmi = {
+    .type = DRIVER_APDU,
+    .name = "qmi",
+    .init = (int (*)(void *, const char *))libapduinterface_init,
+    .main = (int (*)(void *, int, char **))libapduinterface_main,
+    .fini = (void (*)(void *))libapduinterface_fini,
+};
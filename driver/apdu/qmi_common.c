@@ -0,0 +1,489 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (c) 2024, Luca Weiss <luca.weiss@fairphone.com>
+ */
+#include "qmi_common.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "qmi_helpers.h"
+#include "bind.h"
+
+#define QMI_PIPELINE_DEPTH_DEFAULT 4
+#define QMI_SLOT_MAX 2
+
+// Live instances, so that leaked channels can be closed on exit
+static struct qmi_data *instances = NULL;
+
+struct qmi_apdu_request
+{
+    struct qmi_data *qmi_priv;
+    uint32_t index;
+    gint64 start;
+    int done;
+    QmiMessageUimSendApduOutput *output;
+    GError *error;
+};
+
+static void qmi_logic_channel_close(struct qmi_data *qmi_priv, uint8_t channel);
+
+static QmiMessageUimSendApduInput *qmi_send_apdu_input(struct qmi_data *qmi_priv, const uint8_t *tx, uint32_t tx_len)
+{
+    if (qmi_priv->apduInput == NULL)
+    {
+        qmi_priv->apduInput = qmi_message_uim_send_apdu_input_new();
+        qmi_priv->apduData = g_array_sized_new(FALSE, FALSE, sizeof(guint8), 512);
+    }
+
+    g_array_set_size(qmi_priv->apduData, tx_len);
+    memcpy(qmi_priv->apduData->data, tx, tx_len);
+
+    qmi_message_uim_send_apdu_input_set_slot(qmi_priv->apduInput, qmi_priv->uimSlot, NULL);
+    qmi_message_uim_send_apdu_input_set_channel_id(qmi_priv->apduInput, qmi_priv->lastChannelId, NULL);
+    qmi_message_uim_send_apdu_input_set_apdu(qmi_priv->apduInput, qmi_priv->apduData, NULL);
+
+    return qmi_priv->apduInput;
+}
+
+static void qmi_report_latency(struct qmi_data *qmi_priv, uint32_t index, gint64 start)
+{
+    if (qmi_priv->debugLatency)
+    {
+        fprintf(stderr, "QMI_LATENCY: SEND APDU #%u %" G_GINT64_FORMAT " us\n", index, g_get_monotonic_time() - start);
+    }
+}
+
+// *apdu_res points into output, which stays owned by the caller
+static int qmi_send_apdu_result(QmiMessageUimSendApduOutput *output, GError *error, GArray **apdu_res)
+{
+    if (!output)
+    {
+        fprintf(stderr, "error: send apdu operation failed: %s\n", error ? error->message : "unknown");
+        return -1;
+    }
+
+    if (!qmi_message_uim_send_apdu_output_get_result(output, &error))
+    {
+        fprintf(stderr, "error: send apdu operation failed: %s\n", error->message);
+        g_error_free(error);
+        return -1;
+    }
+
+    if (!qmi_message_uim_send_apdu_output_get_apdu_response(output, apdu_res, &error))
+    {
+        fprintf(stderr, "error: get apdu response operation failed: %s\n", error->message);
+        g_error_free(error);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int qmi_apdu_interface_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    struct qmi_data *qmi_priv = ctx->apdu.interface->userdata;
+    int fret = 0;
+    GError *error = NULL;
+    QmiMessageUimSendApduOutput *output;
+    GArray *apdu_res = NULL;
+    gint64 start;
+
+    *rx = NULL;
+    *rx_len = 0;
+
+    start = g_get_monotonic_time();
+    output = qmi_client_uim_send_apdu_sync(qmi_priv->uimClient, qmi_send_apdu_input(qmi_priv, tx, tx_len), qmi_priv->context, &error);
+    qmi_report_latency(qmi_priv, 0, start);
+
+    if (qmi_send_apdu_result(output, error, &apdu_res) < 0)
+    {
+        goto err;
+    }
+
+    /* Convert response GArray into rx */
+    *rx = malloc(apdu_res->len);
+    if (!*rx)
+    {
+        goto err;
+    }
+    memcpy(*rx, apdu_res->data, apdu_res->len);
+    *rx_len = apdu_res->len;
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    if (output)
+        qmi_message_uim_send_apdu_output_unref(output);
+    g_clear_error(&error);
+    return fret;
+}
+
+static void qmi_send_apdu_ready(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    struct qmi_apdu_request *request = user_data;
+
+    request->output = qmi_client_uim_send_apdu_finish(QMI_CLIENT_UIM(source_object), res, &request->error);
+    request->done = 1;
+    qmi_report_latency(request->qmi_priv, request->index, request->start);
+}
+
+// Keeps up to pipelineDepth SEND APDU requests queued at the modem, which answers them in order. Requests queued
+// behind one not answered 90 00 still reach the card, the batch then ends with the count sent and no response,
+// and later batches go one request at a time.
+static int qmi_apdu_interface_transmit_batch(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *const *tx, const uint32_t *tx_len, uint32_t tx_count)
+{
+    struct qmi_data *qmi_priv = ctx->apdu.interface->userdata;
+    int fret = 0;
+    g_autoptr(GMainContextPusher) pusher = NULL;
+    struct qmi_apdu_request *requests = NULL;
+    uint32_t issued = 0;
+    uint32_t i;
+
+    *rx = NULL;
+    *rx_len = 0;
+
+    if (tx_count == 0)
+    {
+        return -1;
+    }
+
+    requests = calloc(tx_count, sizeof(struct qmi_apdu_request));
+    if (requests == NULL)
+    {
+        return -1;
+    }
+
+    pusher = g_main_context_pusher_new(qmi_priv->context);
+
+    for (i = 0; i < tx_count; i++)
+    {
+        GArray *apdu_res = NULL;
+        uint8_t sw1, sw2;
+
+        while (issued < tx_count && issued - i < (uint32_t)qmi_priv->pipelineDepth)
+        {
+            requests[issued].qmi_priv = qmi_priv;
+            requests[issued].index = issued;
+            requests[issued].start = g_get_monotonic_time();
+            qmi_client_uim_send_apdu(qmi_priv->uimClient, qmi_send_apdu_input(qmi_priv, tx[issued], tx_len[issued]), 10, NULL, qmi_send_apdu_ready, &requests[issued]);
+            issued++;
+        }
+
+        while (!requests[i].done)
+            g_main_context_iteration(qmi_priv->context, TRUE);
+
+        if (qmi_send_apdu_result(requests[i].output, requests[i].error, &apdu_res) < 0)
+        {
+            goto err;
+        }
+
+        if (apdu_res->len < 2)
+        {
+            goto err;
+        }
+        sw1 = apdu_res->data[apdu_res->len - 2];
+        sw2 = apdu_res->data[apdu_res->len - 1];
+
+        if (i + 1 == tx_count || apdu_res->len != 2 || sw1 != 0x90 || sw2 != 0x00)
+        {
+            if (issued > i + 1)
+            {
+                fprintf(stderr, "error: SEND APDU #%u answered %02X%02X with %u more already queued, no longer pipelining\n", i, sw1, sw2, issued - i - 1);
+                qmi_priv->pipelineDepth = 1;
+                fret = issued;
+                goto exit;
+            }
+            *rx = malloc(apdu_res->len);
+            if (*rx == NULL)
+            {
+                goto err;
+            }
+            memcpy(*rx, apdu_res->data, apdu_res->len);
+            *rx_len = apdu_res->len;
+            fret = i + 1;
+            goto exit;
+        }
+    }
+
+err:
+    fret = -1;
+exit:
+    // Requests already queued must complete before their slots go away
+    for (uint32_t j = 0; j < issued; j++)
+    {
+        while (!requests[j].done)
+            g_main_context_iteration(qmi_priv->context, TRUE);
+        if (requests[j].output)
+            qmi_message_uim_send_apdu_output_unref(requests[j].output);
+        g_clear_error(&requests[j].error);
+    }
+    free(requests);
+    return fret;
+}
+
+static int qmi_logic_channel_open(struct qmi_data *qmi_priv, int slot, const uint8_t *aid, uint8_t aid_len)
+{
+    g_autoptr(GError) error = NULL;
+    guint8 channel_id;
+
+    GArray *aid_data = g_array_new(FALSE, FALSE, sizeof(guint8));
+    for (int i = 0; i < aid_len; i++)
+        g_array_append_val(aid_data, aid[i]);
+
+    QmiMessageUimOpenLogicalChannelInput *input;
+    input = qmi_message_uim_open_logical_channel_input_new();
+    qmi_message_uim_open_logical_channel_input_set_slot(input, slot, NULL);
+    qmi_message_uim_open_logical_channel_input_set_aid(input, aid_data, NULL);
+
+    QmiMessageUimOpenLogicalChannelOutput *output;
+    output = qmi_client_uim_open_logical_channel_sync(qmi_priv->uimClient, input, qmi_priv->context, &error);
+
+    qmi_message_uim_open_logical_channel_input_unref(input);
+    g_array_unref(aid_data);
+
+    if (!output)
+    {
+        fprintf(stderr, "error: send Open Logical Channel command failed: %s\n", error->message);
+        return -1;
+    }
+
+    if (!qmi_message_uim_open_logical_channel_output_get_result(output, &error))
+    {
+        fprintf(stderr, "error: open logical channel operation failed: %s\n", error->message);
+        qmi_message_uim_open_logical_channel_output_unref(output);
+        return -1;
+    }
+
+    if (!qmi_message_uim_open_logical_channel_output_get_channel_id(output, &channel_id, &error))
+    {
+        fprintf(stderr, "error: get channel id operation failed: %s\n", error->message);
+        qmi_message_uim_open_logical_channel_output_unref(output);
+        return -1;
+    }
+    qmi_priv->lastChannelId = channel_id;
+
+    g_debug("Opened logical channel with id %d on slot %d", channel_id, slot);
+
+    qmi_message_uim_open_logical_channel_output_unref(output);
+
+    return channel_id;
+}
+
+// QMI_SLOT_CACHE_FILE holds the slot the eUICC was found in last time, 0 when unknown
+static int qmi_slot_cache_read(void)
+{
+    const char *path = getenv("QMI_SLOT_CACHE_FILE");
+    FILE *fp;
+    int slot = 0;
+
+    if (path == NULL)
+    {
+        return 0;
+    }
+    fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        return 0;
+    }
+    if (fscanf(fp, "%d", &slot) != 1 || slot < 1 || slot > QMI_SLOT_MAX)
+    {
+        slot = 0;
+    }
+    fclose(fp);
+
+    return slot;
+}
+
+static void qmi_slot_cache_write(int slot)
+{
+    const char *path = getenv("QMI_SLOT_CACHE_FILE");
+    FILE *fp;
+
+    if (path == NULL || qmi_slot_cache_read() == slot)
+    {
+        return;
+    }
+    fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        return;
+    }
+    fprintf(fp, "%d\n", slot);
+    fclose(fp);
+}
+
+static int qmi_apdu_interface_logic_channel_open(struct euicc_ctx *ctx, const uint8_t *aid, uint8_t aid_len)
+{
+    struct qmi_data *qmi_priv = ctx->apdu.interface->userdata;
+    int cached;
+    int ret = -1;
+
+    if (qmi_priv->uimSlot > 0)
+    {
+        return qmi_logic_channel_open(qmi_priv, qmi_priv->uimSlot, aid, aid_len);
+    }
+
+    // No slot given: the cached one first, then every slot in turn. The instance stays on the one found.
+    cached = qmi_slot_cache_read();
+    if (cached > 0)
+    {
+        ret = qmi_logic_channel_open(qmi_priv, cached, aid, aid_len);
+        if (ret >= 0)
+        {
+            qmi_priv->uimSlot = cached;
+            return ret;
+        }
+    }
+    for (int slot = 1; slot <= QMI_SLOT_MAX; slot++)
+    {
+        if (slot == cached)
+        {
+            continue;
+        }
+        ret = qmi_logic_channel_open(qmi_priv, slot, aid, aid_len);
+        if (ret >= 0)
+        {
+            qmi_priv->uimSlot = slot;
+            qmi_slot_cache_write(slot);
+            return ret;
+        }
+    }
+
+    return -1;
+}
+
+static void qmi_logic_channel_close(struct qmi_data *qmi_priv, uint8_t channel)
+{
+    g_autoptr(GError) error = NULL;
+
+    QmiMessageUimLogicalChannelInput *input;
+    input = qmi_message_uim_logical_channel_input_new();
+    qmi_message_uim_logical_channel_input_set_slot(input, qmi_priv->uimSlot, NULL);
+    qmi_message_uim_logical_channel_input_set_channel_id(input, channel, NULL);
+
+    QmiMessageUimLogicalChannelOutput *output;
+    output = qmi_client_uim_logical_channel_sync(qmi_priv->uimClient, input, qmi_priv->context, &error);
+
+    qmi_message_uim_logical_channel_input_unref(input);
+
+    if (error)
+    {
+        fprintf(stderr, "error: send Close Logical Channel command failed: %s\n", error->message);
+        return;
+    }
+
+    if (!qmi_message_uim_logical_channel_output_get_result(output, &error))
+    {
+        fprintf(stderr, "error: logical channel operation failed: %s\n", error->message);
+        return;
+    }
+
+    /* Mark channel as having been cleaned up */
+    if (channel == qmi_priv->lastChannelId)
+        qmi_priv->lastChannelId = -1;
+
+    g_debug("Closed logical channel with id %d", channel);
+
+    qmi_message_uim_logical_channel_output_unref(output);
+}
+
+static void qmi_apdu_interface_logic_channel_close(struct euicc_ctx *ctx, uint8_t channel)
+{
+    qmi_logic_channel_close(ctx->apdu.interface->userdata, channel);
+}
+
+// The modem reset the card itself, the UIM client and the slot it was found in stay valid
+static int qmi_apdu_interface_reconnect(struct euicc_ctx *ctx)
+{
+    struct qmi_data *qmi_priv = ctx->apdu.interface->userdata;
+
+    qmi_priv->lastChannelId = -1;
+    return 0;
+}
+
+static void qmi_cleanup(void)
+{
+    for (struct qmi_data *qmi_priv = instances; qmi_priv != NULL; qmi_priv = qmi_priv->next)
+    {
+        if (qmi_priv->lastChannelId != -1 && qmi_priv->uimClient != NULL)
+        {
+            fprintf(stderr, "Cleaning up leaked APDU channel %d\n", qmi_priv->lastChannelId);
+            qmi_logic_channel_close(qmi_priv, qmi_priv->lastChannelId);
+            qmi_priv->lastChannelId = -1;
+        }
+    }
+}
+
+static void qmi_sighandler(int sig)
+{
+    // This triggers atexit() hooks and therefore call qmi_cleanup()
+    exit(0);
+}
+
+void qmi_data_init(struct qmi_data *qmi_priv)
+{
+    static int cleanup_installed = 0;
+
+    qmi_priv->lastChannelId = -1;
+    qmi_priv->pipelineDepth = getenv("QMI_PIPELINE_DEPTH") ? atoi(getenv("QMI_PIPELINE_DEPTH")) : QMI_PIPELINE_DEPTH_DEFAULT;
+    if (qmi_priv->pipelineDepth < 1)
+    {
+        qmi_priv->pipelineDepth = 1;
+    }
+    qmi_priv->debugLatency = getenv("QMI_LATENCY_DEBUG") != NULL;
+
+    /*
+     * Allow the user to select the SIM card slot via environment variable.
+     * Look for the eUICC on the first logical channel open if not set.
+     */
+    qmi_priv->uimSlot = getenv("UIM_SLOT") ? atoi(getenv("UIM_SLOT")) : 0;
+
+    // Install cleanup routine
+    if (!cleanup_installed)
+    {
+        atexit(qmi_cleanup);
+        signal(SIGINT, qmi_sighandler);
+        cleanup_installed = 1;
+    }
+
+    qmi_priv->next = instances;
+    instances = qmi_priv;
+}
+
+void qmi_data_fini(struct qmi_data *qmi_priv)
+{
+    for (struct qmi_data **pp = &instances; *pp != NULL; pp = &(*pp)->next)
+    {
+        if (*pp == qmi_priv)
+        {
+            *pp = qmi_priv->next;
+            break;
+        }
+    }
+}
+
+void qmi_data_release_input(struct qmi_data *qmi_priv)
+{
+    if (qmi_priv->apduInput)
+    {
+        qmi_message_uim_send_apdu_input_unref(qmi_priv->apduInput);
+        g_array_unref(qmi_priv->apduData);
+        qmi_priv->apduInput = NULL;
+        qmi_priv->apduData = NULL;
+    }
+}
+
+LPAC_BIND_APDU_DEFINE_TRANSMIT(qmi_apdu_interface_transmit)
+
+void qmi_apdu_interface_setup(struct euicc_apdu_interface *ifstruct)
+{
+    ifstruct->logic_channel_open = qmi_apdu_interface_logic_channel_open;
+    ifstruct->logic_channel_close = qmi_apdu_interface_logic_channel_close;
+    ifstruct->transmit = LPAC_BIND_APDU_TRANSMIT(qmi_apdu_interface_transmit);
+    ifstruct->transmit_batch = qmi_apdu_interface_transmit_batch;
+    ifstruct->reconnect = qmi_apdu_interface_reconnect;
+}
@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (c) 2024, Luca Weiss <luca.weiss@fairphone.com>
+ */
+#pragma once
+#include <euicc/euicc.h>
+#include <euicc/interface.h>
+#include <libqmi-glib.h>
+
+// Shared by the QMI backends, must be the first member of their userdata
+struct qmi_data
+{
+    int lastChannelId;
+    // 0 until the first logical channel open found the slot holding the eUICC
+    int uimSlot;
+    GMainContext *context;
+    QmiClientUim *uimClient;
+    // Reused for every SEND APDU, libqmi serializes the input when the request is issued
+    QmiMessageUimSendApduInput *apduInput;
+    GArray *apduData;
+    int pipelineDepth;
+    int debugLatency;
+    struct qmi_data *next;
+};
+
+void qmi_data_init(struct qmi_data *qmi_priv);
+void qmi_data_fini(struct qmi_data *qmi_priv);
+void qmi_data_release_input(struct qmi_data *qmi_priv);
+void qmi_apdu_interface_setup(struct euicc_apdu_interface *ifstruct);
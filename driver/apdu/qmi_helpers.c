@@ -3,7 +3,7 @@
  * Copyright (c) 2024, Luca Weiss <luca.weiss@fairphone.com>
  */
 
-#include "qmi_qrtr_helpers.h"
+#include "qmi_helpers.h"
 
 static void
 async_result_ready(GObject *source_object,
@@ -16,6 +16,7 @@ async_result_ready(GObject *source_object,
     *result_out = g_object_ref(res);
 }
 
+#ifdef LPAC_WITH_APDU_QMI_QRTR
 QrtrBus *
 qrtr_bus_new_sync(GMainContext *context,
                   GError **error)
@@ -56,9 +57,32 @@ qmi_device_new_from_node_sync(QrtrNode *node,
 
     return qmi_device_new_from_node_finish(result, error);
 }
+#endif
+
+QmiDevice *
+qmi_device_new_sync(GFile *file,
+                    GMainContext *context,
+                    GError **error)
+{
+    g_autoptr(GMainContextPusher) pusher = NULL;
+    g_autoptr(GAsyncResult) result = NULL;
+
+    pusher = g_main_context_pusher_new(context);
+
+    qmi_device_new(file,
+                   NULL,
+                   async_result_ready,
+                   &result);
+
+    while (result == NULL)
+        g_main_context_iteration(context, TRUE);
+
+    return qmi_device_new_finish(result, error);
+}
 
 gboolean
 qmi_device_open_sync(QmiDevice *device,
+                     QmiDeviceOpenFlags flags,
                      GMainContext *context,
                      GError **error)
 {
@@ -68,7 +92,7 @@ qmi_device_open_sync(QmiDevice *device,
     pusher = g_main_context_pusher_new(context);
 
     qmi_device_open(device,
-                    QMI_DEVICE_OPEN_FLAGS_NONE,
+                    flags,
                     15,
                     NULL,
                     async_result_ready,
@@ -82,6 +106,7 @@ qmi_device_open_sync(QmiDevice *device,
 
 QmiClient *
 qmi_device_allocate_client_sync(QmiDevice *device,
+                                guint8 cid,
                                 GMainContext *context,
                                 GError **error)
 {
@@ -92,7 +117,7 @@ qmi_device_allocate_client_sync(QmiDevice *device,
 
     qmi_device_allocate_client(device,
                                QMI_SERVICE_UIM,
-                               QMI_CID_NONE,
+                               cid,
                                10,
                                NULL,
                                async_result_ready,
@@ -107,6 +132,7 @@ qmi_device_allocate_client_sync(QmiDevice *device,
 gboolean
 qmi_device_release_client_sync(QmiDevice *device,
                                QmiClient *client,
+                               QmiDeviceReleaseClientFlags flags,
                                GMainContext *context,
                                GError **error)
 {
@@ -117,7 +143,7 @@ qmi_device_release_client_sync(QmiDevice *device,
 
     qmi_device_release_client(device,
                               client,
-                              QMI_DEVICE_RELEASE_CLIENT_FLAGS_RELEASE_CID,
+                              flags,
                               10,
                               NULL,
                               async_result_ready,
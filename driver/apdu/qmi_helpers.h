@@ -2,10 +2,14 @@
 /*
  * Copyright (c) 2024, Luca Weiss <luca.weiss@fairphone.com>
  */
+#pragma once
 
+#ifdef LPAC_WITH_APDU_QMI_QRTR
 #include <libqrtr-glib.h>
+#endif
 #include <libqmi-glib.h>
 
+#ifdef LPAC_WITH_APDU_QMI_QRTR
 QrtrBus *qrtr_bus_new_sync(
     GMainContext *context,
     GError **error);
@@ -15,16 +19,25 @@ qmi_device_new_from_node_sync(
     QrtrNode *node,
     GMainContext *context,
     GError **error);
+#endif
+
+QmiDevice *
+qmi_device_new_sync(
+    GFile *file,
+    GMainContext *context,
+    GError **error);
 
 gboolean
 qmi_device_open_sync(
     QmiDevice *device,
+    QmiDeviceOpenFlags flags,
     GMainContext *context,
     GError **error);
 
 QmiClient *
 qmi_device_allocate_client_sync(
     QmiDevice *device,
+    guint8 cid,
     GMainContext *context,
     GError **error);
 
@@ -32,6 +45,7 @@ gboolean
 qmi_device_release_client_sync(
     QmiDevice *device,
     QmiClient *client,
+    QmiDeviceReleaseClientFlags flags,
     GMainContext *context,
     GError **error);
 
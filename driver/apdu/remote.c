@@ -0,0 +1,617 @@
+#include "remote.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <euicc/euicc.h>
+#include <euicc/interface.h>
+
+#include "bind.h"
+
+/*
+ * An agent next to the card, reached over TCP, speaks the STDIO_APDU_FRAMED protocol: each message is 0x00, 'A',
+ * a 32-bit big-endian body length and the body. Request body: function byte, then the raw parameter. transmit_batch
+ * packs a 32-bit count and every APDU as 32-bit length + bytes, so a whole BoundProfilePackage segment run costs one
+ * round trip. Response body: 32-bit big-endian signed ecode, then the raw data if any.
+ */
+#define FRAME_MAGIC 0x00
+#define FRAME_TYPE 'A'
+
+#define FRAME_FUNC_CONNECT 'c'
+#define FRAME_FUNC_DISCONNECT 'd'
+#define FRAME_FUNC_LOGIC_CHANNEL_OPEN 'o'
+#define FRAME_FUNC_LOGIC_CHANNEL_CLOSE 'x'
+#define FRAME_FUNC_TRANSMIT 't'
+#define FRAME_FUNC_TRANSMIT_BATCH 'b'
+
+#define REMOTE_TIMEOUT_DEFAULT 30000
+#define REMOTE_RESPONSE_MAX (16 * 1024 * 1024)
+
+struct remote_userdata
+{
+    int fd;
+    char *address;
+    int timeout_default;
+    int debug;
+    uint8_t *tx;
+    uint32_t tx_capacity;
+};
+
+static void frame_put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t frame_get_u32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// "host:port", "[v6 address]:port"
+static int remote_socket_open(struct remote_userdata *userdata)
+{
+    int fret = 0;
+    char *host = NULL;
+    char *port;
+    char *end;
+    struct addrinfo hints, *res = NULL, *ai;
+    int one = 1;
+    int ret;
+
+    host = strdup(userdata->address);
+    if (host == NULL)
+    {
+        goto err;
+    }
+    port = strrchr(host, ':');
+    if (port == NULL || port[1] == '\0')
+    {
+        fprintf(stderr, "remote: %s is not host:port\n", userdata->address);
+        goto err;
+    }
+    *port++ = '\0';
+    if (host[0] == '[' && (end = strchr(host, ']')) != NULL)
+    {
+        *end = '\0';
+        memmove(host, host + 1, strlen(host + 1) + 1);
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    ret = getaddrinfo(host, port, &hints, &res);
+    if (ret != 0)
+    {
+        fprintf(stderr, "remote: %s: %s\n", userdata->address, gai_strerror(ret));
+        goto err;
+    }
+
+    for (ai = res; ai; ai = ai->ai_next)
+    {
+        userdata->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (userdata->fd < 0)
+        {
+            continue;
+        }
+        if (connect(userdata->fd, ai->ai_addr, ai->ai_addrlen) == 0)
+        {
+            break;
+        }
+        close(userdata->fd);
+        userdata->fd = -1;
+    }
+    if (userdata->fd < 0)
+    {
+        fprintf(stderr, "remote: %s: %s\n", userdata->address, strerror(errno));
+        goto err;
+    }
+
+    // Every frame is one write followed by a wait for the answer, Nagle would only add a round trip
+    setsockopt(userdata->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    if (res)
+    {
+        freeaddrinfo(res);
+    }
+    free(host);
+    return fret;
+}
+
+static void remote_socket_close(struct remote_userdata *userdata)
+{
+    if (userdata->fd >= 0)
+    {
+        close(userdata->fd);
+    }
+    userdata->fd = -1;
+}
+
+static int remote_write(struct remote_userdata *userdata, const uint8_t *buf, uint32_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(userdata->fd, buf, len, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int remote_read(struct euicc_ctx *ctx, struct remote_userdata *userdata, uint8_t *buf, uint32_t len)
+{
+    while (len > 0)
+    {
+        struct pollfd pfd = {.fd = userdata->fd, .events = POLLIN};
+        uint32_t timeout = euicc_timeout_ms(ctx, ctx->apdu.timeout_ms ? ctx->apdu.timeout_ms : (uint32_t)userdata->timeout_default);
+        ssize_t n;
+        int ret;
+
+        ret = poll(&pfd, 1, timeout ? (int)(timeout > INT32_MAX ? INT32_MAX : timeout) : -1);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            if (ret == 0)
+            {
+                fprintf(stderr, "remote: %s: no answer within %" PRIu32 " ms\n", userdata->address, timeout);
+            }
+            return -1;
+        }
+
+        n = recv(userdata->fd, buf, len, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// The whole frame goes out in one send
+static int frame_request(struct remote_userdata *userdata, uint8_t func, const uint8_t *const *param, const uint32_t *param_len, uint32_t param_count, int batch)
+{
+    uint32_t body_len = 1;
+    uint32_t off;
+
+    if (batch)
+    {
+        body_len += 4;
+        for (uint32_t i = 0; i < param_count; i++)
+        {
+            body_len += 4 + param_len[i];
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; i < param_count; i++)
+        {
+            body_len += param_len[i];
+        }
+    }
+
+    if (6 + body_len > userdata->tx_capacity)
+    {
+        uint8_t *tx = realloc(userdata->tx, 6 + body_len);
+
+        if (tx == NULL)
+        {
+            return -1;
+        }
+        userdata->tx = tx;
+        userdata->tx_capacity = 6 + body_len;
+    }
+
+    userdata->tx[0] = FRAME_MAGIC;
+    userdata->tx[1] = FRAME_TYPE;
+    frame_put_u32(userdata->tx + 2, body_len);
+    userdata->tx[6] = func;
+    off = 7;
+    if (batch)
+    {
+        frame_put_u32(userdata->tx + off, param_count);
+        off += 4;
+    }
+    for (uint32_t i = 0; i < param_count; i++)
+    {
+        if (batch)
+        {
+            frame_put_u32(userdata->tx + off, param_len[i]);
+            off += 4;
+        }
+        if (param_len[i])
+        {
+            memcpy(userdata->tx + off, param[i], param_len[i]);
+            off += param_len[i];
+        }
+    }
+
+    if (userdata->debug)
+    {
+        fprintf(stderr, "[DEBUG] [remote] > %c %" PRIu32 " bytes\n", func, body_len);
+    }
+
+    return remote_write(userdata, userdata->tx, off);
+}
+
+static int frame_request_single(struct remote_userdata *userdata, uint8_t func, const uint8_t *param, uint32_t param_len)
+{
+    return frame_request(userdata, func, &param, &param_len, param ? 1 : 0, 0);
+}
+
+// Reads the response into *data (allocated) or data_buffer, whichever is given
+static int frame_response_ex(struct euicc_ctx *ctx, struct remote_userdata *userdata, int *ecode, uint8_t **data, uint32_t *data_len, uint8_t *data_buffer, uint32_t data_buffer_cap)
+{
+    uint8_t header[6 + 4];
+    uint32_t body_len;
+    uint32_t len;
+    uint8_t *dst = NULL;
+    uint8_t *allocated = NULL;
+
+    *ecode = -1;
+    if (data)
+    {
+        *data = NULL;
+    }
+    if (data_len)
+    {
+        *data_len = 0;
+    }
+
+    if (remote_read(ctx, userdata, header, sizeof(header)))
+    {
+        return -1;
+    }
+    if (header[0] != FRAME_MAGIC || header[1] != FRAME_TYPE)
+    {
+        return -1;
+    }
+    body_len = frame_get_u32(header + 2);
+    if (body_len < 4 || body_len - 4 > REMOTE_RESPONSE_MAX)
+    {
+        return -1;
+    }
+    len = body_len - 4;
+
+    if (len > 0)
+    {
+        if (data_buffer && data_len)
+        {
+            if (len > data_buffer_cap)
+            {
+                return -1;
+            }
+            dst = data_buffer;
+        }
+        else
+        {
+            dst = allocated = malloc(len);
+            if (dst == NULL)
+            {
+                return -1;
+            }
+        }
+        if (remote_read(ctx, userdata, dst, len))
+        {
+            free(allocated);
+            return -1;
+        }
+    }
+
+    *ecode = (int32_t)frame_get_u32(header + 6);
+    if (data && data_len && !data_buffer)
+    {
+        *data = allocated;
+        allocated = NULL;
+    }
+    if (data_len && dst)
+    {
+        *data_len = len;
+    }
+    free(allocated);
+
+    if (userdata->debug)
+    {
+        fprintf(stderr, "[DEBUG] [remote] < %d, %" PRIu32 " bytes\n", *ecode, len);
+    }
+
+    return 0;
+}
+
+static int frame_response(struct euicc_ctx *ctx, struct remote_userdata *userdata, int *ecode, uint8_t **data, uint32_t *data_len)
+{
+    return frame_response_ex(ctx, userdata, ecode, data, data_len, NULL, 0);
+}
+
+// A broken stream cannot be resynchronised, later calls fail until the next connect
+static int remote_call(struct remote_userdata *userdata, int ret)
+{
+    if (ret < 0)
+    {
+        remote_socket_close(userdata);
+    }
+    return ret;
+}
+
+static int apdu_interface_connect(struct euicc_ctx *ctx)
+{
+    struct remote_userdata *userdata = ctx->apdu.interface->userdata;
+    int ecode;
+
+    remote_socket_close(userdata);
+    if (remote_socket_open(userdata))
+    {
+        return -1;
+    }
+
+    if (frame_request_single(userdata, FRAME_FUNC_CONNECT, NULL, 0))
+    {
+        return remote_call(userdata, -1);
+    }
+
+    if (frame_response(ctx, userdata, &ecode, NULL, NULL))
+    {
+        return remote_call(userdata, -1);
+    }
+
+    return ecode;
+}
+
+static void apdu_interface_disconnect(struct euicc_ctx *ctx)
+{
+    struct remote_userdata *userdata = ctx->apdu.interface->userdata;
+    int ecode;
+
+    if (userdata->fd < 0)
+    {
+        return;
+    }
+    if (frame_request_single(userdata, FRAME_FUNC_DISCONNECT, NULL, 0) == 0)
+    {
+        frame_response(ctx, userdata, &ecode, NULL, NULL);
+    }
+    remote_socket_close(userdata);
+}
+
+static int apdu_interface_logic_channel_open(struct euicc_ctx *ctx, const uint8_t *aid, uint8_t aid_len)
+{
+    struct remote_userdata *userdata = ctx->apdu.interface->userdata;
+    int ecode;
+
+    if (userdata->fd < 0)
+    {
+        return -1;
+    }
+
+    if (frame_request_single(userdata, FRAME_FUNC_LOGIC_CHANNEL_OPEN, aid, aid_len))
+    {
+        return remote_call(userdata, -1);
+    }
+
+    if (frame_response(ctx, userdata, &ecode, NULL, NULL))
+    {
+        return remote_call(userdata, -1);
+    }
+
+    return ecode;
+}
+
+static void apdu_interface_logic_channel_close(struct euicc_ctx *ctx, uint8_t channel)
+{
+    struct remote_userdata *userdata = ctx->apdu.interface->userdata;
+    int ecode;
+
+    if (userdata->fd < 0)
+    {
+        return;
+    }
+    if (frame_request_single(userdata, FRAME_FUNC_LOGIC_CHANNEL_CLOSE, &channel, sizeof(channel)) || frame_response(ctx, userdata, &ecode, NULL, NULL))
+    {
+        remote_socket_close(userdata);
+    }
+}
+
+static int apdu_interface_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    struct remote_userdata *userdata = ctx->apdu.interface->userdata;
+    int ecode;
+
+    *rx = NULL;
+    *rx_len = 0;
+    if (userdata->fd < 0)
+    {
+        return -1;
+    }
+
+    if (frame_request_single(userdata, FRAME_FUNC_TRANSMIT, tx, tx_len))
+    {
+        return remote_call(userdata, -1);
+    }
+
+    if (frame_response(ctx, userdata, &ecode, rx, rx_len))
+    {
+        return remote_call(userdata, -1);
+    }
+
+    return ecode;
+}
+
+static int apdu_interface_transmit_into(struct euicc_ctx *ctx, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    struct remote_userdata *userdata = ctx->apdu.interface->userdata;
+    int ecode;
+
+    *rx_len = 0;
+    if (userdata->fd < 0)
+    {
+        return -1;
+    }
+
+    if (frame_request_single(userdata, FRAME_FUNC_TRANSMIT, tx, tx_len))
+    {
+        return remote_call(userdata, -1);
+    }
+
+    if (frame_response_ex(ctx, userdata, &ecode, NULL, rx_len, rx, rx_cap))
+    {
+        return remote_call(userdata, -1);
+    }
+
+    return ecode;
+}
+
+// The agent runs the segments back to back next to the card, so the WAN round trip is paid once per batch
+static int apdu_interface_transmit_batch(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *const *tx, const uint32_t *tx_len, uint32_t tx_count)
+{
+    struct remote_userdata *userdata = ctx->apdu.interface->userdata;
+    int ecode;
+
+    *rx = NULL;
+    *rx_len = 0;
+    if (userdata->fd < 0)
+    {
+        return -1;
+    }
+
+    if (frame_request(userdata, FRAME_FUNC_TRANSMIT_BATCH, tx, tx_len, tx_count, 1))
+    {
+        return remote_call(userdata, -1);
+    }
+
+    if (frame_response(ctx, userdata, &ecode, rx, rx_len))
+    {
+        return remote_call(userdata, -1);
+    }
+
+    return ecode;
+}
+
+static int apdu_interface_identity(struct euicc_ctx *ctx, char *identity, uint32_t identity_len)
+{
+    struct remote_userdata *userdata = ctx->apdu.interface->userdata;
+    int ret;
+
+    ret = snprintf(identity, identity_len, "remote:%s", userdata->address);
+    if (ret < 0 || (uint32_t)ret >= identity_len)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+LPAC_BIND_APDU_DEFINE(apdu_interface_transmit, apdu_interface_transmit_into)
+
+static int libapduinterface_init(struct euicc_apdu_interface *ifstruct, const char *device)
+{
+    struct remote_userdata *userdata;
+
+    memset(ifstruct, 0, sizeof(struct euicc_apdu_interface));
+
+    if (device == NULL)
+    {
+        device = getenv("REMOTE_ADDRESS");
+    }
+    if (device == NULL)
+    {
+        fprintf(stderr, "remote: REMOTE_ADDRESS is not set\n");
+        return -1;
+    }
+
+    userdata = calloc(1, sizeof(struct remote_userdata));
+    if (userdata == NULL)
+    {
+        return -1;
+    }
+    userdata->address = strdup(device);
+    if (userdata->address == NULL)
+    {
+        free(userdata);
+        return -1;
+    }
+    userdata->fd = -1;
+
+    userdata->timeout_default = getenv("REMOTE_TIMEOUT") ? atoi(getenv("REMOTE_TIMEOUT")) : REMOTE_TIMEOUT_DEFAULT;
+    if (userdata->timeout_default <= 0)
+    {
+        userdata->timeout_default = REMOTE_TIMEOUT_DEFAULT;
+    }
+    userdata->debug = getenv("REMOTE_DEBUG") != NULL;
+
+    ifstruct->connect = apdu_interface_connect;
+    ifstruct->disconnect = apdu_interface_disconnect;
+    ifstruct->logic_channel_open = apdu_interface_logic_channel_open;
+    ifstruct->logic_channel_close = apdu_interface_logic_channel_close;
+    ifstruct->transmit = LPAC_BIND_APDU_TRANSMIT(apdu_interface_transmit);
+    ifstruct->transmit_into = LPAC_BIND_APDU_TRANSMIT_INTO(apdu_interface_transmit_into);
+    if (getenv("REMOTE_NO_BATCH") == NULL)
+    {
+        ifstruct->transmit_batch = apdu_interface_transmit_batch;
+    }
+    ifstruct->identity = apdu_interface_identity;
+    ifstruct->extended_length = 1;
+    ifstruct->userdata = userdata;
+
+    return 0;
+}
+
+static int libapduinterface_main(struct euicc_apdu_interface *ifstruct, int argc, char **argv)
+{
+    return 0;
+}
+
+static void libapduinterface_fini(struct euicc_apdu_interface *ifstruct)
+{
+    struct remote_userdata *userdata = ifstruct->userdata;
+
+    if (userdata == NULL)
+    {
+        return;
+    }
+
+    remote_socket_close(userdata);
+    free(userdata->address);
+    free(userdata->tx);
+    free(userdata);
+    ifstruct->userdata = NULL;
+}
+
+const struct euicc_driver driver_apdu_remote = {
+    .type = DRIVER_APDU,
+    .name = "remote",
+    .init = (int (*)(void *, const char *))libapduinterface_init,
+    .main = (int (*)(void *, int, char **))libapduinterface_main,
+    .fini = (void (*)(void *))libapduinterface_fini,
+};
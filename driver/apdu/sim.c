@@ -0,0 +1,1181 @@
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <euicc/euicc.h>
+#include <euicc/interface.h>
+#include <euicc/derutil.h>
+#include <euicc/hexutil.h>
+
+#include "bind.h"
+
+#define SIM_PROFILES_DEFAULT 3
+#define SIM_EID_DEFAULT "89049032123451234512345678901234"
+#define SIM_SMDP_ADDRESS "smdp.example.com"
+#define SIM_SMDS_ADDRESS "testrootsmds.gsma.com"
+#define SIM_RESPONSE_CHUNK 256
+
+#define SIM_NOTIFICATION_INSTALL 0x80
+#define SIM_NOTIFICATION_ENABLE 0x40
+#define SIM_NOTIFICATION_DISABLE 0x20
+#define SIM_NOTIFICATION_DELETE 0x10
+
+// EUICCInfo2 of a GSMA test eUICC, served as is
+static const uint8_t sim_euicc_info2[] = {
+    0x81, 0x03, 0x02, 0x01, 0x00, 0x82, 0x03, 0x02, 0x02, 0x00, 0x83, 0x03, 0x04, 0x06, 0x00, 0x84,
+    0x0F, 0x81, 0x01, 0x00, 0x82, 0x04, 0x00, 0x06, 0x28, 0x24, 0x83, 0x04, 0x00, 0x00, 0x19, 0x22,
+    0x85, 0x04, 0x06, 0x7F, 0x36, 0xC0, 0x86, 0x03, 0x09, 0x02, 0x00, 0x87, 0x03, 0x02, 0x03, 0x00,
+    0x88, 0x02, 0x04, 0x90, 0xA9, 0x16, 0x04, 0x14, 0x81, 0x37, 0x0F, 0x51, 0x25, 0xD0, 0xB1, 0xD4,
+    0x08, 0xD4, 0xC3, 0xB2, 0x32, 0xE6, 0xD2, 0x5E, 0x79, 0x5B, 0xEB, 0xFB, 0xAA, 0x16, 0x04, 0x14,
+    0x81, 0x37, 0x0F, 0x51, 0x25, 0xD0, 0xB1, 0xD4, 0x08, 0xD4, 0xC3, 0xB2, 0x32, 0xE6, 0xD2, 0x5E,
+    0x79, 0x5B, 0xEB, 0xFB, 0x99, 0x02, 0x06, 0xC0, 0x04, 0x03, 0x00, 0x00, 0x01, 0x0C, 0x0D, 0x47,
+    0x49, 0x2D, 0x42, 0x41, 0x2D, 0x55, 0x50, 0x2D, 0x30, 0x34, 0x31, 0x39,
+};
+
+// GSMA test CI public key identifier
+static const uint8_t sim_ci_pkid[] = {
+    0x81, 0x37, 0x0F, 0x51, 0x25, 0xD0, 0xB1, 0xD4, 0x08, 0xD4,
+    0xC3, 0xB2, 0x32, 0xE6, 0xD2, 0x5E, 0x79, 0x5B, 0xEB, 0xFB,
+};
+
+struct sim_profile
+{
+    uint8_t iccid[10];
+    uint8_t aid[16];
+    uint8_t state;
+    char nickname[64 + 1];
+    char name[32];
+};
+
+struct sim_notification
+{
+    long seq;
+    uint8_t event;
+    uint8_t iccid[10];
+    uint8_t aid[16];
+};
+
+struct sim_userdata
+{
+    uint8_t eid[16];
+    // The only AID the ISD-R opens by, any AID when isd_r_aid_len is 0
+    uint8_t isd_r_aid[16];
+    int isd_r_aid_len;
+    long latency;
+    long jitter;
+    // Every busy_every-th STORE DATA is answered 9300 without being taken
+    long busy_every;
+    long store_data_count;
+    uint8_t *icon;
+    uint32_t icon_len;
+
+    struct sim_profile *profiles;
+    uint32_t profiles_count;
+    uint32_t profiles_serial;
+    struct sim_notification *notifications;
+    uint32_t notifications_count;
+    long notifications_seq;
+    char *default_dp_address;
+    uint8_t transaction_id[16];
+
+    // STORE DATA blocks of the command being received
+    uint8_t *command;
+    uint32_t command_len;
+    uint32_t command_cap;
+    // Bytes of the bound profile package still expected after the current segment
+    uint32_t bpp_remaining;
+
+    // Response of the last command, handed out by GET RESPONSE
+    uint8_t *response_buffer;
+    uint32_t response_cap;
+    const uint8_t *response;
+    uint32_t response_len;
+
+    // An enable or disable with refreshFlag went through, nothing but the rest of its response gets an answer until
+    // the card is reset
+    int reset_required;
+};
+
+static void sim_delay(const struct sim_userdata *userdata)
+{
+    long us = userdata->latency;
+
+    if (userdata->jitter > 0)
+    {
+        us += (rand() % (2 * userdata->jitter + 1)) - userdata->jitter;
+    }
+    if (us <= 0)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    Sleep(us / 1000);
+#else
+    struct timespec ts;
+
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) < 0)
+        ;
+#endif
+}
+
+static long sim_getenv_long(const char *name, long fallback)
+{
+    const char *value = getenv(name);
+
+    if (value == NULL || value[0] == '\0')
+    {
+        return fallback;
+    }
+    return strtol(value, NULL, 10);
+}
+
+static int sim_profile_add(struct sim_userdata *userdata, uint8_t state)
+{
+    struct sim_profile *profiles_new;
+    struct sim_profile *profile;
+    char str[32 + 1];
+
+    profiles_new = realloc(userdata->profiles, (userdata->profiles_count + 1) * sizeof(struct sim_profile));
+    if (profiles_new == NULL)
+    {
+        return -1;
+    }
+    userdata->profiles = profiles_new;
+
+    profile = &userdata->profiles[userdata->profiles_count];
+    memset(profile, 0, sizeof(struct sim_profile));
+
+    snprintf(str, sizeof(str), "8900000000000000%04u", (unsigned)(userdata->profiles_serial % 10000));
+    if (euicc_hexutil_gsmbcd2bin(profile->iccid, sizeof(profile->iccid), str, 10) < 0)
+    {
+        return -1;
+    }
+    snprintf(str, sizeof(str), "A0000005591010FFFFFFFF89%08X", (unsigned)userdata->profiles_serial);
+    if (euicc_hexutil_hex2bin(profile->aid, sizeof(profile->aid), str) < 0)
+    {
+        return -1;
+    }
+    snprintf(profile->name, sizeof(profile->name), "Profile %u", (unsigned)userdata->profiles_serial);
+    profile->state = state;
+
+    userdata->profiles_serial++;
+    userdata->profiles_count++;
+
+    return 0;
+}
+
+static struct sim_profile *sim_profile_find(struct sim_userdata *userdata, const struct euicc_derutil_node *id)
+{
+    for (uint32_t i = 0; i < userdata->profiles_count; i++)
+    {
+        struct sim_profile *profile = &userdata->profiles[i];
+
+        if (id->tag == 0x5A && id->length == sizeof(profile->iccid) && memcmp(id->value, profile->iccid, id->length) == 0)
+        {
+            return profile;
+        }
+        if (id->tag == 0x4F && id->length == sizeof(profile->aid) && memcmp(id->value, profile->aid, id->length) == 0)
+        {
+            return profile;
+        }
+    }
+    return NULL;
+}
+
+static int sim_notification_add(struct sim_userdata *userdata, uint8_t event, const struct sim_profile *profile)
+{
+    struct sim_notification *notifications_new;
+    struct sim_notification *notification;
+
+    notifications_new = realloc(userdata->notifications, (userdata->notifications_count + 1) * sizeof(struct sim_notification));
+    if (notifications_new == NULL)
+    {
+        return -1;
+    }
+    userdata->notifications = notifications_new;
+
+    notification = &userdata->notifications[userdata->notifications_count++];
+    notification->seq = ++userdata->notifications_seq;
+    notification->event = event;
+    memcpy(notification->iccid, profile->iccid, sizeof(notification->iccid));
+    memcpy(notification->aid, profile->aid, sizeof(notification->aid));
+
+    return 0;
+}
+
+static void sim_write_result(struct euicc_derutil_writer *writer, uint16_t tag, uint8_t result)
+{
+    euicc_derutil_writer_tlv(writer, 0x80, &result, 1);
+    euicc_derutil_writer_wrap(writer, tag, 0);
+}
+
+static void sim_write_signature(struct euicc_derutil_writer *writer)
+{
+    static const uint8_t signature[64];
+
+    euicc_derutil_writer_tlv(writer, 0x5F37, signature, sizeof(signature));
+}
+
+static void sim_write_integer(struct euicc_derutil_writer *writer, uint16_t tag, long value)
+{
+    uint8_t buffer[sizeof(long)];
+    uint32_t buffer_len = sizeof(buffer);
+
+    if (euicc_derutil_convert_long2bin(buffer, &buffer_len, value) < 0)
+    {
+        return;
+    }
+    euicc_derutil_writer_tlv(writer, tag, buffer, buffer_len);
+}
+
+static void sim_write_notification_metadata(struct euicc_derutil_writer *writer, const struct sim_notification *notification)
+{
+    uint32_t mark = euicc_derutil_writer_mark(writer);
+    uint8_t event[2] = {0x04, notification->event};
+
+    euicc_derutil_writer_tlv(writer, 0x5A, notification->iccid, sizeof(notification->iccid));
+    euicc_derutil_writer_tlv(writer, 0x0C, SIM_SMDP_ADDRESS, strlen(SIM_SMDP_ADDRESS));
+    euicc_derutil_writer_tlv(writer, 0x81, event, sizeof(event));
+    sim_write_integer(writer, 0x80, notification->seq);
+    euicc_derutil_writer_wrap(writer, 0xBF2F, mark);
+}
+
+// ProfileInstallationResult for installs, OtherSignedNotification for everything else
+static void sim_write_pending_notification(struct euicc_derutil_writer *writer, const struct sim_userdata *userdata, const struct sim_notification *notification)
+{
+    uint32_t mark = euicc_derutil_writer_mark(writer);
+    uint32_t mark_data, mark_result;
+
+    if (notification->event == SIM_NOTIFICATION_INSTALL)
+    {
+        sim_write_signature(writer);
+        mark_data = euicc_derutil_writer_mark(writer);
+        mark_result = euicc_derutil_writer_mark(writer);
+        euicc_derutil_writer_tlv(writer, 0x4F, notification->aid, sizeof(notification->aid));
+        euicc_derutil_writer_wrap(writer, 0xA0, mark_result);
+        euicc_derutil_writer_wrap(writer, 0xA2, mark_result);
+        sim_write_notification_metadata(writer, notification);
+        euicc_derutil_writer_tlv(writer, 0x80, userdata->transaction_id, sizeof(userdata->transaction_id));
+        euicc_derutil_writer_wrap(writer, 0xBF27, mark_data);
+        euicc_derutil_writer_wrap(writer, 0xBF37, mark);
+    }
+    else
+    {
+        euicc_derutil_writer_tlv(writer, 0x30, NULL, 0); // eumCertificate
+        euicc_derutil_writer_tlv(writer, 0x30, NULL, 0); // euiccCertificate
+        sim_write_signature(writer);
+        sim_write_notification_metadata(writer, notification);
+        euicc_derutil_writer_wrap(writer, 0x30, mark);
+    }
+}
+
+static int sim_tag_wanted(const struct euicc_derutil_node *tag_list, uint16_t tag)
+{
+    if (tag_list == NULL)
+    {
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < tag_list->length; i++)
+    {
+        uint16_t t = tag_list->value[i];
+
+        if ((t & 0x1F) == 0x1F && i + 1 < tag_list->length)
+        {
+            t = (t << 8) | tag_list->value[++i];
+        }
+        if (t == tag)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void sim_write_profile_info(struct euicc_derutil_writer *writer, const struct sim_userdata *userdata, const struct sim_profile *profile, const struct euicc_derutil_node *tag_list)
+{
+    uint32_t mark = euicc_derutil_writer_mark(writer);
+    uint8_t profile_class = 2; // operational
+    uint8_t icon_type = 1;     // png
+
+    if (sim_tag_wanted(tag_list, 0x95))
+        euicc_derutil_writer_tlv(writer, 0x95, &profile_class, 1);
+    if (userdata->icon_len && sim_tag_wanted(tag_list, 0x94))
+        euicc_derutil_writer_tlv(writer, 0x94, userdata->icon, userdata->icon_len);
+    if (userdata->icon_len && sim_tag_wanted(tag_list, 0x93))
+        euicc_derutil_writer_tlv(writer, 0x93, &icon_type, 1);
+    if (sim_tag_wanted(tag_list, 0x92))
+        euicc_derutil_writer_tlv(writer, 0x92, profile->name, strlen(profile->name));
+    if (sim_tag_wanted(tag_list, 0x91))
+        euicc_derutil_writer_tlv(writer, 0x91, "lpac", strlen("lpac"));
+    if (profile->nickname[0] && sim_tag_wanted(tag_list, 0x90))
+        euicc_derutil_writer_tlv(writer, 0x90, profile->nickname, strlen(profile->nickname));
+    if (sim_tag_wanted(tag_list, 0x9F70))
+        euicc_derutil_writer_tlv(writer, 0x9F70, &profile->state, 1);
+    if (sim_tag_wanted(tag_list, 0x4F))
+        euicc_derutil_writer_tlv(writer, 0x4F, profile->aid, sizeof(profile->aid));
+    if (sim_tag_wanted(tag_list, 0x5A))
+        euicc_derutil_writer_tlv(writer, 0x5A, profile->iccid, sizeof(profile->iccid));
+    euicc_derutil_writer_wrap(writer, 0xE3, mark);
+}
+
+static void sim_profile_info_list(struct sim_userdata *userdata, struct euicc_derutil_writer *writer, const struct euicc_derutil_node *request)
+{
+    struct euicc_derutil_node tag_list, criteria, tmpnode;
+    const struct euicc_derutil_node *tag_list_ptr = NULL;
+    int has_criteria = 0;
+
+    if (euicc_derutil_unpack_find_tag(&tag_list, 0x5C, request->value, request->length) == 0)
+    {
+        tag_list_ptr = &tag_list;
+    }
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xA0, request->value, request->length) == 0 && euicc_derutil_unpack_first(&criteria, tmpnode.value, tmpnode.length) == 0)
+    {
+        has_criteria = 1;
+    }
+
+    for (uint32_t i = userdata->profiles_count; i-- > 0;)
+    {
+        const struct sim_profile *profile = &userdata->profiles[i];
+
+        if (has_criteria)
+        {
+            if (criteria.tag == 0x95)
+            {
+                if (criteria.length != 1 || criteria.value[0] != 2)
+                {
+                    continue;
+                }
+            }
+            else if (sim_profile_find(userdata, &criteria) != profile)
+            {
+                continue;
+            }
+        }
+        sim_write_profile_info(writer, userdata, profile, tag_list_ptr);
+    }
+    euicc_derutil_writer_wrap(writer, 0xA0, 0);
+    euicc_derutil_writer_wrap(writer, 0xBF2D, 0);
+}
+
+static void sim_list_notification(struct sim_userdata *userdata, struct euicc_derutil_writer *writer, const struct euicc_derutil_node *request)
+{
+    struct euicc_derutil_node filter;
+    uint8_t events = 0xFF;
+
+    if (euicc_derutil_unpack_find_tag(&filter, 0x81, request->value, request->length) == 0 && filter.length >= 2)
+    {
+        events = filter.value[1];
+    }
+
+    for (uint32_t i = userdata->notifications_count; i-- > 0;)
+    {
+        if (userdata->notifications[i].event & events)
+        {
+            sim_write_notification_metadata(writer, &userdata->notifications[i]);
+        }
+    }
+    euicc_derutil_writer_wrap(writer, 0xA0, 0);
+    euicc_derutil_writer_wrap(writer, 0xBF28, 0);
+}
+
+static void sim_retrieve_notifications_list(struct sim_userdata *userdata, struct euicc_derutil_writer *writer, const struct euicc_derutil_node *request)
+{
+    struct euicc_derutil_node criteria, tmpnode;
+    long seq = -1;
+
+    if (euicc_derutil_unpack_find_tag(&criteria, 0xA0, request->value, request->length) == 0 && euicc_derutil_unpack_find_tag(&tmpnode, 0x80, criteria.value, criteria.length) == 0)
+    {
+        seq = euicc_derutil_convert_bin2long(tmpnode.value, tmpnode.length);
+    }
+
+    for (uint32_t i = userdata->notifications_count; i-- > 0;)
+    {
+        if (seq < 0 || userdata->notifications[i].seq == seq)
+        {
+            sim_write_pending_notification(writer, userdata, &userdata->notifications[i]);
+        }
+    }
+    euicc_derutil_writer_wrap(writer, 0xA0, 0);
+    euicc_derutil_writer_wrap(writer, 0xBF2B, 0);
+}
+
+// Result codes follow EnableProfileResponse, DisableProfileResponse and DeleteProfileResponse
+static uint8_t sim_profile_operation(struct sim_userdata *userdata, uint16_t tag, const struct euicc_derutil_node *request)
+{
+    struct euicc_derutil_node id, tmpnode, refresh;
+    struct sim_profile *profile;
+    uint8_t event;
+
+    if (euicc_derutil_unpack_first(&id, request->value, request->length) < 0)
+    {
+        return 127;
+    }
+    if (id.tag == 0xA0)
+    {
+        tmpnode = id;
+        if (euicc_derutil_unpack_first(&id, tmpnode.value, tmpnode.length) < 0)
+        {
+            return 127;
+        }
+    }
+
+    profile = sim_profile_find(userdata, &id);
+    if (profile == NULL)
+    {
+        return 1; // iccidOrAidNotFound
+    }
+
+    switch (tag)
+    {
+    case 0xBF31:
+        if (profile->state)
+        {
+            return 2; // profileNotInDisabledState
+        }
+        for (uint32_t i = 0; i < userdata->profiles_count; i++)
+        {
+            userdata->profiles[i].state = 0;
+        }
+        profile->state = 1;
+        event = SIM_NOTIFICATION_ENABLE;
+        break;
+    case 0xBF32:
+        if (!profile->state)
+        {
+            return 2; // profileNotInEnabledState
+        }
+        profile->state = 0;
+        event = SIM_NOTIFICATION_DISABLE;
+        break;
+    default:
+        if (profile->state)
+        {
+            return 2; // profileNotInDisabledState
+        }
+        event = SIM_NOTIFICATION_DELETE;
+        break;
+    }
+
+    if (sim_notification_add(userdata, event, profile) < 0)
+    {
+        return 127;
+    }
+
+    if (tag == 0xBF33)
+    {
+        uint32_t index = profile - userdata->profiles;
+
+        memmove(profile, profile + 1, (userdata->profiles_count - index - 1) * sizeof(struct sim_profile));
+        userdata->profiles_count--;
+    }
+    else if (euicc_derutil_unpack_find_tag(&refresh, 0x81, request->value, request->length) == 0 && refresh.length == 1 && refresh.value[0])
+    {
+        userdata->reset_required = 1;
+    }
+
+    return 0;
+}
+
+static uint8_t sim_set_nickname(struct sim_userdata *userdata, const struct euicc_derutil_node *request)
+{
+    struct euicc_derutil_node iccid, nickname;
+    struct sim_profile *profile;
+
+    if (euicc_derutil_unpack_find_tag(&iccid, 0x5A, request->value, request->length) < 0)
+    {
+        return 127;
+    }
+    if (euicc_derutil_unpack_find_tag(&nickname, 0x90, request->value, request->length) < 0 || nickname.length >= sizeof(profile->nickname))
+    {
+        return 127;
+    }
+
+    profile = sim_profile_find(userdata, &iccid);
+    if (profile == NULL)
+    {
+        return 1; // iccidNotFound
+    }
+
+    memcpy(profile->nickname, nickname.value, nickname.length);
+    profile->nickname[nickname.length] = '\0';
+
+    return 0;
+}
+
+static uint8_t sim_remove_notification(struct sim_userdata *userdata, const struct euicc_derutil_node *request)
+{
+    struct euicc_derutil_node tmpnode;
+    long seq;
+
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0x80, request->value, request->length) < 0)
+    {
+        return 127;
+    }
+    seq = euicc_derutil_convert_bin2long(tmpnode.value, tmpnode.length);
+
+    for (uint32_t i = 0; i < userdata->notifications_count; i++)
+    {
+        if (userdata->notifications[i].seq == seq)
+        {
+            memmove(&userdata->notifications[i], &userdata->notifications[i + 1], (userdata->notifications_count - i - 1) * sizeof(struct sim_notification));
+            userdata->notifications_count--;
+            return 0;
+        }
+    }
+
+    return 1; // nothingToDelete
+}
+
+static uint8_t sim_set_default_dp_address(struct sim_userdata *userdata, const struct euicc_derutil_node *request)
+{
+    struct euicc_derutil_node tmpnode;
+    char *address;
+
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0x80, request->value, request->length) < 0)
+    {
+        return 127;
+    }
+
+    address = malloc(tmpnode.length + 1);
+    if (address == NULL)
+    {
+        return 127;
+    }
+    memcpy(address, tmpnode.value, tmpnode.length);
+    address[tmpnode.length] = '\0';
+
+    free(userdata->default_dp_address);
+    userdata->default_dp_address = address;
+
+    return 0;
+}
+
+static void sim_authenticate_server(struct sim_userdata *userdata, struct euicc_derutil_writer *writer, const struct euicc_derutil_node *request)
+{
+    struct euicc_derutil_node tmpnode;
+    uint32_t mark;
+
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0x30, request->value, request->length) == 0 && euicc_derutil_unpack_find_tag(&tmpnode, 0x80, tmpnode.value, tmpnode.length) == 0 && tmpnode.length == sizeof(userdata->transaction_id))
+    {
+        memcpy(userdata->transaction_id, tmpnode.value, tmpnode.length);
+    }
+
+    euicc_derutil_writer_tlv(writer, 0x30, NULL, 0); // eumCertificate
+    euicc_derutil_writer_tlv(writer, 0x30, NULL, 0); // euiccCertificate
+    sim_write_signature(writer);
+    mark = euicc_derutil_writer_mark(writer);
+    euicc_derutil_writer_tlv(writer, 0x80, userdata->transaction_id, sizeof(userdata->transaction_id));
+    euicc_derutil_writer_wrap(writer, 0x30, mark); // euiccSigned1
+    euicc_derutil_writer_wrap(writer, 0xA0, 0);
+    euicc_derutil_writer_wrap(writer, 0xBF38, 0);
+}
+
+// PrepareDownloadResponse and CancelSessionResponse share the signed transaction ID shape
+static void sim_signed_transaction(struct sim_userdata *userdata, struct euicc_derutil_writer *writer, uint16_t tag, uint16_t extra_tag, uint32_t extra_len)
+{
+    static const uint8_t extra[65];
+    uint32_t mark;
+
+    sim_write_signature(writer);
+    mark = euicc_derutil_writer_mark(writer);
+    if (extra_len)
+    {
+        euicc_derutil_writer_tlv(writer, extra_tag, extra, extra_len);
+    }
+    euicc_derutil_writer_tlv(writer, 0x80, userdata->transaction_id, sizeof(userdata->transaction_id));
+    euicc_derutil_writer_wrap(writer, 0x30, mark);
+    euicc_derutil_writer_wrap(writer, 0xA0, 0);
+    euicc_derutil_writer_wrap(writer, tag, 0);
+}
+
+static int sim_install_profile(struct sim_userdata *userdata, struct euicc_derutil_writer *writer)
+{
+    if (sim_profile_add(userdata, 0) < 0)
+    {
+        return -1;
+    }
+    if (sim_notification_add(userdata, SIM_NOTIFICATION_INSTALL, &userdata->profiles[userdata->profiles_count - 1]) < 0)
+    {
+        return -1;
+    }
+
+    sim_write_pending_notification(writer, userdata, &userdata->notifications[userdata->notifications_count - 1]);
+    return 0;
+}
+
+// Parses a possibly truncated TLV header, returns the header length or -1
+static int sim_header_parse(const uint8_t *buffer, uint32_t buffer_len, uint16_t *tag, uint32_t *length)
+{
+    uint32_t offset = 0;
+    uint8_t length_len;
+
+    if (buffer_len < 2)
+    {
+        return -1;
+    }
+
+    *tag = buffer[offset++];
+    if ((*tag & 0x1F) == 0x1F)
+    {
+        *tag = (*tag << 8) | buffer[offset++];
+    }
+    if (offset >= buffer_len)
+    {
+        return -1;
+    }
+
+    if (!(buffer[offset] & 0x80))
+    {
+        *length = buffer[offset++];
+        return offset;
+    }
+
+    length_len = buffer[offset++] & 0x7F;
+    if (length_len > 4 || offset + length_len > buffer_len)
+    {
+        return -1;
+    }
+    *length = 0;
+    while (length_len--)
+    {
+        *length = (*length << 8) | buffer[offset++];
+    }
+
+    return offset;
+}
+
+static int sim_dispatch(struct sim_userdata *userdata, struct euicc_derutil_writer *writer, const uint8_t *command, uint32_t command_len)
+{
+    struct euicc_derutil_node request;
+    uint8_t challenge[16];
+    uint32_t mark;
+
+    // Every segment of a bound profile package after the first is accepted silently
+    if (userdata->bpp_remaining)
+    {
+        userdata->bpp_remaining -= command_len < userdata->bpp_remaining ? command_len : userdata->bpp_remaining;
+        if (userdata->bpp_remaining == 0)
+        {
+            return sim_install_profile(userdata, writer);
+        }
+        return 0;
+    }
+
+    if (command_len >= 2 && command[0] == 0xBF && command[1] == 0x36)
+    {
+        uint16_t tag;
+        uint32_t length;
+        int header_len;
+
+        header_len = sim_header_parse(command, command_len, &tag, &length);
+        if (header_len < 0)
+        {
+            return -1;
+        }
+        if (header_len + length <= command_len)
+        {
+            return sim_install_profile(userdata, writer);
+        }
+        userdata->bpp_remaining = header_len + length - command_len;
+        return 0;
+    }
+
+    if (euicc_derutil_unpack_first(&request, command, command_len) < 0)
+    {
+        return -1;
+    }
+
+    switch (request.tag)
+    {
+    case 0xBF3E: // GetEuiccDataRequest
+        euicc_derutil_writer_tlv(writer, 0x5A, userdata->eid, sizeof(userdata->eid));
+        euicc_derutil_writer_wrap(writer, 0xBF3E, 0);
+        break;
+    case 0xBF20: // GetEuiccInfo1Request
+        euicc_derutil_writer_tlv(writer, 0x04, sim_ci_pkid, sizeof(sim_ci_pkid));
+        euicc_derutil_writer_wrap(writer, 0xAA, 0); // euiccCiPKIdListForSigning
+        mark = euicc_derutil_writer_mark(writer);
+        euicc_derutil_writer_tlv(writer, 0x04, sim_ci_pkid, sizeof(sim_ci_pkid));
+        euicc_derutil_writer_wrap(writer, 0xA9, mark); // euiccCiPKIdListForVerification
+        euicc_derutil_writer_tlv(writer, 0x82, "\x02\x02\x00", 3);
+        euicc_derutil_writer_wrap(writer, 0xBF20, 0);
+        break;
+    case 0xBF22: // GetEuiccInfo2Request
+        euicc_derutil_writer_tlv(writer, 0xBF22, sim_euicc_info2, sizeof(sim_euicc_info2));
+        break;
+    case 0xBF3C: // EuiccConfiguredAddressesRequest
+        euicc_derutil_writer_tlv(writer, 0x81, SIM_SMDS_ADDRESS, strlen(SIM_SMDS_ADDRESS));
+        if (userdata->default_dp_address)
+        {
+            euicc_derutil_writer_tlv(writer, 0x80, userdata->default_dp_address, strlen(userdata->default_dp_address));
+        }
+        euicc_derutil_writer_wrap(writer, 0xBF3C, 0);
+        break;
+    case 0xBF3F: // SetDefaultDpAddressRequest
+        sim_write_result(writer, request.tag, sim_set_default_dp_address(userdata, &request));
+        break;
+    case 0xBF2D: // ProfileInfoListRequest
+        sim_profile_info_list(userdata, writer, &request);
+        break;
+    case 0xBF31: // EnableProfileRequest
+    case 0xBF32: // DisableProfileRequest
+    case 0xBF33: // DeleteProfileRequest
+        sim_write_result(writer, request.tag, sim_profile_operation(userdata, request.tag, &request));
+        break;
+    case 0xBF29: // SetNicknameRequest
+        sim_write_result(writer, request.tag, sim_set_nickname(userdata, &request));
+        break;
+    case 0xBF34: // EuiccMemoryResetRequest
+        userdata->profiles_count = 0;
+        userdata->notifications_count = 0;
+        sim_write_result(writer, request.tag, 0);
+        break;
+    case 0xBF28: // ListNotificationRequest
+        sim_list_notification(userdata, writer, &request);
+        break;
+    case 0xBF2B: // RetrieveNotificationsListRequest
+        sim_retrieve_notifications_list(userdata, writer, &request);
+        break;
+    case 0xBF30: // NotificationSentRequest
+        sim_write_result(writer, request.tag, sim_remove_notification(userdata, &request));
+        break;
+    case 0xBF2E: // GetEuiccChallengeRequest
+        for (uint32_t i = 0; i < sizeof(challenge); i++)
+        {
+            challenge[i] = rand() & 0xFF;
+        }
+        euicc_derutil_writer_tlv(writer, 0x80, challenge, sizeof(challenge));
+        euicc_derutil_writer_wrap(writer, 0xBF2E, 0);
+        break;
+    case 0xBF38: // AuthenticateServerRequest
+        sim_authenticate_server(userdata, writer, &request);
+        break;
+    case 0xBF21: // PrepareDownloadRequest
+        sim_signed_transaction(userdata, writer, request.tag, 0x5F49, 65);
+        break;
+    case 0xBF41: // CancelSessionRequest
+        sim_signed_transaction(userdata, writer, request.tag, 0, 0);
+        break;
+    case 0xBF43: // GetRatRequest
+        euicc_derutil_writer_tlv(writer, 0xBF43, NULL, 0);
+        break;
+    default:
+        sim_write_result(writer, request.tag, 127); // undefinedError
+        break;
+    }
+
+    return 0;
+}
+
+// Runs the command into the response buffer, sized beforehand for the largest possible response
+static int sim_command(struct sim_userdata *userdata)
+{
+    struct euicc_derutil_writer writer;
+    uint32_t cap;
+
+    userdata->response = NULL;
+    userdata->response_len = 0;
+
+    cap = 4096 + (userdata->profiles_count + 1) * (userdata->icon_len + 256) + (userdata->notifications_count + 1) * 256;
+    if (cap > userdata->response_cap)
+    {
+        uint8_t *buffer_new = realloc(userdata->response_buffer, cap);
+
+        if (buffer_new == NULL)
+        {
+            return -1;
+        }
+        userdata->response_buffer = buffer_new;
+        userdata->response_cap = cap;
+    }
+
+    euicc_derutil_writer_init(&writer, userdata->response_buffer, userdata->response_cap);
+    if (sim_dispatch(userdata, &writer, userdata->command, userdata->command_len) < 0)
+    {
+        return -1;
+    }
+
+    return euicc_derutil_writer_finish(&writer, &userdata->response, &userdata->response_len);
+}
+
+static uint32_t sim_response_chunk(struct sim_userdata *userdata, uint8_t *rx, uint32_t rx_cap)
+{
+    uint32_t chunk = userdata->response_len < SIM_RESPONSE_CHUNK ? userdata->response_len : SIM_RESPONSE_CHUNK;
+    uint32_t remaining;
+
+    if (chunk + 2 > rx_cap)
+    {
+        chunk = rx_cap - 2;
+    }
+
+    memcpy(rx, userdata->response, chunk);
+    userdata->response += chunk;
+    userdata->response_len -= chunk;
+    remaining = userdata->response_len;
+
+    if (remaining)
+    {
+        rx[chunk] = 0x61;
+        rx[chunk + 1] = remaining < SIM_RESPONSE_CHUNK ? remaining : 0x00;
+    }
+    else
+    {
+        rx[chunk] = 0x90;
+        rx[chunk + 1] = 0x00;
+    }
+
+    return chunk + 2;
+}
+
+static void sim_status(uint8_t *rx, uint32_t *rx_len, uint8_t sw1, uint8_t sw2)
+{
+    rx[0] = sw1;
+    rx[1] = sw2;
+    *rx_len = 2;
+}
+
+static int sim_transmit(struct sim_userdata *userdata, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    const uint8_t *data;
+    uint32_t data_len;
+
+    if (rx_cap < 2 || tx_len < 4)
+    {
+        return -1;
+    }
+
+    sim_delay(userdata);
+
+    switch (tx[1])
+    {
+    case 0xC0: // GET RESPONSE
+        if (userdata->response_len == 0)
+        {
+            sim_status(rx, rx_len, 0x69, 0x85);
+            return 0;
+        }
+        *rx_len = sim_response_chunk(userdata, rx, rx_cap);
+        return 0;
+    case 0xE2: // STORE DATA
+        if (userdata->reset_required && userdata->command_len == 0)
+        {
+            return -1;
+        }
+        if (userdata->busy_every > 0 && ++userdata->store_data_count % userdata->busy_every == 0)
+        {
+            sim_status(rx, rx_len, 0x93, 0x00);
+            return 0;
+        }
+        break;
+    default:
+        sim_status(rx, rx_len, 0x6D, 0x00);
+        return 0;
+    }
+
+    if (tx_len > 7 && tx[4] == 0x00)
+    {
+        data = tx + 7;
+        data_len = (tx[5] << 8) | tx[6];
+    }
+    else if (tx_len > 5)
+    {
+        data = tx + 5;
+        data_len = tx[4];
+    }
+    else
+    {
+        data = NULL;
+        data_len = 0;
+    }
+    if (data && data + data_len > tx + tx_len)
+    {
+        sim_status(rx, rx_len, 0x67, 0x00);
+        return 0;
+    }
+
+    if (userdata->command_len + data_len > userdata->command_cap)
+    {
+        uint32_t cap = userdata->command_cap ? userdata->command_cap : 1024;
+        uint8_t *command_new;
+
+        while (cap < userdata->command_len + data_len)
+        {
+            cap *= 2;
+        }
+        command_new = realloc(userdata->command, cap);
+        if (command_new == NULL)
+        {
+            return -1;
+        }
+        userdata->command = command_new;
+        userdata->command_cap = cap;
+    }
+    memcpy(userdata->command + userdata->command_len, data, data_len);
+    userdata->command_len += data_len;
+
+    if (!(tx[2] & 0x80))
+    {
+        sim_status(rx, rx_len, 0x90, 0x00);
+        return 0;
+    }
+
+    if (sim_command(userdata) < 0)
+    {
+        userdata->command_len = 0;
+        sim_status(rx, rx_len, 0x6A, 0x80);
+        return 0;
+    }
+    userdata->command_len = 0;
+
+    if (userdata->response_len == 0)
+    {
+        sim_status(rx, rx_len, 0x90, 0x00);
+    }
+    else
+    {
+        sim_status(rx, rx_len, 0x61, userdata->response_len < SIM_RESPONSE_CHUNK ? userdata->response_len : 0x00);
+    }
+
+    return 0;
+}
+
+static int apdu_interface_connect(struct euicc_ctx *ctx)
+{
+    struct sim_userdata *userdata = ctx->apdu.interface->userdata;
+
+    userdata->reset_required = 0;
+    return 0;
+}
+
+static int apdu_interface_reconnect(struct euicc_ctx *ctx)
+{
+    struct sim_userdata *userdata = ctx->apdu.interface->userdata;
+
+    sim_delay(userdata);
+    userdata->reset_required = 0;
+    userdata->command_len = 0;
+    userdata->response_len = 0;
+    return 0;
+}
+
+static void apdu_interface_disconnect(struct euicc_ctx *ctx)
+{
+}
+
+static int apdu_interface_logic_channel_open(struct euicc_ctx *ctx, const uint8_t *aid, uint8_t aid_len)
+{
+    struct sim_userdata *userdata = ctx->apdu.interface->userdata;
+
+    sim_delay(userdata);
+    if (userdata->reset_required)
+    {
+        return -1;
+    }
+    if (userdata->isd_r_aid_len > 0 && (aid_len != userdata->isd_r_aid_len || memcmp(aid, userdata->isd_r_aid, aid_len) != 0))
+    {
+        return -1;
+    }
+    return 1;
+}
+
+static int apdu_interface_identity(struct euicc_ctx *ctx, char *identity, uint32_t identity_len)
+{
+    struct sim_userdata *userdata = ctx->apdu.interface->userdata;
+
+    return euicc_hexutil_bin2hex(identity, identity_len, userdata->eid, sizeof(userdata->eid));
+}
+
+static void apdu_interface_logic_channel_close(struct euicc_ctx *ctx, uint8_t channel)
+{
+}
+
+static int apdu_interface_transmit_into(struct euicc_ctx *ctx, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    return sim_transmit(ctx->apdu.interface->userdata, rx, rx_cap, rx_len, tx, tx_len);
+}
+
+static int apdu_interface_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    *rx = malloc(SIM_RESPONSE_CHUNK + 2);
+    if (*rx == NULL)
+    {
+        return -1;
+    }
+
+    if (sim_transmit(ctx->apdu.interface->userdata, *rx, SIM_RESPONSE_CHUNK + 2, rx_len, tx, tx_len) < 0)
+    {
+        free(*rx);
+        *rx = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int apdu_interface_transmit_batch(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *const *tx, const uint32_t *tx_len, uint32_t tx_count)
+{
+    uint32_t sent = 0;
+
+    *rx = malloc(SIM_RESPONSE_CHUNK + 2);
+    if (*rx == NULL)
+    {
+        return -1;
+    }
+
+    while (sent < tx_count)
+    {
+        if (sim_transmit(ctx->apdu.interface->userdata, *rx, SIM_RESPONSE_CHUNK + 2, rx_len, tx[sent], tx_len[sent]) < 0)
+        {
+            free(*rx);
+            *rx = NULL;
+            return -1;
+        }
+        sent++;
+        if (*rx_len != 2 || (*rx)[0] != 0x90 || (*rx)[1] != 0x00)
+        {
+            break;
+        }
+    }
+
+    return sent;
+}
+
+LPAC_BIND_APDU_DEFINE(apdu_interface_transmit, apdu_interface_transmit_into)
+
+static int libapduinterface_init(struct euicc_apdu_interface *ifstruct, const char *device)
+{
+    struct sim_userdata *userdata;
+    const char *eid, *isd_r_aid;
+    long profiles, notifications, icon_size;
+
+    memset(ifstruct, 0, sizeof(struct euicc_apdu_interface));
+
+    userdata = calloc(1, sizeof(struct sim_userdata));
+    if (userdata == NULL)
+    {
+        return -1;
+    }
+
+    isd_r_aid = getenv("SIM_ISD_R_AID");
+    if (isd_r_aid)
+    {
+        userdata->isd_r_aid_len = euicc_hexutil_hex2bin(userdata->isd_r_aid, sizeof(userdata->isd_r_aid), isd_r_aid);
+    }
+
+    // The device names the card by its EID, for callers running several at once
+    eid = device ? device : getenv("SIM_EID");
+    if (eid == NULL || euicc_hexutil_hex2bin(userdata->eid, sizeof(userdata->eid), eid) != sizeof(userdata->eid))
+    {
+        euicc_hexutil_hex2bin(userdata->eid, sizeof(userdata->eid), SIM_EID_DEFAULT);
+    }
+
+    userdata->latency = sim_getenv_long("SIM_LATENCY", 0);
+    userdata->jitter = sim_getenv_long("SIM_JITTER", 0);
+    userdata->busy_every = sim_getenv_long("SIM_BUSY", 0);
+    profiles = sim_getenv_long("SIM_PROFILES", SIM_PROFILES_DEFAULT);
+    notifications = sim_getenv_long("SIM_NOTIFICATIONS", 0);
+    icon_size = sim_getenv_long("SIM_ICON_SIZE", 0);
+    srand(time(NULL));
+
+    // The icon content is irrelevant, only its size matters to the host
+    if (icon_size > 0)
+    {
+        userdata->icon = malloc(icon_size);
+        if (userdata->icon == NULL)
+        {
+            goto err;
+        }
+        for (long i = 0; i < icon_size; i++)
+        {
+            userdata->icon[i] = i & 0xFF;
+        }
+        userdata->icon_len = icon_size;
+    }
+
+    for (long i = 0; i < profiles; i++)
+    {
+        if (sim_profile_add(userdata, i == 0) < 0)
+        {
+            goto err;
+        }
+    }
+    for (long i = 0; i < notifications && userdata->profiles_count; i++)
+    {
+        if (sim_notification_add(userdata, SIM_NOTIFICATION_INSTALL >> (i % 4), &userdata->profiles[i % userdata->profiles_count]) < 0)
+        {
+            goto err;
+        }
+    }
+
+    userdata->response_cap = 4096;
+    userdata->response_buffer = malloc(userdata->response_cap);
+    if (userdata->response_buffer == NULL)
+    {
+        goto err;
+    }
+
+    ifstruct->connect = apdu_interface_connect;
+    ifstruct->disconnect = apdu_interface_disconnect;
+    ifstruct->logic_channel_open = apdu_interface_logic_channel_open;
+    ifstruct->logic_channel_close = apdu_interface_logic_channel_close;
+    ifstruct->transmit = LPAC_BIND_APDU_TRANSMIT(apdu_interface_transmit);
+    ifstruct->transmit_into = LPAC_BIND_APDU_TRANSMIT_INTO(apdu_interface_transmit_into);
+    ifstruct->transmit_batch = apdu_interface_transmit_batch;
+    ifstruct->identity = apdu_interface_identity;
+    ifstruct->reconnect = apdu_interface_reconnect;
+    ifstruct->extended_length = 1;
+    ifstruct->userdata = userdata;
+
+    return 0;
+
+err:
+    free(userdata->response_buffer);
+    free(userdata->notifications);
+    free(userdata->profiles);
+    free(userdata->icon);
+    free(userdata);
+    return -1;
+}
+
+static int libapduinterface_main(struct euicc_apdu_interface *ifstruct, int argc, char **argv)
+{
+    return 0;
+}
+
+static void libapduinterface_fini(struct euicc_apdu_interface *ifstruct)
+{
+    struct sim_userdata *userdata = ifstruct->userdata;
+
+    if (userdata == NULL)
+    {
+        return;
+    }
+
+    free(userdata->response_buffer);
+    free(userdata->command);
+    free(userdata->default_dp_address);
+    free(userdata->notifications);
+    free(userdata->profiles);
+    free(userdata->icon);
+    free(userdata);
+    ifstruct->userdata = NULL;
+}
+
+const struct euicc_driver driver_apdu_sim = {
+    .type = DRIVER_APDU,
+    .name = "sim",
+    .init = (int (*)(void *, const char *))libapduinterface_init,
+    .main = (int (*)(void *, int, char **))libapduinterface_main,
+    .fini = (void (*)(void *))libapduinterface_fini,
+};
@@ -0,0 +1,4 @@
+#pragma once
+#include <driver.private.h>
+
+extern const struct euicc_driver driver_apdu_sim;
@@ -5,43 +5,51 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 #include <cjson/cJSON_ex.h>
 #include <euicc/interface.h>
 #include <euicc/hexutil.h>
 
+#include "bind.h"
+
 // getline is a GNU extension, Mingw32 macOS and FreeBSD don't have (a working) one
 static int afgets(char **obuf, FILE *fp)
 {
     uint32_t len = 0;
-    char buffer[2];
+    uint32_t cap = 256;
     char *obuf_new = NULL;
+    int c;
 
-    *obuf = malloc(1);
+    *obuf = malloc(cap);
     if ((*obuf) == NULL)
     {
         goto err;
     }
-    (*obuf)[0] = '\0';
 
-    while (fgets(buffer, sizeof(buffer), fp) != NULL)
+    while ((c = getc(fp)) != EOF)
     {
-        uint32_t fgets_len = strlen(buffer);
-
-        len += fgets_len + 1;
-        obuf_new = realloc(*obuf, len);
-        if (obuf_new == NULL)
+        if (len + 1 >= cap)
         {
-            goto err;
+            cap *= 2;
+            obuf_new = realloc(*obuf, cap);
+            if (obuf_new == NULL)
+            {
+                goto err;
+            }
+            *obuf = obuf_new;
         }
-        *obuf = obuf_new;
-        strcat(*obuf, buffer);
+        (*obuf)[len++] = c;
 
-        if (buffer[fgets_len - 1] == '\n')
+        if (c == '\n')
         {
             break;
         }
     }
+    (*obuf)[len] = '\0';
 
     (*obuf)[strcspn(*obuf, "\r\n")] = 0;
 
@@ -53,6 +61,174 @@ err:
     return -1;
 }
 
+/*
+ * Framed mode (STDIO_APDU_FRAMED): each message is 0x00, 'A', a 32-bit big-endian body length and the body.
+ * Request body: function byte, then the raw parameter. transmit_batch packs a 32-bit count and every APDU as 32-bit length + bytes.
+ * Response body: 32-bit big-endian signed ecode, then the raw data if any.
+ */
+#define FRAME_MAGIC 0x00
+#define FRAME_TYPE 'A'
+
+#define FRAME_FUNC_CONNECT 'c'
+#define FRAME_FUNC_DISCONNECT 'd'
+#define FRAME_FUNC_LOGIC_CHANNEL_OPEN 'o'
+#define FRAME_FUNC_LOGIC_CHANNEL_CLOSE 'x'
+#define FRAME_FUNC_TRANSMIT 't'
+#define FRAME_FUNC_TRANSMIT_BATCH 'b'
+
+static void frame_put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t frame_get_u32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int frame_request(uint8_t func, const uint8_t *const *param, const uint32_t *param_len, uint32_t param_count, int batch)
+{
+    uint8_t header[6 + 1 + 4];
+    uint8_t prefix[4];
+    uint32_t body_len = 1;
+    uint32_t header_len = 7;
+
+    if (batch)
+    {
+        body_len += 4;
+        for (uint32_t i = 0; i < param_count; i++)
+        {
+            body_len += 4 + param_len[i];
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; i < param_count; i++)
+        {
+            body_len += param_len[i];
+        }
+    }
+
+    header[0] = FRAME_MAGIC;
+    header[1] = FRAME_TYPE;
+    frame_put_u32(header + 2, body_len);
+    header[6] = func;
+    if (batch)
+    {
+        frame_put_u32(header + 7, param_count);
+        header_len += 4;
+    }
+
+    if (fwrite(header, 1, header_len, stdout) != header_len)
+    {
+        return -1;
+    }
+    for (uint32_t i = 0; i < param_count; i++)
+    {
+        if (batch)
+        {
+            frame_put_u32(prefix, param_len[i]);
+            if (fwrite(prefix, 1, sizeof(prefix), stdout) != sizeof(prefix))
+            {
+                return -1;
+            }
+        }
+        if (param_len[i] && fwrite(param[i], 1, param_len[i], stdout) != param_len[i])
+        {
+            return -1;
+        }
+    }
+
+    return fflush(stdout) == 0 ? 0 : -1;
+}
+
+static int frame_request_single(uint8_t func, const uint8_t *param, uint32_t param_len)
+{
+    return frame_request(func, &param, &param_len, param ? 1 : 0, 0);
+}
+
+// Reads the response into *data (allocated) or data_buffer, whichever is given
+static int frame_response_ex(int *ecode, uint8_t **data, uint32_t *data_len, uint8_t *data_buffer, uint32_t data_buffer_cap)
+{
+    uint8_t header[6 + 4];
+    uint32_t body_len;
+    uint32_t len;
+    uint8_t *dst = NULL;
+    uint8_t *allocated = NULL;
+
+    *ecode = -1;
+    if (data)
+    {
+        *data = NULL;
+    }
+    if (data_len)
+    {
+        *data_len = 0;
+    }
+
+    if (fread(header, 1, sizeof(header), stdin) != sizeof(header))
+    {
+        return -1;
+    }
+    if (header[0] != FRAME_MAGIC || header[1] != FRAME_TYPE)
+    {
+        return -1;
+    }
+    body_len = frame_get_u32(header + 2);
+    if (body_len < 4)
+    {
+        return -1;
+    }
+    len = body_len - 4;
+
+    if (len > 0)
+    {
+        if (data_buffer && data_len)
+        {
+            if (len > data_buffer_cap)
+            {
+                return -1;
+            }
+            dst = data_buffer;
+        }
+        else
+        {
+            dst = allocated = malloc(len);
+            if (dst == NULL)
+            {
+                return -1;
+            }
+        }
+        if (fread(dst, 1, len, stdin) != len)
+        {
+            free(allocated);
+            return -1;
+        }
+    }
+
+    *ecode = (int32_t)frame_get_u32(header + 6);
+    if (data && data_len && !data_buffer)
+    {
+        *data = allocated;
+        allocated = NULL;
+    }
+    if (data_len && dst)
+    {
+        *data_len = len;
+    }
+    free(allocated);
+
+    return 0;
+}
+
+static int frame_response(int *ecode, uint8_t **data, uint32_t *data_len)
+{
+    return frame_response_ex(ecode, data, data_len, NULL, 0);
+}
+
 static int json_print(cJSON *jpayload)
 {
     cJSON *jroot = NULL;
@@ -153,7 +329,63 @@ exit:
     return fret;
 }
 
-static int json_response(int *ecode, uint8_t **data, uint32_t *data_len)
+static int json_request_batch(const char *func, const uint8_t *const *param, const uint32_t *param_len, uint32_t param_count)
+{
+    int fret = 0;
+    char *param_hex = NULL;
+    cJSON *jpayload = NULL;
+    cJSON *jparam = NULL;
+
+    jpayload = cJSON_CreateObject();
+    if (jpayload == NULL)
+    {
+        goto err;
+    }
+    if (cJSON_AddStringOrNullToObject(jpayload, "func", func) == NULL)
+    {
+        goto err;
+    }
+    jparam = cJSON_AddArrayToObject(jpayload, "param");
+    if (jparam == NULL)
+    {
+        goto err;
+    }
+
+    for (uint32_t i = 0; i < param_count; i++)
+    {
+        cJSON *jitem;
+
+        param_hex = malloc((2 * param_len[i]) + 1);
+        if (param_hex == NULL)
+        {
+            goto err;
+        }
+        if (euicc_hexutil_bin2hex(param_hex, (2 * param_len[i]) + 1, param[i], param_len[i]) < 0)
+        {
+            goto err;
+        }
+        jitem = cJSON_CreateString(param_hex);
+        if (jitem == NULL)
+        {
+            goto err;
+        }
+        cJSON_AddItemToArray(jparam, jitem);
+        free(param_hex);
+        param_hex = NULL;
+    }
+
+    fret = json_print(jpayload);
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    cJSON_Delete(jpayload);
+    free(param_hex);
+    return fret;
+}
+
+static int json_response_ex(int *ecode, uint8_t **data, uint32_t *data_len, uint8_t *data_buffer, uint32_t data_buffer_cap)
 {
     int fret = 0;
     char *data_json;
@@ -215,7 +447,18 @@ static int json_response(int *ecode, uint8_t **data, uint32_t *data_len)
     *ecode = jtmp->valueint;
 
     jtmp = cJSON_GetObjectItem(data_payload, "data");
-    if (jtmp && cJSON_IsString(jtmp) && data && data_len)
+    if (jtmp && cJSON_IsString(jtmp) && data_buffer && data_len)
+    {
+        int ret;
+
+        ret = euicc_hexutil_hex2bin_r(data_buffer, data_buffer_cap, jtmp->valuestring, strlen(jtmp->valuestring));
+        if (ret < 0)
+        {
+            goto err;
+        }
+        *data_len = ret;
+    }
+    else if (jtmp && cJSON_IsString(jtmp) && data && data_len)
     {
         *data_len = strlen(jtmp->valuestring) / 2;
         *data = malloc(*data_len);
@@ -234,9 +477,9 @@ static int json_response(int *ecode, uint8_t **data, uint32_t *data_len)
 
 err:
     fret = -1;
-    free(*data);
     if (data)
     {
+        free(*data);
         *data = NULL;
     }
     if (data_len)
@@ -250,6 +493,11 @@ exit:
     return fret;
 }
 
+static int json_response(int *ecode, uint8_t **data, uint32_t *data_len)
+{
+    return json_response_ex(ecode, data, data_len, NULL, 0);
+}
+
 // {"type":"apdu","payload":{"ecode":0}}
 static int apdu_interface_connect(struct euicc_ctx *ctx)
 {
@@ -324,30 +572,195 @@ static int apdu_interface_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t
     return ecode;
 }
 
-static int libapduinterface_init(struct euicc_apdu_interface *ifstruct)
+static int apdu_interface_transmit_into(struct euicc_ctx *ctx, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    int ecode;
+
+    *rx_len = 0;
+
+    if (json_request("transmit", tx, tx_len))
+    {
+        return -1;
+    }
+
+    if (json_response_ex(&ecode, NULL, rx_len, rx, rx_cap))
+    {
+        return -1;
+    }
+
+    return ecode;
+}
+
+// {"type":"apdu","payload":{"ecode":2,"data":"9000"}}
+static int apdu_interface_transmit_batch(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *const *tx, const uint32_t *tx_len, uint32_t tx_count)
+{
+    int ecode;
+
+    if (json_request_batch("transmit_batch", tx, tx_len, tx_count))
+    {
+        return -1;
+    }
+
+    if (json_response(&ecode, rx, rx_len))
+    {
+        return -1;
+    }
+
+    return ecode;
+}
+
+static int apdu_interface_connect_framed(struct euicc_ctx *ctx)
+{
+    int ecode;
+
+    if (frame_request_single(FRAME_FUNC_CONNECT, NULL, 0))
+    {
+        return -1;
+    }
+
+    if (frame_response(&ecode, NULL, NULL))
+    {
+        return -1;
+    }
+
+    return ecode;
+}
+
+static void apdu_interface_disconnect_framed(struct euicc_ctx *ctx)
+{
+    int ecode;
+
+    frame_request_single(FRAME_FUNC_DISCONNECT, NULL, 0);
+    frame_response(&ecode, NULL, NULL);
+}
+
+static int apdu_interface_logic_channel_open_framed(struct euicc_ctx *ctx, const uint8_t *aid, uint8_t aid_len)
+{
+    int ecode;
+
+    if (frame_request_single(FRAME_FUNC_LOGIC_CHANNEL_OPEN, aid, aid_len))
+    {
+        return -1;
+    }
+
+    if (frame_response(&ecode, NULL, NULL))
+    {
+        return -1;
+    }
+
+    return ecode;
+}
+
+static void apdu_interface_logic_channel_close_framed(struct euicc_ctx *ctx, uint8_t channel)
+{
+    int ecode;
+
+    frame_request_single(FRAME_FUNC_LOGIC_CHANNEL_CLOSE, &channel, sizeof(channel));
+    frame_response(&ecode, NULL, NULL);
+}
+
+static int apdu_interface_transmit_framed(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    int ecode;
+
+    if (frame_request_single(FRAME_FUNC_TRANSMIT, tx, tx_len))
+    {
+        return -1;
+    }
+
+    if (frame_response(&ecode, rx, rx_len))
+    {
+        return -1;
+    }
+
+    return ecode;
+}
+
+static int apdu_interface_transmit_into_framed(struct euicc_ctx *ctx, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    int ecode;
+
+    if (frame_request_single(FRAME_FUNC_TRANSMIT, tx, tx_len))
+    {
+        return -1;
+    }
+
+    if (frame_response_ex(&ecode, NULL, rx_len, rx, rx_cap))
+    {
+        return -1;
+    }
+
+    return ecode;
+}
+
+static int apdu_interface_transmit_batch_framed(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *const *tx, const uint32_t *tx_len, uint32_t tx_count)
+{
+    int ecode;
+
+    if (frame_request(FRAME_FUNC_TRANSMIT_BATCH, tx, tx_len, tx_count, 1))
+    {
+        return -1;
+    }
+
+    if (frame_response(&ecode, rx, rx_len))
+    {
+        return -1;
+    }
+
+    return ecode;
+}
+
+LPAC_BIND_APDU_DEFINE(apdu_interface_transmit, apdu_interface_transmit_into)
+
+static int libapduinterface_init(struct euicc_apdu_interface *ifstruct, const char *device)
 {
     ifstruct->connect = apdu_interface_connect;
     ifstruct->disconnect = apdu_interface_disconnect;
     ifstruct->logic_channel_open = apdu_interface_logic_channel_open;
     ifstruct->logic_channel_close = apdu_interface_logic_channel_close;
-    ifstruct->transmit = apdu_interface_transmit;
+    ifstruct->transmit = LPAC_BIND_APDU_TRANSMIT(apdu_interface_transmit);
+    ifstruct->transmit_into = LPAC_BIND_APDU_TRANSMIT_INTO(apdu_interface_transmit_into);
+    ifstruct->extended_length = 1;
+    if (getenv("STDIO_APDU_BATCH"))
+    {
+        ifstruct->transmit_batch = apdu_interface_transmit_batch;
+    }
+
+    if (getenv("STDIO_APDU_FRAMED"))
+    {
+#ifdef _WIN32
+        // Frames carry raw bytes, which text mode would mangle
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        ifstruct->connect = apdu_interface_connect_framed;
+        ifstruct->disconnect = apdu_interface_disconnect_framed;
+        ifstruct->logic_channel_open = apdu_interface_logic_channel_open_framed;
+        ifstruct->logic_channel_close = apdu_interface_logic_channel_close_framed;
+        ifstruct->transmit = apdu_interface_transmit_framed;
+        ifstruct->transmit_into = apdu_interface_transmit_into_framed;
+        if (ifstruct->transmit_batch)
+        {
+            ifstruct->transmit_batch = apdu_interface_transmit_batch_framed;
+        }
+    }
 
     return 0;
 }
 
-static int libapduinterface_main(int argc, char **argv)
+static int libapduinterface_main(struct euicc_apdu_interface *ifstruct, int argc, char **argv)
 {
     return 0;
 }
 
-static void libapduinterface_fini(void)
+static void libapduinterface_fini(struct euicc_apdu_interface *ifstruct)
 {
 }
 
 const struct euicc_driver driver_apdu_stdio = {
     .type = DRIVER_APDU,
     .name = "stdio",
-    .init = (int (*)(void *))libapduinterface_init,
-    .main = libapduinterface_main,
-    .fini = libapduinterface_fini,
+    .init = (int (*)(void *, const char *))libapduinterface_init,
+    .main = (int (*)(void *, int, char **))libapduinterface_main,
+    .fini = (void (*)(void *))libapduinterface_fini,
 };
@@ -0,0 +1,509 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <euicc/euicc.h>
+#include <euicc/interface.h>
+#include <trace.private.h>
+
+#define TRACE_INTERFACE 'i'
+#define TRACE_CONNECT 'c'
+#define TRACE_DISCONNECT 'd'
+#define TRACE_LOGIC_CHANNEL_OPEN 'o'
+#define TRACE_LOGIC_CHANNEL_CLOSE 'x'
+#define TRACE_TRANSMIT 't'
+
+struct record_userdata
+{
+    const struct euicc_driver *driver;
+    struct euicc_apdu_interface inner;
+    struct driver_trace trace;
+    struct driver_trace_buffer buffer;
+};
+
+struct replay_userdata
+{
+    struct driver_trace trace;
+};
+
+// The wrapped driver finds its own userdata through ctx, so it runs with its interface swapped in
+#define RECORD_CALL(ctx, userdata, call)                                     \
+    do                                                                       \
+    {                                                                        \
+        const struct euicc_apdu_interface *_outer = (ctx)->apdu.interface;  \
+        (ctx)->apdu.interface = &(userdata)->inner;                          \
+        call;                                                                \
+        (ctx)->apdu.interface = _outer;                                      \
+    } while (0)
+
+static void record_write(struct record_userdata *userdata, uint8_t kind, uint64_t start)
+{
+    if (driver_trace_write(&userdata->trace, kind, start, &userdata->buffer) < 0)
+    {
+        fprintf(stderr, "error: write APDU trace failed\n");
+    }
+}
+
+static int record_connect(struct euicc_ctx *ctx)
+{
+    struct record_userdata *userdata = ctx->apdu.interface->userdata;
+    uint64_t start = driver_trace_now();
+    int ret;
+
+    RECORD_CALL(ctx, userdata, ret = userdata->inner.connect(ctx));
+
+    driver_trace_put_int(&userdata->buffer, ret);
+    record_write(userdata, TRACE_CONNECT, start);
+
+    return ret;
+}
+
+static void record_disconnect(struct euicc_ctx *ctx)
+{
+    struct record_userdata *userdata = ctx->apdu.interface->userdata;
+    uint64_t start = driver_trace_now();
+
+    RECORD_CALL(ctx, userdata, userdata->inner.disconnect(ctx));
+
+    record_write(userdata, TRACE_DISCONNECT, start);
+}
+
+static int record_logic_channel_open(struct euicc_ctx *ctx, const uint8_t *aid, uint8_t aid_len)
+{
+    struct record_userdata *userdata = ctx->apdu.interface->userdata;
+    uint64_t start = driver_trace_now();
+    int ret;
+
+    RECORD_CALL(ctx, userdata, ret = userdata->inner.logic_channel_open(ctx, aid, aid_len));
+
+    driver_trace_put_bytes(&userdata->buffer, aid, aid_len);
+    driver_trace_put_int(&userdata->buffer, ret);
+    record_write(userdata, TRACE_LOGIC_CHANNEL_OPEN, start);
+
+    return ret;
+}
+
+static void record_logic_channel_close(struct euicc_ctx *ctx, uint8_t channel)
+{
+    struct record_userdata *userdata = ctx->apdu.interface->userdata;
+    uint64_t start = driver_trace_now();
+
+    RECORD_CALL(ctx, userdata, userdata->inner.logic_channel_close(ctx, channel));
+
+    driver_trace_put_uint(&userdata->buffer, channel);
+    record_write(userdata, TRACE_LOGIC_CHANNEL_CLOSE, start);
+}
+
+static void record_put_transmit(struct record_userdata *userdata, const uint8_t *tx, uint32_t tx_len, int ret, const uint8_t *rx, uint32_t rx_len)
+{
+    driver_trace_put_bytes(&userdata->buffer, tx, tx_len);
+    driver_trace_put_int(&userdata->buffer, ret);
+    driver_trace_put_bytes(&userdata->buffer, rx, ret < 0 ? 0 : rx_len);
+}
+
+static int record_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    struct record_userdata *userdata = ctx->apdu.interface->userdata;
+    uint64_t start = driver_trace_now();
+    int ret;
+
+    *rx = NULL;
+    *rx_len = 0;
+
+    RECORD_CALL(ctx, userdata, ret = userdata->inner.transmit(ctx, rx, rx_len, tx, tx_len));
+
+    record_put_transmit(userdata, tx, tx_len, ret, *rx, *rx_len);
+    record_write(userdata, TRACE_TRANSMIT, start);
+
+    return ret;
+}
+
+// Stored as one transmit record per APDU, all but the last answered with a bare 90 00
+static int record_transmit_batch(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *const *tx, const uint32_t *tx_len, uint32_t tx_count)
+{
+    static const uint8_t sw_ok[] = {0x90, 0x00};
+    struct record_userdata *userdata = ctx->apdu.interface->userdata;
+    uint64_t start = driver_trace_now();
+    int ret;
+
+    *rx = NULL;
+    *rx_len = 0;
+
+    RECORD_CALL(ctx, userdata, ret = userdata->inner.transmit_batch(ctx, rx, rx_len, tx, tx_len, tx_count));
+
+    if (ret <= 0)
+    {
+        record_put_transmit(userdata, tx[0], tx_len[0], -1, NULL, 0);
+        record_write(userdata, TRACE_TRANSMIT, start);
+        return ret;
+    }
+
+    for (int i = 0; i < ret; i++)
+    {
+        if (i == ret - 1)
+        {
+            record_put_transmit(userdata, tx[i], tx_len[i], 0, *rx, *rx_len);
+        }
+        else
+        {
+            record_put_transmit(userdata, tx[i], tx_len[i], 0, sw_ok, sizeof(sw_ok));
+        }
+        record_write(userdata, TRACE_TRANSMIT, start);
+        start = driver_trace_now();
+    }
+
+    return ret;
+}
+
+static int record_transaction_begin(struct euicc_ctx *ctx)
+{
+    struct record_userdata *userdata = ctx->apdu.interface->userdata;
+    int ret;
+
+    RECORD_CALL(ctx, userdata, ret = userdata->inner.transaction_begin(ctx));
+
+    return ret;
+}
+
+static void record_transaction_end(struct euicc_ctx *ctx)
+{
+    struct record_userdata *userdata = ctx->apdu.interface->userdata;
+
+    RECORD_CALL(ctx, userdata, userdata->inner.transaction_end(ctx));
+}
+
+static int record_init(struct euicc_apdu_interface *ifstruct, const char *device)
+{
+    struct record_userdata *userdata;
+    const char *path = getenv("RECORD_APDU_FILE");
+    const char *name = getenv("RECORD_APDU_DRIVER");
+
+    memset(ifstruct, 0, sizeof(struct euicc_apdu_interface));
+
+    if (path == NULL)
+    {
+        fprintf(stderr, "error: RECORD_APDU_FILE is not set\n");
+        return -1;
+    }
+
+    userdata = calloc(1, sizeof(struct record_userdata));
+    if (userdata == NULL)
+    {
+        return -1;
+    }
+
+    userdata->driver = euicc_driver_find(DRIVER_APDU, name);
+    if (userdata->driver == NULL || userdata->driver == &driver_apdu_record || userdata->driver == &driver_apdu_replay)
+    {
+        fprintf(stderr, "error: RECORD_APDU_DRIVER does not name an APDU backend\n");
+        goto err;
+    }
+
+    if (driver_trace_create(&userdata->trace, path, DRIVER_TRACE_APDU) < 0)
+    {
+        fprintf(stderr, "error: create APDU trace %s failed\n", path);
+        goto err;
+    }
+
+    if (userdata->driver->init(&userdata->inner, device))
+    {
+        driver_trace_close(&userdata->trace);
+        goto err;
+    }
+
+    ifstruct->connect = record_connect;
+    ifstruct->disconnect = record_disconnect;
+    ifstruct->logic_channel_open = record_logic_channel_open;
+    ifstruct->logic_channel_close = record_logic_channel_close;
+    ifstruct->transmit = record_transmit;
+    if (userdata->inner.transmit_batch)
+    {
+        ifstruct->transmit_batch = record_transmit_batch;
+    }
+    if (userdata->inner.transaction_begin)
+    {
+        ifstruct->transaction_begin = record_transaction_begin;
+    }
+    if (userdata->inner.transaction_end)
+    {
+        ifstruct->transaction_end = record_transaction_end;
+    }
+    ifstruct->extended_length = userdata->inner.extended_length;
+    ifstruct->userdata = userdata;
+
+    // Lets the replay offer the same capabilities, libeuicc sizes segments by them
+    driver_trace_put_uint(&userdata->buffer, ifstruct->extended_length);
+    driver_trace_put_uint(&userdata->buffer, ifstruct->transmit_batch != NULL);
+    record_write(userdata, TRACE_INTERFACE, driver_trace_now());
+
+    return 0;
+
+err:
+    free(userdata);
+    return -1;
+}
+
+static int record_main(struct euicc_apdu_interface *ifstruct, int argc, char **argv)
+{
+    struct record_userdata *userdata = ifstruct->userdata;
+
+    return userdata->driver->main(&userdata->inner, argc, argv);
+}
+
+static void record_fini(struct euicc_apdu_interface *ifstruct)
+{
+    struct record_userdata *userdata = ifstruct->userdata;
+
+    if (userdata == NULL)
+    {
+        return;
+    }
+
+    userdata->driver->fini(&userdata->inner);
+    driver_trace_close(&userdata->trace);
+    driver_trace_buffer_free(&userdata->buffer);
+    free(userdata);
+    ifstruct->userdata = NULL;
+}
+
+// Returns the body of the next record, which must be of the given kind
+static int replay_next(struct replay_userdata *userdata, uint8_t kind, struct driver_trace_cursor *cursor)
+{
+    uint8_t recorded;
+
+    if (driver_trace_next(&userdata->trace, &recorded, cursor) < 0)
+    {
+        fprintf(stderr, "error: APDU trace ended\n");
+        return -1;
+    }
+    if (recorded != kind)
+    {
+        fprintf(stderr, "error: APDU trace expected '%c' but has '%c'\n", kind, recorded);
+        return -1;
+    }
+    return 0;
+}
+
+static int replay_connect(struct euicc_ctx *ctx)
+{
+    struct driver_trace_cursor cursor;
+
+    if (replay_next(ctx->apdu.interface->userdata, TRACE_CONNECT, &cursor) < 0)
+    {
+        return -1;
+    }
+    return driver_trace_get_int(&cursor);
+}
+
+static void replay_disconnect(struct euicc_ctx *ctx)
+{
+    struct driver_trace_cursor cursor;
+
+    replay_next(ctx->apdu.interface->userdata, TRACE_DISCONNECT, &cursor);
+}
+
+static int replay_logic_channel_open(struct euicc_ctx *ctx, const uint8_t *aid, uint8_t aid_len)
+{
+    struct driver_trace_cursor cursor;
+    uint32_t recorded_aid_len;
+
+    if (replay_next(ctx->apdu.interface->userdata, TRACE_LOGIC_CHANNEL_OPEN, &cursor) < 0)
+    {
+        return -1;
+    }
+    driver_trace_get_bytes(&cursor, &recorded_aid_len);
+    return driver_trace_get_int(&cursor);
+}
+
+static void replay_logic_channel_close(struct euicc_ctx *ctx, uint8_t channel)
+{
+    struct driver_trace_cursor cursor;
+
+    replay_next(ctx->apdu.interface->userdata, TRACE_LOGIC_CHANNEL_CLOSE, &cursor);
+}
+
+// Points rx into the trace, the caller copies it out
+static int replay_one(struct replay_userdata *userdata, const uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    struct driver_trace_cursor cursor;
+    const uint8_t *recorded_tx;
+    uint32_t recorded_tx_len;
+    int ret;
+
+    if (replay_next(userdata, TRACE_TRANSMIT, &cursor) < 0)
+    {
+        return -1;
+    }
+
+    recorded_tx = driver_trace_get_bytes(&cursor, &recorded_tx_len);
+    ret = driver_trace_get_int(&cursor);
+    *rx = driver_trace_get_bytes(&cursor, rx_len);
+    if (cursor.failed)
+    {
+        fprintf(stderr, "error: APDU trace is corrupted\n");
+        return -1;
+    }
+
+    if (recorded_tx_len != tx_len || memcmp(recorded_tx, tx, tx_len) != 0)
+    {
+        fprintf(stderr, "error: APDU does not match the trace\n");
+        return -1;
+    }
+
+    return ret;
+}
+
+static int replay_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    const uint8_t *recorded_rx;
+    int ret;
+
+    ret = replay_one(ctx->apdu.interface->userdata, &recorded_rx, rx_len, tx, tx_len);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    *rx = malloc(*rx_len ? *rx_len : 1);
+    if (*rx == NULL)
+    {
+        return -1;
+    }
+    memcpy(*rx, recorded_rx, *rx_len);
+
+    return ret;
+}
+
+static int replay_transmit_into(struct euicc_ctx *ctx, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len)
+{
+    const uint8_t *recorded_rx;
+    int ret;
+
+    ret = replay_one(ctx->apdu.interface->userdata, &recorded_rx, rx_len, tx, tx_len);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    if (*rx_len > rx_cap)
+    {
+        return -1;
+    }
+    memcpy(rx, recorded_rx, *rx_len);
+
+    return ret;
+}
+
+static int replay_transmit_batch(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *const *tx, const uint32_t *tx_len, uint32_t tx_count)
+{
+    const uint8_t *recorded_rx = NULL;
+    uint32_t sent = 0;
+
+    while (sent < tx_count)
+    {
+        if (replay_one(ctx->apdu.interface->userdata, &recorded_rx, rx_len, tx[sent], tx_len[sent]) < 0)
+        {
+            return -1;
+        }
+        sent++;
+        if (*rx_len != 2 || recorded_rx[0] != 0x90 || recorded_rx[1] != 0x00)
+        {
+            break;
+        }
+    }
+
+    *rx = malloc(*rx_len ? *rx_len : 1);
+    if (*rx == NULL)
+    {
+        return -1;
+    }
+    memcpy(*rx, recorded_rx, *rx_len);
+
+    return sent;
+}
+
+static int replay_init(struct euicc_apdu_interface *ifstruct, const char *device)
+{
+    struct replay_userdata *userdata;
+    struct driver_trace_cursor cursor;
+    const char *path = getenv("REPLAY_APDU_FILE");
+
+    memset(ifstruct, 0, sizeof(struct euicc_apdu_interface));
+
+    if (path == NULL)
+    {
+        fprintf(stderr, "error: REPLAY_APDU_FILE is not set\n");
+        return -1;
+    }
+
+    userdata = calloc(1, sizeof(struct replay_userdata));
+    if (userdata == NULL)
+    {
+        return -1;
+    }
+
+    if (driver_trace_load(&userdata->trace, path, DRIVER_TRACE_APDU) < 0)
+    {
+        fprintf(stderr, "error: load APDU trace %s failed\n", path);
+        free(userdata);
+        return -1;
+    }
+    if (replay_next(userdata, TRACE_INTERFACE, &cursor) < 0)
+    {
+        driver_trace_close(&userdata->trace);
+        free(userdata);
+        return -1;
+    }
+    ifstruct->extended_length = driver_trace_get_uint(&cursor);
+    if (driver_trace_get_uint(&cursor))
+    {
+        ifstruct->transmit_batch = replay_transmit_batch;
+    }
+    userdata->trace.paced = getenv("REPLAY_APDU_PACED") != NULL;
+
+    ifstruct->connect = replay_connect;
+    ifstruct->disconnect = replay_disconnect;
+    ifstruct->logic_channel_open = replay_logic_channel_open;
+    ifstruct->logic_channel_close = replay_logic_channel_close;
+    ifstruct->transmit = replay_transmit;
+    ifstruct->transmit_into = replay_transmit_into;
+    ifstruct->userdata = userdata;
+
+    return 0;
+}
+
+static int replay_main(struct euicc_apdu_interface *ifstruct, int argc, char **argv)
+{
+    return 0;
+}
+
+static void replay_fini(struct euicc_apdu_interface *ifstruct)
+{
+    struct replay_userdata *userdata = ifstruct->userdata;
+
+    if (userdata == NULL)
+    {
+        return;
+    }
+
+    driver_trace_close(&userdata->trace);
+    free(userdata);
+    ifstruct->userdata = NULL;
+}
+
+const struct euicc_driver driver_apdu_record = {
+    .type = DRIVER_APDU,
+    .name = "record",
+    .init = (int (*)(void *, const char *))record_init,
+    .main = (int (*)(void *, int, char **))record_main,
+    .fini = (void (*)(void *))record_fini,
+};
+
+const struct euicc_driver driver_apdu_replay = {
+    .type = DRIVER_APDU,
+    .name = "replay",
+    .init = (int (*)(void *, const char *))replay_init,
+    .main = (int (*)(void *, int, char **))replay_main,
+    .fini = (void (*)(void *))replay_fini,
+};
@@ -0,0 +1,5 @@
+#pragma once
+#include <driver.private.h>
+
+extern const struct euicc_driver driver_apdu_record;
+extern const struct euicc_driver driver_apdu_replay;
@@ -4,10 +4,27 @@
 #include <stdio.h>
 #include <string.h>
 
+#ifdef LPAC_DYNAMIC_DRIVERS
+#include <stdlib.h>
+#ifdef _WIN32
+#include <dlfcn-win32/dlfcn.h>
+#else
+#include <dlfcn.h>
+#endif
+#else
 #ifdef LPAC_WITH_APDU_GBINDER
+#include "driver/apdu/gbinder_aidl.h"
 #include "driver/apdu/gbinder_hidl.h"
 #endif
 
+#ifdef LPAC_WITH_APDU_MBIM
+#include "driver/apdu/mbim.h"
+#endif
+
+#ifdef LPAC_WITH_APDU_QMI
+#include "driver/apdu/qmi.h"
+#endif
+
 #ifdef LPAC_WITH_APDU_QMI_QRTR
 #include "driver/apdu/qmi_qrtr.h"
 #endif
@@ -15,18 +32,79 @@
 #ifdef LPAC_WITH_APDU_PCSC
 #include "driver/apdu/pcsc.h"
 #endif
+#ifdef LPAC_WITH_HTTP_CURL
+#include "driver/http/curl.h"
+#endif
+#endif
 #ifdef LPAC_WITH_APDU_AT
 #include "driver/apdu/at.h"
 #endif
-#ifdef LPAC_WITH_HTTP_CURL
-#include "driver/http/curl.h"
+#ifdef LPAC_WITH_APDU_REMOTE
+#include "driver/apdu/remote.h"
+#endif
+#ifdef LPAC_WITH_APDU_SIM
+#include "driver/apdu/sim.h"
+#endif
+#ifdef LPAC_WITH_HTTP_FAKE_SMDP
+#include "driver/http/fake_smdp.h"
 #endif
 #include "driver/apdu/stdio.h"
+#include "driver/apdu/trace.h"
 #include "driver/http/stdio.h"
+#include "driver/http/trace.h"
+
+#ifdef LPAC_DYNAMIC_DRIVERS
+#ifdef _WIN32
+#define DRIVER_MODULE_SUFFIX ".dll"
+#else
+#define DRIVER_MODULE_SUFFIX ".so"
+#endif
+
+struct euicc_driver_module
+{
+    enum euicc_driver_type type;
+    const char *name;
+    const struct euicc_driver *driver;
+    int failed;
+};
 
+// Backends built as driver_<type>_<name> modules, in the same priority order as the static build
+static struct euicc_driver_module modules[] = {
+#ifdef LPAC_WITH_APDU_GBINDER
+    {DRIVER_APDU, "gbinder_hidl"},
+    {DRIVER_APDU, "gbinder_aidl"},
+#endif
+#ifdef LPAC_WITH_APDU_MBIM
+    {DRIVER_APDU, "mbim"},
+#endif
+#ifdef LPAC_WITH_APDU_QMI
+    {DRIVER_APDU, "qmi"},
+#endif
+#ifdef LPAC_WITH_APDU_QMI_QRTR
+    {DRIVER_APDU, "qmi_qrtr"},
+#endif
+#ifdef LPAC_WITH_APDU_PCSC
+    {DRIVER_APDU, "pcsc"},
+#endif
+#ifdef LPAC_WITH_HTTP_CURL
+    {DRIVER_HTTP, "curl"},
+#endif
+    {DRIVER_APDU, NULL},
+};
+#endif
+
+#ifndef LPAC_BIND_APDU
 static const struct euicc_driver *drivers[] = {
+#ifndef LPAC_DYNAMIC_DRIVERS
 #ifdef LPAC_WITH_APDU_GBINDER
     &driver_apdu_gbinder_hidl,
+    &driver_apdu_gbinder_aidl,
+#endif
+#ifdef LPAC_WITH_APDU_MBIM
+    &driver_apdu_mbim,
+#endif
+#ifdef LPAC_WITH_APDU_QMI
+    &driver_apdu_qmi,
 #endif
 #ifdef LPAC_WITH_APDU_QMI_QRTR
     &driver_apdu_qmi_qrtr,
@@ -34,16 +112,32 @@ static const struct euicc_driver *drivers[] = {
 #ifdef LPAC_WITH_APDU_PCSC
     &driver_apdu_pcsc,
 #endif
+#endif
 #ifdef LPAC_WITH_APDU_AT
     &driver_apdu_at,
 #endif
-#ifdef LPAC_WITH_HTTP_CURL
+#if defined(LPAC_WITH_HTTP_CURL) && !defined(LPAC_DYNAMIC_DRIVERS)
     &driver_http_curl,
 #endif
     &driver_apdu_stdio,
     &driver_http_stdio,
+    // Never picked by default, only when named
+#ifdef LPAC_WITH_APDU_REMOTE
+    &driver_apdu_remote,
+#endif
+#ifdef LPAC_WITH_APDU_SIM
+    &driver_apdu_sim,
+#endif
+#ifdef LPAC_WITH_HTTP_FAKE_SMDP
+    &driver_http_fake_smdp,
+#endif
+    &driver_apdu_record,
+    &driver_apdu_replay,
+    &driver_http_record,
+    &driver_http_replay,
     NULL,
 };
+#endif
 
 static const struct euicc_driver *_driver_apdu = NULL;
 static const struct euicc_driver *_driver_http = NULL;
@@ -53,8 +147,118 @@ struct euicc_http_interface euicc_driver_interface_http;
 int (*euicc_driver_main_apdu)(int argc, char **argv) = NULL;
 int (*euicc_driver_main_http)(int argc, char **argv) = NULL;
 
+#ifdef LPAC_DYNAMIC_DRIVERS
+// Modules stay loaded until exit, their backends may have registered atexit() handlers
+static const struct euicc_driver *_load_module(struct euicc_driver_module *m)
+{
+    const char *type = m->type == DRIVER_APDU ? "apdu" : "http";
+    const char *dir = getenv("LPAC_DRIVER_DIR");
+    char symbol[64];
+    char *path = NULL;
+    size_t path_len;
+    void *handle;
+
+    if (m->driver != NULL || m->failed)
+    {
+        return m->driver;
+    }
+    m->failed = 1;
+
+#ifdef LPAC_DRIVER_DIR
+    if (dir == NULL)
+    {
+        dir = LPAC_DRIVER_DIR;
+    }
+#endif
+
+    snprintf(symbol, sizeof(symbol), "driver_%s_%s", type, m->name);
+
+    path_len = (dir ? strlen(dir) + 1 : 0) + strlen(symbol) + sizeof(DRIVER_MODULE_SUFFIX);
+    path = malloc(path_len);
+    if (path == NULL)
+    {
+        return NULL;
+    }
+    if (dir)
+    {
+        snprintf(path, path_len, "%s/%s" DRIVER_MODULE_SUFFIX, dir, symbol);
+    }
+    else
+    {
+        snprintf(path, path_len, "%s" DRIVER_MODULE_SUFFIX, symbol);
+    }
+
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL)
+    {
+        if (getenv("LPAC_DRIVER_DEBUG"))
+        {
+            fprintf(stderr, "[DEBUG] [driver] %s\n", dlerror());
+        }
+        free(path);
+        return NULL;
+    }
+    free(path);
+
+    m->driver = dlsym(handle, symbol);
+    if (m->driver == NULL)
+    {
+        dlclose(handle);
+        return NULL;
+    }
+    m->failed = 0;
+
+    return m->driver;
+}
+#endif
+
+#ifdef LPAC_BIND_APDU
+// Bound at build time by LPAC_BIND_APDU_DRIVER and LPAC_BIND_HTTP_DRIVER, the backends nothing names are left out of the link
+static const struct euicc_driver *_find_driver(enum euicc_driver_type type, const char *name)
+{
+    const struct euicc_driver *d = type == DRIVER_APDU ? &LPAC_BIND_APDU : &LPAC_BIND_HTTP;
+
+    if (name != NULL && strcmp(d->name, name) != 0)
+    {
+        return NULL;
+    }
+    return d;
+}
+#else
 static const struct euicc_driver *_find_driver(enum euicc_driver_type type, const char *name)
 {
+#ifdef LPAC_DYNAMIC_DRIVERS
+    // Built-in drivers are checked first so that naming one never touches the modules
+    if (name != NULL)
+    {
+        for (int i = 0; drivers[i] != NULL; i++)
+        {
+            if (drivers[i]->type == type && strcmp(drivers[i]->name, name) == 0)
+            {
+                return drivers[i];
+            }
+        }
+    }
+
+    for (int i = 0; modules[i].name != NULL; i++)
+    {
+        const struct euicc_driver *d;
+
+        if (modules[i].type != type)
+        {
+            continue;
+        }
+        if (name != NULL && strcmp(modules[i].name, name) != 0)
+        {
+            continue;
+        }
+        d = _load_module(&modules[i]);
+        if (d != NULL || name != NULL)
+        {
+            return d;
+        }
+    }
+#endif
     for (int i = 0; drivers[i] != NULL; i++)
     {
         const struct euicc_driver *d = drivers[i];
@@ -73,6 +277,84 @@ static const struct euicc_driver *_find_driver(enum euicc_driver_type type, cons
     }
     return NULL;
 }
+#endif
+
+const struct euicc_driver *euicc_driver_find(enum euicc_driver_type type, const char *name)
+{
+    return _find_driver(type, name);
+}
+
+static int _driver_main_apdu(int argc, char **argv)
+{
+    return _driver_apdu->main(&euicc_driver_interface_apdu, argc, argv);
+}
+
+static int _driver_main_http(int argc, char **argv)
+{
+    return _driver_http->main(&euicc_driver_interface_http, argc, argv);
+}
+
+int euicc_driver_apdu_open(struct euicc_apdu_interface *ifstruct, const char *driver_name, const char *device)
+{
+    const struct euicc_driver *d;
+
+    d = _find_driver(DRIVER_APDU, driver_name);
+    if (d == NULL)
+    {
+        fprintf(stderr, "No APDU driver found\n");
+        return -1;
+    }
+
+    if (d->init(ifstruct, device))
+    {
+        fprintf(stderr, "APDU driver init failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void euicc_driver_apdu_close(struct euicc_apdu_interface *ifstruct, const char *driver_name)
+{
+    const struct euicc_driver *d;
+
+    d = _find_driver(DRIVER_APDU, driver_name);
+    if (d != NULL)
+    {
+        d->fini(ifstruct);
+    }
+}
+
+int euicc_driver_http_open(struct euicc_http_interface *ifstruct, const char *driver_name)
+{
+    const struct euicc_driver *d;
+
+    d = _find_driver(DRIVER_HTTP, driver_name);
+    if (d == NULL)
+    {
+        fprintf(stderr, "No HTTP driver found\n");
+        return -1;
+    }
+
+    if (d->init(ifstruct, NULL))
+    {
+        fprintf(stderr, "HTTP driver init failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void euicc_driver_http_close(struct euicc_http_interface *ifstruct, const char *driver_name)
+{
+    const struct euicc_driver *d;
+
+    d = _find_driver(DRIVER_HTTP, driver_name);
+    if (d != NULL)
+    {
+        d->fini(ifstruct);
+    }
+}
 
 int euicc_driver_init(const char *apdu_driver_name, const char *http_driver_name)
 {
@@ -90,20 +372,20 @@ int euicc_driver_init(const char *apdu_driver_name, const char *http_driver_name
         return -1;
     }
 
-    if (_driver_apdu->init(&euicc_driver_interface_apdu))
+    if (_driver_apdu->init(&euicc_driver_interface_apdu, NULL))
     {
         fprintf(stderr, "APDU driver init failed\n");
         return -1;
     }
 
-    if (_driver_http->init(&euicc_driver_interface_http))
+    if (_driver_http->init(&euicc_driver_interface_http, NULL))
     {
         fprintf(stderr, "HTTP driver init failed\n");
         return -1;
     }
 
-    euicc_driver_main_apdu = _driver_apdu->main;
-    euicc_driver_main_http = _driver_http->main;
+    euicc_driver_main_apdu = _driver_main_apdu;
+    euicc_driver_main_http = _driver_main_http;
 
     return 0;
 }
@@ -112,10 +394,39 @@ void euicc_driver_fini()
 {
     if (_driver_apdu != NULL)
     {
-        _driver_apdu->fini();
+        _driver_apdu->fini(&euicc_driver_interface_apdu);
     }
     if (_driver_http != NULL)
     {
-        _driver_http->fini();
+        _driver_http->fini(&euicc_driver_interface_http);
     }
 }
+
+#if !defined(LPAC_WITH_APDU_AT) || defined(LPAC_BIND_APDU) || defined(_WIN32)
+struct euicc_driver_at_engine *euicc_driver_at_engine_new(const char *const *devices, int count)
+{
+    return NULL;
+}
+
+void euicc_driver_at_engine_free(struct euicc_driver_at_engine *engine)
+{
+}
+
+int euicc_driver_at_engine_submit(struct euicc_driver_at_engine *engine, int index, const uint8_t *body, uint32_t body_len, void (*done)(void *userdata, int ecode, const uint8_t *data, uint32_t data_len), void *userdata)
+{
+    return -1;
+}
+
+void euicc_driver_at_engine_reset(struct euicc_driver_at_engine *engine, int index)
+{
+}
+
+int euicc_driver_at_engine_poll(struct euicc_driver_at_engine *engine, struct pollfd *pfds, int pfds_max, int *timeout_ms)
+{
+    return 0;
+}
+
+void euicc_driver_at_engine_dispatch(struct euicc_driver_at_engine *engine, const struct pollfd *pfds, int pfds_count)
+{
+}
+#endif
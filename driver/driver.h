@@ -10,3 +10,23 @@ extern int (*euicc_driver_main_http)(int argc, char **argv);
 
 int euicc_driver_init(const char *apdu_driver_name, const char *http_driver_name);
 void euicc_driver_fini(void);
+
+// Additional driver instances, each with its own state, e.g. one per reader
+int euicc_driver_apdu_open(struct euicc_apdu_interface *ifstruct, const char *driver_name, const char *device);
+void euicc_driver_apdu_close(struct euicc_apdu_interface *ifstruct, const char *driver_name);
+int euicc_driver_http_open(struct euicc_http_interface *ifstruct, const char *driver_name);
+void euicc_driver_http_close(struct euicc_http_interface *ifstruct, const char *driver_name);
+
+// Runs the AT backend's requests for several modems from the caller's poll loop, see at.c. NULL when lpac is built
+// without the AT backend, with LPAC_BIND_APDU_DRIVER, and on Windows.
+struct pollfd;
+struct euicc_driver_at_engine;
+struct euicc_driver_at_engine *euicc_driver_at_engine_new(const char *const *devices, int count);
+void euicc_driver_at_engine_free(struct euicc_driver_at_engine *engine);
+// body is a STDIO_APDU_FRAMED request body, done gets its response. -1 while the modem still has a request.
+int euicc_driver_at_engine_submit(struct euicc_driver_at_engine *engine, int index, const uint8_t *body, uint32_t body_len, void (*done)(void *userdata, int ecode, const uint8_t *data, uint32_t data_len), void *userdata);
+// Drops the modem's request without calling done, and closes and unlocks the modem
+void euicc_driver_at_engine_reset(struct euicc_driver_at_engine *engine, int index);
+// Fills pfds with what the engine waits on and lowers *timeout_ms (-1 for none) to its next deadline
+int euicc_driver_at_engine_poll(struct euicc_driver_at_engine *engine, struct pollfd *pfds, int pfds_max, int *timeout_ms);
+void euicc_driver_at_engine_dispatch(struct euicc_driver_at_engine *engine, const struct pollfd *pfds, int pfds_count);
@@ -10,7 +10,11 @@ struct euicc_driver
 {
     enum euicc_driver_type type;
     const char *name;
-    int (*init)(void *interface);
-    int (*main)(int argc, char **argv);
-    void (*fini)(void);
+    // device selects the reader, port or slot; NULL falls back to the driver's environment variable
+    int (*init)(void *interface, const char *device);
+    int (*main)(void *interface, int argc, char **argv);
+    void (*fini)(void *interface);
 };
+
+// Looks a driver up by name, NULL picks the default one; lets wrapper drivers reach the backend they wrap
+const struct euicc_driver *euicc_driver_find(enum euicc_driver_type type, const char *name);
@@ -3,7 +3,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 
+#include <euicc/euicc.h>
 #include <euicc/interface.h>
 
 #ifndef _WIN32
@@ -12,6 +15,7 @@
 #include <dlfcn-win32/dlfcn.h>
 #define CURL_GLOBAL_DEFAULT ((1 << 0) | (1 << 1))
 #define CURLE_OK 0
+#define CURLE_COULDNT_CONNECT 7
 #define CURLOPT_URL 10002
 #define CURLOPT_WRITEFUNCTION 20011
 #define CURLOPT_WRITEDATA 10001
@@ -20,20 +24,125 @@
 #define CURLOPT_HTTPHEADER 10023
 #define CURLOPT_POSTFIELDS 10015
 #define CURLOPT_POSTFIELDSIZE 60
+#define CURLOPT_COPYPOSTFIELDS 10165
+#define CURLOPT_TCP_KEEPALIVE 213
+#define CURLOPT_NOBODY 44
+#define CURLOPT_TIMEOUT_MS 155
+#define CURLOPT_ACCEPT_ENCODING 10102
 #define CURLINFO_RESPONSE_CODE 2097154
+#define CURLINFO_CONTENT_LENGTH_DOWNLOAD_T 6291471
+#define CURLINFO_SIZE_UPLOAD_T 6291463
+#define CURLINFO_SIZE_DOWNLOAD_T 6291464
+#define CURLINFO_TOTAL_TIME_T 6291506
+#define CURLINFO_NAMELOOKUP_TIME_T 6291507
+#define CURLINFO_CONNECT_TIME_T 6291508
+#define CURLINFO_STARTTRANSFER_TIME_T 6291510
+#define CURLINFO_APPCONNECT_TIME_T 6291512
+#define CURLINFO_RETRY_AFTER 6291513
+#define CURLOPT_PRIVATE 10103
+#define CURLOPT_PIPEWAIT 237
+#define CURLINFO_PRIVATE 1048597
+#define CURLMOPT_PIPELINING 3
+#define CURLMOPT_MAX_HOST_CONNECTIONS 7
+#define CURLPIPE_MULTIPLEX 2L
+#define CURLMSG_DONE 1
+#define CURLOPT_SHARE 10100
+#define CURLOPT_HTTP_VERSION 84
+#define CURL_HTTP_VERSION_2TLS 4L
+#define CURLSHOPT_SHARE 1
+#define CURLSHOPT_LOCKFUNC 3
+#define CURLSHOPT_UNLOCKFUNC 4
+#define CURL_LOCK_DATA_DNS 3
+#define CURL_LOCK_DATA_SSL_SESSION 4
+#define CURL_LOCK_DATA_CONNECT 5
+#define CURL_LOCK_DATA_LAST 8
+#define CURLOPT_RESOLVE 10203
+#define CURLINFO_EFFECTIVE_URL 1048577
+#define CURLINFO_PRIMARY_IP 1048608
+#define CURLINFO_PRIMARY_PORT 2097192
 
 typedef void CURL;
 typedef int CURLcode;
 typedef int CURLoption;
 typedef int CURLINFO;
+typedef long long curl_off_t;
+typedef void CURLM;
+struct curl_waitfd;
+typedef int CURLMcode;
+typedef int CURLMoption;
+typedef void CURLSH;
+typedef int CURLSHcode;
+typedef int CURLSHoption;
+typedef int curl_lock_data;
+typedef int curl_lock_access;
+typedef struct
+{
+    int msg;
+    CURL *easy_handle;
+    union
+    {
+        void *whatever;
+        CURLcode result;
+    } data;
+} CURLMsg;
 
 static void *libcurl_interface_dlhandle = NULL;
 #endif
 
+// One easy handle per interface, reset between requests so its connection, DNS and TLS session caches survive
+struct http_curl_userdata
+{
+    CURL *curl;
+    // A HEAD request from prepare runs on curl until the next request joins it
+    pthread_t prepare_thread;
+    uint8_t preparing;
+    // Requests from submit, sharing connections (or one HTTP/2 connection) through the multi handle's pool
+    CURLM *multi;
+    struct http_async_transfer *transfers;
+};
+
+#define HTTP_RESPONSE_PREALLOC_MAX (16 * 1024 * 1024)
+#define HTTP_RESPONSE_GROWTH_MIN 4096
+#define HTTP_MULTI_HOST_CONNECTIONS 4
+
+// Connections, DNS answers and TLS sessions of every handle in the process, so blocking requests, submitted ones
+// and the HEAD from prepare all reuse the same (HTTP/2) connection to a host. Kept from the first interface init to
+// the last fini.
+static CURLSH *http_share = NULL;
+static uint32_t http_share_users = 0;
+static pthread_mutex_t http_share_locks[CURL_LOCK_DATA_LAST];
+
+// Addresses from CURL_DNS_CACHE_FILE, one "host port address expires" line each. The ones read at init go to every
+// handle through CURLOPT_RESOLVE, the ones learned meanwhile only to the file at the last fini. libcurl does not
+// report the DNS TTL, so an address is kept for CURL_DNS_CACHE_TTL seconds from the lookup that found it.
+#define HTTP_DNS_CACHE_TTL_DEFAULT 300
+#define HTTP_DNS_HOST_SIZE 256
+#define HTTP_DNS_ADDRESS_SIZE 48
+
+struct http_dns_entry
+{
+    char host[HTTP_DNS_HOST_SIZE];
+    long port;
+    char address[HTTP_DNS_ADDRESS_SIZE];
+    long long expires;
+};
+
+static struct http_dns_entry *http_dns_entries = NULL;
+static uint32_t http_dns_count = 0;
+static uint8_t http_dns_dirty = 0;
+// Once a connection failed, the addresses read at init are removed again and libcurl resolves every host itself
+static struct curl_slist *http_dns_resolve = NULL;
+static struct curl_slist *http_dns_unresolve = NULL;
+static uint8_t http_dns_forgotten = 0;
+
 struct http_trans_response_data
 {
+    struct http_curl_userdata *userdata;
+    // Set for a request from submit, which runs on its own handle
+    CURL *curl;
     uint8_t *data;
     size_t size;
+    size_t capacity;
 };
 
 static struct libcurl_interface
@@ -42,21 +151,71 @@ static struct libcurl_interface
     CURL *(*_curl_easy_init)(void);
     CURLcode (*_curl_easy_setopt)(CURL *curl, CURLoption option, ...);
     CURLcode (*_curl_easy_perform)(CURL *curl);
+    void (*_curl_easy_reset)(CURL *curl);
     CURLcode (*_curl_easy_getinfo)(CURL *curl, CURLINFO info, ...);
     const char *(*_curl_easy_strerror)(CURLcode);
     void (*_curl_easy_cleanup)(CURL *curl);
 
     struct curl_slist *(*_curl_slist_append)(struct curl_slist *list, const char *data);
     void (*_curl_slist_free_all)(struct curl_slist *list);
+
+    CURLM *(*_curl_multi_init)(void);
+    CURLMcode (*_curl_multi_setopt)(CURLM *multi, CURLMoption option, ...);
+    CURLMcode (*_curl_multi_add_handle)(CURLM *multi, CURL *curl);
+    CURLMcode (*_curl_multi_remove_handle)(CURLM *multi, CURL *curl);
+    CURLMcode (*_curl_multi_perform)(CURLM *multi, int *running_handles);
+    CURLMcode (*_curl_multi_wait)(CURLM *multi, struct curl_waitfd *extra_fds, unsigned int extra_nfds, int timeout_ms, int *numfds);
+    CURLMsg *(*_curl_multi_info_read)(CURLM *multi, int *msgs_in_queue);
+    CURLMcode (*_curl_multi_cleanup)(CURLM *multi);
+
+    CURLSH *(*_curl_share_init)(void);
+    CURLSHcode (*_curl_share_setopt)(CURLSH *share, CURLSHoption option, ...);
+    CURLSHcode (*_curl_share_cleanup)(CURLSH *share);
 } libcurl;
 
+// Sizes the buffer from Content-Length on the first chunk, then grows it geometrically
+static int http_trans_response_reserve(struct http_trans_response_data *mem, size_t needed)
+{
+    size_t capacity;
+    uint8_t *data_new;
+    curl_off_t content_length = -1;
+
+    if (needed <= mem->capacity)
+    {
+        return 0;
+    }
+
+    capacity = mem->capacity * 2;
+    if (mem->data == NULL && libcurl._curl_easy_getinfo(mem->curl ? mem->curl : mem->userdata->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length) == CURLE_OK && content_length > 0 && content_length < HTTP_RESPONSE_PREALLOC_MAX)
+    {
+        capacity = content_length + 1;
+    }
+    if (capacity < HTTP_RESPONSE_GROWTH_MIN)
+    {
+        capacity = HTTP_RESPONSE_GROWTH_MIN;
+    }
+    if (capacity < needed)
+    {
+        capacity = needed;
+    }
+
+    data_new = realloc(mem->data, capacity);
+    if (data_new == NULL)
+    {
+        return -1;
+    }
+    mem->data = data_new;
+    mem->capacity = capacity;
+
+    return 0;
+}
+
 static size_t http_trans_write_callback(void *contents, size_t size, size_t nmemb, void *userp)
 {
     size_t realsize = size * nmemb;
     struct http_trans_response_data *mem = (struct http_trans_response_data *)userp;
 
-    mem->data = realloc(mem->data, mem->size + realsize + 1);
-    if (mem->data == NULL)
+    if (http_trans_response_reserve(mem, mem->size + realsize + 1) < 0)
     {
         /* out of memory! */
         printf("not enough memory (realloc returned NULL)\n");
@@ -70,68 +229,603 @@ static size_t http_trans_write_callback(void *contents, size_t size, size_t nmem
     return realsize;
 }
 
-static int http_interface_transmit(struct euicc_ctx *ctx, const char *url, uint32_t *rcode, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len, const char **h)
+struct http_trans_stream_data
 {
-    int fret = 0;
-    CURL *curl;
-    CURLcode res;
-    struct http_trans_response_data responseData = {0};
-    struct curl_slist *headers = NULL, *nheaders = NULL;
-    long response_code;
+    int (*callback)(const uint8_t *data, uint32_t data_len, void *userdata);
+    void *userdata;
+    size_t size;
+};
 
-    (*rx) = NULL;
-    (*rcode) = 0;
+static size_t http_trans_stream_callback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    size_t realsize = size * nmemb;
+    struct http_trans_stream_data *stream = (struct http_trans_stream_data *)userp;
 
-    curl = libcurl._curl_easy_init();
-    if (!curl)
+    // Anything short of realsize makes curl abort the transfer
+    if (stream->callback(contents, realsize, stream->userdata) < 0)
     {
-        goto err;
+        return 0;
     }
+    stream->size += realsize;
+
+    return realsize;
+}
+
+static int http_interface_headers(struct curl_slist **headers, const char **h)
+{
+    struct curl_slist *nheaders;
 
-    libcurl._curl_easy_setopt(curl, CURLOPT_URL, url);
-    libcurl._curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, http_trans_write_callback);
-    libcurl._curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&responseData);
-    libcurl._curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-    libcurl._curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
     for (int i = 0; h[i] != NULL; i++)
     {
-        nheaders = libcurl._curl_slist_append(headers, h[i]);
+        nheaders = libcurl._curl_slist_append(*headers, h[i]);
         if (nheaders == NULL)
         {
-            goto err;
+            return -1;
         }
-        headers = nheaders;
+        *headers = nheaders;
     }
+
+    return 0;
+}
+
+static void http_interface_setup(struct euicc_ctx *ctx, CURL *curl, const char *url, const uint8_t *tx, uint32_t tx_len, struct curl_slist *headers, size_t (*write_function)(void *contents, size_t size, size_t nmemb, void *userp), void *write_data)
+{
+    libcurl._curl_easy_setopt(curl, CURLOPT_URL, url);
+    libcurl._curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)euicc_timeout_ms(ctx, ctx->http.timeout_ms));
+    libcurl._curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    libcurl._curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_function);
+    libcurl._curl_easy_setopt(curl, CURLOPT_WRITEDATA, write_data);
+    libcurl._curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    libcurl._curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
     libcurl._curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    // HTTP/2 where TLS negotiates it, and wait for a connection being set up to the same host rather than open another
+    libcurl._curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    libcurl._curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    if (http_share)
+    {
+        libcurl._curl_easy_setopt(curl, CURLOPT_SHARE, http_share);
+    }
+    if (http_dns_resolve)
+    {
+        libcurl._curl_easy_setopt(curl, CURLOPT_RESOLVE, http_dns_forgotten ? http_dns_unresolve : http_dns_resolve);
+    }
+    // "" offers every encoding this libcurl can undo, the write functions only ever see the decoded body
+    if (!ctx->http.no_compression)
+    {
+        libcurl._curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    }
 
     if (tx != NULL)
     {
         libcurl._curl_easy_setopt(curl, CURLOPT_POSTFIELDS, tx);
         libcurl._curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, tx_len);
     }
+}
+
+static uint64_t http_interface_getinfo_off_t(CURL *curl, CURLINFO info)
+{
+    curl_off_t value = 0;
+
+    if (libcurl._curl_easy_getinfo(curl, info, &value) != CURLE_OK || value < 0)
+    {
+        return 0;
+    }
+    return value;
+}
+
+// Host of the URL, or -1 for one given as an address
+static int http_dns_url_host(const char *url, char *host)
+{
+    const char *start, *end;
+
+    start = strstr(url, "://");
+    if (start == NULL)
+    {
+        return -1;
+    }
+    start += 3;
+    if (*start == '[')
+    {
+        return -1;
+    }
+    end = start + strcspn(start, ":/?#");
+    if (end == start || end - start >= HTTP_DNS_HOST_SIZE)
+    {
+        return -1;
+    }
+    memcpy(host, start, end - start);
+    host[end - start] = '\0';
+    return 0;
+}
+
+// Records the address a finished request connected to, an address still cached keeps its expiry
+static void http_dns_learn(CURL *curl)
+{
+    char *url = NULL, *address = NULL;
+    long port = 0;
+    char host[HTTP_DNS_HOST_SIZE];
+    struct http_dns_entry *entry = NULL, *entries_new;
+
+    if (getenv("CURL_DNS_CACHE_FILE") == NULL)
+    {
+        return;
+    }
+    if (libcurl._curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url) != CURLE_OK || url == NULL || http_dns_url_host(url, host) < 0)
+    {
+        return;
+    }
+    if (libcurl._curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &address) != CURLE_OK || address == NULL || address[0] == '\0' || strlen(address) >= HTTP_DNS_ADDRESS_SIZE || strcmp(address, host) == 0)
+    {
+        return;
+    }
+    if (libcurl._curl_easy_getinfo(curl, CURLINFO_PRIMARY_PORT, &port) != CURLE_OK || port <= 0)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < http_dns_count; i++)
+    {
+        if (http_dns_entries[i].port == port && strcmp(http_dns_entries[i].host, host) == 0)
+        {
+            entry = &http_dns_entries[i];
+            break;
+        }
+    }
+    if (entry && strcmp(entry->address, address) == 0 && entry->expires > time(NULL))
+    {
+        return;
+    }
+    if (entry == NULL)
+    {
+        entries_new = realloc(http_dns_entries, (http_dns_count + 1) * sizeof(struct http_dns_entry));
+        if (entries_new == NULL)
+        {
+            return;
+        }
+        http_dns_entries = entries_new;
+        entry = &http_dns_entries[http_dns_count++];
+        strcpy(entry->host, host);
+        entry->port = port;
+    }
+    strcpy(entry->address, address);
+    entry->expires = (long long)time(NULL) + (getenv("CURL_DNS_CACHE_TTL") ? atol(getenv("CURL_DNS_CACHE_TTL")) : HTTP_DNS_CACHE_TTL_DEFAULT);
+    http_dns_dirty = 1;
+}
+
+// A cached address that stopped answering must not be tried again, in this process or the next
+static void http_dns_forget(void)
+{
+    if (http_dns_resolve == NULL || http_dns_forgotten)
+    {
+        return;
+    }
+    http_dns_forgotten = 1;
+    for (uint32_t i = 0; i < http_dns_count; i++)
+    {
+        http_dns_entries[i].expires = 0;
+    }
+    http_dns_dirty = 1;
+}
+
+// decoded is the body as the write function got it, CURLINFO_SIZE_DOWNLOAD_T counts it as it came over the wire
+static void http_interface_timing(struct euicc_ctx *ctx, CURL *curl, uint64_t decoded)
+{
+    struct euicc_http_timing *timing = &ctx->http.timing;
+
+    timing->requests++;
+    timing->namelookup_us += http_interface_getinfo_off_t(curl, CURLINFO_NAMELOOKUP_TIME_T);
+    timing->connect_us += http_interface_getinfo_off_t(curl, CURLINFO_CONNECT_TIME_T);
+    timing->appconnect_us += http_interface_getinfo_off_t(curl, CURLINFO_APPCONNECT_TIME_T);
+    timing->starttransfer_us += http_interface_getinfo_off_t(curl, CURLINFO_STARTTRANSFER_TIME_T);
+    timing->total_us += http_interface_getinfo_off_t(curl, CURLINFO_TOTAL_TIME_T);
+    timing->bytes_sent += http_interface_getinfo_off_t(curl, CURLINFO_SIZE_UPLOAD_T);
+    timing->bytes_received += http_interface_getinfo_off_t(curl, CURLINFO_SIZE_DOWNLOAD_T);
+    timing->bytes_decoded += decoded;
+}
+
+static void http_interface_prepare_join(struct http_curl_userdata *userdata)
+{
+    if (userdata->preparing)
+    {
+        pthread_join(userdata->prepare_thread, NULL);
+        userdata->preparing = 0;
+    }
+}
+
+static void *http_interface_prepare_thread(void *arg)
+{
+    libcurl._curl_easy_perform(arg);
+    return NULL;
+}
+
+static size_t http_trans_discard_callback(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    return size * nmemb;
+}
+
+// The response does not matter, the request only leaves a connection with DNS and TLS done in the handle's cache
+static void http_interface_prepare(struct euicc_ctx *ctx, const char *url)
+{
+    struct http_curl_userdata *userdata = ctx->http.interface->userdata;
+
+    http_interface_prepare_join(userdata);
+
+    if (userdata->curl == NULL)
+    {
+        userdata->curl = libcurl._curl_easy_init();
+        if (userdata->curl == NULL)
+        {
+            return;
+        }
+    }
+    else
+    {
+        libcurl._curl_easy_reset(userdata->curl);
+    }
+
+    http_interface_setup(ctx, userdata->curl, url, NULL, 0, NULL, http_trans_discard_callback, NULL);
+    libcurl._curl_easy_setopt(userdata->curl, CURLOPT_NOBODY, 1L);
+
+    if (pthread_create(&userdata->prepare_thread, NULL, http_interface_prepare_thread, userdata->curl) == 0)
+    {
+        userdata->preparing = 1;
+    }
+}
+
+static int http_interface_perform(struct euicc_ctx *ctx, const char *url, uint32_t *rcode, const uint8_t *tx, uint32_t tx_len, const char **h, size_t (*write_function)(void *contents, size_t size, size_t nmemb, void *userp), void *write_data, const size_t *decoded)
+{
+    int fret = 0;
+    struct http_curl_userdata *userdata = ctx->http.interface->userdata;
+    CURL *curl;
+    CURLcode res;
+    struct curl_slist *headers = NULL;
+    long response_code;
+    uint64_t retry_after;
+
+    (*rcode) = 0;
+
+    http_interface_prepare_join(userdata);
+
+    if (userdata->curl == NULL)
+    {
+        userdata->curl = libcurl._curl_easy_init();
+        if (userdata->curl == NULL)
+        {
+            goto err;
+        }
+    }
+    else
+    {
+        libcurl._curl_easy_reset(userdata->curl);
+    }
+    curl = userdata->curl;
+
+    if (http_interface_headers(&headers, h) < 0)
+    {
+        goto err;
+    }
+    http_interface_setup(ctx, curl, url, tx, tx_len, headers, write_function, write_data);
 
     res = libcurl._curl_easy_perform(curl);
 
     if (res != CURLE_OK)
     {
         fprintf(stderr, "curl_easy_perform() failed: %s\n", libcurl._curl_easy_strerror(res));
+        if (res == CURLE_COULDNT_CONNECT)
+        {
+            http_dns_forget();
+        }
         goto err;
     }
 
     libcurl._curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
     *rcode = response_code;
+    http_interface_timing(ctx, curl, *decoded);
+    http_dns_learn(curl);
+    // Seconds, or an HTTP date already turned into seconds from now. Before curl 7.66.0 always 0.
+    retry_after = http_interface_getinfo_off_t(curl, CURLINFO_RETRY_AFTER);
+    ctx->http.retry_after_ms = retry_after < UINT32_MAX / 1000 ? retry_after * 1000 : UINT32_MAX;
+
+    fret = 0;
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    libcurl._curl_slist_free_all(headers);
+    return fret;
+}
+
+// Connections in the share handle stay pooled for the next session to the same host
+static void http_interface_session_close(struct euicc_ctx *ctx)
+{
+    struct http_curl_userdata *userdata = ctx->http.interface->userdata;
+
+    http_interface_prepare_join(userdata);
+
+    if (userdata->curl)
+    {
+        libcurl._curl_easy_cleanup(userdata->curl);
+        userdata->curl = NULL;
+    }
+}
+
+static int http_interface_transmit(struct euicc_ctx *ctx, const char *url, uint32_t *rcode, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len, const char **h)
+{
+    struct http_trans_response_data responseData = {0};
+
+    (*rx) = NULL;
+    responseData.userdata = ctx->http.interface->userdata;
+
+    if (http_interface_perform(ctx, url, rcode, tx, tx_len, h, http_trans_write_callback, &responseData, &responseData.size) < 0)
+    {
+        free(responseData.data);
+        return -1;
+    }
+
     *rx = responseData.data;
     *rx_len = responseData.size;
 
+    return 0;
+}
+
+static int http_interface_transmit_stream(struct euicc_ctx *ctx, const char *url, uint32_t *rcode, const uint8_t *tx, uint32_t tx_len, const char **h, int (*callback)(const uint8_t *data, uint32_t data_len, void *userdata), void *userdata)
+{
+    struct http_trans_stream_data streamData = {
+        .callback = callback,
+        .userdata = userdata,
+    };
+
+    return http_interface_perform(ctx, url, rcode, tx, tx_len, h, http_trans_stream_callback, &streamData, &streamData.size);
+}
+
+struct http_async_transfer
+{
+    struct euicc_ctx *ctx;
+    CURL *curl;
+    struct curl_slist *headers;
+    struct http_trans_response_data response;
+    struct http_trans_stream_data stream;
+    void (*complete)(int ret, uint32_t rcode, uint8_t *rx, uint32_t rx_len, void *userdata);
+    void *userdata;
+    struct http_async_transfer *next;
+};
+
+static int http_interface_submit(struct euicc_ctx *ctx, const char *url, const uint8_t *tx, uint32_t tx_len, const char **h, int (*chunk)(const uint8_t *data, uint32_t data_len, void *userdata), void (*complete)(int ret, uint32_t rcode, uint8_t *rx, uint32_t rx_len, void *userdata), void *userdata)
+{
+    struct http_curl_userdata *curl_userdata = ctx->http.interface->userdata;
+    struct http_async_transfer *transfer;
+
+    if (curl_userdata->multi == NULL)
+    {
+        curl_userdata->multi = libcurl._curl_multi_init();
+        if (curl_userdata->multi == NULL)
+        {
+            return -1;
+        }
+        libcurl._curl_multi_setopt(curl_userdata->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        libcurl._curl_multi_setopt(curl_userdata->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)HTTP_MULTI_HOST_CONNECTIONS);
+    }
+
+    transfer = calloc(1, sizeof(struct http_async_transfer));
+    if (transfer == NULL)
+    {
+        return -1;
+    }
+    transfer->ctx = ctx;
+    transfer->complete = complete;
+    transfer->userdata = userdata;
+    transfer->stream.callback = chunk;
+    transfer->stream.userdata = userdata;
+
+    transfer->curl = libcurl._curl_easy_init();
+    if (transfer->curl == NULL || http_interface_headers(&transfer->headers, h) < 0)
+    {
+        goto err;
+    }
+    transfer->response.curl = transfer->curl;
+
+    if (chunk)
+    {
+        http_interface_setup(ctx, transfer->curl, url, NULL, 0, transfer->headers, http_trans_stream_callback, &transfer->stream);
+    }
+    else
+    {
+        http_interface_setup(ctx, transfer->curl, url, NULL, 0, transfer->headers, http_trans_write_callback, &transfer->response);
+    }
+    // The caller's buffer may be gone before the request is sent
+    if (tx != NULL)
+    {
+        libcurl._curl_easy_setopt(transfer->curl, CURLOPT_POSTFIELDSIZE, (long)tx_len);
+        libcurl._curl_easy_setopt(transfer->curl, CURLOPT_COPYPOSTFIELDS, tx);
+    }
+    libcurl._curl_easy_setopt(transfer->curl, CURLOPT_PRIVATE, transfer);
+
+    if (libcurl._curl_multi_add_handle(curl_userdata->multi, transfer->curl) != 0)
+    {
+        goto err;
+    }
+
+    transfer->next = curl_userdata->transfers;
+    curl_userdata->transfers = transfer;
+
+    return 0;
+
+err:
+    if (transfer->curl)
+    {
+        libcurl._curl_easy_cleanup(transfer->curl);
+    }
+    libcurl._curl_slist_free_all(transfer->headers);
+    free(transfer);
+    return -1;
+}
+
+// Takes transfer off the multi handle and hands its outcome to complete
+static void http_interface_finish(struct http_curl_userdata *curl_userdata, struct http_async_transfer *transfer, int ret)
+{
+    struct http_async_transfer **link;
+    long response_code = 0;
+
+    for (link = &curl_userdata->transfers; *link; link = &(*link)->next)
+    {
+        if (*link == transfer)
+        {
+            *link = transfer->next;
+            break;
+        }
+    }
+
+    if (ret == 0)
+    {
+        libcurl._curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &response_code);
+        http_interface_timing(transfer->ctx, transfer->curl, transfer->response.size + transfer->stream.size);
+        http_dns_learn(transfer->curl);
+    }
+    else
+    {
+        free(transfer->response.data);
+        transfer->response.data = NULL;
+        transfer->response.size = 0;
+    }
+
+    libcurl._curl_multi_remove_handle(curl_userdata->multi, transfer->curl);
+    libcurl._curl_easy_cleanup(transfer->curl);
+    libcurl._curl_slist_free_all(transfer->headers);
+
+    transfer->complete(ret, response_code, transfer->response.data, transfer->response.size, transfer->userdata);
+    free(transfer);
+}
+
+static int http_interface_poll(struct euicc_ctx *ctx, int timeout_ms)
+{
+    struct http_curl_userdata *curl_userdata = ctx->http.interface->userdata;
+    CURLMsg *msg;
+    int running = 0;
+    int msgs;
+
+    if (curl_userdata->multi == NULL)
+    {
+        return 0;
+    }
+
+    if (libcurl._curl_multi_perform(curl_userdata->multi, &running) != 0)
+    {
+        goto err;
+    }
+    if (running && timeout_ms > 0)
+    {
+        if (libcurl._curl_multi_wait(curl_userdata->multi, NULL, 0, timeout_ms, NULL) != 0 || libcurl._curl_multi_perform(curl_userdata->multi, &running) != 0)
+        {
+            goto err;
+        }
+    }
+
+    while ((msg = libcurl._curl_multi_info_read(curl_userdata->multi, &msgs)) != NULL)
+    {
+        struct http_async_transfer *transfer;
+
+        if (msg->msg != CURLMSG_DONE)
+        {
+            continue;
+        }
+        if (msg->data.result != CURLE_OK)
+        {
+            fprintf(stderr, "curl_multi_perform() failed: %s\n", libcurl._curl_easy_strerror(msg->data.result));
+            if (msg->data.result == CURLE_COULDNT_CONNECT)
+            {
+                http_dns_forget();
+            }
+        }
+        libcurl._curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&transfer);
+        http_interface_finish(curl_userdata, transfer, msg->data.result == CURLE_OK ? 0 : -1);
+    }
+
+    return running;
+
+err:
+    // Nothing moves any more, so every request fails now rather than never
+    while (curl_userdata->transfers)
+    {
+        http_interface_finish(curl_userdata, curl_userdata->transfers, -1);
+    }
+    return -1;
+}
+
+static int http_trans_discard_chunk(const uint8_t *data, uint32_t data_len, void *userdata)
+{
+    return 0;
+}
+
+struct http_multi_request
+{
+    uint32_t *rcode;
+    uint32_t *remaining;
+};
+
+static void http_multi_complete(int ret, uint32_t rcode, uint8_t *rx, uint32_t rx_len, void *userdata)
+{
+    struct http_multi_request *request = userdata;
+
+    *request->rcode = ret < 0 ? 0 : rcode;
+    (*request->remaining)--;
+    free(rx);
+}
+
+static int http_interface_transmit_multi(struct euicc_ctx *ctx, uint32_t *rcode, const char *const *url, const uint8_t *const *tx, const uint32_t *tx_len, uint32_t count, const char **h)
+{
+    struct http_curl_userdata *curl_userdata = ctx->http.interface->userdata;
+    struct http_multi_request *requests = NULL;
+    struct http_async_transfer *transfer, *next;
+    uint32_t remaining = 0;
+    int fret = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        rcode[i] = 0;
+    }
+
+    requests = calloc(count, sizeof(struct http_multi_request));
+    if (requests == NULL)
+    {
+        goto err;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        requests[i].rcode = &rcode[i];
+        requests[i].remaining = &remaining;
+        if (http_interface_submit(ctx, url[i], tx[i], tx_len[i], h, http_trans_discard_chunk, http_multi_complete, &requests[i]) < 0)
+        {
+            goto err;
+        }
+        remaining++;
+    }
+
+    while (remaining > 0)
+    {
+        if (http_interface_poll(ctx, 1000) < 0)
+        {
+            goto err;
+        }
+    }
+
     fret = 0;
     goto exit;
 
 err:
     fret = -1;
-    free(responseData.data);
 exit:
-    libcurl._curl_easy_cleanup(curl);
-    libcurl._curl_slist_free_all(headers);
+    // requests has to outlive every transfer that points at it
+    for (transfer = curl_userdata->transfers; transfer; transfer = next)
+    {
+        next = transfer->next;
+        if (transfer->complete == http_multi_complete)
+        {
+            http_interface_finish(curl_userdata, transfer, -1);
+        }
+    }
+    free(requests);
     return fret;
 }
 
@@ -148,28 +842,211 @@ static int _init_libcurl(void)
     libcurl._curl_easy_init = dlsym(libcurl_interface_dlhandle, "curl_easy_init");
     libcurl._curl_easy_setopt = dlsym(libcurl_interface_dlhandle, "curl_easy_setopt");
     libcurl._curl_easy_perform = dlsym(libcurl_interface_dlhandle, "curl_easy_perform");
+    libcurl._curl_easy_reset = dlsym(libcurl_interface_dlhandle, "curl_easy_reset");
     libcurl._curl_easy_getinfo = dlsym(libcurl_interface_dlhandle, "curl_easy_getinfo");
     libcurl._curl_easy_strerror = dlsym(libcurl_interface_dlhandle, "curl_easy_strerror");
     libcurl._curl_easy_cleanup = dlsym(libcurl_interface_dlhandle, "curl_easy_cleanup");
     libcurl._curl_slist_append = dlsym(libcurl_interface_dlhandle, "curl_slist_append");
     libcurl._curl_slist_free_all = dlsym(libcurl_interface_dlhandle, "curl_slist_free_all");
+    libcurl._curl_multi_init = dlsym(libcurl_interface_dlhandle, "curl_multi_init");
+    libcurl._curl_multi_setopt = dlsym(libcurl_interface_dlhandle, "curl_multi_setopt");
+    libcurl._curl_multi_add_handle = dlsym(libcurl_interface_dlhandle, "curl_multi_add_handle");
+    libcurl._curl_multi_remove_handle = dlsym(libcurl_interface_dlhandle, "curl_multi_remove_handle");
+    libcurl._curl_multi_perform = dlsym(libcurl_interface_dlhandle, "curl_multi_perform");
+    libcurl._curl_multi_wait = dlsym(libcurl_interface_dlhandle, "curl_multi_wait");
+    libcurl._curl_multi_info_read = dlsym(libcurl_interface_dlhandle, "curl_multi_info_read");
+    libcurl._curl_multi_cleanup = dlsym(libcurl_interface_dlhandle, "curl_multi_cleanup");
+    libcurl._curl_share_init = dlsym(libcurl_interface_dlhandle, "curl_share_init");
+    libcurl._curl_share_setopt = dlsym(libcurl_interface_dlhandle, "curl_share_setopt");
+    libcurl._curl_share_cleanup = dlsym(libcurl_interface_dlhandle, "curl_share_cleanup");
 #else
     libcurl._curl_global_init = curl_global_init;
     libcurl._curl_easy_init = curl_easy_init;
     libcurl._curl_easy_setopt = curl_easy_setopt;
     libcurl._curl_easy_perform = curl_easy_perform;
+    libcurl._curl_easy_reset = curl_easy_reset;
     libcurl._curl_easy_getinfo = curl_easy_getinfo;
     libcurl._curl_easy_strerror = curl_easy_strerror;
     libcurl._curl_easy_cleanup = curl_easy_cleanup;
     libcurl._curl_slist_append = curl_slist_append;
     libcurl._curl_slist_free_all = curl_slist_free_all;
+    libcurl._curl_multi_init = curl_multi_init;
+    libcurl._curl_multi_setopt = curl_multi_setopt;
+    libcurl._curl_multi_add_handle = curl_multi_add_handle;
+    libcurl._curl_multi_remove_handle = curl_multi_remove_handle;
+    libcurl._curl_multi_perform = curl_multi_perform;
+    libcurl._curl_multi_wait = curl_multi_wait;
+    libcurl._curl_multi_info_read = curl_multi_info_read;
+    libcurl._curl_multi_cleanup = curl_multi_cleanup;
+    libcurl._curl_share_init = curl_share_init;
+    libcurl._curl_share_setopt = curl_share_setopt;
+    libcurl._curl_share_cleanup = curl_share_cleanup;
 #endif
 
     return 0;
 }
 
-static int libhttpinterface_init(struct euicc_http_interface *ifstruct)
+static void http_share_lock(CURL *curl, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+    pthread_mutex_lock(&http_share_locks[data]);
+}
+
+static void http_share_unlock(CURL *curl, curl_lock_data data, void *userptr)
+{
+    pthread_mutex_unlock(&http_share_locks[data]);
+}
+
+static void http_dns_cache_load(void)
+{
+    const char *path = getenv("CURL_DNS_CACHE_FILE");
+    FILE *fp;
+    struct http_dns_entry entry;
+    char line[HTTP_DNS_HOST_SIZE + HTTP_DNS_ADDRESS_SIZE + 64];
+    char resolve[sizeof(line)];
+    struct http_dns_entry *entries_new;
+    struct curl_slist *list;
+
+    if (path == NULL)
+    {
+        return;
+    }
+    fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "%255s %ld %47s %lld", entry.host, &entry.port, entry.address, &entry.expires) != 4 || entry.expires <= time(NULL))
+        {
+            continue;
+        }
+        entries_new = realloc(http_dns_entries, (http_dns_count + 1) * sizeof(struct http_dns_entry));
+        if (entries_new == NULL)
+        {
+            break;
+        }
+        http_dns_entries = entries_new;
+        http_dns_entries[http_dns_count++] = entry;
+
+        // IPv6 addresses go in brackets
+        snprintf(resolve, sizeof(resolve), strchr(entry.address, ':') ? "%s:%ld:[%s]" : "%s:%ld:%s", entry.host, entry.port, entry.address);
+        if ((list = libcurl._curl_slist_append(http_dns_resolve, resolve)) != NULL)
+        {
+            http_dns_resolve = list;
+        }
+        snprintf(resolve, sizeof(resolve), "-%s:%ld", entry.host, entry.port);
+        if ((list = libcurl._curl_slist_append(http_dns_unresolve, resolve)) != NULL)
+        {
+            http_dns_unresolve = list;
+        }
+    }
+    fclose(fp);
+}
+
+// Written next to the file and renamed over it, concurrent runs each leave a whole file
+static void http_dns_cache_save(void)
+{
+    const char *path = getenv("CURL_DNS_CACHE_FILE");
+    char *tmp;
+    FILE *fp;
+
+    if (path == NULL || !http_dns_dirty)
+    {
+        return;
+    }
+    tmp = malloc(strlen(path) + sizeof(".tmp"));
+    if (tmp == NULL)
+    {
+        return;
+    }
+    sprintf(tmp, "%s.tmp", path);
+
+    fp = fopen(tmp, "w");
+    if (fp != NULL)
+    {
+        for (uint32_t i = 0; i < http_dns_count; i++)
+        {
+            if (http_dns_entries[i].expires > time(NULL))
+            {
+                fprintf(fp, "%s %ld %s %lld\n", http_dns_entries[i].host, http_dns_entries[i].port, http_dns_entries[i].address, http_dns_entries[i].expires);
+            }
+        }
+        if (fclose(fp) != 0 || rename(tmp, path) != 0)
+        {
+            remove(tmp);
+        }
+    }
+    free(tmp);
+}
+
+static void http_dns_cache_free(void)
+{
+    libcurl._curl_slist_free_all(http_dns_resolve);
+    libcurl._curl_slist_free_all(http_dns_unresolve);
+    http_dns_resolve = NULL;
+    http_dns_unresolve = NULL;
+    free(http_dns_entries);
+    http_dns_entries = NULL;
+    http_dns_count = 0;
+    http_dns_dirty = 0;
+    http_dns_forgotten = 0;
+}
+
+// Without a share handle every handle keeps its own caches, as before
+static void http_share_get(void)
+{
+    if (http_share_users++ > 0)
+    {
+        return;
+    }
+
+    http_dns_cache_load();
+
+    http_share = libcurl._curl_share_init();
+    if (http_share == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+    {
+        pthread_mutex_init(&http_share_locks[i], NULL);
+    }
+    libcurl._curl_share_setopt(http_share, CURLSHOPT_LOCKFUNC, http_share_lock);
+    libcurl._curl_share_setopt(http_share, CURLSHOPT_UNLOCKFUNC, http_share_unlock);
+    libcurl._curl_share_setopt(http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    libcurl._curl_share_setopt(http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    // Before curl 7.57.0 connections stay with their handle
+    libcurl._curl_share_setopt(http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+}
+
+static void http_share_put(void)
+{
+    if (http_share_users == 0 || --http_share_users > 0)
+    {
+        return;
+    }
+
+    http_dns_cache_save();
+    http_dns_cache_free();
+    if (http_share == NULL)
+    {
+        return;
+    }
+
+    libcurl._curl_share_cleanup(http_share);
+    http_share = NULL;
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+    {
+        pthread_mutex_destroy(&http_share_locks[i]);
+    }
+}
+
+static int libhttpinterface_init(struct euicc_http_interface *ifstruct, const char *device)
 {
+    struct http_curl_userdata *userdata;
+
     memset(ifstruct, 0, sizeof(struct euicc_http_interface));
 
     if (_init_libcurl() != 0)
@@ -182,24 +1059,64 @@ static int libhttpinterface_init(struct euicc_http_interface *ifstruct)
         return -1;
     }
 
+    userdata = calloc(1, sizeof(struct http_curl_userdata));
+    if (userdata == NULL)
+    {
+        return -1;
+    }
+
     ifstruct->transmit = http_interface_transmit;
+    ifstruct->transmit_stream = http_interface_transmit_stream;
+    ifstruct->transmit_multi = http_interface_transmit_multi;
+    ifstruct->session_close = http_interface_session_close;
+    ifstruct->prepare = http_interface_prepare;
+    ifstruct->submit = http_interface_submit;
+    ifstruct->poll = http_interface_poll;
+    ifstruct->userdata = userdata;
+
+    http_share_get();
 
     return 0;
 }
 
-static int libhttpinterface_main(int argc, char **argv)
+static int libhttpinterface_main(struct euicc_http_interface *ifstruct, int argc, char **argv)
 {
     return 0;
 }
 
-static void libhttpinterface_fini(void)
+static void libhttpinterface_fini(struct euicc_http_interface *ifstruct)
 {
+    struct http_curl_userdata *userdata = ifstruct->userdata;
+
+    if (userdata == NULL)
+    {
+        return;
+    }
+
+    http_interface_prepare_join(userdata);
+
+    while (userdata->transfers)
+    {
+        http_interface_finish(userdata, userdata->transfers, -1);
+    }
+    if (userdata->multi)
+    {
+        libcurl._curl_multi_cleanup(userdata->multi);
+    }
+    if (userdata->curl)
+    {
+        libcurl._curl_easy_cleanup(userdata->curl);
+    }
+    free(userdata);
+    ifstruct->userdata = NULL;
+
+    http_share_put();
 }
 
 const struct euicc_driver driver_http_curl = {
     .type = DRIVER_HTTP,
     .name = "curl",
-    .init = (int (*)(void *))libhttpinterface_init,
-    .main = libhttpinterface_main,
-    .fini = libhttpinterface_fini,
+    .init = (int (*)(void *, const char *))libhttpinterface_init,
+    .main = (int (*)(void *, int, char **))libhttpinterface_main,
+    .fini = (void (*)(void *))libhttpinterface_fini,
 };
@@ -0,0 +1,566 @@
+#include "fake_smdp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <cjson/cJSON_ex.h>
+#include <euicc/euicc.h>
+#include <euicc/interface.h>
+#include <euicc/base64.h>
+#include <euicc/derutil.h>
+
+#define FAKE_SMDP_ADDRESS "smdp.example.com"
+#define FAKE_SMDP_BPP_SIZE_DEFAULT 64
+#define FAKE_SMDP_CERT_SIZE_DEFAULT 512
+// Profile elements are encrypted in segments of up to 1 KiB, MAC included
+#define FAKE_SMDP_ELEMENT_SIZE 1020
+#define FAKE_SMDP_STREAM_CHUNK 16384
+
+// GSMA test CI public key identifier, the one the simulated eUICC trusts
+static const uint8_t fake_smdp_ci_pkid[] = {
+    0x81, 0x37, 0x0F, 0x51, 0x25, 0xD0, 0xB1, 0xD4, 0x08, 0xD4,
+    0xC3, 0xB2, 0x32, 0xE6, 0xD2, 0x5E, 0x79, 0x5B, 0xEB, 0xFB,
+};
+
+static const uint8_t fake_smdp_iccid[] = {0x98, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF0};
+
+struct fake_smdp_userdata
+{
+    long latency;
+    uint32_t bpp_size;
+    uint32_t cert_size;
+    uint32_t icon_size;
+    uint8_t transaction_id[16];
+    char transaction_id_hex[2 * 16 + 1];
+
+    // Everything but serverSigned1 is the same in every session, so it is encoded once
+    char *server_certificate;
+    char *signature;
+    char *ci_pkid;
+    char *profile_metadata;
+    char *smdp_signed2;
+    char *bpp;
+};
+
+struct fake_smdp_response
+{
+    char *data;
+    uint32_t length;
+    uint32_t capacity;
+};
+
+static void fake_smdp_delay(const struct fake_smdp_userdata *userdata)
+{
+    long us = userdata->latency;
+
+    if (us <= 0)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    Sleep(us / 1000);
+#else
+    struct timespec ts;
+
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) < 0)
+        ;
+#endif
+}
+
+static long fake_smdp_getenv_long(const char *name, long fallback)
+{
+    const char *value = getenv(name);
+
+    if (value == NULL || value[0] == '\0')
+    {
+        return fallback;
+    }
+    return strtol(value, NULL, 10);
+}
+
+static char *fake_smdp_base64(const uint8_t *data, uint32_t data_len)
+{
+    char *b64 = malloc(euicc_base64_encode_len(data_len));
+
+    if (b64 == NULL)
+    {
+        return NULL;
+    }
+    euicc_base64_encode(b64, data, data_len);
+    return b64;
+}
+
+static char *fake_smdp_writer_base64(struct euicc_derutil_writer *writer)
+{
+    const uint8_t *data;
+    uint32_t data_len;
+
+    if (euicc_derutil_writer_finish(writer, &data, &data_len) < 0)
+    {
+        return NULL;
+    }
+    return fake_smdp_base64(data, data_len);
+}
+
+static void fake_smdp_write_filler(struct euicc_derutil_writer *writer, uint16_t tag, uint32_t length, uint8_t seed)
+{
+    uint32_t mark = euicc_derutil_writer_mark(writer);
+    uint8_t chunk[256];
+
+    for (uint32_t i = 0; i < sizeof(chunk); i++)
+    {
+        chunk[i] = seed + i * 31;
+    }
+    for (uint32_t left = length; left;)
+    {
+        uint32_t n = left < sizeof(chunk) ? left : sizeof(chunk);
+
+        euicc_derutil_writer_bytes(writer, chunk, n);
+        left -= n;
+    }
+    euicc_derutil_writer_wrap(writer, tag, mark);
+}
+
+// StoreMetadataRequest as the SM-DP+ sends it in the clear, for the LPA to show before the download
+static void fake_smdp_write_metadata(struct fake_smdp_userdata *userdata, struct euicc_derutil_writer *writer)
+{
+    uint8_t profile_class = 2; // operational
+
+    euicc_derutil_writer_tlv(writer, 0x95, &profile_class, sizeof(profile_class));
+    if (userdata->icon_size)
+    {
+        uint8_t icon_type = 1; // png
+
+        fake_smdp_write_filler(writer, 0x94, userdata->icon_size, 0x89);
+        euicc_derutil_writer_tlv(writer, 0x93, &icon_type, sizeof(icon_type));
+    }
+    euicc_derutil_writer_tlv(writer, 0x92, "Benchmark", strlen("Benchmark"));
+    euicc_derutil_writer_tlv(writer, 0x91, "Fake SM-DP+", strlen("Fake SM-DP+"));
+    euicc_derutil_writer_tlv(writer, 0x5A, fake_smdp_iccid, sizeof(fake_smdp_iccid));
+    euicc_derutil_writer_wrap(writer, 0xBF25, 0);
+}
+
+// BoundProfilePackage of about bpp_size bytes: the secure channel setup, the encrypted ConfigureISDP, StoreMetadata
+// and ReplaceSessionKeys, then profile elements in 1 KiB segments
+static void fake_smdp_write_bpp(struct fake_smdp_userdata *userdata, struct euicc_derutil_writer *writer, uint32_t metadata_len)
+{
+    static const uint8_t otpk[65] = {0x04};
+    static const uint8_t signature[64];
+    static const uint8_t remote_op_id = 1; // installBoundProfilePackage
+    static const uint8_t key_type = 0x88, key_len = 16;
+    uint32_t head, elements, mark;
+
+    // What the rest takes, so the profile elements fill the requested size
+    head = 200 + 72 + (metadata_len + 24) + 88;
+    elements = userdata->bpp_size > head ? userdata->bpp_size - head : FAKE_SMDP_ELEMENT_SIZE;
+
+    mark = euicc_derutil_writer_mark(writer);
+    for (uint32_t i = 0; elements > 4; i++)
+    {
+        uint32_t n = elements - 4 < FAKE_SMDP_ELEMENT_SIZE ? elements - 4 : FAKE_SMDP_ELEMENT_SIZE;
+
+        fake_smdp_write_filler(writer, 0x86, n, i);
+        elements -= n + 4;
+    }
+    euicc_derutil_writer_wrap(writer, 0xA3, mark); // sequenceOf86
+
+    mark = euicc_derutil_writer_mark(writer);
+    fake_smdp_write_filler(writer, 0x87, 64, 0x30);
+    euicc_derutil_writer_wrap(writer, 0xA2, mark); // secondSequenceOf87
+
+    mark = euicc_derutil_writer_mark(writer);
+    fake_smdp_write_filler(writer, 0x88, metadata_len + 16, 0x20);
+    euicc_derutil_writer_wrap(writer, 0xA1, mark); // sequenceOf88
+
+    mark = euicc_derutil_writer_mark(writer);
+    fake_smdp_write_filler(writer, 0x87, 48, 0x10);
+    euicc_derutil_writer_wrap(writer, 0xA0, mark); // firstSequenceOf87
+
+    mark = euicc_derutil_writer_mark(writer);
+    euicc_derutil_writer_tlv(writer, 0x5F37, signature, sizeof(signature));
+    euicc_derutil_writer_tlv(writer, 0x5F49, otpk, sizeof(otpk));
+    {
+        uint32_t crt = euicc_derutil_writer_mark(writer);
+
+        euicc_derutil_writer_tlv(writer, 0x84, userdata->transaction_id, 8);
+        euicc_derutil_writer_tlv(writer, 0x81, &key_len, sizeof(key_len));
+        euicc_derutil_writer_tlv(writer, 0x80, &key_type, sizeof(key_type));
+        euicc_derutil_writer_wrap(writer, 0xA6, crt); // controlRefTemplate
+    }
+    euicc_derutil_writer_tlv(writer, 0x80, userdata->transaction_id, sizeof(userdata->transaction_id));
+    euicc_derutil_writer_tlv(writer, 0x82, &remote_op_id, sizeof(remote_op_id));
+    euicc_derutil_writer_wrap(writer, 0xBF23, mark); // InitialiseSecureChannelRequest
+
+    euicc_derutil_writer_wrap(writer, 0xBF36, 0);
+}
+
+static int fake_smdp_prepare(struct fake_smdp_userdata *userdata)
+{
+    static const uint8_t signature[64];
+    struct euicc_derutil_writer writer;
+    const uint8_t *metadata;
+    uint32_t metadata_len;
+    uint32_t cap;
+    uint8_t *buffer;
+    int fret = -1;
+
+    cap = userdata->bpp_size + userdata->cert_size + 2 * userdata->icon_size + 4096;
+    buffer = malloc(cap);
+    if (buffer == NULL)
+    {
+        return -1;
+    }
+
+    euicc_derutil_writer_init(&writer, buffer, cap);
+    fake_smdp_write_filler(&writer, 0x30, userdata->cert_size, 0x40);
+    if ((userdata->server_certificate = fake_smdp_writer_base64(&writer)) == NULL)
+    {
+        goto exit;
+    }
+
+    euicc_derutil_writer_init(&writer, buffer, cap);
+    euicc_derutil_writer_tlv(&writer, 0x5F37, signature, sizeof(signature));
+    if ((userdata->signature = fake_smdp_writer_base64(&writer)) == NULL)
+    {
+        goto exit;
+    }
+
+    euicc_derutil_writer_init(&writer, buffer, cap);
+    euicc_derutil_writer_tlv(&writer, 0x04, fake_smdp_ci_pkid, sizeof(fake_smdp_ci_pkid));
+    if ((userdata->ci_pkid = fake_smdp_writer_base64(&writer)) == NULL)
+    {
+        goto exit;
+    }
+
+    euicc_derutil_writer_init(&writer, buffer, cap);
+    fake_smdp_write_metadata(userdata, &writer);
+    if (euicc_derutil_writer_finish(&writer, &metadata, &metadata_len) < 0 || (userdata->profile_metadata = fake_smdp_base64(metadata, metadata_len)) == NULL)
+    {
+        goto exit;
+    }
+
+    euicc_derutil_writer_init(&writer, buffer, cap);
+    euicc_derutil_writer_tlv(&writer, 0x01, "\x00", 1); // ccRequiredFlag
+    euicc_derutil_writer_tlv(&writer, 0x80, userdata->transaction_id, sizeof(userdata->transaction_id));
+    euicc_derutil_writer_wrap(&writer, 0x30, 0);
+    if ((userdata->smdp_signed2 = fake_smdp_writer_base64(&writer)) == NULL)
+    {
+        goto exit;
+    }
+
+    euicc_derutil_writer_init(&writer, buffer, cap);
+    fake_smdp_write_bpp(userdata, &writer, metadata_len);
+    if ((userdata->bpp = fake_smdp_writer_base64(&writer)) == NULL)
+    {
+        goto exit;
+    }
+
+    fret = 0;
+
+exit:
+    free(buffer);
+    return fret;
+}
+
+static int fake_smdp_append(struct fake_smdp_response *response, const char *data, uint32_t data_len)
+{
+    if (response->length + data_len + 1 > response->capacity)
+    {
+        uint32_t capacity = response->capacity ? response->capacity : 1024;
+        char *data_new;
+
+        while (response->length + data_len + 1 > capacity)
+        {
+            capacity *= 2;
+        }
+        data_new = realloc(response->data, capacity);
+        if (data_new == NULL)
+        {
+            return -1;
+        }
+        response->data = data_new;
+        response->capacity = capacity;
+    }
+
+    memcpy(response->data + response->length, data, data_len);
+    response->length += data_len;
+    response->data[response->length] = '\0';
+    return 0;
+}
+
+// Base64 and hex need no escaping
+static int fake_smdp_member(struct fake_smdp_response *response, const char *name, const char *value)
+{
+    if (fake_smdp_append(response, ",\"", 2) < 0 || fake_smdp_append(response, name, strlen(name)) < 0 || fake_smdp_append(response, "\":\"", 3) < 0)
+    {
+        return -1;
+    }
+    if (fake_smdp_append(response, value, strlen(value)) < 0 || fake_smdp_append(response, "\"", 1) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static int fake_smdp_header(struct fake_smdp_response *response)
+{
+    static const char header[] = "{\"header\":{\"functionExecutionStatus\":{\"status\":\"Executed-Success\"}}";
+
+    return fake_smdp_append(response, header, strlen(header));
+}
+
+// serverSigned1 signs the challenge of the eUICC, and is the only artifact built per session
+static int fake_smdp_initiate_authentication(struct fake_smdp_userdata *userdata, struct fake_smdp_response *response, const uint8_t *tx, uint32_t tx_len)
+{
+    struct euicc_derutil_writer writer;
+    uint8_t buffer[256];
+    uint8_t euicc_challenge[16 + 3] = {0};
+    uint8_t server_challenge[16];
+    const char *server_address = FAKE_SMDP_ADDRESS;
+    cJSON *jrequest, *jitem;
+    char *server_signed1;
+    int fret;
+
+    jrequest = cJSON_ParseWithLength((const char *)tx, tx_len);
+    jitem = cJSON_GetObjectItem(jrequest, "euiccChallenge");
+    if (cJSON_IsString(jitem) && euicc_base64_decode_len(jitem->valuestring) <= (int)sizeof(euicc_challenge))
+    {
+        euicc_base64_decode(euicc_challenge, jitem->valuestring);
+    }
+    jitem = cJSON_GetObjectItem(jrequest, "smdpAddress");
+    if (cJSON_IsString(jitem))
+    {
+        server_address = jitem->valuestring;
+    }
+
+    for (uint32_t i = 0; i < sizeof(server_challenge); i++)
+    {
+        server_challenge[i] = rand() & 0xFF;
+    }
+
+    euicc_derutil_writer_init(&writer, buffer, sizeof(buffer));
+    euicc_derutil_writer_tlv(&writer, 0x84, server_challenge, sizeof(server_challenge));
+    euicc_derutil_writer_tlv(&writer, 0x83, server_address, strlen(server_address));
+    euicc_derutil_writer_tlv(&writer, 0x81, euicc_challenge, 16);
+    euicc_derutil_writer_tlv(&writer, 0x80, userdata->transaction_id, sizeof(userdata->transaction_id));
+    euicc_derutil_writer_wrap(&writer, 0x30, 0);
+    server_signed1 = fake_smdp_writer_base64(&writer);
+    cJSON_Delete(jrequest);
+    if (server_signed1 == NULL)
+    {
+        return -1;
+    }
+
+    fret = fake_smdp_member(response, "transactionId", userdata->transaction_id_hex);
+    if (fret == 0)
+    {
+        fret = fake_smdp_member(response, "serverSigned1", server_signed1);
+    }
+    free(server_signed1);
+    if (fret < 0 || fake_smdp_member(response, "serverSignature1", userdata->signature) < 0 || fake_smdp_member(response, "euiccCiPKIdToBeUsed", userdata->ci_pkid) < 0 || fake_smdp_member(response, "serverCertificate", userdata->server_certificate) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static int fake_smdp_endpoint(const char *url, const char *name)
+{
+    size_t url_len = strlen(url), name_len = strlen(name);
+
+    return url_len >= name_len && strcmp(url + url_len - name_len, name) == 0;
+}
+
+// Builds the answer to url into response, and returns the HTTP status
+static uint32_t fake_smdp_serve(struct fake_smdp_userdata *userdata, const char *url, const uint8_t *tx, uint32_t tx_len, struct fake_smdp_response *response)
+{
+    int ret;
+
+    fake_smdp_delay(userdata);
+
+    if (fake_smdp_endpoint(url, "/handleNotification"))
+    {
+        return 204;
+    }
+
+    if (fake_smdp_header(response) < 0)
+    {
+        return 500;
+    }
+
+    if (fake_smdp_endpoint(url, "/initiateAuthentication"))
+    {
+        ret = fake_smdp_initiate_authentication(userdata, response, tx, tx_len);
+    }
+    else if (fake_smdp_endpoint(url, "/authenticateClient"))
+    {
+        ret = fake_smdp_member(response, "transactionId", userdata->transaction_id_hex);
+        if (ret == 0 && (fake_smdp_member(response, "profileMetadata", userdata->profile_metadata) < 0 || fake_smdp_member(response, "smdpSigned2", userdata->smdp_signed2) < 0 || fake_smdp_member(response, "smdpSignature2", userdata->signature) < 0 || fake_smdp_member(response, "smdpCertificate", userdata->server_certificate) < 0))
+        {
+            ret = -1;
+        }
+    }
+    else if (fake_smdp_endpoint(url, "/getBoundProfilePackage"))
+    {
+        ret = fake_smdp_member(response, "transactionId", userdata->transaction_id_hex);
+        if (ret == 0)
+        {
+            ret = fake_smdp_member(response, "boundProfilePackage", userdata->bpp);
+        }
+    }
+    else if (fake_smdp_endpoint(url, "/cancelSession"))
+    {
+        ret = 0;
+    }
+    else
+    {
+        response->length = 0;
+        return 404;
+    }
+
+    if (ret < 0 || fake_smdp_append(response, "}", 1) < 0)
+    {
+        return 500;
+    }
+    return 200;
+}
+
+static int http_interface_transmit(struct euicc_ctx *ctx, const char *url, uint32_t *rcode, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len, const char **headers)
+{
+    struct fake_smdp_response response = {0};
+
+    *rcode = fake_smdp_serve(ctx->http.interface->userdata, url, tx, tx_len, &response);
+    if (*rcode == 500)
+    {
+        free(response.data);
+        *rx = NULL;
+        *rx_len = 0;
+        return -1;
+    }
+
+    // One spare byte, callers may NUL-terminate the body in place
+    if (response.data == NULL && (response.data = malloc(1)) == NULL)
+    {
+        return -1;
+    }
+    *rx = (uint8_t *)response.data;
+    *rx_len = response.length;
+    return 0;
+}
+
+// In pieces the size a socket read would bring, so the streaming BoundProfilePackage load is taken as well
+static int http_interface_transmit_stream(struct euicc_ctx *ctx, const char *url, uint32_t *rcode, const uint8_t *tx, uint32_t tx_len, const char **headers, int (*callback)(const uint8_t *data, uint32_t data_len, void *userdata), void *userdata)
+{
+    struct fake_smdp_response response = {0};
+    int fret = 0;
+
+    *rcode = fake_smdp_serve(ctx->http.interface->userdata, url, tx, tx_len, &response);
+    if (*rcode == 500)
+    {
+        fret = -1;
+    }
+
+    for (uint32_t offset = 0; fret == 0 && offset < response.length; offset += FAKE_SMDP_STREAM_CHUNK)
+    {
+        uint32_t n = response.length - offset < FAKE_SMDP_STREAM_CHUNK ? response.length - offset : FAKE_SMDP_STREAM_CHUNK;
+
+        if (callback((const uint8_t *)response.data + offset, n, userdata) < 0)
+        {
+            fret = -1;
+        }
+    }
+
+    free(response.data);
+    return fret;
+}
+
+static void fake_smdp_free(struct fake_smdp_userdata *userdata)
+{
+    free(userdata->server_certificate);
+    free(userdata->signature);
+    free(userdata->ci_pkid);
+    free(userdata->profile_metadata);
+    free(userdata->smdp_signed2);
+    free(userdata->bpp);
+    free(userdata);
+}
+
+static int libhttpinterface_init(struct euicc_http_interface *ifstruct, const char *device)
+{
+    struct fake_smdp_userdata *userdata;
+    long bpp_size, cert_size, icon_size;
+
+    memset(ifstruct, 0, sizeof(struct euicc_http_interface));
+
+    userdata = calloc(1, sizeof(struct fake_smdp_userdata));
+    if (userdata == NULL)
+    {
+        return -1;
+    }
+
+    userdata->latency = fake_smdp_getenv_long("FAKE_SMDP_LATENCY", 0);
+    bpp_size = fake_smdp_getenv_long("FAKE_SMDP_BPP_SIZE", FAKE_SMDP_BPP_SIZE_DEFAULT);
+    cert_size = fake_smdp_getenv_long("FAKE_SMDP_CERT_SIZE", FAKE_SMDP_CERT_SIZE_DEFAULT);
+    icon_size = fake_smdp_getenv_long("FAKE_SMDP_ICON_SIZE", 0);
+    if (bpp_size <= 0 || bpp_size > 16384 || cert_size < 0 || cert_size > 65535 || icon_size < 0 || icon_size > 65535)
+    {
+        fprintf(stderr, "FAKE_SMDP_BPP_SIZE, FAKE_SMDP_CERT_SIZE or FAKE_SMDP_ICON_SIZE out of range\n");
+        free(userdata);
+        return -1;
+    }
+    userdata->bpp_size = bpp_size * 1024;
+    userdata->cert_size = cert_size;
+    userdata->icon_size = icon_size;
+
+    srand(time(NULL));
+    for (uint32_t i = 0; i < sizeof(userdata->transaction_id); i++)
+    {
+        userdata->transaction_id[i] = rand() & 0xFF;
+        snprintf(userdata->transaction_id_hex + 2 * i, 3, "%02X", userdata->transaction_id[i]);
+    }
+
+    if (fake_smdp_prepare(userdata) < 0)
+    {
+        fake_smdp_free(userdata);
+        return -1;
+    }
+
+    ifstruct->transmit = http_interface_transmit;
+    ifstruct->transmit_stream = http_interface_transmit_stream;
+    ifstruct->userdata = userdata;
+
+    return 0;
+}
+
+static int libhttpinterface_main(struct euicc_http_interface *ifstruct, int argc, char **argv)
+{
+    return 0;
+}
+
+static void libhttpinterface_fini(struct euicc_http_interface *ifstruct)
+{
+    if (ifstruct->userdata == NULL)
+    {
+        return;
+    }
+
+    fake_smdp_free(ifstruct->userdata);
+    ifstruct->userdata = NULL;
+}
+
+const struct euicc_driver driver_http_fake_smdp = {
+    .type = DRIVER_HTTP,
+    .name = "fake_smdp",
+    .init = (int (*)(void *, const char *))libhttpinterface_init,
+    .main = (int (*)(void *, int, char **))libhttpinterface_main,
+    .fini = (void (*)(void *))libhttpinterface_fini,
+};
@@ -5,6 +5,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 #include <cjson/cJSON_ex.h>
 #include <euicc/interface.h>
@@ -14,34 +18,36 @@
 static int afgets(char **obuf, FILE *fp)
 {
     uint32_t len = 0;
-    char buffer[2];
+    uint32_t cap = 256;
     char *obuf_new = NULL;
+    int c;
 
-    *obuf = malloc(1);
+    *obuf = malloc(cap);
     if ((*obuf) == NULL)
     {
         goto err;
     }
-    (*obuf)[0] = '\0';
 
-    while (fgets(buffer, sizeof(buffer), fp) != NULL)
+    while ((c = getc(fp)) != EOF)
     {
-        uint32_t fgets_len = strlen(buffer);
-
-        len += fgets_len + 1;
-        obuf_new = realloc(*obuf, len);
-        if (obuf_new == NULL)
+        if (len + 1 >= cap)
         {
-            goto err;
+            cap *= 2;
+            obuf_new = realloc(*obuf, cap);
+            if (obuf_new == NULL)
+            {
+                goto err;
+            }
+            *obuf = obuf_new;
         }
-        *obuf = obuf_new;
-        strcat(*obuf, buffer);
+        (*obuf)[len++] = c;
 
-        if (buffer[fgets_len - 1] == '\n')
+        if (c == '\n')
         {
             break;
         }
     }
+    (*obuf)[len] = '\0';
 
     (*obuf)[strcspn(*obuf, "\r\n")] = 0;
 
@@ -53,6 +59,137 @@ err:
     return -1;
 }
 
+/*
+ * Framed mode (STDIO_HTTP_FRAMED): each message is 0x00, 'H', a 32-bit big-endian body length and the body.
+ * Request body: 32-bit URL length and URL, 32-bit header count and every header as 32-bit length + string, then the raw request body.
+ * Response body: 32-bit big-endian status code, then the raw response body.
+ */
+#define FRAME_MAGIC 0x00
+#define FRAME_TYPE 'H'
+
+static void frame_put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t frame_get_u32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int frame_write_string(const char *str)
+{
+    uint8_t prefix[4];
+    uint32_t len = strlen(str);
+
+    frame_put_u32(prefix, len);
+    if (fwrite(prefix, 1, sizeof(prefix), stdout) != sizeof(prefix))
+    {
+        return -1;
+    }
+    return fwrite(str, 1, len, stdout) == len ? 0 : -1;
+}
+
+static int frame_request(const char *url, const uint8_t *tx, uint32_t tx_len, const char **headers)
+{
+    uint8_t header[6];
+    uint8_t count[4];
+    uint32_t body_len;
+    uint32_t headers_count = 0;
+
+    body_len = 4 + strlen(url) + 4 + tx_len;
+    for (; headers[headers_count] != NULL; headers_count++)
+    {
+        body_len += 4 + strlen(headers[headers_count]);
+    }
+
+    header[0] = FRAME_MAGIC;
+    header[1] = FRAME_TYPE;
+    frame_put_u32(header + 2, body_len);
+    if (fwrite(header, 1, sizeof(header), stdout) != sizeof(header))
+    {
+        return -1;
+    }
+
+    if (frame_write_string(url) < 0)
+    {
+        return -1;
+    }
+
+    frame_put_u32(count, headers_count);
+    if (fwrite(count, 1, sizeof(count), stdout) != sizeof(count))
+    {
+        return -1;
+    }
+    for (uint32_t i = 0; i < headers_count; i++)
+    {
+        if (frame_write_string(headers[i]) < 0)
+        {
+            return -1;
+        }
+    }
+
+    if (tx_len && fwrite(tx, 1, tx_len, stdout) != tx_len)
+    {
+        return -1;
+    }
+
+    return fflush(stdout) == 0 ? 0 : -1;
+}
+
+static int http_interface_transmit_framed(struct euicc_ctx *ctx, const char *url, uint32_t *rcode, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len, const char **headers)
+{
+    uint8_t header[6 + 4];
+    uint32_t body_len;
+
+    *rx = NULL;
+    *rx_len = 0;
+
+    if (frame_request(url, tx, tx_len, headers) < 0)
+    {
+        goto err;
+    }
+
+    if (fread(header, 1, sizeof(header), stdin) != sizeof(header))
+    {
+        goto err;
+    }
+    if (header[0] != FRAME_MAGIC || header[1] != FRAME_TYPE)
+    {
+        goto err;
+    }
+    body_len = frame_get_u32(header + 2);
+    if (body_len < 4)
+    {
+        goto err;
+    }
+
+    // One spare byte, callers may NUL-terminate the body in place
+    *rx_len = body_len - 4;
+    *rx = malloc(*rx_len + 1);
+    if (*rx == NULL)
+    {
+        goto err;
+    }
+    if (fread(*rx, 1, *rx_len, stdin) != *rx_len)
+    {
+        goto err;
+    }
+    *rcode = frame_get_u32(header + 6);
+
+    return 0;
+
+err:
+    free(*rx);
+    *rx = NULL;
+    *rx_len = 0;
+    *rcode = 500;
+    return -1;
+}
+
 static int json_print(cJSON *jpayload)
 {
     cJSON *jroot = NULL;
@@ -233,7 +370,7 @@ static int http_interface_transmit(struct euicc_ctx *ctx, const char *url, uint3
         goto err;
     }
     *rx_len = strlen(jtmp->valuestring) / 2;
-    *rx = malloc(*rx_len);
+    *rx = malloc(*rx_len + 1);
     if (!*rx)
     {
         goto err;
@@ -258,28 +395,37 @@ exit:
     return fret;
 }
 
-static int libhttpinterface_init(struct euicc_http_interface *ifstruct)
+static int libhttpinterface_init(struct euicc_http_interface *ifstruct, const char *device)
 {
     memset(ifstruct, 0, sizeof(struct euicc_http_interface));
 
     ifstruct->transmit = http_interface_transmit;
+    if (getenv("STDIO_HTTP_FRAMED"))
+    {
+#ifdef _WIN32
+        // Frames carry raw bytes, which text mode would mangle
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        ifstruct->transmit = http_interface_transmit_framed;
+    }
 
     return 0;
 }
 
-static int libhttpinterface_main(int argc, char **argv)
+static int libhttpinterface_main(struct euicc_http_interface *ifstruct, int argc, char **argv)
 {
     return 0;
 }
 
-static void libhttpinterface_fini(void)
+static void libhttpinterface_fini(struct euicc_http_interface *ifstruct)
 {
 }
 
 const struct euicc_driver driver_http_stdio = {
     .type = DRIVER_HTTP,
     .name = "stdio",
-    .init = (int (*)(void *))libhttpinterface_init,
-    .main = libhttpinterface_main,
-    .fini = libhttpinterface_fini,
+    .init = (int (*)(void *, const char *))libhttpinterface_init,
+    .main = (int (*)(void *, int, char **))libhttpinterface_main,
+    .fini = (void (*)(void *))libhttpinterface_fini,
 };
@@ -0,0 +1,292 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <euicc/euicc.h>
+#include <euicc/interface.h>
+#include <trace.private.h>
+
+#define TRACE_TRANSMIT 't'
+
+struct record_userdata
+{
+    const struct euicc_driver *driver;
+    struct euicc_http_interface inner;
+    struct driver_trace trace;
+    struct driver_trace_buffer buffer;
+};
+
+struct replay_userdata
+{
+    struct driver_trace trace;
+};
+
+// Requests go through transmit only, so streamed responses are recorded whole
+static int record_transmit(struct euicc_ctx *ctx, const char *url, uint32_t *rcode, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len, const char **headers)
+{
+    const struct euicc_http_interface *outer = ctx->http.interface;
+    struct record_userdata *userdata = outer->userdata;
+    uint64_t start = driver_trace_now();
+    uint32_t headers_count = 0;
+    int ret;
+
+    *rx = NULL;
+    *rx_len = 0;
+    *rcode = 0;
+
+    // The wrapped driver finds its own userdata through ctx
+    ctx->http.interface = &userdata->inner;
+    ret = userdata->inner.transmit(ctx, url, rcode, rx, rx_len, tx, tx_len, headers);
+    ctx->http.interface = outer;
+
+    driver_trace_put_bytes(&userdata->buffer, url, strlen(url));
+    while (headers && headers[headers_count])
+    {
+        headers_count++;
+    }
+    driver_trace_put_uint(&userdata->buffer, headers_count);
+    for (uint32_t i = 0; i < headers_count; i++)
+    {
+        driver_trace_put_bytes(&userdata->buffer, headers[i], strlen(headers[i]));
+    }
+    driver_trace_put_bytes(&userdata->buffer, tx, tx_len);
+    driver_trace_put_int(&userdata->buffer, ret);
+    driver_trace_put_uint(&userdata->buffer, *rcode);
+    driver_trace_put_bytes(&userdata->buffer, *rx, ret < 0 ? 0 : *rx_len);
+
+    if (driver_trace_write(&userdata->trace, TRACE_TRANSMIT, start, &userdata->buffer) < 0)
+    {
+        fprintf(stderr, "error: write HTTP trace failed\n");
+    }
+
+    return ret;
+}
+
+static void record_session_close(struct euicc_ctx *ctx)
+{
+    const struct euicc_http_interface *outer = ctx->http.interface;
+    struct record_userdata *userdata = outer->userdata;
+
+    ctx->http.interface = &userdata->inner;
+    userdata->inner.session_close(ctx);
+    ctx->http.interface = outer;
+}
+
+static void record_prepare(struct euicc_ctx *ctx, const char *url)
+{
+    const struct euicc_http_interface *outer = ctx->http.interface;
+    struct record_userdata *userdata = outer->userdata;
+
+    ctx->http.interface = &userdata->inner;
+    userdata->inner.prepare(ctx, url);
+    ctx->http.interface = outer;
+}
+
+static int record_init(struct euicc_http_interface *ifstruct, const char *device)
+{
+    struct record_userdata *userdata;
+    const char *path = getenv("RECORD_HTTP_FILE");
+    const char *name = getenv("RECORD_HTTP_DRIVER");
+
+    memset(ifstruct, 0, sizeof(struct euicc_http_interface));
+
+    if (path == NULL)
+    {
+        fprintf(stderr, "error: RECORD_HTTP_FILE is not set\n");
+        return -1;
+    }
+
+    userdata = calloc(1, sizeof(struct record_userdata));
+    if (userdata == NULL)
+    {
+        return -1;
+    }
+
+    userdata->driver = euicc_driver_find(DRIVER_HTTP, name);
+    if (userdata->driver == NULL || userdata->driver == &driver_http_record || userdata->driver == &driver_http_replay)
+    {
+        fprintf(stderr, "error: RECORD_HTTP_DRIVER does not name an HTTP backend\n");
+        goto err;
+    }
+
+    if (driver_trace_create(&userdata->trace, path, DRIVER_TRACE_HTTP) < 0)
+    {
+        fprintf(stderr, "error: create HTTP trace %s failed\n", path);
+        goto err;
+    }
+
+    if (userdata->driver->init(&userdata->inner, device))
+    {
+        driver_trace_close(&userdata->trace);
+        goto err;
+    }
+
+    ifstruct->transmit = record_transmit;
+    if (userdata->inner.session_close)
+    {
+        ifstruct->session_close = record_session_close;
+    }
+    if (userdata->inner.prepare)
+    {
+        ifstruct->prepare = record_prepare;
+    }
+    ifstruct->userdata = userdata;
+
+    return 0;
+
+err:
+    free(userdata);
+    return -1;
+}
+
+static int record_main(struct euicc_http_interface *ifstruct, int argc, char **argv)
+{
+    struct record_userdata *userdata = ifstruct->userdata;
+
+    return userdata->driver->main(&userdata->inner, argc, argv);
+}
+
+static void record_fini(struct euicc_http_interface *ifstruct)
+{
+    struct record_userdata *userdata = ifstruct->userdata;
+
+    if (userdata == NULL)
+    {
+        return;
+    }
+
+    userdata->driver->fini(&userdata->inner);
+    driver_trace_close(&userdata->trace);
+    driver_trace_buffer_free(&userdata->buffer);
+    free(userdata);
+    ifstruct->userdata = NULL;
+}
+
+// Requests are matched by URL only, their bodies may carry fresh signatures
+static int replay_transmit(struct euicc_ctx *ctx, const char *url, uint32_t *rcode, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len, const char **headers)
+{
+    struct replay_userdata *userdata = ctx->http.interface->userdata;
+    struct driver_trace_cursor cursor;
+    const uint8_t *recorded_url, *recorded_rx;
+    uint32_t recorded_url_len, len;
+    uint64_t headers_count;
+    uint8_t kind;
+    int ret;
+
+    *rx = NULL;
+    *rx_len = 0;
+    *rcode = 0;
+
+    if (driver_trace_next(&userdata->trace, &kind, &cursor) < 0 || kind != TRACE_TRANSMIT)
+    {
+        fprintf(stderr, "error: HTTP trace ended\n");
+        return -1;
+    }
+
+    recorded_url = driver_trace_get_bytes(&cursor, &recorded_url_len);
+    headers_count = driver_trace_get_uint(&cursor);
+    for (uint64_t i = 0; i < headers_count && !cursor.failed; i++)
+    {
+        driver_trace_get_bytes(&cursor, &len);
+    }
+    driver_trace_get_bytes(&cursor, &len); // tx
+    ret = driver_trace_get_int(&cursor);
+    *rcode = driver_trace_get_uint(&cursor);
+    recorded_rx = driver_trace_get_bytes(&cursor, &len);
+    if (cursor.failed)
+    {
+        fprintf(stderr, "error: HTTP trace is corrupted\n");
+        return -1;
+    }
+
+    if (recorded_url_len != strlen(url) || memcmp(recorded_url, url, recorded_url_len) != 0)
+    {
+        fprintf(stderr, "error: HTTP request to %s does not match the trace\n", url);
+        return -1;
+    }
+
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    *rx = malloc(len ? len : 1);
+    if (*rx == NULL)
+    {
+        return -1;
+    }
+    memcpy(*rx, recorded_rx, len);
+    *rx_len = len;
+
+    return ret;
+}
+
+static int replay_init(struct euicc_http_interface *ifstruct, const char *device)
+{
+    struct replay_userdata *userdata;
+    const char *path = getenv("REPLAY_HTTP_FILE");
+
+    memset(ifstruct, 0, sizeof(struct euicc_http_interface));
+
+    if (path == NULL)
+    {
+        fprintf(stderr, "error: REPLAY_HTTP_FILE is not set\n");
+        return -1;
+    }
+
+    userdata = calloc(1, sizeof(struct replay_userdata));
+    if (userdata == NULL)
+    {
+        return -1;
+    }
+
+    if (driver_trace_load(&userdata->trace, path, DRIVER_TRACE_HTTP) < 0)
+    {
+        fprintf(stderr, "error: load HTTP trace %s failed\n", path);
+        free(userdata);
+        return -1;
+    }
+    userdata->trace.paced = getenv("REPLAY_HTTP_PACED") != NULL;
+
+    ifstruct->transmit = replay_transmit;
+    ifstruct->userdata = userdata;
+
+    return 0;
+}
+
+static int replay_main(struct euicc_http_interface *ifstruct, int argc, char **argv)
+{
+    return 0;
+}
+
+static void replay_fini(struct euicc_http_interface *ifstruct)
+{
+    struct replay_userdata *userdata = ifstruct->userdata;
+
+    if (userdata == NULL)
+    {
+        return;
+    }
+
+    driver_trace_close(&userdata->trace);
+    free(userdata);
+    ifstruct->userdata = NULL;
+}
+
+const struct euicc_driver driver_http_record = {
+    .type = DRIVER_HTTP,
+    .name = "record",
+    .init = (int (*)(void *, const char *))record_init,
+    .main = (int (*)(void *, int, char **))record_main,
+    .fini = (void (*)(void *))record_fini,
+};
+
+const struct euicc_driver driver_http_replay = {
+    .type = DRIVER_HTTP,
+    .name = "replay",
+    .init = (int (*)(void *, const char *))replay_init,
+    .main = (int (*)(void *, int, char **))replay_main,
+    .fini = (void (*)(void *))replay_fini,
+};
@@ -0,0 +1,328 @@
+#include "trace.private.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+static const uint8_t trace_magic[] = {'L', 'P', 'A', 'C', 'T', 'R', 'C', 1};
+
+uint64_t driver_trace_now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart / frequency.QuadPart * 1000000 + counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static void trace_sleep(uint64_t us)
+{
+#ifdef _WIN32
+    Sleep(us / 1000);
+#else
+    struct timespec ts;
+
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) < 0)
+        ;
+#endif
+}
+
+int driver_trace_create(struct driver_trace *trace, const char *path, uint8_t type)
+{
+    memset(trace, 0, sizeof(struct driver_trace));
+
+    trace->fp = fopen(path, "wb");
+    if (trace->fp == NULL)
+    {
+        return -1;
+    }
+
+    if (fwrite(trace_magic, sizeof(trace_magic), 1, trace->fp) != 1 || fputc(type, trace->fp) == EOF || fflush(trace->fp) != 0)
+    {
+        fclose(trace->fp);
+        trace->fp = NULL;
+        return -1;
+    }
+
+    trace->epoch = driver_trace_now();
+
+    return 0;
+}
+
+int driver_trace_load(struct driver_trace *trace, const char *path, uint8_t type)
+{
+    FILE *fp;
+    uint8_t *data_new;
+    size_t n;
+
+    memset(trace, 0, sizeof(struct driver_trace));
+
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    // Read at once, so replaying never waits on the disk
+    for (;;)
+    {
+        data_new = realloc(trace->data, trace->data_len + 65536);
+        if (data_new == NULL)
+        {
+            goto err;
+        }
+        trace->data = data_new;
+
+        n = fread(trace->data + trace->data_len, 1, 65536, fp);
+        trace->data_len += n;
+        if (n < 65536)
+        {
+            break;
+        }
+    }
+    if (ferror(fp))
+    {
+        goto err;
+    }
+    fclose(fp);
+
+    if (trace->data_len < sizeof(trace_magic) + 1 || memcmp(trace->data, trace_magic, sizeof(trace_magic)) != 0 || trace->data[sizeof(trace_magic)] != type)
+    {
+        free(trace->data);
+        trace->data = NULL;
+        return -1;
+    }
+    trace->offset = sizeof(trace_magic) + 1;
+
+    return 0;
+
+err:
+    fclose(fp);
+    free(trace->data);
+    trace->data = NULL;
+    return -1;
+}
+
+void driver_trace_close(struct driver_trace *trace)
+{
+    if (trace->fp)
+    {
+        fclose(trace->fp);
+    }
+    free(trace->data);
+    memset(trace, 0, sizeof(struct driver_trace));
+}
+
+static void trace_buffer_reserve(struct driver_trace_buffer *buffer, uint32_t length)
+{
+    uint32_t capacity;
+    uint8_t *data_new;
+
+    if (buffer->failed || buffer->length + length <= buffer->capacity)
+    {
+        return;
+    }
+
+    capacity = buffer->capacity ? buffer->capacity : 256;
+    while (capacity < buffer->length + length)
+    {
+        capacity *= 2;
+    }
+
+    data_new = realloc(buffer->data, capacity);
+    if (data_new == NULL)
+    {
+        buffer->failed = 1;
+        return;
+    }
+    buffer->data = data_new;
+    buffer->capacity = capacity;
+}
+
+void driver_trace_put_uint(struct driver_trace_buffer *buffer, uint64_t value)
+{
+    trace_buffer_reserve(buffer, 10);
+    if (buffer->failed)
+    {
+        return;
+    }
+
+    do
+    {
+        uint8_t byte = value & 0x7F;
+
+        value >>= 7;
+        buffer->data[buffer->length++] = byte | (value ? 0x80 : 0x00);
+    } while (value);
+}
+
+void driver_trace_put_int(struct driver_trace_buffer *buffer, int32_t value)
+{
+    driver_trace_put_uint(buffer, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+void driver_trace_put_bytes(struct driver_trace_buffer *buffer, const void *data, uint32_t data_len)
+{
+    driver_trace_put_uint(buffer, data_len);
+    trace_buffer_reserve(buffer, data_len);
+    if (buffer->failed)
+    {
+        return;
+    }
+
+    if (data_len)
+    {
+        memcpy(buffer->data + buffer->length, data, data_len);
+    }
+    buffer->length += data_len;
+}
+
+int driver_trace_write(struct driver_trace *trace, uint8_t kind, uint64_t start, struct driver_trace_buffer *buffer)
+{
+    struct driver_trace_buffer header = {0};
+    int fret = 0;
+
+    if (buffer->failed)
+    {
+        goto err;
+    }
+
+    driver_trace_put_uint(&header, kind);
+    driver_trace_put_uint(&header, start - trace->epoch);
+    driver_trace_put_uint(&header, driver_trace_now() - start);
+    driver_trace_put_uint(&header, buffer->length);
+    if (header.failed)
+    {
+        goto err;
+    }
+
+    // Flushed per record, so a crashed session still leaves a usable trace
+    if (fwrite(header.data, header.length, 1, trace->fp) != 1)
+    {
+        goto err;
+    }
+    if (buffer->length && fwrite(buffer->data, buffer->length, 1, trace->fp) != 1)
+    {
+        goto err;
+    }
+    if (fflush(trace->fp) != 0)
+    {
+        goto err;
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    free(header.data);
+    buffer->length = 0;
+    buffer->failed = 0;
+    return fret;
+}
+
+void driver_trace_buffer_free(struct driver_trace_buffer *buffer)
+{
+    free(buffer->data);
+    memset(buffer, 0, sizeof(struct driver_trace_buffer));
+}
+
+int driver_trace_next(struct driver_trace *trace, uint8_t *kind, struct driver_trace_cursor *cursor)
+{
+    struct driver_trace_cursor header;
+    uint64_t duration, length;
+
+    header.data = trace->data + trace->offset;
+    header.length = trace->data_len - trace->offset;
+    header.failed = 0;
+
+    *kind = driver_trace_get_uint(&header);
+    driver_trace_get_uint(&header); // start
+    duration = driver_trace_get_uint(&header);
+    length = driver_trace_get_uint(&header);
+    if (header.failed || length > header.length)
+    {
+        return -1;
+    }
+
+    cursor->data = header.data;
+    cursor->length = length;
+    cursor->failed = 0;
+    trace->offset = header.data + length - trace->data;
+
+    if (trace->paced)
+    {
+        trace_sleep(duration);
+    }
+
+    return 0;
+}
+
+uint64_t driver_trace_get_uint(struct driver_trace_cursor *cursor)
+{
+    uint64_t value = 0;
+    uint8_t shift = 0;
+
+    while (!cursor->failed)
+    {
+        uint8_t byte;
+
+        if (cursor->length == 0 || shift > 63)
+        {
+            cursor->failed = 1;
+            break;
+        }
+
+        byte = *cursor->data++;
+        cursor->length--;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+        if (!(byte & 0x80))
+        {
+            return value;
+        }
+    }
+
+    return 0;
+}
+
+int32_t driver_trace_get_int(struct driver_trace_cursor *cursor)
+{
+    uint32_t value = driver_trace_get_uint(cursor);
+
+    return (int32_t)((value >> 1) ^ -(value & 1));
+}
+
+const uint8_t *driver_trace_get_bytes(struct driver_trace_cursor *cursor, uint32_t *data_len)
+{
+    const uint8_t *data;
+    uint64_t length;
+
+    length = driver_trace_get_uint(cursor);
+    if (cursor->failed || length > cursor->length)
+    {
+        cursor->failed = 1;
+        *data_len = 0;
+        return NULL;
+    }
+
+    data = cursor->data;
+    cursor->data += length;
+    cursor->length -= length;
+    *data_len = length;
+
+    return data;
+}
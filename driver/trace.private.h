@@ -0,0 +1,57 @@
+#pragma once
+#include <inttypes.h>
+#include <stdio.h>
+
+// Binary trace shared by the record and replay drivers. After a header of
+// "LPACTRC", a version byte and the interface type ('A' or 'H'), every record
+// is a kind byte followed by varints for its start time and duration in
+// microseconds and for the body length, and then the body.
+
+#define DRIVER_TRACE_APDU 'A'
+#define DRIVER_TRACE_HTTP 'H'
+
+struct driver_trace
+{
+    FILE *fp;
+    uint64_t epoch;
+    int paced;
+    uint8_t *data;
+    uint32_t data_len;
+    uint32_t offset;
+};
+
+// Body of a record being written, reused across records
+struct driver_trace_buffer
+{
+    uint8_t *data;
+    uint32_t length;
+    uint32_t capacity;
+    int failed;
+};
+
+// Body of a record being read, failed is set once anything was out of bounds
+struct driver_trace_cursor
+{
+    const uint8_t *data;
+    uint32_t length;
+    int failed;
+};
+
+uint64_t driver_trace_now(void);
+
+int driver_trace_create(struct driver_trace *trace, const char *path, uint8_t type);
+int driver_trace_load(struct driver_trace *trace, const char *path, uint8_t type);
+void driver_trace_close(struct driver_trace *trace);
+
+void driver_trace_put_uint(struct driver_trace_buffer *buffer, uint64_t value);
+void driver_trace_put_int(struct driver_trace_buffer *buffer, int32_t value);
+void driver_trace_put_bytes(struct driver_trace_buffer *buffer, const void *data, uint32_t data_len);
+// Appends the record started at start (from driver_trace_now) and empties buffer
+int driver_trace_write(struct driver_trace *trace, uint8_t kind, uint64_t start, struct driver_trace_buffer *buffer);
+void driver_trace_buffer_free(struct driver_trace_buffer *buffer);
+
+// Returns -1 at the end of the trace, sleeps for the recorded duration when pacing
+int driver_trace_next(struct driver_trace *trace, uint8_t *kind, struct driver_trace_cursor *cursor);
+uint64_t driver_trace_get_uint(struct driver_trace_cursor *cursor);
+int32_t driver_trace_get_int(struct driver_trace_cursor *cursor);
+const uint8_t *driver_trace_get_bytes(struct driver_trace_cursor *cursor, uint32_t *data_len);
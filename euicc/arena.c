@@ -0,0 +1,98 @@
+#include "arena.h"
+#include "euicc.private.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pool.private.h"
+
+#define EUICC_ARENA_ALIGN (2 * sizeof(void *))
+#define EUICC_ARENA_ALIGN_UP(x) (((x) + EUICC_ARENA_ALIGN - 1) & ~(EUICC_ARENA_ALIGN - 1))
+#define EUICC_ARENA_HEADER EUICC_ARENA_ALIGN_UP(sizeof(struct euicc_arena))
+#define EUICC_ARENA_BLOCK_MIN 1024
+
+static struct euicc_arena *euicc_arena_block_new(const struct euicc_allocator *allocator, uint32_t capacity)
+{
+    struct euicc_arena *block;
+
+    capacity = EUICC_ARENA_ALIGN_UP(capacity);
+    if (capacity < EUICC_ARENA_BLOCK_MIN)
+    {
+        capacity = EUICC_ARENA_BLOCK_MIN;
+    }
+
+    block = euicc_allocator_malloc(allocator, EUICC_ARENA_HEADER + capacity);
+    if (!block)
+    {
+        return NULL;
+    }
+
+    block->allocator = allocator;
+    block->next = NULL;
+    block->tail = block;
+    block->used = 0;
+    block->capacity = capacity;
+
+    return block;
+}
+
+struct euicc_arena *euicc_arena_new(const struct euicc_allocator *allocator, uint32_t size_hint)
+{
+    return euicc_arena_block_new(allocator, size_hint);
+}
+
+void *euicc_arena_alloc(struct euicc_arena *arena, uint32_t size)
+{
+    struct euicc_arena *block = arena->tail;
+    uint8_t *ptr;
+
+    if (size > UINT32_MAX / 2)
+    {
+        return NULL;
+    }
+    size = EUICC_ARENA_ALIGN_UP(size);
+
+    if (block->capacity - block->used < size)
+    {
+        // Grow geometrically so a list of unknown length still needs only a few blocks
+        block = euicc_arena_block_new(arena->allocator, size > block->capacity * 2 ? size : block->capacity * 2);
+        if (!block)
+        {
+            return NULL;
+        }
+        arena->tail->next = block;
+        arena->tail = block;
+    }
+
+    ptr = (uint8_t *)block + EUICC_ARENA_HEADER + block->used;
+    block->used += size;
+
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+char *euicc_arena_strndup(struct euicc_arena *arena, const void *buffer, uint32_t buffer_len)
+{
+    char *str;
+
+    str = euicc_arena_alloc(arena, buffer_len + 1);
+    if (!str)
+    {
+        return NULL;
+    }
+
+    memcpy(str, buffer, buffer_len);
+    str[buffer_len] = '\0';
+
+    return str;
+}
+
+void euicc_arena_free(struct euicc_arena *arena)
+{
+    while (arena)
+    {
+        struct euicc_arena *next = arena->next;
+        euicc_allocator_free(arena->allocator, arena);
+        arena = next;
+    }
+}
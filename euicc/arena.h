@@ -0,0 +1,24 @@
+#pragma once
+#include <inttypes.h>
+
+struct euicc_allocator;
+
+// Bump allocator backing a decoded ES10 result, everything it hands out is released by one euicc_arena_free
+struct euicc_arena
+{
+    // The blocks come from this, NULL for libc, so the result is freed without its context
+    const struct euicc_allocator *allocator;
+    struct euicc_arena *next;
+    struct euicc_arena *tail;
+    uint32_t used;
+    uint32_t capacity;
+};
+
+#define EUICC_ARENA_LIST_SIZE_HINT 4096
+
+// allocator must outlive the arena, NULL for libc
+struct euicc_arena *euicc_arena_new(const struct euicc_allocator *allocator, uint32_t size_hint);
+// Returns zeroed memory
+void *euicc_arena_alloc(struct euicc_arena *arena, uint32_t size);
+char *euicc_arena_strndup(struct euicc_arena *arena, const void *buffer, uint32_t buffer_len);
+void euicc_arena_free(struct euicc_arena *arena);
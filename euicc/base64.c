@@ -1,14 +1,26 @@
 #include <string.h>
+#include <stdint.h>
 
 #include "base64.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EUICC_BASE64_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define EUICC_BASE64_NEON
+#include <arm_neon.h>
+#endif
+
 static const char basis_64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
+// 64 ends the input, 65 marks whitespace that is skipped
+#define BASE64_SKIP 65
+
 static const unsigned char pr2six[256] =
     {
+        64, 64, 64, 64, 64, 64, 64, 64, 64, 65, 65, 64, 64, 65, 64, 64,
         64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
-        64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
-        64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 62, 64, 64, 64, 63,
+        65, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 62, 64, 64, 64, 63,
         52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 64, 64, 64, 64, 64, 64,
         64, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
         15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 64, 64, 64, 64, 64,
@@ -23,72 +35,333 @@ static const unsigned char pr2six[256] =
         64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
         64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64};
 
-int euicc_base64_decode_len(const char *bufcoded)
+#ifdef EUICC_BASE64_X86
+// Character class checks and ASCII to sextet offsets, indexed by nibble
+#define BASE64_DEC_LUT_LO 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A
+#define BASE64_DEC_LUT_HI 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+#define BASE64_DEC_LUT_ROLL 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+#define BASE64_DEC_PACK 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+// Stops at the first block holding a non-alphabet character, the scalar loop takes over from there
+__attribute__((target("avx2"))) static void base64_decode_avx2(unsigned char **bufout, const unsigned char **bufin, size_t *remaining)
 {
-    int nbytesdecoded;
-    register const unsigned char *bufin;
-    register int nprbytes;
+    const __m256i lut_lo = _mm256_setr_epi8(BASE64_DEC_LUT_LO, BASE64_DEC_LUT_LO);
+    const __m256i lut_hi = _mm256_setr_epi8(BASE64_DEC_LUT_HI, BASE64_DEC_LUT_HI);
+    const __m256i lut_roll = _mm256_setr_epi8(BASE64_DEC_LUT_ROLL, BASE64_DEC_LUT_ROLL);
+    const __m256i pack = _mm256_setr_epi8(BASE64_DEC_PACK, BASE64_DEC_PACK);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2F);
 
-    bufin = (const unsigned char *)bufcoded;
-    while (pr2six[*(bufin++)] <= 63)
-        ;
+    // Each block stores 32 bytes for 24 decoded ones, keep the slack inside the decode_len() bound
+    while (*remaining >= 48)
+    {
+        __m256i str, hi_nibbles, lo_nibbles, lo, hi, roll;
+
+        str = _mm256_loadu_si256((const __m256i *)*bufin);
+        hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+        lo_nibbles = _mm256_and_si256(str, mask_2f);
+        lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+        hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        if (!_mm256_testz_si256(lo, hi))
+        {
+            break;
+        }
+        roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(str, mask_2f), hi_nibbles));
+        str = _mm256_add_epi8(str, roll);
 
-    nprbytes = (bufin - (const unsigned char *)bufcoded) - 1;
-    nbytesdecoded = ((nprbytes + 3) / 4) * 3;
+        str = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        str = _mm256_madd_epi16(str, _mm256_set1_epi32(0x00011000));
+        str = _mm256_shuffle_epi8(str, pack);
+        str = _mm256_permutevar8x32_epi32(str, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i *)*bufout, str);
 
-    return nbytesdecoded + 1;
+        *bufin += 32;
+        *bufout += 24;
+        *remaining -= 32;
+    }
 }
 
-int euicc_base64_decode(unsigned char *bufplain, const char *bufcoded)
+__attribute__((target("ssse3"))) static void base64_decode_ssse3(unsigned char **bufout, const unsigned char **bufin, size_t *remaining)
 {
-    int nbytesdecoded;
-    register const unsigned char *bufin;
-    register unsigned char *bufout;
-    register int nprbytes;
+    const __m128i lut_lo = _mm_setr_epi8(BASE64_DEC_LUT_LO);
+    const __m128i lut_hi = _mm_setr_epi8(BASE64_DEC_LUT_HI);
+    const __m128i lut_roll = _mm_setr_epi8(BASE64_DEC_LUT_ROLL);
+    const __m128i pack = _mm_setr_epi8(BASE64_DEC_PACK);
+    const __m128i mask_2f = _mm_set1_epi8(0x2F);
 
-    bufin = (const unsigned char *)bufcoded;
-    while (pr2six[*(bufin++)] <= 63)
-        ;
-    nprbytes = (bufin - (const unsigned char *)bufcoded) - 1;
-    nbytesdecoded = ((nprbytes + 3) / 4) * 3;
+    // Each block stores 16 bytes for 12 decoded ones
+    while (*remaining >= 24)
+    {
+        __m128i str, hi_nibbles, lo_nibbles, lo, hi, roll;
 
-    bufout = (unsigned char *)bufplain;
-    bufin = (const unsigned char *)bufcoded;
+        str = _mm_loadu_si128((const __m128i *)*bufin);
+        hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+        lo_nibbles = _mm_and_si128(str, mask_2f);
+        lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+        hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xFFFF)
+        {
+            break;
+        }
+        roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(str, mask_2f), hi_nibbles));
+        str = _mm_add_epi8(str, roll);
+
+        str = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+        str = _mm_madd_epi16(str, _mm_set1_epi32(0x00011000));
+        str = _mm_shuffle_epi8(str, pack);
+        _mm_storeu_si128((__m128i *)*bufout, str);
+
+        *bufin += 16;
+        *bufout += 12;
+        *remaining -= 16;
+    }
+}
+
+// 12 input bytes to 16 characters per block, reads 4 bytes past the block
+__attribute__((target("ssse3"))) static void base64_encode_ssse3(char **encoded, const unsigned char **string, int *remaining)
+{
+    const __m128i spread = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    while (*remaining >= 16)
+    {
+        __m128i in, t0, t1, t2, t3, indices, result, less;
+
+        in = _mm_loadu_si128((const __m128i *)*string);
+        in = _mm_shuffle_epi8(in, spread);
+        t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+        t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        t2 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+        t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        indices = _mm_or_si128(t1, t3);
+
+        result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+        result = _mm_add_epi8(_mm_shuffle_epi8(shift_lut, result), indices);
+        _mm_storeu_si128((__m128i *)*encoded, result);
+
+        *string += 12;
+        *encoded += 16;
+        *remaining -= 12;
+    }
+}
+#endif
+
+#ifdef EUICC_BASE64_NEON
+// Returns 0xFF lanes for characters in [lo, hi]
+static inline uint8x16_t base64_neon_range(uint8x16_t v, uint8_t lo, uint8_t hi)
+{
+    return vandq_u8(vcgeq_u8(v, vdupq_n_u8(lo)), vcleq_u8(v, vdupq_n_u8(hi)));
+}
+
+// Maps characters to sextets and clears *valid lanes holding anything else
+static inline uint8x16_t base64_neon_sextets(uint8x16_t v, uint8x16_t *valid)
+{
+    uint8x16_t upper = base64_neon_range(v, 'A', 'Z');
+    uint8x16_t lower = base64_neon_range(v, 'a', 'z');
+    uint8x16_t digit = base64_neon_range(v, '0', '9');
+    uint8x16_t plus = vceqq_u8(v, vdupq_n_u8('+'));
+    uint8x16_t slash = vceqq_u8(v, vdupq_n_u8('/'));
+    uint8x16_t r;
+
+    r = vandq_u8(upper, vsubq_u8(v, vdupq_n_u8('A')));
+    r = vorrq_u8(r, vandq_u8(lower, vsubq_u8(v, vdupq_n_u8('a' - 26))));
+    r = vorrq_u8(r, vandq_u8(digit, vaddq_u8(v, vdupq_n_u8(52 - '0'))));
+    r = vorrq_u8(r, vandq_u8(plus, vdupq_n_u8(62)));
+    r = vorrq_u8(r, vandq_u8(slash, vdupq_n_u8(63)));
+
+    *valid = vandq_u8(*valid, vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, vorrq_u8(plus, slash))));
+    return r;
+}
+
+static void base64_decode_neon(unsigned char **bufout, const unsigned char **bufin, size_t *remaining)
+{
+    while (*remaining >= 64)
+    {
+        uint8x16x4_t str = vld4q_u8(*bufin);
+        uint8x16_t valid = vdupq_n_u8(0xFF);
+        uint8x16_t a, b, c, d;
+        uint8x16x3_t out;
+
+        a = base64_neon_sextets(str.val[0], &valid);
+        b = base64_neon_sextets(str.val[1], &valid);
+        c = base64_neon_sextets(str.val[2], &valid);
+        d = base64_neon_sextets(str.val[3], &valid);
+        if (vminvq_u8(valid) != 0xFF)
+        {
+            break;
+        }
+
+        out.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+        out.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+        out.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+        vst3q_u8(*bufout, out);
+
+        *bufin += 64;
+        *bufout += 48;
+        *remaining -= 64;
+    }
+}
+
+static void base64_encode_neon(char **encoded, const unsigned char **string, int *remaining)
+{
+    uint8x16x4_t alphabet;
+
+    alphabet.val[0] = vld1q_u8((const uint8_t *)basis_64);
+    alphabet.val[1] = vld1q_u8((const uint8_t *)basis_64 + 16);
+    alphabet.val[2] = vld1q_u8((const uint8_t *)basis_64 + 32);
+    alphabet.val[3] = vld1q_u8((const uint8_t *)basis_64 + 48);
 
-    while (nprbytes > 4)
+    while (*remaining >= 48)
     {
-        *(bufout++) =
-            (unsigned char)(pr2six[*bufin] << 2 | pr2six[bufin[1]] >> 4);
-        *(bufout++) =
-            (unsigned char)(pr2six[bufin[1]] << 4 | pr2six[bufin[2]] >> 2);
-        *(bufout++) =
-            (unsigned char)(pr2six[bufin[2]] << 6 | pr2six[bufin[3]]);
-        bufin += 4;
-        nprbytes -= 4;
+        uint8x16x3_t in = vld3q_u8(*string);
+        uint8x16x4_t out;
+
+        out.val[0] = vshrq_n_u8(in.val[0], 2);
+        out.val[1] = vorrq_u8(vshlq_n_u8(vandq_u8(in.val[0], vdupq_n_u8(0x03)), 4), vshrq_n_u8(in.val[1], 4));
+        out.val[2] = vorrq_u8(vshlq_n_u8(vandq_u8(in.val[1], vdupq_n_u8(0x0F)), 2), vshrq_n_u8(in.val[2], 6));
+        out.val[3] = vandq_u8(in.val[2], vdupq_n_u8(0x3F));
+        out.val[0] = vqtbl4q_u8(alphabet, out.val[0]);
+        out.val[1] = vqtbl4q_u8(alphabet, out.val[1]);
+        out.val[2] = vqtbl4q_u8(alphabet, out.val[2]);
+        out.val[3] = vqtbl4q_u8(alphabet, out.val[3]);
+        vst4q_u8((uint8_t *)*encoded, out);
+
+        *string += 48;
+        *encoded += 64;
+        *remaining -= 48;
     }
+}
+#endif
 
-    /* Note: (nprbytes == 1) would be an error, so just ingore that case */
-    if (nprbytes > 1)
+// Bulk of the input through the widest kernel the CPU has, leaves the rest to the scalar code
+static void base64_decode_blocks(unsigned char **bufout, const unsigned char **bufin, size_t remaining)
+{
+#if defined(EUICC_BASE64_X86)
+    if (__builtin_cpu_supports("avx2"))
     {
-        *(bufout++) =
-            (unsigned char)(pr2six[*bufin] << 2 | pr2six[bufin[1]] >> 4);
+        base64_decode_avx2(bufout, bufin, &remaining);
     }
-    if (nprbytes > 2)
+    if (__builtin_cpu_supports("ssse3"))
     {
-        *(bufout++) =
-            (unsigned char)(pr2six[bufin[1]] << 4 | pr2six[bufin[2]] >> 2);
+        base64_decode_ssse3(bufout, bufin, &remaining);
     }
-    if (nprbytes > 3)
+#elif defined(EUICC_BASE64_NEON)
+    base64_decode_neon(bufout, bufin, &remaining);
+#endif
+}
+
+static void base64_encode_blocks(char **encoded, const unsigned char **string, int *remaining)
+{
+#if defined(EUICC_BASE64_X86)
+    if (__builtin_cpu_supports("ssse3"))
     {
-        *(bufout++) =
-            (unsigned char)(pr2six[bufin[2]] << 6 | pr2six[bufin[3]]);
+        base64_encode_ssse3(encoded, string, remaining);
     }
+#elif defined(EUICC_BASE64_NEON)
+    base64_encode_neon(encoded, string, remaining);
+#endif
+}
+
+int euicc_base64_decode_len(const char *bufcoded)
+{
+    // Upper bound from the string length alone, padding and trailing bytes only make it looser
+    return (int)((strlen(bufcoded) + 3) / 4) * 3 + 1;
+}
 
-    *(bufout++) = '\0';
-    nbytesdecoded -= (4 - nprbytes) & 3;
+int euicc_base64_decode(unsigned char *bufplain, const char *bufcoded)
+{
+    struct euicc_base64_decoder decoder;
+    int nbytesdecoded;
+
+    euicc_base64_decoder_init(&decoder);
+    nbytesdecoded = euicc_base64_decoder_update(&decoder, bufplain, bufcoded, strlen(bufcoded));
+    nbytesdecoded += euicc_base64_decoder_finish(&decoder, bufplain + nbytesdecoded);
+
+    bufplain[nbytesdecoded] = '\0';
     return nbytesdecoded;
 }
 
+void euicc_base64_decoder_init(struct euicc_base64_decoder *decoder)
+{
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+int euicc_base64_decoder_update_len(uint32_t len)
+{
+    // One extra quad for the sextets carried over from the previous piece
+    return ((len + 3) / 4 + 1) * 3;
+}
+
+int euicc_base64_decoder_update(struct euicc_base64_decoder *decoder, unsigned char *bufplain, const char *bufcoded, uint32_t len)
+{
+    const unsigned char *bufin, *bufend;
+    unsigned char *bufout;
+
+    bufin = (const unsigned char *)bufcoded;
+    bufend = bufin + len;
+    bufout = bufplain;
+
+    while (!decoder->done)
+    {
+        // Line breaks push a block back to the scalar loop, which re-enters the kernel once past them
+        if (decoder->count == 0)
+        {
+            base64_decode_blocks(&bufout, &bufin, bufend - bufin);
+        }
+
+        while (decoder->count < 4)
+        {
+            unsigned char v;
+
+            if (bufin == bufend)
+            {
+                return bufout - bufplain;
+            }
+
+            v = pr2six[*bufin];
+            if (v == BASE64_SKIP)
+            {
+                bufin++;
+                continue;
+            }
+            if (v > 63)
+            {
+                decoder->done = 1;
+                return bufout - bufplain;
+            }
+            decoder->sextets[decoder->count++] = v;
+            bufin++;
+        }
+
+        *(bufout++) = (unsigned char)(decoder->sextets[0] << 2 | decoder->sextets[1] >> 4);
+        *(bufout++) = (unsigned char)(decoder->sextets[1] << 4 | decoder->sextets[2] >> 2);
+        *(bufout++) = (unsigned char)(decoder->sextets[2] << 6 | decoder->sextets[3]);
+        decoder->count = 0;
+    }
+
+    return bufout - bufplain;
+}
+
+int euicc_base64_decoder_finish(struct euicc_base64_decoder *decoder, unsigned char *bufplain)
+{
+    unsigned char *bufout = bufplain;
+
+    /* Note: (count == 1) would be an error, so just ingore that case */
+    if (decoder->count > 1)
+    {
+        *(bufout++) = (unsigned char)(decoder->sextets[0] << 2 | decoder->sextets[1] >> 4);
+    }
+    if (decoder->count > 2)
+    {
+        *(bufout++) = (unsigned char)(decoder->sextets[1] << 4 | decoder->sextets[2] >> 2);
+    }
+
+    decoder->count = 0;
+    decoder->done = 1;
+    return bufout - bufplain;
+}
+
 int euicc_base64_encode_len(int len)
 {
     return ((len + 2) / 3 * 4) + 1;
@@ -100,6 +373,7 @@ int euicc_base64_encode(char *encoded, const unsigned char *string, int len)
     char *p;
 
     p = encoded;
+    base64_encode_blocks(&p, &string, &len);
     for (i = 0; i < len - 2; i += 3)
     {
         *p++ = basis_64[(string[i] >> 2) & 0x3F];
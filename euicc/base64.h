@@ -1,6 +1,24 @@
 #pragma once
+#include <inttypes.h>
 
+// Upper bound for the decoded size including the terminator, computed from the string length only
 int euicc_base64_decode_len(const char *bufcoded);
+// Decodes up to the first non-alphabet character, skipping whitespace, and returns the number of bytes produced
 int euicc_base64_decode(unsigned char *bufplain, const char *bufcoded);
 int euicc_base64_encode_len(int len);
 int euicc_base64_encode(char *encoded, const unsigned char *string, int len);
+
+// Incremental decoder for input arriving in pieces, with the same stop and whitespace rules as euicc_base64_decode()
+struct euicc_base64_decoder
+{
+    unsigned char sextets[4];
+    unsigned char count;
+    unsigned char done;
+};
+
+void euicc_base64_decoder_init(struct euicc_base64_decoder *decoder);
+// Output room needed by euicc_base64_decoder_update() for len input characters
+int euicc_base64_decoder_update_len(uint32_t len);
+int euicc_base64_decoder_update(struct euicc_base64_decoder *decoder, unsigned char *bufplain, const char *bufcoded, uint32_t len);
+// Writes the 1 or 2 bytes of a trailing partial quad
+int euicc_base64_decoder_finish(struct euicc_base64_decoder *decoder, unsigned char *bufplain);
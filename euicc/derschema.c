@@ -0,0 +1,284 @@
+#include "derschema.h"
+
+#include "derutil.h"
+#include "hexutil.h"
+#include "base64.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int euicc_derschema_enum_value(const struct euicc_derschema_enum *desc, long value)
+{
+    for (uint8_t i = 0; i < desc->values_count; i++)
+    {
+        if (desc->values[i] == value)
+        {
+            return value;
+        }
+    }
+
+    return desc->undefined;
+}
+
+static void euicc_derschema_defaults(uint8_t *base, const struct euicc_derschema_field *fields)
+{
+    for (const struct euicc_derschema_field *field = fields; field->tag; field++)
+    {
+        switch (field->type)
+        {
+        case EUICC_DERSCHEMA_ENUM:
+        case EUICC_DERSCHEMA_ENUM_BITS:
+            *(int *)(base + field->offset) = ((const struct euicc_derschema_enum *)field->param)->absent;
+            break;
+        case EUICC_DERSCHEMA_SEQUENCE:
+            euicc_derschema_defaults(base, field->param);
+            break;
+        }
+    }
+}
+
+static char **euicc_derschema_hex_list(struct euicc_arena *arena, const uint8_t *buffer, uint32_t buffer_len)
+{
+    struct euicc_derutil_node node;
+    char **list;
+    uint32_t count = 0;
+
+    node.self.ptr = buffer;
+    node.self.length = 0;
+    while (euicc_derutil_unpack_next(&node, &node, buffer, buffer_len) == 0)
+    {
+        count++;
+    }
+
+    list = euicc_arena_alloc(arena, (count + 1) * sizeof(char *));
+    if (!list)
+    {
+        return NULL;
+    }
+
+    node.self.ptr = buffer;
+    node.self.length = 0;
+    count = 0;
+    while (euicc_derutil_unpack_next(&node, &node, buffer, buffer_len) == 0)
+    {
+        list[count] = euicc_arena_alloc(arena, node.length * 2 + 1);
+        if (!list[count])
+        {
+            return NULL;
+        }
+        euicc_hexutil_bin2hex(list[count], node.length * 2 + 1, node.value, node.length);
+        count++;
+    }
+
+    return list;
+}
+
+static int euicc_derschema_decode_field(uint8_t *base, const struct euicc_derschema_field *field, struct euicc_arena *arena, const struct euicc_derutil_node *node)
+{
+    void *member = base + field->offset;
+
+    switch (field->type)
+    {
+    case EUICC_DERSCHEMA_UTF8STRING:
+        *(char **)member = euicc_arena_strndup(arena, node->value, node->length);
+        if (!*(char **)member)
+        {
+            return -1;
+        }
+        break;
+    case EUICC_DERSCHEMA_HEX:
+        euicc_hexutil_bin2hex(member, field->size, node->value, node->length);
+        break;
+    case EUICC_DERSCHEMA_HEX_ALLOC:
+        if (node->length == 0)
+        {
+            break;
+        }
+        *(char **)member = euicc_arena_alloc(arena, node->length * 2 + 1);
+        if (!*(char **)member)
+        {
+            return -1;
+        }
+        euicc_hexutil_bin2hex(*(char **)member, node->length * 2 + 1, node->value, node->length);
+        break;
+    case EUICC_DERSCHEMA_HEX_LIST:
+        *(char ***)member = euicc_derschema_hex_list(arena, node->value, node->length);
+        if (!*(char ***)member)
+        {
+            return -1;
+        }
+        break;
+    case EUICC_DERSCHEMA_GSMBCD:
+        euicc_hexutil_bin2gsmbcd(member, field->size, node->value, node->length);
+        break;
+    case EUICC_DERSCHEMA_GSMBCD_ALLOC:
+    {
+        char *str = euicc_arena_alloc(arena, node->length * 2 + 1);
+        if (!str)
+        {
+            return -1;
+        }
+        if (euicc_hexutil_bin2gsmbcd(str, node->length * 2 + 1, node->value, node->length) == 0)
+        {
+            *(char **)member = str;
+        }
+    }
+    break;
+    case EUICC_DERSCHEMA_BASE64:
+        *(char **)member = euicc_arena_alloc(arena, euicc_base64_encode_len(node->length));
+        if (!*(char **)member)
+        {
+            return -1;
+        }
+        euicc_base64_encode(*(char **)member, node->value, node->length);
+        break;
+    case EUICC_DERSCHEMA_OCTETS:
+    {
+        struct euicc_derschema_octets *octets = member;
+
+        octets->data = euicc_arena_alloc(arena, node->length ? node->length : 1);
+        if (!octets->data)
+        {
+            return -1;
+        }
+        memcpy(octets->data, node->value, node->length);
+        octets->length = node->length;
+    }
+    break;
+    case EUICC_DERSCHEMA_INTEGER:
+        *(unsigned long *)member = euicc_derutil_convert_bin2long(node->value, node->length);
+        break;
+    case EUICC_DERSCHEMA_UINT32:
+        *(uint32_t *)member = euicc_derutil_convert_bin2long(node->value, node->length);
+        break;
+    case EUICC_DERSCHEMA_ENUM:
+        *(int *)member = euicc_derschema_enum_value(field->param, euicc_derutil_convert_bin2long(node->value, node->length));
+        break;
+    case EUICC_DERSCHEMA_ENUM_BITS:
+        if (node->length >= 2)
+        {
+            *(int *)member = euicc_derschema_enum_value(field->param, node->value[1]);
+        }
+        break;
+    case EUICC_DERSCHEMA_NAMED_ENUM:
+    {
+        const char *const *names = field->param;
+        long value = euicc_derutil_convert_bin2long(node->value, node->length);
+        long count;
+
+        for (count = 0; names[count]; count++)
+            ;
+        *(const char **)member = (value >= 0 && value < count) ? names[value] : names[0];
+    }
+    break;
+    case EUICC_DERSCHEMA_NAMED_BITS:
+    {
+        const char **desc = (const char **)field->param;
+        const char **bits;
+
+        bits = euicc_arena_alloc(arena, (euicc_derutil_convert_bin2bits_str_count(desc) + 1) * sizeof(char *));
+        if (!bits)
+        {
+            return -1;
+        }
+        if (euicc_derutil_convert_bin2bits_str_into(bits, node->value, node->length, desc))
+        {
+            return -1;
+        }
+        *(const char ***)member = bits;
+    }
+    break;
+    case EUICC_DERSCHEMA_VERSION:
+        if (node->length != 3)
+        {
+            break;
+        }
+        *(char **)member = euicc_arena_alloc(arena, sizeof("255.255.255"));
+        if (!*(char **)member)
+        {
+            return -1;
+        }
+        snprintf(*(char **)member, sizeof("255.255.255"), "%d.%d.%d", node->value[0], node->value[1], node->value[2]);
+        break;
+    case EUICC_DERSCHEMA_SEQUENCE:
+        // Nested members use offsets relative to the same struct
+        return euicc_derschema_decode(base, field->param, arena, node->value, node->length);
+    case EUICC_DERSCHEMA_LIST:
+        return euicc_derschema_decode_list(member, field->param, arena, node->value, node->length);
+    case EUICC_DERSCHEMA_REPORT:
+        fprintf(stderr, "\n[PLEASE REPORT][TODO][TAG %02X]: ", node->tag);
+        for (uint32_t i = 0; i < node->self.length; i++)
+        {
+            fprintf(stderr, "%02X ", node->self.ptr[i]);
+        }
+        fprintf(stderr, "\n");
+        break;
+    }
+
+    return 0;
+}
+
+int euicc_derschema_decode(void *out, const struct euicc_derschema_field *fields, struct euicc_arena *arena, const uint8_t *buffer, uint32_t buffer_len)
+{
+    uint8_t *base = out;
+    struct euicc_derutil_node node;
+
+    euicc_derschema_defaults(base, fields);
+
+    node.self.ptr = buffer;
+    node.self.length = 0;
+    while (euicc_derutil_unpack_next(&node, &node, buffer, buffer_len) == 0)
+    {
+        for (const struct euicc_derschema_field *field = fields; field->tag; field++)
+        {
+            if (field->tag != node.tag)
+            {
+                continue;
+            }
+            if (euicc_derschema_decode_field(base, field, arena, &node) < 0)
+            {
+                return -1;
+            }
+            break;
+        }
+    }
+
+    return 0;
+}
+
+int euicc_derschema_decode_list(void **head, const struct euicc_derschema_list *list, struct euicc_arena *arena, const uint8_t *buffer, uint32_t buffer_len)
+{
+    struct euicc_derutil_node node;
+    uint8_t *element, *tail = NULL;
+
+    *head = NULL;
+
+    node.self.ptr = buffer;
+    node.self.length = 0;
+    while (euicc_derutil_unpack_next(&node, &node, buffer, buffer_len) == 0)
+    {
+        element = euicc_arena_alloc(arena, list->size);
+        if (!element)
+        {
+            return -1;
+        }
+
+        if (euicc_derschema_decode(element, list->fields, arena, node.value, node.length) < 0)
+        {
+            return -1;
+        }
+
+        if (tail == NULL)
+        {
+            *head = element;
+        }
+        else
+        {
+            *(void **)(tail + list->next_offset) = element;
+        }
+        tail = element;
+    }
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+// Declarative DER decoding: a zero-tag terminated table maps each child tag to a typed member of the output struct
+enum euicc_derschema_type
+{
+    EUICC_DERSCHEMA_UTF8STRING,   // char *
+    EUICC_DERSCHEMA_HEX,          // char[size]
+    EUICC_DERSCHEMA_HEX_ALLOC,    // char *, left NULL when empty
+    EUICC_DERSCHEMA_HEX_LIST,     // char **, one hex string per child, NULL terminated
+    EUICC_DERSCHEMA_GSMBCD,       // char[size]
+    EUICC_DERSCHEMA_GSMBCD_ALLOC, // char *
+    EUICC_DERSCHEMA_BASE64,       // char *
+    EUICC_DERSCHEMA_OCTETS,       // struct euicc_derschema_octets, the value as it is
+    EUICC_DERSCHEMA_INTEGER,      // unsigned long
+    EUICC_DERSCHEMA_UINT32,       // uint32_t
+    EUICC_DERSCHEMA_ENUM,         // int, param is struct euicc_derschema_enum
+    EUICC_DERSCHEMA_ENUM_BITS,    // int taken from the first octet of a BIT STRING, param is struct euicc_derschema_enum
+    EUICC_DERSCHEMA_NAMED_ENUM,   // const char *, param is a NULL terminated name table, out of range maps to the first name
+    EUICC_DERSCHEMA_NAMED_BITS,   // const char **, param is a NULL terminated bit name table
+    EUICC_DERSCHEMA_VERSION,      // char *, VersionType as "x.y.z"
+    EUICC_DERSCHEMA_SEQUENCE,     // members of the same struct, param is the nested field table
+    EUICC_DERSCHEMA_LIST,         // linked list of structs, param is struct euicc_derschema_list
+    EUICC_DERSCHEMA_REPORT,       // not decoded yet, dumped to stderr
+};
+
+struct euicc_derschema_octets
+{
+    uint8_t *data;
+    uint32_t length;
+};
+
+struct euicc_derschema_field
+{
+    uint16_t tag;
+    uint8_t type;
+    uint16_t offset;
+    uint16_t size;
+    const void *param;
+};
+
+struct euicc_derschema_enum
+{
+    int absent;
+    int undefined;
+    const int *values;
+    uint8_t values_count;
+};
+
+struct euicc_derschema_list
+{
+    const struct euicc_derschema_field *fields;
+    uint16_t size;
+    uint16_t next_offset;
+};
+
+#define EUICC_DERSCHEMA_FIELD(tag_, type_, struct_, member_, param_) \
+    {                                                                \
+        .tag = (tag_),                                               \
+        .type = (type_),                                             \
+        .offset = offsetof(struct_, member_),                        \
+        .size = sizeof(((struct_ *)0)->member_),                     \
+        .param = (param_),                                           \
+    }
+
+#define EUICC_DERSCHEMA_END \
+    {                       \
+        .tag = 0,           \
+    }
+
+// Decodes the TLVs in buffer into out, out must be zeroed and everything allocated comes from arena
+int euicc_derschema_decode(void *out, const struct euicc_derschema_field *fields, struct euicc_arena *arena, const uint8_t *buffer, uint32_t buffer_len);
+// Decodes every TLV in buffer as one element of list, *head receives the first element
+int euicc_derschema_decode_list(void **head, const struct euicc_derschema_list *list, struct euicc_arena *arena, const uint8_t *buffer, uint32_t buffer_len);
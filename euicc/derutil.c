@@ -2,6 +2,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "pool.private.h"
 
 int euicc_derutil_unpack_first(struct euicc_derutil_node *result, const uint8_t *buffer, uint32_t buffer_len)
 {
@@ -107,6 +108,487 @@ int euicc_derutil_unpack_find_tag(struct euicc_derutil_node *result, uint16_t ta
     return euicc_derutil_unpack_find_alias_tags(result, &tag, 1, buffer, buffer_len);
 }
 
+int euicc_derutil_index(struct euicc_derutil_node *children, uint32_t children_max, const uint8_t *buffer, uint32_t buffer_len)
+{
+    uint32_t count = 0;
+    uint32_t offset = 0;
+
+    while (offset < buffer_len)
+    {
+        if (count >= children_max)
+        {
+            return -1;
+        }
+        if (euicc_derutil_unpack_first(&children[count], buffer + offset, buffer_len - offset) < 0)
+        {
+            return -1;
+        }
+        offset += children[count].self.length;
+        count++;
+    }
+
+    return count;
+}
+
+static inline uint32_t euicc_derutil_index_hash(uint16_t tag)
+{
+    return ((uint32_t)tag * 0x9E3779B1u) >> (32 - EUICC_DERUTIL_INDEX_BITS);
+}
+
+int euicc_derutil_index_table_init(struct euicc_derutil_index_table *table, const struct euicc_derutil_node *children, uint32_t children_count)
+{
+    uint32_t used = 0;
+
+    memset(table, 0x00, sizeof(struct euicc_derutil_index_table));
+    table->children = children;
+
+    if (children_count > UINT8_MAX)
+    {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < children_count; i++)
+    {
+        uint32_t slot = euicc_derutil_index_hash(children[i].tag);
+
+        while (table->slots[slot] && children[table->slots[slot] - 1].tag != children[i].tag)
+        {
+            slot = (slot + 1) & (EUICC_DERUTIL_INDEX_SLOTS - 1);
+        }
+        if (table->slots[slot])
+        {
+            continue;
+        }
+        // One slot always stays empty so a lookup of a missing tag stops
+        if (++used >= EUICC_DERUTIL_INDEX_SLOTS)
+        {
+            return -1;
+        }
+        table->slots[slot] = i + 1;
+    }
+
+    return 0;
+}
+
+const struct euicc_derutil_node *euicc_derutil_index_find(const struct euicc_derutil_index_table *table, uint16_t tag)
+{
+    uint32_t slot = euicc_derutil_index_hash(tag);
+
+    while (table->slots[slot])
+    {
+        const struct euicc_derutil_node *child = &table->children[table->slots[slot] - 1];
+
+        if (child->tag == tag)
+        {
+            return child;
+        }
+        slot = (slot + 1) & (EUICC_DERUTIL_INDEX_SLOTS - 1);
+    }
+
+    return NULL;
+}
+
+int euicc_derutil_stream_init(struct euicc_derutil_stream *stream, const uint16_t *path, uint8_t path_len, int (*callback)(const struct euicc_derutil_node *node, void *userdata), void *userdata)
+{
+    memset(stream, 0x00, sizeof(struct euicc_derutil_stream));
+
+    if (path_len < 1 || path_len > EUICC_DERUTIL_STREAM_DEPTH_MAX)
+    {
+        return -1;
+    }
+
+    stream->path = path;
+    stream->path_len = path_len;
+    stream->callback = callback;
+    stream->userdata = userdata;
+
+    return 0;
+}
+
+int euicc_derutil_stream_init_select(struct euicc_derutil_stream *stream, int (*select)(uint16_t tag, const uint8_t *header, uint8_t header_len, uint8_t depth, void *userdata), int (*callback)(const struct euicc_derutil_node *node, void *userdata), void *userdata)
+{
+    memset(stream, 0x00, sizeof(struct euicc_derutil_stream));
+
+    stream->select = select;
+    stream->callback = callback;
+    stream->userdata = userdata;
+
+    return 0;
+}
+
+// Returns 1 with tag and length set once header[] holds a complete TLV header, 0 if more bytes are needed
+static int euicc_derutil_stream_header(struct euicc_derutil_stream *stream, uint16_t *tag, uint32_t *length)
+{
+    uint8_t offset = 1;
+    uint8_t lengthlen;
+
+    if (stream->header_len < 1)
+    {
+        return 0;
+    }
+
+    *tag = stream->header[0];
+    if ((*tag & 0x1F) == 0x1F)
+    {
+        if (stream->header_len < 2)
+        {
+            return 0;
+        }
+        *tag = (*tag << 8) | stream->header[1];
+        offset++;
+    }
+
+    if (stream->header_len < offset + 1)
+    {
+        return 0;
+    }
+
+    *length = stream->header[offset];
+    if (!(*length & 0x80))
+    {
+        return stream->header_len == offset + 1;
+    }
+
+    lengthlen = *length & 0x7F;
+    if (lengthlen > 4)
+    {
+        return -1;
+    }
+    if (stream->header_len < offset + 1 + lengthlen)
+    {
+        return 0;
+    }
+
+    *length = 0;
+    for (int i = 0; i < lengthlen; i++)
+    {
+        *length = (*length << 8) | stream->header[offset + 1 + i];
+    }
+
+    return 1;
+}
+
+static int euicc_derutil_stream_account(struct euicc_derutil_stream *stream, uint32_t length)
+{
+    for (uint8_t i = 0; i < stream->depth; i++)
+    {
+        if (stream->remaining[i] < length)
+        {
+            return -1;
+        }
+        stream->remaining[i] -= length;
+    }
+
+    return 0;
+}
+
+// Accounts consumed bytes against every open container and closes the ones that are complete
+static int euicc_derutil_stream_consume(struct euicc_derutil_stream *stream, uint32_t length)
+{
+    if (euicc_derutil_stream_account(stream, length) < 0)
+    {
+        return -1;
+    }
+
+    while (stream->depth > 0 && stream->remaining[stream->depth - 1] == 0)
+    {
+        stream->depth--;
+        if (stream->depth == stream->path_len - 1)
+        {
+            stream->done = 1;
+        }
+    }
+
+    // In select mode the input is a single top level TLV
+    if (stream->select && stream->depth == 0)
+    {
+        stream->done = 1;
+    }
+
+    return 0;
+}
+
+static int euicc_derutil_stream_begin(struct euicc_derutil_stream *stream, uint16_t tag, uint32_t length)
+{
+    uint32_t need;
+    int enter;
+
+    if (stream->done || (stream->depth < stream->path_len && tag != stream->path[stream->depth]))
+    {
+        // Not on the path, discard it
+        if (euicc_derutil_stream_consume(stream, stream->header_len) < 0)
+        {
+            return -1;
+        }
+        stream->header_len = 0;
+        stream->skip = length;
+        return 0;
+    }
+
+    if (stream->select)
+    {
+        enter = stream->select(tag, stream->header, stream->header_len, stream->depth, stream->userdata);
+        if (enter < 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        enter = stream->depth < stream->path_len;
+    }
+
+    if (enter)
+    {
+        if (stream->depth >= EUICC_DERUTIL_STREAM_DEPTH_MAX)
+        {
+            return -1;
+        }
+
+        // The parent must stay open until the child is pushed
+        if (euicc_derutil_stream_account(stream, stream->header_len) < 0)
+        {
+            return -1;
+        }
+        stream->header_len = 0;
+        stream->remaining[stream->depth] = length;
+        stream->depth++;
+        return euicc_derutil_stream_consume(stream, 0);
+    }
+
+    need = stream->header_len + length;
+    if (need < length)
+    {
+        return -1;
+    }
+
+    if (stream->element_capacity < need)
+    {
+        uint8_t *element_new = realloc(stream->element, need);
+        if (element_new == NULL)
+        {
+            return -1;
+        }
+        stream->element = element_new;
+        stream->element_capacity = need;
+    }
+
+    memcpy(stream->element, stream->header, stream->header_len);
+    stream->element_len = stream->header_len;
+    stream->element_need = need;
+    stream->header_len = 0;
+
+    return 0;
+}
+
+// Delivers the buffered child and accounts it against the open containers
+static int euicc_derutil_stream_emit(struct euicc_derutil_stream *stream)
+{
+    struct euicc_derutil_node node;
+    uint32_t length = stream->element_len;
+
+    stream->element_len = 0;
+    stream->element_need = 0;
+
+    if (euicc_derutil_unpack_first(&node, stream->element, length) < 0)
+    {
+        return -1;
+    }
+
+    if (stream->callback(&node, stream->userdata) < 0)
+    {
+        return -1;
+    }
+
+    return euicc_derutil_stream_consume(stream, length);
+}
+
+int euicc_derutil_stream_feed(struct euicc_derutil_stream *stream, const uint8_t *buffer, uint32_t buffer_len)
+{
+    uint16_t tag;
+    uint32_t length;
+    uint32_t n;
+    int ret;
+
+    while (buffer_len > 0)
+    {
+        if (stream->element_need > 0)
+        {
+            n = stream->element_need - stream->element_len;
+            if (n > buffer_len)
+            {
+                n = buffer_len;
+            }
+            memcpy(stream->element + stream->element_len, buffer, n);
+            stream->element_len += n;
+            buffer += n;
+            buffer_len -= n;
+
+            if (stream->element_len == stream->element_need)
+            {
+                if (euicc_derutil_stream_emit(stream) < 0)
+                {
+                    return -1;
+                }
+            }
+            continue;
+        }
+
+        if (stream->skip > 0)
+        {
+            n = stream->skip;
+            if (n > buffer_len)
+            {
+                n = buffer_len;
+            }
+            stream->skip -= n;
+            buffer += n;
+            buffer_len -= n;
+
+            if (euicc_derutil_stream_consume(stream, n) < 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        if (stream->header_len >= sizeof(stream->header))
+        {
+            return -1;
+        }
+        stream->header[stream->header_len++] = *buffer;
+        buffer++;
+        buffer_len--;
+
+        ret = euicc_derutil_stream_header(stream, &tag, &length);
+        if (ret < 0)
+        {
+            return -1;
+        }
+        if (ret == 0)
+        {
+            continue;
+        }
+
+        if (euicc_derutil_stream_begin(stream, tag, length) < 0)
+        {
+            return -1;
+        }
+
+        if (stream->element_need > 0 && stream->element_len == stream->element_need)
+        {
+            if (euicc_derutil_stream_emit(stream) < 0)
+            {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int euicc_derutil_stream_finish(struct euicc_derutil_stream *stream)
+{
+    if (stream->header_len > 0 || stream->skip > 0 || stream->element_need > 0 || stream->depth > 0)
+    {
+        return -1;
+    }
+
+    if (!stream->done)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+void euicc_derutil_stream_free(struct euicc_derutil_stream *stream)
+{
+    free(stream->element);
+    stream->element = NULL;
+    stream->element_capacity = 0;
+}
+
+void euicc_derutil_writer_init(struct euicc_derutil_writer *writer, uint8_t *buffer, uint32_t capacity)
+{
+    writer->buffer = buffer;
+    writer->offset = capacity;
+    writer->capacity = capacity;
+    writer->overflow = 0;
+}
+
+uint32_t euicc_derutil_writer_mark(const struct euicc_derutil_writer *writer)
+{
+    return writer->capacity - writer->offset;
+}
+
+void euicc_derutil_writer_bytes(struct euicc_derutil_writer *writer, const void *data, uint32_t data_len)
+{
+    if (writer->overflow || writer->offset < data_len)
+    {
+        writer->overflow = 1;
+        return;
+    }
+
+    writer->offset -= data_len;
+    memcpy(writer->buffer + writer->offset, data, data_len);
+}
+
+void euicc_derutil_writer_header(struct euicc_derutil_writer *writer, uint16_t tag, uint32_t length)
+{
+    uint8_t header[2 + 1 + 4];
+    uint8_t *wptr = header + sizeof(header);
+
+    if (length < 0x80)
+    {
+        *(--wptr) = length;
+    }
+    else
+    {
+        uint8_t lengthlen = 0;
+
+        while (length)
+        {
+            *(--wptr) = length & 0xFF;
+            length >>= 8;
+            lengthlen++;
+        }
+        *(--wptr) = 0x80 | lengthlen;
+    }
+
+    *(--wptr) = tag & 0xFF;
+    if (tag >> 8)
+    {
+        *(--wptr) = tag >> 8;
+    }
+
+    euicc_derutil_writer_bytes(writer, wptr, header + sizeof(header) - wptr);
+}
+
+void euicc_derutil_writer_tlv(struct euicc_derutil_writer *writer, uint16_t tag, const void *value, uint32_t value_len)
+{
+    euicc_derutil_writer_bytes(writer, value, value_len);
+    euicc_derutil_writer_header(writer, tag, value_len);
+}
+
+void euicc_derutil_writer_wrap(struct euicc_derutil_writer *writer, uint16_t tag, uint32_t mark)
+{
+    euicc_derutil_writer_header(writer, tag, euicc_derutil_writer_mark(writer) - mark);
+}
+
+int euicc_derutil_writer_finish(struct euicc_derutil_writer *writer, const uint8_t **data, uint32_t *data_len)
+{
+    if (writer->overflow)
+    {
+        return -1;
+    }
+
+    *data = writer->buffer + writer->offset;
+    *data_len = writer->capacity - writer->offset;
+
+    return 0;
+}
+
 static void euicc_derutil_pack_sizeof_single_node(struct euicc_derutil_node *node)
 {
     node->self.length = 0;
@@ -381,16 +863,22 @@ int euicc_derutil_convert_bits2bin_alloc(uint8_t **buffer, uint32_t *buffer_len,
     return euicc_derutil_convert_bits2bin(*buffer, *buffer_len, bits, bits_count);
 }
 
-int euicc_derutil_convert_bin2bits_str(const char ***output, const uint8_t *buffer, int buffer_len, const char **desc)
+int euicc_derutil_convert_bin2bits_str_count(const char **desc)
 {
-    int max_cap_len = 0;
+    int count;
+
+    for (count = 0; desc[count]; count++)
+        ;
+
+    return count;
+}
+
+int euicc_derutil_convert_bin2bits_str_into(const char **output, const uint8_t *buffer, int buffer_len, const char **desc)
+{
+    int max_cap_len;
     int flags_reg;
-    int flags_count = 0;
-    const char **wptr;
     char unused;
 
-    *output = NULL;
-
     if (buffer_len < 1)
     {
         return -1;
@@ -401,8 +889,7 @@ int euicc_derutil_convert_bin2bits_str(const char ***output, const uint8_t *buff
     buffer++;
     buffer_len--;
 
-    for (max_cap_len = 0; desc[max_cap_len]; max_cap_len++)
-        ;
+    max_cap_len = euicc_derutil_convert_bin2bits_str_count(desc);
 
     for (int j = 0; j < buffer_len; j++)
     {
@@ -414,43 +901,40 @@ int euicc_derutil_convert_bin2bits_str(const char ***output, const uint8_t *buff
         {
             flags_reg = buffer[j];
         }
+
         for (int i = 0; (i < 8) && ((j * 8 + i) < max_cap_len); i++)
         {
             if (flags_reg & 0x80)
             {
-                flags_count++;
+                *(output++) = desc[j * 8 + i];
             }
             flags_reg <<= 1;
         }
     }
+    *output = NULL;
 
-    wptr = calloc(flags_count + 1, sizeof(char *));
-    if (!wptr)
+    return 0;
+}
+
+int euicc_derutil_convert_bin2bits_str(const char ***output, const uint8_t *buffer, int buffer_len, const char **desc)
+{
+    const char **wptr;
+
+    *output = NULL;
+
+    if (buffer_len < 1)
     {
         return -1;
     }
-    *output = wptr;
 
-    for (int j = 0; j < buffer_len; j++)
+    wptr = calloc(euicc_derutil_convert_bin2bits_str_count(desc) + 1, sizeof(char *));
+    if (!wptr)
     {
-        if (j == buffer_len - 1)
-        {
-            flags_reg = buffer[j] & ~(0xFF >> (8 - unused));
-        }
-        else
-        {
-            flags_reg = buffer[j];
-        }
-
-        for (int i = 0; (i < 8) && ((j * 8 + i) < max_cap_len); i++)
-        {
-            if (flags_reg & 0x80)
-            {
-                *(wptr++) = desc[j * 8 + i];
-            }
-            flags_reg <<= 1;
-        }
+        return -1;
     }
 
+    euicc_derutil_convert_bin2bits_str_into(wptr, buffer, buffer_len, desc);
+    *output = wptr;
+
     return 0;
 }
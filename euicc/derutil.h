@@ -1,3 +1,4 @@
+#pragma once
 #include <inttypes.h>
 
 struct euicc_derutil_node
@@ -24,6 +25,74 @@ int euicc_derutil_unpack_next(struct euicc_derutil_node *result, struct euicc_de
 int euicc_derutil_unpack_find_alias_tags(struct euicc_derutil_node *result, const uint16_t *tags, uint32_t tags_count, const uint8_t *buffer, uint32_t buffer_len);
 int euicc_derutil_unpack_find_tag(struct euicc_derutil_node *result, uint16_t tag, const uint8_t *buffer, uint32_t buffer_len);
 
+// Decodes every TLV in buffer into children[] in one pass, returns the count or -1 if malformed or more than children_max
+int euicc_derutil_index(struct euicc_derutil_node *children, uint32_t children_max, const uint8_t *buffer, uint32_t buffer_len);
+
+#define EUICC_DERUTIL_INDEX_BITS 5
+#define EUICC_DERUTIL_INDEX_SLOTS (1 << EUICC_DERUTIL_INDEX_BITS)
+
+// Tag to child table over the nodes filled in by euicc_derutil_index, the first child with a tag wins
+struct euicc_derutil_index_table
+{
+    const struct euicc_derutil_node *children;
+    // Open addressing on a multiplicative hash of the tag, each slot holds child number + 1 or 0 when empty
+    uint8_t slots[EUICC_DERUTIL_INDEX_SLOTS];
+};
+
+// Returns -1 if children has more distinct tags than the table can hold
+int euicc_derutil_index_table_init(struct euicc_derutil_index_table *table, const struct euicc_derutil_node *children, uint32_t children_count);
+// O(1), NULL if no child has the tag
+const struct euicc_derutil_node *euicc_derutil_index_find(const struct euicc_derutil_index_table *table, uint16_t tag);
+
+#define EUICC_DERUTIL_STREAM_DEPTH_MAX 4
+
+// Push decoder: enters the containers listed in path[] and hands each complete child of the innermost one to callback
+struct euicc_derutil_stream
+{
+    const uint16_t *path;
+    uint8_t path_len;
+    uint8_t depth;
+    uint8_t done;
+    uint32_t remaining[EUICC_DERUTIL_STREAM_DEPTH_MAX];
+    uint8_t header[2 + 1 + 4];
+    uint8_t header_len;
+    uint32_t skip;
+    uint8_t *element;
+    uint32_t element_len;
+    uint32_t element_need;
+    uint32_t element_capacity;
+    int (*select)(uint16_t tag, const uint8_t *header, uint8_t header_len, uint8_t depth, void *userdata);
+    int (*callback)(const struct euicc_derutil_node *node, void *userdata);
+    void *userdata;
+};
+
+int euicc_derutil_stream_init(struct euicc_derutil_stream *stream, const uint16_t *path, uint8_t path_len, int (*callback)(const struct euicc_derutil_node *node, void *userdata), void *userdata);
+// Instead of a fixed path, select() is asked for every TLV header: a positive return enters the container, 0 hands the whole TLV to callback
+int euicc_derutil_stream_init_select(struct euicc_derutil_stream *stream, int (*select)(uint16_t tag, const uint8_t *header, uint8_t header_len, uint8_t depth, void *userdata), int (*callback)(const struct euicc_derutil_node *node, void *userdata), void *userdata);
+int euicc_derutil_stream_feed(struct euicc_derutil_stream *stream, const uint8_t *buffer, uint32_t buffer_len);
+// Returns -1 if the input ended inside a TLV or the path was never entered
+int euicc_derutil_stream_finish(struct euicc_derutil_stream *stream);
+void euicc_derutil_stream_free(struct euicc_derutil_stream *stream);
+
+// Single pass DER writer filling the buffer from its end, children are written last to first and then wrapped
+struct euicc_derutil_writer
+{
+    uint8_t *buffer;
+    uint32_t offset;
+    uint32_t capacity;
+    uint8_t overflow;
+};
+
+void euicc_derutil_writer_init(struct euicc_derutil_writer *writer, uint8_t *buffer, uint32_t capacity);
+uint32_t euicc_derutil_writer_mark(const struct euicc_derutil_writer *writer);
+void euicc_derutil_writer_bytes(struct euicc_derutil_writer *writer, const void *data, uint32_t data_len);
+void euicc_derutil_writer_header(struct euicc_derutil_writer *writer, uint16_t tag, uint32_t length);
+void euicc_derutil_writer_tlv(struct euicc_derutil_writer *writer, uint16_t tag, const void *value, uint32_t value_len);
+// Prepends a header covering everything written since mark
+void euicc_derutil_writer_wrap(struct euicc_derutil_writer *writer, uint16_t tag, uint32_t mark);
+// Returns -1 if the buffer was too small, otherwise points data at the encoded bytes
+int euicc_derutil_writer_finish(struct euicc_derutil_writer *writer, const uint8_t **data, uint32_t *data_len);
+
 int euicc_derutil_pack(uint8_t *buffer, uint32_t *buffer_len, struct euicc_derutil_node *node);
 int euicc_derutil_pack_alloc(uint8_t **buffer, uint32_t *buffer_len, struct euicc_derutil_node *node);
 
@@ -32,3 +101,6 @@ int euicc_derutil_convert_long2bin(uint8_t *buffer, uint32_t *buffer_len, long v
 int euicc_derutil_convert_bits2bin(uint8_t *buffer, uint32_t buffer_len, const uint32_t *bits, uint32_t bits_count);
 int euicc_derutil_convert_bits2bin_alloc(uint8_t **buffer, uint32_t *buffer_len, const uint32_t *bits, uint32_t bits_count);
 int euicc_derutil_convert_bin2bits_str(const char ***output, const uint8_t *buffer, int buffer_len, const char **desc);
+// output must hold euicc_derutil_convert_bin2bits_str_count(desc) + 1 entries
+int euicc_derutil_convert_bin2bits_str_count(const char **desc);
+int euicc_derutil_convert_bin2bits_str_into(const char **output, const uint8_t *buffer, int buffer_len, const char **desc);
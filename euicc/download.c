@@ -0,0 +1,432 @@
+#include "download.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "es10b.h"
+#include "es10c_ex.h"
+#include "es9p.h"
+#include "euicc.private.h"
+#include "pool.private.h"
+
+enum euicc_download_stage
+{
+    EUICC_DOWNLOAD_STAGE_GET_EUICC_CHALLENGE_AND_INFO,
+    EUICC_DOWNLOAD_STAGE_INITIATE_AUTHENTICATION,
+    EUICC_DOWNLOAD_STAGE_AUTHENTICATE_SERVER,
+    EUICC_DOWNLOAD_STAGE_AUTHENTICATE_CLIENT,
+    EUICC_DOWNLOAD_STAGE_PREPARE_DOWNLOAD,
+    EUICC_DOWNLOAD_STAGE_GET_BOUND_PROFILE_PACKAGE,
+    EUICC_DOWNLOAD_STAGE_LOAD_BOUND_PROFILE_PACKAGE,
+    EUICC_DOWNLOAD_STAGE_DONE,
+};
+
+static int download_stage_get_euicc_challenge_and_info(struct euicc_download_session *session)
+{
+    return es10b_get_euicc_challenge_and_info(session->ctx);
+}
+
+static int download_stage_initiate_authentication(struct euicc_download_session *session)
+{
+    return es9p_initiate_authentication(session->ctx);
+}
+
+static int download_stage_authenticate_server(struct euicc_download_session *session)
+{
+    return es10b_authenticate_server(session->ctx, session->matchingId, session->imei);
+}
+
+static int download_stage_authenticate_client(struct euicc_download_session *session)
+{
+    return es9p_authenticate_client(session->ctx);
+}
+
+static int download_stage_prepare_download(struct euicc_download_session *session)
+{
+    return es10b_prepare_download(session->ctx, session->confirmationCode);
+}
+
+static int download_stage_get_bound_profile_package(struct euicc_download_session *session)
+{
+    return es9p_get_bound_profile_package(session->ctx);
+}
+
+static int download_stage_load_bound_profile_package(struct euicc_download_session *session)
+{
+    return es10b_load_bound_profile_package(session->ctx, &session->result);
+}
+
+static const struct
+{
+    const char *name;
+    uint8_t http;
+    int (*run)(struct euicc_download_session *session);
+} download_stages[] = {
+    {"es10b_get_euicc_challenge_and_info", 0, download_stage_get_euicc_challenge_and_info},
+    {"es9p_initiate_authentication", 1, download_stage_initiate_authentication},
+    {"es10b_authenticate_server", 0, download_stage_authenticate_server},
+    {"es9p_authenticate_client", 1, download_stage_authenticate_client},
+    {"es10b_prepare_download", 0, download_stage_prepare_download},
+    {"es9p_get_bound_profile_package", 1, download_stage_get_bound_profile_package},
+    {"es10b_load_bound_profile_package", 0, download_stage_load_bound_profile_package},
+};
+
+// Stands in for ctx->http.interface during ES9+ steps. Without a response it records the request and fails,
+// the step is then run again once the response arrived and gets it from here. The ES9+ functions only keep
+// their results on success, so the second run starts from the same state as the first.
+static int download_session_transmit(struct euicc_ctx *ctx, const char *url, uint32_t *rcode, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len, const char **headers)
+{
+    struct euicc_download_session *session = ctx->http.interface->userdata;
+
+    *rcode = 0;
+    *rx = NULL;
+    *rx_len = 0;
+
+    if (session->http.completed)
+    {
+        session->http.completed = 0;
+        if (session->http.ret < 0)
+        {
+            return -1;
+        }
+        *rcode = session->http.rcode;
+        *rx = session->http.rx;
+        *rx_len = session->http.rx_len;
+        session->http.rx = NULL;
+        session->http.rx_len = 0;
+        return 0;
+    }
+
+    euicc_free(ctx, session->http.url);
+    euicc_free(ctx, session->http.tx);
+    session->http.url = euicc_malloc(ctx, strlen(url) + 1);
+    session->http.tx = euicc_malloc(ctx, tx_len ? tx_len : 1);
+    if (session->http.url == NULL || session->http.tx == NULL)
+    {
+        return -1;
+    }
+    strcpy(session->http.url, url);
+    memcpy(session->http.tx, tx, tx_len);
+    session->http.tx_len = tx_len;
+    session->http.headers = headers;
+    session->http.pending = 1;
+
+    return -1;
+}
+
+int euicc_download_session_init(struct euicc_download_session *session, struct euicc_ctx *ctx, const char *matchingId, const char *imei, const char *confirmationCode)
+{
+    memset(session, 0, sizeof(struct euicc_download_session));
+    session->ctx = ctx;
+
+    if (ctx->http.server_address == NULL)
+    {
+        return -1;
+    }
+
+    session->matchingId = matchingId;
+    session->imei = imei;
+    session->confirmationCode = confirmationCode;
+    session->stage = EUICC_DOWNLOAD_STAGE_GET_EUICC_CHALLENGE_AND_INFO;
+    session->result.bppCommandId = ES10B_BPP_COMMAND_ID_UNDEFINED;
+    session->result.errorReason = ES10B_ERROR_REASON_UNDEFINED;
+
+    session->http.interface.transmit = download_session_transmit;
+    session->http.interface.userdata = session;
+
+    return 0;
+}
+
+static enum euicc_download_session_state euicc_download_session_state(const struct euicc_download_session *session)
+{
+    if (session->failed)
+    {
+        return EUICC_DOWNLOAD_SESSION_ERROR;
+    }
+    if (session->http.pending)
+    {
+        return EUICC_DOWNLOAD_SESSION_WANT_HTTP;
+    }
+    if (session->stage >= EUICC_DOWNLOAD_STAGE_DONE)
+    {
+        return EUICC_DOWNLOAD_SESSION_DONE;
+    }
+    return download_stages[session->stage].http ? EUICC_DOWNLOAD_SESSION_WANT_HTTP : EUICC_DOWNLOAD_SESSION_WANT_CARD;
+}
+
+enum euicc_download_session_state euicc_download_session_step(struct euicc_download_session *session)
+{
+    const struct euicc_http_interface *http_interface = session->ctx->http.interface;
+    int ret;
+
+    if (session->failed || session->http.pending || session->stage >= EUICC_DOWNLOAD_STAGE_DONE)
+    {
+        return euicc_download_session_state(session);
+    }
+
+    if (download_stages[session->stage].http)
+    {
+        session->ctx->http.interface = &session->http.interface;
+        ret = download_stages[session->stage].run(session);
+        session->ctx->http.interface = http_interface;
+    }
+    else
+    {
+        ret = download_stages[session->stage].run(session);
+    }
+
+    if (ret < 0 && session->http.pending)
+    {
+        return EUICC_DOWNLOAD_SESSION_WANT_HTTP;
+    }
+    if (ret < 0)
+    {
+        session->failed = download_stages[session->stage].name;
+        return EUICC_DOWNLOAD_SESSION_ERROR;
+    }
+
+    session->stage++;
+    return euicc_download_session_state(session);
+}
+
+void euicc_download_session_http_request(const struct euicc_download_session *session, const char **url, const uint8_t **tx, uint32_t *tx_len, const char *const **headers)
+{
+    *url = session->http.url;
+    *tx = session->http.tx;
+    *tx_len = session->http.tx_len;
+    *headers = (const char *const *)session->http.headers;
+}
+
+int euicc_download_session_http_complete(struct euicc_download_session *session, int ret, uint32_t rcode, const uint8_t *rx, uint32_t rx_len)
+{
+    if (!session->http.pending)
+    {
+        return -1;
+    }
+
+    free(session->http.rx);
+    session->http.rx = NULL;
+    session->http.rx_len = 0;
+
+    if (ret >= 0)
+    {
+        // One more byte, es9p terminates the body in place. From malloc, es9p frees it like any transport response.
+        session->http.rx = malloc(rx_len + 1);
+        if (session->http.rx == NULL)
+        {
+            return -1;
+        }
+        memcpy(session->http.rx, rx, rx_len);
+        session->http.rx_len = rx_len;
+    }
+
+    session->http.ret = ret;
+    session->http.rcode = rcode;
+    session->http.pending = 0;
+    session->http.completed = 1;
+
+    return 0;
+}
+
+const char *euicc_download_session_stage2str(const struct euicc_download_session *session)
+{
+    if (session->stage >= EUICC_DOWNLOAD_STAGE_DONE)
+    {
+        return NULL;
+    }
+    return download_stages[session->stage].name;
+}
+
+int euicc_download_cancel(struct euicc_ctx *ctx, enum es10b_cancel_session_reason reason)
+{
+    int fret = 0;
+    uint64_t deadline_us = ctx->deadline_us;
+    int (*cancel)(struct euicc_ctx *ctx) = ctx->cancel;
+
+    if (ctx->http._internal.transaction_id_bin == NULL)
+    {
+        return 0;
+    }
+
+    euicc_deadline_set(ctx, EUICC_DOWNLOAD_CANCEL_GRACE_MS);
+    ctx->cancel = NULL;
+
+    if (es10b_cancel_session(ctx, reason) < 0 || es9p_cancel_session(ctx) < 0)
+    {
+        fret = -1;
+    }
+
+    ctx->deadline_us = deadline_us;
+    ctx->cancel = cancel;
+
+    return fret;
+}
+
+void euicc_download_session_free(struct euicc_download_session *session)
+{
+    euicc_free(session->ctx, session->http.url);
+    euicc_free(session->ctx, session->http.tx);
+    free(session->http.rx);
+    memset(&session->http, 0, sizeof(session->http));
+}
+
+static void download_progress(struct euicc_ctx *ctx, const struct euicc_download_params *params, const char *step, int done)
+{
+    if (params->progress)
+    {
+        params->progress(ctx, step, done, params->userdata);
+    }
+}
+
+// Tells the eUICC, and the SM-DP+ once the eUICC signed it, that the session ends here
+static int download_cancel_session(struct euicc_ctx *ctx, const struct euicc_download_params *params, enum es10b_cancel_session_reason reason)
+{
+    download_progress(ctx, params, "es10b_cancel_session", 0);
+    if (es10b_cancel_session(ctx, reason))
+    {
+        return -1;
+    }
+    download_progress(ctx, params, "es10b_cancel_session", 1);
+
+    download_progress(ctx, params, "es9p_cancel_session", 0);
+    if (es9p_cancel_session(ctx))
+    {
+        return -1;
+    }
+    download_progress(ctx, params, "es9p_cancel_session", 1);
+
+    return 0;
+}
+
+int euicc_download(struct euicc_ctx *ctx, const struct euicc_download_params *params, struct es10b_load_bound_profile_package_result *result, const char **failed)
+{
+    int fret = 0;
+    struct es10c_ex_euiccinfo2 euiccinfo2 = {0};
+    uint32_t bpp_max_length = ctx->http.bpp_max_length;
+    int cancelled = 0;
+    int ret;
+
+    *failed = NULL;
+    memset(result, 0, sizeof(*result));
+
+    // DNS, TCP and TLS to the SM-DP+ run while the eUICC answers
+    es9p_prepare(ctx);
+
+    download_progress(ctx, params, "es10b_get_euicc_challenge_and_info", 0);
+    if (es10b_get_euicc_challenge_and_info(ctx))
+    {
+        *failed = "es10b_get_euicc_challenge_and_info";
+        goto err;
+    }
+    download_progress(ctx, params, "es10b_get_euicc_challenge_and_info", 1);
+
+    download_progress(ctx, params, "es9p_initiate_authentication", 0);
+    if (es9p_initiate_authentication(ctx))
+    {
+        *failed = "es9p_initiate_authentication";
+        goto err;
+    }
+    download_progress(ctx, params, "es9p_initiate_authentication", 1);
+
+    download_progress(ctx, params, "es10b_authenticate_server", 0);
+    if (es10b_authenticate_server(ctx, params->matchingId, params->imei))
+    {
+        *failed = "es10b_authenticate_server";
+        goto err;
+    }
+    download_progress(ctx, params, "es10b_authenticate_server", 1);
+
+    download_progress(ctx, params, "es9p_authenticate_client", 0);
+    if (es9p_authenticate_client(ctx))
+    {
+        *failed = "es9p_authenticate_client";
+        goto err;
+    }
+    download_progress(ctx, params, "es9p_authenticate_client", 1);
+
+    if (params->metadata)
+    {
+        const struct euicc_blob *profileMetadata = &ctx->http._internal.prepare_download_param->profileMetadata;
+        struct es10c_profile_metadata metadata;
+        int declined;
+
+        if (es10c_profile_metadata_decode(&metadata, profileMetadata->data, profileMetadata->length))
+        {
+            *failed = "es10c_profile_metadata_decode";
+            goto err;
+        }
+        declined = params->metadata(ctx, &metadata, params->userdata);
+        es10c_profile_metadata_free(&metadata);
+        if (declined)
+        {
+            cancelled = 1;
+            if (download_cancel_session(ctx, params, ES10B_CANCEL_SESSION_REASON_ENDUSERREJECTION))
+            {
+                *failed = "es10b_cancel_session";
+                goto err;
+            }
+            fret = 1;
+            goto exit;
+        }
+    }
+
+    download_progress(ctx, params, "es10b_prepare_download", 0);
+    if (es10b_prepare_download(ctx, params->confirmationCode))
+    {
+        *failed = "es10b_prepare_download";
+        goto err;
+    }
+    download_progress(ctx, params, "es10b_prepare_download", 1);
+
+    // A package larger than the free memory is refused from its header, before the download and the STORE DATA commands
+    // that would end in an insufficient memory error. A card without EUICCInfo2 loads without the check.
+    if (bpp_max_length == 0)
+    {
+        download_progress(ctx, params, "es10c_ex_get_euiccinfo2", 0);
+        if (es10c_ex_get_euiccinfo2(ctx, &euiccinfo2) == 0)
+        {
+            ctx->http.bpp_max_length = euiccinfo2.extCardResource.freeNonVolatileMemory;
+            download_progress(ctx, params, "es10c_ex_get_euiccinfo2", 1);
+        }
+    }
+
+    // The package is sent to the eUICC while it is still downloading, so both steps run at once
+    download_progress(ctx, params, "es9p_get_bound_profile_package", 0);
+    download_progress(ctx, params, "es10b_load_bound_profile_package", 0);
+    ret = es9p_get_and_load_bound_profile_package(ctx, result);
+    if (ret == -1)
+    {
+        *failed = "es9p_get_bound_profile_package";
+        goto err;
+    }
+    if (ret < 0)
+    {
+        *failed = "es10b_load_bound_profile_package";
+        fret = ret;
+    }
+    if (ret == -3 || ret == -4)
+    {
+        cancelled = 1;
+        download_cancel_session(ctx, params, ES10B_CANCEL_SESSION_REASON_POSTPONED);
+    }
+    if (ret < 0)
+    {
+        goto exit;
+    }
+    download_progress(ctx, params, "es9p_get_bound_profile_package", 1);
+    download_progress(ctx, params, "es10b_load_bound_profile_package", 1);
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    // Cut short, the eUICC and the SM-DP+ are told so the session does not linger on either
+    if (fret < 0 && !cancelled && euicc_aborted(ctx))
+    {
+        euicc_download_cancel(ctx, ES10B_CANCEL_SESSION_REASON_TIMEOUT);
+    }
+    ctx->http.bpp_max_length = bpp_max_length;
+    es10c_ex_euiccinfo2_free(&euiccinfo2);
+    return fret;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <inttypes.h>
+#include "euicc.h"
+#include "interface.h"
+#include "es10b.h"
+#include "es10c.h"
+
+// What euicc_download_session_step needs before it can be called again
+enum euicc_download_session_state
+{
+    EUICC_DOWNLOAD_SESSION_WANT_CARD,  // The next step sends ES10x commands to the eUICC
+    EUICC_DOWNLOAD_SESSION_WANT_HTTP,  // A request is pending, see euicc_download_session_http_request
+    EUICC_DOWNLOAD_SESSION_DONE,       // The profile is installed
+    EUICC_DOWNLOAD_SESSION_ERROR,      // failed names the function, result holds a load error
+};
+
+// A profile download that the caller drives one step at a time. Steps that need the network return WANT_HTTP
+// instead of blocking on ctx->http.interface, and the caller may answer from any event loop. Card steps run on
+// ctx->apdu.interface, one ES10x function per step, so sessions on different cards can take turns on one thread.
+// ctx->http.server_address must be set and ctx->http.interface is only borrowed while a step runs.
+struct euicc_download_session
+{
+    struct euicc_ctx *ctx;
+    const char *matchingId;
+    const char *imei;
+    const char *confirmationCode;
+    uint8_t stage;
+    const char *failed;
+    struct es10b_load_bound_profile_package_result result;
+    struct
+    {
+        struct euicc_http_interface interface;
+        char *url;
+        uint8_t *tx;
+        uint32_t tx_len;
+        const char **headers;
+        int ret;
+        uint8_t *rx;
+        uint32_t rx_len;
+        uint32_t rcode;
+        uint8_t pending;
+        uint8_t completed;
+    } http;
+};
+
+int euicc_download_session_init(struct euicc_download_session *session, struct euicc_ctx *ctx, const char *matchingId, const char *imei, const char *confirmationCode);
+// Runs the next step, ctx->http status and the ES9+ state are left as the blocking calls leave them
+enum euicc_download_session_state euicc_download_session_step(struct euicc_download_session *session);
+// The request to send after a WANT_HTTP step, as a POST with headers. Valid until the next step.
+void euicc_download_session_http_request(const struct euicc_download_session *session, const char **url, const uint8_t **tx, uint32_t *tx_len, const char *const **headers);
+// Hands over the response, rx is copied. A negative ret reports a transport failure, the next step then fails.
+int euicc_download_session_http_complete(struct euicc_download_session *session, int ret, uint32_t rcode, const uint8_t *rx, uint32_t rx_len);
+// Name of the step that runs next, for progress output
+const char *euicc_download_session_stage2str(const struct euicc_download_session *session);
+void euicc_download_session_free(struct euicc_download_session *session);
+
+// Ends the download that ctx->http holds, on the eUICC and at the SM-DP+, through the blocking interfaces. For a
+// download cut short by ctx->deadline_us or ctx->cancel: both are lifted for EUICC_DOWNLOAD_CANCEL_GRACE_MS meanwhile.
+// Does nothing before initiateAuthentication.
+#define EUICC_DOWNLOAD_CANCEL_GRACE_MS 10000
+int euicc_download_cancel(struct euicc_ctx *ctx, enum es10b_cancel_session_reason reason);
+
+// The whole download that lpac profile download runs, on the blocking interfaces, for callers without an event loop.
+// ctx->http.server_address must be set. progress, when set, is called with done 0 before every step and with done 1
+// after it succeeded, steps named as by euicc_download_session_stage2str plus es10c_ex_get_euiccinfo2, which sizes
+// ctx->http.bpp_max_length when it is 0, and es10b_cancel_session and es9p_cancel_session. The package is loaded while
+// it downloads, es9p_get_bound_profile_package and es10b_load_bound_profile_package begin together.
+struct euicc_download_params
+{
+    const char *matchingId;
+    const char *imei;
+    const char *confirmationCode;
+    void (*progress)(struct euicc_ctx *ctx, const char *step, int done, void *userdata);
+    // Optional, shown the profile once es9p_authenticate_client brought its metadata, before the eUICC is asked to
+    // prepare the download. A nonzero return declines it and the session is cancelled as an end user rejection.
+    int (*metadata)(struct euicc_ctx *ctx, const struct es10c_profile_metadata *metadata, void *userdata);
+    void *userdata;
+};
+
+// Returns 0 with the profile installed and 1 when metadata declined it. Otherwise failed names the step, result holds a load error and the return
+// value is that of es9p_get_and_load_bound_profile_package for the load, -1 for any other step. A package refused
+// for its size is cancelled as postponed, a download cut short by ctx->deadline_us or ctx->cancel as timed out.
+int euicc_download(struct euicc_ctx *ctx, const struct euicc_download_params *params, struct es10b_load_bound_profile_package_result *result, const char **failed);
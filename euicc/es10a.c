@@ -9,14 +9,12 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include "pool.private.h"
 
 int es10a_get_euicc_configured_addresses(struct euicc_ctx *ctx, struct es10a_euicc_configured_addresses *address)
 {
     int fret = 0;
-    struct euicc_derutil_node n_request = {
-        .tag = 0xBF3C, // EuiccConfiguredAddressesRequest
-    };
-    uint32_t reqlen;
+    unsigned reqlen;
     uint8_t *respbuf = NULL;
     unsigned resplen;
 
@@ -24,18 +22,14 @@ int es10a_get_euicc_configured_addresses(struct euicc_ctx *ctx, struct es10a_eui
 
     memset(address, 0, sizeof(*address));
 
-    reqlen = sizeof(ctx->apdu._internal.request_buffer.body);
-    if (euicc_derutil_pack(ctx->apdu._internal.request_buffer.body, &reqlen, &n_request))
-    {
-        goto err;
-    }
+    reqlen = es10x_template_emit(ctx, ES10X_TEMPLATE_CONFIGURED_ADDRESSES, NULL, NULL);
 
     if (es10x_command(ctx, &respbuf, &resplen, ctx->apdu._internal.request_buffer.body, reqlen) < 0)
     {
         goto err;
     }
 
-    if (euicc_derutil_unpack_find_tag(&n_Response, n_request.tag, respbuf, resplen))
+    if (euicc_derutil_unpack_find_tag(&n_Response, 0xBF3C, respbuf, resplen))
     {
         goto err;
     }
@@ -69,8 +63,6 @@ err:
     free(address->rootDsAddress);
     address->rootDsAddress = NULL;
 exit:
-    free(respbuf);
-    respbuf = NULL;
     return fret;
 }
 
@@ -121,8 +113,6 @@ int es10a_set_default_dp_address(struct euicc_ctx *ctx, const char *smdp)
 err:
     fret = -1;
 exit:
-    free(respbuf);
-    respbuf = NULL;
     return fret;
 }
 
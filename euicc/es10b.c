@@ -1,18 +1,33 @@
 #include "euicc.private.h"
-#include "es10b.h"
+#include "es10b.private.h"
 
 #include "derutil.h"
 #include "hexutil.h"
 #include "base64.h"
 #include "sha256.h"
+#include "derschema.h"
 
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include "pool.private.h"
 
-int es10b_prepare_download_r(struct euicc_ctx *ctx, char **b64_PrepareDownloadResponse, struct es10b_prepare_download_param *param, struct es10b_prepare_download_param_user *param_user)
+static int es10b_blob_set(struct euicc_blob *blob, const uint8_t *data, uint32_t length)
+{
+    blob->data = malloc(length ? length : 1);
+    if (!blob->data)
+    {
+        blob->length = 0;
+        return -1;
+    }
+    memcpy(blob->data, data, length);
+    blob->length = length;
+    return 0;
+}
+
+int es10b_prepare_download_r(struct euicc_ctx *ctx, struct euicc_blob *PrepareDownloadResponse, struct es10b_prepare_download_param *param, struct es10b_prepare_download_param_user *param_user)
 {
     int fret = 0;
     uint8_t *reqbuf = NULL;
@@ -23,11 +38,9 @@ int es10b_prepare_download_r(struct euicc_ctx *ctx, char **b64_PrepareDownloadRe
     EUICC_SHA256_CTX sha256ctx;
     uint8_t hashCC[SHA256_BLOCK_SIZE];
 
-    uint8_t *smdpSigned2 = NULL, *smdpSignature2 = NULL, *smdpCertificate = NULL;
-    int smdpSigned2_len, smdpSignature2_len, smdpCertificate_len;
     struct euicc_derutil_node n_request, n_smdpSigned2, n_smdpSignature2, n_smdpCertificate, n_hashCc, n_transactionId, n_ccRequiredFlag;
 
-    *b64_PrepareDownloadResponse = NULL;
+    memset(PrepareDownloadResponse, 0, sizeof(*PrepareDownloadResponse));
 
     memset(&n_request, 0, sizeof(n_request));
     memset(&n_smdpSigned2, 0, sizeof(n_smdpSigned2));
@@ -35,50 +48,17 @@ int es10b_prepare_download_r(struct euicc_ctx *ctx, char **b64_PrepareDownloadRe
     memset(&n_smdpCertificate, 0, sizeof(n_smdpCertificate));
     memset(&n_hashCc, 0, sizeof(n_hashCc));
 
-    smdpSigned2 = malloc(euicc_base64_decode_len(param->b64_smdpSigned2));
-    if (!smdpSigned2)
-    {
-        goto err;
-    }
-
-    smdpSignature2 = malloc(euicc_base64_decode_len(param->b64_smdpSignature2));
-    if (!smdpSignature2)
-    {
-        goto err;
-    }
-
-    smdpCertificate = malloc(euicc_base64_decode_len(param->b64_smdpCertificate));
-    if (!smdpCertificate)
-    {
-        goto err;
-    }
-
-    if ((smdpSigned2_len = euicc_base64_decode(smdpSigned2, param->b64_smdpSigned2)) < 0)
-    {
-        goto err;
-    }
-
-    if ((smdpSignature2_len = euicc_base64_decode(smdpSignature2, param->b64_smdpSignature2)) < 0)
-    {
-        goto err;
-    }
-
-    if ((smdpCertificate_len = euicc_base64_decode(smdpCertificate, param->b64_smdpCertificate)) < 0)
-    {
-        goto err;
-    }
-
-    if (euicc_derutil_unpack_find_tag(&n_smdpSigned2, 0x30, smdpSigned2, smdpSigned2_len) < 0)
+    if (euicc_derutil_unpack_find_tag(&n_smdpSigned2, 0x30, param->smdpSigned2.data, param->smdpSigned2.length) < 0)
     {
         goto err;
     }
 
-    if (euicc_derutil_unpack_find_tag(&n_smdpSignature2, 0x5F37, smdpSignature2, smdpSignature2_len) < 0)
+    if (euicc_derutil_unpack_find_tag(&n_smdpSignature2, 0x5F37, param->smdpSignature2.data, param->smdpSignature2.length) < 0)
     {
         goto err;
     }
 
-    if (euicc_derutil_unpack_find_tag(&n_smdpCertificate, 0x30, smdpCertificate, smdpCertificate_len) < 0)
+    if (euicc_derutil_unpack_find_tag(&n_smdpCertificate, 0x30, param->smdpCertificate.data, param->smdpCertificate.length) < 0)
     {
         goto err;
     }
@@ -132,13 +112,6 @@ int es10b_prepare_download_r(struct euicc_ctx *ctx, char **b64_PrepareDownloadRe
         goto err;
     }
 
-    free(smdpSigned2);
-    smdpSigned2 = NULL;
-    free(smdpSignature2);
-    smdpSignature2 = NULL;
-    free(smdpCertificate);
-    smdpCertificate = NULL;
-
     if (es10x_command(ctx, &respbuf, &resplen, reqbuf, reqlen) < 0)
     {
         goto err;
@@ -147,13 +120,7 @@ int es10b_prepare_download_r(struct euicc_ctx *ctx, char **b64_PrepareDownloadRe
     free(reqbuf);
     reqbuf = NULL;
 
-    *b64_PrepareDownloadResponse = malloc(euicc_base64_encode_len(resplen));
-    if (!(*b64_PrepareDownloadResponse))
-    {
-        goto err;
-    }
-
-    if (euicc_base64_encode(*b64_PrepareDownloadResponse, respbuf, resplen) < 0)
+    if (es10b_blob_set(PrepareDownloadResponse, respbuf, resplen) < 0)
     {
         goto err;
     }
@@ -164,36 +131,20 @@ int es10b_prepare_download_r(struct euicc_ctx *ctx, char **b64_PrepareDownloadRe
 
 err:
     fret = -1;
-    free(*b64_PrepareDownloadResponse);
-    *b64_PrepareDownloadResponse = NULL;
+    euicc_blob_free(PrepareDownloadResponse);
 exit:
-    free(smdpSigned2);
-    smdpSigned2 = NULL;
-    free(smdpSignature2);
-    smdpSignature2 = NULL;
-    free(smdpCertificate);
-    smdpCertificate = NULL;
     free(reqbuf);
     reqbuf = NULL;
-    free(respbuf);
-    respbuf = NULL;
     return fret;
 }
 
-static int es10b_load_bound_profile_package_tx(struct euicc_ctx *ctx, struct es10b_load_bound_profile_package_result *result, const uint8_t *reqbuf, int reqbuf_len)
+static int es10b_load_bound_profile_package_parse(struct es10b_load_bound_profile_package_result *result, const uint8_t *respbuf, unsigned resplen)
 {
     int fret = 0;
-    uint8_t *respbuf = NULL;
-    unsigned resplen;
 
     result->bppCommandId = ES10B_BPP_COMMAND_ID_UNDEFINED;
     result->errorReason = ES10B_ERROR_REASON_UNDEFINED;
 
-    if (es10x_command(ctx, &respbuf, &resplen, reqbuf, reqbuf_len) < 0)
-    {
-        goto err;
-    }
-
     if (resplen > 0)
     {
         struct euicc_derutil_node tmpnode, n_finalResult;
@@ -288,127 +239,113 @@ static int es10b_load_bound_profile_package_tx(struct euicc_ctx *ctx, struct es1
 err:
     fret = -1;
 exit:
-    free(respbuf);
-    respbuf = NULL;
     return fret;
 }
 
-int es10b_load_bound_profile_package_r(struct euicc_ctx *ctx, struct es10b_load_bound_profile_package_result *result, const char *b64_BoundProfilePackage)
+static int es10b_load_bound_profile_package_tx(struct euicc_ctx *ctx, struct es10b_load_bound_profile_package_result *result, const uint8_t *reqbuf, int reqbuf_len)
 {
-    int fret = 0;
-
-    uint8_t *bpp = NULL;
-    int bpp_len;
-
-    const uint8_t *reqbuf;
-    int reqbuf_len;
-
-    struct euicc_derutil_node tmpnode, tmpchildnode, n_BoundProfilePackage;
-
-    bpp = malloc(euicc_base64_decode_len(b64_BoundProfilePackage));
-    if (!bpp)
-    {
-        goto err;
-    }
-    if ((bpp_len = euicc_base64_decode(bpp, b64_BoundProfilePackage)) < 0)
-    {
-        goto err;
-    }
+    uint8_t *respbuf = NULL;
+    unsigned resplen;
 
-    if (euicc_derutil_unpack_find_tag(&n_BoundProfilePackage, 0xBF36, bpp, bpp_len) < 0)
-    {
-        goto err;
-    }
+    result->bppCommandId = ES10B_BPP_COMMAND_ID_UNDEFINED;
+    result->errorReason = ES10B_ERROR_REASON_UNDEFINED;
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xBF23, n_BoundProfilePackage.value, n_BoundProfilePackage.length) < 0)
+    if (es10x_command(ctx, &respbuf, &resplen, reqbuf, reqbuf_len) < 0)
     {
-        goto err;
+        return -1;
     }
 
-    reqbuf = n_BoundProfilePackage.self.ptr;
-    reqbuf_len = tmpnode.self.ptr - n_BoundProfilePackage.self.ptr + tmpnode.self.length;
-
-    if (es10b_load_bound_profile_package_tx(ctx, result, reqbuf, reqbuf_len) < 0)
-    {
-        goto err;
-    }
+    return es10b_load_bound_profile_package_parse(result, respbuf, resplen);
+}
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xA0, n_BoundProfilePackage.value, n_BoundProfilePackage.length) < 0)
-    {
-        goto err;
-    }
+// Counts len more bytes of the BoundProfilePackage as sent, for ctx->progress
+static void es10b_load_bound_profile_package_progress(struct euicc_ctx *ctx, uint16_t tag, uint32_t index, uint32_t len)
+{
+    struct euicc_progress_meter *meter = &ctx->apdu._internal.progress;
 
-    reqbuf = tmpnode.self.ptr;
-    reqbuf_len = tmpnode.self.length;
+    meter->progress.tag = tag;
+    meter->progress.index = index;
+    euicc_progress_update(ctx, meter, len);
+}
 
-    if (es10b_load_bound_profile_package_tx(ctx, result, reqbuf, reqbuf_len) < 0)
-    {
-        goto err;
-    }
+// Commands of one sequence sent as a batch: its header when header is set, then elements from index first on
+struct es10b_load_bound_profile_package_batch
+{
+    struct euicc_ctx *ctx;
+    struct es10b_load_bound_profile_package_result *result;
+    const unsigned *lens;
+    uint16_t tag;
+    uint32_t first;
+    uint8_t header;
+};
+
+static int iter_es10b_load_bound_profile_package_batch(unsigned index, const uint8_t *resp, unsigned resp_len, void *userdata)
+{
+    struct es10b_load_bound_profile_package_batch *batch = userdata;
+    uint32_t element = batch->first + index;
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xA1, n_BoundProfilePackage.value, n_BoundProfilePackage.length) < 0)
+    if (es10b_load_bound_profile_package_parse(batch->result, resp, resp_len) < 0)
     {
-        goto err;
+        return -1;
     }
-
-    reqbuf = tmpnode.self.ptr;
-    reqbuf_len = tmpnode.value - tmpnode.self.ptr;
-
-    if (es10b_load_bound_profile_package_tx(ctx, result, reqbuf, reqbuf_len) < 0)
+    if (batch->header)
     {
-        goto err;
+        element = index ? element - 1 : batch->first;
     }
+    es10b_load_bound_profile_package_progress(batch->ctx, batch->tag, element, batch->lens[index]);
+    return 0;
+}
 
-    tmpchildnode.self.ptr = tmpnode.value;
+// Sends a sequence header followed by each of its elements as one batch of ES10x commands
+static int es10b_load_bound_profile_package_tx_sequence(struct euicc_ctx *ctx, struct es10b_load_bound_profile_package_result *result, const struct euicc_derutil_node *n_sequence)
+{
+    int fret = 0;
+    struct euicc_derutil_node tmpchildnode;
+    const uint8_t **reqbufs = NULL;
+    unsigned *reqbuf_lens = NULL;
+    unsigned count;
+    struct es10b_load_bound_profile_package_batch batch;
+
+    count = 1;
+    tmpchildnode.self.ptr = n_sequence->value;
     tmpchildnode.self.length = 0;
-
-    while (euicc_derutil_unpack_next(&tmpchildnode, &tmpchildnode, tmpnode.value, tmpnode.length) == 0)
-    {
-        reqbuf = tmpchildnode.self.ptr;
-        reqbuf_len = tmpchildnode.self.length;
-
-        if (es10b_load_bound_profile_package_tx(ctx, result, reqbuf, reqbuf_len) < 0)
-        {
-            goto err;
-        }
-    }
-
-    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xA2, n_BoundProfilePackage.value, n_BoundProfilePackage.length) == 0)
+    while (euicc_derutil_unpack_next(&tmpchildnode, &tmpchildnode, n_sequence->value, n_sequence->length) == 0)
     {
-        reqbuf = tmpnode.self.ptr;
-        reqbuf_len = tmpnode.self.length;
-
-        if (es10b_load_bound_profile_package_tx(ctx, result, reqbuf, reqbuf_len) < 0)
-        {
-            goto err;
-        }
+        count++;
     }
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xA3, n_BoundProfilePackage.value, n_BoundProfilePackage.length) < 0)
+    reqbufs = euicc_malloc(ctx, count * sizeof(*reqbufs));
+    reqbuf_lens = euicc_malloc(ctx, count * sizeof(*reqbuf_lens));
+    if (!reqbufs || !reqbuf_lens)
     {
         goto err;
     }
 
-    reqbuf = tmpnode.self.ptr;
-    reqbuf_len = tmpnode.value - tmpnode.self.ptr;
+    reqbufs[0] = n_sequence->self.ptr;
+    reqbuf_lens[0] = n_sequence->value - n_sequence->self.ptr;
 
-    if (es10b_load_bound_profile_package_tx(ctx, result, reqbuf, reqbuf_len) < 0)
+    count = 1;
+    tmpchildnode.self.ptr = n_sequence->value;
+    tmpchildnode.self.length = 0;
+    while (euicc_derutil_unpack_next(&tmpchildnode, &tmpchildnode, n_sequence->value, n_sequence->length) == 0)
     {
-        goto err;
+        reqbufs[count] = tmpchildnode.self.ptr;
+        reqbuf_lens[count] = tmpchildnode.self.length;
+        count++;
     }
 
-    tmpchildnode.self.ptr = tmpnode.value;
-    tmpchildnode.self.length = 0;
+    result->bppCommandId = ES10B_BPP_COMMAND_ID_UNDEFINED;
+    result->errorReason = ES10B_ERROR_REASON_UNDEFINED;
 
-    while (euicc_derutil_unpack_next(&tmpchildnode, &tmpchildnode, tmpnode.value, tmpnode.length) == 0)
+    batch.ctx = ctx;
+    batch.result = result;
+    batch.lens = reqbuf_lens;
+    batch.tag = n_sequence->tag;
+    batch.first = 0;
+    batch.header = 1;
+    if (es10x_command_batch(ctx, reqbufs, reqbuf_lens, count, iter_es10b_load_bound_profile_package_batch, &batch) < 0)
     {
-        reqbuf = tmpchildnode.self.ptr;
-        reqbuf_len = tmpchildnode.self.length;
-
-        if (es10b_load_bound_profile_package_tx(ctx, result, reqbuf, reqbuf_len) < 0)
-        {
-            goto err;
-        }
+        goto err;
     }
 
     goto exit;
@@ -416,100 +353,79 @@ int es10b_load_bound_profile_package_r(struct euicc_ctx *ctx, struct es10b_load_
 err:
     fret = -1;
 exit:
-    free(bpp);
-    bpp = NULL;
+    euicc_free(ctx, reqbufs);
+    euicc_free(ctx, reqbuf_lens);
     return fret;
 }
 
-int es10b_get_euicc_challenge_r(struct euicc_ctx *ctx, char **b64_euiccChallenge)
+int es10b_load_bound_profile_package_r(struct euicc_ctx *ctx, struct es10b_load_bound_profile_package_result *result, const struct euicc_blob *BoundProfilePackage)
 {
     int fret = 0;
-    struct euicc_derutil_node n_request = {
-        .tag = 0xBF2E, // GetEuiccDataRequest
-    };
-    uint32_t reqlen;
-    uint8_t *respbuf = NULL;
-    unsigned resplen;
 
-    struct euicc_derutil_node tmpnode;
+    const uint8_t *reqbuf;
+    int reqbuf_len;
 
-    reqlen = sizeof(ctx->apdu._internal.request_buffer.body);
-    if (euicc_derutil_pack(ctx->apdu._internal.request_buffer.body, &reqlen, &n_request))
-    {
-        goto err;
-    }
+    struct euicc_derutil_node n_BoundProfilePackage;
+    struct euicc_derutil_node n_children[8];
+    int n_children_count;
+    struct euicc_derutil_index_table n_table;
+    const struct euicc_derutil_node *n_initialiseSecureChannelRequest, *n_firstSequenceOf87, *n_sequenceOf88, *n_secondSequenceOf87, *n_sequenceOf86;
 
-    if (es10x_command(ctx, &respbuf, &resplen, ctx->apdu._internal.request_buffer.body, reqlen) < 0)
-    {
-        goto err;
-    }
+    euicc_operation(ctx, "es10b_load_bound_profile_package", 0);
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, n_request.tag, respbuf, resplen))
+    if (euicc_derutil_unpack_find_tag(&n_BoundProfilePackage, 0xBF36, BoundProfilePackage->data, BoundProfilePackage->length) < 0)
     {
         goto err;
     }
+    euicc_progress_begin(ctx, &ctx->apdu._internal.progress, EUICC_PROGRESS_LOAD, n_BoundProfilePackage.self.length);
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, 0x80, tmpnode.value, tmpnode.length))
+    n_children_count = euicc_derutil_index(n_children, sizeof(n_children) / sizeof(n_children[0]), n_BoundProfilePackage.value, n_BoundProfilePackage.length);
+    if (n_children_count < 0 || euicc_derutil_index_table_init(&n_table, n_children, n_children_count) < 0)
     {
         goto err;
     }
 
-    *b64_euiccChallenge = malloc(euicc_base64_encode_len(tmpnode.length));
-    if (!(*b64_euiccChallenge))
-    {
-        goto err;
-    }
-    if (euicc_base64_encode(*b64_euiccChallenge, tmpnode.value, tmpnode.length) < 0)
+    n_initialiseSecureChannelRequest = euicc_derutil_index_find(&n_table, 0xBF23);
+    n_firstSequenceOf87 = euicc_derutil_index_find(&n_table, 0xA0);
+    n_sequenceOf88 = euicc_derutil_index_find(&n_table, 0xA1);
+    n_secondSequenceOf87 = euicc_derutil_index_find(&n_table, 0xA2);
+    n_sequenceOf86 = euicc_derutil_index_find(&n_table, 0xA3);
+
+    if (!n_initialiseSecureChannelRequest || !n_firstSequenceOf87 || !n_sequenceOf88 || !n_sequenceOf86)
     {
         goto err;
     }
 
-    goto exit;
-
-err:
-    fret = -1;
-    free(*b64_euiccChallenge);
-    *b64_euiccChallenge = NULL;
-exit:
-    free(respbuf);
-    respbuf = NULL;
-    return fret;
-}
-
-int es10b_get_euicc_info_r(struct euicc_ctx *ctx, char **b64_EUICCInfo1)
-{
-    int fret = 0;
-    struct euicc_derutil_node n_request = {
-        .tag = 0xBF20, // GetEuiccInfo1Request
-    };
-    uint32_t reqlen;
-    uint8_t *respbuf = NULL;
-    unsigned resplen;
-
-    struct euicc_derutil_node tmpnode;
+    reqbuf = n_BoundProfilePackage.self.ptr;
+    reqbuf_len = n_initialiseSecureChannelRequest->self.ptr - n_BoundProfilePackage.self.ptr + n_initialiseSecureChannelRequest->self.length;
 
-    reqlen = sizeof(ctx->apdu._internal.request_buffer.body);
-    if (euicc_derutil_pack(ctx->apdu._internal.request_buffer.body, &reqlen, &n_request))
+    if (es10b_load_bound_profile_package_tx(ctx, result, reqbuf, reqbuf_len) < 0)
     {
         goto err;
     }
+    es10b_load_bound_profile_package_progress(ctx, 0xBF23, 0, reqbuf_len);
 
-    if (es10x_command(ctx, &respbuf, &resplen, ctx->apdu._internal.request_buffer.body, reqlen) < 0)
+    if (es10b_load_bound_profile_package_tx(ctx, result, n_firstSequenceOf87->self.ptr, n_firstSequenceOf87->self.length) < 0)
     {
         goto err;
     }
+    es10b_load_bound_profile_package_progress(ctx, 0xA0, 0, n_firstSequenceOf87->self.length);
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, n_request.tag, respbuf, resplen))
+    if (es10b_load_bound_profile_package_tx_sequence(ctx, result, n_sequenceOf88) < 0)
     {
         goto err;
     }
 
-    *b64_EUICCInfo1 = malloc(euicc_base64_encode_len(tmpnode.self.length));
-    if (!(*b64_EUICCInfo1))
+    if (n_secondSequenceOf87)
     {
-        goto err;
+        if (es10b_load_bound_profile_package_tx(ctx, result, n_secondSequenceOf87->self.ptr, n_secondSequenceOf87->self.length) < 0)
+        {
+            goto err;
+        }
+        es10b_load_bound_profile_package_progress(ctx, 0xA2, 0, n_secondSequenceOf87->self.length);
     }
-    if (euicc_base64_encode(*b64_EUICCInfo1, tmpnode.self.ptr, tmpnode.self.length) < 0)
+
+    if (es10b_load_bound_profile_package_tx_sequence(ctx, result, n_sequenceOf86) < 0)
     {
         goto err;
     }
@@ -518,197 +434,545 @@ int es10b_get_euicc_info_r(struct euicc_ctx *ctx, char **b64_EUICCInfo1)
 
 err:
     fret = -1;
-    free(*b64_EUICCInfo1);
-    *b64_EUICCInfo1 = NULL;
 exit:
-    free(respbuf);
-    respbuf = NULL;
+    euicc_progress_end(ctx, &ctx->apdu._internal.progress);
+    euicc_operation(ctx, "es10b_load_bound_profile_package", 1);
     return fret;
 }
 
-int es10b_authenticate_server_r(struct euicc_ctx *ctx, uint8_t **transaction_id, uint32_t *transaction_id_len, char **b64_AuthenticateServerResponse, struct es10b_authenticate_server_param *param, struct es10b_authenticate_server_param_user *param_user)
-{
-    int fret = 0;
-    uint8_t *reqbuf = NULL;
-    uint32_t reqlen;
-    uint8_t *respbuf = NULL;
-    unsigned resplen;
-
-    uint8_t imei[8];
-    uint8_t *serverSigned1 = NULL, *serverSignature1 = NULL, *euiccCiPKIdToBeUsed = NULL, *serverCertificate = NULL;
-    int serverSigned1_len, serverSignature1_len, euiccCiPKIdToBeUsed_len, serverCertificate_len;
-    struct euicc_derutil_node n_request, n_serverSigned1, n_transactionId, n_serverSignature1, n_euiccCiPKIdToBeUsed, n_serverCertificate, n_CtxParams1, n_matchingId, n_deviceInfo, n_tac, n_deviceCapabilities, n_imei;
-
-    *transaction_id = NULL;
-    *transaction_id_len = 0;
-    *b64_AuthenticateServerResponse = NULL;
-
-    memset(&n_request, 0, sizeof(n_request));
-    memset(&n_serverSigned1, 0, sizeof(n_serverSigned1));
-    memset(&n_serverSignature1, 0, sizeof(n_serverSignature1));
-    memset(&n_euiccCiPKIdToBeUsed, 0, sizeof(n_euiccCiPKIdToBeUsed));
-    memset(&n_serverCertificate, 0, sizeof(n_serverCertificate));
-    memset(&n_CtxParams1, 0, sizeof(n_CtxParams1));
-    memset(&n_matchingId, 0, sizeof(n_matchingId));
-    memset(&n_deviceInfo, 0, sizeof(n_deviceInfo));
-    memset(&n_tac, 0, sizeof(n_tac));
-    memset(&n_deviceCapabilities, 0, sizeof(n_deviceCapabilities));
-    memset(&n_imei, 0, sizeof(n_imei));
+// Bytes of sequence elements the stream sends to the eUICC in one transmit_batch
+#define ES10B_BPP_STREAM_BATCH_MAX 16384
 
-    serverSigned1 = malloc(euicc_base64_decode_len(param->b64_serverSigned1));
-    if (!serverSigned1)
+enum es10b_bpp_stage
+{
+    ES10B_BPP_STAGE_START,
+    ES10B_BPP_STAGE_INITIALISE_SECURE_CHANNEL,
+    ES10B_BPP_STAGE_FIRST_SEQUENCE_OF_87,
+    ES10B_BPP_STAGE_SEQUENCE_OF_88,
+    ES10B_BPP_STAGE_SECOND_SEQUENCE_OF_87,
+    ES10B_BPP_STAGE_SEQUENCE_OF_86,
+};
+
+static int es10b_load_bound_profile_package_stream_stage(struct es10b_load_bound_profile_package_stream *stream, enum es10b_bpp_stage from_min, enum es10b_bpp_stage from_max, enum es10b_bpp_stage to)
+{
+    if (stream->stage < from_min || stream->stage > from_max)
     {
-        goto err;
+        return -1;
     }
+    stream->stage = to;
+    return 0;
+}
 
-    serverSignature1 = malloc(euicc_base64_decode_len(param->b64_serverSignature1));
-    if (!serverSignature1)
+// Length of the value behind a one or two byte tag
+static uint32_t es10b_load_bound_profile_package_stream_length(const uint8_t *header, uint8_t header_len)
+{
+    uint32_t length = 0;
+    uint8_t pos = (header[0] & 0x1F) == 0x1F ? 2 : 1;
+    uint8_t n;
+
+    if (header_len < pos + 1)
     {
-        goto err;
+        return 0;
     }
-
-    euiccCiPKIdToBeUsed = malloc(euicc_base64_decode_len(param->b64_euiccCiPKIdToBeUsed));
-    if (!euiccCiPKIdToBeUsed)
+    if (!(header[pos] & 0x80))
     {
-        goto err;
+        return header[pos];
     }
 
-    serverCertificate = malloc(euicc_base64_decode_len(param->b64_serverCertificate));
-    if (!serverCertificate)
+    n = header[pos] & 0x7F;
+    for (uint8_t i = 0; i < n && pos + 1 + i < header_len; i++)
     {
-        goto err;
+        length = (length << 8) | header[pos + 1 + i];
     }
+    return length;
+}
 
-    if ((serverSigned1_len = euicc_base64_decode(serverSigned1, param->b64_serverSigned1)) < 0)
+// The stream buffers a TLV it hands over whole, element_max bounds that buffer
+static int es10b_load_bound_profile_package_stream_whole(struct es10b_load_bound_profile_package_stream *stream, const uint8_t *header, uint8_t header_len)
+{
+    if (stream->element_max && header_len + es10b_load_bound_profile_package_stream_length(header, header_len) > stream->element_max)
     {
-        goto err;
+        stream->oversized = 1;
+        return -1;
     }
+    return 0;
+}
+
+// Sends the queued elements, in order, as one batch of ES10x commands
+static int es10b_load_bound_profile_package_stream_flush(struct es10b_load_bound_profile_package_stream *stream)
+{
+    const uint8_t **reqbufs;
+    const uint8_t *ptr;
+    struct es10b_load_bound_profile_package_batch batch;
+    int ret;
 
-    if ((serverSignature1_len = euicc_base64_decode(serverSignature1, param->b64_serverSignature1)) < 0)
+    if (stream->batch_count == 0)
     {
-        goto err;
+        return 0;
     }
 
-    if ((euiccCiPKIdToBeUsed_len = euicc_base64_decode(euiccCiPKIdToBeUsed, param->b64_euiccCiPKIdToBeUsed)) < 0)
+    reqbufs = euicc_malloc(stream->ctx, stream->batch_count * sizeof(*reqbufs));
+    if (reqbufs == NULL)
     {
-        goto err;
+        return -1;
     }
-
-    if ((serverCertificate_len = euicc_base64_decode(serverCertificate, param->b64_serverCertificate)) < 0)
+    ptr = stream->batch;
+    for (unsigned i = 0; i < stream->batch_count; i++)
     {
-        goto err;
+        reqbufs[i] = ptr;
+        ptr += stream->batch_lens[i];
     }
 
-    if (euicc_derutil_unpack_find_tag(&n_serverSigned1, 0x30, serverSigned1, serverSigned1_len) < 0)
+    batch.ctx = stream->ctx;
+    batch.result = stream->result;
+    batch.lens = stream->batch_lens;
+    batch.tag = stream->tag;
+    batch.first = stream->element - stream->batch_count;
+    batch.header = 0;
+
+    stream->result->bppCommandId = ES10B_BPP_COMMAND_ID_UNDEFINED;
+    stream->result->errorReason = ES10B_ERROR_REASON_UNDEFINED;
+    ret = es10x_command_batch(stream->ctx, reqbufs, stream->batch_lens, stream->batch_count, iter_es10b_load_bound_profile_package_batch, &batch);
+
+    euicc_free(stream->ctx, reqbufs);
+    stream->batch_len = 0;
+    stream->batch_count = 0;
+    return ret;
+}
+
+// An element of sequenceOf88 or sequenceOf86, the stream only keeps it until it returns
+static int es10b_load_bound_profile_package_stream_element(struct es10b_load_bound_profile_package_stream *stream, const uint8_t *reqbuf, uint32_t reqbuf_len)
+{
+    if (stream->batch_max == 0 || reqbuf_len > stream->batch_max)
     {
-        goto err;
+        if (es10b_load_bound_profile_package_stream_flush(stream) < 0)
+        {
+            return -1;
+        }
+        if (es10b_load_bound_profile_package_tx(stream->ctx, stream->result, reqbuf, reqbuf_len) < 0)
+        {
+            return -1;
+        }
+        es10b_load_bound_profile_package_progress(stream->ctx, stream->tag, stream->element++, reqbuf_len);
+        return 0;
     }
 
-    if (euicc_derutil_unpack_find_tag(&n_transactionId, 0x80, n_serverSigned1.value, n_serverSigned1.length) < 0)
+    if (stream->batch_len + reqbuf_len > stream->batch_max)
     {
-        goto err;
+        if (es10b_load_bound_profile_package_stream_flush(stream) < 0)
+        {
+            return -1;
+        }
     }
 
-    if (euicc_derutil_unpack_find_tag(&n_serverSignature1, 0x5F37, serverSignature1, serverSignature1_len) < 0)
+    if (stream->batch_len + reqbuf_len > stream->batch_capacity)
     {
-        goto err;
+        uint8_t *batch_new = euicc_realloc(stream->ctx, stream->batch, stream->batch_max);
+        if (batch_new == NULL)
+        {
+            return -1;
+        }
+        stream->batch = batch_new;
+        stream->batch_capacity = stream->batch_max;
     }
-
-    if (euicc_derutil_unpack_find_tag(&n_euiccCiPKIdToBeUsed, 0x04, euiccCiPKIdToBeUsed, euiccCiPKIdToBeUsed_len) < 0)
+    if (stream->batch_count == stream->batch_lens_capacity)
     {
-        goto err;
+        unsigned capacity = stream->batch_lens_capacity ? stream->batch_lens_capacity * 2 : 16;
+        unsigned *batch_lens_new = euicc_realloc(stream->ctx, stream->batch_lens, capacity * sizeof(*batch_lens_new));
+        if (batch_lens_new == NULL)
+        {
+            return -1;
+        }
+        stream->batch_lens = batch_lens_new;
+        stream->batch_lens_capacity = capacity;
     }
 
-    if (euicc_derutil_unpack_find_tag(&n_serverCertificate, 0x30, serverCertificate, serverCertificate_len) < 0)
+    memcpy(stream->batch + stream->batch_len, reqbuf, reqbuf_len);
+    stream->batch_len += reqbuf_len;
+    stream->batch_lens[stream->batch_count++] = reqbuf_len;
+    stream->element++;
+    return 0;
+}
+
+// Decides which containers are entered, the sequences of 88 and 86 are sent header first and then element by element
+static int select_es10b_load_bound_profile_package_stream(uint16_t tag, const uint8_t *header, uint8_t header_len, uint8_t depth, void *userdata)
+{
+    struct es10b_load_bound_profile_package_stream *stream = userdata;
+
+    if (depth == 0)
     {
-        goto err;
+        if (tag != 0xBF36) // BoundProfilePackage
+        {
+            return -1;
+        }
+        if (stream->max_length && es10b_load_bound_profile_package_stream_length(header, header_len) > stream->max_length)
+        {
+            stream->refused = 1;
+            stream->result->errorReason = ES10B_ERROR_REASON_INSTALL_FAILED_DUE_TO_INSUFFICIENT_MEMORY_FOR_PROFILE;
+            return -1;
+        }
+        memcpy(stream->header, header, header_len);
+        stream->header_len = header_len;
+        stream->ctx->apdu._internal.progress.progress.total = header_len + es10b_load_bound_profile_package_stream_length(header, header_len);
+        return 1;
     }
 
-    *transaction_id_len = n_transactionId.length;
-    *transaction_id = malloc(n_transactionId.length);
-    if (!(*transaction_id))
+    if (depth > 1)
     {
-        goto err;
+        return es10b_load_bound_profile_package_stream_whole(stream, header, header_len);
     }
-    memcpy(*transaction_id, n_transactionId.value, n_transactionId.length);
 
-    n_request.tag = 0xBF38;
-    n_request.pack.child = &n_serverSigned1;
-    n_serverSigned1.pack.next = &n_serverSignature1;
-    n_serverSignature1.pack.next = &n_euiccCiPKIdToBeUsed;
-    n_euiccCiPKIdToBeUsed.pack.next = &n_serverCertificate;
-    n_serverCertificate.pack.next = &n_CtxParams1;
-    n_CtxParams1.tag = 0xA0;
-
-    n_deviceInfo.tag = 0xA1;
-    n_deviceInfo.pack.child = &n_tac;
-    n_tac.tag = 0x80;
-    n_tac.value = imei;
-    n_tac.length = 4;
-    n_tac.pack.next = &n_deviceCapabilities;
-    n_deviceCapabilities.tag = 0xA1;
-    if (param_user->imei)
+    switch (tag)
     {
-        int imei_len;
-
-        imei_len = euicc_hexutil_gsmbcd2bin(imei, sizeof(imei), param_user->imei, 0);
-        if (imei_len < 0)
+    case 0xA1: // sequenceOf88
+        if (es10b_load_bound_profile_package_stream_stage(stream, ES10B_BPP_STAGE_FIRST_SEQUENCE_OF_87, ES10B_BPP_STAGE_FIRST_SEQUENCE_OF_87, ES10B_BPP_STAGE_SEQUENCE_OF_88) < 0)
         {
-            goto err;
+            return -1;
         }
-
-        n_deviceCapabilities.pack.next = &n_imei;
-        n_imei.tag = 0x82;
-        n_imei.value = imei;
-        n_imei.length = imei_len;
-    }
-    else
-    {
-        memcpy(imei, (uint8_t[]){0x35, 0x29, 0x06, 0x11}, 4);
+        break;
+    case 0xA3: // sequenceOf86
+        if (es10b_load_bound_profile_package_stream_stage(stream, ES10B_BPP_STAGE_SEQUENCE_OF_88, ES10B_BPP_STAGE_SECOND_SEQUENCE_OF_87, ES10B_BPP_STAGE_SEQUENCE_OF_86) < 0)
+        {
+            return -1;
+        }
+        break;
+    default:
+        return es10b_load_bound_profile_package_stream_whole(stream, header, header_len);
     }
 
-    if (param_user->matchingId)
+    if (es10b_load_bound_profile_package_stream_flush(stream) < 0)
     {
-        n_CtxParams1.pack.child = &n_matchingId;
-        n_matchingId.tag = 0x80;
-        n_matchingId.value = (const uint8_t *)param_user->matchingId;
-        n_matchingId.length = strlen(param_user->matchingId);
-        n_matchingId.pack.next = &n_deviceInfo;
+        return -1;
     }
-    else
+    if (es10b_load_bound_profile_package_tx(stream->ctx, stream->result, header, header_len) < 0)
     {
-        n_CtxParams1.pack.child = &n_deviceInfo;
+        return -1;
     }
+    stream->tag = tag;
+    stream->element = 0;
+    es10b_load_bound_profile_package_progress(stream->ctx, tag, 0, header_len);
 
-    if (euicc_derutil_pack_alloc(&reqbuf, &reqlen, &n_request) < 0)
-    {
+    return 1;
+}
+
+static int iter_es10b_load_bound_profile_package_stream(const struct euicc_derutil_node *node, void *userdata)
+{
+    struct es10b_load_bound_profile_package_stream *stream = userdata;
+    uint8_t *respbuf;
+    unsigned resplen;
+
+    if (stream->der.depth > 1)
+    {
+        return es10b_load_bound_profile_package_stream_element(stream, node->self.ptr, node->self.length);
+    }
+
+    if (es10b_load_bound_profile_package_stream_flush(stream) < 0)
+    {
+        return -1;
+    }
+
+    switch (node->tag)
+    {
+    case 0xBF23: // initialiseSecureChannelRequest, sent together with the BoundProfilePackage header
+    {
+        struct es10x_iovec iov[2] = {
+            {.base = stream->header, .len = stream->header_len},
+            {.base = node->self.ptr, .len = node->self.length},
+        };
+
+        if (es10b_load_bound_profile_package_stream_stage(stream, ES10B_BPP_STAGE_START, ES10B_BPP_STAGE_START, ES10B_BPP_STAGE_INITIALISE_SECURE_CHANNEL) < 0)
+        {
+            return -1;
+        }
+
+        stream->result->bppCommandId = ES10B_BPP_COMMAND_ID_UNDEFINED;
+        stream->result->errorReason = ES10B_ERROR_REASON_UNDEFINED;
+        if (es10x_command_gather(stream->ctx, &respbuf, &resplen, iov, 2) < 0)
+        {
+            return -1;
+        }
+        if (es10b_load_bound_profile_package_parse(stream->result, respbuf, resplen) < 0)
+        {
+            return -1;
+        }
+        es10b_load_bound_profile_package_progress(stream->ctx, node->tag, 0, stream->header_len + node->self.length);
+        return 0;
+    }
+    case 0xA0: // firstSequenceOf87
+        if (es10b_load_bound_profile_package_stream_stage(stream, ES10B_BPP_STAGE_INITIALISE_SECURE_CHANNEL, ES10B_BPP_STAGE_INITIALISE_SECURE_CHANNEL, ES10B_BPP_STAGE_FIRST_SEQUENCE_OF_87) < 0)
+        {
+            return -1;
+        }
+        break;
+    case 0xA2: // secondSequenceOf87
+        if (es10b_load_bound_profile_package_stream_stage(stream, ES10B_BPP_STAGE_SEQUENCE_OF_88, ES10B_BPP_STAGE_SEQUENCE_OF_88, ES10B_BPP_STAGE_SECOND_SEQUENCE_OF_87) < 0)
+        {
+            return -1;
+        }
+        break;
+    default:
+        return 0;
+    }
+
+    if (es10b_load_bound_profile_package_tx(stream->ctx, stream->result, node->self.ptr, node->self.length) < 0)
+    {
+        return -1;
+    }
+    es10b_load_bound_profile_package_progress(stream->ctx, node->tag, 0, node->self.length);
+    return 0;
+}
+
+int es10b_load_bound_profile_package_stream_init(struct es10b_load_bound_profile_package_stream *stream, struct euicc_ctx *ctx, struct es10b_load_bound_profile_package_result *result)
+{
+    memset(stream, 0x00, sizeof(struct es10b_load_bound_profile_package_stream));
+
+    stream->ctx = ctx;
+    stream->result = result;
+    stream->stage = ES10B_BPP_STAGE_START;
+
+    result->bppCommandId = ES10B_BPP_COMMAND_ID_UNDEFINED;
+    result->errorReason = ES10B_ERROR_REASON_UNDEFINED;
+
+    if (ctx->apdu.interface && ctx->apdu.interface->transmit_batch)
+    {
+        stream->batch_max = ES10B_BPP_STREAM_BATCH_MAX;
+    }
+    euicc_progress_begin(ctx, &ctx->apdu._internal.progress, EUICC_PROGRESS_LOAD, 0);
+    euicc_operation(ctx, "es10b_load_bound_profile_package", 0);
+    stream->operation = 1;
+
+    return euicc_derutil_stream_init_select(&stream->der, select_es10b_load_bound_profile_package_stream, iter_es10b_load_bound_profile_package_stream, stream);
+}
+
+int es10b_load_bound_profile_package_stream_feed(struct es10b_load_bound_profile_package_stream *stream, const uint8_t *buffer, uint32_t buffer_len)
+{
+    return euicc_derutil_stream_feed(&stream->der, buffer, buffer_len);
+}
+
+int es10b_load_bound_profile_package_stream_finish(struct es10b_load_bound_profile_package_stream *stream)
+{
+    if (euicc_derutil_stream_finish(&stream->der) < 0)
+    {
+        return -1;
+    }
+
+    if (es10b_load_bound_profile_package_stream_flush(stream) < 0)
+    {
+        return -1;
+    }
+
+    if (stream->stage != ES10B_BPP_STAGE_SEQUENCE_OF_86)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+void es10b_load_bound_profile_package_stream_free(struct es10b_load_bound_profile_package_stream *stream)
+{
+    euicc_progress_end(stream->ctx, &stream->ctx->apdu._internal.progress);
+    euicc_derutil_stream_free(&stream->der);
+    euicc_free(stream->ctx, stream->batch);
+    stream->batch = NULL;
+    euicc_free(stream->ctx, stream->batch_lens);
+    stream->batch_lens = NULL;
+    if (stream->operation)
+    {
+        stream->operation = 0;
+        euicc_operation(stream->ctx, "es10b_load_bound_profile_package", 1);
+    }
+}
+
+int es10b_get_euicc_challenge_r(struct euicc_ctx *ctx, struct euicc_blob *euiccChallenge)
+{
+    int fret = 0;
+    unsigned reqlen;
+    uint8_t *respbuf = NULL;
+    unsigned resplen;
+
+    struct euicc_derutil_node tmpnode;
+
+    memset(euiccChallenge, 0, sizeof(*euiccChallenge));
+
+    reqlen = es10x_template_emit(ctx, ES10X_TEMPLATE_EUICC_CHALLENGE, NULL, NULL);
+
+    if (es10x_command(ctx, &respbuf, &resplen, ctx->apdu._internal.request_buffer.body, reqlen) < 0)
+    {
         goto err;
     }
 
-    free(serverSigned1);
-    serverSigned1 = NULL;
-    free(serverSignature1);
-    serverSignature1 = NULL;
-    free(euiccCiPKIdToBeUsed);
-    euiccCiPKIdToBeUsed = NULL;
-    free(serverCertificate);
-    serverCertificate = NULL;
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xBF2E, respbuf, resplen))
+    {
+        goto err;
+    }
 
-    if (es10x_command(ctx, &respbuf, &resplen, reqbuf, reqlen) < 0)
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0x80, tmpnode.value, tmpnode.length))
     {
         goto err;
     }
 
-    free(reqbuf);
-    reqbuf = NULL;
+    if (es10b_blob_set(euiccChallenge, tmpnode.value, tmpnode.length) < 0)
+    {
+        goto err;
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    return fret;
+}
+
+int es10b_get_euicc_info_r(struct euicc_ctx *ctx, struct euicc_blob *EUICCInfo1)
+{
+    int fret = 0;
+    unsigned reqlen;
+    uint8_t *respbuf = NULL;
+    unsigned resplen;
+
+    struct euicc_derutil_node tmpnode;
+
+    memset(EUICCInfo1, 0, sizeof(*EUICCInfo1));
+
+    reqlen = es10x_template_emit(ctx, ES10X_TEMPLATE_EUICC_INFO1, NULL, NULL);
+
+    if (es10x_command(ctx, &respbuf, &resplen, ctx->apdu._internal.request_buffer.body, reqlen) < 0)
+    {
+        goto err;
+    }
+
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xBF20, respbuf, resplen))
+    {
+        goto err;
+    }
+
+    if (es10b_blob_set(EUICCInfo1, tmpnode.self.ptr, tmpnode.self.length) < 0)
+    {
+        goto err;
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    return fret;
+}
+
+#define EUICC_AUTHENTICATE_SERVER_CTXPARAMS_MAX 512
+
+int es10b_authenticate_server_r(struct euicc_ctx *ctx, uint8_t **transaction_id, uint32_t *transaction_id_len, struct euicc_blob *AuthenticateServerResponse, struct es10b_authenticate_server_param *param, struct es10b_authenticate_server_param_user *param_user)
+{
+    int fret = 0;
+    uint8_t request_header[2 + 1 + 4];
+    uint8_t ctxParams1[EUICC_AUTHENTICATE_SERVER_CTXPARAMS_MAX];
+    struct euicc_derutil_writer writer;
+    const uint8_t *header, *ctxParams;
+    uint32_t header_len, ctxParams_len;
+    struct es10x_iovec iov[6];
+    uint8_t *respbuf = NULL;
+    unsigned resplen;
+
+    uint8_t imei[8];
+    uint8_t tac[4] = {0x35, 0x29, 0x06, 0x11};
+    int imei_len = 0;
+    struct euicc_derutil_node n_serverSigned1, n_transactionId, n_serverSignature1, n_euiccCiPKIdToBeUsed, n_serverCertificate;
+
+    *transaction_id = NULL;
+    *transaction_id_len = 0;
+    memset(AuthenticateServerResponse, 0, sizeof(*AuthenticateServerResponse));
+
+    if (euicc_derutil_unpack_find_tag(&n_serverSigned1, 0x30, param->serverSigned1.data, param->serverSigned1.length) < 0)
+    {
+        goto err;
+    }
+
+    if (euicc_derutil_unpack_find_tag(&n_transactionId, 0x80, n_serverSigned1.value, n_serverSigned1.length) < 0)
+    {
+        goto err;
+    }
+
+    if (euicc_derutil_unpack_find_tag(&n_serverSignature1, 0x5F37, param->serverSignature1.data, param->serverSignature1.length) < 0)
+    {
+        goto err;
+    }
+
+    if (euicc_derutil_unpack_find_tag(&n_euiccCiPKIdToBeUsed, 0x04, param->euiccCiPKIdToBeUsed.data, param->euiccCiPKIdToBeUsed.length) < 0)
+    {
+        goto err;
+    }
+
+    if (euicc_derutil_unpack_find_tag(&n_serverCertificate, 0x30, param->serverCertificate.data, param->serverCertificate.length) < 0)
+    {
+        goto err;
+    }
+
+    *transaction_id_len = n_transactionId.length;
+    *transaction_id = malloc(n_transactionId.length);
+    if (!(*transaction_id))
+    {
+        goto err;
+    }
+    memcpy(*transaction_id, n_transactionId.value, n_transactionId.length);
+
+    if (param_user->imei)
+    {
+        imei_len = euicc_hexutil_gsmbcd2bin(imei, sizeof(imei), param_user->imei, 0);
+        if (imei_len < 0)
+        {
+            goto err;
+        }
+        memcpy(tac, imei, sizeof(tac));
+    }
+
+    // CtxParams1 is the only part built here, children are written last to first
+    euicc_derutil_writer_init(&writer, ctxParams1, sizeof(ctxParams1));
+    if (imei_len > 0)
+    {
+        euicc_derutil_writer_tlv(&writer, 0x82, imei, imei_len); // imei
+    }
+    euicc_derutil_writer_header(&writer, 0xA1, 0); // deviceCapabilities
+    euicc_derutil_writer_tlv(&writer, 0x80, tac, sizeof(tac));
+    euicc_derutil_writer_wrap(&writer, 0xA1, 0); // deviceInfo
+    if (param_user->matchingId)
+    {
+        euicc_derutil_writer_tlv(&writer, 0x80, param_user->matchingId, strlen(param_user->matchingId));
+    }
+    euicc_derutil_writer_wrap(&writer, 0xA0, 0);
+    if (euicc_derutil_writer_finish(&writer, &ctxParams, &ctxParams_len) < 0)
+    {
+        goto err;
+    }
+
+    // The signed server parts are sent as received, only the outer header is new
+    iov[1].base = n_serverSigned1.self.ptr;
+    iov[1].len = n_serverSigned1.self.length;
+    iov[2].base = n_serverSignature1.self.ptr;
+    iov[2].len = n_serverSignature1.self.length;
+    iov[3].base = n_euiccCiPKIdToBeUsed.self.ptr;
+    iov[3].len = n_euiccCiPKIdToBeUsed.self.length;
+    iov[4].base = n_serverCertificate.self.ptr;
+    iov[4].len = n_serverCertificate.self.length;
+    iov[5].base = ctxParams;
+    iov[5].len = ctxParams_len;
+
+    euicc_derutil_writer_init(&writer, request_header, sizeof(request_header));
+    euicc_derutil_writer_header(&writer, 0xBF38, iov[1].len + iov[2].len + iov[3].len + iov[4].len + iov[5].len);
+    if (euicc_derutil_writer_finish(&writer, &header, &header_len) < 0)
+    {
+        goto err;
+    }
+    iov[0].base = header;
+    iov[0].len = header_len;
 
-    *b64_AuthenticateServerResponse = malloc(euicc_base64_encode_len(resplen));
-    if (!(*b64_AuthenticateServerResponse))
+    if (es10x_command_gather(ctx, &respbuf, &resplen, iov, sizeof(iov) / sizeof(iov[0])) < 0)
     {
         goto err;
     }
 
-    if (euicc_base64_encode(*b64_AuthenticateServerResponse, respbuf, resplen) < 0)
+    if (es10b_blob_set(AuthenticateServerResponse, respbuf, resplen) < 0)
     {
         goto err;
     }
@@ -722,25 +986,12 @@ err:
     free(*transaction_id);
     *transaction_id = NULL;
     *transaction_id_len = 0;
-    free(*b64_AuthenticateServerResponse);
-    *b64_AuthenticateServerResponse = NULL;
+    euicc_blob_free(AuthenticateServerResponse);
 exit:
-    free(serverSigned1);
-    serverSigned1 = NULL;
-    free(serverSignature1);
-    serverSignature1 = NULL;
-    free(euiccCiPKIdToBeUsed);
-    euiccCiPKIdToBeUsed = NULL;
-    free(serverCertificate);
-    serverCertificate = NULL;
-    free(reqbuf);
-    reqbuf = NULL;
-    free(respbuf);
-    respbuf = NULL;
     return fret;
 }
 
-int es10b_cancel_session_r(struct euicc_ctx *ctx, char **b64_CancelSessionResponse, struct es10b_cancel_session_param *param)
+int es10b_cancel_session_r(struct euicc_ctx *ctx, struct euicc_blob *CancelSessionResponse, struct es10b_cancel_session_param *param)
 {
     int fret = 0;
     struct euicc_derutil_node n_request, n_transactionId, n_reason;
@@ -752,6 +1003,8 @@ int es10b_cancel_session_r(struct euicc_ctx *ctx, char **b64_CancelSessionRespon
 
     struct euicc_derutil_node tmpnode;
 
+    memset(CancelSessionResponse, 0, sizeof(*CancelSessionResponse));
+
     if (euicc_derutil_convert_long2bin(reason_buf, &reason_buf_len, param->reason) < 0)
     {
         goto err;
@@ -788,12 +1041,7 @@ int es10b_cancel_session_r(struct euicc_ctx *ctx, char **b64_CancelSessionRespon
         goto err;
     }
 
-    *b64_CancelSessionResponse = malloc(euicc_base64_encode_len(tmpnode.self.length));
-    if (!(*b64_CancelSessionResponse))
-    {
-        goto err;
-    }
-    if (euicc_base64_encode(*b64_CancelSessionResponse, tmpnode.self.ptr, tmpnode.self.length) < 0)
+    if (es10b_blob_set(CancelSessionResponse, tmpnode.self.ptr, tmpnode.self.length) < 0)
     {
         goto err;
     }
@@ -802,11 +1050,7 @@ int es10b_cancel_session_r(struct euicc_ctx *ctx, char **b64_CancelSessionRespon
 
 err:
     fret = -1;
-    free(*b64_CancelSessionResponse);
-    *b64_CancelSessionResponse = NULL;
 exit:
-    free(respbuf);
-    respbuf = NULL;
     return fret;
 }
 
@@ -817,10 +1061,10 @@ void es10b_prepare_download_param_free(struct es10b_prepare_download_param *para
         return;
     }
 
-    free(param->b64_profileMetadata);
-    free(param->b64_smdpCertificate);
-    free(param->b64_smdpSignature2);
-    free(param->b64_smdpSigned2);
+    free(param->profileMetadata.data);
+    free(param->smdpCertificate.data);
+    free(param->smdpSignature2.data);
+    free(param->smdpSigned2.data);
 
     memset(param, 0x00, sizeof(*param));
 }
@@ -832,10 +1076,10 @@ void es10b_authenticate_server_param_free(struct es10b_authenticate_server_param
         return;
     }
 
-    free(param->b64_euiccCiPKIdToBeUsed);
-    free(param->b64_serverCertificate);
-    free(param->b64_serverSignature1);
-    free(param->b64_serverSigned1);
+    free(param->euiccCiPKIdToBeUsed.data);
+    free(param->serverCertificate.data);
+    free(param->serverSignature1.data);
+    free(param->serverSigned1.data);
 
     memset(param, 0x00, sizeof(*param));
 }
@@ -848,7 +1092,7 @@ int es10b_prepare_download(struct euicc_ctx *ctx, const char *confirmationCode)
         .confirmationCode = confirmationCode,
     };
 
-    if (ctx->http._internal.b64_prepare_download_response)
+    if (ctx->http._internal.prepare_download_response.data)
     {
         return -1;
     }
@@ -858,10 +1102,9 @@ int es10b_prepare_download(struct euicc_ctx *ctx, const char *confirmationCode)
         return -1;
     }
 
-    fret = es10b_prepare_download_r(ctx, &ctx->http._internal.b64_prepare_download_response, ctx->http._internal.prepare_download_param, &param_user);
+    fret = es10b_prepare_download_r(ctx, &ctx->http._internal.prepare_download_response, ctx->http._internal.prepare_download_param, &param_user);
     if (fret < 0)
     {
-        ctx->http._internal.b64_prepare_download_response = NULL;
         return fret;
     }
 
@@ -876,19 +1119,18 @@ int es10b_load_bound_profile_package(struct euicc_ctx *ctx, struct es10b_load_bo
 {
     int fret;
 
-    if (ctx->http._internal.b64_bound_profile_package == NULL)
+    if (ctx->http._internal.bound_profile_package.data == NULL)
     {
         return -1;
     }
 
-    fret = es10b_load_bound_profile_package_r(ctx, result, ctx->http._internal.b64_bound_profile_package);
+    fret = es10b_load_bound_profile_package_r(ctx, result, &ctx->http._internal.bound_profile_package);
     if (fret < 0)
     {
         return fret;
     }
 
-    free(ctx->http._internal.b64_bound_profile_package);
-    ctx->http._internal.b64_bound_profile_package = NULL;
+    euicc_blob_free(&ctx->http._internal.bound_profile_package);
 
     return fret;
 }
@@ -897,23 +1139,23 @@ int es10b_get_euicc_challenge_and_info(struct euicc_ctx *ctx)
 {
     int fret;
 
-    if (ctx->http._internal.b64_euicc_challenge)
+    if (ctx->http._internal.euicc_challenge.data)
     {
         return -1;
     }
 
-    if (ctx->http._internal.b64_euicc_info_1)
+    if (ctx->http._internal.euicc_info_1.data)
     {
         return -1;
     }
 
-    fret = es10b_get_euicc_challenge_r(ctx, &ctx->http._internal.b64_euicc_challenge);
+    fret = es10b_get_euicc_challenge_r(ctx, &ctx->http._internal.euicc_challenge);
     if (fret < 0)
     {
         goto err;
     }
 
-    fret = es10b_get_euicc_info_r(ctx, &ctx->http._internal.b64_euicc_info_1);
+    fret = es10b_get_euicc_info_r(ctx, &ctx->http._internal.euicc_info_1);
     if (fret < 0)
     {
         goto err;
@@ -922,10 +1164,8 @@ int es10b_get_euicc_challenge_and_info(struct euicc_ctx *ctx)
     return fret;
 
 err:
-    free(ctx->http._internal.b64_euicc_challenge);
-    ctx->http._internal.b64_euicc_challenge = NULL;
-    free(ctx->http._internal.b64_euicc_info_1);
-    ctx->http._internal.b64_euicc_info_1 = NULL;
+    euicc_blob_free(&ctx->http._internal.euicc_challenge);
+    euicc_blob_free(&ctx->http._internal.euicc_info_1);
 
     return -1;
 }
@@ -939,7 +1179,7 @@ int es10b_authenticate_server(struct euicc_ctx *ctx, const char *matchingId, con
         .imei = imei,
     };
 
-    if (ctx->http._internal.b64_authenticate_server_response)
+    if (ctx->http._internal.authenticate_server_response.data)
     {
         return -1;
     }
@@ -949,10 +1189,9 @@ int es10b_authenticate_server(struct euicc_ctx *ctx, const char *matchingId, con
         return -1;
     }
 
-    fret = es10b_authenticate_server_r(ctx, &ctx->http._internal.transaction_id_bin, &ctx->http._internal.transaction_id_bin_len, &ctx->http._internal.b64_authenticate_server_response, ctx->http._internal.authenticate_server_param, &param_user);
+    fret = es10b_authenticate_server_r(ctx, &ctx->http._internal.transaction_id_bin, &ctx->http._internal.transaction_id_bin_len, &ctx->http._internal.authenticate_server_response, ctx->http._internal.authenticate_server_param, &param_user);
     if (fret < 0)
     {
-        ctx->http._internal.b64_authenticate_server_response = NULL;
         return fret;
     }
 
@@ -983,147 +1222,363 @@ int es10b_cancel_session(struct euicc_ctx *ctx, enum es10b_cancel_session_reason
         return -1;
     }
 
-    if (ctx->http._internal.b64_cancel_session_response)
+    if (ctx->http._internal.cancel_session_response.data)
     {
         return -1;
     }
 
-    fret = es10b_cancel_session_r(ctx, &ctx->http._internal.b64_cancel_session_response, &param);
-
-    if (fret < 0)
-    {
-        ctx->http._internal.b64_cancel_session_response = NULL;
-    }
+    fret = es10b_cancel_session_r(ctx, &ctx->http._internal.cancel_session_response, &param);
 
     return fret;
 }
 
-int es10b_list_notification(struct euicc_ctx *ctx, struct es10b_notification_metadata_list **notificationMetadataList)
+static const int es10b_profile_management_operation_values[] = {
+    ES10B_PROFILE_MANAGEMENT_OPERATION_INSTALL,
+    ES10B_PROFILE_MANAGEMENT_OPERATION_ENABLE,
+    ES10B_PROFILE_MANAGEMENT_OPERATION_DISABLE,
+    ES10B_PROFILE_MANAGEMENT_OPERATION_DELETE,
+};
+static const struct euicc_derschema_enum es10b_profile_management_operation_enum = {
+    .absent = ES10B_PROFILE_MANAGEMENT_OPERATION_NULL,
+    .undefined = ES10B_PROFILE_MANAGEMENT_OPERATION_UNDEFINED,
+    .values = es10b_profile_management_operation_values,
+    .values_count = sizeof(es10b_profile_management_operation_values) / sizeof(es10b_profile_management_operation_values[0]),
+};
+
+// NotificationMetadata
+static const struct euicc_derschema_field es10b_notification_metadata_schema[] = {
+    EUICC_DERSCHEMA_FIELD(0x80, EUICC_DERSCHEMA_INTEGER, struct es10b_notification_metadata_list, seqNumber, NULL),
+    EUICC_DERSCHEMA_FIELD(0x81, EUICC_DERSCHEMA_ENUM_BITS, struct es10b_notification_metadata_list, profileManagementOperation, &es10b_profile_management_operation_enum),
+    EUICC_DERSCHEMA_FIELD(0x0C, EUICC_DERSCHEMA_UTF8STRING, struct es10b_notification_metadata_list, notificationAddress, NULL),
+    EUICC_DERSCHEMA_FIELD(0x5A, EUICC_DERSCHEMA_GSMBCD_ALLOC, struct es10b_notification_metadata_list, iccid, NULL),
+    EUICC_DERSCHEMA_END,
+};
+
+static struct es10b_notification_metadata_list *es10b_notification_metadata_decode(struct euicc_arena *arena, const struct euicc_derutil_node *n_NotificationMetadata)
 {
-    int fret = 0;
-    struct euicc_derutil_node n_request = {
-        .tag = 0xBF28, // ListNotificationRequest
-    };
-    uint32_t reqlen;
-    uint8_t *respbuf = NULL;
-    unsigned resplen;
+    struct es10b_notification_metadata_list *p;
 
-    struct euicc_derutil_node tmpnode, n_notificationMetadataList, n_NotificationMetadata;
+    p = euicc_arena_alloc(arena, sizeof(struct es10b_notification_metadata_list));
+    if (!p)
+    {
+        return NULL;
+    }
 
-    struct es10b_notification_metadata_list *list_wptr = NULL;
+    if (euicc_derschema_decode(p, es10b_notification_metadata_schema, arena, n_NotificationMetadata->value, n_NotificationMetadata->length) < 0)
+    {
+        return NULL;
+    }
 
-    *notificationMetadataList = NULL;
+    return p;
+}
 
-    reqlen = sizeof(ctx->apdu._internal.request_buffer.body);
-    if (euicc_derutil_pack(ctx->apdu._internal.request_buffer.body, &reqlen, &n_request))
+// Zeroed slot at the end of the array, the array grows geometrically
+static struct es10b_notification_metadata_list *es10b_notification_metadata_array_append(struct es10b_notification_metadata_array *array)
+{
+    struct es10b_notification_metadata_list *p;
+
+    if (array->count == array->_internal.capacity)
     {
-        goto err;
+        uint32_t capacity_new = array->_internal.capacity ? array->_internal.capacity * 2 : 8;
+        struct es10b_notification_metadata_list *notifications_new;
+
+        notifications_new = euicc_allocator_realloc(array->_internal.arena->allocator, array->notifications, capacity_new * sizeof(struct es10b_notification_metadata_list));
+        if (!notifications_new)
+        {
+            return NULL;
+        }
+        array->notifications = notifications_new;
+        array->_internal.capacity = capacity_new;
     }
 
-    if (es10x_command(ctx, &respbuf, &resplen, ctx->apdu._internal.request_buffer.body, reqlen) < 0)
+    p = &array->notifications[array->count++];
+    memset(p, 0, sizeof(struct es10b_notification_metadata_list));
+    return p;
+}
+
+struct es10b_list_notification_iter_userdata
+{
+    const struct euicc_allocator *allocator;
+    struct euicc_arena *arena;
+    // Decodes straight into the array instead of calling back
+    struct es10b_notification_metadata_array *array;
+    int (*callback)(struct es10b_notification_metadata_list *notificationMetadata, void *userdata);
+    void *userdata;
+    uint8_t operations;
+};
+
+static int iter_es10b_list_notification(const struct euicc_derutil_node *node, void *userdata)
+{
+    struct es10b_list_notification_iter_userdata *ud = (struct es10b_list_notification_iter_userdata *)userdata;
+    struct euicc_arena *arena = ud->arena;
+    struct es10b_notification_metadata_list *p;
+    struct euicc_derutil_node n_operation;
+
+    if (node->tag != 0xBF2F)
     {
-        goto err;
+        return 0;
     }
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, n_request.tag, respbuf, resplen) < 0)
+    // A card that ignores the filter still has its other records dropped here, before they are decoded
+    if (ud->operations && euicc_derutil_unpack_find_tag(&n_operation, 0x81, node->value, node->length) == 0 && n_operation.length >= 2 && !(n_operation.value[1] & ud->operations))
     {
-        goto err;
+        return 0;
     }
 
-    if (euicc_derutil_unpack_find_tag(&n_notificationMetadataList, 0xA0, tmpnode.value, tmpnode.length) < 0)
+    if (ud->array)
     {
-        goto err;
+        p = es10b_notification_metadata_array_append(ud->array);
+        if (!p)
+        {
+            return -1;
+        }
+        return euicc_derschema_decode(p, es10b_notification_metadata_schema, arena, node->value, node->length);
     }
 
-    n_NotificationMetadata.self.ptr = n_notificationMetadataList.value;
-    n_NotificationMetadata.self.length = 0;
-
-    while (euicc_derutil_unpack_next(&n_NotificationMetadata, &n_NotificationMetadata, n_notificationMetadataList.value, n_notificationMetadataList.length) == 0)
+    if (arena == NULL)
     {
-        struct es10b_notification_metadata_list *p;
-
-        if (n_NotificationMetadata.tag != 0xBF2F)
+        arena = euicc_arena_new(ud->allocator, sizeof(struct es10b_notification_metadata_list) + node->self.length * 2);
+        if (!arena)
         {
-            continue;
+            return -1;
         }
+    }
 
-        p = malloc(sizeof(struct es10b_notification_metadata_list));
-        if (!p)
+    p = es10b_notification_metadata_decode(arena, node);
+    if (!p)
+    {
+        if (arena != ud->arena)
         {
-            goto err;
+            euicc_arena_free(arena);
         }
+        return -1;
+    }
+
+    if (arena != ud->arena)
+    {
+        p->_internal.arena = arena;
+    }
+
+    return ud->callback(p, ud->userdata);
+}
 
-        memset(p, 0, sizeof(*p));
+static int es10b_list_notification_stream(struct euicc_ctx *ctx, uint8_t operations, struct euicc_arena *arena, struct es10b_notification_metadata_array *array, int (*callback)(struct es10b_notification_metadata_list *notificationMetadata, void *userdata), void *userdata)
+{
+    int fret = 0;
+    uint8_t operation[2];
+    static const uint16_t path[] = {
+        0xBF28, // ListNotificationResponse
+        0xA0,   // notificationMetadataList
+    };
+    unsigned reqlen;
+    struct euicc_derutil_stream stream;
+    struct es10b_list_notification_iter_userdata ud = {
+        .allocator = ctx->allocator,
+        .arena = arena,
+        .array = array,
+        .callback = callback,
+        .userdata = userdata,
+        .operations = operations,
+    };
 
-        tmpnode.self.ptr = n_NotificationMetadata.value;
-        tmpnode.self.length = 0;
-        p->profileManagementOperation = ES10B_PROFILE_MANAGEMENT_OPERATION_NULL;
-        while (euicc_derutil_unpack_next(&tmpnode, &tmpnode, n_NotificationMetadata.value, n_NotificationMetadata.length) == 0)
+    if (operations)
+    {
+        // NotificationEvent BIT STRING, DER leaves out the trailing zero bits
+        operation[0] = 0;
+        while (!(operations & (1 << operation[0])))
         {
-            switch (tmpnode.tag)
-            {
-            case 0x80:
-                p->seqNumber = euicc_derutil_convert_bin2long(tmpnode.value, tmpnode.length);
-                break;
-            case 0x81:
-                if (tmpnode.length >= 2)
-                {
-                    switch (tmpnode.value[1])
-                    {
-                    case ES10B_PROFILE_MANAGEMENT_OPERATION_INSTALL:
-                    case ES10B_PROFILE_MANAGEMENT_OPERATION_ENABLE:
-                    case ES10B_PROFILE_MANAGEMENT_OPERATION_DISABLE:
-                    case ES10B_PROFILE_MANAGEMENT_OPERATION_DELETE:
-                        p->profileManagementOperation = tmpnode.value[1];
-                        break;
-                    default:
-                        p->profileManagementOperation = ES10B_PROFILE_MANAGEMENT_OPERATION_UNDEFINED;
-                        break;
-                    }
-                }
-                break;
-            case 0x0C:
-                p->notificationAddress = malloc(tmpnode.length + 1);
-                if (p->notificationAddress)
-                {
-                    memcpy(p->notificationAddress, tmpnode.value, tmpnode.length);
-                    p->notificationAddress[tmpnode.length] = '\0';
-                }
-                break;
-            case 0x5A:
-                p->iccid = malloc((tmpnode.length * 2) + 1);
-                if (p->iccid)
-                {
-                    if (euicc_hexutil_bin2gsmbcd(p->iccid, (tmpnode.length * 2) + 1, tmpnode.value, tmpnode.length) < 0)
-                    {
-                        free(p->iccid);
-                        p->iccid = NULL;
-                    }
-                }
-                break;
-            }
+            operation[0]++;
         }
+        operation[1] = operations;
+        reqlen = es10x_template_emit(ctx, ES10X_TEMPLATE_LIST_NOTIFICATION_OPERATION, operation, NULL);
+    }
+    else
+    {
+        reqlen = es10x_template_emit(ctx, ES10X_TEMPLATE_LIST_NOTIFICATION, NULL, NULL);
+    }
+
+    if (euicc_derutil_stream_init(&stream, path, sizeof(path) / sizeof(path[0]), iter_es10b_list_notification, &ud) < 0)
+    {
+        return -1;
+    }
+
+    if (es10x_command_stream(ctx, ctx->apdu._internal.request_buffer.body, reqlen, &stream) < 0)
+    {
+        goto err;
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    euicc_derutil_stream_free(&stream);
+    return fret;
+}
+
+int es10b_list_notification_iter(struct euicc_ctx *ctx, int (*callback)(struct es10b_notification_metadata_list *notificationMetadata, void *userdata), void *userdata)
+{
+    return es10b_list_notification_stream(ctx, 0, NULL, NULL, callback, userdata);
+}
+
+int es10b_list_notification_filtered_iter(struct euicc_ctx *ctx, uint8_t operations, int (*callback)(struct es10b_notification_metadata_list *notificationMetadata, void *userdata), void *userdata)
+{
+    return es10b_list_notification_stream(ctx, operations, NULL, NULL, callback, userdata);
+}
+
+struct es10b_list_notification_userdata
+{
+    struct es10b_notification_metadata_list *head;
+    struct es10b_notification_metadata_list *tail;
+};
+
+static int iter_es10b_list_notification_append(struct es10b_notification_metadata_list *notificationMetadata, void *userdata)
+{
+    struct es10b_list_notification_userdata *ud = (struct es10b_list_notification_userdata *)userdata;
+
+    if (ud->head == NULL)
+    {
+        ud->head = notificationMetadata;
+    }
+    else
+    {
+        ud->tail->next = notificationMetadata;
+    }
+
+    ud->tail = notificationMetadata;
+    return 0;
+}
+
+int es10b_list_notification_filtered(struct euicc_ctx *ctx, uint8_t operations, struct es10b_notification_metadata_list **notificationMetadataList)
+{
+    struct es10b_list_notification_userdata ud = {0};
+    struct euicc_arena *arena;
+
+    *notificationMetadataList = NULL;
+
+    arena = euicc_arena_new(ctx->allocator, EUICC_ARENA_LIST_SIZE_HINT);
+    if (!arena)
+    {
+        return -1;
+    }
+
+    if (es10b_list_notification_stream(ctx, operations, arena, NULL, iter_es10b_list_notification_append, &ud) < 0)
+    {
+        euicc_arena_free(arena);
+        return -1;
+    }
+
+    if (ud.head == NULL)
+    {
+        euicc_arena_free(arena);
+        return 0;
+    }
+
+    ud.head->_internal.arena = arena;
+    *notificationMetadataList = ud.head;
+    return 0;
+}
+
+int es10b_list_notification(struct euicc_ctx *ctx, struct es10b_notification_metadata_list **notificationMetadataList)
+{
+    return es10b_list_notification_filtered(ctx, 0, notificationMetadataList);
+}
+
+int es10b_list_notification_v(struct euicc_ctx *ctx, struct es10b_notification_metadata_array *notificationMetadataArray)
+{
+    memset(notificationMetadataArray, 0, sizeof(struct es10b_notification_metadata_array));
+
+    notificationMetadataArray->_internal.arena = euicc_arena_new(ctx->allocator, EUICC_ARENA_LIST_SIZE_HINT);
+    if (!notificationMetadataArray->_internal.arena)
+    {
+        return -1;
+    }
+
+    if (es10b_list_notification_stream(ctx, 0, notificationMetadataArray->_internal.arena, notificationMetadataArray, NULL, NULL) < 0)
+    {
+        es10b_notification_metadata_array_free(notificationMetadataArray);
+        return -1;
+    }
+
+    // Linked only now, the array may have moved while it grew
+    for (uint32_t i = 0; i + 1 < notificationMetadataArray->count; i++)
+    {
+        notificationMetadataArray->notifications[i].next = &notificationMetadataArray->notifications[i + 1];
+    }
 
-        if (*notificationMetadataList == NULL)
+    return 0;
+}
+
+// Fills PendingNotification from one PendingNotification element (BF37 or 30) of a RetrieveNotificationsListResponse
+static int es10b_pending_notification_parse(struct es10b_pending_notification *PendingNotification, unsigned long *seqNumber, const struct euicc_derutil_node *n_PendingNotification)
+{
+    int fret = 0;
+    struct euicc_derutil_node tmpnode, n_NotificationMetadata;
+
+    memset(PendingNotification, 0, sizeof(struct es10b_pending_notification));
+
+    switch (n_PendingNotification->tag)
+    {
+    case 0xBF37: // profileInstallationResult
+        if (euicc_derutil_unpack_find_tag(&tmpnode, 0xBF27, n_PendingNotification->value, n_PendingNotification->length) < 0)
         {
-            *notificationMetadataList = p;
+            goto err;
         }
-        else
+        if (euicc_derutil_unpack_find_tag(&n_NotificationMetadata, 0xBF2F, tmpnode.value, tmpnode.length) < 0)
         {
-            list_wptr->next = p;
+            goto err;
+        }
+        break;
+    case 0x30: // otherSignedNotification
+        if (euicc_derutil_unpack_find_tag(&n_NotificationMetadata, 0xBF2F, n_PendingNotification->value, n_PendingNotification->length) < 0)
+        {
+            goto err;
+        }
+        break;
+    default:
+        goto err;
+    }
+
+    if (seqNumber)
+    {
+        if (euicc_derutil_unpack_find_tag(&tmpnode, 0x80, n_NotificationMetadata.value, n_NotificationMetadata.length) < 0)
+        {
+            goto err;
         }
+        *seqNumber = euicc_derutil_convert_bin2long(tmpnode.value, tmpnode.length);
+    }
 
-        list_wptr = p;
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0x0C, n_NotificationMetadata.value, n_NotificationMetadata.length) < 0)
+    {
+        goto err;
     }
 
+    PendingNotification->notificationAddress = malloc(tmpnode.length + 1);
+    if (!PendingNotification->notificationAddress)
+    {
+        goto err;
+    }
+    memcpy(PendingNotification->notificationAddress, tmpnode.value, tmpnode.length);
+    PendingNotification->notificationAddress[tmpnode.length] = '\0';
+
+    PendingNotification->b64_PendingNotification = malloc(euicc_base64_encode_len(n_PendingNotification->self.length));
+    if (!PendingNotification->b64_PendingNotification)
+    {
+        goto err;
+    }
+    if (euicc_base64_encode(PendingNotification->b64_PendingNotification, n_PendingNotification->self.ptr, n_PendingNotification->self.length) < 0)
+    {
+        goto err;
+    }
+
+    fret = 0;
+
     goto exit;
 
 err:
     fret = -1;
-    es10b_notification_metadata_list_free_all(*notificationMetadataList);
+    es10b_pending_notification_free(PendingNotification);
 exit:
-    free(respbuf);
-    respbuf = NULL;
     return fret;
 }
 
@@ -1137,7 +1592,7 @@ int es10b_retrieve_notifications_list(struct euicc_ctx *ctx, struct es10b_pendin
     uint8_t *respbuf = NULL;
     unsigned resplen;
 
-    struct euicc_derutil_node tmpnode, n_PendingNotification, n_NotificationMetadata;
+    struct euicc_derutil_node tmpnode, n_PendingNotification;
 
     memset(PendingNotification, 0, sizeof(struct es10b_pending_notification));
 
@@ -1186,59 +1641,81 @@ int es10b_retrieve_notifications_list(struct euicc_ctx *ctx, struct es10b_pendin
         goto err;
     }
 
-    switch (n_PendingNotification.tag)
-    {
-    case 0xBF37: // profileInstallationResult
-        if (euicc_derutil_unpack_find_tag(&tmpnode, 0xBF27, n_PendingNotification.value, n_PendingNotification.length) < 0)
-        {
-            goto err;
-        }
-        if (euicc_derutil_unpack_find_tag(&n_NotificationMetadata, 0xBF2F, tmpnode.value, tmpnode.length) < 0)
-        {
-            goto err;
-        }
-        break;
-    case 0x30: // otherSignedNotification
-        if (euicc_derutil_unpack_find_tag(&n_NotificationMetadata, 0xBF2F, n_PendingNotification.value, n_PendingNotification.length) < 0)
-        {
-            goto err;
-        }
-        break;
-    }
+    fret = es10b_pending_notification_parse(PendingNotification, NULL, &n_PendingNotification);
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, 0x0C, n_NotificationMetadata.value, n_NotificationMetadata.length) < 0)
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    return fret;
+}
+
+int es10b_retrieve_notifications_list_all(struct euicc_ctx *ctx, struct es10b_pending_notification_list **pendingNotificationList)
+{
+    int fret = 0;
+    unsigned reqlen;
+    uint8_t *respbuf = NULL;
+    unsigned resplen;
+    struct euicc_derutil_node tmpnode, n_PendingNotification;
+    struct es10b_pending_notification_list *list = NULL, *list_wptr = NULL;
+
+    *pendingNotificationList = NULL;
+
+    // RetrieveNotificationsListRequest without searchCriteria returns every pending notification
+    reqlen = es10x_template_emit(ctx, ES10X_TEMPLATE_RETRIEVE_NOTIFICATIONS_LIST, NULL, NULL);
+    if (es10x_command(ctx, &respbuf, &resplen, ctx->apdu._internal.request_buffer.body, reqlen) < 0)
     {
         goto err;
     }
 
-    PendingNotification->notificationAddress = malloc(tmpnode.length + 1);
-    if (!PendingNotification->notificationAddress)
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xBF2B, respbuf, resplen) < 0)
     {
         goto err;
     }
-    memcpy(PendingNotification->notificationAddress, tmpnode.value, tmpnode.length);
-    PendingNotification->notificationAddress[tmpnode.length] = '\0';
 
-    PendingNotification->b64_PendingNotification = malloc(euicc_base64_encode_len(n_PendingNotification.self.length));
-    if (!PendingNotification->b64_PendingNotification)
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xA0, tmpnode.value, tmpnode.length) < 0)
     {
         goto err;
     }
-    if (euicc_base64_encode(PendingNotification->b64_PendingNotification, n_PendingNotification.self.ptr, n_PendingNotification.self.length) < 0)
+
+    n_PendingNotification.self.ptr = tmpnode.value;
+    n_PendingNotification.self.length = 0;
+
+    while (euicc_derutil_unpack_next(&n_PendingNotification, &n_PendingNotification, tmpnode.value, tmpnode.length) == 0)
     {
-        goto err;
+        struct es10b_pending_notification_list *p;
+
+        p = calloc(1, sizeof(struct es10b_pending_notification_list));
+        if (!p)
+        {
+            goto err;
+        }
+
+        if (list == NULL)
+        {
+            list = p;
+        }
+        else
+        {
+            list_wptr->next = p;
+        }
+        list_wptr = p;
+
+        if (es10b_pending_notification_parse(&p->notification, &p->seqNumber, &n_PendingNotification) < 0)
+        {
+            goto err;
+        }
     }
 
-    fret = 0;
+    *pendingNotificationList = list;
 
     goto exit;
 
 err:
     fret = -1;
-    es10b_pending_notification_free(PendingNotification);
+    es10b_pending_notification_list_free_all(list);
 exit:
-    free(respbuf);
-    respbuf = NULL;
     return fret;
 }
 
@@ -1247,7 +1724,8 @@ int es10b_remove_notification_from_list(struct euicc_ctx *ctx, unsigned long seq
     int fret = 0;
     uint8_t seqNumber_buf[sizeof(seqNumber)];
     uint32_t seqNumber_buf_len = sizeof(seqNumber_buf);
-    struct euicc_derutil_node n_request, n_seqNumber;
+    struct euicc_derutil_writer writer;
+    const uint8_t *reqbuf;
     uint32_t reqlen;
     uint8_t *respbuf = NULL;
     unsigned resplen;
@@ -1259,28 +1737,20 @@ int es10b_remove_notification_from_list(struct euicc_ctx *ctx, unsigned long seq
         goto err;
     }
 
-    memset(&n_request, 0, sizeof(n_request));
-    memset(&n_seqNumber, 0, sizeof(n_seqNumber));
-
-    n_request.tag = 0xBF30; // NotificationSentRequest
-    n_request.pack.child = &n_seqNumber;
-
-    n_seqNumber.tag = 0x80; // seqNumber
-    n_seqNumber.length = seqNumber_buf_len;
-    n_seqNumber.value = seqNumber_buf;
-
-    reqlen = sizeof(ctx->apdu._internal.request_buffer.body);
-    if (euicc_derutil_pack(ctx->apdu._internal.request_buffer.body, &reqlen, &n_request))
+    euicc_derutil_writer_init(&writer, ctx->apdu._internal.request_buffer.body, sizeof(ctx->apdu._internal.request_buffer.body));
+    euicc_derutil_writer_tlv(&writer, 0x80, seqNumber_buf, seqNumber_buf_len); // seqNumber
+    euicc_derutil_writer_wrap(&writer, 0xBF30, 0);                              // NotificationSentRequest
+    if (euicc_derutil_writer_finish(&writer, &reqbuf, &reqlen) < 0)
     {
         goto err;
     }
 
-    if (es10x_command(ctx, &respbuf, &resplen, ctx->apdu._internal.request_buffer.body, reqlen) < 0)
+    if (es10x_command(ctx, &respbuf, &resplen, reqbuf, reqlen) < 0)
     {
         goto err;
     }
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, n_request.tag, respbuf, resplen) < 0)
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xBF30, respbuf, resplen) < 0)
     {
         goto err;
     }
@@ -1297,21 +1767,106 @@ int es10b_remove_notification_from_list(struct euicc_ctx *ctx, unsigned long seq
 err:
     fret = -1;
 exit:
-    free(respbuf);
-    respbuf = NULL;
+    return fret;
+}
+
+static int iter_es10b_remove_notification_from_list_multi(unsigned index, const uint8_t *resp, unsigned resp_len, void *userdata)
+{
+    int *result = userdata;
+    struct euicc_derutil_node tmpnode;
+
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xBF30, resp, resp_len) == 0 && euicc_derutil_unpack_find_tag(&tmpnode, 0x80, tmpnode.value, tmpnode.length) == 0)
+    {
+        result[index] = euicc_derutil_convert_bin2long(tmpnode.value, tmpnode.length);
+    }
+
+    return 0;
+}
+
+int es10b_remove_notification_from_list_multi(struct euicc_ctx *ctx, const unsigned long *seqNumber, int *result, uint32_t count)
+{
+    int fret = 0;
+    // 80 with up to sizeof(long) + 1 bytes, wrapped in BF30
+    const unsigned request_max = 3 + 2 + sizeof(unsigned long) + 1;
+    uint8_t *reqbuf = NULL;
+    const uint8_t **reqbufs = NULL;
+    unsigned *reqbuf_lens = NULL;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        result[i] = -1;
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    reqbuf = euicc_malloc(ctx, count * request_max);
+    reqbufs = euicc_malloc(ctx, count * sizeof(*reqbufs));
+    reqbuf_lens = euicc_malloc(ctx, count * sizeof(*reqbuf_lens));
+    if (!reqbuf || !reqbufs || !reqbuf_lens)
+    {
+        goto err;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint8_t seqNumber_buf[sizeof(unsigned long) + 1];
+        uint32_t seqNumber_buf_len = sizeof(seqNumber_buf);
+        struct euicc_derutil_writer writer;
+        const uint8_t *out;
+        uint32_t out_len;
+
+        if (euicc_derutil_convert_long2bin(seqNumber_buf, &seqNumber_buf_len, seqNumber[i]) < 0)
+        {
+            goto err;
+        }
+
+        euicc_derutil_writer_init(&writer, reqbuf + i * request_max, request_max);
+        euicc_derutil_writer_tlv(&writer, 0x80, seqNumber_buf, seqNumber_buf_len); // seqNumber
+        euicc_derutil_writer_wrap(&writer, 0xBF30, 0);                              // NotificationSentRequest
+        if (euicc_derutil_writer_finish(&writer, &out, &out_len) < 0)
+        {
+            goto err;
+        }
+        reqbufs[i] = out;
+        reqbuf_lens[i] = out_len;
+    }
+
+    if (es10x_command_batch(ctx, reqbufs, reqbuf_lens, count, iter_es10b_remove_notification_from_list_multi, result) < 0)
+    {
+        goto err;
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    euicc_free(ctx, reqbuf);
+    euicc_free(ctx, reqbufs);
+    euicc_free(ctx, reqbuf_lens);
     return fret;
 }
 
 void es10b_notification_metadata_list_free_all(struct es10b_notification_metadata_list *notificationMetadataList)
 {
-    while (notificationMetadataList)
+    if (!notificationMetadataList)
     {
-        struct es10b_notification_metadata_list *next = notificationMetadataList->next;
-        free(notificationMetadataList->notificationAddress);
-        free(notificationMetadataList->iccid);
-        free(notificationMetadataList);
-        notificationMetadataList = next;
+        return;
     }
+
+    euicc_arena_free(notificationMetadataList->_internal.arena);
+}
+
+void es10b_notification_metadata_array_free(struct es10b_notification_metadata_array *notificationMetadataArray)
+{
+    if (notificationMetadataArray->_internal.arena)
+    {
+        euicc_allocator_free(notificationMetadataArray->_internal.arena->allocator, notificationMetadataArray->notifications);
+    }
+    euicc_arena_free(notificationMetadataArray->_internal.arena);
+    memset(notificationMetadataArray, 0, sizeof(struct es10b_notification_metadata_array));
 }
 
 void es10b_pending_notification_free(struct es10b_pending_notification *PendingNotification)
@@ -1321,26 +1876,62 @@ void es10b_pending_notification_free(struct es10b_pending_notification *PendingN
     memset(PendingNotification, 0, sizeof(struct es10b_pending_notification));
 }
 
+void es10b_pending_notification_list_free_all(struct es10b_pending_notification_list *pendingNotificationList)
+{
+    while (pendingNotificationList)
+    {
+        struct es10b_pending_notification_list *next = pendingNotificationList->next;
+
+        es10b_pending_notification_free(&pendingNotificationList->notification);
+        free(pendingNotificationList);
+        pendingNotificationList = next;
+    }
+}
+
+static const char *es10b_ppr_ids_desc[] = {"pprUpdateControl", "ppr1", "ppr2", "ppr3", NULL};
+static const char *es10b_ppr_flags_desc[] = {"consentRequired", NULL};
+
+// OperatorId
+static const struct euicc_derschema_field es10b_operation_id_schema[] = {
+    EUICC_DERSCHEMA_FIELD(0x80, EUICC_DERSCHEMA_HEX_ALLOC, struct es10b_operation_id, plmn, NULL),
+    EUICC_DERSCHEMA_FIELD(0x81, EUICC_DERSCHEMA_HEX_ALLOC, struct es10b_operation_id, gid1, NULL),
+    EUICC_DERSCHEMA_FIELD(0x82, EUICC_DERSCHEMA_HEX_ALLOC, struct es10b_operation_id, gid2, NULL),
+    EUICC_DERSCHEMA_END,
+};
+
+static const struct euicc_derschema_list es10b_operation_id_list = {
+    .fields = es10b_operation_id_schema,
+    .size = sizeof(struct es10b_operation_id),
+    .next_offset = offsetof(struct es10b_operation_id, next),
+};
+
+// ProfilePolicyAuthorisationRule
+static const struct euicc_derschema_field es10b_rat_schema[] = {
+    EUICC_DERSCHEMA_FIELD(0x80, EUICC_DERSCHEMA_NAMED_BITS, struct es10b_rat, pprIds, es10b_ppr_ids_desc),
+    EUICC_DERSCHEMA_FIELD(0xA1, EUICC_DERSCHEMA_LIST, struct es10b_rat, allowedOperators, &es10b_operation_id_list),
+    EUICC_DERSCHEMA_FIELD(0x82, EUICC_DERSCHEMA_NAMED_BITS, struct es10b_rat, pprFlags, es10b_ppr_flags_desc),
+    EUICC_DERSCHEMA_END,
+};
+
+static const struct euicc_derschema_list es10b_rat_list = {
+    .fields = es10b_rat_schema,
+    .size = sizeof(struct es10b_rat),
+    .next_offset = offsetof(struct es10b_rat, next),
+};
+
 int es10b_get_rat(struct euicc_ctx *ctx, struct es10b_rat **ratList)
 {
     int fret;
-    struct euicc_derutil_node n_request = {
-        .tag = 0xBF43, // GetRatRequest
-    };
-    uint32_t reqlen;
+    unsigned reqlen;
     uint8_t *respbuf = NULL;
     unsigned resplen;
 
-    struct es10b_rat *rat;
-    struct euicc_derutil_node tmpnode, tmpchildnode, n_profile;
+    struct euicc_arena *arena = NULL;
+    struct euicc_derutil_node tmpnode;
 
     *ratList = NULL;
 
-    reqlen = sizeof(ctx->apdu._internal.request_buffer.body);
-    if (euicc_derutil_pack(ctx->apdu._internal.request_buffer.body, &reqlen, &n_request))
-    {
-        goto err;
-    }
+    reqlen = es10x_template_emit(ctx, ES10X_TEMPLATE_GET_RAT, NULL, NULL);
 
     if (es10x_command(ctx, &respbuf, &resplen, ctx->apdu._internal.request_buffer.body, reqlen) < 0)
     {
@@ -1364,148 +1955,43 @@ int es10b_get_rat(struct euicc_ctx *ctx, struct es10b_rat **ratList)
         goto err;
     }
 
-    n_profile.self.ptr = tmpnode.value;
-    n_profile.self.length = 0;
-
-    // ProfilePolicyAuthorisationRule
-    while (euicc_derutil_unpack_next(&n_profile, &n_profile, tmpnode.value, tmpnode.length) == 0)
+    // Every rule, operator and string of the table lives in one arena owned by the head
+    arena = euicc_arena_new(ctx->allocator, sizeof(struct es10b_rat) + tmpnode.length * 4);
+    if (!arena)
     {
-        tmpchildnode.self.ptr = n_profile.value;
-        tmpchildnode.self.length = 0;
-
-        rat = malloc(sizeof(struct es10b_rat));
-        if (!rat)
-        {
-            goto err;
-        }
-
-        memset(rat, 0, sizeof(*rat));
-
-        while (euicc_derutil_unpack_next(&tmpchildnode, &tmpchildnode, n_profile.value, n_profile.length) == 0)
-        {
-            switch (tmpchildnode.tag)
-            {
-            case 0x80: // ppr ids
-            {
-                static const char *desc[] = {"pprUpdateControl", "ppr1", "ppr2", "ppr3", NULL};
-
-                if (euicc_derutil_convert_bin2bits_str(&rat->pprIds, tmpchildnode.value, tmpchildnode.length, desc))
-                {
-                    goto err;
-                }
-            }
-            break;
-            case 0xA1: // allowed operators
-            {
-                struct euicc_derutil_node n_allowed_operator, n_operator;
-                struct es10b_operation_id *operations_wptr = NULL;
-                struct es10b_operation_id *p;
-
-                n_allowed_operator.self.ptr = tmpchildnode.value;
-                n_allowed_operator.self.length = 0;
-
-                while (euicc_derutil_unpack_next(&n_allowed_operator, &n_allowed_operator, tmpchildnode.value, tmpchildnode.length) == 0)
-                {
-                    p = malloc(sizeof(struct es10b_operation_id));
-                    if (!p)
-                    {
-                        goto err;
-                    }
-                    memset(p, 0, sizeof(*p));
-
-                    n_operator.self.ptr = n_allowed_operator.value;
-                    n_operator.self.length = 0;
-
-                    while (euicc_derutil_unpack_next(&n_operator, &n_operator, n_allowed_operator.value, n_allowed_operator.length) == 0)
-                    {
-                        if (n_operator.length == 0)
-                        {
-                            continue;
-                        }
-                        switch (n_operator.tag)
-                        {
-                        case 0x80: // mcc_mnc
-                            p->plmn = malloc((n_operator.length * 2) + 1);
-                            euicc_hexutil_bin2hex(p->plmn, sizeof(p->plmn), n_operator.value, n_operator.length);
-                            break;
-                        case 0x81: // gid1
-                            p->gid1 = malloc((n_operator.length * 2) + 1);
-                            euicc_hexutil_bin2hex(p->gid1, sizeof(p->gid1), n_operator.value, n_operator.length);
-                            break;
-                        case 0x82: // gid2
-                            p->gid2 = malloc((n_operator.length * 2) + 1);
-                            euicc_hexutil_bin2hex(p->gid2, sizeof(p->gid2), n_operator.value, n_operator.length);
-                            break;
-                        }
-                    }
-                    if (operations_wptr == NULL)
-                    {
-                        operations_wptr = p;
-                    }
-                    else
-                    {
-                        operations_wptr->next = p;
-                    }
-                }
-
-                rat->allowedOperators = operations_wptr;
-            }
-            break;
-            case 0x82: // ppr flags
-            {
-                static const char *desc[] = {"consentRequired", NULL};
+        goto err;
+    }
 
-                if (euicc_derutil_convert_bin2bits_str(&rat->pprFlags, tmpchildnode.value, tmpchildnode.length, desc))
-                {
-                    goto err;
-                }
-            }
-            break;
-            }
-        }
+    if (euicc_derschema_decode_list((void **)ratList, &es10b_rat_list, arena, tmpnode.value, tmpnode.length) < 0)
+    {
+        goto err;
+    }
 
-        if (*ratList == NULL)
-        {
-            *ratList = rat;
-        }
-        else
-        {
-            (*ratList)->next = rat;
-        }
+    if (*ratList == NULL)
+    {
+        euicc_arena_free(arena);
+    }
+    else
+    {
+        (*ratList)->_internal.arena = arena;
     }
 
     fret = 0;
     goto exit;
 err:
     fret = -1;
-    es10b_rat_list_free_all(*ratList);
+    euicc_arena_free(arena);
     *ratList = NULL;
 exit:
-    free(respbuf);
-    respbuf = NULL;
     return fret;
 }
 
 void es10b_rat_list_free_all(struct es10b_rat *ratList)
 {
-    struct es10b_rat *next_rat;
-    struct es10b_operation_id *next_operation_id;
-
-    while (ratList)
+    if (!ratList)
     {
-        next_rat = ratList->next;
-        free(ratList->pprIds);
-        while (ratList->allowedOperators)
-        {
-            next_operation_id = ratList->allowedOperators->next;
-            free(ratList->allowedOperators->plmn);
-            free(ratList->allowedOperators->gid1);
-            free(ratList->allowedOperators->gid2);
-            free(ratList->allowedOperators);
-            ratList->allowedOperators = next_operation_id;
-        }
-        free(ratList->pprFlags);
-        free(ratList);
-        ratList = next_rat;
+        return;
     }
+
+    euicc_arena_free(ratList->_internal.arena);
 }
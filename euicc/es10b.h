@@ -1,6 +1,7 @@
 #pragma once
 
 #include "euicc.h"
+#include "arena.h"
 
 enum es10b_profile_management_operation
 {
@@ -63,10 +64,10 @@ struct es10b_load_bound_profile_package_result
 
 struct es10b_prepare_download_param
 {
-    char *b64_profileMetadata;
-    char *b64_smdpSigned2;
-    char *b64_smdpSignature2;
-    char *b64_smdpCertificate;
+    struct euicc_blob profileMetadata;
+    struct euicc_blob smdpSigned2;
+    struct euicc_blob smdpSignature2;
+    struct euicc_blob smdpCertificate;
 };
 
 struct es10b_prepare_download_param_user
@@ -81,21 +82,47 @@ struct es10b_notification_metadata_list
     char *notificationAddress;
     char *iccid;
 
+    struct
+    {
+        struct euicc_arena *arena;
+    } _internal;
+
     struct es10b_notification_metadata_list *next;
 };
 
+// Notifications in one contiguous array with their strings in one arena, next links each element to the one after it.
+// Always free it with es10b_notification_metadata_array_free.
+struct es10b_notification_metadata_array
+{
+    struct es10b_notification_metadata_list *notifications;
+    uint32_t count;
+
+    struct
+    {
+        struct euicc_arena *arena;
+        uint32_t capacity;
+    } _internal;
+};
+
 struct es10b_pending_notification
 {
     char *notificationAddress;
     char *b64_PendingNotification;
 };
 
+struct es10b_pending_notification_list
+{
+    unsigned long seqNumber;
+    struct es10b_pending_notification notification;
+    struct es10b_pending_notification_list *next;
+};
+
 struct es10b_authenticate_server_param
 {
-    char *b64_serverSigned1;
-    char *b64_serverSignature1;
-    char *b64_euiccCiPKIdToBeUsed;
-    char *b64_serverCertificate;
+    struct euicc_blob serverSigned1;
+    struct euicc_blob serverSignature1;
+    struct euicc_blob euiccCiPKIdToBeUsed;
+    struct euicc_blob serverCertificate;
 };
 
 struct es10b_authenticate_server_param_user
@@ -117,6 +144,11 @@ struct es10b_rat
     struct es10b_operation_id *allowedOperators;
     const char **pprFlags;
 
+    struct
+    {
+        struct euicc_arena *arena;
+    } _internal;
+
     struct es10b_rat *next;
 };
 
@@ -129,12 +161,13 @@ struct es10b_operation_id
     struct es10b_operation_id *next;
 };
 
-int es10b_prepare_download_r(struct euicc_ctx *ctx, char **b64_PrepareDownloadResponse, struct es10b_prepare_download_param *param, struct es10b_prepare_download_param_user *param_user);
-int es10b_load_bound_profile_package_r(struct euicc_ctx *ctx, struct es10b_load_bound_profile_package_result *result, const char *b64_BoundProfilePackage);
-int es10b_get_euicc_challenge_r(struct euicc_ctx *ctx, char **b64_euiccChallenge);
-int es10b_get_euicc_info_r(struct euicc_ctx *ctx, char **b64_EUICCInfo1);
-int es10b_authenticate_server_r(struct euicc_ctx *ctx, uint8_t **transaction_id, uint32_t *transaction_id_len, char **b64_AuthenticateServerResponse, struct es10b_authenticate_server_param *param, struct es10b_authenticate_server_param_user *param_user);
-int es10b_cancel_session_r(struct euicc_ctx *ctx, char **b64_CancelSessionResponse, struct es10b_cancel_session_param *param);
+// The card's responses are returned as they came, DER encoded
+int es10b_prepare_download_r(struct euicc_ctx *ctx, struct euicc_blob *PrepareDownloadResponse, struct es10b_prepare_download_param *param, struct es10b_prepare_download_param_user *param_user);
+int es10b_load_bound_profile_package_r(struct euicc_ctx *ctx, struct es10b_load_bound_profile_package_result *result, const struct euicc_blob *BoundProfilePackage);
+int es10b_get_euicc_challenge_r(struct euicc_ctx *ctx, struct euicc_blob *euiccChallenge);
+int es10b_get_euicc_info_r(struct euicc_ctx *ctx, struct euicc_blob *EUICCInfo1);
+int es10b_authenticate_server_r(struct euicc_ctx *ctx, uint8_t **transaction_id, uint32_t *transaction_id_len, struct euicc_blob *AuthenticateServerResponse, struct es10b_authenticate_server_param *param, struct es10b_authenticate_server_param_user *param_user);
+int es10b_cancel_session_r(struct euicc_ctx *ctx, struct euicc_blob *CancelSessionResponse, struct es10b_cancel_session_param *param);
 
 void es10b_prepare_download_param_free(struct es10b_prepare_download_param *param);
 void es10b_authenticate_server_param_free(struct es10b_authenticate_server_param *param);
@@ -145,12 +178,27 @@ int es10b_get_euicc_challenge_and_info(struct euicc_ctx *ctx);
 int es10b_authenticate_server(struct euicc_ctx *ctx, const char *matchingId, const char *imei);
 int es10b_cancel_session(struct euicc_ctx *ctx, enum es10b_cancel_session_reason reason);
 
+// Entries of the returned list share one allocation owned by the head, free the list through the head only
 int es10b_list_notification(struct euicc_ctx *ctx, struct es10b_notification_metadata_list **notificationMetadataList);
+// Calls back with each NotificationMetadata as soon as it is received, the callback owns it and frees it with es10b_notification_metadata_list_free_all
+int es10b_list_notification_iter(struct euicc_ctx *ctx, int (*callback)(struct es10b_notification_metadata_list *notificationMetadata, void *userdata), void *userdata);
+int es10b_list_notification_v(struct euicc_ctx *ctx, struct es10b_notification_metadata_array *notificationMetadataArray);
+// Only the notifications of operations, an OR of ES10B_PROFILE_MANAGEMENT_OPERATION_INSTALL/ENABLE/DISABLE/DELETE, 0 for
+// all of them. The eUICC filters them itself, the rest is never sent.
+int es10b_list_notification_filtered(struct euicc_ctx *ctx, uint8_t operations, struct es10b_notification_metadata_list **notificationMetadataList);
+int es10b_list_notification_filtered_iter(struct euicc_ctx *ctx, uint8_t operations, int (*callback)(struct es10b_notification_metadata_list *notificationMetadata, void *userdata), void *userdata);
 int es10b_retrieve_notifications_list(struct euicc_ctx *ctx, struct es10b_pending_notification *PendingNotification, unsigned long seqNumber);
+// All pending notifications in one transaction, the list is empty (NULL) when there are none
+int es10b_retrieve_notifications_list_all(struct euicc_ctx *ctx, struct es10b_pending_notification_list **pendingNotificationList);
 int es10b_remove_notification_from_list(struct euicc_ctx *ctx, unsigned long seqNumber);
+// Sends the removals back to back in one transaction, result[i] is what es10b_remove_notification_from_list would
+// return for seqNumber[i]. A negative return means the batch broke off and results are incomplete.
+int es10b_remove_notification_from_list_multi(struct euicc_ctx *ctx, const unsigned long *seqNumber, int *result, uint32_t count);
 
 void es10b_notification_metadata_list_free_all(struct es10b_notification_metadata_list *notificationMetadataList);
+void es10b_notification_metadata_array_free(struct es10b_notification_metadata_array *notificationMetadataArray);
 void es10b_pending_notification_free(struct es10b_pending_notification *PendingNotification);
+void es10b_pending_notification_list_free_all(struct es10b_pending_notification_list *pendingNotificationList);
 
 int es10b_get_rat(struct euicc_ctx *ctx, struct es10b_rat **ratList);
 void es10b_rat_list_free_all(struct es10b_rat *ratList);
@@ -0,0 +1,40 @@
+#pragma once
+#include "es10b.h"
+#include "derutil.h"
+
+// Sends a BoundProfilePackage to the eUICC while it is still arriving, each command goes out as soon as its TLV is complete
+struct es10b_load_bound_profile_package_stream
+{
+    struct euicc_ctx *ctx;
+    struct es10b_load_bound_profile_package_result *result;
+    struct euicc_derutil_stream der;
+    uint8_t header[2 + 1 + 4];
+    uint8_t header_len;
+    uint8_t stage;
+    // Optional. A larger BoundProfilePackage is refused before its first command, 0 for no limit
+    uint32_t max_length;
+    uint8_t refused;
+    // Optional. A TLV that is handed to the eUICC whole and larger than this fails the load, 0 for no limit
+    uint32_t element_max;
+    uint8_t oversized;
+    // Elements of sequenceOf88 and sequenceOf86 are queued up to this many bytes and sent as one batch when the APDU
+    // interface has transmit_batch, 0 sends each one as soon as it is complete
+    uint32_t batch_max;
+    uint8_t *batch;
+    uint32_t batch_len;
+    uint32_t batch_capacity;
+    unsigned *batch_lens;
+    unsigned batch_count;
+    unsigned batch_lens_capacity;
+    // The sequence being sent and how many of its elements were, for ctx->progress
+    uint16_t tag;
+    uint32_t element;
+    // Set between init and free, while ctx->operation has the load open
+    uint8_t operation;
+};
+
+int es10b_load_bound_profile_package_stream_init(struct es10b_load_bound_profile_package_stream *stream, struct euicc_ctx *ctx, struct es10b_load_bound_profile_package_result *result);
+int es10b_load_bound_profile_package_stream_feed(struct es10b_load_bound_profile_package_stream *stream, const uint8_t *buffer, uint32_t buffer_len);
+// Returns -1 unless a complete BoundProfilePackage was sent
+int es10b_load_bound_profile_package_stream_finish(struct es10b_load_bound_profile_package_stream *stream);
+void es10b_load_bound_profile_package_stream_free(struct es10b_load_bound_profile_package_stream *stream);
@@ -4,221 +4,414 @@
 #include "derutil.h"
 #include "hexutil.h"
 #include "base64.h"
+#include "arena.h"
+#include "derschema.h"
 
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include "pool.private.h"
+
+static const int es10c_profile_state_values[] = {ES10C_PROFILE_STATE_DISABLED, ES10C_PROFILE_STATE_ENABLED};
+static const struct euicc_derschema_enum es10c_profile_state_enum = {
+    .absent = ES10C_PROFILE_STATE_NULL,
+    .undefined = ES10C_PROFILE_STATE_UNDEFINED,
+    .values = es10c_profile_state_values,
+    .values_count = sizeof(es10c_profile_state_values) / sizeof(es10c_profile_state_values[0]),
+};
+
+static const int es10c_icon_type_values[] = {ES10C_ICON_TYPE_JPEG, ES10C_ICON_TYPE_PNG};
+static const struct euicc_derschema_enum es10c_icon_type_enum = {
+    .absent = ES10C_ICON_TYPE_NULL,
+    .undefined = ES10C_ICON_TYPE_UNDEFINED,
+    .values = es10c_icon_type_values,
+    .values_count = sizeof(es10c_icon_type_values) / sizeof(es10c_icon_type_values[0]),
+};
+
+static const int es10c_profile_class_values[] = {ES10C_PROFILE_CLASS_TEST, ES10C_PROFILE_CLASS_PROVISIONING, ES10C_PROFILE_CLASS_OPERATIONAL};
+static const struct euicc_derschema_enum es10c_profile_class_enum = {
+    .absent = ES10C_PROFILE_CLASS_NULL,
+    .undefined = ES10C_PROFILE_CLASS_UNDEFINED,
+    .values = es10c_profile_class_values,
+    .values_count = sizeof(es10c_profile_class_values) / sizeof(es10c_profile_class_values[0]),
+};
+
+// ProfileInfo
+static const struct euicc_derschema_field es10c_profile_info_schema[] = {
+    EUICC_DERSCHEMA_FIELD(0x5A, EUICC_DERSCHEMA_GSMBCD, struct es10c_profile_info_list, iccid, NULL),
+    EUICC_DERSCHEMA_FIELD(0x4F, EUICC_DERSCHEMA_HEX, struct es10c_profile_info_list, isdpAid, NULL),
+    EUICC_DERSCHEMA_FIELD(0x9F70, EUICC_DERSCHEMA_ENUM, struct es10c_profile_info_list, profileState, &es10c_profile_state_enum),
+    EUICC_DERSCHEMA_FIELD(0x90, EUICC_DERSCHEMA_UTF8STRING, struct es10c_profile_info_list, profileNickname, NULL),
+    EUICC_DERSCHEMA_FIELD(0x91, EUICC_DERSCHEMA_UTF8STRING, struct es10c_profile_info_list, serviceProviderName, NULL),
+    EUICC_DERSCHEMA_FIELD(0x92, EUICC_DERSCHEMA_UTF8STRING, struct es10c_profile_info_list, profileName, NULL),
+    EUICC_DERSCHEMA_FIELD(0x93, EUICC_DERSCHEMA_ENUM, struct es10c_profile_info_list, iconType, &es10c_icon_type_enum),
+    EUICC_DERSCHEMA_FIELD(0x94, EUICC_DERSCHEMA_OCTETS, struct es10c_profile_info_list, icon, NULL),
+    EUICC_DERSCHEMA_FIELD(0x95, EUICC_DERSCHEMA_ENUM, struct es10c_profile_info_list, profileClass, &es10c_profile_class_enum),
+    EUICC_DERSCHEMA_FIELD(0xB6, EUICC_DERSCHEMA_REPORT, struct es10c_profile_info_list, notificationConfigurationInfo, NULL),
+    EUICC_DERSCHEMA_FIELD(0xB7, EUICC_DERSCHEMA_REPORT, struct es10c_profile_info_list, profileOwner, NULL),
+    EUICC_DERSCHEMA_FIELD(0xB8, EUICC_DERSCHEMA_REPORT, struct es10c_profile_info_list, dpProprietaryData, NULL),
+    EUICC_DERSCHEMA_FIELD(0x99, EUICC_DERSCHEMA_REPORT, struct es10c_profile_info_list, profilePolicyRules, NULL),
+    EUICC_DERSCHEMA_END,
+};
+
+static const char *es10c_ppr_desc[] = {"pprUpdateControl", "ppr1", "ppr2", "ppr3", NULL};
+
+// StoreMetadataRequest.profileOwner
+static const struct euicc_derschema_field es10c_profile_owner_schema[] = {
+    EUICC_DERSCHEMA_FIELD(0x80, EUICC_DERSCHEMA_HEX_ALLOC, struct es10c_profile_metadata, profileOwner.mccmnc, NULL),
+    EUICC_DERSCHEMA_FIELD(0x81, EUICC_DERSCHEMA_HEX_ALLOC, struct es10c_profile_metadata, profileOwner.gid1, NULL),
+    EUICC_DERSCHEMA_FIELD(0x82, EUICC_DERSCHEMA_HEX_ALLOC, struct es10c_profile_metadata, profileOwner.gid2, NULL),
+    EUICC_DERSCHEMA_END,
+};
+
+// StoreMetadataRequest, the tags it shares with ProfileInfo
+static const struct euicc_derschema_field es10c_profile_metadata_schema[] = {
+    EUICC_DERSCHEMA_FIELD(0x5A, EUICC_DERSCHEMA_GSMBCD, struct es10c_profile_metadata, iccid, NULL),
+    EUICC_DERSCHEMA_FIELD(0x91, EUICC_DERSCHEMA_UTF8STRING, struct es10c_profile_metadata, serviceProviderName, NULL),
+    EUICC_DERSCHEMA_FIELD(0x92, EUICC_DERSCHEMA_UTF8STRING, struct es10c_profile_metadata, profileName, NULL),
+    EUICC_DERSCHEMA_FIELD(0x93, EUICC_DERSCHEMA_ENUM, struct es10c_profile_metadata, iconType, &es10c_icon_type_enum),
+    EUICC_DERSCHEMA_FIELD(0x94, EUICC_DERSCHEMA_OCTETS, struct es10c_profile_metadata, icon, NULL),
+    EUICC_DERSCHEMA_FIELD(0x95, EUICC_DERSCHEMA_ENUM, struct es10c_profile_metadata, profileClass, &es10c_profile_class_enum),
+    EUICC_DERSCHEMA_FIELD(0xB7, EUICC_DERSCHEMA_SEQUENCE, struct es10c_profile_metadata, profileOwner, es10c_profile_owner_schema),
+    EUICC_DERSCHEMA_FIELD(0x99, EUICC_DERSCHEMA_NAMED_BITS, struct es10c_profile_metadata, profilePolicyRules, es10c_ppr_desc),
+    EUICC_DERSCHEMA_END,
+};
+
+static struct es10c_profile_info_list *es10c_profile_info_decode(struct euicc_arena *arena, const struct euicc_derutil_node *n_ProfileInfo)
+{
+    struct es10c_profile_info_list *p;
 
-int es10c_get_profiles_info(struct euicc_ctx *ctx, struct es10c_profile_info_list **profileInfoList)
+    p = euicc_arena_alloc(arena, sizeof(struct es10c_profile_info_list));
+    if (!p)
+    {
+        return NULL;
+    }
+
+    if (euicc_derschema_decode(p, es10c_profile_info_schema, arena, n_ProfileInfo->value, n_ProfileInfo->length) < 0)
+    {
+        return NULL;
+    }
+
+    return p;
+}
+
+// Zeroed slot at the end of the array, the array grows geometrically
+static struct es10c_profile_info_list *es10c_profile_info_array_append(struct es10c_profile_info_array *array)
 {
-    int fret = 0;
-    struct euicc_derutil_node n_request = {
-        .tag = 0xBF2D, // ProfileInfoListRequest
-    };
-    uint32_t reqlen;
-    uint8_t *respbuf = NULL;
-    unsigned resplen;
+    struct es10c_profile_info_list *p;
 
-    struct euicc_derutil_node tmpnode, n_profileInfoListOk, n_ProfileInfo;
+    if (array->count == array->_internal.capacity)
+    {
+        uint32_t capacity_new = array->_internal.capacity ? array->_internal.capacity * 2 : 8;
+        struct es10c_profile_info_list *profiles_new;
 
-    struct es10c_profile_info_list *list_wptr = NULL;
+        profiles_new = euicc_allocator_realloc(array->_internal.arena->allocator, array->profiles, capacity_new * sizeof(struct es10c_profile_info_list));
+        if (!profiles_new)
+        {
+            return NULL;
+        }
+        array->profiles = profiles_new;
+        array->_internal.capacity = capacity_new;
+    }
 
-    int tmpint;
+    p = &array->profiles[array->count++];
+    memset(p, 0, sizeof(struct es10c_profile_info_list));
+    return p;
+}
 
-    *profileInfoList = NULL;
+struct es10c_get_profiles_info_iter_userdata
+{
+    const struct euicc_allocator *allocator;
+    struct euicc_arena *arena;
+    // Decodes straight into the array instead of calling back
+    struct es10c_profile_info_array *array;
+    int (*callback)(struct es10c_profile_info_list *profileInfo, void *userdata);
+    void *userdata;
+};
+
+static int iter_es10c_get_profiles_info(const struct euicc_derutil_node *node, void *userdata)
+{
+    struct es10c_get_profiles_info_iter_userdata *ud = (struct es10c_get_profiles_info_iter_userdata *)userdata;
+    struct euicc_arena *arena = ud->arena;
+    struct es10c_profile_info_list *p;
 
-    reqlen = sizeof(ctx->apdu._internal.request_buffer.body);
-    if (euicc_derutil_pack(ctx->apdu._internal.request_buffer.body, &reqlen, &n_request))
+    if (node->tag != 0xE3)
     {
-        goto err;
+        return 0;
     }
 
-    if (es10x_command(ctx, &respbuf, &resplen, ctx->apdu._internal.request_buffer.body, reqlen) < 0)
+    if (ud->array)
     {
-        goto err;
+        p = es10c_profile_info_array_append(ud->array);
+        if (!p)
+        {
+            return -1;
+        }
+        return euicc_derschema_decode(p, es10c_profile_info_schema, arena, node->value, node->length);
     }
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, n_request.tag, respbuf, resplen) < 0)
+    if (arena == NULL)
     {
-        goto err;
+        // A standalone element gets its own arena, sized from the encoded length so it needs a single block
+        arena = euicc_arena_new(ud->allocator, sizeof(struct es10c_profile_info_list) + node->self.length * 2);
+        if (!arena)
+        {
+            return -1;
+        }
     }
 
-    if (euicc_derutil_unpack_find_tag(&n_profileInfoListOk, 0xA0, tmpnode.value, tmpnode.length) < 0)
+    p = es10c_profile_info_decode(arena, node);
+    if (!p)
     {
-        goto err;
+        if (arena != ud->arena)
+        {
+            euicc_arena_free(arena);
+        }
+        return -1;
+    }
+
+    if (arena != ud->arena)
+    {
+        p->_internal.arena = arena;
     }
 
-    n_ProfileInfo.self.ptr = n_profileInfoListOk.value;
-    n_ProfileInfo.self.length = 0;
+    return ud->callback(p, ud->userdata);
+}
+
+// ProfileInfoListRequest, with searchCriteria and tagList when a filter is given
+static int es10c_profile_info_request_encode(struct euicc_ctx *ctx, const struct es10c_profile_info_filter *filter, const uint8_t **reqbuf, uint32_t *reqlen)
+{
+    struct euicc_derutil_writer writer;
+    uint8_t id[16];
+    int id_len = -1;
+    uint16_t id_tag = 0;
+    uint8_t tag_list[ES10C_PROFILE_INFO_FILTER_TAGS_MAX * 2];
+    uint32_t tag_list_len = 0;
 
-    while (euicc_derutil_unpack_next(&n_ProfileInfo, &n_ProfileInfo, n_profileInfoListOk.value, n_profileInfoListOk.length) == 0)
+    if (filter == NULL)
     {
-        struct es10c_profile_info_list *p;
+        *reqbuf = ctx->apdu._internal.request_buffer.body;
+        *reqlen = es10x_template_emit(ctx, ES10X_TEMPLATE_PROFILE_INFO_LIST, NULL, NULL);
+        return 0;
+    }
 
-        if (n_ProfileInfo.tag != 0xE3)
-        {
-            continue;
-        }
+    if (filter->isdpAid)
+    {
+        id_len = euicc_hexutil_hex2bin(id, sizeof(id), filter->isdpAid);
+        id_tag = 0x4F;
+    }
+    else if (filter->iccid)
+    {
+        id_len = euicc_hexutil_gsmbcd2bin(id, sizeof(id), filter->iccid, 10);
+        id_tag = 0x5A;
+    }
+    else if (filter->profileClass)
+    {
+        id[0] = *filter->profileClass;
+        id_len = 1;
+        id_tag = 0x95;
+    }
+    if (id_tag && id_len < 0)
+    {
+        return -1;
+    }
 
-        p = malloc(sizeof(struct es10c_profile_info_list));
-        if (!p)
+    if (filter->tagList_count > ES10C_PROFILE_INFO_FILTER_TAGS_MAX)
+    {
+        return -1;
+    }
+    for (uint32_t i = 0; i < filter->tagList_count; i++)
+    {
+        if (filter->tagList[i] > 0xFF)
         {
-            goto err;
+            tag_list[tag_list_len++] = filter->tagList[i] >> 8;
         }
+        tag_list[tag_list_len++] = filter->tagList[i] & 0xFF;
+    }
 
-        memset(p, 0, sizeof(*p));
+    // Children are written last to first
+    euicc_derutil_writer_init(&writer, ctx->apdu._internal.request_buffer.body, sizeof(ctx->apdu._internal.request_buffer.body));
+    if (tag_list_len)
+    {
+        euicc_derutil_writer_tlv(&writer, 0x5C, tag_list, tag_list_len);
+    }
+    if (id_tag)
+    {
+        uint32_t mark = euicc_derutil_writer_mark(&writer);
 
-        tmpnode.self.ptr = n_ProfileInfo.value;
-        tmpnode.self.length = 0;
+        euicc_derutil_writer_tlv(&writer, id_tag, id, id_len);
+        euicc_derutil_writer_wrap(&writer, 0xA0, mark);
+    }
+    euicc_derutil_writer_wrap(&writer, 0xBF2D, 0);
 
-        p->profileState = ES10C_PROFILE_STATE_NULL;
-        p->profileClass = ES10C_PROFILE_CLASS_NULL;
-        p->iconType = ES10C_ICON_TYPE_NULL;
+    return euicc_derutil_writer_finish(&writer, reqbuf, reqlen);
+}
 
-        while (euicc_derutil_unpack_next(&tmpnode, &tmpnode, n_ProfileInfo.value, n_ProfileInfo.length) == 0)
-        {
-            switch (tmpnode.tag)
-            {
-            case 0x5A:
-                euicc_hexutil_bin2gsmbcd(p->iccid, sizeof(p->iccid), tmpnode.value, tmpnode.length);
-                break;
-            case 0x4F:
-                euicc_hexutil_bin2hex(p->isdpAid, sizeof(p->isdpAid), tmpnode.value, tmpnode.length);
-                break;
-            case 0x9F70:
-                tmpint = euicc_derutil_convert_bin2long(tmpnode.value, tmpnode.length);
-                switch (tmpint)
-                {
-                case ES10C_PROFILE_STATE_DISABLED:
-                case ES10C_PROFILE_STATE_ENABLED:
-                    p->profileState = tmpint;
-                    break;
-                default:
-                    p->profileState = ES10C_PROFILE_STATE_UNDEFINED;
-                    break;
-                }
-                break;
-            case 0x90:
-                p->profileNickname = malloc(tmpnode.length + 1);
-                if (p->profileNickname)
-                {
-                    memcpy(p->profileNickname, tmpnode.value, tmpnode.length);
-                    p->profileNickname[tmpnode.length] = '\0';
-                }
-                break;
-            case 0x91:
-                p->serviceProviderName = malloc(tmpnode.length + 1);
-                if (p->serviceProviderName)
-                {
-                    memcpy(p->serviceProviderName, tmpnode.value, tmpnode.length);
-                    p->serviceProviderName[tmpnode.length] = '\0';
-                }
-                break;
-            case 0x92:
-                p->profileName = malloc(tmpnode.length + 1);
-                if (p->profileName)
-                {
-                    memcpy(p->profileName, tmpnode.value, tmpnode.length);
-                    p->profileName[tmpnode.length] = '\0';
-                }
-                break;
-            case 0x93:
-                tmpint = euicc_derutil_convert_bin2long(tmpnode.value, tmpnode.length);
-                switch (tmpint)
-                {
-                case ES10C_ICON_TYPE_JPEG:
-                case ES10C_ICON_TYPE_PNG:
-                    p->iconType = tmpint;
-                    break;
-                default:
-                    p->iconType = ES10C_ICON_TYPE_UNDEFINED;
-                    break;
-                }
-                break;
-            case 0x94:
-                p->icon = malloc(euicc_base64_encode_len(tmpnode.length));
-                if (p->icon)
-                {
-                    euicc_base64_encode(p->icon, tmpnode.value, tmpnode.length);
-                }
-                break;
-            case 0x95:
-                tmpint = euicc_derutil_convert_bin2long(tmpnode.value, tmpnode.length);
-                switch (tmpint)
-                {
-                case ES10C_PROFILE_CLASS_TEST:
-                case ES10C_PROFILE_CLASS_PROVISIONING:
-                case ES10C_PROFILE_CLASS_OPERATIONAL:
-                    p->profileClass = tmpint;
-                    break;
-                default:
-                    p->profileClass = ES10C_PROFILE_CLASS_UNDEFINED;
-                    break;
-                }
-                break;
-            case 0xB6:
-            case 0xB7:
-            case 0xB8:
-            case 0x99:
-                fprintf(stderr, "\n[PLEASE REPORT][TODO][TAG %02X]: ", tmpnode.tag);
-                for (uint32_t i = 0; i < tmpnode.self.length; i++)
-                {
-                    fprintf(stderr, "%02X ", tmpnode.self.ptr[i]);
-                }
-                fprintf(stderr, "\n");
-                break;
-            }
-        }
+static int es10c_get_profiles_info_stream(struct euicc_ctx *ctx, const struct es10c_profile_info_filter *filter, struct euicc_arena *arena, struct es10c_profile_info_array *array, int (*callback)(struct es10c_profile_info_list *profileInfo, void *userdata), void *userdata)
+{
+    int fret = 0;
+    static const uint16_t path[] = {
+        0xBF2D, // ProfileInfoListResponse
+        0xA0,   // profileInfoListOk
+    };
+    const uint8_t *reqbuf;
+    uint32_t reqlen;
+    struct euicc_derutil_stream stream;
+    struct es10c_get_profiles_info_iter_userdata ud = {
+        .allocator = ctx->allocator,
+        .arena = arena,
+        .array = array,
+        .callback = callback,
+        .userdata = userdata,
+    };
 
-        if (*profileInfoList == NULL)
-        {
-            *profileInfoList = p;
-        }
-        else
-        {
-            list_wptr->next = p;
-        }
+    if (es10c_profile_info_request_encode(ctx, filter, &reqbuf, &reqlen) < 0)
+    {
+        return -1;
+    }
 
-        list_wptr = p;
+    euicc_operation(ctx, "es10c_get_profiles_info", 0);
+
+    if (euicc_derutil_stream_init(&stream, path, sizeof(path) / sizeof(path[0]), iter_es10c_get_profiles_info, &ud) < 0)
+    {
+        euicc_operation(ctx, "es10c_get_profiles_info", 1);
+        return -1;
+    }
+
+    if (es10x_command_stream(ctx, reqbuf, reqlen, &stream) < 0)
+    {
+        goto err;
     }
 
     goto exit;
 
 err:
     fret = -1;
-    es10c_profile_info_list_free_all(*profileInfoList);
 exit:
-    free(respbuf);
-    respbuf = NULL;
+    euicc_derutil_stream_free(&stream);
+    euicc_operation(ctx, "es10c_get_profiles_info", 1);
     return fret;
 }
 
+int es10c_get_profiles_info_iter(struct euicc_ctx *ctx, int (*callback)(struct es10c_profile_info_list *profileInfo, void *userdata), void *userdata)
+{
+    return es10c_get_profiles_info_stream(ctx, NULL, NULL, NULL, callback, userdata);
+}
+
+int es10c_get_profiles_info_filtered_iter(struct euicc_ctx *ctx, const struct es10c_profile_info_filter *filter, int (*callback)(struct es10c_profile_info_list *profileInfo, void *userdata), void *userdata)
+{
+    return es10c_get_profiles_info_stream(ctx, filter, NULL, NULL, callback, userdata);
+}
+
+struct es10c_get_profiles_info_userdata
+{
+    struct es10c_profile_info_list *head;
+    struct es10c_profile_info_list *tail;
+};
+
+static int iter_es10c_get_profiles_info_append(struct es10c_profile_info_list *profileInfo, void *userdata)
+{
+    struct es10c_get_profiles_info_userdata *ud = (struct es10c_get_profiles_info_userdata *)userdata;
+
+    if (ud->head == NULL)
+    {
+        ud->head = profileInfo;
+    }
+    else
+    {
+        ud->tail->next = profileInfo;
+    }
+
+    ud->tail = profileInfo;
+    return 0;
+}
+
+int es10c_get_profiles_info_filtered(struct euicc_ctx *ctx, const struct es10c_profile_info_filter *filter, struct es10c_profile_info_list **profileInfoList)
+{
+    struct es10c_get_profiles_info_userdata ud = {0};
+    struct euicc_arena *arena;
+
+    *profileInfoList = NULL;
+
+    // The whole list shares one arena owned by its head
+    arena = euicc_arena_new(ctx->allocator, EUICC_ARENA_LIST_SIZE_HINT);
+    if (!arena)
+    {
+        return -1;
+    }
+
+    if (es10c_get_profiles_info_stream(ctx, filter, arena, NULL, iter_es10c_get_profiles_info_append, &ud) < 0)
+    {
+        euicc_arena_free(arena);
+        return -1;
+    }
+
+    if (ud.head == NULL)
+    {
+        euicc_arena_free(arena);
+        return 0;
+    }
+
+    ud.head->_internal.arena = arena;
+    *profileInfoList = ud.head;
+    return 0;
+}
+
+int es10c_get_profiles_info(struct euicc_ctx *ctx, struct es10c_profile_info_list **profileInfoList)
+{
+    return es10c_get_profiles_info_filtered(ctx, NULL, profileInfoList);
+}
+
+int es10c_get_profiles_info_v(struct euicc_ctx *ctx, const struct es10c_profile_info_filter *filter, struct es10c_profile_info_array *profileInfoArray)
+{
+    memset(profileInfoArray, 0, sizeof(struct es10c_profile_info_array));
+
+    profileInfoArray->_internal.arena = euicc_arena_new(ctx->allocator, EUICC_ARENA_LIST_SIZE_HINT);
+    if (!profileInfoArray->_internal.arena)
+    {
+        return -1;
+    }
+
+    if (es10c_get_profiles_info_stream(ctx, filter, profileInfoArray->_internal.arena, profileInfoArray, NULL, NULL) < 0)
+    {
+        es10c_profile_info_array_free(profileInfoArray);
+        return -1;
+    }
+
+    // Linked only now, the array may have moved while it grew
+    for (uint32_t i = 0; i + 1 < profileInfoArray->count; i++)
+    {
+        profileInfoArray->profiles[i].next = &profileInfoArray->profiles[i + 1];
+    }
+
+    return 0;
+}
+
 static int es10c_enable_disable_delete_profile(struct euicc_ctx *ctx, uint16_t op_tag, const char *str_id, uint8_t refreshFlag)
 {
     int fret = 0;
     uint8_t id[16];
     int id_len;
-    struct euicc_derutil_node n_request, n_choicer, n_profileIdentifierChoice, n_refreshFlag;
+    uint16_t id_tag;
+    struct euicc_derutil_writer writer;
+    const uint8_t *reqbuf;
     uint32_t reqlen;
     uint8_t *respbuf = NULL;
     unsigned resplen;
+    int with_refresh;
+    int refresh = 0;
 
     struct euicc_derutil_node tmpnode;
 
-    memset(&n_request, 0, sizeof(n_request));
-    memset(&n_choicer, 0, sizeof(n_choicer));
-    memset(&n_profileIdentifierChoice, 0, sizeof(n_profileIdentifierChoice));
-    memset(&n_refreshFlag, 0, sizeof(n_refreshFlag));
-
     if (strlen(str_id) == 32)
     {
         if ((id_len = euicc_hexutil_hex2bin(id, sizeof(id), str_id)) < 0)
         {
             return -1;
         }
-        n_profileIdentifierChoice.tag = 0x4F;
+        id_tag = 0x4F;
     }
     else
     {
@@ -226,48 +419,63 @@ static int es10c_enable_disable_delete_profile(struct euicc_ctx *ctx, uint16_t o
         {
             return -1;
         }
-        n_profileIdentifierChoice.tag = 0x5A;
+        id_tag = 0x5A;
     }
-    n_profileIdentifierChoice.length = id_len;
-    n_profileIdentifierChoice.value = id;
 
-    if (refreshFlag & 0x80)
+    with_refresh = refreshFlag & 0x80;
+    if (with_refresh)
     {
         refreshFlag &= 0x7F;
 
         if (refreshFlag)
         {
             refreshFlag = 0xFF;
+            refresh = 1;
         }
+    }
 
-        n_refreshFlag.tag = 0x81;
-        n_refreshFlag.length = 1;
-        n_refreshFlag.value = &refreshFlag;
-
-        n_choicer.tag = 0xA0;
-        n_choicer.pack.child = &n_profileIdentifierChoice;
-        n_choicer.pack.next = &n_refreshFlag;
-
-        n_request.pack.child = &n_choicer;
+    // By ICCID the request has a fixed shape, by ISD-P AID it is built
+    if (id_tag == 0x5A && id_len == 10 && with_refresh && (op_tag == 0xBF31 || op_tag == 0xBF32))
+    {
+        reqbuf = ctx->apdu._internal.request_buffer.body;
+        reqlen = es10x_template_emit(ctx, op_tag == 0xBF31 ? ES10X_TEMPLATE_ENABLE_ICCID : ES10X_TEMPLATE_DISABLE_ICCID, id, &refreshFlag);
     }
-    else
+    else if (id_tag == 0x5A && id_len == 10 && !with_refresh && op_tag == 0xBF33)
     {
-        n_request.pack.child = &n_profileIdentifierChoice;
+        reqbuf = ctx->apdu._internal.request_buffer.body;
+        reqlen = es10x_template_emit(ctx, ES10X_TEMPLATE_DELETE_ICCID, id, NULL);
     }
-    n_request.tag = op_tag;
-
-    reqlen = sizeof(ctx->apdu._internal.request_buffer.body);
-    if (euicc_derutil_pack(ctx->apdu._internal.request_buffer.body, &reqlen, &n_request))
+    else
     {
-        goto err;
+        // Children are written last to first
+        euicc_derutil_writer_init(&writer, ctx->apdu._internal.request_buffer.body, sizeof(ctx->apdu._internal.request_buffer.body));
+        if (with_refresh)
+        {
+            uint32_t mark;
+
+            euicc_derutil_writer_tlv(&writer, 0x81, &refreshFlag, 1);
+            mark = euicc_derutil_writer_mark(&writer);
+            euicc_derutil_writer_tlv(&writer, id_tag, id, id_len);
+            euicc_derutil_writer_wrap(&writer, 0xA0, mark);
+        }
+        else
+        {
+            euicc_derutil_writer_tlv(&writer, id_tag, id, id_len);
+        }
+        euicc_derutil_writer_wrap(&writer, op_tag, 0);
+
+        if (euicc_derutil_writer_finish(&writer, &reqbuf, &reqlen) < 0)
+        {
+            goto err;
+        }
     }
 
-    if (es10x_command(ctx, &respbuf, &resplen, ctx->apdu._internal.request_buffer.body, reqlen) < 0)
+    if (es10x_command(ctx, &respbuf, &resplen, reqbuf, reqlen) < 0)
     {
         goto err;
     }
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, n_request.tag, respbuf, resplen) < 0)
+    if (euicc_derutil_unpack_find_tag(&tmpnode, op_tag, respbuf, resplen) < 0)
     {
         goto err;
     }
@@ -278,14 +486,17 @@ static int es10c_enable_disable_delete_profile(struct euicc_ctx *ctx, uint16_t o
     }
 
     fret = euicc_derutil_convert_bin2long(tmpnode.value, tmpnode.length);
+    if (fret == 0 && refresh)
+    {
+        // The eUICC asks for a REFRESH and resets, the next command has to reconnect
+        ctx->apdu._internal.refresh_pending = 1;
+    }
 
     goto exit;
 
 err:
     fret = -1;
 exit:
-    free(respbuf);
-    respbuf = NULL;
     return fret;
 }
 
@@ -323,34 +534,20 @@ int es10c_delete_profile(struct euicc_ctx *ctx, const char *id)
 int es10c_euicc_memory_reset(struct euicc_ctx *ctx)
 {
     int fret = 0;
-    struct euicc_derutil_node n_request = {
-        .tag = 0xBF34, // EuiccMemoryResetRequest
-        .pack = {
-            .child = &(struct euicc_derutil_node){
-                .tag = 0x82, // resetOptions
-                .length = 2,
-                .value = (const uint8_t[]){0x05, 0xE0},
-            },
-        },
-    };
-    uint32_t reqlen;
+    unsigned reqlen;
     uint8_t *respbuf = NULL;
     unsigned resplen;
 
     struct euicc_derutil_node tmpnode;
 
-    reqlen = sizeof(ctx->apdu._internal.request_buffer.body);
-    if (euicc_derutil_pack(ctx->apdu._internal.request_buffer.body, &reqlen, &n_request))
-    {
-        goto err;
-    }
+    reqlen = es10x_template_emit(ctx, ES10X_TEMPLATE_MEMORY_RESET, NULL, NULL);
 
     if (es10x_command(ctx, &respbuf, &resplen, ctx->apdu._internal.request_buffer.body, reqlen) < 0)
     {
         goto err;
     }
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, n_request.tag, respbuf, resplen) < 0)
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xBF34, respbuf, resplen) < 0)
     {
         goto err;
     }
@@ -367,42 +564,26 @@ int es10c_euicc_memory_reset(struct euicc_ctx *ctx)
 err:
     fret = -1;
 exit:
-    free(respbuf);
-    respbuf = NULL;
     return fret;
 }
 
 int es10c_get_eid(struct euicc_ctx *ctx, char **eidValue)
 {
     int fret = 0;
-    struct euicc_derutil_node n_request = {
-        .tag = 0xBF3E, // GetEuiccDataRequest
-        .pack = {
-            .child = &(struct euicc_derutil_node){
-                .tag = 0x5C, // tagList
-                .length = 1,
-                .value = (const uint8_t[]){0x5A},
-            },
-        },
-    };
-    uint32_t reqlen;
+    unsigned reqlen;
     uint8_t *respbuf = NULL;
     unsigned resplen;
 
     struct euicc_derutil_node tmpnode;
 
-    reqlen = sizeof(ctx->apdu._internal.request_buffer.body);
-    if (euicc_derutil_pack(ctx->apdu._internal.request_buffer.body, &reqlen, &n_request))
-    {
-        goto err;
-    }
+    reqlen = es10x_template_emit(ctx, ES10X_TEMPLATE_GET_EID, NULL, NULL);
 
     if (es10x_command(ctx, &respbuf, &resplen, ctx->apdu._internal.request_buffer.body, reqlen) < 0)
     {
         goto err;
     }
 
-    if (euicc_derutil_unpack_find_tag(&tmpnode, n_request.tag, respbuf, resplen))
+    if (euicc_derutil_unpack_find_tag(&tmpnode, 0xBF3E, respbuf, resplen))
     {
         goto err;
     }
@@ -427,8 +608,6 @@ err:
     free(*eidValue);
     *eidValue = NULL;
 exit:
-    free(respbuf);
-    respbuf = NULL;
     return fret;
 }
 
@@ -492,21 +671,91 @@ int es10c_set_nickname(struct euicc_ctx *ctx, const char *iccid, const char *pro
 err:
     fret = -1;
 exit:
-    free(respbuf);
-    respbuf = NULL;
     return fret;
 }
 
+char *es10c_profile_icon_b64(const struct es10c_profile_info_list *profileInfo)
+{
+    char *b64;
+
+    if (!profileInfo->icon.data)
+    {
+        return NULL;
+    }
+
+    b64 = malloc(euicc_base64_encode_len(profileInfo->icon.length));
+    if (!b64)
+    {
+        return NULL;
+    }
+    euicc_base64_encode(b64, profileInfo->icon.data, profileInfo->icon.length);
+
+    return b64;
+}
+
 void es10c_profile_info_list_free_all(struct es10c_profile_info_list *profileInfoList)
 {
-    while (profileInfoList)
+    if (!profileInfoList)
+    {
+        return;
+    }
+
+    euicc_arena_free(profileInfoList->_internal.arena);
+}
+
+void es10c_profile_info_array_free(struct es10c_profile_info_array *profileInfoArray)
+{
+    if (profileInfoArray->_internal.arena)
     {
-        struct es10c_profile_info_list *next = profileInfoList->next;
-        free(profileInfoList->profileNickname);
-        free(profileInfoList->serviceProviderName);
-        free(profileInfoList->profileName);
-        free(profileInfoList->icon);
-        free(profileInfoList);
-        profileInfoList = next;
+        euicc_allocator_free(profileInfoArray->_internal.arena->allocator, profileInfoArray->profiles);
     }
+    euicc_arena_free(profileInfoArray->_internal.arena);
+    memset(profileInfoArray, 0, sizeof(struct es10c_profile_info_array));
+}
+
+int es10c_profile_metadata_decode(struct es10c_profile_metadata *metadata, const uint8_t *buffer, uint32_t buffer_len)
+{
+    int fret = 0;
+    struct euicc_derutil_node n_StoreMetadataRequest;
+
+    memset(metadata, 0, sizeof(struct es10c_profile_metadata));
+
+    if (euicc_derutil_unpack_find_tag(&n_StoreMetadataRequest, 0xBF25, buffer, buffer_len) < 0)
+    {
+        goto err;
+    }
+
+    metadata->_internal.arena = euicc_arena_new(NULL, n_StoreMetadataRequest.length * 2);
+    if (!metadata->_internal.arena)
+    {
+        goto err;
+    }
+
+    if (euicc_derschema_decode(metadata, es10c_profile_metadata_schema, metadata->_internal.arena, n_StoreMetadataRequest.value, n_StoreMetadataRequest.length) < 0)
+    {
+        goto err;
+    }
+    if (metadata->profileClass == ES10C_PROFILE_CLASS_NULL)
+    {
+        metadata->profileClass = ES10C_PROFILE_CLASS_OPERATIONAL;
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+    es10c_profile_metadata_free(metadata);
+exit:
+    return fret;
+}
+
+void es10c_profile_metadata_free(struct es10c_profile_metadata *metadata)
+{
+    if (!metadata)
+    {
+        return;
+    }
+
+    euicc_arena_free(metadata->_internal.arena);
+    memset(metadata, 0, sizeof(struct es10c_profile_metadata));
 }
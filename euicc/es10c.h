@@ -1,6 +1,8 @@
 #pragma once
 
 #include "euicc.h"
+#include "arena.h"
+#include "derschema.h"
 
 enum es10c_profile_state
 {
@@ -37,7 +39,8 @@ struct es10c_profile_info_list
     char *serviceProviderName;
     char *profileName;
     enum es10c_icon_type iconType;
-    char *icon;
+    // The raw icon, es10c_profile_icon_b64 encodes it. data is NULL without an icon.
+    struct euicc_derschema_octets icon;
     struct
     {
         char **profileManagementOperation;
@@ -55,10 +58,74 @@ struct es10c_profile_info_list
     } dpProprietaryData;
     char **profilePolicyRules;
 
+    struct
+    {
+        struct euicc_arena *arena;
+    } _internal;
+
     struct es10c_profile_info_list *next;
 };
 
+// Profiles in one contiguous array, ready to be indexed or sorted, with their strings in one arena. next links each
+// element to the one after it, so the array can also be walked as a list. Always free it with es10c_profile_info_array_free.
+struct es10c_profile_info_array
+{
+    struct es10c_profile_info_list *profiles;
+    uint32_t count;
+
+    struct
+    {
+        struct euicc_arena *arena;
+        uint32_t capacity;
+    } _internal;
+};
+
+#define ES10C_PROFILE_INFO_FILTER_TAGS_MAX 16
+
+// ProfileInfoListRequest fields, so the card only sends what is needed
+struct es10c_profile_info_filter
+{
+    // searchCriteria, the first one set is used
+    const char *isdpAid;
+    const char *iccid;
+    const enum es10c_profile_class *profileClass;
+    // tagList, the ProfileInfo tags to return (e.g. 0x5A, 0x9F70), all of them when empty
+    const uint16_t *tagList;
+    uint32_t tagList_count;
+};
+
+// Entries of the returned list share one allocation owned by the head, free the list through the head only
+// StoreMetadataRequest, what the SM-DP+ tells of the profile before sending it. es9p_authenticate_client receives it
+// as the profileMetadata of ctx->http._internal.prepare_download_param. profileClass defaults to operational.
+struct es10c_profile_metadata
+{
+    char iccid[(10 * 2) + 1];
+    char *serviceProviderName;
+    char *profileName;
+    enum es10c_icon_type iconType;
+    struct euicc_derschema_octets icon;
+    enum es10c_profile_class profileClass;
+    struct
+    {
+        char *mccmnc;
+        char *gid1;
+        char *gid2;
+    } profileOwner;
+    const char **profilePolicyRules;
+
+    struct
+    {
+        struct euicc_arena *arena;
+    } _internal;
+};
+
 int es10c_get_profiles_info(struct euicc_ctx *ctx, struct es10c_profile_info_list **profileInfoList);
+// Calls back with each ProfileInfo as soon as it is received, the callback owns it and frees it with es10c_profile_info_list_free_all
+int es10c_get_profiles_info_iter(struct euicc_ctx *ctx, int (*callback)(struct es10c_profile_info_list *profileInfo, void *userdata), void *userdata);
+int es10c_get_profiles_info_filtered(struct euicc_ctx *ctx, const struct es10c_profile_info_filter *filter, struct es10c_profile_info_list **profileInfoList);
+int es10c_get_profiles_info_filtered_iter(struct euicc_ctx *ctx, const struct es10c_profile_info_filter *filter, int (*callback)(struct es10c_profile_info_list *profileInfo, void *userdata), void *userdata);
+// filter may be NULL for every profile with every field
+int es10c_get_profiles_info_v(struct euicc_ctx *ctx, const struct es10c_profile_info_filter *filter, struct es10c_profile_info_array *profileInfoArray);
 int es10c_enable_profile(struct euicc_ctx *ctx, const char *id, uint8_t refreshFlag);
 int es10c_disable_profile(struct euicc_ctx *ctx, const char *id, uint8_t refreshFlag);
 int es10c_delete_profile(struct euicc_ctx *ctx, const char *id);
@@ -66,4 +133,11 @@ int es10c_euicc_memory_reset(struct euicc_ctx *ctx);
 int es10c_get_eid(struct euicc_ctx *ctx, char **eidValue);
 int es10c_set_nickname(struct euicc_ctx *ctx, const char *iccid, const char *profileNickname);
 
+// The icon as base64, to free by the caller. NULL without an icon or when out of memory.
+char *es10c_profile_icon_b64(const struct es10c_profile_info_list *profileInfo);
+
 void es10c_profile_info_list_free_all(struct es10c_profile_info_list *profileInfoList);
+void es10c_profile_info_array_free(struct es10c_profile_info_array *profileInfoArray);
+
+int es10c_profile_metadata_decode(struct es10c_profile_metadata *metadata, const uint8_t *buffer, uint32_t buffer_len);
+void es10c_profile_metadata_free(struct es10c_profile_metadata *metadata);
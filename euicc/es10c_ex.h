@@ -1,6 +1,7 @@
 #pragma once
 
 #include "euicc.h"
+#include "arena.h"
 
 struct es10c_ex_euiccinfo2
 {
@@ -28,6 +29,11 @@ struct es10c_ex_euiccinfo2
         char *platformLabel;
         char *discoveryBaseURL;
     } certificationDataObject;
+
+    struct
+    {
+        struct euicc_arena *arena;
+    } _internal;
 };
 
 int es10c_ex_get_euiccinfo2(struct euicc_ctx *ctx, struct es10c_ex_euiccinfo2 *euiccinfo2);
@@ -0,0 +1,68 @@
+#include "euicc.private.h"
+
+#include <string.h>
+
+// Fixed requests, the slots are zeroed here and filled in by es10x_template_emit
+static const uint8_t template_get_eid[] = {0xBF, 0x3E, 0x03, 0x5C, 0x01, 0x5A};
+static const uint8_t template_euicc_info1[] = {0xBF, 0x20, 0x00};
+static const uint8_t template_euicc_info2[] = {0xBF, 0x22, 0x00};
+static const uint8_t template_euicc_challenge[] = {0xBF, 0x2E, 0x00};
+static const uint8_t template_configured_addresses[] = {0xBF, 0x3C, 0x00};
+static const uint8_t template_get_rat[] = {0xBF, 0x43, 0x00};
+static const uint8_t template_memory_reset[] = {0xBF, 0x34, 0x04, 0x82, 0x02, 0x05, 0xE0};
+static const uint8_t template_profile_info_list[] = {0xBF, 0x2D, 0x00};
+static const uint8_t template_list_notification[] = {0xBF, 0x28, 0x00};
+// profileManagementOperation BIT STRING: unused bits, then the bits
+static const uint8_t template_list_notification_operation[] = {0xBF, 0x28, 0x04, 0x81, 0x02, 0x00, 0x00};
+static const uint8_t template_retrieve_notifications_list[] = {0xBF, 0x2B, 0x00};
+// Enable and Disable by ICCID with refreshFlag
+#define TEMPLATE_ENABLE_DISABLE_ICCID(tag) {0xBF, tag, 0x11, 0xA0, 0x0C, 0x5A, 0x0A, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x81, 0x01, 0x00}
+static const uint8_t template_enable_iccid[] = TEMPLATE_ENABLE_DISABLE_ICCID(0x31);
+static const uint8_t template_disable_iccid[] = TEMPLATE_ENABLE_DISABLE_ICCID(0x32);
+static const uint8_t template_delete_iccid[] = {0xBF, 0x33, 0x0C, 0x5A, 0x0A, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+#define TEMPLATE(der, ...) {der, sizeof(der), {__VA_ARGS__}}
+
+static const struct es10x_template
+{
+    const uint8_t *der;
+    uint8_t length;
+    struct
+    {
+        uint8_t offset;
+        uint8_t length;
+    } slots[ES10X_TEMPLATE_SLOTS_MAX];
+} es10x_templates[] = {
+    [ES10X_TEMPLATE_GET_EID] = TEMPLATE(template_get_eid),
+    [ES10X_TEMPLATE_EUICC_INFO1] = TEMPLATE(template_euicc_info1),
+    [ES10X_TEMPLATE_EUICC_INFO2] = TEMPLATE(template_euicc_info2),
+    [ES10X_TEMPLATE_EUICC_CHALLENGE] = TEMPLATE(template_euicc_challenge),
+    [ES10X_TEMPLATE_CONFIGURED_ADDRESSES] = TEMPLATE(template_configured_addresses),
+    [ES10X_TEMPLATE_GET_RAT] = TEMPLATE(template_get_rat),
+    [ES10X_TEMPLATE_MEMORY_RESET] = TEMPLATE(template_memory_reset),
+    [ES10X_TEMPLATE_PROFILE_INFO_LIST] = TEMPLATE(template_profile_info_list),
+    [ES10X_TEMPLATE_LIST_NOTIFICATION] = TEMPLATE(template_list_notification),
+    [ES10X_TEMPLATE_LIST_NOTIFICATION_OPERATION] = TEMPLATE(template_list_notification_operation, {5, 2}),
+    [ES10X_TEMPLATE_RETRIEVE_NOTIFICATIONS_LIST] = TEMPLATE(template_retrieve_notifications_list),
+    [ES10X_TEMPLATE_ENABLE_ICCID] = TEMPLATE(template_enable_iccid, {7, 10}, {19, 1}),
+    [ES10X_TEMPLATE_DISABLE_ICCID] = TEMPLATE(template_disable_iccid, {7, 10}, {19, 1}),
+    [ES10X_TEMPLATE_DELETE_ICCID] = TEMPLATE(template_delete_iccid, {5, 10}),
+};
+
+unsigned es10x_template_emit(struct euicc_ctx *ctx, enum es10x_template_id id, const uint8_t *slot0, const uint8_t *slot1)
+{
+    const struct es10x_template *template = &es10x_templates[id];
+    uint8_t *body = ctx->apdu._internal.request_buffer.body;
+    const uint8_t *values[ES10X_TEMPLATE_SLOTS_MAX] = {slot0, slot1};
+
+    memcpy(body, template->der, template->length);
+    for (int i = 0; i < ES10X_TEMPLATE_SLOTS_MAX; i++)
+    {
+        if (template->slots[i].length)
+        {
+            memcpy(body + template->slots[i].offset, values[i], template->slots[i].length);
+        }
+    }
+
+    return template->length;
+}
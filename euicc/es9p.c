@@ -1,11 +1,15 @@
 #include "es9p.h"
 #include "es9p_errors.h"
+#include "es10b.private.h"
+#include "euicc.private.h"
+#include "base64.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <cjson/cJSON_ex.h>
+#include "pool.private.h"
 
 static const char *lpa_header[] = {
     "User-Agent: gsma-rsp-lpad",
@@ -14,74 +18,888 @@ static const char *lpa_header[] = {
     NULL,
 };
 
-static void es9p_base64_trim(char *str)
+// Pulls the value of one top level string member out of a JSON body as it arrives, everything else is kept in skeleton
+struct es9p_json_extract
 {
-    char *p = str;
+    const char *key;
+    int (*callback)(const char *data, uint32_t data_len, void *userdata);
+    void *userdata;
+    char *skeleton;
+    uint32_t skeleton_len;
+    uint32_t skeleton_capacity;
+    // 0 for no limit
+    uint32_t skeleton_max;
+    char token[32];
+    uint8_t token_len;
+    uint8_t token_overflow;
+    uint8_t depth;
+    uint8_t in_string;
+    uint8_t in_value;
+    uint8_t escape;
+    uint8_t unicode;
+    uint16_t unicode_value;
+    uint8_t key_matched;
+    uint8_t expect_value;
+    uint8_t found;
+};
+
+static int es9p_json_extract_append(struct es9p_json_extract *extract, char c)
+{
+    if (extract->skeleton_len + 1 >= extract->skeleton_capacity)
+    {
+        uint32_t capacity_new = extract->skeleton_capacity ? extract->skeleton_capacity * 2 : 256;
+        char *skeleton_new;
+
+        if (extract->skeleton_max && capacity_new > extract->skeleton_max)
+        {
+            capacity_new = extract->skeleton_max;
+        }
+        if (capacity_new <= extract->skeleton_len + 1)
+        {
+            return -1;
+        }
+
+        skeleton_new = realloc(extract->skeleton, capacity_new);
+        if (skeleton_new == NULL)
+        {
+            return -1;
+        }
+        extract->skeleton = skeleton_new;
+        extract->skeleton_capacity = capacity_new;
+    }
+
+    extract->skeleton[extract->skeleton_len++] = c;
+    extract->skeleton[extract->skeleton_len] = '\0';
+    return 0;
+}
+
+// Back to where it was before the first byte, for a response that is thrown away before the value started
+static void es9p_json_extract_reset(struct es9p_json_extract *extract)
+{
+    struct es9p_json_extract config = {
+        .key = extract->key,
+        .callback = extract->callback,
+        .userdata = extract->userdata,
+        .skeleton_max = extract->skeleton_max,
+    };
+
+    free(extract->skeleton);
+    *extract = config;
+}
+
+// Handles one character of the extracted value that needs unescaping
+static int es9p_json_extract_value_escaped(struct es9p_json_extract *extract, char c)
+{
+    char out;
+
+    if (extract->unicode)
+    {
+        int nibble;
+
+        if (c >= '0' && c <= '9')
+        {
+            nibble = c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            nibble = c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            nibble = c - 'A' + 10;
+        }
+        else
+        {
+            return -1;
+        }
+
+        extract->unicode_value = (extract->unicode_value << 4) | nibble;
+        if (--extract->unicode)
+        {
+            return 0;
+        }
+        // Anything outside ASCII is not base64 and ends the decoding anyway
+        out = extract->unicode_value < 0x80 ? (char)extract->unicode_value : '?';
+        return extract->callback(&out, 1, extract->userdata);
+    }
+
+    extract->escape = 0;
+    switch (c)
+    {
+    case 'n':
+        out = '\n';
+        break;
+    case 'r':
+        out = '\r';
+        break;
+    case 't':
+        out = '\t';
+        break;
+    case 'u':
+        extract->unicode = 4;
+        extract->unicode_value = 0;
+        return 0;
+    default:
+        out = c;
+        break;
+    }
+
+    return extract->callback(&out, 1, extract->userdata);
+}
+
+static int es9p_json_extract_feed(struct es9p_json_extract *extract, const char *data, uint32_t data_len)
+{
+    uint32_t run = 0;
+
+    for (uint32_t i = 0; i < data_len; i++)
+    {
+        char c = data[i];
+
+        if (extract->in_value)
+        {
+            if (extract->escape || extract->unicode)
+            {
+                if (es9p_json_extract_value_escaped(extract, c) < 0)
+                {
+                    return -1;
+                }
+                run = i + 1;
+                continue;
+            }
+            if (c != '\\' && c != '"')
+            {
+                continue;
+            }
+
+            // Plain characters are handed over in runs
+            if (i > run && extract->callback(data + run, i - run, extract->userdata) < 0)
+            {
+                return -1;
+            }
+            run = i + 1;
+
+            if (c == '\\')
+            {
+                extract->escape = 1;
+                continue;
+            }
+            extract->in_value = 0;
+        }
+
+        if (es9p_json_extract_append(extract, c) < 0)
+        {
+            return -1;
+        }
+
+        if (extract->in_string)
+        {
+            if (extract->escape)
+            {
+                extract->escape = 0;
+            }
+            else if (c == '\\')
+            {
+                extract->escape = 1;
+            }
+            else if (c == '"')
+            {
+                extract->in_string = 0;
+                extract->key_matched = extract->depth == 1 && !extract->token_overflow && extract->token_len == strlen(extract->key) && memcmp(extract->token, extract->key, extract->token_len) == 0;
+            }
+            else if (extract->token_len < sizeof(extract->token))
+            {
+                extract->token[extract->token_len++] = c;
+            }
+            else
+            {
+                extract->token_overflow = 1;
+            }
+            continue;
+        }
+
+        switch (c)
+        {
+        case '"':
+            if (extract->expect_value)
+            {
+                extract->expect_value = 0;
+                extract->in_value = 1;
+                extract->found = 1;
+                run = i + 1;
+                break;
+            }
+            extract->in_string = 1;
+            extract->token_len = 0;
+            extract->token_overflow = 0;
+            break;
+        case ':':
+            extract->expect_value = extract->key_matched;
+            extract->key_matched = 0;
+            break;
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+            break;
+        case '{':
+        case '[':
+            extract->depth++;
+            extract->key_matched = extract->expect_value = 0;
+            break;
+        case '}':
+        case ']':
+            extract->depth--;
+            extract->key_matched = extract->expect_value = 0;
+            break;
+        default:
+            extract->key_matched = extract->expect_value = 0;
+            break;
+        }
+    }
+
+    if (extract->in_value && data_len > run)
+    {
+        return extract->callback(data + run, data_len - run, extract->userdata);
+    }
+
+    return 0;
+}
+
+// Minimal in-place scanner for the response body, values come back as slices of the buffer
+static const char *es9p_json_skip_ws(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+    {
+        p++;
+    }
+    return p;
+}
+
+static const char *es9p_json_skip_string(const char *p, const char *end)
+{
+    for (p++; p < end; p++)
+    {
+        if (*p == '\\')
+        {
+            p++;
+        }
+        else if (*p == '"')
+        {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+// Returns the end of the value starting at p, or NULL when it is malformed
+static const char *es9p_json_skip_value(const char *p, const char *end)
+{
+    char stack[32];
+    uint8_t depth = 0;
+
+    if (p >= end)
+    {
+        return NULL;
+    }
+
+    if (*p != '{' && *p != '[' && *p != '"')
+    {
+        while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+        {
+            p++;
+        }
+        return p;
+    }
+
+    while (p < end)
+    {
+        switch (*p)
+        {
+        case '"':
+            if ((p = es9p_json_skip_string(p, end)) == NULL)
+            {
+                return NULL;
+            }
+            break;
+        case '{':
+        case '[':
+            if (depth >= sizeof(stack))
+            {
+                return NULL;
+            }
+            stack[depth++] = *p == '{' ? '}' : ']';
+            p++;
+            break;
+        case '}':
+        case ']':
+            if (depth == 0 || stack[--depth] != *p)
+            {
+                return NULL;
+            }
+            p++;
+            break;
+        default:
+            p++;
+            break;
+        }
+
+        if (depth == 0)
+        {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+// Looks up a member of the object in json, keys compare case-insensitively like cJSON_GetObjectItem
+static int es9p_json_find(const char *json, uint32_t json_len, const char *key, const char **value, uint32_t *value_len)
+{
+    const char *end = json + json_len;
+    const char *p = es9p_json_skip_ws(json, end);
+    uint32_t key_len = strlen(key);
+
+    if (p >= end || *p != '{')
+    {
+        return -1;
+    }
+    p = es9p_json_skip_ws(p + 1, end);
+
+    while (p < end && *p == '"')
+    {
+        const char *name = p + 1;
+        const char *name_end;
+        const char *v;
+        int matched;
+
+        if ((p = es9p_json_skip_string(p, end)) == NULL)
+        {
+            return -1;
+        }
+        name_end = p - 1;
+
+        matched = (uint32_t)(name_end - name) == key_len;
+        for (uint32_t i = 0; matched && i < key_len; i++)
+        {
+            char a = name[i], b = key[i];
+
+            if (a >= 'A' && a <= 'Z')
+            {
+                a += 'a' - 'A';
+            }
+            if (b >= 'A' && b <= 'Z')
+            {
+                b += 'a' - 'A';
+            }
+            matched = a == b;
+        }
+
+        p = es9p_json_skip_ws(p, end);
+        if (p >= end || *p != ':')
+        {
+            return -1;
+        }
+        v = es9p_json_skip_ws(p + 1, end);
+        if ((p = es9p_json_skip_value(v, end)) == NULL)
+        {
+            return -1;
+        }
+
+        if (matched)
+        {
+            *value = v;
+            *value_len = p - v;
+            return 0;
+        }
+
+        p = es9p_json_skip_ws(p, end);
+        if (p < end && *p == ',')
+        {
+            p = es9p_json_skip_ws(p + 1, end);
+        }
+    }
+
+    return -1;
+}
+
+static int es9p_json_is_string(const char *value, uint32_t value_len)
+{
+    return value_len >= 2 && value[0] == '"' && value[value_len - 1] == '"';
+}
+
+static int es9p_json_hex4(const char *p, uint32_t *out)
+{
+    *out = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        char c = p[i];
+
+        *out <<= 4;
+        if (c >= '0' && c <= '9')
+        {
+            *out |= c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            *out |= c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            *out |= c - 'A' + 10;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Unescapes a string value, the result is never longer than the quoted source
+static char *es9p_json_string_dup(const char *value, uint32_t value_len)
+{
+    const char *p = value + 1;
+    const char *end = value + value_len - 1;
+    char *out, *o;
+
+    out = o = malloc(value_len);
+    if (out == NULL)
+    {
+        return NULL;
+    }
+
+    while (p < end)
+    {
+        const char *run = p;
+        uint32_t cp;
+
+        while (p < end && *p != '\\')
+        {
+            p++;
+        }
+        memcpy(o, run, p - run);
+        o += p - run;
+        if (p >= end)
+        {
+            break;
+        }
+
+        if (++p >= end)
+        {
+            goto err;
+        }
+        switch (*p++)
+        {
+        case 'b':
+            *o++ = '\b';
+            continue;
+        case 'f':
+            *o++ = '\f';
+            continue;
+        case 'n':
+            *o++ = '\n';
+            continue;
+        case 'r':
+            *o++ = '\r';
+            continue;
+        case 't':
+            *o++ = '\t';
+            continue;
+        case 'u':
+            break;
+        default:
+            *o++ = p[-1];
+            continue;
+        }
+
+        if (end - p < 4 || es9p_json_hex4(p, &cp) < 0)
+        {
+            goto err;
+        }
+        p += 4;
+        if (cp >= 0xD800 && cp <= 0xDBFF)
+        {
+            uint32_t low;
+
+            if (end - p < 6 || p[0] != '\\' || p[1] != 'u' || es9p_json_hex4(p + 2, &low) < 0 || low < 0xDC00 || low > 0xDFFF)
+            {
+                goto err;
+            }
+            p += 6;
+            cp = 0x10000 + (((cp & 0x3FF) << 10) | (low & 0x3FF));
+        }
+
+        if (cp < 0x80)
+        {
+            *o++ = cp;
+        }
+        else if (cp < 0x800)
+        {
+            *o++ = 0xC0 | (cp >> 6);
+            *o++ = 0x80 | (cp & 0x3F);
+        }
+        else if (cp < 0x10000)
+        {
+            *o++ = 0xE0 | (cp >> 12);
+            *o++ = 0x80 | ((cp >> 6) & 0x3F);
+            *o++ = 0x80 | (cp & 0x3F);
+        }
+        else
+        {
+            *o++ = 0xF0 | (cp >> 18);
+            *o++ = 0x80 | ((cp >> 12) & 0x3F);
+            *o++ = 0x80 | ((cp >> 6) & 0x3F);
+            *o++ = 0x80 | (cp & 0x3F);
+        }
+    }
+
+    *o = '\0';
+    return out;
+
+err:
+    free(out);
+    return NULL;
+}
+
+// Copies a string member of json into a fixed size field, leaving it untouched when absent
+static int es9p_json_copy_string(const char *json, uint32_t json_len, const char *key, char *out, size_t out_size)
+{
+    const char *value;
+    uint32_t value_len;
+    char *str;
+
+    if (es9p_json_find(json, json_len, key, &value, &value_len) < 0 || !es9p_json_is_string(value, value_len))
+    {
+        return -1;
+    }
+    if ((str = es9p_json_string_dup(value, value_len)) == NULL)
+    {
+        return -1;
+    }
+    strncpy(out, str, out_size);
+    free(str);
+    return 0;
+}
+
+// Decodes a base64 string member into binary, straight from the received buffer unless it has escapes in it
+static int es9p_json_blob(const char *value, uint32_t value_len, struct euicc_blob *blob)
+{
+    struct euicc_base64_decoder decoder;
+    char *unescaped = NULL;
+    const char *coded = value + 1;
+    uint32_t coded_len = value_len - 2;
+    int n;
+
+    // JSON may write '/' as "\/"
+    if (memchr(coded, '\\', coded_len))
+    {
+        unescaped = es9p_json_string_dup(value, value_len);
+        if (unescaped == NULL)
+        {
+            return -1;
+        }
+        coded = unescaped;
+        coded_len = strlen(unescaped);
+    }
+
+    blob->data = malloc(euicc_base64_decoder_update_len(coded_len));
+    if (blob->data == NULL)
+    {
+        free(unescaped);
+        return -1;
+    }
+    euicc_base64_decoder_init(&decoder);
+    n = euicc_base64_decoder_update(&decoder, blob->data, coded, coded_len);
+    n += euicc_base64_decoder_finish(&decoder, blob->data + n);
+    blob->length = n;
+    free(unescaped);
+
+    return 0;
+}
+
+static int iter_es9p_json_extract(const uint8_t *data, uint32_t data_len, void *userdata)
+{
+    return es9p_json_extract_feed(userdata, (const char *)data, data_len);
+}
+
+// Requests are written as URL, NUL, then the JSON body into one buffer that lives for the whole session
+static int es9p_request_reserve(struct euicc_ctx *ctx, uint32_t n)
+{
+    uint32_t capacity = ctx->http._internal.request_buffer.capacity;
+    char *data_new;
+
+    if (ctx->http._internal.request_buffer.length + n <= capacity)
+    {
+        return 0;
+    }
+
+    if (capacity == 0)
+    {
+        capacity = 1024;
+    }
+    while (capacity < ctx->http._internal.request_buffer.length + n)
+    {
+        capacity *= 2;
+    }
+
+    data_new = euicc_realloc(ctx, ctx->http._internal.request_buffer.data, capacity);
+    if (data_new == NULL)
+    {
+        return -1;
+    }
+    ctx->http._internal.request_buffer.data = data_new;
+    ctx->http._internal.request_buffer.capacity = capacity;
+
+    return 0;
+}
+
+static int es9p_request_write(struct euicc_ctx *ctx, const char *data, uint32_t data_len)
+{
+    if (es9p_request_reserve(ctx, data_len) < 0)
+    {
+        return -1;
+    }
+    memcpy(ctx->http._internal.request_buffer.data + ctx->http._internal.request_buffer.length, data, data_len);
+    ctx->http._internal.request_buffer.length += data_len;
+    return 0;
+}
+
+// Same escaping as cJSON_PrintUnformatted, so servers see identical requests
+static int es9p_request_write_string(struct euicc_ctx *ctx, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint32_t len = strlen(str);
+    char *o;
+
+    // Worst case every byte becomes \u00XX
+    if (es9p_request_reserve(ctx, len * 6 + 2) < 0)
+    {
+        return -1;
+    }
+
+    o = ctx->http._internal.request_buffer.data + ctx->http._internal.request_buffer.length;
+    *o++ = '"';
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++)
+    {
+        switch (*p)
+        {
+        case '"':
+        case '\\':
+            *o++ = '\\';
+            *o++ = *p;
+            break;
+        case '\b':
+            *o++ = '\\';
+            *o++ = 'b';
+            break;
+        case '\f':
+            *o++ = '\\';
+            *o++ = 'f';
+            break;
+        case '\n':
+            *o++ = '\\';
+            *o++ = 'n';
+            break;
+        case '\r':
+            *o++ = '\\';
+            *o++ = 'r';
+            break;
+        case '\t':
+            *o++ = '\\';
+            *o++ = 't';
+            break;
+        default:
+            if (*p < 0x20)
+            {
+                *o++ = '\\';
+                *o++ = 'u';
+                *o++ = '0';
+                *o++ = '0';
+                *o++ = hex[*p >> 4];
+                *o++ = hex[*p & 0xF];
+            }
+            else
+            {
+                *o++ = *p;
+            }
+            break;
+        }
+    }
+    *o++ = '"';
+    ctx->http._internal.request_buffer.length = o - ctx->http._internal.request_buffer.data;
+
+    return 0;
+}
+
+// Encoded straight into the buffer, base64 needs no escaping
+static int es9p_request_write_base64(struct euicc_ctx *ctx, const struct euicc_blob *blob)
+{
+    char *o;
+    int n;
+
+    if (es9p_request_reserve(ctx, euicc_base64_encode_len(blob->length) + 2) < 0)
+    {
+        return -1;
+    }
+
+    o = ctx->http._internal.request_buffer.data + ctx->http._internal.request_buffer.length;
+    *o++ = '"';
+    n = euicc_base64_encode(o, blob->data, blob->length);
+    if (n < 0)
+    {
+        return -1;
+    }
+    // n counts the terminator, which the closing quote replaces
+    o += n - 1;
+    *o++ = '"';
+    ctx->http._internal.request_buffer.length = o - ctx->http._internal.request_buffer.data;
+
+    return 0;
+}
+
+// {"ikey[0]":"idata[0]",...}, a NULL idata entry is written as null, or as the base64 of ibin[i] when ibin has one
+// Appended to the buffer, offsets are returned since later appends may move it
+static int es9p_request_build(struct euicc_ctx *ctx, const char *smdp, const char *api, const char *ikey[], const char *idata[], const struct euicc_blob *const ibin[], uint32_t *url_offset, uint32_t *body_offset)
+{
+    static const char url_prefix[] = "https://";
+
+    *url_offset = ctx->http._internal.request_buffer.length;
+    if (es9p_request_write(ctx, url_prefix, sizeof(url_prefix) - 1) < 0 || es9p_request_write(ctx, smdp, strlen(smdp)) < 0 || es9p_request_write(ctx, api, strlen(api) + 1) < 0)
+    {
+        return -1;
+    }
+    *body_offset = ctx->http._internal.request_buffer.length;
 
-    while (*p)
+    if (es9p_request_write(ctx, "{", 1) < 0)
+    {
+        return -1;
+    }
+    for (int i = 0; ikey[i] != NULL; i++)
     {
-        if (*p == '\n' || *p == '\r' || *p == ' ' || *p == '\t')
+        if (i > 0 && es9p_request_write(ctx, ",", 1) < 0)
         {
-            memmove(p, p + 1, strlen(p));
+            return -1;
         }
-        else
+        if (es9p_request_write_string(ctx, ikey[i]) < 0 || es9p_request_write(ctx, ":", 1) < 0)
         {
-            p++;
+            return -1;
+        }
+        if (ibin && ibin[i])
+        {
+            if (es9p_request_write_base64(ctx, ibin[i]) < 0)
+            {
+                return -1;
+            }
+        }
+        else if (idata[i] == NULL)
+        {
+            if (es9p_request_write(ctx, "null", 4) < 0)
+            {
+                return -1;
+            }
+        }
+        else if (es9p_request_write_string(ctx, idata[i]) < 0)
+        {
+            return -1;
         }
     }
+    // The terminator is kept for the debug log, it is not sent
+    if (es9p_request_write(ctx, "}", 2) < 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void es9p_trace(struct euicc_ctx *ctx, const char *url, uint64_t start, uint32_t tx_len, uint32_t rx_len, uint32_t rcode, int ret)
+{
+    struct euicc_trace_span span = {
+        .category = EUICC_TRACE_HTTP,
+        .name = url,
+        .tx_len = tx_len,
+        .rx_len = rx_len,
+        .status = rcode,
+        .ret = ret,
+    };
+
+    if (ctx->trace)
+    {
+        euicc_trace(ctx, &span, start);
+    }
 }
 
-static int es9p_trans_ex(struct euicc_ctx *ctx, const char *url, const char *url_postfix, uint32_t *rcode, char **str_rx, const char *str_tx)
+// With extract set the response body goes through it and str_rx receives the skeleton
+static int es9p_trans_ex(struct euicc_ctx *ctx, const char *full_url, uint32_t *rcode, char **str_rx, const char *str_tx, uint32_t str_tx_len, struct es9p_json_extract *extract)
 {
     int fret = 0;
     uint32_t rcode_mearged;
     uint8_t *rbuf = NULL;
-    uint32_t rlen;
-    char *full_url = NULL;
-    const char *url_prefix = "https://";
+    uint32_t rlen = 0;
+    uint64_t start;
+    int ret;
 
-    if (!ctx->http.interface)
+    if (!ctx->http.interface || euicc_aborted(ctx))
     {
         goto err;
     }
 
-    full_url = malloc(strlen(url_prefix) + strlen(url) + strlen(url_postfix) + 1);
-    if (full_url == NULL)
+    if (ctx->debug & EUICC_DEBUG_HTTP)
     {
-        goto err;
+        euicc_log(ctx, EUICC_TRACE_HTTP, "[DEBUG] [HTTP] [TX] url: %s, data: %s", full_url, str_tx);
     }
-
-    full_url[0] = '\0';
-    strcat(full_url, url_prefix);
-    strcat(full_url, url);
-    strcat(full_url, url_postfix);
-
-    if (getenv("LIBEUICC_DEBUG_HTTP"))
+    start = euicc_now_us();
+    rcode_mearged = 0;
+    ctx->http.retry_after_ms = 0;
+    if (extract && ctx->http.interface->transmit_stream)
+    {
+        ret = ctx->http.interface->transmit_stream(ctx, full_url, &rcode_mearged, (const uint8_t *)str_tx, str_tx_len, lpa_header, iter_es9p_json_extract, extract);
+    }
+    else
     {
-        fprintf(stderr, "[DEBUG] [HTTP] [TX] url: %s, data: %s\n", full_url, str_tx);
+        ret = ctx->http.interface->transmit(ctx, full_url, &rcode_mearged, &rbuf, &rlen, (const uint8_t *)str_tx, str_tx_len, lpa_header);
     }
-    if (ctx->http.interface->transmit(ctx, full_url, &rcode_mearged, &rbuf, &rlen, (const uint8_t *)str_tx, strlen(str_tx), lpa_header) < 0)
+    es9p_trace(ctx, full_url, start, str_tx_len, ret < 0 ? 0 : rlen, rcode_mearged, ret);
+    if (ret < 0)
     {
         goto err;
     }
-    if (getenv("LIBEUICC_DEBUG_HTTP"))
+
+    if (extract && !ctx->http.interface->transmit_stream)
     {
-        fprintf(stderr, "[DEBUG] [HTTP] [RX] rcode: %d, data: %s\n", rcode_mearged, rbuf);
+        if (es9p_json_extract_feed(extract, (const char *)rbuf, rlen) < 0)
+        {
+            goto err;
+        }
+        free(rbuf);
+        rbuf = NULL;
     }
 
-    free(full_url);
-    full_url = NULL;
+    if (extract)
+    {
+        if (es9p_json_extract_append(extract, '\0') < 0)
+        {
+            goto err;
+        }
+        rbuf = (uint8_t *)extract->skeleton;
+        rlen = extract->skeleton_len - 1;
+        extract->skeleton = NULL;
+        extract->skeleton_len = 0;
+        extract->skeleton_capacity = 0;
+    }
+    if (ctx->debug & EUICC_DEBUG_HTTP)
+    {
+        euicc_log(ctx, EUICC_TRACE_HTTP, "[DEBUG] [HTTP] [RX] rcode: %d, data: %s", rcode_mearged, rbuf);
+    }
 
-    *str_rx = malloc(rlen + 1);
+    // Drivers usually leave room for the terminator, making this a no-op
+    *str_rx = realloc(rbuf, rlen + 1);
     if (*str_rx == NULL)
     {
         goto err;
     }
-    memcpy(*str_rx, rbuf, rlen);
-    (*str_rx)[rlen] = '\0';
-
-    free(rbuf);
     rbuf = NULL;
+    (*str_rx)[rlen] = '\0';
 
     *rcode = rcode_mearged;
 
@@ -91,55 +909,72 @@ static int es9p_trans_ex(struct euicc_ctx *ctx, const char *url, const char *url
 err:
     fret = -1;
 exit:
-    free(full_url);
     free(rbuf);
     return fret;
 }
 
-static int es9p_trans_json(struct euicc_ctx *ctx, const char *smdp, const char *api, const char *ikey[], const char *idata[], const char *okey[], const char *oobj, void **optr[])
+#define ES9P_RETRY_DELAY_MS_DEFAULT 500
+#define ES9P_RETRY_DELAY_MAX_MS_DEFAULT 30000
+
+// A transport failure, or a status that may go away by itself
+static int es9p_retry_transient(int ret, uint32_t rcode)
 {
-    int fret = 0;
-    cJSON *sjroot = NULL;
-    char *sbuf = NULL;
-    uint32_t rcode;
-    char *rbuf = NULL;
-    cJSON *rjroot = NULL, *rjheader = NULL, *rjfunctionExecutionStatus = NULL;
+    return ret < 0 || rcode == 408 || rcode == 429 || (rcode / 100 == 5 && rcode != 501);
+}
 
-    strncpy(ctx->http.status.reasonCode, "0.0.0", sizeof(ctx->http.status.reasonCode));
-    strncpy(ctx->http.status.subjectCode, "0.0.0", sizeof(ctx->http.status.subjectCode));
-    strncpy(ctx->http.status.subjectIdentifier, "unknown", sizeof(ctx->http.status.subjectIdentifier));
-    strncpy(ctx->http.status.message, "unknown", sizeof(ctx->http.status.message));
+// Milliseconds to wait before sending a request again whose attempt ended with ret and rcode, 0 when it is not
+static uint32_t es9p_retry_delay(struct euicc_ctx *ctx, uint32_t attempt, int ret, uint32_t rcode)
+{
+    uint64_t delay_ms = ctx->http.retry_delay_ms ? ctx->http.retry_delay_ms : ES9P_RETRY_DELAY_MS_DEFAULT;
+    uint32_t delay_max_ms = ctx->http.retry_delay_max_ms ? ctx->http.retry_delay_max_ms : ES9P_RETRY_DELAY_MAX_MS_DEFAULT;
 
-    if (!(sjroot = cJSON_CreateObject()))
+    if (attempt >= ctx->http.retry_max || euicc_aborted(ctx))
     {
-        goto err;
+        return 0;
+    }
+    if (!es9p_retry_transient(ret, rcode))
+    {
+        return 0;
     }
 
-    for (int i = 0; ikey[i] != NULL; i++)
+    for (uint32_t i = 0; i < attempt && delay_ms < delay_max_ms; i++)
+    {
+        delay_ms *= 2;
+    }
+    if (delay_ms > delay_max_ms)
+    {
+        delay_ms = delay_max_ms;
+    }
+    // The low bits of the clock are random enough to spread clients apart, and keep no state
+    delay_ms -= euicc_now_us() % (delay_ms / 2 + 1);
+
+    if (ret >= 0 && ctx->http.retry_after_ms > delay_ms)
     {
-        if (!cJSON_AddStringOrNullToObject(sjroot, ikey[i], idata[i]))
+        if (ctx->http.retry_after_ms > delay_max_ms)
         {
-            goto err;
+            return 0;
         }
+        delay_ms = ctx->http.retry_after_ms;
     }
 
-    if (!(sbuf = cJSON_PrintUnformatted(sjroot)))
+    if (ctx->deadline_us && euicc_now_us() + delay_ms * 1000 >= ctx->deadline_us)
     {
-        goto err;
+        return 0;
     }
-    cJSON_Delete(sjroot);
-    sjroot = NULL;
 
-    if (es9p_trans_ex(ctx, smdp, api, &rcode, &rbuf, sbuf) < 0)
+    if (ctx->debug & EUICC_DEBUG_HTTP)
     {
-        strncpy(ctx->http.status.reasonCode, "0.0.0", sizeof(ctx->http.status.reasonCode));
-        strncpy(ctx->http.status.subjectCode, "0.0.0", sizeof(ctx->http.status.subjectCode));
-        strncpy(ctx->http.status.subjectIdentifier, "unknown", sizeof(ctx->http.status.subjectIdentifier));
-        strncpy(ctx->http.status.message, "HTTP transport failed", sizeof(ctx->http.status.message));
-        goto err;
+        euicc_log(ctx, EUICC_TRACE_HTTP, "[DEBUG] [HTTP] retry %u in %u ms", attempt + 1, (uint32_t)delay_ms);
     }
-    free(sbuf);
-    sbuf = NULL;
+
+    return delay_ms ? delay_ms : 1;
+}
+
+// Checks the HTTP status and the ES9+ header of a response in rbuf, filling ctx->http.status, and picks out okey
+static int es9p_response_parse(struct euicc_ctx *ctx, uint32_t rcode, const char *rbuf, const char *okey[], const char *oobj, void **optr[])
+{
+    const char *rjroot, *rjroot_end, *rjheader, *rjfunctionExecutionStatus, *statusCodeData;
+    uint32_t rlen, rjroot_len, rjheader_len, rjfunctionExecutionStatus_len, statusCodeData_len;
 
     if (rcode / 100 != 2)
     {
@@ -147,78 +982,60 @@ static int es9p_trans_json(struct euicc_ctx *ctx, const char *smdp, const char *
         strncpy(ctx->http.status.subjectCode, "0.0.0", sizeof(ctx->http.status.subjectCode));
         snprintf(ctx->http.status.subjectIdentifier, sizeof(ctx->http.status.subjectIdentifier), "%d", rcode);
         strncpy(ctx->http.status.message, "HTTP status code error", sizeof(ctx->http.status.message));
-        goto err;
+        return -1;
     }
 
     if (!okey)
     {
-        fret = 0;
-        goto exit;
+        return 0;
     }
 
-    if (!(rjroot = cJSON_Parse((const char *)rbuf)))
+    rlen = strlen(rbuf);
+    rjroot = es9p_json_skip_ws(rbuf, rbuf + rlen);
+    rjroot_end = es9p_json_skip_value(rjroot, rbuf + rlen);
+    if (rjroot_end == NULL || es9p_json_skip_ws(rjroot_end, rbuf + rlen) != rbuf + rlen)
     {
         strncpy(ctx->http.status.reasonCode, "0.0.0", sizeof(ctx->http.status.reasonCode));
         strncpy(ctx->http.status.subjectCode, "0.0.0", sizeof(ctx->http.status.subjectCode));
         strncpy(ctx->http.status.subjectIdentifier, "root", sizeof(ctx->http.status.subjectIdentifier));
         strncpy(ctx->http.status.message, "Not JSON", sizeof(ctx->http.status.message));
-        goto err;
+        return -1;
     }
-    free(rbuf);
-    rbuf = NULL;
+    rjroot_len = rjroot_end - rjroot;
 
-    if (!cJSON_IsObject(rjroot))
+    if (*rjroot != '{')
     {
         strncpy(ctx->http.status.reasonCode, "0.0.0", sizeof(ctx->http.status.reasonCode));
         strncpy(ctx->http.status.subjectCode, "0.0.0", sizeof(ctx->http.status.subjectCode));
         strncpy(ctx->http.status.subjectIdentifier, "root", sizeof(ctx->http.status.subjectIdentifier));
         strncpy(ctx->http.status.message, "Not Object", sizeof(ctx->http.status.message));
-        goto err;
+        return -1;
     }
 
-    if (!cJSON_HasObjectItem(rjroot, "header"))
+    if (es9p_json_find(rjroot, rjroot_len, "header", &rjheader, &rjheader_len) < 0)
     {
         strncpy(ctx->http.status.reasonCode, "0.0.0", sizeof(ctx->http.status.reasonCode));
         strncpy(ctx->http.status.subjectCode, "0.0.0", sizeof(ctx->http.status.subjectCode));
         strncpy(ctx->http.status.subjectIdentifier, "header", sizeof(ctx->http.status.subjectIdentifier));
         strncpy(ctx->http.status.message, "Critical object missing", sizeof(ctx->http.status.message));
-        goto err;
+        return -1;
     }
 
-    rjheader = cJSON_GetObjectItem(rjroot, "header");
-
-    if (!cJSON_HasObjectItem(rjheader, "functionExecutionStatus"))
+    if (es9p_json_find(rjheader, rjheader_len, "functionExecutionStatus", &rjfunctionExecutionStatus, &rjfunctionExecutionStatus_len) < 0)
     {
         strncpy(ctx->http.status.reasonCode, "0.0.0", sizeof(ctx->http.status.reasonCode));
         strncpy(ctx->http.status.subjectCode, "0.0.0", sizeof(ctx->http.status.subjectCode));
         strncpy(ctx->http.status.subjectIdentifier, "functionExecutionStatus", sizeof(ctx->http.status.subjectIdentifier));
         strncpy(ctx->http.status.message, "Critical object missing", sizeof(ctx->http.status.message));
-        goto err;
+        return -1;
     }
 
-    rjfunctionExecutionStatus = cJSON_GetObjectItem(rjheader, "functionExecutionStatus");
-
-    if (cJSON_HasObjectItem(rjfunctionExecutionStatus, "statusCodeData"))
+    if (es9p_json_find(rjfunctionExecutionStatus, rjfunctionExecutionStatus_len, "statusCodeData", &statusCodeData, &statusCodeData_len) == 0)
     {
-        cJSON *statusCodeData = cJSON_GetObjectItem(rjfunctionExecutionStatus, "statusCodeData");
-
-        if (cJSON_HasObjectItem(statusCodeData, "reasonCode") && cJSON_IsString(cJSON_GetObjectItem(statusCodeData, "reasonCode")))
-        {
-            strncpy(ctx->http.status.reasonCode, cJSON_GetObjectItem(statusCodeData, "reasonCode")->valuestring, sizeof(ctx->http.status.reasonCode));
-        }
-        if (cJSON_HasObjectItem(statusCodeData, "subjectCode") && cJSON_IsString(cJSON_GetObjectItem(statusCodeData, "subjectCode")))
-        {
-            strncpy(ctx->http.status.subjectCode, cJSON_GetObjectItem(statusCodeData, "subjectCode")->valuestring, sizeof(ctx->http.status.subjectCode));
-        }
-        if (cJSON_HasObjectItem(statusCodeData, "subjectIdentifier") && cJSON_IsString(cJSON_GetObjectItem(statusCodeData, "subjectIdentifier")))
-        {
-            strncpy(ctx->http.status.subjectIdentifier, cJSON_GetObjectItem(statusCodeData, "subjectIdentifier")->valuestring, sizeof(ctx->http.status.subjectIdentifier));
-        }
-        if (cJSON_HasObjectItem(statusCodeData, "message") && cJSON_IsString(cJSON_GetObjectItem(statusCodeData, "message")))
-        {
-            strncpy(ctx->http.status.message, cJSON_GetObjectItem(statusCodeData, "message")->valuestring, sizeof(ctx->http.status.message));
-        }
-        else
+        es9p_json_copy_string(statusCodeData, statusCodeData_len, "reasonCode", ctx->http.status.reasonCode, sizeof(ctx->http.status.reasonCode));
+        es9p_json_copy_string(statusCodeData, statusCodeData_len, "subjectCode", ctx->http.status.subjectCode, sizeof(ctx->http.status.subjectCode));
+        es9p_json_copy_string(statusCodeData, statusCodeData_len, "subjectIdentifier", ctx->http.status.subjectIdentifier, sizeof(ctx->http.status.subjectIdentifier));
+        if (es9p_json_copy_string(statusCodeData, statusCodeData_len, "message", ctx->http.status.message, sizeof(ctx->http.status.message)) < 0)
         {
             const char* message = es9p_error_message(ctx->http.status.subjectCode, ctx->http.status.reasonCode);
             if (message != NULL)
@@ -232,38 +1049,127 @@ static int es9p_trans_json(struct euicc_ctx *ctx, const char *smdp, const char *
         }
     }
 
+    // Only the requested members are materialized, straight from the received buffer
     for (int i = 0; okey[i] != NULL; i++)
     {
-        cJSON *obj;
+        const char *value;
+        uint32_t value_len;
 
-        obj = cJSON_GetObjectItem(rjroot, okey[i]);
-        if (!obj)
+        if (es9p_json_find(rjroot, rjroot_len, okey[i], &value, &value_len) < 0)
         {
-            goto err;
+            return -1;
         }
 
-        if (cJSON_IsString(obj))
+        if (oobj && oobj[i] == 2)
         {
-            if (!(*optr[i] = strdup(obj->valuestring)))
+            if (!es9p_json_is_string(value, value_len) || es9p_json_blob(value, value_len, (struct euicc_blob *)optr[i]) < 0)
             {
-                goto err;
+                return -1;
+            }
+        }
+        else if (es9p_json_is_string(value, value_len))
+        {
+            if (!(*optr[i] = es9p_json_string_dup(value, value_len)))
+            {
+                return -1;
             }
         }
         else
         {
             if (oobj[i] == 0)
             {
-                goto err;
+                return -1;
             }
-            if (!(*(optr[i]) = cJSON_Duplicate(obj, 1)))
+            if (!(*(optr[i]) = cJSON_ParseWithLength(value, value_len)))
             {
-                goto err;
+                return -1;
             }
         }
     }
 
-    cJSON_Delete(rjroot);
-    rjroot = NULL;
+    return 0;
+}
+
+static const struct
+{
+    const char *api;
+    const char *operation;
+} es9p_operations[] = {
+    {"/gsma/rsp2/es9plus/initiateAuthentication", "es9p_initiate_authentication"},
+    {"/gsma/rsp2/es9plus/getBoundProfilePackage", "es9p_get_bound_profile_package"},
+    {"/gsma/rsp2/es9plus/authenticateClient", "es9p_authenticate_client"},
+    {"/gsma/rsp2/es9plus/cancelSession", "es9p_cancel_session"},
+    {"/gsma/rsp2/es9plus/handleNotification", "es9p_handle_notification"},
+};
+
+static const char *es9p_operation(const char *api)
+{
+    for (size_t i = 0; i < sizeof(es9p_operations) / sizeof(es9p_operations[0]); i++)
+    {
+        if (strcmp(es9p_operations[i].api, api) == 0)
+        {
+            return es9p_operations[i].operation;
+        }
+    }
+    return api;
+}
+
+static int es9p_trans_json_ex(struct euicc_ctx *ctx, const char *smdp, const char *api, const char *ikey[], const char *idata[], const struct euicc_blob *const ibin[], const char *okey[], const char *oobj, void **optr[], struct es9p_json_extract *extract)
+{
+    int fret = 0;
+    uint32_t url_offset, body_offset;
+    uint32_t rcode = 0;
+    char *rbuf = NULL;
+    uint32_t delay_ms;
+    int ret;
+    const char *operation = es9p_operation(api);
+
+    euicc_operation(ctx, operation, 0);
+
+    strncpy(ctx->http.status.reasonCode, "0.0.0", sizeof(ctx->http.status.reasonCode));
+    strncpy(ctx->http.status.subjectCode, "0.0.0", sizeof(ctx->http.status.subjectCode));
+    strncpy(ctx->http.status.subjectIdentifier, "unknown", sizeof(ctx->http.status.subjectIdentifier));
+    strncpy(ctx->http.status.message, "unknown", sizeof(ctx->http.status.message));
+
+    ctx->http._internal.request_buffer.length = 0;
+    if (es9p_request_build(ctx, smdp, api, ikey, idata, ibin, &url_offset, &body_offset) < 0)
+    {
+        goto err;
+    }
+
+    for (uint32_t attempt = 0;; attempt++)
+    {
+        ret = es9p_trans_ex(ctx, ctx->http._internal.request_buffer.data + url_offset, &rcode, &rbuf, ctx->http._internal.request_buffer.data + body_offset, ctx->http._internal.request_buffer.length - body_offset - 1, extract);
+        // Once the extracted value started it went on to its consumer, and the request cannot be taken back
+        if (extract && extract->found)
+        {
+            break;
+        }
+        delay_ms = es9p_retry_delay(ctx, attempt, ret, rcode);
+        if (delay_ms == 0 || euicc_wait_ms(ctx, delay_ms) < 0)
+        {
+            break;
+        }
+        free(rbuf);
+        rbuf = NULL;
+        if (extract)
+        {
+            es9p_json_extract_reset(extract);
+        }
+    }
+    if (ret < 0)
+    {
+        strncpy(ctx->http.status.reasonCode, "0.0.0", sizeof(ctx->http.status.reasonCode));
+        strncpy(ctx->http.status.subjectCode, "0.0.0", sizeof(ctx->http.status.subjectCode));
+        strncpy(ctx->http.status.subjectIdentifier, "unknown", sizeof(ctx->http.status.subjectIdentifier));
+        strncpy(ctx->http.status.message, "HTTP transport failed", sizeof(ctx->http.status.message));
+        goto err;
+    }
+
+    if (es9p_response_parse(ctx, rcode, rbuf, okey, oobj, optr) < 0)
+    {
+        goto err;
+    }
 
     fret = 0;
     goto exit;
@@ -271,79 +1177,245 @@ static int es9p_trans_json(struct euicc_ctx *ctx, const char *smdp, const char *
 err:
     fret = -1;
 exit:
-    free(sbuf);
-    cJSON_Delete(sjroot);
     free(rbuf);
-    cJSON_Delete(rjroot);
+    euicc_operation(ctx, operation, 1);
     return fret;
 }
 
-int es9p_initiate_authentication_r(struct euicc_ctx *ctx, char **transaction_id, struct es10b_authenticate_server_param *resp, const char *server_address, const char *b64_euicc_challenge, const char *b64_euicc_info_1)
+static int es9p_trans_json(struct euicc_ctx *ctx, const char *smdp, const char *api, const char *ikey[], const char *idata[], const struct euicc_blob *const ibin[], const char *okey[], const char *oobj, void **optr[])
+{
+    return es9p_trans_json_ex(ctx, smdp, api, ikey, idata, ibin, okey, oobj, optr, NULL);
+}
+
+int es9p_initiate_authentication_r(struct euicc_ctx *ctx, char **transaction_id, struct es10b_authenticate_server_param *resp, const char *server_address, const struct euicc_blob *euicc_challenge, const struct euicc_blob *euicc_info_1)
 {
     const char *ikey[] = {"smdpAddress", "euiccChallenge", "euiccInfo1", NULL};
-    const char *idata[] = {ctx->http.server_address, b64_euicc_challenge, b64_euicc_info_1, NULL};
+    const char *idata[] = {ctx->http.server_address, NULL, NULL, NULL};
+    const struct euicc_blob *const ibin[] = {NULL, euicc_challenge, euicc_info_1, NULL};
     const char *okey[] = {"transactionId", "serverSigned1", "serverSignature1", "euiccCiPKIdToBeUsed", "serverCertificate", NULL};
-    const char oobj[] = {0, 0, 0, 0, 0};
-    void **optr[] = {(void **)transaction_id, (void **)&resp->b64_serverSigned1, (void **)&resp->b64_serverSignature1, (void **)&resp->b64_euiccCiPKIdToBeUsed, (void **)&resp->b64_serverCertificate, NULL};
+    const char oobj[] = {0, 2, 2, 2, 2};
+    void **optr[] = {(void **)transaction_id, (void **)&resp->serverSigned1, (void **)&resp->serverSignature1, (void **)&resp->euiccCiPKIdToBeUsed, (void **)&resp->serverCertificate, NULL};
+
+    memset(resp, 0, sizeof(*resp));
+    if (es9p_trans_json(ctx, ctx->http.server_address, "/gsma/rsp2/es9plus/initiateAuthentication", ikey, idata, ibin, okey, oobj, optr))
+    {
+        free(*transaction_id);
+        *transaction_id = NULL;
+        es10b_authenticate_server_param_free(resp);
+        return -1;
+    }
+
+    return 0;
+}
+
+int es9p_get_bound_profile_package_r(struct euicc_ctx *ctx, struct euicc_blob *bound_profile_package, const char *server_address, const char *transaction_id, const struct euicc_blob *prepare_download_response)
+{
+    const char *ikey[] = {"transactionId", "prepareDownloadResponse", NULL};
+    const char *idata[] = {transaction_id, NULL, NULL};
+    const struct euicc_blob *const ibin[] = {NULL, prepare_download_response, NULL};
+    const char *okey[] = {"boundProfilePackage", NULL};
+    const char oobj[] = {2};
+    void **optr[] = {(void **)bound_profile_package, NULL};
+
+    memset(bound_profile_package, 0, sizeof(*bound_profile_package));
+    if (es9p_trans_json(ctx, ctx->http.server_address, "/gsma/rsp2/es9plus/getBoundProfilePackage", ikey, idata, ibin, okey, oobj, optr))
+    {
+        euicc_blob_free(bound_profile_package);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Base64 characters decoded at once, bounds the decode buffer whatever piece sizes the driver hands over
+#define ES9P_BPP_WINDOW 4096
+// Everything of the getBoundProfilePackage response but the package, kept under bpp_memory_max
+#define ES9P_BPP_SKELETON_MAX 2048
+
+struct es9p_bpp_pipeline
+{
+    struct euicc_base64_decoder decoder;
+    struct es10b_load_bound_profile_package_stream loader;
+    const struct es9p_json_extract *extract;
+    uint8_t *buffer;
+    uint32_t buffer_capacity;
+    uint32_t memory_peak;
+    uint8_t load_failed;
+};
+
+static void es9p_bpp_pipeline_measure(struct es9p_bpp_pipeline *pipeline)
+{
+    uint32_t memory = pipeline->buffer_capacity + pipeline->loader.der.element_capacity + pipeline->loader.batch_capacity + pipeline->extract->skeleton_capacity;
+
+    if (memory > pipeline->memory_peak)
+    {
+        pipeline->memory_peak = memory;
+    }
+}
+
+static int es9p_bpp_pipeline_load(struct es9p_bpp_pipeline *pipeline, const uint8_t *data, uint32_t data_len)
+{
+    struct euicc_ctx *ctx = pipeline->loader.ctx;
+
+    if (data_len > 0 && es10b_load_bound_profile_package_stream_feed(&pipeline->loader, data, data_len) < 0)
+    {
+        pipeline->load_failed = 1;
+        return -1;
+    }
+
+    // The loader learns the length of the package from its header
+    ctx->http._internal.progress.progress.total = ctx->apdu._internal.progress.progress.total;
+    euicc_progress_update(ctx, &ctx->http._internal.progress, data_len);
+    return 0;
+}
+
+static int iter_es9p_bpp_pipeline(const char *data, uint32_t data_len, void *userdata)
+{
+    struct es9p_bpp_pipeline *pipeline = userdata;
+
+    while (data_len > 0)
+    {
+        uint32_t window = data_len < ES9P_BPP_WINDOW ? data_len : ES9P_BPP_WINDOW;
+        uint32_t need = euicc_base64_decoder_update_len(window);
+        int n;
+
+        if (pipeline->buffer_capacity < need)
+        {
+            uint8_t *buffer_new = euicc_realloc(pipeline->loader.ctx, pipeline->buffer, need);
+            if (buffer_new == NULL)
+            {
+                return -1;
+            }
+            pipeline->buffer = buffer_new;
+            pipeline->buffer_capacity = need;
+        }
+
+        n = euicc_base64_decoder_update(&pipeline->decoder, pipeline->buffer, data, window);
+        if (es9p_bpp_pipeline_load(pipeline, pipeline->buffer, n) < 0)
+        {
+            return -1;
+        }
+        es9p_bpp_pipeline_measure(pipeline);
+
+        data += window;
+        data_len -= window;
+    }
+
+    return 0;
+}
+
+int es9p_get_and_load_bound_profile_package_r(struct euicc_ctx *ctx, struct es10b_load_bound_profile_package_result *result, const char *server_address, const char *transaction_id, const struct euicc_blob *prepare_download_response)
+{
+    int fret = 0;
+    const char *ikey[] = {"transactionId", "prepareDownloadResponse", NULL};
+    const char *idata[] = {transaction_id, NULL, NULL};
+    const struct euicc_blob *const ibin[] = {NULL, prepare_download_response, NULL};
+    const char *okey[] = {NULL};
+    struct es9p_bpp_pipeline pipeline;
+    struct es9p_json_extract extract;
+    uint8_t tail[2];
+    int ret;
+
+    memset(&pipeline, 0, sizeof(pipeline));
+    memset(&extract, 0, sizeof(extract));
+    ctx->http.bpp_memory_peak = 0;
+
+    euicc_base64_decoder_init(&pipeline.decoder);
+    if (es10b_load_bound_profile_package_stream_init(&pipeline.loader, ctx, result) < 0)
+    {
+        goto err;
+    }
+    pipeline.loader.max_length = ctx->http.bpp_max_length;
+    pipeline.extract = &extract;
+    euicc_progress_begin(ctx, &ctx->http._internal.progress, EUICC_PROGRESS_DOWNLOAD, 0);
+
+    // What is left after the decode window and the skeleton is for the element the loader holds whole.
+    // Without transmit_stream the driver hands over the whole body, there is no bound to keep.
+    if (ctx->http.bpp_memory_max)
+    {
+        uint32_t fixed = euicc_base64_decoder_update_len(ES9P_BPP_WINDOW) + ES9P_BPP_SKELETON_MAX;
+
+        if (!ctx->http.interface || !ctx->http.interface->transmit_stream || ctx->http.bpp_memory_max <= fixed)
+        {
+            pipeline.loader.oversized = 1;
+            goto err;
+        }
+        pipeline.loader.element_max = ctx->http.bpp_memory_max - fixed;
+        // The bound is spent on the element, queueing a batch of them would double it
+        pipeline.loader.batch_max = 0;
+        extract.skeleton_max = ES9P_BPP_SKELETON_MAX;
+    }
+
+    extract.key = "boundProfilePackage";
+    extract.callback = iter_es9p_bpp_pipeline;
+    extract.userdata = &pipeline;
 
-    if (es9p_trans_json(ctx, ctx->http.server_address, "/gsma/rsp2/es9plus/initiateAuthentication", ikey, idata, okey, oobj, optr))
+    ret = es9p_trans_json_ex(ctx, ctx->http.server_address, "/gsma/rsp2/es9plus/getBoundProfilePackage", ikey, idata, ibin, okey, NULL, NULL, &extract);
+    if (ctx->http.interface && ctx->http.interface->transmit_stream)
     {
-        return -1;
+        es9p_bpp_pipeline_measure(&pipeline);
+        ctx->http.bpp_memory_peak = pipeline.memory_peak;
+    }
+    if (ret)
+    {
+        goto err;
     }
 
-    es9p_base64_trim(resp->b64_serverSigned1);
-    es9p_base64_trim(resp->b64_serverSignature1);
-    es9p_base64_trim(resp->b64_euiccCiPKIdToBeUsed);
-    es9p_base64_trim(resp->b64_serverCertificate);
-
-    return 0;
-}
+    if (!extract.found)
+    {
+        goto err;
+    }
 
-int es9p_get_bound_profile_package_r(struct euicc_ctx *ctx, char **b64_bound_profile_package, const char *server_address, const char *transaction_id, const char *b64_prepare_download_response)
-{
-    const char *ikey[] = {"transactionId", "prepareDownloadResponse", NULL};
-    const char *idata[] = {transaction_id, b64_prepare_download_response, NULL};
-    const char *okey[] = {"boundProfilePackage", NULL};
-    const char oobj[] = {0};
-    void **optr[] = {(void **)b64_bound_profile_package, NULL};
+    if (es9p_bpp_pipeline_load(&pipeline, tail, euicc_base64_decoder_finish(&pipeline.decoder, tail)) < 0)
+    {
+        goto err;
+    }
+    euicc_progress_end(ctx, &ctx->http._internal.progress);
 
-    if (es9p_trans_json(ctx, ctx->http.server_address, "/gsma/rsp2/es9plus/getBoundProfilePackage", ikey, idata, okey, oobj, optr))
+    if (es10b_load_bound_profile_package_stream_finish(&pipeline.loader) < 0)
     {
-        return -1;
+        pipeline.load_failed = 1;
+        goto err;
     }
 
-    es9p_base64_trim(*b64_bound_profile_package);
+    goto exit;
 
-    return 0;
+err:
+    fret = pipeline.loader.oversized ? -4 : pipeline.loader.refused ? -3 : pipeline.load_failed ? -2 : -1;
+exit:
+    euicc_progress_end(ctx, &ctx->http._internal.progress);
+    es10b_load_bound_profile_package_stream_free(&pipeline.loader);
+    euicc_free(ctx, pipeline.buffer);
+    free(extract.skeleton);
+    return fret;
 }
 
-int es9p_authenticate_client_r(struct euicc_ctx *ctx, struct es10b_prepare_download_param *resp, const char *server_address, const char *transaction_id, const char *b64_authenticate_server_response)
+int es9p_authenticate_client_r(struct euicc_ctx *ctx, struct es10b_prepare_download_param *resp, const char *server_address, const char *transaction_id, const struct euicc_blob *authenticate_server_response)
 {
     const char *ikey[] = {"transactionId", "authenticateServerResponse", NULL};
-    const char *idata[] = {transaction_id, b64_authenticate_server_response, NULL};
+    const char *idata[] = {transaction_id, NULL, NULL};
+    const struct euicc_blob *const ibin[] = {NULL, authenticate_server_response, NULL};
     const char *okey[] = {"profileMetadata", "smdpSigned2", "smdpSignature2", "smdpCertificate", NULL};
-    const char oobj[] = {0, 0, 0, 0};
-    void **optr[] = {(void **)&resp->b64_profileMetadata, (void **)&resp->b64_smdpSigned2, (void **)&resp->b64_smdpSignature2, (void **)&resp->b64_smdpCertificate, NULL};
+    const char oobj[] = {2, 2, 2, 2};
+    void **optr[] = {(void **)&resp->profileMetadata, (void **)&resp->smdpSigned2, (void **)&resp->smdpSignature2, (void **)&resp->smdpCertificate, NULL};
 
-    if (es9p_trans_json(ctx, ctx->http.server_address, "/gsma/rsp2/es9plus/authenticateClient", ikey, idata, okey, oobj, optr))
+    memset(resp, 0, sizeof(*resp));
+    if (es9p_trans_json(ctx, ctx->http.server_address, "/gsma/rsp2/es9plus/authenticateClient", ikey, idata, ibin, okey, oobj, optr))
     {
+        es10b_prepare_download_param_free(resp);
         return -1;
     }
 
-    es9p_base64_trim(resp->b64_profileMetadata);
-    es9p_base64_trim(resp->b64_smdpSigned2);
-    es9p_base64_trim(resp->b64_smdpSignature2);
-    es9p_base64_trim(resp->b64_smdpCertificate);
-
     return 0;
 }
 
-int es9p_cancel_session_r(struct euicc_ctx *ctx, const char *server_address, const char *transaction_id, const char *b64_cancel_session_response)
+int es9p_cancel_session_r(struct euicc_ctx *ctx, const char *server_address, const char *transaction_id, const struct euicc_blob *cancel_session_response)
 {
     const char *ikey[] = {"transactionId", "cancelSessionResponse", NULL};
-    const char *idata[] = {transaction_id, b64_cancel_session_response, NULL};
+    const char *idata[] = {transaction_id, NULL, NULL};
+    const struct euicc_blob *const ibin[] = {NULL, cancel_session_response, NULL};
 
-    if (es9p_trans_json(ctx, ctx->http.server_address, "/gsma/rsp2/es9plus/cancelSession", ikey, idata, NULL, NULL, NULL))
+    if (es9p_trans_json(ctx, ctx->http.server_address, "/gsma/rsp2/es9plus/cancelSession", ikey, idata, ibin, NULL, NULL, NULL))
     {
         return -1;
     }
@@ -351,21 +1423,10 @@ int es9p_cancel_session_r(struct euicc_ctx *ctx, const char *server_address, con
     return 0;
 }
 
-int es11_authenticate_client_r(struct euicc_ctx *ctx, char ***smdp_list, const char *server_address, const char *transaction_id, const char *b64_authenticate_server_response)
+// rspServerAddress of every event record in j_eventEntries, a NULL terminated list
+static int es11_smdp_list_parse(char ***smdp_list, cJSON *j_eventEntries)
 {
-    int fret = 0;
-    cJSON *j_eventEntries = NULL;
     int j_eventEntries_size = 0;
-    const char *ikey[] = {"transactionId", "authenticateServerResponse", NULL};
-    const char *idata[] = {transaction_id, b64_authenticate_server_response, NULL};
-    const char *okey[] = {"eventEntries", NULL};
-    const char oobj[] = {1};
-    void **optr[] = {(void **)&j_eventEntries, NULL};
-
-    if (es9p_trans_json(ctx, ctx->http.server_address, "/gsma/rsp2/es9plus/authenticateClient", ikey, idata, okey, oobj, optr))
-    {
-        return -1;
-    }
 
     if (j_eventEntries == NULL || !cJSON_IsArray(j_eventEntries))
     {
@@ -377,8 +1438,7 @@ int es11_authenticate_client_r(struct euicc_ctx *ctx, char ***smdp_list, const c
     *smdp_list = malloc(sizeof(char *) * (j_eventEntries_size + 1));
     if (*smdp_list == NULL)
     {
-        fret = -1;
-        goto err;
+        return -1;
     }
     memset(*smdp_list, 0, sizeof(char *) * (j_eventEntries_size + 1));
 
@@ -389,32 +1449,69 @@ int es11_authenticate_client_r(struct euicc_ctx *ctx, char ***smdp_list, const c
 
         if (j_eventType == NULL || !cJSON_IsString(j_eventType))
         {
-            fret = -1;
             goto err;
         }
 
         (*smdp_list)[i] = strdup(j_eventType->valuestring);
     }
 
-    fret = 0;
-    goto exit;
+    return 0;
 
 err:
-    if (*smdp_list)
+    for (int i = 0; i < j_eventEntries_size; i++)
     {
-        for (int i = 0; i < j_eventEntries_size; i++)
-        {
-            free((*smdp_list)[i]);
-        }
-        free(*smdp_list);
-        *smdp_list = NULL;
+        free((*smdp_list)[i]);
     }
+    free(*smdp_list);
+    *smdp_list = NULL;
+    return -1;
+}
 
-exit:
+int es11_authenticate_client_r(struct euicc_ctx *ctx, char ***smdp_list, const char *server_address, const char *transaction_id, const struct euicc_blob *authenticate_server_response)
+{
+    int fret = 0;
+    cJSON *j_eventEntries = NULL;
+    const char *ikey[] = {"transactionId", "authenticateServerResponse", NULL};
+    const char *idata[] = {transaction_id, NULL, NULL};
+    const struct euicc_blob *const ibin[] = {NULL, authenticate_server_response, NULL};
+    const char *okey[] = {"eventEntries", NULL};
+    const char oobj[] = {1};
+    void **optr[] = {(void **)&j_eventEntries, NULL};
+
+    if (es9p_trans_json(ctx, ctx->http.server_address, "/gsma/rsp2/es9plus/authenticateClient", ikey, idata, ibin, okey, oobj, optr))
+    {
+        return -1;
+    }
+
+    fret = es11_smdp_list_parse(smdp_list, j_eventEntries);
     cJSON_Delete(j_eventEntries);
     return fret;
 }
 
+void es9p_prepare(struct euicc_ctx *ctx)
+{
+    static const char url_prefix[] = "https://";
+    static const char api[] = "/gsma/rsp2/es9plus/initiateAuthentication";
+    char *url;
+
+    if (!ctx->http.interface || !ctx->http.interface->prepare || !ctx->http.server_address)
+    {
+        return;
+    }
+
+    url = euicc_malloc(ctx, sizeof(url_prefix) - 1 + strlen(ctx->http.server_address) + sizeof(api));
+    if (url == NULL)
+    {
+        return;
+    }
+    strcpy(url, url_prefix);
+    strcat(url, ctx->http.server_address);
+    strcat(url, api);
+
+    ctx->http.interface->prepare(ctx, url);
+    euicc_free(ctx, url);
+}
+
 int es9p_initiate_authentication(struct euicc_ctx *ctx)
 {
     int fret;
@@ -424,12 +1521,12 @@ int es9p_initiate_authentication(struct euicc_ctx *ctx)
         return -1;
     }
 
-    if (ctx->http._internal.b64_euicc_challenge == NULL)
+    if (ctx->http._internal.euicc_challenge.data == NULL)
     {
         return -1;
     }
 
-    if (ctx->http._internal.b64_euicc_info_1 == NULL)
+    if (ctx->http._internal.euicc_info_1.data == NULL)
     {
         return -1;
     }
@@ -440,7 +1537,7 @@ int es9p_initiate_authentication(struct euicc_ctx *ctx)
         return -1;
     }
 
-    fret = es9p_initiate_authentication_r(ctx, &ctx->http._internal.transaction_id_http, ctx->http._internal.authenticate_server_param, ctx->http.server_address, ctx->http._internal.b64_euicc_challenge, ctx->http._internal.b64_euicc_info_1);
+    fret = es9p_initiate_authentication_r(ctx, &ctx->http._internal.transaction_id_http, ctx->http._internal.authenticate_server_param, ctx->http.server_address, &ctx->http._internal.euicc_challenge, &ctx->http._internal.euicc_info_1);
     if (fret < 0)
     {
         free(ctx->http._internal.authenticate_server_param);
@@ -448,11 +1545,8 @@ int es9p_initiate_authentication(struct euicc_ctx *ctx)
         return fret;
     }
 
-    free(ctx->http._internal.b64_euicc_challenge);
-    ctx->http._internal.b64_euicc_challenge = NULL;
-
-    free(ctx->http._internal.b64_euicc_info_1);
-    ctx->http._internal.b64_euicc_info_1 = NULL;
+    euicc_blob_free(&ctx->http._internal.euicc_challenge);
+    euicc_blob_free(&ctx->http._internal.euicc_info_1);
 
     return fret;
 }
@@ -461,26 +1555,48 @@ int es9p_get_bound_profile_package(struct euicc_ctx *ctx)
 {
     int fret;
 
-    if (ctx->http._internal.b64_bound_profile_package)
+    if (ctx->http._internal.bound_profile_package.data)
+    {
+        return -1;
+    }
+
+    if (ctx->http._internal.prepare_download_response.data == NULL)
+    {
+        return -1;
+    }
+
+    fret = es9p_get_bound_profile_package_r(ctx, &ctx->http._internal.bound_profile_package, ctx->http.server_address, ctx->http._internal.transaction_id_http, &ctx->http._internal.prepare_download_response);
+    if (fret < 0)
+    {
+        return fret;
+    }
+
+    euicc_blob_free(&ctx->http._internal.prepare_download_response);
+
+    return fret;
+}
+
+int es9p_get_and_load_bound_profile_package(struct euicc_ctx *ctx, struct es10b_load_bound_profile_package_result *result)
+{
+    int fret;
+
+    if (ctx->http._internal.bound_profile_package.data)
     {
         return -1;
     }
 
-    if (ctx->http._internal.b64_prepare_download_response == NULL)
+    if (ctx->http._internal.prepare_download_response.data == NULL)
     {
         return -1;
     }
 
-    fret = es9p_get_bound_profile_package_r(ctx, &ctx->http._internal.b64_bound_profile_package, ctx->http.server_address, ctx->http._internal.transaction_id_http, ctx->http._internal.b64_prepare_download_response);
+    fret = es9p_get_and_load_bound_profile_package_r(ctx, result, ctx->http.server_address, ctx->http._internal.transaction_id_http, &ctx->http._internal.prepare_download_response);
     if (fret < 0)
     {
-        free(ctx->http._internal.b64_bound_profile_package);
-        ctx->http._internal.b64_bound_profile_package = NULL;
         return fret;
     }
 
-    free(ctx->http._internal.b64_prepare_download_response);
-    ctx->http._internal.b64_prepare_download_response = NULL;
+    euicc_blob_free(&ctx->http._internal.prepare_download_response);
 
     return fret;
 }
@@ -494,7 +1610,7 @@ int es9p_authenticate_client(struct euicc_ctx *ctx)
         return -1;
     }
 
-    if (ctx->http._internal.b64_authenticate_server_response == NULL)
+    if (ctx->http._internal.authenticate_server_response.data == NULL)
     {
         return -1;
     }
@@ -505,7 +1621,7 @@ int es9p_authenticate_client(struct euicc_ctx *ctx)
         return -1;
     }
 
-    fret = es9p_authenticate_client_r(ctx, ctx->http._internal.prepare_download_param, ctx->http.server_address, ctx->http._internal.transaction_id_http, ctx->http._internal.b64_authenticate_server_response);
+    fret = es9p_authenticate_client_r(ctx, ctx->http._internal.prepare_download_param, ctx->http.server_address, ctx->http._internal.transaction_id_http, &ctx->http._internal.authenticate_server_response);
     if (fret < 0)
     {
         free(ctx->http._internal.prepare_download_param);
@@ -513,8 +1629,7 @@ int es9p_authenticate_client(struct euicc_ctx *ctx)
         return fret;
     }
 
-    free(ctx->http._internal.b64_authenticate_server_response);
-    ctx->http._internal.b64_authenticate_server_response = NULL;
+    euicc_blob_free(&ctx->http._internal.authenticate_server_response);
 
     return fret;
 }
@@ -523,19 +1638,18 @@ int es9p_cancel_session(struct euicc_ctx *ctx)
 {
     int fret;
 
-    if (ctx->http._internal.b64_cancel_session_response == NULL)
+    if (ctx->http._internal.cancel_session_response.data == NULL)
     {
         return -1;
     }
 
-    fret = es9p_cancel_session_r(ctx, ctx->http.server_address, ctx->http._internal.transaction_id_http, ctx->http._internal.b64_cancel_session_response);
+    fret = es9p_cancel_session_r(ctx, ctx->http.server_address, ctx->http._internal.transaction_id_http, &ctx->http._internal.cancel_session_response);
     if (fret < 0)
     {
         return fret;
     }
 
-    free(ctx->http._internal.b64_cancel_session_response);
-    ctx->http._internal.b64_cancel_session_response = NULL;
+    euicc_blob_free(&ctx->http._internal.cancel_session_response);
 
     return fret;
 }
@@ -544,20 +1658,175 @@ int es11_authenticate_client(struct euicc_ctx *ctx, char ***smdp_list)
 {
     int fret;
 
-    if (ctx->http._internal.b64_authenticate_server_response == NULL)
+    if (ctx->http._internal.authenticate_server_response.data == NULL)
     {
         return -1;
     }
 
-    fret = es11_authenticate_client_r(ctx, smdp_list, ctx->http.server_address, ctx->http._internal.transaction_id_http, ctx->http._internal.b64_authenticate_server_response);
+    fret = es11_authenticate_client_r(ctx, smdp_list, ctx->http.server_address, ctx->http._internal.transaction_id_http, &ctx->http._internal.authenticate_server_response);
     if (fret < 0)
     {
         return fret;
     }
 
-    free(ctx->http._internal.b64_authenticate_server_response);
-    ctx->http._internal.b64_authenticate_server_response = NULL;
+    euicc_blob_free(&ctx->http._internal.authenticate_server_response);
+
+    return fret;
+}
+
+struct es11_multi_response
+{
+    int ret;
+    uint32_t rcode;
+    uint8_t *rx;
+    uint32_t rx_len;
+    uint32_t *remaining;
+};
+
+static void es11_multi_complete(int ret, uint32_t rcode, uint8_t *rx, uint32_t rx_len, void *userdata)
+{
+    struct es11_multi_response *response = userdata;
+
+    response->ret = ret;
+    response->rcode = rcode;
+    response->rx = rx;
+    response->rx_len = rx_len;
+    (*response->remaining)--;
+}
+
+int es11_authenticate_client_multi(struct euicc_ctx *ctx, const char *const *server_address, const char *const *transaction_id, const struct euicc_blob *authenticate_server_response, char ***smdp_list, uint32_t count)
+{
+    int fret = 0;
+    const char *ikey[] = {"transactionId", "authenticateServerResponse", NULL};
+    const char *idata[] = {NULL, NULL, NULL};
+    const struct euicc_blob *ibin[] = {NULL, NULL, NULL};
+    const char *okey[] = {"eventEntries", NULL};
+    const char oobj[] = {1};
+    uint32_t *offsets = NULL;
+    struct es11_multi_response *responses = NULL;
+    uint32_t remaining = 0;
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        smdp_list[i] = NULL;
+    }
+
+    if (!ctx->http.interface)
+    {
+        goto err;
+    }
+
+    offsets = euicc_malloc(ctx, count * 2 * sizeof(uint32_t));
+    responses = euicc_malloc(ctx, count * sizeof(struct es11_multi_response));
+    if (count && (offsets == NULL || responses == NULL))
+    {
+        goto err;
+    }
+    if (responses)
+    {
+        memset(responses, 0, count * sizeof(struct es11_multi_response));
+    }
+
+    ctx->http._internal.request_buffer.length = 0;
+    for (i = 0; i < count; i++)
+    {
+        idata[0] = transaction_id[i];
+        ibin[1] = &authenticate_server_response[i];
+        if (es9p_request_build(ctx, server_address[i], "/gsma/rsp2/es9plus/authenticateClient", ikey, idata, ibin, &offsets[i * 2], &offsets[i * 2 + 1]) < 0)
+        {
+            goto err;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        const char *url = ctx->http._internal.request_buffer.data + offsets[i * 2];
+        const char *tx = ctx->http._internal.request_buffer.data + offsets[i * 2 + 1];
+        uint32_t tx_len = (i + 1 < count ? offsets[(i + 1) * 2] : ctx->http._internal.request_buffer.length) - offsets[i * 2 + 1] - 1;
+
+        if (ctx->debug & EUICC_DEBUG_HTTP)
+        {
+            euicc_log(ctx, EUICC_TRACE_HTTP, "[DEBUG] [HTTP] [TX] url: %s, data: %s", url, tx);
+        }
+
+        responses[i].ret = -1;
+        responses[i].remaining = &remaining;
+        if (euicc_aborted(ctx))
+        {
+            continue;
+        }
+        if (ctx->http.interface->submit && ctx->http.interface->poll)
+        {
+            if (ctx->http.interface->submit(ctx, url, (const uint8_t *)tx, tx_len, lpa_header, NULL, es11_multi_complete, &responses[i]) == 0)
+            {
+                remaining++;
+            }
+        }
+        else
+        {
+            uint64_t start = euicc_now_us();
+
+            responses[i].ret = ctx->http.interface->transmit(ctx, url, &responses[i].rcode, &responses[i].rx, &responses[i].rx_len, (const uint8_t *)tx, tx_len, lpa_header);
+            es9p_trace(ctx, url, start, tx_len, responses[i].ret < 0 ? 0 : responses[i].rx_len, responses[i].rcode, responses[i].ret);
+        }
+    }
+
+    while (remaining > 0)
+    {
+        if (ctx->http.interface->poll(ctx, 1000) < 0 && remaining > 0)
+        {
+            goto err;
+        }
+    }
+
+    // ctx->http.status ends up describing the last session that failed
+    for (i = 0; i < count; i++)
+    {
+        cJSON *j_eventEntries = NULL;
+        void **optr[] = {(void **)&j_eventEntries, NULL};
+        char *rbuf;
+
+        if (responses[i].ret < 0)
+        {
+            strncpy(ctx->http.status.message, "HTTP transport failed", sizeof(ctx->http.status.message));
+            continue;
+        }
+
+        rbuf = realloc(responses[i].rx, responses[i].rx_len + 1);
+        if (rbuf == NULL)
+        {
+            continue;
+        }
+        responses[i].rx = (uint8_t *)rbuf;
+        rbuf[responses[i].rx_len] = '\0';
+        if (ctx->debug & EUICC_DEBUG_HTTP)
+        {
+            euicc_log(ctx, EUICC_TRACE_HTTP, "[DEBUG] [HTTP] [RX] rcode: %d, data: %s", responses[i].rcode, rbuf);
+        }
+
+        if (es9p_response_parse(ctx, responses[i].rcode, rbuf, okey, oobj, optr) == 0)
+        {
+            es11_smdp_list_parse(&smdp_list[i], j_eventEntries);
+        }
+        cJSON_Delete(j_eventEntries);
+    }
+
+    fret = 0;
+    goto exit;
 
+err:
+    fret = -1;
+exit:
+    if (responses)
+    {
+        for (i = 0; i < count; i++)
+        {
+            free(responses[i].rx);
+        }
+    }
+    euicc_free(ctx, responses);
+    euicc_free(ctx, offsets);
     return fret;
 }
 
@@ -566,7 +1835,180 @@ int es9p_handle_notification(struct euicc_ctx *ctx, const char *b64_PendingNotif
     const char *ikey[] = {"pendingNotification", NULL};
     const char *idata[] = {b64_PendingNotification, NULL};
 
-    return es9p_trans_json(ctx, ctx->http.server_address, "/gsma/rsp2/es9plus/handleNotification", ikey, idata, NULL, NULL, NULL);
+    return es9p_trans_json(ctx, ctx->http.server_address, "/gsma/rsp2/es9plus/handleNotification", ikey, idata, NULL, NULL, NULL, NULL);
+}
+
+// rcode[i] stays 0 for a request that could not be completed, -1 when none could
+static int es9p_handle_notification_send(struct euicc_ctx *ctx, uint32_t *rcode, const char *const *url, const uint8_t *const *tx, const uint32_t *tx_len, uint32_t count)
+{
+    ctx->http.retry_after_ms = 0;
+    if (ctx->http.interface->transmit_multi)
+    {
+        uint64_t start = euicc_now_us();
+        uint32_t tx_total = 0;
+        int ret;
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            tx_total += tx_len[i];
+        }
+
+        ret = ctx->http.interface->transmit_multi(ctx, rcode, url, tx, tx_len, count, lpa_header);
+        es9p_trace(ctx, count ? url[0] : NULL, start, tx_total, 0, count ? rcode[0] : 0, ret);
+        if (ret < 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint8_t *rx = NULL;
+            uint32_t rx_len = 0;
+            uint64_t start = euicc_now_us();
+            int ret;
+
+            ret = ctx->http.interface->transmit(ctx, url[i], &rcode[i], &rx, &rx_len, tx[i], tx_len[i], lpa_header);
+            es9p_trace(ctx, url[i], start, tx_len[i], ret < 0 ? 0 : rx_len, ret < 0 ? 0 : rcode[i], ret);
+            if (ret < 0)
+            {
+                rcode[i] = 0;
+            }
+            free(rx);
+        }
+    }
+
+    return 0;
+}
+
+int es9p_handle_notification_multi(struct euicc_ctx *ctx, const char *const *server_address, const char *const *b64_PendingNotification, int *result, uint32_t count)
+{
+    int fret = 0;
+    const char *ikey[] = {"pendingNotification", NULL};
+    const char *idata[] = {NULL, NULL};
+    uint32_t *offsets = NULL;
+    const char **url = NULL;
+    const uint8_t **tx = NULL;
+    uint32_t *tx_len = NULL;
+    uint32_t *rcode = NULL;
+    uint32_t *index = NULL;
+
+    if (!ctx->http.interface)
+    {
+        goto err;
+    }
+
+    offsets = euicc_malloc(ctx, count * 2 * sizeof(uint32_t));
+    url = euicc_malloc(ctx, count * sizeof(char *));
+    tx = euicc_malloc(ctx, count * sizeof(uint8_t *));
+    tx_len = euicc_malloc(ctx, count * sizeof(uint32_t));
+    rcode = euicc_malloc(ctx, count * sizeof(uint32_t));
+    index = euicc_malloc(ctx, count * sizeof(uint32_t));
+    if (count && (offsets == NULL || url == NULL || tx == NULL || tx_len == NULL || rcode == NULL || index == NULL))
+    {
+        goto err;
+    }
+    if (rcode)
+    {
+        memset(rcode, 0, count * sizeof(uint32_t));
+    }
+
+    ctx->http._internal.request_buffer.length = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        idata[0] = b64_PendingNotification[i];
+        if (es9p_request_build(ctx, server_address[i], "/gsma/rsp2/es9plus/handleNotification", ikey, idata, NULL, &offsets[i * 2], &offsets[i * 2 + 1]) < 0)
+        {
+            goto err;
+        }
+        tx_len[i] = ctx->http._internal.request_buffer.length - offsets[i * 2 + 1] - 1;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        url[i] = ctx->http._internal.request_buffer.data + offsets[i * 2];
+        tx[i] = (const uint8_t *)ctx->http._internal.request_buffer.data + offsets[i * 2 + 1];
+        if (ctx->debug & EUICC_DEBUG_HTTP)
+        {
+            euicc_log(ctx, EUICC_TRACE_HTTP, "[DEBUG] [HTTP] [TX] url: %s, data: %s", url[i], (const char *)tx[i]);
+        }
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        index[i] = i;
+        result[i] = -1;
+    }
+
+    // After each attempt the requests to send again move to the front, index tells whose they are
+    for (uint32_t attempt = 0, pending = count; pending > 0; attempt++)
+    {
+        uint32_t failed = 0;
+        uint32_t delay_ms = 0;
+        int ret;
+
+        if (euicc_aborted(ctx))
+        {
+            if (attempt == 0)
+            {
+                goto err;
+            }
+            break;
+        }
+
+        memset(rcode, 0, pending * sizeof(uint32_t));
+        ret = es9p_handle_notification_send(ctx, rcode, url, tx, tx_len, pending);
+        if (ret < 0 && attempt == 0)
+        {
+            goto err;
+        }
+
+        for (uint32_t i = 0; i < pending; i++)
+        {
+            if (ctx->debug & EUICC_DEBUG_HTTP)
+            {
+                euicc_log(ctx, EUICC_TRACE_HTTP, "[DEBUG] [HTTP] [RX] rcode: %d", rcode[i]);
+            }
+            if (rcode[i] / 100 == 2)
+            {
+                result[index[i]] = 0;
+                continue;
+            }
+            if (!es9p_retry_transient(rcode[i] ? 0 : -1, rcode[i]))
+            {
+                continue;
+            }
+            if (failed == 0)
+            {
+                delay_ms = es9p_retry_delay(ctx, attempt, rcode[i] ? 0 : -1, rcode[i]);
+            }
+            url[failed] = url[i];
+            tx[failed] = tx[i];
+            tx_len[failed] = tx_len[i];
+            index[failed] = index[i];
+            failed++;
+        }
+
+        pending = failed;
+        if (delay_ms == 0 || euicc_wait_ms(ctx, delay_ms) < 0)
+        {
+            break;
+        }
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    euicc_free(ctx, offsets);
+    euicc_free(ctx, url);
+    euicc_free(ctx, tx);
+    euicc_free(ctx, tx_len);
+    euicc_free(ctx, rcode);
+    euicc_free(ctx, index);
+    return fret;
 }
 
 void es11_smdp_list_free_all(char **smdp_list)
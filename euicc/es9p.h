@@ -3,18 +3,31 @@
 #include "euicc.h"
 #include "es10b.h"
 
-int es9p_initiate_authentication_r(struct euicc_ctx *ctx, char **transaction_id, struct es10b_authenticate_server_param *resp, const char *server_address, const char *b64_euicc_challenge, const char *b64_euicc_info_1);
-int es9p_get_bound_profile_package_r(struct euicc_ctx *ctx, char **b64_bound_profile_package, const char *server_address, const char *transaction_id, const char *b64_prepare_download_response);
-int es9p_authenticate_client_r(struct euicc_ctx *ctx, struct es10b_prepare_download_param *resp, const char *server_address, const char *transaction_id, const char *b64_authenticate_server_response);
-int es9p_cancel_session_r(struct euicc_ctx *ctx, const char *server_address, const char *transaction_id, const char *b64_cancel_session_response);
+// The binary arguments and results are what the eUICC takes or returns, base64 only appears in the JSON on the wire
+int es9p_initiate_authentication_r(struct euicc_ctx *ctx, char **transaction_id, struct es10b_authenticate_server_param *resp, const char *server_address, const struct euicc_blob *euicc_challenge, const struct euicc_blob *euicc_info_1);
+int es9p_get_bound_profile_package_r(struct euicc_ctx *ctx, struct euicc_blob *bound_profile_package, const char *server_address, const char *transaction_id, const struct euicc_blob *prepare_download_response);
+// Returns -1 if the ES9+ transfer failed and -2 if the eUICC rejected the package while it was being streamed in,
+// -3 if it was larger than ctx->http.bpp_max_length and the transfer was stopped before anything reached the eUICC,
+// -4 if it could not be loaded within ctx->http.bpp_memory_max. ctx->http.bpp_memory_peak is set either way.
+int es9p_get_and_load_bound_profile_package_r(struct euicc_ctx *ctx, struct es10b_load_bound_profile_package_result *result, const char *server_address, const char *transaction_id, const struct euicc_blob *prepare_download_response);
+int es9p_authenticate_client_r(struct euicc_ctx *ctx, struct es10b_prepare_download_param *resp, const char *server_address, const char *transaction_id, const struct euicc_blob *authenticate_server_response);
+int es9p_cancel_session_r(struct euicc_ctx *ctx, const char *server_address, const char *transaction_id, const struct euicc_blob *cancel_session_response);
 
+// Lets the HTTP driver connect to ctx->http.server_address while the eUICC is still busy, a no-op for drivers without prepare
+void es9p_prepare(struct euicc_ctx *ctx);
 int es9p_initiate_authentication(struct euicc_ctx *ctx);
 int es9p_get_bound_profile_package(struct euicc_ctx *ctx);
+int es9p_get_and_load_bound_profile_package(struct euicc_ctx *ctx, struct es10b_load_bound_profile_package_result *result);
 int es9p_authenticate_client(struct euicc_ctx *ctx);
 int es9p_cancel_session(struct euicc_ctx *ctx);
 
-int es11_authenticate_client_r(struct euicc_ctx *ctx, char ***smdp_list, const char *server_address, const char *transaction_id, const char *b64_authenticate_server_response);
+int es11_authenticate_client_r(struct euicc_ctx *ctx, char ***smdp_list, const char *server_address, const char *transaction_id, const struct euicc_blob *authenticate_server_response);
 int es11_authenticate_client(struct euicc_ctx *ctx, char ***smdp_list);
+// Sends the AuthenticateClient of several SM-DS sessions at once, concurrently when the HTTP driver has submit.
+// smdp_list[i] stays NULL when session i failed, a negative return means none of them were sent.
+int es11_authenticate_client_multi(struct euicc_ctx *ctx, const char *const *server_address, const char *const *transaction_id, const struct euicc_blob *authenticate_server_response, char ***smdp_list, uint32_t count);
 
 int es9p_handle_notification(struct euicc_ctx *ctx, const char *b64_PendingNotification);
+// Sends all notifications at once, concurrently when the HTTP driver supports it. result[i] is 0 once notification i was acknowledged.
+int es9p_handle_notification_multi(struct euicc_ctx *ctx, const char *const *server_address, const char *const *b64_PendingNotification, int *result, uint32_t count);
 void es11_smdp_list_free_all(char **smdp_list);
@@ -2,213 +2,1439 @@
 #include "hexutil.h"
 
 #include <inttypes.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "pool.private.h"
 
 #define ISD_R_AID "\xA0\x00\x00\x05\x59\x10\x10\xFF\xFF\xFF\xFF\x89\x00\x00\x01\x00"
 
 #define APDU_EUICC_HEADER 0x80, 0xE2
 #define APDU_CONTINUE_READ_HEADER 0x80, 0xC0, 0x00, 0x00
 
+#define ES10X_SEGMENT_SIZE_DEFAULT 120
+#define ES10X_SEGMENT_SIZE_SHORT_MAX 255
+#define ES10X_SEGMENT_SIZE_EXTENDED_MAX 65535
+
+#define ES10X_RETRY_DELAY_MS 20
+
 static int es10x_transmit(struct euicc_ctx *ctx, struct apdu_response *response, struct apdu_request *req, unsigned req_len)
 {
     req->cla = (req->cla & 0xF0) | (ctx->apdu._internal.logic_channel & 0x0F);
     return euicc_apdu_transmit(ctx, response, req, req_len);
 }
 
-static int es10x_transmit_iter(struct euicc_ctx *ctx, struct apdu_request *req, unsigned req_len, int (*callback)(struct apdu_response *response, void *userdata), void *userdata)
+static int es10x_response_iter(struct euicc_ctx *ctx, struct apdu_response *response, int (*callback)(struct apdu_response *response, void *userdata), void *userdata, uint16_t *sw)
 {
     struct apdu_request *request = NULL;
-    struct apdu_response response;
-
-    if (es10x_transmit(ctx, &response, req, req_len) < 0)
-    {
-        return -1;
-    }
+    uint8_t corrections = 0;
 
     do
     {
-        if (response.length > 0)
+        if (response->length > 0)
         {
-            if (callback(&response, userdata) < 0)
+            if (callback(response, userdata) < 0)
             {
+                euicc_apdu_response_free(response);
                 return -1;
             }
         }
 
-        euicc_apdu_response_free(&response);
+        euicc_apdu_response_free(response);
+
+        // A GET RESPONSE with the wrong Le returned nothing, it can go again with the one the card named
+        if (response->sw1 == SW1_WRONG_LE && request && corrections < ctx->apdu.retry_max)
+        {
+            corrections++;
+            ctx->apdu.stats.retries.wrong_le++;
+            response->sw1 = SW1_LAST;
+        }
+        else
+        {
+            corrections = 0;
+        }
 
-        if (response.sw1 == SW1_LAST)
+        if (response->sw1 == SW1_LAST)
         {
             int ret;
 
-            if ((ret = euicc_apdu_le(ctx, &request, APDU_CONTINUE_READ_HEADER, response.sw2)) < 0)
+            if ((ret = euicc_apdu_le(ctx, &request, APDU_CONTINUE_READ_HEADER, response->sw2)) < 0)
             {
                 return -1;
             }
 
-            if (es10x_transmit(ctx, &response, request, ret) < 0)
+            ctx->apdu.stats.get_responses++;
+            if (es10x_transmit(ctx, response, request, ret) < 0)
             {
                 return -1;
             }
 
             continue;
         }
-        else if ((response.sw1 & 0xF0) == SW1_OK)
+        else if ((response->sw1 & 0xF0) == SW1_OK && response->sw1 != SW1_BUSY)
         {
             return 0;
         }
 
+        *sw = (response->sw1 << 8) | response->sw2;
         return -1;
     } while (1);
 }
 
-int es10x_command_buildrequest(struct euicc_ctx *ctx, struct apdu_request **request, uint8_t p1, uint8_t p2, const uint8_t *der_req, unsigned req_len)
+// Whether a failed segment may go again: nothing of its answer has been handed on, and the card either never saw it or
+// turned it down before acting on it. Counts the retry when it may.
+static int es10x_retry(struct euicc_ctx *ctx, uint8_t *attempt, int transport_failed, int transport_retry, const struct apdu_response *response)
+{
+    uint32_t *counter;
+
+    if (transport_failed)
+    {
+        if (!transport_retry)
+        {
+            return 0;
+        }
+        counter = &ctx->apdu.stats.retries.transport;
+    }
+    else if (response->length)
+    {
+        return 0;
+    }
+    else if (response->sw1 == SW1_BUSY)
+    {
+        counter = &ctx->apdu.stats.retries.busy;
+    }
+    else if (response->sw1 == SW1_TECHNICAL)
+    {
+        counter = &ctx->apdu.stats.retries.technical;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (*attempt >= ctx->apdu.retry_max || euicc_wait_ms(ctx, ES10X_RETRY_DELAY_MS << *attempt) < 0)
+    {
+        return 0;
+    }
+    (*attempt)++;
+    (*counter)++;
+    return 1;
+}
+
+static int es10x_transmit_iter(struct euicc_ctx *ctx, struct apdu_request *req, unsigned req_len, int transport_retry, int (*callback)(struct apdu_response *response, void *userdata), void *userdata, uint16_t *sw)
+{
+    struct apdu_response response;
+    uint8_t attempt = 0;
+    int transport_failed;
+
+    *sw = 0;
+
+    while (1)
+    {
+        transport_failed = es10x_transmit(ctx, &response, req, req_len) < 0;
+        if (!es10x_retry(ctx, &attempt, transport_failed, transport_retry, &response))
+        {
+            break;
+        }
+        if (!transport_failed)
+        {
+            euicc_apdu_response_free(&response);
+        }
+    }
+
+    if (transport_failed)
+    {
+        return -1;
+    }
+
+    return es10x_response_iter(ctx, &response, callback, userdata, sw);
+}
+
+struct es10x_request_cursor
+{
+    const struct es10x_iovec *iov;
+    unsigned iov_count;
+    unsigned index;
+    unsigned offset;
+};
+
+static void es10x_request_cursor_copy(struct es10x_request_cursor *cursor, uint8_t *output, unsigned length)
+{
+    while (length)
+    {
+        const struct es10x_iovec *iov = &cursor->iov[cursor->index];
+        unsigned n = iov->len - cursor->offset;
+
+        if (n > length)
+        {
+            n = length;
+        }
+        memmove(output, iov->base + cursor->offset, n);
+        output += n;
+        length -= n;
+        cursor->offset += n;
+
+        if (cursor->offset == iov->len)
+        {
+            cursor->index++;
+            cursor->offset = 0;
+        }
+    }
+}
+
+// A request already serialized into request_buffer.body gets its APDU header written just in front of the segment, no copy needed.
+// Bytes in front of a later segment belong to segments that have already been sent.
+static struct apdu_request *es10x_request_inplace(struct euicc_ctx *ctx, struct es10x_request_cursor *cursor, unsigned length)
+{
+    const uint8_t *body = ctx->apdu._internal.request_buffer.body;
+    const uint8_t *segment;
+
+    if (cursor->iov_count != 1)
+    {
+        return NULL;
+    }
+
+    segment = cursor->iov[0].base + cursor->offset;
+    if (segment < body || segment + length > body + sizeof(ctx->apdu._internal.request_buffer.body))
+    {
+        return NULL;
+    }
+
+    cursor->offset += length;
+    return (struct apdu_request *)(segment - sizeof(struct apdu_request));
+}
+
+static int es10x_command_buildrequest(struct euicc_ctx *ctx, struct apdu_request **request, uint8_t p1, uint8_t p2, struct es10x_request_cursor *cursor, unsigned req_len)
 {
+    const uint8_t header[] = {APDU_EUICC_HEADER};
+    struct apdu_request *inplace;
     int ret;
 
+    inplace = es10x_request_inplace(ctx, cursor, req_len);
+    if (inplace)
+    {
+        inplace->cla = header[0];
+        inplace->ins = header[1];
+        inplace->p1 = p1;
+        inplace->p2 = p2;
+        inplace->length = req_len;
+        *request = inplace;
+        return req_len + sizeof(struct apdu_request);
+    }
+
     ret = euicc_apdu_lc(ctx, request, APDU_EUICC_HEADER, p1, p2, req_len);
     if (ret < 0)
         return ret;
 
-    memcpy((*request)->data, der_req, req_len);
+    es10x_request_cursor_copy(cursor, (*request)->data, req_len);
+
+    return ret;
+}
+
+static int es10x_command_buildrequest_extended(struct euicc_ctx *ctx, struct apdu_request **request, uint8_t p1, uint8_t p2, struct es10x_request_cursor *cursor, unsigned req_len)
+{
+    int ret;
+    struct apdu_request_extended *ereq;
+
+    ret = euicc_apdu_lc_extended(ctx, &ereq, APDU_EUICC_HEADER, p1, p2, req_len);
+    if (ret < 0)
+        return ret;
+
+    es10x_request_cursor_copy(cursor, ereq->data, req_len);
+    *request = (struct apdu_request *)ereq;
 
     return ret;
 }
 
-static int es10x_command_buildrequest_continue(struct euicc_ctx *ctx, uint8_t reqseq, struct apdu_request **request, const uint8_t *der_req, unsigned req_len)
+static int es10x_command_buildrequest_segment(struct euicc_ctx *ctx, int extended, uint8_t p1, uint8_t reqseq, struct apdu_request **request, struct es10x_request_cursor *cursor, unsigned req_len)
 {
-    return es10x_command_buildrequest(ctx, request, 0x11, reqseq, der_req, req_len);
+    if (extended)
+        return es10x_command_buildrequest_extended(ctx, request, p1, reqseq, cursor, req_len);
+    return es10x_command_buildrequest(ctx, request, p1, reqseq, cursor, req_len);
 }
 
-static int es10x_command_buildrequest_last(struct euicc_ctx *ctx, uint8_t reqseq, struct apdu_request **request, const uint8_t *der_req, unsigned req_len)
+static int es10x_command_buildrequest_continue(struct euicc_ctx *ctx, int extended, uint8_t reqseq, struct apdu_request **request, struct es10x_request_cursor *cursor, unsigned req_len)
 {
-    return es10x_command_buildrequest(ctx, request, 0x91, reqseq, der_req, req_len);
+    return es10x_command_buildrequest_segment(ctx, extended, 0x11, reqseq, request, cursor, req_len);
 }
 
-int es10x_command_iter(struct euicc_ctx *ctx, const uint8_t *der_req, unsigned req_len, int (*callback)(struct apdu_response *response, void *userdata), void *userdata)
+static int es10x_command_buildrequest_last(struct euicc_ctx *ctx, int extended, uint8_t reqseq, struct apdu_request **request, struct es10x_request_cursor *cursor, unsigned req_len)
+{
+    return es10x_command_buildrequest_segment(ctx, extended, 0x91, reqseq, request, cursor, req_len);
+}
+
+static unsigned es10x_segment_size(struct euicc_ctx *ctx, int *extended)
+{
+    unsigned segment_size = ctx->apdu.segment_size;
+
+    *extended = 0;
+
+    if (segment_size == 0)
+    {
+        return ES10X_SEGMENT_SIZE_DEFAULT;
+    }
+
+    if (segment_size > ES10X_SEGMENT_SIZE_SHORT_MAX)
+    {
+        if (!ctx->apdu.interface->extended_length || ctx->apdu._internal.extended_length_rejected)
+        {
+            return ES10X_SEGMENT_SIZE_SHORT_MAX;
+        }
+        if (segment_size > ES10X_SEGMENT_SIZE_EXTENDED_MAX)
+        {
+            segment_size = ES10X_SEGMENT_SIZE_EXTENDED_MAX;
+        }
+        *extended = 1;
+    }
+
+    return segment_size;
+}
+
+static int es10x_command_iter_segmented(struct euicc_ctx *ctx, unsigned segment_size, int extended, const struct es10x_iovec *iov, unsigned iov_count, int (*callback)(struct apdu_response *response, void *userdata), void *userdata, int *rejected)
 {
     int ret, reqseq;
     struct apdu_request *req;
-    const uint8_t *req_ptr;
+    struct es10x_request_cursor cursor = {
+        .iov = iov,
+        .iov_count = iov_count,
+    };
+    unsigned req_len = 0;
+    uint16_t sw;
+
+    *rejected = 0;
+
+    for (unsigned i = 0; i < iov_count; i++)
+    {
+        req_len += iov[i].len;
+    }
+
+    while (cursor.index < iov_count && iov[cursor.index].len == 0)
+    {
+        cursor.index++;
+    }
 
     reqseq = 0;
-    req_ptr = der_req;
     while (req_len)
     {
-        uint8_t rlen;
-        if (req_len > 120)
+        unsigned rlen;
+        if (req_len > segment_size)
         {
-            rlen = 120;
-            ret = es10x_command_buildrequest_continue(ctx, reqseq, &req, req_ptr, rlen);
+            rlen = segment_size;
+            ret = es10x_command_buildrequest_continue(ctx, extended, reqseq, &req, &cursor, rlen);
         }
         else
         {
             rlen = req_len;
-            ret = es10x_command_buildrequest_last(ctx, reqseq, &req, req_ptr, rlen);
+            ret = es10x_command_buildrequest_last(ctx, extended, reqseq, &req, &cursor, rlen);
         }
         req_len -= rlen;
 
         if (ret < 0)
             return -1;
 
-        ret = es10x_transmit_iter(ctx, req, ret, callback, userdata);
+        // A lost answer does not mean the card never saw the segment, so only block 0 of a longer command goes again: the
+        // card just buffers it and a repeated block 0 starts the command over. A lost first extended-length segment is
+        // taken as no extended-length support, not as noise.
+        ret = es10x_transmit_iter(ctx, req, ret, !extended && reqseq == 0 && req_len, callback, userdata, &sw);
         if (ret < 0)
+        {
+            // Only the first segment can be retried safely: the card has not buffered anything yet.
+            // A transport error or "wrong length" (67xx) there means extended-length is not usable.
+            if (extended && reqseq == 0 && (sw == 0 || (sw >> 8) == 0x67))
+            {
+                *rejected = 1;
+            }
             return -1;
+        }
 
-        req_ptr += rlen;
         reqseq++;
     }
 
     return 0;
 }
 
-struct userdata_es10x_command
+static int es10x_transaction_begin(struct euicc_ctx *ctx)
 {
-    uint8_t *resp;
-    unsigned resp_len;
-};
+    if (ctx->apdu.interface->transaction_begin)
+    {
+        return ctx->apdu.interface->transaction_begin(ctx);
+    }
+    return 0;
+}
 
-static int iter_es10x_command(struct apdu_response *response, void *userdata)
+static void es10x_transaction_end(struct euicc_ctx *ctx)
+{
+    if (ctx->apdu.interface->transaction_end)
+    {
+        ctx->apdu.interface->transaction_end(ctx);
+    }
+}
+
+static int es10x_refresh(struct euicc_ctx *ctx)
+{
+    if (!ctx->apdu._internal.refresh_pending)
+    {
+        return 0;
+    }
+    return euicc_reconnect(ctx);
+}
+
+static void es10x_boundary(struct euicc_ctx *ctx)
 {
-    struct userdata_es10x_command *ud = (struct userdata_es10x_command *)userdata;
-    uint8_t *new_response_data;
+    uint8_t body[sizeof(ctx->apdu._internal.request_buffer.body)];
 
-    new_response_data = realloc(ud->resp, ud->resp_len + response->length);
-    if (!new_response_data)
+    if (ctx->boundary)
     {
-        return -1;
+        // The request about to be sent is often encoded there, and the commands of the hook would overwrite it
+        memcpy(body, ctx->apdu._internal.request_buffer.body, sizeof(body));
+        ctx->boundary(ctx);
+        memcpy(ctx->apdu._internal.request_buffer.body, body, sizeof(body));
+    }
+}
+
+void euicc_operation(struct euicc_ctx *ctx, const char *name, int end)
+{
+    if (ctx->operation)
+    {
+        ctx->operation(ctx, name, end);
+    }
+}
+
+uint64_t euicc_now_us(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart / frequency.QuadPart * 1000000 + counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+void euicc_deadline_set(struct euicc_ctx *ctx, uint32_t timeout_ms)
+{
+    ctx->deadline_us = timeout_ms ? euicc_now_us() + (uint64_t)timeout_ms * 1000 : 0;
+}
+
+int euicc_aborted(struct euicc_ctx *ctx)
+{
+    if (ctx->deadline_us && euicc_now_us() >= ctx->deadline_us)
+    {
+        return 1;
+    }
+    if (ctx->cancel && ctx->cancel(ctx))
+    {
+        return 1;
     }
-    ud->resp = new_response_data;
-    memcpy(ud->resp + ud->resp_len, response->data, response->length);
-    ud->resp_len += response->length;
     return 0;
 }
 
-int es10x_command(struct euicc_ctx *ctx, uint8_t **resp, unsigned *resp_len, const uint8_t *der_req, unsigned req_len)
+uint32_t euicc_timeout_ms(struct euicc_ctx *ctx, uint32_t timeout_ms)
 {
-    int ret = 0;
-    struct userdata_es10x_command ud;
+    uint64_t now, left;
 
-    *resp = NULL;
-    *resp_len = 0;
-    memset(&ud, 0, sizeof(ud));
+    if (!ctx->deadline_us)
+    {
+        return timeout_ms;
+    }
 
-    ret = es10x_command_iter(ctx, der_req, req_len, iter_es10x_command, &ud);
-    if (ret < 0)
+    now = euicc_now_us();
+    left = ctx->deadline_us > now ? (ctx->deadline_us - now + 999) / 1000 : 1;
+    if (left > UINT32_MAX)
     {
-        free(ud.resp);
-        return -1;
+        left = UINT32_MAX;
+    }
+    if (timeout_ms && timeout_ms < left)
+    {
+        return timeout_ms;
     }
+    return left;
+}
 
-    *resp = ud.resp;
-    *resp_len = ud.resp_len;
-    return 0;
+int euicc_wait_ms(struct euicc_ctx *ctx, uint32_t ms)
+{
+    uint64_t end = euicc_now_us() + (uint64_t)ms * 1000;
+    uint64_t now;
+
+    // In slices, so ctx->cancel is heard while waiting
+    while (!euicc_aborted(ctx) && (now = euicc_now_us()) < end)
+    {
+        uint64_t us = end - now < 100000 ? end - now : 100000;
+#ifdef _WIN32
+        Sleep(us / 1000);
+#else
+        struct timespec ts;
+
+        ts.tv_sec = 0;
+        ts.tv_nsec = us * 1000;
+        nanosleep(&ts, NULL);
+#endif
+    }
+
+    return euicc_aborted(ctx) ? -1 : 0;
 }
 
-int euicc_init(struct euicc_ctx *ctx)
+void euicc_trace(struct euicc_ctx *ctx, struct euicc_trace_span *span, uint64_t start)
 {
-    int ret;
+    span->start_us = start;
+    span->duration_us = euicc_now_us() - start;
+    ctx->trace(ctx, span);
+}
 
-    ret = ctx->apdu.interface->connect(ctx);
-    if (ret < 0)
+static void euicc_progress_report(struct euicc_ctx *ctx, struct euicc_progress_meter *meter, uint64_t now)
+{
+    meter->progress.apdus = ctx->apdu.stats.apdus - meter->apdus_start;
+    meter->progress.elapsed_us = now - meter->start_us;
+    meter->last_us = now;
+    ctx->progress(ctx, &meter->progress);
+}
+
+void euicc_progress_begin(struct euicc_ctx *ctx, struct euicc_progress_meter *meter, enum euicc_progress_phase phase, uint32_t total)
+{
+    memset(meter, 0, sizeof(*meter));
+    if (!ctx->progress)
     {
-        return -1;
+        return;
     }
+    meter->progress.phase = phase;
+    meter->progress.total = total;
+    meter->start_us = meter->last_us = euicc_now_us();
+    meter->apdus_start = ctx->apdu.stats.apdus;
+    meter->active = 1;
+}
 
-    ret = ctx->apdu.interface->logic_channel_open(ctx, (const uint8_t *)ISD_R_AID, sizeof(ISD_R_AID) - 1);
-    if (ret < 0)
+void euicc_progress_update(struct euicc_ctx *ctx, struct euicc_progress_meter *meter, uint32_t done)
+{
+    uint64_t now;
+
+    if (!meter->active)
     {
-        return -1;
+        return;
     }
+    meter->progress.done += done;
 
-    ctx->apdu._internal.logic_channel = ret;
+    now = euicc_now_us();
+    if (now - meter->last_us >= (uint64_t)(ctx->progress_interval_ms ? ctx->progress_interval_ms : 1000) * 1000)
+    {
+        euicc_progress_report(ctx, meter, now);
+    }
+}
 
-    return 0;
+void euicc_progress_end(struct euicc_ctx *ctx, struct euicc_progress_meter *meter)
+{
+    if (!meter->active)
+    {
+        return;
+    }
+    meter->progress.finished = 1;
+    euicc_progress_report(ctx, meter, euicc_now_us());
+    meter->active = 0;
 }
 
-void euicc_fini(struct euicc_ctx *ctx)
+void *euicc_allocator_malloc(const struct euicc_allocator *allocator, size_t size)
 {
-    ctx->apdu.interface->logic_channel_close(ctx, ctx->apdu._internal.logic_channel);
-    ctx->apdu.interface->disconnect(ctx);
-    ctx->apdu._internal.logic_channel = 0;
+    if (allocator)
+    {
+        return (allocator->malloc)(allocator->userdata, size);
+    }
+    return malloc(size);
 }
 
-void euicc_http_cleanup(struct euicc_ctx *ctx)
+void *euicc_allocator_realloc(const struct euicc_allocator *allocator, void *ptr, size_t size)
+{
+    if (allocator)
+    {
+        return (allocator->realloc)(allocator->userdata, ptr, size);
+    }
+    return realloc(ptr, size);
+}
+
+void euicc_allocator_free(const struct euicc_allocator *allocator, void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    if (allocator)
+    {
+        (allocator->free)(allocator->userdata, ptr);
+        return;
+    }
+    free(ptr);
+}
+
+void *euicc_malloc(struct euicc_ctx *ctx, size_t size)
+{
+    return euicc_allocator_malloc(ctx->allocator, size);
+}
+
+void *euicc_realloc(struct euicc_ctx *ctx, void *ptr, size_t size)
+{
+    return euicc_allocator_realloc(ctx->allocator, ptr, size);
+}
+
+void euicc_free(struct euicc_ctx *ctx, void *ptr)
+{
+    euicc_allocator_free(ctx->allocator, ptr);
+}
+
+void euicc_log(struct euicc_ctx *ctx, enum euicc_trace_category category, const char *fmt, ...)
+{
+    char buffer[256];
+    char *line = buffer;
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buffer, sizeof(buffer), fmt, ap);
+    va_end(ap);
+    if (len < 0)
+    {
+        return;
+    }
+
+    if ((size_t)len >= sizeof(buffer))
+    {
+        line = euicc_malloc(ctx, len + 1);
+        if (line == NULL)
+        {
+            return;
+        }
+        va_start(ap, fmt);
+        vsnprintf(line, len + 1, fmt, ap);
+        va_end(ap);
+    }
+
+    if (ctx->log)
+    {
+        ctx->log(ctx, category, line);
+    }
+    else
+    {
+        fprintf(stderr, "%s\n", line);
+    }
+
+    if (line != buffer)
+    {
+        euicc_free(ctx, line);
+    }
+}
+
+static uint16_t es10x_stats_tag(const struct es10x_iovec *iov, unsigned iov_count)
+{
+    uint8_t tag[2];
+    unsigned n = 0;
+
+    for (unsigned i = 0; i < iov_count && n < sizeof(tag); i++)
+    {
+        for (unsigned j = 0; j < iov[i].len && n < sizeof(tag); j++)
+        {
+            tag[n++] = iov[i].base[j];
+        }
+    }
+
+    if (n == 0)
+    {
+        return 0;
+    }
+    if ((tag[0] & 0x1F) == 0x1F && n == 2)
+    {
+        return (tag[0] << 8) | tag[1];
+    }
+    return tag[0];
+}
+
+static void es10x_stats_command(struct euicc_ctx *ctx, uint16_t tag, uint32_t tx_len, uint32_t calls, uint32_t apdus, uint64_t start, int ret)
 {
+    struct euicc_apdu_stats *stats = &ctx->apdu.stats;
+    uint32_t i;
+
+    if (ctx->trace)
+    {
+        struct euicc_trace_span span = {
+            .category = EUICC_TRACE_ES10X,
+            .tag = tag,
+            .tx_len = tx_len,
+            .count = stats->apdus - apdus,
+            .ret = ret,
+        };
+
+        euicc_trace(ctx, &span, start);
+    }
+
+    for (i = 0; i < stats->command_count; i++)
+    {
+        if (stats->commands[i].tag == tag)
+        {
+            break;
+        }
+    }
+    if (i == stats->command_count)
+    {
+        if (stats->command_count == EUICC_APDU_STATS_COMMAND_MAX)
+        {
+            return;
+        }
+        stats->commands[i].tag = tag;
+        stats->command_count++;
+    }
+
+    stats->commands[i].calls += calls;
+    stats->commands[i].apdus += stats->apdus - apdus;
+    stats->commands[i].time_us += euicc_now_us() - start;
+}
+
+// Requests whose response only changes through other ES10x commands
+static int es10x_response_cacheable(uint16_t tag)
+{
+    switch (tag)
+    {
+    case 0xBF3E: // GetEuiccDataRequest
+    case 0xBF20: // GetEuiccInfo1Request
+    case 0xBF22: // GetEuiccInfo2Request
+    case 0xBF3C: // EuiccConfiguredAddressesRequest
+    case 0xBF43: // GetRatRequest
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Any other request may change the card, and drops the cached responses
+static int es10x_response_cache_kept(uint16_t tag)
+{
+    switch (tag)
+    {
+    case 0xBF2D: // ProfileInfoListRequest
+    case 0xBF28: // ListNotificationRequest
+    case 0xBF2B: // RetrieveNotificationsListRequest
+    case 0xBF2E: // GetEuiccChallengeRequest
+        return 1;
+    default:
+        return es10x_response_cacheable(tag);
+    }
+}
+
+void euicc_response_cache_clear(struct euicc_ctx *ctx)
+{
+    for (uint32_t i = 0; i < ctx->apdu._internal.response_cache_count; i++)
+    {
+        euicc_free(ctx, ctx->apdu._internal.response_cache[i].request);
+        euicc_free(ctx, ctx->apdu._internal.response_cache[i].response);
+    }
+    memset(ctx->apdu._internal.response_cache, 0, sizeof(ctx->apdu._internal.response_cache));
+    ctx->apdu._internal.response_cache_count = 0;
+}
+
+static int es10x_response_cache_find(struct euicc_ctx *ctx, const uint8_t *req, unsigned req_len)
+{
+    for (uint32_t i = 0; i < ctx->apdu._internal.response_cache_count; i++)
+    {
+        if (ctx->apdu._internal.response_cache[i].request_len == req_len && memcmp(ctx->apdu._internal.response_cache[i].request, req, req_len) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void es10x_response_cache_store(struct euicc_ctx *ctx, const uint8_t *req, unsigned req_len, const uint8_t *resp, unsigned resp_len)
+{
+    uint32_t i = ctx->apdu._internal.response_cache_count;
+    uint8_t *request, *response;
+
+    if (i == EUICC_RESPONSE_CACHE_MAX || es10x_response_cache_find(ctx, req, req_len) >= 0)
+    {
+        return;
+    }
+
+    request = euicc_malloc(ctx, req_len);
+    response = euicc_malloc(ctx, resp_len ? resp_len : 1);
+    if (!request || !response)
+    {
+        euicc_free(ctx, request);
+        euicc_free(ctx, response);
+        return;
+    }
+    memcpy(request, req, req_len);
+    memcpy(response, resp, resp_len);
+
+    ctx->apdu._internal.response_cache[i].request = request;
+    ctx->apdu._internal.response_cache[i].request_len = req_len;
+    ctx->apdu._internal.response_cache[i].response = response;
+    ctx->apdu._internal.response_cache[i].response_len = resp_len;
+    ctx->apdu._internal.response_cache_count++;
+}
+
+static int es10x_command_iter_gather(struct euicc_ctx *ctx, const struct es10x_iovec *iov, unsigned iov_count, int (*callback)(struct apdu_response *response, void *userdata), void *userdata)
+{
+    int ret, extended, rejected;
+    unsigned segment_size;
+    uint32_t apdus, tx_len;
+    uint64_t start;
+
+    if (!es10x_response_cache_kept(es10x_stats_tag(iov, iov_count)))
+    {
+        euicc_response_cache_clear(ctx);
+    }
+
+    if (es10x_transaction_begin(ctx) < 0)
+    {
+        return -1;
+    }
+
+    apdus = ctx->apdu.stats.apdus;
+    start = euicc_now_us();
+
+    segment_size = es10x_segment_size(ctx, &extended);
+
+    ret = es10x_command_iter_segmented(ctx, segment_size, extended, iov, iov_count, callback, userdata, &rejected);
+    if (ret < 0 && rejected)
+    {
+        ctx->apdu._internal.extended_length_rejected = 1;
+        ret = es10x_command_iter_segmented(ctx, ES10X_SEGMENT_SIZE_DEFAULT, 0, iov, iov_count, callback, userdata, &rejected);
+    }
+
+    tx_len = 0;
+    for (unsigned i = 0; i < iov_count; i++)
+    {
+        tx_len += iov[i].len;
+    }
+    es10x_stats_command(ctx, es10x_stats_tag(iov, iov_count), tx_len, 1, apdus, start, ret);
+
+    es10x_transaction_end(ctx);
+
+    return ret;
+}
+
+int es10x_command_iter(struct euicc_ctx *ctx, const uint8_t *der_req, unsigned req_len, int (*callback)(struct apdu_response *response, void *userdata), void *userdata)
+{
+    struct es10x_iovec iov = {
+        .base = der_req,
+        .len = req_len,
+    };
+
+    es10x_boundary(ctx);
+    if (es10x_refresh(ctx) < 0)
+    {
+        return -1;
+    }
+
+    return es10x_command_iter_gather(ctx, &iov, 1, callback, userdata);
+}
+
+#define ES10X_RESPONSE_BUFFER_INITIAL 1024
+
+static int es10x_response_buffer_reserve(struct euicc_ctx *ctx, uint32_t length)
+{
+    uint8_t *new_data;
+    uint32_t new_capacity;
+
+    if (ctx->apdu._internal.response_buffer.capacity >= length)
+        return 0;
+
+    new_capacity = ctx->apdu._internal.response_buffer.capacity;
+    if (new_capacity == 0)
+        new_capacity = ES10X_RESPONSE_BUFFER_INITIAL;
+    while (new_capacity < length)
+        new_capacity *= 2;
+
+    new_data = euicc_realloc(ctx, ctx->apdu._internal.response_buffer.data, new_capacity);
+    if (!new_data)
+        return -1;
+
+    ctx->apdu._internal.response_buffer.data = new_data;
+    ctx->apdu._internal.response_buffer.capacity = new_capacity;
+    return 0;
+}
+
+static int iter_es10x_command(struct apdu_response *response, void *userdata)
+{
+    struct euicc_ctx *ctx = (struct euicc_ctx *)userdata;
+    uint32_t length = ctx->apdu._internal.response_buffer.length;
+
+    if (es10x_response_buffer_reserve(ctx, length + response->length) < 0)
+    {
+        return -1;
+    }
+    memcpy(ctx->apdu._internal.response_buffer.data + length, response->data, response->length);
+    ctx->apdu._internal.response_buffer.length += response->length;
+    return 0;
+}
+
+// The response is kept in a per-context buffer and stays valid until the next ES10x command.
+int es10x_command(struct euicc_ctx *ctx, uint8_t **resp, unsigned *resp_len, const uint8_t *der_req, unsigned req_len)
+{
+    struct es10x_iovec iov = {
+        .base = der_req,
+        .len = req_len,
+    };
+
+    return es10x_command_gather(ctx, resp, resp_len, &iov, 1);
+}
+
+int euicc_es10x_transceive(struct euicc_ctx *ctx, const uint8_t *der_req, uint32_t req_len, const uint8_t **resp, uint32_t *resp_len)
+{
+    uint8_t *respbuf;
+    unsigned resplen;
+
+    euicc_response_cache_clear(ctx);
+    if (es10x_command(ctx, &respbuf, &resplen, der_req, req_len) < 0)
+    {
+        return -1;
+    }
+    *resp = respbuf;
+    *resp_len = resplen;
+    return 0;
+}
+
+// Sends the concatenation of iov[] as one command, each segment is copied straight from the pieces.
+int es10x_command_gather(struct euicc_ctx *ctx, uint8_t **resp, unsigned *resp_len, const struct es10x_iovec *iov, unsigned iov_count)
+{
+    int cacheable;
+
+    es10x_boundary(ctx);
+    if (es10x_refresh(ctx) < 0)
+    {
+        return -1;
+    }
+
+    *resp = NULL;
+    *resp_len = 0;
+    ctx->apdu._internal.response_buffer.length = 0;
+
+    cacheable = iov_count == 1 && es10x_response_cacheable(es10x_stats_tag(iov, iov_count));
+    if (cacheable)
+    {
+        int i = es10x_response_cache_find(ctx, iov->base, iov->len);
+
+        if (i >= 0)
+        {
+            if (es10x_response_buffer_reserve(ctx, ctx->apdu._internal.response_cache[i].response_len) < 0)
+            {
+                return -1;
+            }
+            memcpy(ctx->apdu._internal.response_buffer.data, ctx->apdu._internal.response_cache[i].response, ctx->apdu._internal.response_cache[i].response_len);
+            ctx->apdu._internal.response_buffer.length = ctx->apdu._internal.response_cache[i].response_len;
+            ctx->apdu.stats.cache_hits++;
+            goto done;
+        }
+    }
+
+    if (es10x_command_iter_gather(ctx, iov, iov_count, iter_es10x_command, ctx) < 0)
+    {
+        return -1;
+    }
+
+    if (cacheable)
+    {
+        es10x_response_cache_store(ctx, iov->base, iov->len, ctx->apdu._internal.response_buffer.data, ctx->apdu._internal.response_buffer.length);
+    }
+
+done:
+    *resp = ctx->apdu._internal.response_buffer.data;
+    *resp_len = ctx->apdu._internal.response_buffer.length;
+    return 0;
+}
+
+static int iter_es10x_command_stream(struct apdu_response *response, void *userdata)
+{
+    return euicc_derutil_stream_feed((struct euicc_derutil_stream *)userdata, response->data, response->length);
+}
+
+// Feeds every response chunk to the stream decoder as it arrives instead of buffering the whole response.
+int es10x_command_stream(struct euicc_ctx *ctx, const uint8_t *der_req, unsigned req_len, struct euicc_derutil_stream *stream)
+{
+    if (es10x_command_iter(ctx, der_req, req_len, iter_es10x_command_stream, stream) < 0)
+    {
+        return -1;
+    }
+
+    return euicc_derutil_stream_finish(stream);
+}
+
+struct es10x_batch_apdu
+{
+    unsigned command;
+    uint8_t last;
+};
+
+static uint32_t es10x_batch_header(struct euicc_ctx *ctx, uint8_t *wptr, int extended, uint8_t p1, uint8_t p2, unsigned datalen)
+{
+    const uint8_t header[] = {APDU_EUICC_HEADER};
+
+    wptr[0] = (header[0] & 0xF0) | (ctx->apdu._internal.logic_channel & 0x0F);
+    wptr[1] = header[1];
+    wptr[2] = p1;
+    wptr[3] = p2;
+    if (extended)
+    {
+        wptr[4] = 0x00;
+        wptr[5] = (datalen >> 8) & 0xFF;
+        wptr[6] = datalen & 0xFF;
+        return sizeof(struct apdu_request_extended);
+    }
+    wptr[4] = datalen;
+    return sizeof(struct apdu_request);
+}
+
+static int es10x_command_batch_segmented(struct euicc_ctx *ctx, unsigned segment_size, int extended, const uint8_t *const *der_reqs, const unsigned *req_lens, unsigned count, int (*callback)(unsigned index, const uint8_t *resp, unsigned resp_len, void *userdata), void *userdata, int *rejected)
+{
+    int fret = 0;
+    const uint8_t **tx = NULL;
+    uint32_t *tx_len = NULL;
+    struct es10x_batch_apdu *meta = NULL;
+    uint32_t apdu_count = 0, buffer_len = 0, header_len;
+    uint32_t n, pos, retry_index;
+    unsigned acc_command;
+    uint8_t attempt;
+    uint8_t *wptr;
+
+    *rejected = 0;
+    header_len = extended ? sizeof(struct apdu_request_extended) : sizeof(struct apdu_request);
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        unsigned segments = (req_lens[i] + segment_size - 1) / segment_size;
+        apdu_count += segments;
+        buffer_len += req_lens[i] + segments * header_len;
+    }
+
+    if (ctx->apdu._internal.batch_buffer_len < buffer_len)
+    {
+        uint8_t *new_buffer;
+
+        new_buffer = euicc_realloc(ctx, ctx->apdu._internal.batch_buffer, buffer_len);
+        if (!new_buffer)
+        {
+            goto err;
+        }
+        ctx->apdu._internal.batch_buffer = new_buffer;
+        ctx->apdu._internal.batch_buffer_len = buffer_len;
+    }
+
+    tx = euicc_malloc(ctx, apdu_count * sizeof(*tx));
+    tx_len = euicc_malloc(ctx, apdu_count * sizeof(*tx_len));
+    meta = euicc_malloc(ctx, apdu_count * sizeof(*meta));
+    if (!tx || !tx_len || !meta)
+    {
+        goto err;
+    }
+
+    n = 0;
+    wptr = ctx->apdu._internal.batch_buffer;
+    for (unsigned i = 0; i < count; i++)
+    {
+        const uint8_t *req_ptr = der_reqs[i];
+        unsigned req_len = req_lens[i];
+        uint8_t reqseq = 0;
+
+        while (req_len)
+        {
+            unsigned rlen = req_len > segment_size ? segment_size : req_len;
+            uint8_t p1 = req_len > segment_size ? 0x11 : 0x91;
+            uint32_t hlen;
+
+            hlen = es10x_batch_header(ctx, wptr, extended, p1, reqseq, rlen);
+            memcpy(wptr + hlen, req_ptr, rlen);
+
+            tx[n] = wptr;
+            tx_len[n] = hlen + rlen;
+            meta[n].command = i;
+            meta[n].last = (p1 == 0x91);
+
+            wptr += tx_len[n];
+            req_ptr += rlen;
+            req_len -= rlen;
+            reqseq++;
+            n++;
+        }
+    }
+
+    acc_command = count;
+    ctx->apdu._internal.response_buffer.length = 0;
+
+    pos = 0;
+    retry_index = n;
+    attempt = 0;
+    while (pos < n)
+    {
+        struct apdu_response response;
+        uint16_t sw = 0;
+        uint32_t last;
+        int sent;
+
+        // The first extended-length APDU goes alone, so a failure can only be it being turned down and nothing the
+        // card accepted gets sent again when the batch restarts with short segments
+        sent = euicc_apdu_transmit_batch(ctx, &response, tx + pos, tx_len + pos, extended && pos == 0 ? 1 : n - pos);
+        if (sent < 0)
+        {
+            if (extended && pos == 0)
+            {
+                *rejected = 1;
+            }
+            goto err;
+        }
+        last = pos + sent - 1;
+
+        // Everything before the last APDU was answered with a bare 90 00
+        for (uint32_t i = pos; i < last; i++)
+        {
+            if (!meta[i].last)
+            {
+                continue;
+            }
+            if (meta[i].command == acc_command)
+            {
+                if (callback(acc_command, ctx->apdu._internal.response_buffer.data, ctx->apdu._internal.response_buffer.length, userdata) < 0)
+                {
+                    goto err;
+                }
+                acc_command = count;
+                ctx->apdu._internal.response_buffer.length = 0;
+            }
+            else if (callback(meta[i].command, NULL, 0, userdata) < 0)
+            {
+                goto err;
+            }
+        }
+
+        if (last != retry_index)
+        {
+            retry_index = last;
+            attempt = 0;
+        }
+        // The batch stopped at an APDU the card turned down without acting on it, the rest goes again from there
+        if (es10x_retry(ctx, &attempt, 0, 0, &response))
+        {
+            euicc_apdu_response_free(&response);
+            pos = last;
+            continue;
+        }
+
+        if (meta[last].command != acc_command)
+        {
+            acc_command = meta[last].command;
+            ctx->apdu._internal.response_buffer.length = 0;
+        }
+
+        if (es10x_response_iter(ctx, &response, iter_es10x_command, ctx, &sw) < 0)
+        {
+            if (extended && last == 0 && (sw >> 8) == 0x67)
+            {
+                *rejected = 1;
+            }
+            goto err;
+        }
+
+        if (meta[last].last)
+        {
+            if (callback(acc_command, ctx->apdu._internal.response_buffer.data, ctx->apdu._internal.response_buffer.length, userdata) < 0)
+            {
+                goto err;
+            }
+            acc_command = count;
+            ctx->apdu._internal.response_buffer.length = 0;
+        }
+
+        pos = last + 1;
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    euicc_free(ctx, tx);
+    euicc_free(ctx, tx_len);
+    euicc_free(ctx, meta);
+    return fret;
+}
+
+int es10x_command_batch(struct euicc_ctx *ctx, const uint8_t *const *der_reqs, const unsigned *req_lens, unsigned count, int (*callback)(unsigned index, const uint8_t *resp, unsigned resp_len, void *userdata), void *userdata)
+{
+    int ret, extended, rejected;
+    unsigned segment_size;
+    struct es10x_iovec iov;
+    uint32_t apdus, tx_len;
+    uint64_t start;
+
+    es10x_boundary(ctx);
+    if (es10x_refresh(ctx) < 0)
+    {
+        return -1;
+    }
+
+    euicc_response_cache_clear(ctx);
+
+    if (!ctx->apdu.interface->transmit_batch)
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            uint8_t *resp;
+            unsigned resp_len;
+
+            if (es10x_command(ctx, &resp, &resp_len, der_reqs[i], req_lens[i]) < 0)
+            {
+                return -1;
+            }
+            if (callback(i, resp, resp_len, userdata) < 0)
+            {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    if (es10x_transaction_begin(ctx) < 0)
+    {
+        return -1;
+    }
+
+    apdus = ctx->apdu.stats.apdus;
+    start = euicc_now_us();
+
+    segment_size = es10x_segment_size(ctx, &extended);
+
+    ret = es10x_command_batch_segmented(ctx, segment_size, extended, der_reqs, req_lens, count, callback, userdata, &rejected);
+    if (ret < 0 && rejected)
+    {
+        ctx->apdu._internal.extended_length_rejected = 1;
+        ret = es10x_command_batch_segmented(ctx, ES10X_SEGMENT_SIZE_DEFAULT, 0, der_reqs, req_lens, count, callback, userdata, &rejected);
+    }
+
+    // A batch is accounted to the tag of its first command
+    iov.base = count ? der_reqs[0] : NULL;
+    iov.len = count ? req_lens[0] : 0;
+    tx_len = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        tx_len += req_lens[i];
+    }
+    es10x_stats_command(ctx, es10x_stats_tag(&iov, 1), tx_len, count, apdus, start, ret);
+
+    es10x_transaction_end(ctx);
+
+    return ret;
+}
+
+static void euicc_trace_call(struct euicc_ctx *ctx, const char *name, uint64_t start, int ret)
+{
+    struct euicc_trace_span span = {
+        .category = EUICC_TRACE_APDU,
+        .name = name,
+        .ret = ret,
+    };
+
+    if (ctx->trace)
+    {
+        euicc_trace(ctx, &span, start);
+    }
+}
+
+int euicc_connect(struct euicc_ctx *ctx)
+{
+    int ret;
+    uint64_t start;
+
+    if (getenv("LIBEUICC_DEBUG_APDU"))
+    {
+        ctx->debug |= EUICC_DEBUG_APDU;
+    }
+    if (getenv("LIBEUICC_DEBUG_HTTP"))
+    {
+        ctx->debug |= EUICC_DEBUG_HTTP;
+    }
+#ifdef EUICC_STATIC_POOL_SIZE
+    // Hooks cJSON before the first ES9+ response is parsed
+    euicc_static_pool();
+#endif
+
+    start = euicc_now_us();
+    ret = ctx->apdu.interface->connect(ctx);
+    euicc_trace_call(ctx, "connect", start, ret);
+    if (ret < 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Tries the AIDs in order, starting from first and wrapping around
+static int euicc_open_isd_r_from(struct euicc_ctx *ctx, uint32_t first)
+{
+    int ret = -1;
+    uint32_t aid_count;
+    uint64_t start;
+
+    aid_count = ctx->apdu.isd_r_aids ? ctx->apdu.isd_r_aid_count : 1;
+    if (first >= aid_count)
+    {
+        first = 0;
+    }
+
+    if (es10x_transaction_begin(ctx) < 0)
+    {
+        return -1;
+    }
+    for (uint32_t n = 0; n < aid_count; n++)
+    {
+        uint32_t i = (first + n) % aid_count;
+        const uint8_t *aid = (const uint8_t *)ISD_R_AID;
+        uint8_t aid_len = sizeof(ISD_R_AID) - 1;
+
+        if (ctx->apdu.isd_r_aids)
+        {
+            aid = ctx->apdu.isd_r_aids[i].aid;
+            aid_len = ctx->apdu.isd_r_aids[i].length;
+        }
+
+        start = euicc_now_us();
+        ret = ctx->apdu.interface->logic_channel_open(ctx, aid, aid_len);
+        euicc_trace_call(ctx, "logic_channel_open", start, ret);
+        if (ret >= 0)
+        {
+            ctx->apdu.isd_r_aid_index = i;
+            break;
+        }
+    }
+    es10x_transaction_end(ctx);
+    if (ret < 0)
+    {
+        return -1;
+    }
+
+    ctx->apdu._internal.logic_channel = ret;
+
+    return 0;
+}
+
+int euicc_open_isd_r(struct euicc_ctx *ctx)
+{
+    return euicc_open_isd_r_from(ctx, 0);
+}
+
+int euicc_init(struct euicc_ctx *ctx)
+{
+    if (euicc_connect(ctx) < 0)
+    {
+        return -1;
+    }
+
+    return euicc_open_isd_r(ctx);
+}
+
+int euicc_reconnect(struct euicc_ctx *ctx)
+{
+    int ret;
+    uint64_t start;
+
+    ctx->apdu._internal.refresh_pending = 0;
+    ctx->apdu._internal.logic_channel = 0;
+    euicc_response_cache_clear(ctx);
+
+    start = euicc_now_us();
+    if (ctx->apdu.interface->reconnect)
+    {
+        ret = ctx->apdu.interface->reconnect(ctx);
+        euicc_trace_call(ctx, "reconnect", start, ret);
+    }
+    else
+    {
+        ctx->apdu.interface->disconnect(ctx);
+        euicc_trace_call(ctx, "disconnect", start, 0);
+        start = euicc_now_us();
+        ret = ctx->apdu.interface->connect(ctx);
+        euicc_trace_call(ctx, "connect", start, ret);
+    }
+    if (ret < 0)
+    {
+        return -1;
+    }
+
+    // The card is the same, so is the AID its ISD-R opens by
+    return euicc_open_isd_r_from(ctx, ctx->apdu.isd_r_aid_index);
+}
+
+void euicc_fini(struct euicc_ctx *ctx)
+{
+    uint64_t start;
+
+    euicc_response_cache_clear(ctx);
+
+    // A card reset after a REFRESH took the channel with it
+    if (!ctx->apdu._internal.refresh_pending && es10x_transaction_begin(ctx) == 0)
+    {
+        start = euicc_now_us();
+        ctx->apdu.interface->logic_channel_close(ctx, ctx->apdu._internal.logic_channel);
+        euicc_trace_call(ctx, "logic_channel_close", start, 0);
+        es10x_transaction_end(ctx);
+    }
+    start = euicc_now_us();
+    ctx->apdu.interface->disconnect(ctx);
+    euicc_trace_call(ctx, "disconnect", start, 0);
+    ctx->apdu._internal.logic_channel = 0;
+    ctx->apdu._internal.refresh_pending = 0;
+    ctx->apdu._internal.extended_length_rejected = 0;
+    euicc_free(ctx, ctx->apdu._internal.extended_request_buffer);
+    ctx->apdu._internal.extended_request_buffer = NULL;
+    ctx->apdu._internal.extended_request_buffer_len = 0;
+    euicc_free(ctx, ctx->apdu._internal.rx_buffer);
+    ctx->apdu._internal.rx_buffer = NULL;
+    ctx->apdu._internal.rx_buffer_len = 0;
+    euicc_free(ctx, ctx->apdu._internal.batch_buffer);
+    ctx->apdu._internal.batch_buffer = NULL;
+    ctx->apdu._internal.batch_buffer_len = 0;
+    euicc_free(ctx, ctx->apdu._internal.response_buffer.data);
+    memset(&ctx->apdu._internal.response_buffer, 0, sizeof(ctx->apdu._internal.response_buffer));
+}
+
+void euicc_apdu_stats_reset(struct euicc_ctx *ctx)
+{
+    memset(&ctx->apdu.stats, 0, sizeof(ctx->apdu.stats));
+}
+
+void euicc_blob_free(struct euicc_blob *blob)
+{
+    free(blob->data);
+    blob->data = NULL;
+    blob->length = 0;
+}
+
+void euicc_http_cleanup(struct euicc_ctx *ctx)
+{
+    if (ctx->http.interface && ctx->http.interface->session_close)
+    {
+        ctx->http.interface->session_close(ctx);
+    }
+
     free(ctx->http._internal.transaction_id_http);
     free(ctx->http._internal.transaction_id_bin);
-    free(ctx->http._internal.b64_euicc_challenge);
-    free(ctx->http._internal.b64_euicc_info_1);
+    euicc_blob_free(&ctx->http._internal.euicc_challenge);
+    euicc_blob_free(&ctx->http._internal.euicc_info_1);
     es10b_authenticate_server_param_free(ctx->http._internal.authenticate_server_param);
     free(ctx->http._internal.authenticate_server_param);
-    free(ctx->http._internal.b64_authenticate_server_response);
+    euicc_blob_free(&ctx->http._internal.authenticate_server_response);
     es10b_prepare_download_param_free(ctx->http._internal.prepare_download_param);
     free(ctx->http._internal.prepare_download_param);
-    free(ctx->http._internal.b64_prepare_download_response);
-    free(ctx->http._internal.b64_bound_profile_package);
-    free(ctx->http._internal.b64_cancel_session_response);
+    euicc_blob_free(&ctx->http._internal.prepare_download_response);
+    euicc_blob_free(&ctx->http._internal.bound_profile_package);
+    euicc_blob_free(&ctx->http._internal.cancel_session_response);
+    euicc_free(ctx, ctx->http._internal.request_buffer.data);
     memset(&ctx->http._internal, 0, sizeof(ctx->http._internal));
+    memset(&ctx->http.timing, 0, sizeof(ctx->http.timing));
 }
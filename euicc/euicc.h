@@ -1,17 +1,212 @@
 #pragma once
 
 #include <inttypes.h>
+#include <stddef.h>
 #include "interface.h"
+
+// Binary data owned by whoever holds it, free data with free()
+struct euicc_blob
+{
+    uint8_t *data;
+    uint32_t length;
+};
+
 #include "es10b.h"
 
+#define EUICC_APDU_STATS_SW_MAX 16
+#define EUICC_APDU_STATS_COMMAND_MAX 32
+#define EUICC_RESPONSE_CACHE_MAX 8
+
+// Flags of euicc_ctx.debug
+#define EUICC_DEBUG_APDU (1 << 0)
+#define EUICC_DEBUG_HTTP (1 << 1)
+
+// Counters for every APDU sent through the context, never cleared by the library itself
+struct euicc_apdu_stats
+{
+    uint32_t apdus;
+    uint32_t get_responses;
+    // ES10x commands answered from the response cache, without an APDU
+    uint32_t cache_hits;
+    // Commands sent again under ctx->apdu.retry_max, by cause: no answer from the transport, 93xx busy, 6Fxx, and
+    // GET RESPONSE repeated with the Le of a 6Cxx
+    struct
+    {
+        uint32_t transport;
+        uint32_t busy;
+        uint32_t technical;
+        uint32_t wrong_le;
+    } retries;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    struct
+    {
+        uint16_t sw;
+        uint32_t count;
+    } sw[EUICC_APDU_STATS_SW_MAX];
+    uint32_t sw_count;
+    // Keyed by the tag of the ES10x request, segments and GET RESPONSE included
+    struct
+    {
+        uint16_t tag;
+        uint32_t calls;
+        uint32_t apdus;
+        uint64_t time_us;
+    } commands[EUICC_APDU_STATS_COMMAND_MAX];
+    uint32_t command_count;
+};
+
+// Filled in by HTTP drivers able to measure it, summed over requests until the caller clears it.
+// Phase times are counted from the start of each request, as libcurl reports them.
+struct euicc_http_timing
+{
+    uint32_t requests;
+    uint64_t namelookup_us;
+    uint64_t connect_us;
+    uint64_t appconnect_us;
+    uint64_t starttransfer_us;
+    uint64_t total_us;
+    uint64_t bytes_sent;
+    // Response bodies as they came over the wire, and after undoing their Content-Encoding
+    uint64_t bytes_received;
+    uint64_t bytes_decoded;
+};
+
+enum euicc_trace_category
+{
+    EUICC_TRACE_ES10X,
+    EUICC_TRACE_APDU,
+    EUICC_TRACE_HTTP,
+};
+
+// One finished operation, as handed to euicc_ctx.trace
+struct euicc_trace_span
+{
+    enum euicc_trace_category category;
+    // APDU: the command or driver call, HTTP: the URL, ES10X: NULL
+    const char *name;
+    // ES10X: tag of the request
+    uint16_t tag;
+    // On the euicc_now_us() clock
+    uint64_t start_us;
+    uint64_t duration_us;
+    // ES10X: length of the request, APDU and HTTP: bytes sent
+    uint32_t tx_len;
+    uint32_t rx_len;
+    // APDU: status word of the last response, HTTP: response code
+    uint32_t status;
+    // APDUs sent by the operation
+    uint32_t count;
+    int ret;
+};
+
+enum euicc_progress_phase
+{
+    EUICC_PROGRESS_DOWNLOAD, // The BoundProfilePackage arriving from the SM-DP+, counted after base64 decoding
+    EUICC_PROGRESS_LOAD,     // The BoundProfilePackage sent to the eUICC
+};
+
+// Where a BoundProfilePackage download or load stands, as handed to euicc_ctx.progress
+struct euicc_progress
+{
+    enum euicc_progress_phase phase;
+    // Bytes of the BoundProfilePackage done, out of total, which stays 0 until its header has been seen
+    uint32_t done;
+    uint32_t total;
+    // LOAD: tag of the part being sent (0xBF23, 0xA0 to 0xA3) and, within sequenceOf88 or sequenceOf86, the element
+    uint16_t tag;
+    uint32_t index;
+    // APDUs sent and time taken since the phase began
+    uint32_t apdus;
+    uint64_t elapsed_us;
+    // Set on the last call of the phase, whether it completed or not
+    uint8_t finished;
+};
+
+// The state behind one phase, kept in the context
+struct euicc_progress_meter
+{
+    struct euicc_progress progress;
+    uint64_t start_us;
+    uint64_t last_us;
+    uint32_t apdus_start;
+    uint8_t active;
+};
+
+// An application identifier, as listed in euicc_ctx.apdu.isd_r_aids
+struct euicc_aid
+{
+    uint8_t aid[16];
+    uint8_t length;
+};
+
+// Memory for the buffers a context keeps between calls and the scratch space of its calls: APDU and response buffers,
+// the response cache, ES10x and ES9+ batches, ES9+ request building and the download session. NULL returns fail the
+// call like a failed malloc. Decoded lists and tables (profile and notification lists and arrays, the RAT, EUICCInfo2)
+// come from it too and keep a pointer to it, their *_free functions give the memory back, so the allocator must
+// outlive them.
+// Not covered, and still from malloc: strings and blobs handed to the caller (EID, addresses, transaction IDs,
+// pending notifications, SM-DS lists, BPP blobs), HTTP bodies from the driver and the decoders' parse buffers. A cap
+// set here bounds what the context holds, not all the heap libeuicc uses.
+// cJSON has no per-context hooks. For its objects to go through the same memory, the host calls cJSON_InitHooks
+// itself, once for the process; libeuicc does not, except in a static pool build.
+struct euicc_allocator
+{
+    void *(*malloc)(void *userdata, size_t size);
+    void *(*realloc)(void *userdata, void *ptr, size_t size);
+    void (*free)(void *userdata, void *ptr);
+    void *userdata;
+};
+
+// libeuicc keeps no global state: a context is used by one thread at a time, and separate contexts may run on
+// separate threads at once, as long as their drivers allow it
 struct euicc_ctx
 {
     struct
     {
         const struct euicc_apdu_interface *interface;
+        uint32_t segment_size;
+        // Optional. Longest wait in milliseconds for one APDU, for drivers that can time out, 0 for the driver default
+        uint32_t timeout_ms;
+        // Optional. How often one STORE DATA segment is sent again after a transient failure, 0 for never: the
+        // transport gave no answer, or the card answered 93xx or 6Fxx without data. Waits start at 20 ms and double.
+        // The same limit applies to GET RESPONSE repeated with the Le a 6Cxx asks for.
+        uint8_t retry_max;
+        // Optional. ISD-R AIDs tried in order until one opens a logical channel, NULL for the GSMA one only.
+        // Keep until euicc_fini.
+        const struct euicc_aid *isd_r_aids;
+        uint32_t isd_r_aid_count;
+        // Set once the ISD-R is open: index of its AID in isd_r_aids, 0 without a list
+        uint32_t isd_r_aid_index;
+        struct euicc_apdu_stats stats;
         struct
         {
             int logic_channel;
+            // An enable or disable with refreshFlag succeeded, the card resets and the next command reconnects first
+            uint8_t refresh_pending;
+            uint8_t extended_length_rejected;
+            uint8_t *extended_request_buffer;
+            uint32_t extended_request_buffer_len;
+            uint8_t *rx_buffer;
+            uint32_t rx_buffer_len;
+            uint8_t *batch_buffer;
+            uint32_t batch_buffer_len;
+            struct euicc_progress_meter progress;
+            struct
+            {
+                uint8_t *data;
+                uint32_t length;
+                uint32_t capacity;
+            } response_buffer;
+            // Responses of the read-only ES10x requests with a fixed answer, see euicc_response_cache_clear
+            struct
+            {
+                uint8_t *request;
+                uint32_t request_len;
+                uint8_t *response;
+                uint32_t response_len;
+            } response_cache[EUICC_RESPONSE_CACHE_MAX];
+            uint32_t response_cache_count;
             struct
             {
                 uint8_t apdu_header[5];
@@ -23,6 +218,29 @@ struct euicc_ctx
     {
         const struct euicc_http_interface *interface;
         const char *server_address;
+        // Optional. Longest time in milliseconds one HTTP request may take, for drivers that can time out, 0 for none
+        uint32_t timeout_ms;
+        // Optional. Set to ask for uncompressed responses, drivers able to decompress them offer gzip and deflate otherwise
+        uint8_t no_compression;
+        // Optional. Largest BoundProfilePackage es9p_get_and_load_bound_profile_package loads, 0 for no limit
+        uint32_t bpp_max_length;
+        // Optional. Bytes es9p_get_and_load_bound_profile_package may hold of the BoundProfilePackage at once: the decode
+        // window, the rest of the response and the largest element that is sent whole. 0 for no limit, a nonzero
+        // value needs a driver with transmit_stream. The context's APDU buffers are not counted.
+        uint32_t bpp_memory_max;
+        // Most bytes of it held at once by the last es9p_get_and_load_bound_profile_package, 0 without transmit_stream
+        uint32_t bpp_memory_peak;
+        // Optional. How often an ES9+ request is sent again after a transport failure or an HTTP 408, 429 or 5xx
+        // status, 0 for never. The wait starts at retry_delay_ms (0 for 500) and doubles up to retry_delay_max_ms
+        // (0 for 30000), each one cut by up to half at random. A longer Retry-After is waited out instead, one beyond
+        // retry_delay_max_ms or ctx->deadline_us ends the retries. A streamed BoundProfilePackage is only requested
+        // again while none of it reached the eUICC.
+        uint8_t retry_max;
+        uint32_t retry_delay_ms;
+        uint32_t retry_delay_max_ms;
+        // For drivers: the Retry-After of the last response in milliseconds, 0 without one
+        uint32_t retry_after_ms;
+        struct euicc_http_timing timing;
         struct
         {
             char subjectCode[8 + 1];
@@ -35,19 +253,74 @@ struct euicc_ctx
             char *transaction_id_http;
             uint8_t *transaction_id_bin;
             uint32_t transaction_id_bin_len;
-            char *b64_euicc_challenge;
-            char *b64_euicc_info_1;
+            // Kept as binary, base64 only on the way in or out of the ES9+ JSON
+            struct euicc_blob euicc_challenge;
+            struct euicc_blob euicc_info_1;
             struct es10b_authenticate_server_param *authenticate_server_param;
-            char *b64_authenticate_server_response;
+            struct euicc_blob authenticate_server_response;
             struct es10b_prepare_download_param *prepare_download_param;
-            char *b64_prepare_download_response;
-            char *b64_bound_profile_package;
-            char *b64_cancel_session_response;
+            struct euicc_blob prepare_download_response;
+            struct euicc_blob bound_profile_package;
+            struct euicc_blob cancel_session_response;
+            struct
+            {
+                char *data;
+                uint32_t length;
+                uint32_t capacity;
+            } request_buffer;
+            struct euicc_progress_meter progress;
         } _internal;
     } http;
+    // Optional. Once euicc_now_us() reaches deadline_us, or cancel returns nonzero, every APDU and HTTP request fails
+    // before it is sent, see euicc_aborted. Drivers also cut their own timeouts to the time left.
+    uint64_t deadline_us;
+    int (*cancel)(struct euicc_ctx *ctx);
+    // Optional. Called before every ES10x command, when the card is between commands and the response of the last one
+    // is no longer needed. It may send ES10x commands of its own, which call it again.
+    void (*boundary)(struct euicc_ctx *ctx);
+    // Optional. Called with end 0 when a top level operation starts and with end 1 when it returns, name being the
+    // function it is named after, e.g. es10c_get_profiles_info or es9p_authenticate_client. Operations may nest.
+    void (*operation)(struct euicc_ctx *ctx, const char *name, int end);
+    // Optional. Called after every ES10x command, APDU driver call and HTTP request
+    void (*trace)(struct euicc_ctx *ctx, const struct euicc_trace_span *span);
+    // Optional. Called while a BoundProfilePackage is downloaded and loaded, at most every progress_interval_ms (0 for
+    // 1000) and once more when each phase ends
+    void (*progress)(struct euicc_ctx *ctx, const struct euicc_progress *progress);
+    uint32_t progress_interval_ms;
+    // EUICC_DEBUG_* flags, euicc_init adds EUICC_DEBUG_APDU when LIBEUICC_DEBUG_APDU is set and EUICC_DEBUG_HTTP
+    // when LIBEUICC_DEBUG_HTTP is, the environment is not read after that
+    uint32_t debug;
+    // Optional. Receives every debug line, without the newline. The lines go to stderr without it.
+    void (*log)(struct euicc_ctx *ctx, enum euicc_trace_category category, const char *line);
+    // Optional. Set before euicc_init and keep until euicc_fini, libc is used without it
+    const struct euicc_allocator *allocator;
     void *userdata;
 };
 
+// euicc_connect followed by euicc_open_isd_r
 int euicc_init(struct euicc_ctx *ctx);
+// The two halves of euicc_init, for callers that choose ctx->apdu.isd_r_aids once the driver is connected.
+// A failed euicc_open_isd_r leaves the driver connected, euicc_fini disconnects it.
+int euicc_connect(struct euicc_ctx *ctx);
+int euicc_open_isd_r(struct euicc_ctx *ctx);
+// Connects again once the card was reset, through the driver's reconnect when it has one, and opens the ISD-R on the
+// AID that opened last. The next ES10x command does it by itself after an enable or disable with refreshFlag.
+int euicc_reconnect(struct euicc_ctx *ctx);
 void euicc_fini(struct euicc_ctx *ctx);
 void euicc_http_cleanup(struct euicc_ctx *ctx);
+void euicc_blob_free(struct euicc_blob *blob);
+void euicc_apdu_stats_reset(struct euicc_ctx *ctx);
+// GetEID, EUICCInfo1/2, configured addresses and RAT are answered from memory after their first read, until a
+// command that may change the card is sent or the context is finalized. Call this when the card may have changed otherwise.
+void euicc_response_cache_clear(struct euicc_ctx *ctx);
+// Sends der_req to the ISD-R as it is and points *resp at the response, valid until the next ES10x command. Never
+// answered from the response cache. For tools that measure the card or its transport with requests of their own.
+int euicc_es10x_transceive(struct euicc_ctx *ctx, const uint8_t *der_req, uint32_t req_len, const uint8_t **resp, uint32_t *resp_len);
+// Monotonic clock in microseconds
+uint64_t euicc_now_us(void);
+// Sets ctx->deadline_us timeout_ms from now, 0 clears it
+void euicc_deadline_set(struct euicc_ctx *ctx, uint32_t timeout_ms);
+// Nonzero once ctx->deadline_us has passed or ctx->cancel asks to stop
+int euicc_aborted(struct euicc_ctx *ctx);
+// For drivers: timeout_ms cut to the time left before ctx->deadline_us, at least 1. 0 stands for no limit both ways.
+uint32_t euicc_timeout_ms(struct euicc_ctx *ctx, uint32_t timeout_ms);
@@ -2,6 +2,66 @@
 
 #include "euicc.h"
 #include "interface.private.h"
+#include "derutil.h"
+
+struct es10x_iovec
+{
+    const uint8_t *base;
+    unsigned len;
+};
+
+// Reports span to ctx->trace, timed from start (from euicc_now_us)
+void euicc_trace(struct euicc_ctx *ctx, struct euicc_trace_span *span, uint64_t start);
+// Sleeps ms, -1 as soon as euicc_aborted
+int euicc_wait_ms(struct euicc_ctx *ctx, uint32_t ms);
+// Hands one debug line to ctx->log, or stderr
+void euicc_log(struct euicc_ctx *ctx, enum euicc_trace_category category, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+// Starts a phase for ctx->progress, which the updates are then reported to
+void euicc_progress_begin(struct euicc_ctx *ctx, struct euicc_progress_meter *meter, enum euicc_progress_phase phase, uint32_t total);
+// Adds done bytes, and reports them once progress_interval_ms has passed since the last report
+void euicc_progress_update(struct euicc_ctx *ctx, struct euicc_progress_meter *meter, uint32_t done);
+// Reports the phase a last time, does nothing unless it was begun
+void euicc_progress_end(struct euicc_ctx *ctx, struct euicc_progress_meter *meter);
+// Reports the start (end 0) or the return (end 1) of a top level operation to ctx->operation
+void euicc_operation(struct euicc_ctx *ctx, const char *name, int end);
+// allocator, or libc when it is NULL
+void *euicc_allocator_malloc(const struct euicc_allocator *allocator, size_t size);
+void *euicc_allocator_realloc(const struct euicc_allocator *allocator, void *ptr, size_t size);
+void euicc_allocator_free(const struct euicc_allocator *allocator, void *ptr);
+// ctx->allocator, or libc without one
+void *euicc_malloc(struct euicc_ctx *ctx, size_t size);
+void *euicc_realloc(struct euicc_ctx *ctx, void *ptr, size_t size);
+void euicc_free(struct euicc_ctx *ctx, void *ptr);
+
+#define ES10X_TEMPLATE_SLOTS_MAX 2
+
+// Requests that are constant or differ only in fixed-size fields, encoded at compile time
+enum es10x_template_id
+{
+    ES10X_TEMPLATE_GET_EID,
+    ES10X_TEMPLATE_EUICC_INFO1,
+    ES10X_TEMPLATE_EUICC_INFO2,
+    ES10X_TEMPLATE_EUICC_CHALLENGE,
+    ES10X_TEMPLATE_CONFIGURED_ADDRESSES,
+    ES10X_TEMPLATE_GET_RAT,
+    ES10X_TEMPLATE_MEMORY_RESET,
+    ES10X_TEMPLATE_PROFILE_INFO_LIST,
+    ES10X_TEMPLATE_LIST_NOTIFICATION,
+    // slot0: profileManagementOperation, unused bits and the bit string
+    ES10X_TEMPLATE_LIST_NOTIFICATION_OPERATION,
+    ES10X_TEMPLATE_RETRIEVE_NOTIFICATIONS_LIST,
+    // slot0: the 10 byte ICCID, slot1: refreshFlag
+    ES10X_TEMPLATE_ENABLE_ICCID,
+    ES10X_TEMPLATE_DISABLE_ICCID,
+    // slot0: the 10 byte ICCID
+    ES10X_TEMPLATE_DELETE_ICCID,
+};
+
+// Copies the template into request_buffer.body and patches the slots it has, returns the request length
+unsigned es10x_template_emit(struct euicc_ctx *ctx, enum es10x_template_id id, const uint8_t *slot0, const uint8_t *slot1);
 
 int es10x_command_iter(struct euicc_ctx *ctx, const uint8_t *der_req, unsigned req_len, int (*callback)(struct apdu_response *response, void *userdata), void *userdata);
 int es10x_command(struct euicc_ctx *ctx, uint8_t **resp, unsigned *resp_len, const uint8_t *der_req, unsigned req_len);
+int es10x_command_gather(struct euicc_ctx *ctx, uint8_t **resp, unsigned *resp_len, const struct es10x_iovec *iov, unsigned iov_count);
+int es10x_command_stream(struct euicc_ctx *ctx, const uint8_t *der_req, unsigned req_len, struct euicc_derutil_stream *stream);
+int es10x_command_batch(struct euicc_ctx *ctx, const uint8_t *const *der_reqs, const unsigned *req_lens, unsigned count, int (*callback)(unsigned index, const uint8_t *resp, unsigned resp_len, void *userdata), void *userdata);
@@ -4,9 +4,136 @@
 #include <stdlib.h>
 #include <string.h>
 
-int euicc_hexutil_bin2hex(char *output, uint32_t output_len, const uint8_t *bin, uint32_t bin_len)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EUICC_HEXUTIL_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define EUICC_HEXUTIL_NEON
+#include <arm_neon.h>
+#endif
+
+static const char hexutil_digits_lower[] = "0123456789abcdef";
+static const char hexutil_digits_upper[] = "0123456789ABCDEF";
+
+// Nibble value plus one, 0 marks a character that is not a hex digit
+static const uint8_t hexutil_nibbles[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+#ifdef EUICC_HEXUTIL_X86
+// 16 bytes to 32 characters per block
+__attribute__((target("ssse3"))) static uint32_t hexutil_bin2hex_ssse3(char *output, const uint8_t *bin, uint32_t bin_len, const char *digits)
 {
-    const char hexDigits[] = "0123456789abcdef";
+    const __m128i lut = _mm_loadu_si128((const __m128i *)digits);
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    uint32_t i;
+
+    for (i = 0; i + 16 <= bin_len; i += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)(bin + i));
+        __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(in, 4), mask));
+        __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(in, mask));
+
+        _mm_storeu_si128((__m128i *)(output + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(output + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+
+    return i;
+}
+
+__attribute__((target("ssse3"))) static __m128i hexutil_hex2nibbles_ssse3(__m128i str, __m128i *valid)
+{
+    __m128i digit = _mm_sub_epi8(str, _mm_set1_epi8('0'));
+    __m128i alpha = _mm_sub_epi8(_mm_or_si128(str, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+
+    *valid = _mm_and_si128(*valid, _mm_or_si128(is_digit, is_alpha));
+    return _mm_or_si128(_mm_and_si128(is_digit, digit), _mm_and_si128(is_alpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+}
+
+// 32 characters to 16 bytes per block, stops before the first block holding a non-hex character
+__attribute__((target("ssse3"))) static uint32_t hexutil_hex2bin_ssse3(uint8_t *output, const char *str, uint32_t length)
+{
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    uint32_t i;
+
+    for (i = 0; i + 16 <= length; i += 16)
+    {
+        __m128i valid = _mm_set1_epi8(-1);
+        __m128i a = hexutil_hex2nibbles_ssse3(_mm_loadu_si128((const __m128i *)(str + 2 * i)), &valid);
+        __m128i b = hexutil_hex2nibbles_ssse3(_mm_loadu_si128((const __m128i *)(str + 2 * i + 16)), &valid);
+
+        if (_mm_movemask_epi8(valid) != 0xFFFF)
+        {
+            break;
+        }
+
+        _mm_storeu_si128((__m128i *)(output + i), _mm_packus_epi16(_mm_maddubs_epi16(a, weights), _mm_maddubs_epi16(b, weights)));
+    }
+
+    return i;
+}
+#endif
+
+#ifdef EUICC_HEXUTIL_NEON
+static uint32_t hexutil_bin2hex_neon(char *output, const uint8_t *bin, uint32_t bin_len, const char *digits)
+{
+    const uint8x16_t lut = vld1q_u8((const uint8_t *)digits);
+    uint32_t i;
+
+    for (i = 0; i + 16 <= bin_len; i += 16)
+    {
+        uint8x16_t in = vld1q_u8(bin + i);
+        uint8x16x2_t out;
+
+        out.val[0] = vqtbl1q_u8(lut, vshrq_n_u8(in, 4));
+        out.val[1] = vqtbl1q_u8(lut, vandq_u8(in, vdupq_n_u8(0x0F)));
+        vst2q_u8((uint8_t *)output + 2 * i, out);
+    }
+
+    return i;
+}
+
+static uint8x16_t hexutil_hex2nibbles_neon(uint8x16_t str, uint8x16_t *valid)
+{
+    uint8x16_t digit = vsubq_u8(str, vdupq_n_u8('0'));
+    uint8x16_t alpha = vsubq_u8(vorrq_u8(str, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+    uint8x16_t is_digit = vcleq_u8(digit, vdupq_n_u8(9));
+    uint8x16_t is_alpha = vcleq_u8(alpha, vdupq_n_u8(5));
+
+    *valid = vandq_u8(*valid, vorrq_u8(is_digit, is_alpha));
+    return vorrq_u8(vandq_u8(is_digit, digit), vandq_u8(is_alpha, vaddq_u8(alpha, vdupq_n_u8(10))));
+}
+
+static uint32_t hexutil_hex2bin_neon(uint8_t *output, const char *str, uint32_t length)
+{
+    uint32_t i;
+
+    for (i = 0; i + 16 <= length; i += 16)
+    {
+        uint8x16x2_t in = vld2q_u8((const uint8_t *)str + 2 * i);
+        uint8x16_t valid = vdupq_n_u8(0xFF);
+        uint8x16_t hi = hexutil_hex2nibbles_neon(in.val[0], &valid);
+        uint8x16_t lo = hexutil_hex2nibbles_neon(in.val[1], &valid);
+
+        if (vminvq_u8(valid) != 0xFF)
+        {
+            break;
+        }
+
+        vst1q_u8(output + i, vorrq_u8(vshlq_n_u8(hi, 4), lo));
+    }
+
+    return i;
+}
+#endif
+
+static int hexutil_bin2hex(char *output, uint32_t output_len, const uint8_t *bin, uint32_t bin_len, const char *digits)
+{
+    uint32_t i = 0;
 
     if (!bin || !output)
     {
@@ -18,17 +145,35 @@ int euicc_hexutil_bin2hex(char *output, uint32_t output_len, const uint8_t *bin,
         return -1;
     }
 
-    for (uint32_t i = 0; i < bin_len; ++i)
+#if defined(EUICC_HEXUTIL_X86)
+    if (__builtin_cpu_supports("ssse3"))
     {
-        char byte = bin[i];
-        output[2 * i] = hexDigits[(byte >> 4) & 0x0F];
-        output[2 * i + 1] = hexDigits[byte & 0x0F];
+        i = hexutil_bin2hex_ssse3(output, bin, bin_len, digits);
+    }
+#elif defined(EUICC_HEXUTIL_NEON)
+    i = hexutil_bin2hex_neon(output, bin, bin_len, digits);
+#endif
+
+    for (; i < bin_len; ++i)
+    {
+        output[2 * i] = digits[bin[i] >> 4];
+        output[2 * i + 1] = digits[bin[i] & 0x0F];
     }
     output[2 * bin_len] = '\0';
 
     return 0;
 }
 
+int euicc_hexutil_bin2hex(char *output, uint32_t output_len, const uint8_t *bin, uint32_t bin_len)
+{
+    return hexutil_bin2hex(output, output_len, bin, bin_len, hexutil_digits_lower);
+}
+
+int euicc_hexutil_bin2hex_upper(char *output, uint32_t output_len, const uint8_t *bin, uint32_t bin_len)
+{
+    return hexutil_bin2hex(output, output_len, bin, bin_len, hexutil_digits_upper);
+}
+
 int euicc_hexutil_hex2bin(uint8_t *output, uint32_t output_len, const char *str)
 {
     return euicc_hexutil_hex2bin_r(output, output_len, str, strlen(str));
@@ -37,6 +182,7 @@ int euicc_hexutil_hex2bin(uint8_t *output, uint32_t output_len, const char *str)
 int euicc_hexutil_hex2bin_r(uint8_t *output, uint32_t output_len, const char *str, uint32_t str_len)
 {
     uint32_t length;
+    uint32_t i = 0;
 
     if (!str || !output || str_len % 2 != 0)
     {
@@ -49,46 +195,27 @@ int euicc_hexutil_hex2bin_r(uint8_t *output, uint32_t output_len, const char *st
         return -1;
     }
 
-    for (uint32_t i = 0; i < length; ++i)
+#if defined(EUICC_HEXUTIL_X86)
+    if (__builtin_cpu_supports("ssse3"))
     {
-        char high = str[2 * i];
-        char low = str[2 * i + 1];
+        i = hexutil_hex2bin_ssse3(output, str, length);
+    }
+#elif defined(EUICC_HEXUTIL_NEON)
+    i = hexutil_hex2bin_neon(output, str, length);
+#endif
 
-        if (high >= '0' && high <= '9')
-        {
-            high -= '0';
-        }
-        else if (high >= 'a' && high <= 'f')
-        {
-            high = high - 'a' + 10;
-        }
-        else if (high >= 'A' && high <= 'F')
-        {
-            high = high - 'A' + 10;
-        }
-        else
-        {
-            return -1;
-        }
+    // Also picks up the block the vector loop stopped at and reports its bad character
+    for (; i < length; ++i)
+    {
+        uint8_t high = hexutil_nibbles[(uint8_t)str[2 * i]];
+        uint8_t low = hexutil_nibbles[(uint8_t)str[2 * i + 1]];
 
-        if (low >= '0' && low <= '9')
-        {
-            low -= '0';
-        }
-        else if (low >= 'a' && low <= 'f')
-        {
-            low = low - 'a' + 10;
-        }
-        else if (low >= 'A' && low <= 'F')
-        {
-            low = low - 'A' + 10;
-        }
-        else
+        if (!high || !low)
         {
             return -1;
         }
 
-        output[i] = (high << 4) + low;
+        output[i] = ((high - 1) << 4) | (low - 1);
     }
 
     return length;
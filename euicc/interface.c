@@ -1,8 +1,10 @@
 #include "interface.private.h"
+#include "euicc.private.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include "pool.private.h"
 
 static int lc(struct apdu_request *apdu, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t datalen)
 {
@@ -32,42 +34,214 @@ int euicc_apdu_lc(struct euicc_ctx *ctx, struct apdu_request **apdu, uint8_t cla
     return lc(*apdu, cla, ins, p1, p2, datalen);
 }
 
+int euicc_apdu_lc_extended(struct euicc_ctx *ctx, struct apdu_request_extended **apdu, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint16_t datalen)
+{
+    uint32_t request_len;
+
+    request_len = datalen + sizeof(struct apdu_request_extended);
+    if (ctx->apdu._internal.extended_request_buffer_len < request_len)
+    {
+        uint8_t *new_buffer;
+
+        new_buffer = euicc_realloc(ctx, ctx->apdu._internal.extended_request_buffer, request_len);
+        if (!new_buffer)
+        {
+            return -1;
+        }
+        ctx->apdu._internal.extended_request_buffer = new_buffer;
+        ctx->apdu._internal.extended_request_buffer_len = request_len;
+    }
+
+    *apdu = (struct apdu_request_extended *)ctx->apdu._internal.extended_request_buffer;
+    (*apdu)->cla = cla;
+    (*apdu)->ins = ins;
+    (*apdu)->p1 = p1;
+    (*apdu)->p2 = p2;
+    (*apdu)->length_marker = 0x00;
+    (*apdu)->length[0] = (datalen >> 8) & 0xFF;
+    (*apdu)->length[1] = datalen & 0xFF;
+
+    return request_len;
+}
+
 int euicc_apdu_le(struct euicc_ctx *ctx, struct apdu_request **apdu, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t requestlen)
 {
     *apdu = (struct apdu_request *)&ctx->apdu._internal.request_buffer;
     return le(*apdu, cla, ins, p1, p2, requestlen);
 }
 
-static void euicc_apdu_request_print(const struct apdu_request *req, uint32_t request_len)
+// "%02X " per byte, as the debug lines have always shown data
+static char *euicc_apdu_hex(struct euicc_ctx *ctx, const uint8_t *data, uint32_t data_len)
 {
-    fprintf(stderr, "[DEBUG] [APDU] [TX] CLA: %02X, INS: %02X, P1: %02X, P2: %02X, Lc: %02X, Data: ", req->cla, req->ins, req->p1, req->p2, req->length);
-    for (uint32_t i = 0; i < (request_len - sizeof(struct apdu_request)); i++)
-        fprintf(stderr, "%02X ", (req->data[i] & 0xFF));
-    fprintf(stderr, "\n");
+    static const char digits[] = "0123456789ABCDEF";
+    char *hex = euicc_malloc(ctx, data_len * 3 + 1);
+
+    if (hex == NULL)
+    {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < data_len; i++)
+    {
+        hex[i * 3] = digits[data[i] >> 4];
+        hex[i * 3 + 1] = digits[data[i] & 0x0F];
+        hex[i * 3 + 2] = ' ';
+    }
+    hex[data_len * 3] = '\0';
+    return hex;
 }
 
-static void euicc_apdu_response_print(const struct apdu_response *resp)
+static void euicc_apdu_request_print(struct euicc_ctx *ctx, const struct apdu_request *req, uint32_t request_len)
 {
-    fprintf(stderr, "[DEBUG] [APDU] [RX] SW1: %02X, SW2: %02X, Data: ", resp->sw1, resp->sw2);
-    for (uint32_t i = 0; i < resp->length; i++)
-        fprintf(stderr, "%02X ", (resp->data[i] & 0xFF));
-    fprintf(stderr, "\n");
+    const uint8_t *data = req->data;
+    uint32_t data_len = request_len - sizeof(struct apdu_request);
+    char *hex;
+
+    if (data_len > 0 && req->length == 0x00)
+    {
+        const struct apdu_request_extended *ereq = (const struct apdu_request_extended *)req;
+
+        hex = euicc_apdu_hex(ctx, ereq->data, request_len - sizeof(struct apdu_request_extended));
+        euicc_log(ctx, EUICC_TRACE_APDU, "[DEBUG] [APDU] [TX] CLA: %02X, INS: %02X, P1: %02X, P2: %02X, Lc: %02X%02X, Data: %s", ereq->cla, ereq->ins, ereq->p1, ereq->p2, ereq->length[0], ereq->length[1], hex ? hex : "");
+    }
+    else
+    {
+        hex = euicc_apdu_hex(ctx, data, data_len);
+        euicc_log(ctx, EUICC_TRACE_APDU, "[DEBUG] [APDU] [TX] CLA: %02X, INS: %02X, P1: %02X, P2: %02X, Lc: %02X, Data: %s", req->cla, req->ins, req->p1, req->p2, req->length, hex ? hex : "");
+    }
+    euicc_free(ctx, hex);
+}
+
+static void euicc_apdu_response_print(struct euicc_ctx *ctx, const struct apdu_response *resp)
+{
+    char *hex = euicc_apdu_hex(ctx, resp->data, resp->length);
+
+    euicc_log(ctx, EUICC_TRACE_APDU, "[DEBUG] [APDU] [RX] SW1: %02X, SW2: %02X, Data: %s", resp->sw1, resp->sw2, hex ? hex : "");
+    euicc_free(ctx, hex);
+}
+
+static void euicc_apdu_stats_sw(struct euicc_ctx *ctx, uint16_t sw, uint32_t count)
+{
+    struct euicc_apdu_stats *stats = &ctx->apdu.stats;
+
+    for (uint32_t i = 0; i < stats->sw_count; i++)
+    {
+        if (stats->sw[i].sw == sw)
+        {
+            stats->sw[i].count += count;
+            return;
+        }
+    }
+
+    if (stats->sw_count < EUICC_APDU_STATS_SW_MAX)
+    {
+        stats->sw[stats->sw_count].sw = sw;
+        stats->sw[stats->sw_count].count = count;
+        stats->sw_count++;
+    }
+}
+
+static void euicc_apdu_trace(struct euicc_ctx *ctx, uint64_t start, const uint8_t *request, uint32_t request_len, uint32_t count, int ret, const struct apdu_response *response)
+{
+    struct euicc_trace_span span = {
+        .category = EUICC_TRACE_APDU,
+        .tx_len = request_len,
+        .count = count,
+        .ret = ret,
+    };
+
+    switch (request[1])
+    {
+    case 0xE2:
+        span.name = "STORE DATA";
+        break;
+    case 0xC0:
+        span.name = "GET RESPONSE";
+        break;
+    default:
+        span.name = "APDU";
+        break;
+    }
+    if (count > 1)
+    {
+        span.name = "batch";
+    }
+
+    if (ret >= 0 && response->length >= 2)
+    {
+        span.rx_len = response->length;
+        span.status = (response->data[response->length - 2] << 8) | response->data[response->length - 1];
+    }
+
+    euicc_trace(ctx, &span, start);
 }
 
 int euicc_apdu_transmit(struct euicc_ctx *ctx, struct apdu_response *response, const struct apdu_request *request, uint32_t request_len)
 {
     const struct euicc_apdu_interface *in = ctx->apdu.interface;
+    uint64_t start = 0;
+    int ret;
 
     memset(response, 0x00, sizeof(*response));
 
-    if (getenv("LIBEUICC_DEBUG_APDU"))
+    if (euicc_aborted(ctx))
+    {
+        return -1;
+    }
+
+    if (ctx->debug & EUICC_DEBUG_APDU)
+    {
+        euicc_apdu_request_print(ctx, request, request_len);
+    }
+
+    ctx->apdu.stats.apdus++;
+    ctx->apdu.stats.bytes_sent += request_len;
+
+    if (ctx->trace)
     {
-        euicc_apdu_request_print(request, request_len);
+        start = euicc_now_us();
     }
 
-    if (in->transmit(ctx, &response->data, &response->length, (uint8_t *)request, request_len) < 0)
+    if (in->transmit_into)
+    {
+        uint32_t rx_buffer_len = in->extended_length ? EUICC_APDU_RX_BUFSZ_EXTENDED : EUICC_APDU_RX_BUFSZ_SHORT;
+
+        if (ctx->apdu._internal.rx_buffer_len < rx_buffer_len)
+        {
+            uint8_t *new_buffer;
+
+            new_buffer = euicc_realloc(ctx, ctx->apdu._internal.rx_buffer, rx_buffer_len);
+            if (!new_buffer)
+                return -1;
+            ctx->apdu._internal.rx_buffer = new_buffer;
+            ctx->apdu._internal.rx_buffer_len = rx_buffer_len;
+        }
+
+        response->data = ctx->apdu._internal.rx_buffer;
+        response->borrowed = 1;
+#ifdef EUICC_BIND_APDU
+        // A direct call whenever ctx uses the bound driver, which LTO can inline
+        if (in->transmit_into == euicc_bound_apdu_transmit_into)
+            ret = euicc_bound_apdu_transmit_into(ctx, response->data, ctx->apdu._internal.rx_buffer_len, &response->length, (uint8_t *)request, request_len);
+        else
+#endif
+            ret = in->transmit_into(ctx, response->data, ctx->apdu._internal.rx_buffer_len, &response->length, (uint8_t *)request, request_len);
+    }
+#ifdef EUICC_BIND_APDU
+    else if (in->transmit == euicc_bound_apdu_transmit)
+        ret = euicc_bound_apdu_transmit(ctx, &response->data, &response->length, (uint8_t *)request, request_len);
+#endif
+    else
+        ret = in->transmit(ctx, &response->data, &response->length, (uint8_t *)request, request_len);
+
+    if (ctx->trace)
+    {
+        euicc_apdu_trace(ctx, start, (const uint8_t *)request, request_len, 1, ret, response);
+    }
+    if (ret < 0)
         return -1;
 
+    ctx->apdu.stats.bytes_received += response->length;
+
     if (response->length < 2)
         return -1;
 
@@ -75,17 +249,97 @@ int euicc_apdu_transmit(struct euicc_ctx *ctx, struct apdu_response *response, c
     response->sw2 = response->data[response->length - 1];
     response->length -= 2;
 
-    if (getenv("LIBEUICC_DEBUG_APDU"))
+    euicc_apdu_stats_sw(ctx, (response->sw1 << 8) | response->sw2, 1);
+
+    if (ctx->debug & EUICC_DEBUG_APDU)
     {
-        euicc_apdu_response_print(response);
+        euicc_apdu_response_print(ctx, response);
     }
 
     return 0;
 }
 
+int euicc_apdu_transmit_batch(struct euicc_ctx *ctx, struct apdu_response *response, const uint8_t *const *requests, const uint32_t *request_lens, uint32_t count)
+{
+    const struct euicc_apdu_interface *in = ctx->apdu.interface;
+    uint64_t start = 0;
+    int sent;
+
+    memset(response, 0x00, sizeof(*response));
+
+    if (euicc_aborted(ctx))
+    {
+        return -1;
+    }
+
+    if (ctx->trace)
+    {
+        start = euicc_now_us();
+    }
+
+    sent = in->transmit_batch(ctx, &response->data, &response->length, requests, request_lens, count);
+
+    if (ctx->trace)
+    {
+        uint32_t tx_len = 0;
+
+        for (int i = 0; i < sent && (uint32_t)i < count; i++)
+        {
+            tx_len += request_lens[i];
+        }
+        euicc_apdu_trace(ctx, start, requests[0], tx_len, sent > 0 ? sent : 1, sent, response);
+    }
+    if (sent <= 0 || (uint32_t)sent > count)
+    {
+        euicc_apdu_response_free(response);
+        return -1;
+    }
+
+    if (ctx->debug & EUICC_DEBUG_APDU)
+    {
+        for (int i = 0; i < sent; i++)
+        {
+            euicc_apdu_request_print(ctx, (const struct apdu_request *)requests[i], request_lens[i]);
+        }
+    }
+
+    ctx->apdu.stats.apdus += sent;
+    for (int i = 0; i < sent; i++)
+    {
+        ctx->apdu.stats.bytes_sent += request_lens[i];
+    }
+    ctx->apdu.stats.bytes_received += response->length;
+
+    if (response->length < 2)
+    {
+        euicc_apdu_response_free(response);
+        return -1;
+    }
+
+    response->sw1 = response->data[response->length - 2];
+    response->sw2 = response->data[response->length - 1];
+    response->length -= 2;
+
+    // Only the last APDU's answer is returned, the ones before it were a bare 90 00
+    ctx->apdu.stats.bytes_received += (sent - 1) * 2;
+    if (sent > 1)
+    {
+        euicc_apdu_stats_sw(ctx, 0x9000, sent - 1);
+    }
+    euicc_apdu_stats_sw(ctx, (response->sw1 << 8) | response->sw2, 1);
+
+    if (ctx->debug & EUICC_DEBUG_APDU)
+    {
+        euicc_apdu_response_print(ctx, response);
+    }
+
+    return sent;
+}
+
 void euicc_apdu_response_free(struct apdu_response *resp)
 {
-    free(resp->data);
+    if (!resp->borrowed)
+        free(resp->data);
     resp->data = NULL;
     resp->length = 0;
 }
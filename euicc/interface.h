@@ -10,11 +10,44 @@ struct euicc_apdu_interface
     int (*logic_channel_open)(struct euicc_ctx *ctx, const uint8_t *aid, uint8_t aid_len);
     void (*logic_channel_close)(struct euicc_ctx *ctx, uint8_t channel);
     int (*transmit)(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len);
+    int (*transmit_into)(struct euicc_ctx *ctx, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len);
+    // Optional. Sends tx[0..tx_count) in order and stops after the first response that is not exactly 90 00.
+    // Returns how many APDUs were sent, with *rx holding the response (including SW) of the last one.
+    // A driver keeping several in flight may already have sent later ones when a response is not 90 00: it returns
+    // the count sent with *rx empty, since the card ran APDUs past the failing one, and the command fails.
+    int (*transmit_batch)(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *const *tx, const uint32_t *tx_len, uint32_t tx_count);
+    // Optional. Bracket each ES10x command and the logical channel setup, so a driver sharing the card with other processes only holds it while in use.
+    int (*transaction_begin)(struct euicc_ctx *ctx);
+    void (*transaction_end)(struct euicc_ctx *ctx);
+    // Optional. Writes a string naming the connected card or reader, for callers keeping settings per card.
+    // Valid after connect, the same card in the same reader gives the same string.
+    int (*identity)(struct euicc_ctx *ctx, char *identity, uint32_t identity_len);
+    // Optional. Resets the card, or picks it up again after the modem did, keeping the reader or modem session open.
+    // Logical channels are gone afterwards. Without it a reset goes through disconnect and connect.
+    int (*reconnect)(struct euicc_ctx *ctx);
+    uint8_t extended_length;
     void *userdata;
 };
 
 struct euicc_http_interface
 {
     int (*transmit)(struct euicc_ctx *ctx, const char *url, uint32_t *rcode, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len, const char **headers);
+    // Optional. Hands the response body to callback piece by piece as it arrives, a negative return from callback aborts the transfer.
+    int (*transmit_stream)(struct euicc_ctx *ctx, const char *url, uint32_t *rcode, const uint8_t *tx, uint32_t tx_len, const char **headers, int (*callback)(const uint8_t *data, uint32_t data_len, void *userdata), void *userdata);
+    // Optional. Sends count independent requests concurrently and discards the response bodies.
+    // rcode[i] stays 0 when request i could not be completed, a negative return means none of them were.
+    int (*transmit_multi)(struct euicc_ctx *ctx, uint32_t *rcode, const char *const *url, const uint8_t *const *tx, const uint32_t *tx_len, uint32_t count, const char **headers);
+    // Optional. Drops connections and caches kept across the requests of one ES9+/ES11 session.
+    void (*session_close)(struct euicc_ctx *ctx);
+    // Optional. Starts a request and returns at once, poll moves it forward. With chunk set the body goes there piece by
+    // piece and complete gets rx NULL, otherwise complete gets the whole body and frees it. A negative return from chunk
+    // aborts the transfer. complete runs exactly once, from poll, for every request submit accepted.
+    int (*submit)(struct euicc_ctx *ctx, const char *url, const uint8_t *tx, uint32_t tx_len, const char **headers, int (*chunk)(const uint8_t *data, uint32_t data_len, void *userdata), void (*complete)(int ret, uint32_t rcode, uint8_t *rx, uint32_t rx_len, void *userdata), void *userdata);
+    // Optional, comes with submit. Runs the submitted requests for at most timeout_ms, 0 only does what is ready, and
+    // calls the complete callback of the finished ones. Returns how many are still running, or -1.
+    int (*poll)(struct euicc_ctx *ctx, int timeout_ms);
+    // Optional. Starts resolving and connecting to the host of url in the background and returns at once,
+    // the next request to that host reuses the connection. Failures are left for that request to report.
+    void (*prepare)(struct euicc_ctx *ctx, const char *url);
     void *userdata;
 };
@@ -4,10 +4,22 @@
 
 #include <inttypes.h>
 
+#define EUICC_APDU_RX_BUFSZ_SHORT (256 + 2)
+#define EUICC_APDU_RX_BUFSZ_EXTENDED (65536 + 2)
+
+#ifdef EUICC_BIND_APDU
+// Exported by the one APDU driver lpac is built for, see driver/apdu/bind.h
+int euicc_bound_apdu_transmit(struct euicc_ctx *ctx, uint8_t **rx, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len);
+int euicc_bound_apdu_transmit_into(struct euicc_ctx *ctx, uint8_t *rx, uint32_t rx_cap, uint32_t *rx_len, const uint8_t *tx, uint32_t tx_len);
+#endif
+
 enum apdu_sw1
 {
     SW1_OK = 0x90,
     SW1_LAST = 0x61,
+    SW1_WRONG_LE = 0x6C,
+    SW1_TECHNICAL = 0x6F,
+    SW1_BUSY = 0x93,
 };
 
 struct apdu_request
@@ -20,15 +32,29 @@ struct apdu_request
     uint8_t data[];
 } __attribute__((packed));
 
+struct apdu_request_extended
+{
+    uint8_t cla;
+    uint8_t ins;
+    uint8_t p1;
+    uint8_t p2;
+    uint8_t length_marker;
+    uint8_t length[2];
+    uint8_t data[];
+} __attribute__((packed));
+
 struct apdu_response
 {
     uint8_t *data;
     uint32_t length;
     uint8_t sw1;
     uint8_t sw2;
+    uint8_t borrowed;
 };
 
 int euicc_apdu_lc(struct euicc_ctx *ctx, struct apdu_request **apdu, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t datalen);
+int euicc_apdu_lc_extended(struct euicc_ctx *ctx, struct apdu_request_extended **apdu, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint16_t datalen);
 int euicc_apdu_le(struct euicc_ctx *ctx, struct apdu_request **apdu, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t requestlen);
 int euicc_apdu_transmit(struct euicc_ctx *ctx, struct apdu_response *response, const struct apdu_request *req, uint32_t req_len);
+int euicc_apdu_transmit_batch(struct euicc_ctx *ctx, struct apdu_response *response, const uint8_t *const *requests, const uint32_t *request_lens, uint32_t count);
 void euicc_apdu_response_free(struct apdu_response *resp);
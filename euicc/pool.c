@@ -0,0 +1,277 @@
+#include "pool.h"
+#include "euicc.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef EUICC_STATIC_POOL_SIZE
+#include <cjson/cJSON.h>
+#endif
+
+#define EUICC_POOL_ALIGN (2 * sizeof(void *))
+#define EUICC_POOL_ALIGN_UP(x) (((x) + EUICC_POOL_ALIGN - 1) & ~(EUICC_POOL_ALIGN - 1))
+#define EUICC_POOL_HEADER EUICC_POOL_ALIGN_UP(sizeof(struct euicc_pool_block))
+
+// Blocks lie back to back over the buffer, each header followed by size bytes
+struct euicc_pool_block
+{
+    size_t size;
+    size_t used;
+};
+
+static struct euicc_pool_block *euicc_pool_next(struct euicc_pool *pool, struct euicc_pool_block *block)
+{
+    uint8_t *next = (uint8_t *)block + EUICC_POOL_HEADER + block->size;
+
+    if (next >= pool->base + pool->size)
+    {
+        return NULL;
+    }
+    return (struct euicc_pool_block *)next;
+}
+
+static struct euicc_pool_block *euicc_pool_block_of(struct euicc_pool *pool, void *ptr)
+{
+    if ((uint8_t *)ptr < pool->base + EUICC_POOL_HEADER || (uint8_t *)ptr >= pool->base + pool->size)
+    {
+        return NULL;
+    }
+    return (struct euicc_pool_block *)((uint8_t *)ptr - EUICC_POOL_HEADER);
+}
+
+// Takes the free blocks that follow into block
+static void euicc_pool_merge(struct euicc_pool *pool, struct euicc_pool_block *block)
+{
+    struct euicc_pool_block *next;
+
+    while ((next = euicc_pool_next(pool, block)) && !next->used)
+    {
+        block->size += EUICC_POOL_HEADER + next->size;
+    }
+}
+
+// Leaves size bytes in block, the rest becomes a free block when it is large enough for one
+static void euicc_pool_split(struct euicc_pool_block *block, size_t size)
+{
+    struct euicc_pool_block *rest;
+
+    if (block->size - size < EUICC_POOL_HEADER + EUICC_POOL_ALIGN)
+    {
+        return;
+    }
+
+    rest = (struct euicc_pool_block *)((uint8_t *)block + EUICC_POOL_HEADER + size);
+    rest->size = block->size - size - EUICC_POOL_HEADER;
+    rest->used = 0;
+    block->size = size;
+}
+
+static void euicc_pool_take(struct euicc_pool *pool, size_t bytes)
+{
+    pool->used += bytes;
+    if (pool->used > pool->peak)
+    {
+        pool->peak = pool->used;
+    }
+}
+
+void euicc_pool_init(struct euicc_pool *pool, void *buffer, size_t size)
+{
+    uintptr_t start = (uintptr_t)buffer, aligned = EUICC_POOL_ALIGN_UP(start);
+    struct euicc_pool_block *block;
+
+    memset(pool, 0, sizeof(*pool));
+
+    if (buffer == NULL || size < aligned - start + EUICC_POOL_HEADER + EUICC_POOL_ALIGN)
+    {
+        // Every allocation fails
+        return;
+    }
+
+    pool->base = (uint8_t *)aligned;
+    pool->size = (size - (aligned - start)) & ~(EUICC_POOL_ALIGN - 1);
+
+    block = (struct euicc_pool_block *)pool->base;
+    block->size = pool->size - EUICC_POOL_HEADER;
+    block->used = 0;
+}
+
+void *euicc_pool_malloc(struct euicc_pool *pool, size_t size)
+{
+    struct euicc_pool_block *block;
+
+    if (size > pool->size)
+    {
+        pool->failures++;
+        return NULL;
+    }
+    size = size ? EUICC_POOL_ALIGN_UP(size) : EUICC_POOL_ALIGN;
+
+    for (block = pool->size ? (struct euicc_pool_block *)pool->base : NULL; block; block = euicc_pool_next(pool, block))
+    {
+        if (block->used)
+        {
+            continue;
+        }
+        // Frees only mark, neighbours are merged when a walk comes by
+        euicc_pool_merge(pool, block);
+        if (block->size < size)
+        {
+            continue;
+        }
+
+        euicc_pool_split(block, size);
+        block->used = 1;
+        euicc_pool_take(pool, EUICC_POOL_HEADER + block->size);
+        return (uint8_t *)block + EUICC_POOL_HEADER;
+    }
+
+    pool->failures++;
+    return NULL;
+}
+
+void *euicc_pool_realloc(struct euicc_pool *pool, void *ptr, size_t size)
+{
+    struct euicc_pool_block *block;
+    size_t old_size;
+    void *moved;
+
+    if (ptr == NULL)
+    {
+        return euicc_pool_malloc(pool, size);
+    }
+    block = euicc_pool_block_of(pool, ptr);
+    if (block == NULL || size > pool->size)
+    {
+        pool->failures++;
+        return NULL;
+    }
+    size = size ? EUICC_POOL_ALIGN_UP(size) : EUICC_POOL_ALIGN;
+
+    // Grow in place over the free blocks behind it
+    old_size = block->size;
+    euicc_pool_merge(pool, block);
+    if (block->size >= size)
+    {
+        euicc_pool_split(block, size > old_size ? size : old_size);
+        euicc_pool_take(pool, block->size - old_size);
+        return ptr;
+    }
+    euicc_pool_split(block, old_size);
+
+    moved = euicc_pool_malloc(pool, size);
+    if (moved == NULL)
+    {
+        return NULL;
+    }
+    memcpy(moved, ptr, old_size);
+    euicc_pool_free(pool, ptr);
+
+    return moved;
+}
+
+void euicc_pool_free(struct euicc_pool *pool, void *ptr)
+{
+    struct euicc_pool_block *block;
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+    block = euicc_pool_block_of(pool, ptr);
+    if (block == NULL || !block->used)
+    {
+        return;
+    }
+
+    block->used = 0;
+    pool->used -= EUICC_POOL_HEADER + block->size;
+}
+
+static void *euicc_pool_allocator_malloc(void *userdata, size_t size)
+{
+    return euicc_pool_malloc(userdata, size);
+}
+
+static void *euicc_pool_allocator_realloc(void *userdata, void *ptr, size_t size)
+{
+    return euicc_pool_realloc(userdata, ptr, size);
+}
+
+static void euicc_pool_allocator_free(void *userdata, void *ptr)
+{
+    euicc_pool_free(userdata, ptr);
+}
+
+void euicc_pool_allocator(struct euicc_pool *pool, struct euicc_allocator *allocator)
+{
+    allocator->malloc = euicc_pool_allocator_malloc;
+    allocator->realloc = euicc_pool_allocator_realloc;
+    allocator->free = euicc_pool_allocator_free;
+    allocator->userdata = pool;
+}
+
+#ifdef EUICC_STATIC_POOL_SIZE
+static uint8_t euicc_static_buffer[EUICC_STATIC_POOL_SIZE] __attribute__((aligned(16)));
+static struct euicc_pool euicc_static;
+static int euicc_static_ready;
+
+struct euicc_pool *euicc_static_pool(void)
+{
+    cJSON_Hooks hooks = {euicc_static_malloc, euicc_static_free};
+
+    if (!euicc_static_ready)
+    {
+        euicc_static_ready = 1;
+        euicc_pool_init(&euicc_static, euicc_static_buffer, sizeof(euicc_static_buffer));
+        cJSON_InitHooks(&hooks);
+    }
+    return &euicc_static;
+}
+
+void *euicc_static_malloc(size_t size)
+{
+    return euicc_pool_malloc(euicc_static_pool(), size);
+}
+
+void *euicc_static_calloc(size_t count, size_t size)
+{
+    void *ptr;
+
+    if (size && count > SIZE_MAX / size)
+    {
+        euicc_static_pool()->failures++;
+        return NULL;
+    }
+
+    ptr = euicc_static_malloc(count * size);
+    if (ptr)
+    {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void *euicc_static_realloc(void *ptr, size_t size)
+{
+    return euicc_pool_realloc(euicc_static_pool(), ptr, size);
+}
+
+void euicc_static_free(void *ptr)
+{
+    euicc_pool_free(euicc_static_pool(), ptr);
+}
+
+char *euicc_static_strdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *dup;
+
+    dup = euicc_static_malloc(len);
+    if (dup)
+    {
+        memcpy(dup, str, len);
+    }
+    return dup;
+}
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+#include <inttypes.h>
+
+struct euicc_allocator;
+
+// First-fit allocator over one fixed buffer, for hosts without a general-purpose heap. Out of space is a NULL
+// return, which libeuicc reports like a failed malloc, and is counted in failures.
+struct euicc_pool
+{
+    uint8_t *base;
+    size_t size;
+    // Bytes taken, block headers included, and the most they have been
+    size_t used;
+    size_t peak;
+    uint32_t failures;
+};
+
+// buffer is used from its first aligned byte on and must outlive the pool
+void euicc_pool_init(struct euicc_pool *pool, void *buffer, size_t size);
+void *euicc_pool_malloc(struct euicc_pool *pool, size_t size);
+void *euicc_pool_realloc(struct euicc_pool *pool, void *ptr, size_t size);
+// Pointers from outside the buffer are ignored
+void euicc_pool_free(struct euicc_pool *pool, void *ptr);
+// Fills allocator to serve ctx->allocator from pool
+void euicc_pool_allocator(struct euicc_pool *pool, struct euicc_allocator *allocator);
+
+#ifdef EUICC_STATIC_POOL_SIZE
+// With LPAC_LIBEUICC_STATIC_POOL every libeuicc allocation, results included, comes from this pool of
+// EUICC_STATIC_POOL_SIZE bytes instead of malloc, and so do cJSON objects once it is set up. The first call sets it
+// up and hooks cJSON into it, euicc_init does that, call it first when cJSON is used before. One thread at a time.
+struct euicc_pool *euicc_static_pool(void);
+// What libeuicc calls in place of libc, free its results and hand back driver buffers with these
+void *euicc_static_malloc(size_t size);
+void *euicc_static_calloc(size_t count, size_t size);
+void *euicc_static_realloc(void *ptr, size_t size);
+void euicc_static_free(void *ptr);
+char *euicc_static_strdup(const char *str);
+#endif
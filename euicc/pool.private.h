@@ -0,0 +1,17 @@
+#pragma once
+
+// Included after the system headers by every libeuicc file that allocates, so a static pool build never reaches malloc
+#ifdef EUICC_STATIC_POOL_SIZE
+#include "pool.h"
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+#undef strdup
+#define malloc(size) euicc_static_malloc(size)
+#define calloc(count, size) euicc_static_calloc(count, size)
+#define realloc(ptr, size) euicc_static_realloc(ptr, size)
+#define free(ptr) euicc_static_free(ptr)
+#define strdup(str) euicc_static_strdup(str)
+#endif
@@ -133,3 +133,60 @@ const char *euicc_errorreason2str(enum es10b_error_reason value)
     }
     return "(no_str_available)";
 }
+
+const char *euicc_es10xcommand2str(uint16_t tag)
+{
+    switch (tag)
+    {
+    case 0xBF20:
+        return "es10b_get_euicc_info1";
+    case 0xBF21:
+        return "es10b_prepare_download";
+    case 0xBF22:
+        return "es10c_ex_get_euiccinfo2";
+    case 0xBF28:
+        return "es10b_list_notification";
+    case 0xBF29:
+        return "es10c_set_nickname";
+    case 0xBF2B:
+        return "es10b_retrieve_notifications_list";
+    case 0xBF2D:
+        return "es10c_get_profiles_info";
+    case 0xBF2E:
+        return "es10b_get_euicc_challenge";
+    case 0xBF30:
+        return "es10b_remove_notification_from_list";
+    case 0xBF31:
+        return "es10c_enable_profile";
+    case 0xBF32:
+        return "es10c_disable_profile";
+    case 0xBF33:
+        return "es10c_delete_profile";
+    case 0xBF34:
+        return "es10c_euicc_memory_reset";
+    case 0xBF38:
+        return "es10b_authenticate_server";
+    case 0xBF3C:
+        return "es10a_get_euicc_configured_addresses";
+    case 0xBF3E:
+        return "es10c_get_eid";
+    case 0xBF3F:
+        return "es10a_set_default_dp_address";
+    case 0xBF41:
+        return "es10b_cancel_session";
+    case 0xBF43:
+        return "es10b_get_rat";
+    // Every element of a BoundProfilePackage is sent as its own command
+    case 0xBF36:
+    case 0xBF23:
+    case 0xA0:
+    case 0xA1:
+    case 0xA2:
+    case 0xA3:
+    case 0x86:
+    case 0x87:
+    case 0x88:
+        return "es10b_load_bound_profile_package";
+    }
+    return NULL;
+}
@@ -0,0 +1,407 @@
+#include "batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
+
+#include <main.h>
+
+#define BATCH_ARGV_MAX 64
+
+static const char *opt_string = "kh?";
+
+struct batch_command
+{
+    int argc;
+    char *argv[BATCH_ARGV_MAX];
+};
+
+static char *batch_read_file(const char *path)
+{
+    FILE *fp;
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+
+    if (strcmp(path, "-") == 0)
+    {
+        fp = stdin;
+    }
+    else
+    {
+        fp = fopen(path, "rb");
+        if (fp == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    while (1)
+    {
+        size_t n;
+
+        if (len + 1 >= cap)
+        {
+            char *buf_new;
+
+            cap = cap ? cap * 2 : 4096;
+            buf_new = realloc(buf, cap);
+            if (buf_new == NULL)
+            {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = buf_new;
+        }
+
+        n = fread(buf + len, 1, cap - len - 1, fp);
+        len += n;
+        if (n == 0)
+        {
+            buf[len] = '\0';
+            break;
+        }
+    }
+
+    if (fp != stdin)
+    {
+        fclose(fp);
+    }
+    return buf;
+}
+
+static int batch_add_arg(struct batch_command *command, const char *arg, size_t len)
+{
+    if (command->argc >= BATCH_ARGV_MAX - 1)
+    {
+        return -1;
+    }
+    command->argv[command->argc] = malloc(len + 1);
+    if (command->argv[command->argc] == NULL)
+    {
+        return -1;
+    }
+    memcpy(command->argv[command->argc], arg, len);
+    command->argv[command->argc][len] = '\0';
+    command->argc++;
+    command->argv[command->argc] = NULL;
+    return 0;
+}
+
+// Splits a line the way a shell would for plain words, 'single' and "double" quotes and backslash escapes
+static int batch_split_line(struct batch_command *command, const char *line)
+{
+    const char *p = line;
+    char *word;
+    size_t len;
+    int fret = 0;
+
+    word = malloc(strlen(line) + 1);
+    if (word == NULL)
+    {
+        return -1;
+    }
+
+    while (1)
+    {
+        char quote = 0;
+        int in_word = 0;
+
+        while (*p && isspace((unsigned char)*p))
+        {
+            p++;
+        }
+        if (*p == '\0' || *p == '#')
+        {
+            break;
+        }
+
+        len = 0;
+        while (*p && (quote || !isspace((unsigned char)*p)))
+        {
+            in_word = 1;
+            if (quote && *p == quote)
+            {
+                quote = 0;
+            }
+            else if (!quote && (*p == '\'' || *p == '"'))
+            {
+                quote = *p;
+            }
+            else if (*p == '\\' && quote != '\'' && p[1])
+            {
+                word[len++] = *++p;
+            }
+            else
+            {
+                word[len++] = *p;
+            }
+            p++;
+        }
+
+        if (quote)
+        {
+            goto err;
+        }
+        if (in_word && batch_add_arg(command, word, len) < 0)
+        {
+            goto err;
+        }
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    free(word);
+    return fret;
+}
+
+static void batch_commands_free(struct batch_command *commands, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        for (int j = 0; j < commands[i].argc; j++)
+        {
+            free(commands[i].argv[j]);
+        }
+    }
+    free(commands);
+}
+
+static struct batch_command *batch_commands_append(struct batch_command **commands, int *count)
+{
+    struct batch_command *commands_new;
+
+    commands_new = realloc(*commands, (*count + 1) * sizeof(struct batch_command));
+    if (commands_new == NULL)
+    {
+        return NULL;
+    }
+    *commands = commands_new;
+
+    memset(&commands_new[*count], 0, sizeof(struct batch_command));
+    // argv[0] is the program name, as applet_entry expects
+    if (batch_add_arg(&commands_new[*count], "lpac", strlen("lpac")) < 0)
+    {
+        return NULL;
+    }
+    return &commands_new[(*count)++];
+}
+
+// [["chip","info"],"profile list"], each element an argv array or a command line
+static int batch_parse_json(struct batch_command **commands, int *count, const char *script)
+{
+    cJSON *jroot = NULL;
+    cJSON *jcommand = NULL;
+    cJSON *jarg = NULL;
+    int fret = 0;
+
+    jroot = cJSON_Parse(script);
+    if (!cJSON_IsArray(jroot))
+    {
+        goto err;
+    }
+
+    cJSON_ArrayForEach(jcommand, jroot)
+    {
+        struct batch_command *command;
+
+        command = batch_commands_append(commands, count);
+        if (command == NULL)
+        {
+            goto err;
+        }
+
+        if (cJSON_IsString(jcommand))
+        {
+            if (batch_split_line(command, jcommand->valuestring) < 0)
+            {
+                goto err;
+            }
+            continue;
+        }
+
+        if (!cJSON_IsArray(jcommand))
+        {
+            goto err;
+        }
+        cJSON_ArrayForEach(jarg, jcommand)
+        {
+            if (!cJSON_IsString(jarg) || batch_add_arg(command, jarg->valuestring, strlen(jarg->valuestring)) < 0)
+            {
+                goto err;
+            }
+        }
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    cJSON_Delete(jroot);
+    return fret;
+}
+
+static int batch_parse_lines(struct batch_command **commands, int *count, char *script)
+{
+    char *line, *saveptr = NULL;
+
+    for (line = strtok_r(script, "\r\n", &saveptr); line; line = strtok_r(NULL, "\r\n", &saveptr))
+    {
+        struct batch_command *command;
+
+        command = batch_commands_append(commands, count);
+        if (command == NULL || batch_split_line(command, line) < 0)
+        {
+            return -1;
+        }
+
+        // Blank and comment lines take no index
+        if (command->argc == 1)
+        {
+            free(command->argv[0]);
+            (*count)--;
+        }
+    }
+
+    return 0;
+}
+
+static int applet_main(int argc, char **argv)
+{
+    int fret = 0;
+    int opt;
+    int keep_going = 0;
+    const char *path;
+    char *script = NULL;
+    const char *p;
+    struct batch_command *commands = NULL;
+    int count = 0, failed = 0, i;
+    cJSON *jdata = NULL;
+
+    opt = getopt(argc, argv, opt_string);
+    while (opt != -1)
+    {
+        switch (opt)
+        {
+        case 'k':
+            keep_going = 1;
+            break;
+        case 'h':
+        case '?':
+            printf("Usage: %s [OPTIONS] <file|->\r\n", argv[0]);
+            printf("\t One command per line, or a JSON array of argv arrays or command lines\r\n");
+            printf("\t -k Keep going after a command failed\r\n");
+            printf("\t -h This help info\r\n");
+            return -1;
+        }
+        opt = getopt(argc, argv, opt_string);
+    }
+
+    if (optind >= argc)
+    {
+        jprint_error("batch", "no script specified");
+        return -1;
+    }
+    path = argv[optind];
+
+    if (strcmp(path, "-") == 0 && strcmp(getenv("LPAC_APDU") ? getenv("LPAC_APDU") : "", "stdio") == 0)
+    {
+        jprint_error("batch", "stdio APDU backend cannot be used with a script from stdin");
+        return -1;
+    }
+
+    script = batch_read_file(path);
+    if (script == NULL)
+    {
+        jprint_error("batch", "cannot read script");
+        return -1;
+    }
+
+    p = script;
+    while (isspace((unsigned char)*p))
+    {
+        p++;
+    }
+    if ((*p == '[' ? batch_parse_json(&commands, &count, p) : batch_parse_lines(&commands, &count, script)) < 0)
+    {
+        jprint_error("batch", "invalid script");
+        goto err;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        const char *name = commands[i].argc > 1 ? commands[i].argv[1] : "";
+
+        if (strcmp(name, "batch") == 0 || strcmp(name, "daemon") == 0 || strcmp(name, "fleet") == 0)
+        {
+            jprint_error("batch", "command cannot be run in batch mode");
+            goto err;
+        }
+    }
+
+    // Every command shares the connection and ISD-R channel opened here
+    main_init_euicc();
+
+    jdata = cJSON_CreateArray();
+    for (i = 0; i < count; i++)
+    {
+        cJSON *jresult;
+        int ret;
+
+        main_reset_getopt();
+        euicc_apdu_stats_reset(&euicc_ctx);
+        jprint_timing_reset();
+        main_reset_deadline();
+        jprint_set_index(i);
+        ret = main_applet_entry(commands[i].argc, commands[i].argv);
+        jprint_set_index(-1);
+        euicc_http_cleanup(&euicc_ctx);
+        fflush(stdout);
+
+        jresult = cJSON_CreateObject();
+        cJSON_AddNumberToObject(jresult, "index", i);
+        cJSON_AddNumberToObject(jresult, "code", ret ? -1 : 0);
+        cJSON_AddItemToArray(jdata, jresult);
+
+        if (ret)
+        {
+            failed++;
+            if (!keep_going)
+            {
+                break;
+            }
+        }
+    }
+
+    if (failed)
+    {
+        cJSON_Delete(jdata);
+        jdata = NULL;
+        jprint_error("batch", i < count ? "stopped after a failed command" : "some commands failed");
+        goto err;
+    }
+
+    jprint_success(jdata);
+    jdata = NULL;
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    cJSON_Delete(jdata);
+    batch_commands_free(commands, count);
+    free(script);
+    return fret;
+}
+
+struct applet_entry applet_batch = {
+    .name = "batch",
+    .main = applet_main,
+};
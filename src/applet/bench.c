@@ -0,0 +1,28 @@
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <main.h>
+
+#include "bench/apdu.h"
+#include "bench/calibrate.h"
+#include "bench/download.h"
+
+static const struct applet_entry *applets[] = {
+    &applet_bench_apdu,
+    &applet_bench_calibrate,
+    &applet_bench_download,
+    NULL,
+};
+
+static int applet_main(int argc, char **argv)
+{
+    return applet_entry(argc, argv, applets);
+}
+
+struct applet_entry applet_bench = {
+    .name = "bench",
+    .main = applet_main,
+};
@@ -0,0 +1,289 @@
+#include "apdu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <main.h>
+#include <calibrate.h>
+
+#include <euicc/euicc.h>
+
+#define BENCH_SWEEP_MAX 16
+
+static const char *opt_string = "n:s:h?";
+
+struct bench_workload
+{
+    const char *name;
+    uint8_t *req;
+    uint32_t req_len;
+};
+
+struct bench_result
+{
+    double *latency_ms;
+    uint32_t requests;
+    uint32_t failures;
+    uint32_t resp_len;
+    uint64_t total_us;
+    uint64_t apdus;
+    uint64_t apdu_us;
+    uint64_t get_responses;
+    uint64_t get_response_us;
+    uint64_t apdu_tx;
+    uint64_t apdu_rx;
+};
+
+static uint8_t bench_req_eid[] = {0xBF, 0x3E, 0x03, 0x5C, 0x01, 0x5A};
+static uint8_t bench_req_profiles_iccid[] = {0xBF, 0x2D, 0x03, 0x5C, 0x01, 0x5A};
+static uint8_t bench_req_profiles_state[] = {0xBF, 0x2D, 0x05, 0x5C, 0x03, 0x5A, 0x9F, 0x70};
+static uint8_t bench_req_profiles_all[] = {0xBF, 0x2D, 0x00};
+static uint8_t bench_req_euiccinfo2[] = {0xBF, 0x22, 0x00};
+
+static struct bench_result *bench_current;
+static void (*bench_trace_next)(struct euicc_ctx *ctx, const struct euicc_trace_span *span);
+
+static void bench_span(struct euicc_ctx *ctx, const struct euicc_trace_span *span)
+{
+    if (bench_current)
+    {
+        if (span->category == EUICC_TRACE_ES10X)
+        {
+            bench_current->apdus += span->count;
+        }
+        else if (span->category == EUICC_TRACE_APDU)
+        {
+            bench_current->apdu_us += span->duration_us;
+            bench_current->apdu_tx += span->tx_len;
+            bench_current->apdu_rx += span->rx_len;
+            if (span->name && strcmp(span->name, "GET RESPONSE") == 0)
+            {
+                bench_current->get_responses++;
+                bench_current->get_response_us += span->duration_us;
+            }
+        }
+    }
+
+    if (bench_trace_next)
+    {
+        bench_trace_next(ctx, span);
+    }
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double bench_percentile(const double *sorted, uint32_t n, uint32_t p)
+{
+    uint32_t rank;
+
+    // Nearest rank
+    rank = (n * p + 99) / 100;
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    return sorted[rank - 1];
+}
+
+static int bench_run(const struct bench_workload *workload, uint32_t iterations, struct bench_result *result)
+{
+    const uint8_t *resp;
+    uint32_t resp_len;
+    uint64_t start_us, duration_us;
+
+    memset(result, 0, sizeof(*result));
+    result->latency_ms = calloc(iterations, sizeof(double));
+    if (result->latency_ms == NULL)
+    {
+        return -1;
+    }
+
+    // Warm-up, not counted
+    euicc_es10x_transceive(&euicc_ctx, workload->req, workload->req_len, &resp, &resp_len);
+
+    bench_current = result;
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        start_us = euicc_now_us();
+        if (euicc_es10x_transceive(&euicc_ctx, workload->req, workload->req_len, &resp, &resp_len) < 0)
+        {
+            result->failures++;
+            continue;
+        }
+        duration_us = euicc_now_us() - start_us;
+        result->latency_ms[result->requests++] = duration_us / 1000.0;
+        result->total_us += duration_us;
+        result->resp_len = resp_len;
+    }
+    bench_current = NULL;
+
+    return 0;
+}
+
+static cJSON *bench_result_json(const struct bench_workload *workload, struct bench_result *result)
+{
+    cJSON *jresult, *jlatency;
+    double seconds, attempts;
+
+    jresult = cJSON_CreateObject();
+    cJSON_AddStringToObject(jresult, "name", workload->name);
+    cJSON_AddNumberToObject(jresult, "request_bytes", workload->req_len);
+    cJSON_AddNumberToObject(jresult, "response_bytes", result->resp_len);
+    cJSON_AddNumberToObject(jresult, "requests", result->requests);
+    cJSON_AddNumberToObject(jresult, "failures", result->failures);
+
+    if (result->requests == 0)
+    {
+        cJSON_AddNullToObject(jresult, "latency_ms");
+        return jresult;
+    }
+
+    qsort(result->latency_ms, result->requests, sizeof(double), bench_compare);
+    jlatency = cJSON_AddObjectToObject(jresult, "latency_ms");
+    cJSON_AddNumberToObject(jlatency, "min", result->latency_ms[0]);
+    cJSON_AddNumberToObject(jlatency, "p50", bench_percentile(result->latency_ms, result->requests, 50));
+    cJSON_AddNumberToObject(jlatency, "p95", bench_percentile(result->latency_ms, result->requests, 95));
+    cJSON_AddNumberToObject(jlatency, "p99", bench_percentile(result->latency_ms, result->requests, 99));
+    cJSON_AddNumberToObject(jlatency, "max", result->latency_ms[result->requests - 1]);
+
+    // Failed requests still went over the wire, so the per-request APDU counts divide by every attempt
+    attempts = result->requests + result->failures;
+    cJSON_AddNumberToObject(jresult, "apdus_per_request", result->apdus / attempts);
+    cJSON_AddNumberToObject(jresult, "get_responses_per_request", result->get_responses / attempts);
+    cJSON_AddNumberToObject(jresult, "get_response_time_share", result->apdu_us ? (double)result->get_response_us / result->apdu_us : 0);
+    cJSON_AddNumberToObject(jresult, "apdu_bytes_sent", result->apdu_tx);
+    cJSON_AddNumberToObject(jresult, "apdu_bytes_received", result->apdu_rx);
+
+    // Effective ES10x payload rate, as an LPA sees it
+    seconds = result->total_us / 1000000.0;
+    cJSON_AddNumberToObject(jresult, "tx_bytes_per_second", seconds > 0 ? (double)workload->req_len * result->requests / seconds : 0);
+    cJSON_AddNumberToObject(jresult, "rx_bytes_per_second", seconds > 0 ? (double)result->resp_len * result->requests / seconds : 0);
+
+    return jresult;
+}
+
+static int applet_main(int argc, char **argv)
+{
+    int fret = 0;
+    int opt;
+    uint32_t iterations = 20;
+    const char *sizes = "128,512,2048";
+    struct bench_workload workloads[5 + BENCH_SWEEP_MAX] = {
+        {"eid", bench_req_eid, sizeof(bench_req_eid)},
+        {"profiles_iccid", bench_req_profiles_iccid, sizeof(bench_req_profiles_iccid)},
+        {"profiles_state", bench_req_profiles_state, sizeof(bench_req_profiles_state)},
+        {"profiles_all", bench_req_profiles_all, sizeof(bench_req_profiles_all)},
+        {"euiccinfo2", bench_req_euiccinfo2, sizeof(bench_req_euiccinfo2)},
+    };
+    char sweep_names[BENCH_SWEEP_MAX][32];
+    int fixed_count = 5, workload_count = 5;
+    struct bench_result result;
+    cJSON *jdata = NULL;
+    char *sizes_dup = NULL, *token, *saveptr;
+
+    main_init_euicc();
+
+    opt = getopt(argc, argv, opt_string);
+    while (opt != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            sizes = optarg;
+            break;
+        case 'h':
+        case '?':
+            printf("Usage: %s [OPTIONS]\r\n", argv[0]);
+            printf("\t -n Requests per workload, after one warm-up [default: 20]\r\n");
+            printf("\t -s Comma separated request sizes for the STORE DATA sweep, empty for none [default: 128,512,2048]\r\n");
+            printf("\t -h This help info\r\n");
+            return -1;
+        }
+        opt = getopt(argc, argv, opt_string);
+    }
+
+    if (iterations == 0)
+    {
+        jprint_error("bench", "iterations must be positive");
+        return -1;
+    }
+
+    sizes_dup = strdup(sizes);
+    if (sizes_dup == NULL)
+    {
+        jprint_error("bench", "out of memory");
+        goto err;
+    }
+    for (token = strtok_r(sizes_dup, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr))
+    {
+        unsigned long size = strtoul(token, NULL, 0);
+
+        if (workload_count == fixed_count + BENCH_SWEEP_MAX)
+        {
+            jprint_error("bench", "too many sweep sizes");
+            goto err;
+        }
+        if (size == 0 || size > 0xFFFF)
+        {
+            jprint_error("bench", "sweep size out of range");
+            goto err;
+        }
+        snprintf(sweep_names[workload_count - fixed_count], sizeof(sweep_names[0]), "store_data_%lu", size);
+        workloads[workload_count].name = sweep_names[workload_count - fixed_count];
+        workloads[workload_count].req = calibrate_padded_request(size, &workloads[workload_count].req_len);
+        if (workloads[workload_count].req == NULL)
+        {
+            jprint_error("bench", "out of memory");
+            goto err;
+        }
+        workload_count++;
+    }
+
+    bench_trace_next = euicc_ctx.trace;
+    euicc_ctx.trace = bench_span;
+
+    jdata = cJSON_CreateArray();
+    for (int i = 0; i < workload_count; i++)
+    {
+        if (bench_run(&workloads[i], iterations, &result))
+        {
+            jprint_error("bench", "out of memory");
+            goto err;
+        }
+        cJSON_AddItemToArray(jdata, bench_result_json(&workloads[i], &result));
+        free(result.latency_ms);
+    }
+
+    jprint_success(jdata);
+    jdata = NULL;
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    if (euicc_ctx.trace == bench_span)
+    {
+        euicc_ctx.trace = bench_trace_next;
+    }
+    cJSON_Delete(jdata);
+    for (int i = fixed_count; i < workload_count; i++)
+    {
+        free(workloads[i].req);
+    }
+    free(sizes_dup);
+    return fret;
+}
+
+struct applet_entry applet_bench_apdu = {
+    .name = "apdu",
+    .main = applet_main,
+};
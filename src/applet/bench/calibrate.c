@@ -0,0 +1,82 @@
+#include "calibrate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <main.h>
+#include <cache.h>
+#include <calibrate.h>
+
+#include <euicc/euicc.h>
+#include <euicc/interface.h>
+
+static const char *opt_string = "n:h?";
+
+static int applet_main(int argc, char **argv)
+{
+    int opt;
+    uint32_t iterations = CALIBRATE_ITERATIONS_DEFAULT;
+    uint32_t segment_size;
+    char identity[256];
+    int stored = 0;
+    cJSON *jdata = NULL;
+
+    main_init_euicc();
+
+    opt = getopt(argc, argv, opt_string);
+    while (opt != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 'h':
+        case '?':
+            printf("Usage: %s [OPTIONS]\r\n", argv[0]);
+            printf("\t -n Requests per segment size, after one warm-up [default: %d]\r\n", CALIBRATE_ITERATIONS_DEFAULT);
+            printf("\t -h This help info\r\n");
+            return -1;
+        }
+        opt = getopt(argc, argv, opt_string);
+    }
+
+    if (iterations == 0)
+    {
+        jprint_error("bench", "iterations must be positive");
+        return -1;
+    }
+
+    jdata = cJSON_CreateObject();
+    segment_size = calibrate_segment_size(&euicc_ctx, iterations, cJSON_AddArrayToObject(jdata, "candidates"));
+    if (segment_size == 0)
+    {
+        cJSON_Delete(jdata);
+        jprint_error("bench", "no segment size worked");
+        return -1;
+    }
+    cJSON_AddNumberToObject(jdata, "segment_size", segment_size);
+
+    if (cache_enabled() && euicc_ctx.apdu.interface->identity && euicc_ctx.apdu.interface->identity(&euicc_ctx, identity, sizeof(identity)) == 0 && identity[0])
+    {
+        cache_segment_size_put(identity, segment_size);
+        stored = 1;
+    }
+    cJSON_AddBoolToObject(jdata, "stored", stored);
+
+    // The rest of a batch or daemon session uses it too, unless LPAC_APDU_SEGMENT_SIZE pinned one
+    if (!getenv("LPAC_APDU_SEGMENT_SIZE"))
+    {
+        euicc_ctx.apdu.segment_size = segment_size;
+    }
+
+    jprint_success(jdata);
+
+    return 0;
+}
+
+struct applet_entry applet_bench_calibrate = {
+    .name = "calibrate",
+    .main = applet_main,
+};
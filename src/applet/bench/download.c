@@ -0,0 +1,623 @@
+#include "download.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <main.h>
+#include <driver.h>
+
+#include <euicc/euicc.h>
+#include <euicc/interface.h>
+#include <euicc/download.h>
+#include <euicc/tostr.h>
+
+#define BENCH_DOWNLOAD_JOBS_DEFAULT 4
+#define BENCH_DOWNLOAD_JOBS_MAX 256
+#define BENCH_DOWNLOAD_SESSIONS_DEFAULT 16
+#define BENCH_DOWNLOAD_LINE_MAX 1024
+#define BENCH_DOWNLOAD_ERRORS_MAX 64
+// The 22 leading digits of every simulated EID, the session number and the check digits follow
+#define BENCH_DOWNLOAD_EID_PREFIX "8904903212345123451234"
+
+static const char *opt_string = "s:m:q:i:j:n:h?";
+
+// Stages of euicc_download_session in order, then the whole session
+static const char *const bench_download_stages[] = {
+    "es10b_get_euicc_challenge_and_info",
+    "es9p_initiate_authentication",
+    "es10b_authenticate_server",
+    "es9p_authenticate_client",
+    "es10b_prepare_download",
+    "es9p_get_bound_profile_package",
+    "es10b_load_bound_profile_package",
+    "session",
+};
+#define BENCH_DOWNLOAD_STAGE_COUNT (sizeof(bench_download_stages) / sizeof(bench_download_stages[0]))
+
+struct bench_download_code
+{
+    char *smdp;
+    char *matchingId;
+};
+
+struct bench_download_stage
+{
+    double *latency_ms;
+    uint32_t count;
+    uint32_t failures;
+};
+
+struct bench_download_error
+{
+    const char *stage;
+    char subject_code[sizeof(((struct euicc_ctx *)0)->http.status.subjectCode)];
+    char reason_code[sizeof(((struct euicc_ctx *)0)->http.status.reasonCode)];
+    char message[sizeof(((struct euicc_ctx *)0)->http.status.message)];
+    uint32_t count;
+};
+
+// One simulated eUICC with its download in flight
+struct bench_download_slot
+{
+    struct euicc_ctx ctx;
+    struct euicc_apdu_interface apdu_interface;
+    struct euicc_download_session session;
+    uint64_t session_start_us;
+    uint64_t stage_start_us;
+    uint8_t active;
+    uint8_t waiting;
+};
+
+struct bench_download
+{
+    struct bench_download_stage stages[BENCH_DOWNLOAD_STAGE_COUNT];
+    struct bench_download_error errors[BENCH_DOWNLOAD_ERRORS_MAX];
+    uint32_t error_count;
+    uint32_t succeeded;
+    uint32_t failed;
+    const char *imei;
+};
+
+static int bench_download_compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double bench_download_percentile(const double *sorted, uint32_t n, uint32_t p)
+{
+    uint32_t rank;
+
+    // Nearest rank
+    rank = (n * p + 99) / 100;
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    return sorted[rank - 1];
+}
+
+static struct bench_download_stage *bench_download_stage_find(struct bench_download *bench, const char *name)
+{
+    for (uint32_t i = 0; i < BENCH_DOWNLOAD_STAGE_COUNT; i++)
+    {
+        if (strcmp(bench_download_stages[i], name) == 0)
+        {
+            return &bench->stages[i];
+        }
+    }
+    return NULL;
+}
+
+// The latency arrays hold one entry per session, every stage runs at most once in each
+static void bench_download_stage_done(struct bench_download *bench, const char *name, uint64_t duration_us)
+{
+    struct bench_download_stage *stage = bench_download_stage_find(bench, name);
+
+    if (stage)
+    {
+        stage->latency_ms[stage->count++] = duration_us / 1000.0;
+    }
+}
+
+static void bench_download_error_add(struct bench_download *bench, struct bench_download_slot *slot)
+{
+    const char *stage = slot->session.failed;
+    struct bench_download_error error = {.stage = stage};
+
+    // ES9+ failures are told apart by the SGP.22 status code, eUICC ones by the reason the card gave
+    if (strncmp(stage, "es9p_", 5) == 0)
+    {
+        snprintf(error.subject_code, sizeof(error.subject_code), "%s", slot->ctx.http.status.subjectCode);
+        snprintf(error.reason_code, sizeof(error.reason_code), "%s", slot->ctx.http.status.reasonCode);
+        snprintf(error.message, sizeof(error.message), "%s", slot->ctx.http.status.message);
+    }
+    else if (strcmp(stage, "es10b_load_bound_profile_package") == 0)
+    {
+        snprintf(error.message, sizeof(error.message), "%s", euicc_errorreason2str(slot->session.result.errorReason));
+    }
+
+    bench_download_stage_find(bench, stage)->failures++;
+
+    for (uint32_t i = 0; i < bench->error_count; i++)
+    {
+        struct bench_download_error *known = &bench->errors[i];
+
+        if (known->stage == error.stage && strcmp(known->subject_code, error.subject_code) == 0 && strcmp(known->reason_code, error.reason_code) == 0 && strcmp(known->message, error.message) == 0)
+        {
+            known->count++;
+            return;
+        }
+    }
+    if (bench->error_count < BENCH_DOWNLOAD_ERRORS_MAX)
+    {
+        error.count = 1;
+        bench->errors[bench->error_count++] = error;
+    }
+}
+
+// EID of the n-th simulated card, with the ISO 7064 MOD 97-10 check digits an SM-DP+ may verify
+static void bench_download_eid(char *eid, uint32_t n)
+{
+    uint32_t remainder = 0;
+
+    snprintf(eid, 33, BENCH_DOWNLOAD_EID_PREFIX "%08u00", n % 100000000);
+    for (int i = 0; i < 32; i++)
+    {
+        remainder = (remainder * 10 + (eid[i] - '0')) % 97;
+    }
+    snprintf(eid + 30, 3, "%02u", 98 - remainder);
+}
+
+static int bench_download_start(struct bench_download_slot *slot, const struct bench_download_code *code, const char *imei, uint32_t n)
+{
+    char eid[32 + 1];
+
+    memset(slot, 0, sizeof(*slot));
+    slot->session_start_us = euicc_now_us();
+    slot->stage_start_us = slot->session_start_us;
+
+    bench_download_eid(eid, n);
+    if (euicc_driver_apdu_open(&slot->apdu_interface, "sim", eid))
+    {
+        return -1;
+    }
+
+    slot->ctx.apdu.interface = &slot->apdu_interface;
+    slot->ctx.apdu.segment_size = euicc_ctx.apdu.segment_size;
+    slot->ctx.apdu.timeout_ms = euicc_ctx.apdu.timeout_ms;
+    slot->ctx.apdu.retry_max = euicc_ctx.apdu.retry_max;
+    slot->ctx.http.interface = euicc_ctx.http.interface;
+    slot->ctx.http.timeout_ms = euicc_ctx.http.timeout_ms;
+    slot->ctx.http.no_compression = euicc_ctx.http.no_compression;
+    slot->ctx.http.server_address = code->smdp;
+
+    if (euicc_init(&slot->ctx))
+    {
+        euicc_driver_apdu_close(&slot->apdu_interface, "sim");
+        return -1;
+    }
+    if (euicc_download_session_init(&slot->session, &slot->ctx, code->matchingId, imei, NULL))
+    {
+        euicc_fini(&slot->ctx);
+        euicc_driver_apdu_close(&slot->apdu_interface, "sim");
+        return -1;
+    }
+
+    slot->active = 1;
+    return 0;
+}
+
+static void bench_download_finish(struct bench_download *bench, struct bench_download_slot *slot, int ok)
+{
+    if (ok)
+    {
+        bench_download_stage_done(bench, "session", euicc_now_us() - slot->session_start_us);
+        bench->succeeded++;
+    }
+    else
+    {
+        bench_download_error_add(bench, slot);
+        bench->failed++;
+        // Sessions left open would count against the SM-DP+ in the next run
+        euicc_download_cancel(&slot->ctx, ES10B_CANCEL_SESSION_REASON_POSTPONED);
+    }
+
+    euicc_download_session_free(&slot->session);
+    euicc_http_cleanup(&slot->ctx);
+    euicc_fini(&slot->ctx);
+    euicc_driver_apdu_close(&slot->apdu_interface, "sim");
+    slot->active = 0;
+}
+
+static void bench_download_complete(int ret, uint32_t rcode, uint8_t *rx, uint32_t rx_len, void *userdata)
+{
+    struct bench_download_slot *slot = userdata;
+
+    if (euicc_download_session_http_complete(&slot->session, ret, rcode, rx, rx_len) < 0)
+    {
+        // Out of memory for the copy, the next step fails as if the transport had
+        euicc_download_session_http_complete(&slot->session, -1, 0, NULL, 0);
+    }
+    free(rx);
+    slot->waiting = 0;
+}
+
+// Through submit the requests of every session are in flight at once, a driver without it answers on the spot
+static void bench_download_request(struct bench_download_slot *slot)
+{
+    const struct euicc_http_interface *http = slot->ctx.http.interface;
+    const char *url;
+    const uint8_t *tx;
+    uint32_t tx_len;
+    const char *const *headers;
+    uint32_t rcode = 0;
+    uint8_t *rx = NULL;
+    uint32_t rx_len = 0;
+    int ret;
+
+    euicc_download_session_http_request(&slot->session, &url, &tx, &tx_len, &headers);
+
+    slot->waiting = 1;
+    if (http->submit && http->poll)
+    {
+        if (http->submit(&slot->ctx, url, tx, tx_len, (const char **)headers, NULL, bench_download_complete, slot) < 0)
+        {
+            bench_download_complete(-1, 0, NULL, 0, slot);
+        }
+        return;
+    }
+
+    ret = http->transmit(&slot->ctx, url, &rcode, &rx, &rx_len, tx, tx_len, (const char **)headers);
+    bench_download_complete(ret, rcode, rx, rx_len, slot);
+}
+
+static void bench_download_advance(struct bench_download *bench, struct bench_download_slot *slot)
+{
+    enum euicc_download_session_state state;
+    const char *stage = euicc_download_session_stage2str(&slot->session);
+    uint64_t now;
+
+    state = euicc_download_session_step(&slot->session);
+    now = euicc_now_us();
+
+    if (state == EUICC_DOWNLOAD_SESSION_ERROR)
+    {
+        bench_download_finish(bench, slot, 0);
+        return;
+    }
+
+    if (state == EUICC_DOWNLOAD_SESSION_WANT_HTTP && euicc_download_session_stage2str(&slot->session) == stage)
+    {
+        // The step built its ES9+ request and runs again with the response
+        bench_download_request(slot);
+        return;
+    }
+
+    bench_download_stage_done(bench, stage, now - slot->stage_start_us);
+    slot->stage_start_us = now;
+
+    if (state == EUICC_DOWNLOAD_SESSION_DONE)
+    {
+        bench_download_finish(bench, slot, 1);
+    }
+}
+
+static cJSON *bench_download_latency_json(struct bench_download_stage *stage)
+{
+    cJSON *jlatency;
+
+    if (stage->count == 0)
+    {
+        return cJSON_CreateNull();
+    }
+
+    qsort(stage->latency_ms, stage->count, sizeof(double), bench_download_compare);
+    jlatency = cJSON_CreateObject();
+    cJSON_AddNumberToObject(jlatency, "min", stage->latency_ms[0]);
+    cJSON_AddNumberToObject(jlatency, "p50", bench_download_percentile(stage->latency_ms, stage->count, 50));
+    cJSON_AddNumberToObject(jlatency, "p95", bench_download_percentile(stage->latency_ms, stage->count, 95));
+    cJSON_AddNumberToObject(jlatency, "p99", bench_download_percentile(stage->latency_ms, stage->count, 99));
+    cJSON_AddNumberToObject(jlatency, "max", stage->latency_ms[stage->count - 1]);
+    return jlatency;
+}
+
+static cJSON *bench_download_json(struct bench_download *bench, uint32_t sessions, uint32_t jobs, uint64_t duration_us)
+{
+    cJSON *jdata, *jstages, *jerrors;
+    double seconds = duration_us / 1000000.0;
+
+    jdata = cJSON_CreateObject();
+    cJSON_AddNumberToObject(jdata, "sessions", sessions);
+    cJSON_AddNumberToObject(jdata, "concurrency", jobs);
+    cJSON_AddNumberToObject(jdata, "succeeded", bench->succeeded);
+    cJSON_AddNumberToObject(jdata, "failed", bench->failed);
+    cJSON_AddNumberToObject(jdata, "error_rate", sessions ? (double)bench->failed / sessions : 0);
+    cJSON_AddNumberToObject(jdata, "duration_s", seconds);
+    cJSON_AddNumberToObject(jdata, "sessions_per_second", seconds > 0 ? bench->succeeded / seconds : 0);
+    cJSON_AddItemToObject(jdata, "session_latency_ms", bench_download_latency_json(bench_download_stage_find(bench, "session")));
+
+    jstages = cJSON_AddArrayToObject(jdata, "stages");
+    for (uint32_t i = 0; i + 1 < BENCH_DOWNLOAD_STAGE_COUNT; i++)
+    {
+        cJSON *jstage = cJSON_CreateObject();
+
+        cJSON_AddStringToObject(jstage, "name", bench_download_stages[i]);
+        cJSON_AddNumberToObject(jstage, "count", bench->stages[i].count);
+        cJSON_AddNumberToObject(jstage, "failures", bench->stages[i].failures);
+        cJSON_AddItemToObject(jstage, "latency_ms", bench_download_latency_json(&bench->stages[i]));
+        cJSON_AddItemToArray(jstages, jstage);
+    }
+
+    jerrors = cJSON_AddArrayToObject(jdata, "errors");
+    for (uint32_t i = 0; i < bench->error_count; i++)
+    {
+        const struct bench_download_error *error = &bench->errors[i];
+        cJSON *jerror = cJSON_CreateObject();
+
+        cJSON_AddStringToObject(jerror, "stage", error->stage);
+        cJSON_AddStringOrNullToObject(jerror, "subjectCode", error->subject_code[0] ? error->subject_code : NULL);
+        cJSON_AddStringOrNullToObject(jerror, "reasonCode", error->reason_code[0] ? error->reason_code : NULL);
+        cJSON_AddStringOrNullToObject(jerror, "message", error->message[0] ? error->message : NULL);
+        cJSON_AddNumberToObject(jerror, "count", error->count);
+        cJSON_AddNumberToObject(jerror, "rate", (double)error->count / sessions);
+        cJSON_AddItemToArray(jerrors, jerror);
+    }
+
+    return jdata;
+}
+
+// Activation codes become SM-DP+ and matching ID, any other line is a matching ID for -s
+static int bench_download_codes_read(const char *path, const char *smdp, struct bench_download_code **codes, uint32_t *count)
+{
+    char line[BENCH_DOWNLOAD_LINE_MAX];
+    FILE *fp;
+    int fret = 0;
+
+    fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        struct bench_download_code *codes_new;
+        struct bench_download_code code = {0};
+        char *token = line;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0')
+        {
+            continue;
+        }
+        if (strncmp(token, "LPA:", 4) == 0)
+        {
+            token += 4;
+        }
+        if (strncmp(token, "1$", 2) == 0)
+        {
+            char *address = token + 2;
+            char *matchingId = strchr(address, '$');
+
+            if (matchingId)
+            {
+                *matchingId++ = '\0';
+                matchingId[strcspn(matchingId, "$")] = '\0';
+            }
+            code.smdp = strdup(address);
+            code.matchingId = matchingId && matchingId[0] ? strdup(matchingId) : NULL;
+        }
+        else
+        {
+            code.smdp = smdp ? strdup(smdp) : NULL;
+            code.matchingId = strdup(token);
+        }
+        if (code.smdp == NULL)
+        {
+            free(code.matchingId);
+            goto err;
+        }
+
+        codes_new = realloc(*codes, (*count + 1) * sizeof(struct bench_download_code));
+        if (codes_new == NULL)
+        {
+            free(code.smdp);
+            free(code.matchingId);
+            goto err;
+        }
+        *codes = codes_new;
+        (*codes)[(*count)++] = code;
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    if (fp != stdin)
+    {
+        fclose(fp);
+    }
+    return fret;
+}
+
+static int applet_main(int argc, char **argv)
+{
+    int fret = 0;
+    int opt;
+    const char *smdp = NULL;
+    const char *matchingId = NULL;
+    const char *codes_path = NULL;
+    uint32_t jobs = BENCH_DOWNLOAD_JOBS_DEFAULT;
+    uint32_t sessions = 0;
+    struct bench_download_code *codes = NULL;
+    uint32_t code_count = 0;
+    struct bench_download_slot *slots = NULL;
+    struct bench_download bench = {0};
+    uint32_t started = 0, active;
+    uint64_t start_us;
+    cJSON *jdata = NULL;
+
+    opt = getopt(argc, argv, opt_string);
+    while (opt != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            smdp = optarg;
+            break;
+        case 'm':
+            matchingId = optarg;
+            break;
+        case 'q':
+            codes_path = optarg;
+            break;
+        case 'i':
+            bench.imei = optarg;
+            break;
+        case 'j':
+            jobs = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            sessions = strtoul(optarg, NULL, 0);
+            break;
+        case 'h':
+        case '?':
+            printf("Usage: %s [OPTIONS]\r\n", argv[0]);
+            printf("\t -s SM-DP+ Domain\r\n");
+            printf("\t -m Matching ID, used by every session\r\n");
+            printf("\t -q File of matching IDs or activation codes, one per line, or - for standard input. Sessions take them in turn.\r\n");
+            printf("\t -i IMEI\r\n");
+            printf("\t -j Sessions in flight at once [default: %d]\r\n", BENCH_DOWNLOAD_JOBS_DEFAULT);
+            printf("\t -n Sessions in total [default: one per line of -q, otherwise %d]\r\n", BENCH_DOWNLOAD_SESSIONS_DEFAULT);
+            printf("\t -h This help info\r\n");
+            return -1;
+        }
+        opt = getopt(argc, argv, opt_string);
+    }
+
+    if (jobs == 0 || jobs > BENCH_DOWNLOAD_JOBS_MAX)
+    {
+        jprint_error("bench", "concurrency out of range");
+        return -1;
+    }
+
+    if (codes_path)
+    {
+        if (bench_download_codes_read(codes_path, smdp, &codes, &code_count) < 0)
+        {
+            jprint_error("bench", "cannot read the activation codes, or a matching ID without -s");
+            goto err;
+        }
+    }
+    else if (smdp)
+    {
+        codes = calloc(1, sizeof(struct bench_download_code));
+        if (codes == NULL || (codes->smdp = strdup(smdp)) == NULL || (matchingId && (codes->matchingId = strdup(matchingId)) == NULL))
+        {
+            jprint_error("bench", "out of memory");
+            goto err;
+        }
+        code_count = 1;
+    }
+    if (code_count == 0)
+    {
+        jprint_error("bench", "smdp is null");
+        goto err;
+    }
+    if (sessions == 0)
+    {
+        sessions = codes_path ? code_count : BENCH_DOWNLOAD_SESSIONS_DEFAULT;
+    }
+
+    slots = calloc(jobs, sizeof(struct bench_download_slot));
+    if (slots == NULL)
+    {
+        jprint_error("bench", "out of memory");
+        goto err;
+    }
+    for (uint32_t i = 0; i < BENCH_DOWNLOAD_STAGE_COUNT; i++)
+    {
+        bench.stages[i].latency_ms = calloc(sessions, sizeof(double));
+        if (bench.stages[i].latency_ms == NULL)
+        {
+            jprint_error("bench", "out of memory");
+            goto err;
+        }
+    }
+
+    // One thread: card steps run in turn, the ES9+ requests of all sessions overlap in the HTTP driver
+    start_us = euicc_now_us();
+    do
+    {
+        int waiting = 0;
+
+        active = 0;
+        for (uint32_t i = 0; i < jobs; i++)
+        {
+            struct bench_download_slot *slot = &slots[i];
+
+            if (!slot->active && started < sessions)
+            {
+                if (bench_download_start(slot, &codes[started % code_count], bench.imei, started) < 0)
+                {
+                    jprint_error("bench", "cannot open a simulated eUICC, lpac needs -DLPAC_WITH_APDU_SIM=ON");
+                    goto err;
+                }
+                started++;
+            }
+            if (slot->active && !slot->waiting)
+            {
+                bench_download_advance(&bench, slot);
+            }
+            active += slot->active;
+            waiting |= slot->active && slot->waiting;
+        }
+
+        if (waiting && euicc_ctx.http.interface->poll(&euicc_ctx, 50) < 0)
+        {
+            jprint_error("bench", "HTTP driver failed");
+            goto err;
+        }
+    } while (active || started < sessions);
+
+    jdata = bench_download_json(&bench, sessions, jobs, euicc_now_us() - start_us);
+    jprint_success(jdata);
+    jdata = NULL;
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    for (uint32_t i = 0; slots && i < jobs; i++)
+    {
+        if (slots[i].active)
+        {
+            euicc_download_session_free(&slots[i].session);
+            euicc_http_cleanup(&slots[i].ctx);
+            euicc_fini(&slots[i].ctx);
+            euicc_driver_apdu_close(&slots[i].apdu_interface, "sim");
+        }
+    }
+    free(slots);
+    for (uint32_t i = 0; i < BENCH_DOWNLOAD_STAGE_COUNT; i++)
+    {
+        free(bench.stages[i].latency_ms);
+    }
+    for (uint32_t i = 0; i < code_count; i++)
+    {
+        free(codes[i].smdp);
+        free(codes[i].matchingId);
+    }
+    free(codes);
+    cJSON_Delete(jdata);
+    return fret;
+}
+
+struct applet_entry applet_bench_download = {
+    .name = "download",
+    .main = applet_main,
+};
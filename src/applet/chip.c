@@ -9,11 +9,13 @@
 #include "chip/info.h"
 #include "chip/defaultsmdp.h"
 #include "chip/purge.h"
+#include "chip/snapshot.h"
 
 static const struct applet_entry *applets[] = {
     &applet_chip_info,
     &applet_chip_defaultsmdp,
     &applet_chip_purge,
+    &applet_chip_snapshot,
     NULL,
 };
 
@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <main.h>
+#include <cache.h>
 
 #include <euicc/es10a.h>
 
@@ -19,6 +20,8 @@ static int applet_main(int argc, char **argv)
 
     smdp = argv[1];
 
+    cache_invalidate();
+
     if (es10a_set_default_dp_address(&euicc_ctx, smdp))
     {
         jprint_error("es10a_set_default_dp_address", NULL);
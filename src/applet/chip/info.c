@@ -5,23 +5,30 @@
 #include <unistd.h>
 #include <string.h>
 #include <main.h>
+#include <cache.h>
 
 #include <euicc/es10a.h>
 #include <euicc/es10c.h>
 #include <euicc/es10c_ex.h>
 
-static int applet_main(int argc, char **argv)
+cJSON *chip_info_json(void)
 {
     char *eid = NULL;
     struct es10a_euicc_configured_addresses addresses;
     struct es10b_rat *ratList;
     struct es10c_ex_euiccinfo2 euiccinfo2;
     cJSON *jaddresses = NULL, *jratList = NULL, *jeuiccinfo2 = NULL, *jdata = NULL;
+    int complete;
+
+    jdata = cache_get("chip");
+    if (jdata)
+    {
+        return jdata;
+    }
 
     if (es10c_get_eid(&euicc_ctx, &eid))
     {
-        jprint_error("es10c_get_eid", NULL);
-        return -1;
+        return NULL;
     }
 
     if (es10a_get_euicc_configured_addresses(&euicc_ctx, &addresses) == 0)
@@ -39,6 +46,9 @@ static int applet_main(int argc, char **argv)
         jeuiccinfo2 = cJSON_CreateObject();
     }
 
+    // Not every eUICC answers GetRAT, the result is only kept when the rest was read
+    complete = jaddresses && jeuiccinfo2;
+
     jdata = cJSON_CreateObject();
     cJSON_AddStringOrNullToObject(jdata, "eidValue", eid);
     free(eid);
@@ -129,21 +139,23 @@ static int applet_main(int argc, char **argv)
 
     if (jratList)
     {
-        while (ratList) {
+        const struct es10b_rat *rat = ratList;
+
+        while (rat) {
             struct cJSON *jrat = cJSON_CreateObject();
-            if (ratList->pprIds)
+            if (rat->pprIds)
             {
                 cJSON *jPPR = cJSON_CreateArray();
-                for (int i = 0; ratList->pprIds[i] != NULL; i++)
+                for (int i = 0; rat->pprIds[i] != NULL; i++)
                 {
-                    cJSON_AddItemToArray(jPPR, cJSON_CreateString(ratList->pprIds[i]));
+                    cJSON_AddItemToArray(jPPR, cJSON_CreateString(rat->pprIds[i]));
                 }
                 cJSON_AddItemToObject(jrat, "pprIds", jPPR);
             }
-            if (ratList->allowedOperators)
+            if (rat->allowedOperators)
             {
                 cJSON *jAllowedOperators = cJSON_CreateArray();
-                const struct es10b_operation_id *rptr = ratList->allowedOperators;
+                const struct es10b_operation_id *rptr = rat->allowedOperators;
                 while (rptr)
                 {
                     cJSON *joperator = cJSON_CreateObject();
@@ -155,22 +167,41 @@ static int applet_main(int argc, char **argv)
                 }
                 cJSON_AddItemToObject(jrat, "allowedOperators", jAllowedOperators);
             }
-            if (ratList->pprFlags)
+            if (rat->pprFlags)
             {
                 cJSON *jFlags = cJSON_CreateArray();
-                for (int i = 0; ratList->pprFlags[i] != NULL; i++)
+                for (int i = 0; rat->pprFlags[i] != NULL; i++)
                 {
-                    cJSON_AddItemToArray(jFlags, cJSON_CreateString(ratList->pprFlags[i]));
+                    cJSON_AddItemToArray(jFlags, cJSON_CreateString(rat->pprFlags[i]));
                 }
                 cJSON_AddItemToObject(jrat, "pprFlags", jFlags);
             }
             cJSON_AddItemToArray(jratList, jrat);
-            ratList = ratList->next;
+            rat = rat->next;
         }
         cJSON_AddItemToObject(jdata, "rulesAuthorisationTable", jratList);
         es10b_rat_list_free_all(ratList);
     }
 
+    if (complete)
+    {
+        cache_put("chip", jdata);
+    }
+
+    return jdata;
+}
+
+static int applet_main(int argc, char **argv)
+{
+    cJSON *jdata;
+
+    jdata = chip_info_json();
+    if (jdata == NULL)
+    {
+        jprint_error("es10c_get_eid", NULL);
+        return -1;
+    }
+
     jprint_success(jdata);
 
     return 0;
@@ -1,5 +1,9 @@
 #pragma once
 
 #include <applet.h>
+#include <cjson/cJSON_ex.h>
 
 extern struct applet_entry applet_chip_info;
+
+// The document chip info prints, from the cache when it holds one, NULL when the EID cannot be read
+cJSON *chip_info_json(void);
@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <main.h>
+#include <cache.h>
 
 #include <euicc/es10c.h>
 
@@ -24,6 +25,8 @@ static int applet_main(int argc, char **argv)
         return -1;
     }
 
+    cache_invalidate();
+
     if ((ret = es10c_euicc_memory_reset(&euicc_ctx)))
     {
         const char *reason;
@@ -0,0 +1,98 @@
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <main.h>
+#include <cache.h>
+
+#include "info.h"
+#include "../profile/list.h"
+#include "../notification/list.h"
+
+static const char *opt_string = "o:h?";
+
+static const struct option long_options[] = {
+    {"only", required_argument, NULL, 'o'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0},
+};
+
+static int applet_main(int argc, char **argv)
+{
+    int fret = 0;
+    int opt;
+    uint8_t operations = 0;
+    cJSON *jchip = NULL, *jprofiles = NULL, *jnotifications = NULL, *jdata = NULL;
+
+    opt = getopt_long(argc, argv, opt_string, long_options, NULL);
+    while (opt != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            if (notification_operations_parse(&operations, optarg) < 0)
+            {
+                jprint_error("chip snapshot", "unknown operation");
+                return -1;
+            }
+            break;
+        case 'h':
+        case '?':
+            printf("Usage: %s [OPTIONS]\r\n", argv[0]);
+            printf("\t -o, --only  Comma separated notification operations to list, out of install,enable,disable,delete\r\n");
+            printf("\t -h, --help  This help info\r\n");
+            return -1;
+        }
+        opt = getopt_long(argc, argv, opt_string, long_options, NULL);
+    }
+
+    // Nothing here changes the card, one probe vouches for both cached entries
+    cache_probe_reuse(1);
+
+    jchip = chip_info_json();
+    if (jchip == NULL)
+    {
+        jprint_error("es10c_get_eid", NULL);
+        goto err;
+    }
+
+    jprofiles = profile_list_brief_json();
+    if (jprofiles == NULL)
+    {
+        jprint_error("es10c_get_profiles_info", NULL);
+        goto err;
+    }
+
+    jnotifications = notification_list_json(operations);
+    if (jnotifications == NULL)
+    {
+        jprint_error("es10b_list_notification", NULL);
+        goto err;
+    }
+
+    jdata = cJSON_CreateObject();
+    cJSON_AddItemToObject(jdata, "chip", jchip);
+    cJSON_AddItemToObject(jdata, "profiles", jprofiles);
+    cJSON_AddItemToObject(jdata, "notifications", jnotifications);
+    jchip = jprofiles = jnotifications = NULL;
+
+    jprint_success(jdata);
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    cache_probe_reuse(0);
+    cJSON_Delete(jchip);
+    cJSON_Delete(jprofiles);
+    cJSON_Delete(jnotifications);
+    return fret;
+}
+
+struct applet_entry applet_chip_snapshot = {
+    .name = "snapshot",
+    .main = applet_main,
+};
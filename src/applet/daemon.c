@@ -0,0 +1,1127 @@
+#include "daemon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <main.h>
+#include <driver.h>
+#include <heap.h>
+#include <metrics.h>
+#include <outbox.h>
+
+#ifndef WIN32
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#define DAEMON_SOCKET_NAME "lpac.sock"
+#define DAEMON_REQUEST_MAX (64 * 1024)
+#define DAEMON_ARGV_MAX 64
+#define DAEMON_OUTBOX_INTERVAL 60
+#define DAEMON_DEVICES_MAX 16
+#define DAEMON_QUEUE_MAX 64
+#define DAEMON_REPLIES_MAX 16
+#define DAEMON_READ_TIMEOUT_MS 2000
+
+#ifndef WIN32
+static volatile sig_atomic_t daemon_running = 1;
+
+// With -d, one driver instance and context per device, swapped in for the requests naming it
+struct daemon_device
+{
+    const char *name;
+    struct euicc_apdu_interface interface;
+    struct euicc_ctx ctx;
+    int inited;
+};
+
+static struct daemon_device daemon_devices[DAEMON_DEVICES_MAX];
+static int daemon_devices_count = 0;
+
+enum daemon_priority
+{
+    DAEMON_PRIORITY_INTERACTIVE,
+    DAEMON_PRIORITY_BACKGROUND,
+};
+
+static const char *daemon_priority_names[] = {"interactive", "background"};
+
+// How a subcommand is scheduled. Anything not listed is interactive and treated as a session.
+struct daemon_command
+{
+    const char *applet;
+    const char *subcommand;
+    enum daemon_priority priority;
+    // A read whose last reply may answer it while the card is busy with another request
+    int cacheable;
+    // Holds an ES10b session or the HTTP state of the context, so never runs inside another request
+    int session;
+};
+
+static const struct daemon_command daemon_commands[] = {
+    {"chip", "info", DAEMON_PRIORITY_INTERACTIVE, 1, 0},
+    {"chip", "defaultsmdp", DAEMON_PRIORITY_INTERACTIVE, 0, 0},
+    {"chip", "purge", DAEMON_PRIORITY_INTERACTIVE, 0, 0},
+    {"profile", "list", DAEMON_PRIORITY_INTERACTIVE, 1, 0},
+    {"profile", "enable", DAEMON_PRIORITY_INTERACTIVE, 0, 0},
+    {"profile", "disable", DAEMON_PRIORITY_INTERACTIVE, 0, 0},
+    {"profile", "delete", DAEMON_PRIORITY_INTERACTIVE, 0, 0},
+    {"profile", "nickname", DAEMON_PRIORITY_INTERACTIVE, 0, 0},
+    {"notification", "list", DAEMON_PRIORITY_INTERACTIVE, 1, 0},
+    {"notification", "remove", DAEMON_PRIORITY_INTERACTIVE, 0, 0},
+    {"notification", "process", DAEMON_PRIORITY_BACKGROUND, 0, 1},
+    {"notification", "deliver", DAEMON_PRIORITY_BACKGROUND, 0, 1},
+    {NULL, NULL, DAEMON_PRIORITY_INTERACTIVE, 0, 0},
+};
+
+// A request read from its client, waiting for the card or running on it
+struct daemon_request
+{
+    int fd;
+    int argc;
+    char *argv[DAEMON_ARGV_MAX];
+    struct daemon_device *device;
+    enum daemon_priority priority;
+    int cacheable;
+    int session;
+    // Device and argv, to find the reply of an earlier run
+    char *key;
+    uint64_t queued_us;
+};
+
+// Served by priority, in arrival order within one
+static struct daemon_request *daemon_queue[DAEMON_QUEUE_MAX];
+static int daemon_queue_count = 0;
+// The outermost request on the card, and whether another one runs inside it right now
+static struct daemon_request *daemon_current = NULL;
+static uint64_t daemon_current_start_us;
+static int daemon_nested = 0;
+static int daemon_listen_fd = -1;
+static int (*daemon_cancel_next)(struct euicc_ctx *ctx) = NULL;
+static void (*daemon_boundary_next)(struct euicc_ctx *ctx) = NULL;
+
+// The last successful reply of each cacheable request since the card last changed
+struct daemon_reply
+{
+    char *key;
+    char *data;
+    size_t len;
+};
+
+static struct daemon_reply daemon_replies[DAEMON_REPLIES_MAX];
+static int daemon_replies_count = 0;
+
+struct daemon_stdout
+{
+    int fd;
+    struct jprint_state jprint;
+};
+
+static void daemon_signal_handler(int signo)
+{
+    daemon_running = 0;
+}
+
+// Reads one request line (terminated by '\n' or EOF) from the client, as many bytes at a time as have arrived.
+// A connection carries a single request, anything after its line is dropped.
+static int daemon_read_request(int fd, char **line)
+{
+    char *buf = NULL;
+    char *newline = NULL;
+    uint32_t len = 0;
+    uint32_t cap = 256;
+    ssize_t ret;
+
+    buf = malloc(cap);
+    if (buf == NULL)
+    {
+        goto err;
+    }
+
+    while (newline == NULL)
+    {
+        if (len + 1 >= cap)
+        {
+            char *buf_new;
+
+            if (cap >= DAEMON_REQUEST_MAX)
+            {
+                goto err;
+            }
+            cap *= 2;
+            buf_new = realloc(buf, cap);
+            if (buf_new == NULL)
+            {
+                goto err;
+            }
+            buf = buf_new;
+        }
+
+        // Requests are also taken while the card is busy with another one, so a silent client must not hold it up
+        {
+            struct pollfd pfd = {
+                .fd = fd,
+                .events = POLLIN,
+            };
+
+            ret = poll(&pfd, 1, DAEMON_READ_TIMEOUT_MS);
+            if (ret < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (ret <= 0)
+            {
+                goto err;
+            }
+        }
+
+        ret = read(fd, buf + len, cap - len - 1);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            break;
+        }
+        newline = memchr(buf + len, '\n', ret);
+        len += ret;
+    }
+
+    if (newline)
+    {
+        len = newline - buf;
+    }
+    buf[len] = '\0';
+    buf[strcspn(buf, "\r\n")] = '\0';
+
+    *line = buf;
+    return 0;
+
+err:
+    free(buf);
+    *line = NULL;
+    return -1;
+}
+
+// {"argv":["profile","list"]}, {"device":"2","argv":["profile","list"]} with -d, "priority" overrides the one the
+// subcommand gets by default
+static int daemon_parse_request(const char *line, int *argc, char **argv, int argv_max, char **device, int *priority)
+{
+    cJSON *jroot = NULL;
+    cJSON *jargv = NULL;
+    cJSON *jitem = NULL;
+    cJSON *jdevice = NULL;
+    cJSON *jpriority = NULL;
+
+    *argc = 0;
+    *device = NULL;
+    *priority = -1;
+
+    jroot = cJSON_Parse(line);
+    if (jroot == NULL)
+    {
+        goto err;
+    }
+
+    jargv = cJSON_GetObjectItem(jroot, "argv");
+    if (!cJSON_IsArray(jargv))
+    {
+        goto err;
+    }
+
+    argv[(*argc)++] = strdup("lpac");
+    cJSON_ArrayForEach(jitem, jargv)
+    {
+        if (!cJSON_IsString(jitem))
+        {
+            goto err;
+        }
+        if (*argc >= argv_max - 1)
+        {
+            goto err;
+        }
+        argv[(*argc)++] = strdup(jitem->valuestring);
+    }
+    argv[*argc] = NULL;
+
+    for (int i = 0; i < *argc; i++)
+    {
+        if (argv[i] == NULL)
+        {
+            goto err;
+        }
+    }
+
+    jdevice = cJSON_GetObjectItem(jroot, "device");
+    if (jdevice)
+    {
+        if (!cJSON_IsString(jdevice) || (*device = strdup(jdevice->valuestring)) == NULL)
+        {
+            goto err;
+        }
+    }
+
+    jpriority = cJSON_GetObjectItem(jroot, "priority");
+    if (jpriority)
+    {
+        if (!cJSON_IsString(jpriority))
+        {
+            goto err;
+        }
+        for (int i = 0; i < (int)(sizeof(daemon_priority_names) / sizeof(daemon_priority_names[0])); i++)
+        {
+            if (strcmp(jpriority->valuestring, daemon_priority_names[i]) == 0)
+            {
+                *priority = i;
+            }
+        }
+        if (*priority < 0)
+        {
+            goto err;
+        }
+    }
+
+    cJSON_Delete(jroot);
+    return 0;
+
+err:
+    cJSON_Delete(jroot);
+    for (int i = 0; i < *argc; i++)
+    {
+        free(argv[i]);
+    }
+    *argc = 0;
+    free(*device);
+    *device = NULL;
+    return -1;
+}
+
+// The first device unless the request names one, NULL for a name not given to -d
+static struct daemon_device *daemon_find_device(const char *name)
+{
+    if (name == NULL)
+    {
+        return &daemon_devices[0];
+    }
+    for (int i = 0; i < daemon_devices_count; i++)
+    {
+        if (strcmp(daemon_devices[i].name, name) == 0)
+        {
+            return &daemon_devices[i];
+        }
+    }
+    return NULL;
+}
+
+static int daemon_stdout_push(int fd, struct daemon_stdout *saved)
+{
+    fflush(stdout);
+    saved->fd = dup(STDOUT_FILENO);
+    if (saved->fd < 0)
+    {
+        return -1;
+    }
+    if (dup2(fd, STDOUT_FILENO) < 0)
+    {
+        close(saved->fd);
+        return -1;
+    }
+    jprint_state_save(&saved->jprint);
+    return 0;
+}
+
+static void daemon_stdout_pop(struct daemon_stdout *saved)
+{
+    fflush(stdout);
+    jprint_state_restore(&saved->jprint);
+    dup2(saved->fd, STDOUT_FILENO);
+    close(saved->fd);
+}
+
+static void daemon_write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t ret = write(fd, data, len);
+
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return;
+        }
+        data += ret;
+        len -= ret;
+    }
+}
+
+static void daemon_reply_error(int fd, const char *detail)
+{
+    struct daemon_stdout saved;
+
+    if (daemon_stdout_push(fd, &saved) == 0)
+    {
+        jprint_error("daemon", detail);
+        daemon_stdout_pop(&saved);
+    }
+}
+
+static void daemon_request_free(struct daemon_request *request)
+{
+    if (request == NULL)
+    {
+        return;
+    }
+    if (request->fd >= 0)
+    {
+        close(request->fd);
+    }
+    for (int i = 0; i < request->argc; i++)
+    {
+        free(request->argv[i]);
+    }
+    free(request->key);
+    free(request);
+}
+
+static cJSON *daemon_request_json(const struct daemon_request *request, uint64_t now_us, uint64_t since_us)
+{
+    cJSON *jrequest = cJSON_CreateObject();
+    cJSON *jargv = cJSON_AddArrayToObject(jrequest, "argv");
+
+    for (int i = 1; i < request->argc; i++)
+    {
+        cJSON_AddItemToArray(jargv, cJSON_CreateString(request->argv[i]));
+    }
+    if (request->device)
+    {
+        cJSON_AddStringToObject(jrequest, "device", request->device->name);
+    }
+    cJSON_AddStringToObject(jrequest, "priority", daemon_priority_names[request->priority]);
+    cJSON_AddNumberToObject(jrequest, request == daemon_current ? "running_ms" : "wait_ms", (now_us - since_us) / 1000.0);
+    return jrequest;
+}
+
+// daemon status: the request on the card and the queue behind it
+static void daemon_reply_status(int fd)
+{
+    struct daemon_stdout saved;
+    cJSON *jdata;
+    cJSON *jqueue;
+    uint64_t now = euicc_now_us();
+
+    jdata = cJSON_CreateObject();
+    if (daemon_current)
+    {
+        cJSON_AddItemToObject(jdata, "running", daemon_request_json(daemon_current, now, daemon_current_start_us));
+    }
+    else
+    {
+        cJSON_AddNullToObject(jdata, "running");
+    }
+    cJSON_AddNumberToObject(jdata, "depth", daemon_queue_count);
+    jqueue = cJSON_AddArrayToObject(jdata, "queue");
+    for (int i = 0; i < daemon_queue_count; i++)
+    {
+        cJSON_AddItemToArray(jqueue, daemon_request_json(daemon_queue[i], now, daemon_queue[i]->queued_us));
+    }
+    cJSON_AddNumberToObject(jdata, "cached_replies", daemon_replies_count);
+
+    if (daemon_stdout_push(fd, &saved) == 0)
+    {
+        jprint_success(jdata);
+        daemon_stdout_pop(&saved);
+    }
+    else
+    {
+        cJSON_Delete(jdata);
+    }
+}
+
+static struct daemon_reply *daemon_reply_find(const char *key)
+{
+    for (int i = 0; i < daemon_replies_count; i++)
+    {
+        if (strcmp(daemon_replies[i].key, key) == 0)
+        {
+            return &daemon_replies[i];
+        }
+    }
+    return NULL;
+}
+
+static void daemon_reply_store(const char *key, char *data, size_t len)
+{
+    struct daemon_reply *reply = daemon_reply_find(key);
+
+    if (reply == NULL)
+    {
+        if (daemon_replies_count >= DAEMON_REPLIES_MAX)
+        {
+            free(data);
+            return;
+        }
+        reply = &daemon_replies[daemon_replies_count];
+        reply->key = strdup(key);
+        if (reply->key == NULL)
+        {
+            free(data);
+            return;
+        }
+        reply->data = NULL;
+        daemon_replies_count++;
+    }
+    free(reply->data);
+    reply->data = data;
+    reply->len = len;
+}
+
+static void daemon_replies_clear(void)
+{
+    for (int i = 0; i < daemon_replies_count; i++)
+    {
+        free(daemon_replies[i].key);
+        free(daemon_replies[i].data);
+    }
+    daemon_replies_count = 0;
+}
+
+static void daemon_request_classify(struct daemon_request *request)
+{
+    const char *applet = request->argc > 1 ? request->argv[1] : "";
+    const char *subcommand = request->argc > 2 ? request->argv[2] : "";
+
+    request->priority = DAEMON_PRIORITY_INTERACTIVE;
+    request->cacheable = 0;
+    request->session = 1;
+    for (const struct daemon_command *command = daemon_commands; command->applet; command++)
+    {
+        if (strcmp(command->applet, applet) == 0 && strcmp(command->subcommand, subcommand) == 0)
+        {
+            request->priority = command->priority;
+            request->cacheable = command->cacheable;
+            request->session = command->session;
+            break;
+        }
+    }
+
+    // profile list --watch keeps streaming, its events have to reach the client as they come
+    for (int i = 3; i < request->argc && request->cacheable; i++)
+    {
+        if (strcmp(request->argv[i], "-w") == 0 || strcmp(request->argv[i], "--watch") == 0)
+        {
+            request->cacheable = 0;
+        }
+    }
+}
+
+static char *daemon_request_key(const struct daemon_request *request)
+{
+    size_t len = 1;
+    char *key;
+
+    len += request->device ? strlen(request->device->name) : 0;
+    for (int i = 1; i < request->argc; i++)
+    {
+        len += strlen(request->argv[i]) + 1;
+    }
+
+    key = malloc(len);
+    if (key == NULL)
+    {
+        return NULL;
+    }
+    strcpy(key, request->device ? request->device->name : "");
+    for (int i = 1; i < request->argc; i++)
+    {
+        strcat(key, "\x1f");
+        strcat(key, request->argv[i]);
+    }
+    return key;
+}
+
+// Reads a request from a new client, and answers it right away when it needs no card, queues it otherwise
+static void daemon_take_request(int fd)
+{
+    struct daemon_request *request = NULL;
+    struct daemon_reply *reply;
+    char *line = NULL;
+    char *device_name = NULL;
+    int priority;
+
+    request = calloc(1, sizeof(*request));
+    if (request == NULL)
+    {
+        close(fd);
+        goto exit;
+    }
+    request->fd = fd;
+    request->queued_us = euicc_now_us();
+
+    if (daemon_read_request(fd, &line) < 0)
+    {
+        goto exit;
+    }
+
+    if (daemon_parse_request(line, &request->argc, request->argv, DAEMON_ARGV_MAX, &device_name, &priority) < 0)
+    {
+        daemon_reply_error(fd, "invalid request");
+        goto exit;
+    }
+
+    if (daemon_devices_count > 0)
+    {
+        request->device = daemon_find_device(device_name);
+        if (request->device == NULL)
+        {
+            daemon_reply_error(fd, "unknown device");
+            goto exit;
+        }
+    }
+    else if (device_name)
+    {
+        daemon_reply_error(fd, "unknown device");
+        goto exit;
+    }
+
+    if (request->argc > 1 && strcmp(request->argv[1], "daemon") == 0)
+    {
+        if (request->argc == 3 && strcmp(request->argv[2], "status") == 0)
+        {
+            daemon_reply_status(fd);
+        }
+        else
+        {
+            daemon_reply_error(fd, "already running");
+        }
+        goto exit;
+    }
+
+    daemon_request_classify(request);
+    if (priority >= 0)
+    {
+        request->priority = priority;
+    }
+    if (request->cacheable && (request->key = daemon_request_key(request)) == NULL)
+    {
+        request->cacheable = 0;
+    }
+
+    if (request->cacheable && daemon_current && (reply = daemon_reply_find(request->key)))
+    {
+        daemon_write_all(fd, reply->data, reply->len);
+        goto exit;
+    }
+
+    if (daemon_queue_count >= DAEMON_QUEUE_MAX)
+    {
+        daemon_reply_error(fd, "queue full");
+        goto exit;
+    }
+
+    daemon_queue[daemon_queue_count++] = request;
+    request = NULL;
+
+exit:
+    daemon_request_free(request);
+    free(device_name);
+    free(line);
+}
+
+static void daemon_accept(void)
+{
+    struct pollfd pfd = {
+        .fd = daemon_listen_fd,
+        .events = POLLIN,
+    };
+
+    while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN))
+    {
+        int client_fd = accept(daemon_listen_fd, NULL, NULL);
+
+        if (client_fd < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        daemon_take_request(client_fd);
+    }
+}
+
+// The next request to run: with outer NULL the first of the highest priority, otherwise the first interactive one
+// that can run inside outer, on the same device and without a session of its own
+static struct daemon_request *daemon_queue_pop(const struct daemon_request *outer)
+{
+    int best = -1;
+    struct daemon_request *request;
+
+    for (int i = 0; i < daemon_queue_count; i++)
+    {
+        request = daemon_queue[i];
+        if (outer)
+        {
+            if (request->priority == DAEMON_PRIORITY_INTERACTIVE && !request->session && request->device == outer->device)
+            {
+                best = i;
+                break;
+            }
+        }
+        else if (best < 0 || request->priority < daemon_queue[best]->priority)
+        {
+            best = i;
+        }
+    }
+    if (best < 0)
+    {
+        return NULL;
+    }
+
+    request = daemon_queue[best];
+    memmove(&daemon_queue[best], &daemon_queue[best + 1], (daemon_queue_count - best - 1) * sizeof(daemon_queue[0]));
+    daemon_queue_count--;
+    return request;
+}
+
+// Collects the reply of a cacheable request, which goes to the client and, when it succeeded, to daemon_replies
+static void daemon_capture_finish(struct daemon_request *request, FILE *capture, int ret)
+{
+    long len;
+    char *data;
+
+    fflush(capture);
+    len = ftell(capture);
+    if (len <= 0 || fseek(capture, 0, SEEK_SET) != 0 || (data = malloc(len)) == NULL)
+    {
+        return;
+    }
+    if (fread(data, 1, len, capture) != (size_t)len)
+    {
+        free(data);
+        return;
+    }
+
+    daemon_write_all(request->fd, data, len);
+    if (ret == 0)
+    {
+        daemon_reply_store(request->key, data, len);
+    }
+    else
+    {
+        free(data);
+    }
+}
+
+static void daemon_run(struct daemon_request *request)
+{
+    int ret;
+    int nested = daemon_current != NULL;
+    struct daemon_stdout saved;
+    FILE *capture = NULL;
+    uint64_t now = euicc_now_us();
+    uint64_t deadline_us = euicc_ctx.deadline_us;
+    int optind_saved = optind;
+    struct euicc_apdu_stats stats_saved = euicc_ctx.apdu.stats;
+    struct heap_stats heap_saved;
+    uint8_t status_saved[sizeof(euicc_ctx.http.status)];
+
+    metrics_request_queued(daemon_priority_names[request->priority], (now - request->queued_us) / 1000000.0, daemon_queue_count);
+
+    if (request->cacheable)
+    {
+        capture = tmpfile();
+    }
+    if (daemon_stdout_push(capture ? fileno(capture) : request->fd, &saved) < 0)
+    {
+        goto exit;
+    }
+
+    if (nested)
+    {
+        memcpy(status_saved, &euicc_ctx.http.status, sizeof(status_saved));
+        heap_stats_save(&heap_saved);
+    }
+    else
+    {
+        if (request->device)
+        {
+            main_swap_euicc(&request->device->ctx, &request->device->inited);
+        }
+        daemon_current = request;
+        daemon_current_start_us = now;
+    }
+
+    main_reset_getopt();
+    euicc_apdu_stats_reset(&euicc_ctx);
+    heap_stats_reset();
+    main_reset_deadline();
+    metrics_request_begin();
+    ret = main_applet_entry(request->argc, request->argv);
+    metrics_request_end(ret);
+
+    if (nested)
+    {
+        // The outer request carries on where it was
+        memcpy(&euicc_ctx.http.status, status_saved, sizeof(status_saved));
+        euicc_ctx.apdu.stats = stats_saved;
+        heap_stats_restore(&heap_saved);
+        euicc_ctx.deadline_us = deadline_us;
+        optind = optind_saved;
+    }
+    else
+    {
+        euicc_http_cleanup(&euicc_ctx);
+        if (request->device)
+        {
+            main_swap_euicc(&request->device->ctx, &request->device->inited);
+        }
+        daemon_current = NULL;
+    }
+
+    daemon_stdout_pop(&saved);
+
+    if (capture)
+    {
+        daemon_capture_finish(request, capture, ret);
+    }
+    else
+    {
+        // Anything but a read may have changed the card
+        daemon_replies_clear();
+    }
+
+exit:
+    if (capture)
+    {
+        fclose(capture);
+    }
+    daemon_request_free(request);
+}
+
+// Takes the requests that arrived while the card is busy, at every APDU and HTTP request and while a download streams
+static int daemon_cancel(struct euicc_ctx *ctx)
+{
+    if (daemon_current)
+    {
+        daemon_accept();
+    }
+    return daemon_cancel_next ? daemon_cancel_next(ctx) : 0;
+}
+
+// Between two ES10x commands of a background request, runs the interactive requests waiting for the same card
+static void daemon_boundary(struct euicc_ctx *ctx)
+{
+    struct daemon_request *request;
+
+    if (!daemon_nested && daemon_current && daemon_current->priority == DAEMON_PRIORITY_BACKGROUND)
+    {
+        daemon_accept();
+        daemon_nested = 1;
+        while ((request = daemon_queue_pop(daemon_current)))
+        {
+            daemon_run(request);
+        }
+        daemon_nested = 0;
+    }
+
+    if (daemon_boundary_next)
+    {
+        daemon_boundary_next(ctx);
+    }
+}
+
+// Starts a background delivery when the outbox grew, and otherwise every DAEMON_OUTBOX_INTERVAL seconds while it is not empty
+static void daemon_outbox_deliver(void)
+{
+    static time_t last;
+    static int last_count;
+    int count;
+
+    if (!outbox_enabled())
+    {
+        return;
+    }
+
+    count = outbox_count();
+    if (count > 0 && (count > last_count || time(NULL) - last >= DAEMON_OUTBOX_INTERVAL))
+    {
+        if (outbox_deliver_background(&euicc_ctx) == 0)
+        {
+            last = time(NULL);
+        }
+    }
+    last_count = count;
+}
+
+static int daemon_listen(const char *path)
+{
+    int fd = -1;
+    int ret;
+    mode_t mask;
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        jprint_error("daemon", "socket path too long");
+        goto err;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        jprint_error("socket", strerror(errno));
+        goto err;
+    }
+
+    // Created owner-only from the start, there is no moment another user could connect before a chmod
+    unlink(path);
+    mask = umask(077);
+    ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (ret < 0)
+    {
+        jprint_error("bind", strerror(errno));
+        goto err;
+    }
+
+    if (listen(fd, 16) < 0)
+    {
+        jprint_error("listen", strerror(errno));
+        goto err;
+    }
+
+    return fd;
+
+err:
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    return -1;
+}
+
+static int daemon_add_devices(char *list)
+{
+    for (char *token = strtok(list, ","); token != NULL; token = strtok(NULL, ","))
+    {
+        if (daemon_devices_count >= DAEMON_DEVICES_MAX)
+        {
+            return -1;
+        }
+        daemon_devices[daemon_devices_count++].name = token;
+    }
+    return 0;
+}
+
+// Every device starts from the settings of euicc_ctx and connects before the first request, like the default one
+static void daemon_open_devices(void)
+{
+    const char *driver_name = getenv("LPAC_APDU");
+
+    for (int i = 0; i < daemon_devices_count; i++)
+    {
+        struct daemon_device *device = &daemon_devices[i];
+
+        if (euicc_driver_apdu_open(&device->interface, driver_name, device->name))
+        {
+            jprint_error("euicc_driver_apdu_open", device->name);
+            exit(-1);
+        }
+        device->ctx = euicc_ctx;
+        device->ctx.apdu.interface = &device->interface;
+        device->inited = 0;
+
+        main_swap_euicc(&device->ctx, &device->inited);
+        main_init_euicc();
+        main_swap_euicc(&device->ctx, &device->inited);
+    }
+}
+
+static void daemon_close_devices(void)
+{
+    const char *driver_name = getenv("LPAC_APDU");
+
+    for (int i = 0; i < daemon_devices_count; i++)
+    {
+        struct daemon_device *device = &daemon_devices[i];
+
+        main_swap_euicc(&device->ctx, &device->inited);
+        main_fini_euicc();
+        main_swap_euicc(&device->ctx, &device->inited);
+        euicc_driver_apdu_close(&device->interface, driver_name);
+    }
+    daemon_devices_count = 0;
+}
+
+static int applet_main(int argc, char **argv)
+{
+    int opt;
+    static const char *opt_string = "s:d:h?";
+    const char *path = NULL;
+    static char path_default[PATH_MAX];
+    int listen_fd;
+    struct sigaction sa;
+
+    // The user's own runtime directory by default, a socket in a shared one could be taken over by another user
+    path = getenv("LPAC_DAEMON_SOCKET");
+    if (path == NULL && getenv("XDG_RUNTIME_DIR"))
+    {
+        snprintf(path_default, sizeof(path_default), "%s/" DAEMON_SOCKET_NAME, getenv("XDG_RUNTIME_DIR"));
+        path = path_default;
+    }
+
+    opt = getopt(argc, argv, opt_string);
+    while (opt != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            path = optarg;
+            break;
+        case 'd':
+            if (daemon_add_devices(optarg) < 0)
+            {
+                jprint_error("daemon", "too many devices");
+                return -1;
+            }
+            break;
+        case 'h':
+        case '?':
+            printf("Usage: %s [OPTIONS]\r\n", argv[0]);
+            printf("\t -s Unix socket path [default: $XDG_RUNTIME_DIR/" DAEMON_SOCKET_NAME "]\r\n");
+            printf("\t -d Comma separated devices to serve, picked per request by \"device\": PC/SC reader indices, AT serial ports, QMI or GBinder slots, may be repeated\r\n");
+            printf("\t -h This help info\r\n");
+            return -1;
+        }
+        opt = getopt(argc, argv, opt_string);
+    }
+
+    if (path == NULL)
+    {
+        jprint_error("daemon", "no socket path, XDG_RUNTIME_DIR is not set");
+        return -1;
+    }
+
+    if (strcmp(getenv("LPAC_APDU") ? getenv("LPAC_APDU") : "", "stdio") == 0)
+    {
+        jprint_error("daemon", "stdio APDU backend is not supported in daemon mode");
+        return -1;
+    }
+
+    // Every device context starts as a copy of euicc_ctx, so the hooks go in first
+    daemon_cancel_next = euicc_ctx.cancel;
+    euicc_ctx.cancel = daemon_cancel;
+    daemon_boundary_next = euicc_ctx.boundary;
+    euicc_ctx.boundary = daemon_boundary;
+
+    if (daemon_devices_count > 0)
+    {
+        daemon_open_devices();
+    }
+    else
+    {
+        main_init_euicc();
+    }
+
+    if (getenv("LPAC_METRICS_FILE"))
+    {
+        metrics_init(&euicc_ctx, getenv("LPAC_METRICS_FILE"));
+    }
+
+    listen_fd = daemon_listen(path);
+    daemon_listen_fd = listen_fd;
+    if (listen_fd < 0)
+    {
+        metrics_fini();
+        daemon_close_devices();
+        return -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+    sa.sa_handler = daemon_signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    jprint_progress("daemon", path);
+
+    daemon_outbox_deliver();
+
+    while (daemon_running)
+    {
+        struct pollfd pfd = {
+            .fd = listen_fd,
+            .events = POLLIN,
+        };
+        struct daemon_request *request;
+        int ret;
+
+        ret = poll(&pfd, 1, outbox_enabled() ? DAEMON_OUTBOX_INTERVAL * 1000 : -1);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret == 0)
+        {
+            daemon_outbox_deliver();
+            continue;
+        }
+
+        if (ret < 0)
+        {
+            jprint_error("poll", strerror(errno));
+            break;
+        }
+
+        daemon_accept();
+        while ((request = daemon_queue_pop(NULL)))
+        {
+            daemon_run(request);
+            daemon_accept();
+        }
+        daemon_outbox_deliver();
+    }
+
+    while (daemon_queue_count > 0)
+    {
+        daemon_request_free(daemon_queue[--daemon_queue_count]);
+    }
+    daemon_replies_clear();
+    close(listen_fd);
+    unlink(path);
+    metrics_fini();
+    daemon_close_devices();
+
+    jprint_success(NULL);
+    return 0;
+}
+#else
+static int applet_main(int argc, char **argv)
+{
+    jprint_error("daemon", "daemon mode is not supported on this platform");
+    return -1;
+}
+#endif
+
+struct applet_entry applet_daemon = {
+    .name = "daemon",
+    .main = applet_main,
+};
@@ -0,0 +1,1151 @@
+#include "fleet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <main.h>
+#include <driver.h>
+
+#ifndef WIN32
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+#define FLEET_JOBS_DEFAULT 4
+#define FLEET_JOBS_MAX 64
+#define FLEET_GATE_LINE_MAX 512
+#define FLEET_QUEUE_LINE_MAX 1024
+// Tries per activation code, and failed downloads after which a card is given up on
+#define FLEET_QUEUE_ATTEMPTS 3
+#define FLEET_QUEUE_DEVICE_FAILURES 3
+// Largest APDU request frame a worker may send, an extended APDU with room to spare
+#define FLEET_FRAME_MAX (1 << 17)
+
+#ifndef WIN32
+/*
+ * A fork-based supervisor: each device gets a worker forked from this process that runs the subcommand with its own
+ * APDU driver instance, and the parent relays the workers' output, admits their SM-DP+ sessions and, with the AT
+ * backend, talks to every modem for them, all from one poll loop.
+ */
+
+// The child's end of its gate socket, -1 outside a fleet worker or without a limit
+static int fleet_gate_fd = -1;
+static uint8_t fleet_gate_held = 0;
+
+// An SM-DP+ that download sessions are admitted to, with its token bucket
+struct fleet_host
+{
+    char *name;
+    int in_flight;
+    double tokens;
+    uint64_t refill_us;
+};
+
+// One line of the -q file: the activation code, optionally followed by a comma and the confirmation code
+struct fleet_code
+{
+    char *activation_code;
+    char *confirmation_code;
+    int attempts;
+    int status;
+    uint8_t running;
+    // Queue position, a failed code goes to the back
+    uint64_t seq;
+    const char *device;
+};
+
+struct fleet_worker
+{
+    const char *device;
+    int index;
+    pid_t pid;
+    int fd;
+    // Parent's end of the worker's standard input, which carries APDU responses while the AT engine runs the modem
+    int apdu_fd;
+    char *line;
+    size_t line_len;
+    int status;
+    // Parent's end of the gate socket, and the host the worker waits for or holds a session at, -1 for none
+    int gate_fd;
+    char gate_line[FLEET_GATE_LINE_MAX];
+    size_t gate_len;
+    int waiting;
+    uint64_t waiting_seq;
+    int holding;
+    // With -q: the code being downloaded, -1 when idle, and whether the card got its profile
+    int code;
+    int failures;
+    uint8_t done;
+};
+
+static int fleet_gate_send(int fd, const char *line)
+{
+    size_t len = strlen(line);
+
+    return send(fd, line, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+// Blocks until the fleet parent admits a session at host. Outside a fleet, or once the parent is gone, admits at once.
+int fleet_gate_acquire(const char *host)
+{
+    char line[FLEET_GATE_LINE_MAX];
+    char c;
+    ssize_t n;
+
+    if (fleet_gate_fd < 0 || fleet_gate_held || strlen(host) + 4 > sizeof(line) || strchr(host, '\n'))
+    {
+        return 0;
+    }
+
+    snprintf(line, sizeof(line), "A %s\n", host);
+    if (fleet_gate_send(fleet_gate_fd, line) < 0)
+    {
+        return 0;
+    }
+    for (;;)
+    {
+        n = recv(fleet_gate_fd, &c, 1, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        if (c == '\n')
+        {
+            fleet_gate_held = 1;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+void fleet_gate_release(void)
+{
+    if (fleet_gate_fd < 0 || !fleet_gate_held)
+    {
+        return;
+    }
+    fleet_gate_send(fleet_gate_fd, "R\n");
+    fleet_gate_held = 0;
+}
+
+// Runs the command against one device, in the forked child
+static int fleet_child(const char *device, const char *driver_name, int argc, char **argv)
+{
+    struct euicc_apdu_interface apdu_interface;
+    int ret;
+
+    // The parent reads JSON lines from the child, whatever it writes itself
+    jprint_format_set("json");
+
+    // The parent's driver instance is left untouched, the child binds its own
+    if (euicc_driver_apdu_open(&apdu_interface, driver_name, device))
+    {
+        jprint_error("euicc_driver_apdu_open", device);
+        return -1;
+    }
+    euicc_ctx.apdu.interface = &apdu_interface;
+
+    main_reset_getopt();
+    ret = main_applet_entry(argc, argv);
+
+    main_fini_euicc();
+    euicc_driver_apdu_close(&apdu_interface, driver_name);
+
+    return ret;
+}
+
+// With apdu, the worker talks to its modem through the parent's AT engine, as the stdio backend in framed mode
+static int fleet_spawn(struct fleet_worker *worker, int gate, int apdu, int argc, char **argv)
+{
+    int fds[2];
+    int gate_fds[2] = {-1, -1};
+    int apdu_fds[2] = {-1, -1};
+
+    fflush(stdout);
+
+    if (pipe(fds) < 0)
+    {
+        return -1;
+    }
+    if (gate && socketpair(AF_UNIX, SOCK_STREAM, 0, gate_fds) < 0)
+    {
+        goto err;
+    }
+    if (apdu && socketpair(AF_UNIX, SOCK_STREAM, 0, apdu_fds) < 0)
+    {
+        goto err;
+    }
+
+    worker->pid = fork();
+    if (worker->pid < 0)
+    {
+        goto err;
+    }
+
+    if (worker->pid == 0)
+    {
+        const char *driver_name = getenv("LPAC_APDU");
+
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        if (gate)
+        {
+            close(gate_fds[0]);
+            fleet_gate_fd = gate_fds[1];
+        }
+        if (apdu)
+        {
+            close(apdu_fds[0]);
+            dup2(apdu_fds[1], STDIN_FILENO);
+            close(apdu_fds[1]);
+            // A queue read from standard input left it at end of file
+            clearerr(stdin);
+            setenv("STDIO_APDU_FRAMED", "1", 1);
+            unsetenv("STDIO_APDU_BATCH");
+            driver_name = "stdio";
+        }
+        exit(fleet_child(worker->device, driver_name, argc, argv) == 0 ? 0 : 1);
+    }
+
+    close(fds[1]);
+    if (gate)
+    {
+        close(gate_fds[1]);
+    }
+    if (apdu)
+    {
+        close(apdu_fds[1]);
+    }
+    worker->apdu_fd = apdu_fds[0];
+    worker->gate_fd = gate_fds[0];
+    worker->gate_len = 0;
+    worker->waiting = -1;
+    worker->holding = -1;
+    worker->fd = fds[0];
+    worker->line = NULL;
+    worker->line_len = 0;
+    return 0;
+
+err:
+    for (int i = 0; i < 2; i++)
+    {
+        close(fds[i]);
+        if (gate_fds[i] >= 0)
+        {
+            close(gate_fds[i]);
+        }
+        if (apdu_fds[i] >= 0)
+        {
+            close(apdu_fds[i]);
+        }
+    }
+    return -1;
+}
+
+// Re-emits one line of child output with the device ID, and the activation code it works on with -q, added
+static void fleet_emit_line(const char *device, const char *activation_code, const char *line)
+{
+    cJSON *jroot;
+
+    if (line[0] == '\0')
+    {
+        return;
+    }
+
+    jroot = cJSON_Parse(line);
+    if (jroot == NULL || !cJSON_IsObject(jroot))
+    {
+        cJSON_Delete(jroot);
+        jprint_line_text(line);
+        return;
+    }
+
+    cJSON_AddStringOrNullToObject(jroot, "device", device);
+    if (activation_code)
+    {
+        cJSON_AddStringOrNullToObject(jroot, "activationCode", activation_code);
+    }
+    jprint_line(jroot);
+}
+
+static int fleet_send_all(int fd, const uint8_t *data, uint32_t data_len)
+{
+    ssize_t n;
+
+    while (data_len > 0)
+    {
+        n = send(fd, data, data_len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        data += n;
+        data_len -= n;
+    }
+    return 0;
+}
+
+// Hands the AT engine's response to the worker as a STDIO_APDU_FRAMED response
+static void fleet_apdu_done(void *userdata, int ecode, const uint8_t *data, uint32_t data_len)
+{
+    struct fleet_worker *worker = userdata;
+    uint8_t header[6 + 4];
+    uint32_t body_len = 4 + data_len;
+
+    if (worker->apdu_fd < 0)
+    {
+        return;
+    }
+
+    header[0] = 0x00;
+    header[1] = 'A';
+    header[2] = body_len >> 24;
+    header[3] = body_len >> 16;
+    header[4] = body_len >> 8;
+    header[5] = body_len;
+    header[6] = (uint32_t)ecode >> 24;
+    header[7] = (uint32_t)ecode >> 16;
+    header[8] = (uint32_t)ecode >> 8;
+    header[9] = (uint32_t)ecode;
+    if (fleet_send_all(worker->apdu_fd, header, sizeof(header)) < 0 || fleet_send_all(worker->apdu_fd, data, data_len) < 0)
+    {
+        close(worker->apdu_fd);
+        worker->apdu_fd = -1;
+    }
+}
+
+// Returns 1 once the worker's output is exhausted. Its JSON lines never start with a zero byte, so APDU request
+// frames, which do, can be told apart from them and go to the AT engine.
+static int fleet_drain(struct fleet_worker *worker, const char *activation_code, struct euicc_driver_at_engine *engine)
+{
+    char buffer[4096];
+    ssize_t n;
+    char *line_new;
+    size_t start = 0;
+    char *end;
+
+    n = read(worker->fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR)
+    {
+        return 0;
+    }
+
+    if (n > 0)
+    {
+        line_new = realloc(worker->line, worker->line_len + n + 1);
+        if (line_new == NULL)
+        {
+            return 1;
+        }
+        worker->line = line_new;
+        memcpy(worker->line + worker->line_len, buffer, n);
+        worker->line_len += n;
+        worker->line[worker->line_len] = '\0';
+
+        while (start < worker->line_len)
+        {
+            char *p = worker->line + start;
+            size_t len = worker->line_len - start;
+
+            if (p[0] == 0x00)
+            {
+                const uint8_t *frame = (const uint8_t *)p;
+                uint32_t body_len;
+
+                if (len < 6)
+                {
+                    break;
+                }
+                body_len = ((uint32_t)frame[2] << 24) | ((uint32_t)frame[3] << 16) | ((uint32_t)frame[4] << 8) | frame[5];
+                if (frame[1] != 'A' || body_len < 1 || body_len > FLEET_FRAME_MAX || worker->apdu_fd < 0)
+                {
+                    // Not a frame after all, the worker gets no more responses and its output is dropped
+                    if (worker->apdu_fd >= 0)
+                    {
+                        close(worker->apdu_fd);
+                        worker->apdu_fd = -1;
+                    }
+                    start = worker->line_len;
+                    break;
+                }
+                if (len < 6 + body_len)
+                {
+                    break;
+                }
+                if (euicc_driver_at_engine_submit(engine, worker->index, frame + 6, body_len, fleet_apdu_done, worker) < 0)
+                {
+                    fleet_apdu_done(worker, -1, NULL, 0);
+                }
+                start += 6 + body_len;
+                continue;
+            }
+
+            end = memchr(p, '\n', len);
+            if (end == NULL)
+            {
+                break;
+            }
+            *end = '\0';
+            p[strcspn(p, "\r")] = '\0';
+            fleet_emit_line(worker->device, activation_code, p);
+            start = end - worker->line + 1;
+        }
+        worker->line_len -= start;
+        memmove(worker->line, worker->line + start, worker->line_len + 1);
+        return 0;
+    }
+
+    if (worker->line_len > 0 && worker->line[0] != 0x00)
+    {
+        worker->line[strcspn(worker->line, "\r")] = '\0';
+        fleet_emit_line(worker->device, activation_code, worker->line);
+    }
+    free(worker->line);
+    worker->line = NULL;
+    worker->line_len = 0;
+    return 1;
+}
+
+static int fleet_host_find(struct fleet_host **hosts, int *hosts_count, const char *name, double burst)
+{
+    struct fleet_host *hosts_new;
+
+    for (int i = 0; i < *hosts_count; i++)
+    {
+        if (strcmp((*hosts)[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+
+    hosts_new = realloc(*hosts, (*hosts_count + 1) * sizeof(struct fleet_host));
+    if (hosts_new == NULL)
+    {
+        return -1;
+    }
+    *hosts = hosts_new;
+    (*hosts)[*hosts_count].name = strdup(name);
+    if ((*hosts)[*hosts_count].name == NULL)
+    {
+        return -1;
+    }
+    (*hosts)[*hosts_count].in_flight = 0;
+    (*hosts)[*hosts_count].tokens = burst;
+    (*hosts)[*hosts_count].refill_us = euicc_now_us();
+    return (*hosts_count)++;
+}
+
+// Gives the worker's session slot back, and forgets that it waits for one
+static void fleet_gate_drop(struct fleet_worker *worker, struct fleet_host *hosts)
+{
+    if (worker->holding >= 0)
+    {
+        hosts[worker->holding].in_flight--;
+        worker->holding = -1;
+    }
+    worker->waiting = -1;
+}
+
+static void fleet_gate_close(struct fleet_worker *worker, struct fleet_host *hosts)
+{
+    if (worker->gate_fd >= 0)
+    {
+        close(worker->gate_fd);
+        worker->gate_fd = -1;
+    }
+    fleet_gate_drop(worker, hosts);
+}
+
+// Handles the lines a worker sent on its gate socket, returns -1 once the socket is closed
+static int fleet_gate_read(struct fleet_worker *worker, struct fleet_host **hosts, int *hosts_count, double burst, uint64_t *seq)
+{
+    ssize_t n;
+    char *start, *end;
+
+    n = recv(worker->gate_fd, worker->gate_line + worker->gate_len, sizeof(worker->gate_line) - 1 - worker->gate_len, 0);
+    if (n < 0 && errno == EINTR)
+    {
+        return 0;
+    }
+    if (n <= 0)
+    {
+        return -1;
+    }
+    worker->gate_len += n;
+    worker->gate_line[worker->gate_len] = '\0';
+
+    start = worker->gate_line;
+    while ((end = strchr(start, '\n')) != NULL)
+    {
+        *end = '\0';
+        if (start[0] == 'A' && start[1] == ' ' && worker->holding < 0)
+        {
+            worker->waiting = fleet_host_find(hosts, hosts_count, start + 2, burst);
+            worker->waiting_seq = (*seq)++;
+            // Out of memory, the session goes ahead unlimited rather than never
+            if (worker->waiting < 0)
+            {
+                fleet_gate_send(worker->gate_fd, "\n");
+            }
+        }
+        else if (start[0] == 'R')
+        {
+            fleet_gate_drop(worker, *hosts);
+        }
+        start = end + 1;
+    }
+    worker->gate_len -= start - worker->gate_line;
+    memmove(worker->gate_line, start, worker->gate_len + 1);
+    if (worker->gate_len == sizeof(worker->gate_line) - 1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Admits waiting sessions, oldest first, as far as each host's limit and token bucket allow. Hosts do not wait for
+// one another, and an admitted session keeps its slot until it is done with the SM-DP+, so sessions partway through
+// are never held up by new ones. Returns how long poll may sleep before a token comes due, -1 for no limit.
+static int fleet_gate_schedule(struct fleet_worker *workers, int count, struct fleet_host *hosts, int hosts_count, int max_in_flight, double rate, double burst)
+{
+    uint64_t now = euicc_now_us();
+    int timeout = -1;
+
+    for (int h = 0; h < hosts_count; h++)
+    {
+        struct fleet_host *host = &hosts[h];
+
+        if (rate > 0)
+        {
+            host->tokens += (now - host->refill_us) * rate / 1000000.0;
+            if (host->tokens > burst)
+            {
+                host->tokens = burst;
+            }
+            host->refill_us = now;
+        }
+
+        for (;;)
+        {
+            struct fleet_worker *worker = NULL;
+
+            for (int i = 0; i < count; i++)
+            {
+                if (workers[i].waiting == h && (worker == NULL || workers[i].waiting_seq < worker->waiting_seq))
+                {
+                    worker = &workers[i];
+                }
+            }
+            if (worker == NULL || (max_in_flight > 0 && host->in_flight >= max_in_flight))
+            {
+                break;
+            }
+            if (rate > 0 && host->tokens < 1)
+            {
+                int wait = (int)((1 - host->tokens) * 1000 / rate) + 1;
+
+                if (timeout < 0 || wait < timeout)
+                {
+                    timeout = wait;
+                }
+                break;
+            }
+
+            if (rate > 0)
+            {
+                host->tokens -= 1;
+            }
+            host->in_flight++;
+            worker->holding = h;
+            worker->waiting = -1;
+            if (fleet_gate_send(worker->gate_fd, "\n") < 0)
+            {
+                fleet_gate_drop(worker, hosts);
+            }
+        }
+    }
+
+    return timeout;
+}
+
+static char *fleet_queue_field(char *field)
+{
+    size_t len;
+
+    field += strspn(field, " \t");
+    len = strlen(field);
+    while (len > 0 && (field[len - 1] == ' ' || field[len - 1] == '\t'))
+    {
+        field[--len] = '\0';
+    }
+    if (len >= 2 && field[0] == '"' && field[len - 1] == '"')
+    {
+        field[len - 1] = '\0';
+        field++;
+    }
+    return field;
+}
+
+// Lines without a '$', such as a header or comments, are not activation codes and skipped
+static int fleet_queue_load(const char *path, struct fleet_code **codes, int *count)
+{
+    FILE *fp;
+    char line[FLEET_QUEUE_LINE_MAX];
+    struct fleet_code *codes_new;
+    char *comma;
+
+    fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        struct fleet_code *code;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || strchr(line, '$') == NULL)
+        {
+            continue;
+        }
+
+        codes_new = realloc(*codes, (*count + 1) * sizeof(struct fleet_code));
+        if (codes_new == NULL)
+        {
+            goto err;
+        }
+        *codes = codes_new;
+        code = &(*codes)[*count];
+        memset(code, 0, sizeof(struct fleet_code));
+        code->status = -1;
+        code->seq = *count;
+
+        comma = strchr(line, ',');
+        if (comma)
+        {
+            *comma = '\0';
+            if (*fleet_queue_field(comma + 1) != '\0' && (code->confirmation_code = strdup(fleet_queue_field(comma + 1))) == NULL)
+            {
+                goto err;
+            }
+        }
+        code->activation_code = strdup(fleet_queue_field(line));
+        (*count)++;
+        if (code->activation_code == NULL)
+        {
+            goto err;
+        }
+    }
+
+    if (fp != stdin)
+    {
+        fclose(fp);
+    }
+    return 0;
+
+err:
+    if (fp != stdin)
+    {
+        fclose(fp);
+    }
+    return -1;
+}
+
+// The code next in the queue that this card has not failed yet, -1 for none
+static int fleet_queue_next(const struct fleet_code *codes, int codes_count, const uint8_t *tried, int devices_count, int device)
+{
+    int best = -1;
+
+    for (int i = 0; i < codes_count; i++)
+    {
+        if (codes[i].status == 0 || codes[i].running || codes[i].attempts >= FLEET_QUEUE_ATTEMPTS || tried[i * devices_count + device])
+        {
+            continue;
+        }
+        if (best < 0 || codes[i].seq < codes[best].seq)
+        {
+            best = i;
+        }
+    }
+    return best;
+}
+
+static int fleet_is_at(void)
+{
+    return strcmp(getenv("LPAC_APDU") ? getenv("LPAC_APDU") : "", "at") == 0;
+}
+
+static int fleet_add_devices(const char ***devices, int *count, char *list)
+{
+    const char **devices_new;
+    char *token;
+
+    for (token = strtok(list, ","); token != NULL; token = strtok(NULL, ","))
+    {
+        devices_new = realloc(*devices, (*count + 1) * sizeof(char *));
+        if (devices_new == NULL)
+        {
+            return -1;
+        }
+        *devices = devices_new;
+        (*devices)[(*count)++] = token;
+    }
+
+    return 0;
+}
+
+static int applet_main(int argc, char **argv)
+{
+    int fret = 0;
+    int opt;
+    static const char *opt_string = "d:j:c:r:q:h?";
+    const char **devices = NULL;
+    int devices_count = 0;
+    int jobs = -1;
+    char *env_devices = NULL;
+    int cmd_argc;
+    char **cmd_argv = NULL;
+    struct fleet_worker *workers = NULL;
+    struct pollfd *pfds = NULL;
+    int next = 0, running = 0;
+    cJSON *jdata = NULL;
+    int max_in_flight = 0;
+    double rate = 0, burst;
+    struct fleet_host *hosts = NULL;
+    int hosts_count = 0;
+    uint64_t seq = 0;
+    const char *queue_path = NULL;
+    struct fleet_code *codes = NULL;
+    int codes_count = 0;
+    uint64_t codes_seq;
+    uint8_t *tried = NULL;
+    char **queue_argv = NULL;
+    struct euicc_driver_at_engine *engine = NULL;
+
+    opt = getopt(argc, argv, opt_string);
+    while (opt != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            if (fleet_add_devices(&devices, &devices_count, optarg) < 0)
+            {
+                goto err;
+            }
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'c':
+            max_in_flight = atoi(optarg);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'q':
+            queue_path = optarg;
+            break;
+        case 'h':
+        case '?':
+            printf("Usage: %s [OPTIONS] -- <command> [parameters]\r\n", argv[0]);
+            printf("\t -d Comma separated devices: PC/SC reader indices, AT serial ports, QMI or GBinder slots, may be repeated\r\n");
+            printf("\t -j Number of devices processed in parallel, one worker process each, 0 for all [default: %d, all for AT]\r\n", FLEET_JOBS_DEFAULT);
+            printf("\t -c Most profile download sessions in flight per SM-DP+ [default: no limit]\r\n");
+            printf("\t -r Most profile download sessions started per second per SM-DP+, in bursts of up to -c [default: no limit]\r\n");
+            printf("\t -q File of activation codes, one per line with an optional confirmation code after a comma, or - for standard input. Each device takes the next code for profile download until one installs.\r\n");
+            printf("\t -h This help info\r\n");
+            free(devices);
+            return -1;
+        }
+        opt = getopt(argc, argv, opt_string);
+    }
+
+    // AT gateways list their modems once, in AT_DEVICE
+    if (devices_count == 0 && fleet_is_at() && getenv("AT_DEVICE"))
+    {
+        env_devices = strdup(getenv("AT_DEVICE"));
+        if (env_devices == NULL || fleet_add_devices(&devices, &devices_count, env_devices) < 0)
+        {
+            goto err;
+        }
+    }
+
+    if (devices_count == 0)
+    {
+        jprint_error("fleet", "no device specified");
+        goto err;
+    }
+
+    if (optind >= argc)
+    {
+        jprint_error("fleet", "no command specified");
+        goto err;
+    }
+
+    if (strcmp(argv[optind], "fleet") == 0 || strcmp(argv[optind], "daemon") == 0)
+    {
+        jprint_error("fleet", "command cannot be run in fleet mode");
+        goto err;
+    }
+
+    if (queue_path && (argc - optind < 2 || strcmp(argv[optind], "profile") != 0 || strcmp(argv[optind + 1], "download") != 0))
+    {
+        jprint_error("fleet", "a queue of activation codes needs profile download");
+        goto err;
+    }
+
+    if (queue_path && fleet_queue_load(queue_path, &codes, &codes_count) < 0)
+    {
+        jprint_error("fleet", "cannot read the activation code queue");
+        goto err;
+    }
+    codes_seq = codes_count;
+
+    if (strcmp(getenv("LPAC_APDU") ? getenv("LPAC_APDU") : "", "stdio") == 0)
+    {
+        jprint_error("fleet", "stdio APDU backend is not supported in fleet mode");
+        goto err;
+    }
+
+    // Every modem is on its own serial link, so a sweep takes as long as the slowest one
+    if (jobs < 0)
+    {
+        jobs = fleet_is_at() ? 0 : FLEET_JOBS_DEFAULT;
+    }
+    if (jobs == 0)
+    {
+        jobs = devices_count;
+    }
+    if (jobs > FLEET_JOBS_MAX)
+    {
+        jobs = FLEET_JOBS_MAX;
+    }
+    if (jobs > devices_count)
+    {
+        jobs = devices_count;
+    }
+
+    // A worker may burst up to its host's in-flight limit, or one session at a time under a bare rate
+    burst = max_in_flight > 0 ? max_in_flight : 1;
+
+    cmd_argc = argc - optind + 1;
+    cmd_argv = malloc((cmd_argc + 1) * sizeof(char *));
+    workers = calloc(devices_count, sizeof(struct fleet_worker));
+    // The AT engine runs every modem from this process, the workers only decode and encode
+    if (fleet_is_at())
+    {
+        engine = euicc_driver_at_engine_new(devices, devices_count);
+    }
+    pfds = calloc(jobs * 2 + devices_count, sizeof(struct pollfd));
+    jdata = cJSON_CreateArray();
+    if (cmd_argv == NULL || workers == NULL || pfds == NULL || jdata == NULL)
+    {
+        goto err;
+    }
+    cmd_argv[0] = "lpac";
+    memcpy(cmd_argv + 1, argv + optind, (argc - optind) * sizeof(char *));
+    cmd_argv[cmd_argc] = NULL;
+
+    // The subcommand with -a <code> [-c <confirmation code>] appended, filled in before each spawn
+    if (queue_path)
+    {
+        tried = calloc(codes_count ? codes_count * devices_count : 1, 1);
+        queue_argv = calloc(cmd_argc + 5, sizeof(char *));
+        if (tried == NULL || queue_argv == NULL)
+        {
+            goto err;
+        }
+        memcpy(queue_argv, cmd_argv, cmd_argc * sizeof(char *));
+    }
+
+    for (int i = 0; i < devices_count; i++)
+    {
+        workers[i].device = devices[i];
+        workers[i].index = i;
+        workers[i].fd = -1;
+        workers[i].apdu_fd = -1;
+        workers[i].gate_fd = -1;
+        workers[i].status = -1;
+        workers[i].waiting = -1;
+        workers[i].holding = -1;
+        workers[i].code = -1;
+    }
+
+    for (;;)
+    {
+        int npfds = 0;
+        int map[FLEET_JOBS_MAX * 2];
+        int timeout;
+        int engine_npfds = 0;
+
+        // Without -q every device runs once in turn. With it, an idle card takes the next code it has not failed,
+        // so fast cards work through the queue while slow ones are still busy.
+        while (running < jobs)
+        {
+            struct fleet_worker *worker = NULL;
+            int code = -1;
+
+            if (queue_path == NULL)
+            {
+                if (next >= devices_count)
+                {
+                    break;
+                }
+                worker = &workers[next++];
+            }
+            else
+            {
+                for (int i = 0; i < devices_count && worker == NULL; i++)
+                {
+                    if (workers[i].fd >= 0 || workers[i].done || workers[i].failures >= FLEET_QUEUE_DEVICE_FAILURES)
+                    {
+                        continue;
+                    }
+                    code = fleet_queue_next(codes, codes_count, tried, devices_count, i);
+                    if (code >= 0)
+                    {
+                        worker = &workers[i];
+                    }
+                }
+                if (worker == NULL)
+                {
+                    break;
+                }
+                worker->code = code;
+                codes[code].running = 1;
+                codes[code].attempts++;
+                codes[code].device = worker->device;
+                tried[code * devices_count + (worker - workers)] = 1;
+                queue_argv[cmd_argc] = "-a";
+                queue_argv[cmd_argc + 1] = codes[code].activation_code;
+                queue_argv[cmd_argc + 2] = codes[code].confirmation_code ? "-c" : NULL;
+                queue_argv[cmd_argc + 3] = codes[code].confirmation_code;
+            }
+
+            if (fleet_spawn(worker, max_in_flight > 0 || rate > 0, engine != NULL, queue_path ? cmd_argc + (codes[code].confirmation_code ? 4 : 2) : cmd_argc, queue_path ? queue_argv : cmd_argv) < 0)
+            {
+                jprint_error("fork", strerror(errno));
+                goto err;
+            }
+            running++;
+        }
+
+        if (running == 0)
+        {
+            break;
+        }
+
+        for (int i = 0; i < devices_count; i++)
+        {
+            if (workers[i].fd < 0)
+            {
+                continue;
+            }
+            pfds[npfds].fd = workers[i].fd;
+            pfds[npfds].events = POLLIN;
+            map[npfds] = i;
+            npfds++;
+            if (workers[i].gate_fd >= 0)
+            {
+                pfds[npfds].fd = workers[i].gate_fd;
+                pfds[npfds].events = POLLIN;
+                map[npfds] = i;
+                npfds++;
+            }
+        }
+
+        timeout = fleet_gate_schedule(workers, devices_count, hosts, hosts_count, max_in_flight, rate, burst);
+        if (engine)
+        {
+            engine_npfds = euicc_driver_at_engine_poll(engine, pfds + npfds, devices_count, &timeout);
+        }
+        if (poll(pfds, npfds + engine_npfds, timeout) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            goto err;
+        }
+        // Modem responses first, the worker waiting for one may have more output behind it
+        if (engine)
+        {
+            euicc_driver_at_engine_dispatch(engine, pfds + npfds, engine_npfds);
+        }
+
+        for (int i = 0; i < npfds; i++)
+        {
+            struct fleet_worker *worker = &workers[map[i]];
+            int wstatus;
+
+            if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                continue;
+            }
+            if (pfds[i].fd != worker->fd)
+            {
+                if (worker->gate_fd >= 0 && fleet_gate_read(worker, &hosts, &hosts_count, burst, &seq) < 0)
+                {
+                    fleet_gate_close(worker, hosts);
+                }
+                continue;
+            }
+            if (!fleet_drain(worker, worker->code >= 0 ? codes[worker->code].activation_code : NULL, engine))
+            {
+                continue;
+            }
+
+            close(worker->fd);
+            worker->fd = -1;
+            if (engine)
+            {
+                euicc_driver_at_engine_reset(engine, worker->index);
+            }
+            if (worker->apdu_fd >= 0)
+            {
+                close(worker->apdu_fd);
+                worker->apdu_fd = -1;
+            }
+            fleet_gate_close(worker, hosts);
+            worker->status = -1;
+            if (waitpid(worker->pid, &wstatus, 0) == worker->pid && WIFEXITED(wstatus))
+            {
+                worker->status = WEXITSTATUS(wstatus);
+            }
+            running--;
+
+            if (worker->code >= 0)
+            {
+                struct fleet_code *code = &codes[worker->code];
+
+                code->running = 0;
+                code->status = worker->status == 0 ? 0 : -1;
+                if (worker->status == 0)
+                {
+                    worker->done = 1;
+                }
+                else
+                {
+                    worker->failures++;
+                    code->seq = codes_seq++;
+                }
+                worker->code = -1;
+            }
+        }
+    }
+
+    // With -q the report is per code, a code no card could take stays at attempts 0
+    for (int i = 0; queue_path && i < codes_count; i++)
+    {
+        cJSON *jresult = cJSON_CreateObject();
+
+        cJSON_AddStringOrNullToObject(jresult, "activationCode", codes[i].activation_code);
+        cJSON_AddNumberToObject(jresult, "code", codes[i].status == 0 ? 0 : -1);
+        cJSON_AddStringOrNullToObject(jresult, "device", codes[i].device);
+        cJSON_AddNumberToObject(jresult, "attempts", codes[i].attempts);
+        cJSON_AddItemToArray(jdata, jresult);
+        if (codes[i].status != 0)
+        {
+            fret = -1;
+        }
+    }
+
+    for (int i = 0; !queue_path && i < devices_count; i++)
+    {
+        cJSON *jresult = cJSON_CreateObject();
+
+        cJSON_AddStringOrNullToObject(jresult, "device", workers[i].device);
+        cJSON_AddNumberToObject(jresult, "code", workers[i].status == 0 ? 0 : -1);
+        cJSON_AddItemToArray(jdata, jresult);
+        if (workers[i].status != 0)
+        {
+            fret = -1;
+        }
+    }
+
+    jprint_success(jdata);
+    jdata = NULL;
+    goto exit;
+
+err:
+    fret = -1;
+    if (workers)
+    {
+        for (int i = 0; i < devices_count; i++)
+        {
+            if (workers[i].gate_fd >= 0)
+            {
+                close(workers[i].gate_fd);
+            }
+            if (workers[i].apdu_fd >= 0)
+            {
+                close(workers[i].apdu_fd);
+            }
+            if (workers[i].fd >= 0)
+            {
+                close(workers[i].fd);
+                waitpid(workers[i].pid, NULL, 0);
+            }
+            free(workers[i].line);
+        }
+    }
+exit:
+    euicc_driver_at_engine_free(engine);
+    cJSON_Delete(jdata);
+    free(pfds);
+    free(workers);
+    free(cmd_argv);
+    free(devices);
+    free(env_devices);
+    for (int i = 0; i < hosts_count; i++)
+    {
+        free(hosts[i].name);
+    }
+    free(hosts);
+    for (int i = 0; i < codes_count; i++)
+    {
+        free(codes[i].activation_code);
+        free(codes[i].confirmation_code);
+    }
+    free(codes);
+    free(tried);
+    free(queue_argv);
+    return fret;
+}
+#else
+int fleet_gate_acquire(const char *host)
+{
+    return 0;
+}
+
+void fleet_gate_release(void)
+{
+}
+
+static int applet_main(int argc, char **argv)
+{
+    jprint_error("fleet", "fleet mode is not supported on this platform");
+    return -1;
+}
+#endif
+
+struct applet_entry applet_fleet = {
+    .name = "fleet",
+    .main = applet_main,
+};
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <applet.h>
+
+extern struct applet_entry applet_fleet;
+
+// Called by fleet workers around the part of a profile download that talks to the SM-DP+, to keep within the
+// per-host limits of lpac fleet -c and -r. Both return at once outside a fleet.
+int fleet_gate_acquire(const char *host);
+void fleet_gate_release(void);
@@ -9,17 +9,23 @@
 #include "notification/list.h"
 #include "notification/process.h"
 #include "notification/remove.h"
+#include "notification/deliver.h"
 
 static const struct applet_entry *applets[] = {
     &applet_notification_list,
     &applet_notification_process,
     &applet_notification_remove,
+    &applet_notification_deliver,
     NULL,
 };
 
 static int applet_main(int argc, char **argv)
 {
-    main_init_euicc();
+    // The outbox is delivered without the eUICC
+    if (argc < 2 || strcmp(argv[1], applet_notification_deliver.name) != 0)
+    {
+        main_init_euicc();
+    }
     return applet_entry(argc, argv, applets);
 }
 
@@ -0,0 +1,47 @@
+#include "deliver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <main.h>
+#include <outbox.h>
+
+// Sends what notification process -q queued, the eUICC is not needed for that
+static int applet_main(int argc, char **argv)
+{
+    uint32_t sent, left;
+    int ret;
+    cJSON *jdata = NULL;
+
+    if (!outbox_enabled())
+    {
+        jprint_error("notification deliver", "LPAC_NOTIFICATION_OUTBOX is not set");
+        return -1;
+    }
+
+    jprint_progress("es9p_handle_notification", NULL);
+    ret = outbox_deliver(&euicc_ctx, &sent, &left);
+    if (ret < 0)
+    {
+        jprint_error("notification deliver", "cannot read or write the outbox");
+        return -1;
+    }
+    if (ret > 0)
+    {
+        jprint_error("notification deliver", "another process is delivering the outbox");
+        return -1;
+    }
+    jprint_progress_http("es9p_handle_notification", NULL);
+
+    jdata = cJSON_CreateObject();
+    cJSON_AddNumberToObject(jdata, "sent", sent);
+    cJSON_AddNumberToObject(jdata, "left", left);
+    jprint_success(jdata);
+
+    return 0;
+}
+
+struct applet_entry applet_notification_deliver = {
+    .name = "deliver",
+    .main = applet_main,
+};
@@ -3,40 +3,137 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <getopt.h>
 #include <main.h>
 
 #include <euicc/es10b.h>
 #include <euicc/tostr.h>
 
-static int applet_main(int argc, char **argv)
+static const char *opt_string = "o:h?";
+
+static const struct option long_options[] = {
+    {"only", required_argument, NULL, 'o'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0},
+};
+
+int notification_operations_parse(uint8_t *operations, const char *str)
 {
-    struct es10b_notification_metadata_list *notifications, *rptr;
-    cJSON *jdata = NULL;
+    static const enum es10b_profile_management_operation known[] = {
+        ES10B_PROFILE_MANAGEMENT_OPERATION_INSTALL,
+        ES10B_PROFILE_MANAGEMENT_OPERATION_ENABLE,
+        ES10B_PROFILE_MANAGEMENT_OPERATION_DISABLE,
+        ES10B_PROFILE_MANAGEMENT_OPERATION_DELETE,
+    };
+    const char *name = str;
 
-    if (es10b_list_notification(&euicc_ctx, &notifications))
+    *operations = 0;
+    while (*name)
     {
-        jprint_error("es10b_list_notification", NULL);
-        return -1;
+        size_t len = strcspn(name, ",");
+        uint32_t i;
+
+        for (i = 0; i < sizeof(known) / sizeof(known[0]); i++)
+        {
+            const char *known_name = euicc_profilemanagementoperation2str(known[i]);
+
+            if (strlen(known_name) == len && strncmp(name, known_name, len) == 0)
+            {
+                *operations |= known[i];
+                break;
+            }
+        }
+        if (i == sizeof(known) / sizeof(known[0]))
+        {
+            return -1;
+        }
+        name += len;
+        if (*name == ',')
+        {
+            name++;
+        }
+    }
+
+    return *operations ? 0 : -1;
+}
+
+static cJSON *list_notification_json(const struct es10b_notification_metadata_list *notification)
+{
+    cJSON *jnotification = NULL;
+
+    jnotification = cJSON_CreateObject();
+    cJSON_AddNumberToObject(jnotification, "seqNumber", notification->seqNumber);
+    cJSON_AddStringOrNullToObject(jnotification, "profileManagementOperation", euicc_profilemanagementoperation2str(notification->profileManagementOperation));
+    cJSON_AddStringOrNullToObject(jnotification, "notificationAddress", notification->notificationAddress);
+    cJSON_AddStringOrNullToObject(jnotification, "iccid", notification->iccid);
+
+    return jnotification;
+}
+
+static int iter_notification(struct es10b_notification_metadata_list *notification, void *userdata)
+{
+    jprint_success_array_append(list_notification_json(notification));
+    es10b_notification_metadata_list_free_all(notification);
+
+    return 0;
+}
+
+static int iter_notification_array(struct es10b_notification_metadata_list *notification, void *userdata)
+{
+    cJSON_AddItemToArray((cJSON *)userdata, list_notification_json(notification));
+    es10b_notification_metadata_list_free_all(notification);
+
+    return 0;
+}
+
+cJSON *notification_list_json(uint8_t operations)
+{
+    cJSON *jnotifications = cJSON_CreateArray();
+
+    if (es10b_list_notification_filtered_iter(&euicc_ctx, operations, iter_notification_array, jnotifications))
+    {
+        cJSON_Delete(jnotifications);
+        return NULL;
     }
+    return jnotifications;
+}
 
-    jdata = cJSON_CreateArray();
-    rptr = notifications;
-    while (rptr)
+static int applet_main(int argc, char **argv)
+{
+    int opt;
+    uint8_t operations = 0;
+
+    opt = getopt_long(argc, argv, opt_string, long_options, NULL);
+    while (opt != -1)
     {
-        cJSON *jnotification = NULL;
+        switch (opt)
+        {
+        case 'o':
+            if (notification_operations_parse(&operations, optarg) < 0)
+            {
+                jprint_error("notification list", "unknown operation");
+                return -1;
+            }
+            break;
+        case 'h':
+        case '?':
+            printf("Usage: %s [OPTIONS]\r\n", argv[0]);
+            printf("\t -o, --only  Comma separated operations to list, out of install,enable,disable,delete, filtered by the eUICC\r\n");
+            printf("\t -h, --help  This help info\r\n");
+            return -1;
+        }
+        opt = getopt_long(argc, argv, opt_string, long_options, NULL);
+    }
 
-        jnotification = cJSON_CreateObject();
-        cJSON_AddNumberToObject(jnotification, "seqNumber", rptr->seqNumber);
-        cJSON_AddStringOrNullToObject(jnotification, "profileManagementOperation", euicc_profilemanagementoperation2str(rptr->profileManagementOperation));
-        cJSON_AddStringOrNullToObject(jnotification, "notificationAddress", rptr->notificationAddress);
-        cJSON_AddStringOrNullToObject(jnotification, "iccid", rptr->iccid);
-        cJSON_AddItemToArray(jdata, jnotification);
+    jprint_success_array_begin();
 
-        rptr = rptr->next;
+    if (es10b_list_notification_filtered_iter(&euicc_ctx, operations, iter_notification, NULL))
+    {
+        jprint_success_array_abort("es10b_list_notification", NULL);
+        return -1;
     }
-    es10b_notification_metadata_list_free_all(notifications);
 
-    jprint_success(jdata);
+    jprint_success_array_end();
 
     return 0;
 }
@@ -1,5 +1,12 @@
 #pragma once
 
 #include <applet.h>
+#include <stdint.h>
+#include <cjson/cJSON_ex.h>
 
 extern struct applet_entry applet_notification_list;
+
+// Comma separated install, enable, disable and delete, as the operations mask of es10b_list_notification_filtered
+int notification_operations_parse(uint8_t *operations, const char *str);
+// The array notification list prints, for operations as above or 0 for all, NULL on error
+cJSON *notification_list_json(uint8_t operations);
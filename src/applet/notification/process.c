@@ -5,69 +5,250 @@
 #include <string.h>
 #include <errno.h>
 #include <main.h>
+#include <outbox.h>
+
+#include "list.h"
 
 #include <euicc/es10b.h>
 #include <euicc/es9p.h>
 
-static int _process_single(uint32_t seqNumber, uint8_t autoremove)
+struct process_item
 {
-    int ret;
+    unsigned long seqNumber;
     char str_seqNumber[11];
     struct es10b_pending_notification notification;
+    int result;
+};
 
-    snprintf(str_seqNumber, sizeof(str_seqNumber), "%u", seqNumber);
+static int _process_remove(struct process_item *item)
+{
+    int ret;
 
-    jprint_progress("es10b_retrieve_notifications_list", str_seqNumber);
-    if (es10b_retrieve_notifications_list(&euicc_ctx, &notification, seqNumber))
+    jprint_progress("es10b_remove_notification_from_list", item->str_seqNumber);
+    if ((ret = es10b_remove_notification_from_list(&euicc_ctx, item->seqNumber)))
     {
-        jprint_error("es10b_retrieve_notifications_list", NULL);
+        const char *reason;
+        switch (ret)
+        {
+        case 1:
+            reason = "seqNumber not found";
+            break;
+        default:
+            reason = "unknown";
+            break;
+        }
+        jprint_error("es10b_remove_notification_from_list", reason);
         return -1;
     }
 
-    euicc_ctx.http.server_address = notification.notificationAddress;
+    return 0;
+}
 
-    jprint_progress("es9p_handle_notification", str_seqNumber);
-    if (es9p_handle_notification(&euicc_ctx, notification.b64_PendingNotification))
+// Moves the notifications into the outbox and off the card, the SM-DP+ gets them from a background process
+static int _process_queue(struct process_item *items, uint32_t count)
+{
+    int fret = 0;
+    unsigned long *seqNumbers = NULL;
+    struct es10b_pending_notification *notifications = NULL;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (items[i].notification.b64_PendingNotification)
+        {
+            continue;
+        }
+        jprint_progress("es10b_retrieve_notifications_list", items[i].str_seqNumber);
+        if (es10b_retrieve_notifications_list(&euicc_ctx, &items[i].notification, items[i].seqNumber))
+        {
+            jprint_error("es10b_retrieve_notifications_list", NULL);
+            goto err;
+        }
+    }
+
+    seqNumbers = malloc((count ? count : 1) * sizeof(unsigned long));
+    notifications = malloc((count ? count : 1) * sizeof(struct es10b_pending_notification));
+    if (seqNumbers == NULL || notifications == NULL)
+    {
+        jprint_error("malloc", NULL);
+        goto err;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        seqNumbers[i] = items[i].seqNumber;
+        notifications[i] = items[i].notification;
+    }
+
+    // Nothing leaves the card before it is on disk
+    jprint_progress("outbox_append", NULL);
+    if (outbox_append(seqNumbers, notifications, count) < 0)
+    {
+        jprint_error("outbox_append", getenv("LPAC_NOTIFICATION_OUTBOX"));
+        goto err;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (_process_remove(&items[i]))
+        {
+            goto err;
+        }
+    }
+
+    outbox_deliver_background(&euicc_ctx);
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    free(seqNumbers);
+    free(notifications);
+    return fret;
+}
+
+// Retrieves whatever is still missing from the card first, sends all notifications in one go, then removes the acknowledged ones
+static int _process_all(struct process_item *items, uint32_t count, uint8_t autoremove)
+{
+    int fret = 0;
+    uint32_t *order = NULL;
+    const char **addresses = NULL;
+    const char **notifications = NULL;
+    int *results = NULL;
+    struct process_item *failed = NULL;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (items[i].notification.b64_PendingNotification)
+        {
+            continue;
+        }
+        jprint_progress("es10b_retrieve_notifications_list", items[i].str_seqNumber);
+        if (es10b_retrieve_notifications_list(&euicc_ctx, &items[i].notification, items[i].seqNumber))
+        {
+            jprint_error("es10b_retrieve_notifications_list", NULL);
+            goto err;
+        }
+    }
+
+    order = malloc(count * sizeof(uint32_t));
+    addresses = malloc(count * sizeof(char *));
+    notifications = malloc(count * sizeof(char *));
+    results = malloc(count * sizeof(int));
+    if (count && (order == NULL || addresses == NULL || notifications == NULL || results == NULL))
+    {
+        jprint_error("malloc", NULL);
+        goto err;
+    }
+
+    // Requests to the same server go out next to each other so they share its connection
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t j = i;
+
+        while (j > 0 && strcmp(items[order[j - 1]].notification.notificationAddress, items[i].notification.notificationAddress) > 0)
+        {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        addresses[i] = items[order[i]].notification.notificationAddress;
+        notifications[i] = items[order[i]].notification.b64_PendingNotification;
+        jprint_progress("es9p_handle_notification", items[order[i]].str_seqNumber);
+    }
+
+    if (es9p_handle_notification_multi(&euicc_ctx, addresses, notifications, results, count))
     {
         jprint_error("es9p_handle_notification", NULL);
-        return -1;
+        goto err;
     }
+    jprint_progress_http("es9p_handle_notification", NULL);
 
-    es10b_pending_notification_free(&notification);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        items[order[i]].result = results[i];
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (items[i].result != 0)
+        {
+            if (failed == NULL)
+            {
+                failed = &items[i];
+            }
+            continue;
+        }
+        if (autoremove && _process_remove(&items[i]))
+        {
+            goto err;
+        }
+    }
 
-    if (!autoremove)
+    if (failed)
     {
-        return 0;
+        jprint_error("es9p_handle_notification", failed->str_seqNumber);
+        goto err;
     }
 
-    jprint_progress("es10b_remove_notification_from_list", str_seqNumber);
-    if ((ret = es10b_remove_notification_from_list(&euicc_ctx, seqNumber)))
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    free(order);
+    free(addresses);
+    free(notifications);
+    free(results);
+    return fret;
+}
+
+struct process_list
+{
+    struct process_item *items;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+static int iter_process_list(struct es10b_notification_metadata_list *notification, void *userdata)
+{
+    struct process_list *list = userdata;
+
+    if (list->count == list->capacity)
     {
-        const char *reason;
-        switch (ret)
+        uint32_t capacity = list->capacity ? list->capacity * 2 : 8;
+        struct process_item *items = realloc(list->items, capacity * sizeof(struct process_item));
+
+        if (items == NULL)
         {
-        case 1:
-            reason = "seqNumber not found";
-            break;
-        default:
-            reason = "unknown";
-            break;
+            es10b_notification_metadata_list_free_all(notification);
+            return -1;
         }
-        jprint_error("es10b_remove_notification_from_list", reason);
-        return -1;
+        memset(items + list->capacity, 0, (capacity - list->capacity) * sizeof(struct process_item));
+        list->items = items;
+        list->capacity = capacity;
     }
+    list->items[list->count++].seqNumber = notification->seqNumber;
+    es10b_notification_metadata_list_free_all(notification);
 
     return 0;
 }
 
 static int applet_main(int argc, char **argv)
 {
-    static const char *opt_string = "arh?";
+    static const char *opt_string = "arqo:h?";
 
     int fret = 0;
     int all = 0;
     int autoremove = 0;
+    int queue = 0;
+    uint8_t operations = 0;
     int argc_seq_offset = 1;
+    struct process_item *items = NULL;
+    uint32_t count = 0;
 
     int opt = getopt(argc, argv, opt_string);
     for (int i = 0; opt != -1; i++)
@@ -80,11 +261,27 @@ static int applet_main(int argc, char **argv)
         case 'r':
             autoremove = 1;
             break;
+        case 'q':
+            queue = 1;
+            break;
+        case 'o':
+            if (notification_operations_parse(&operations, optarg) < 0)
+            {
+                jprint_error("notification process", "unknown operation");
+                return -1;
+            }
+            if (optarg == argv[optind - 1])
+            {
+                argc_seq_offset++;
+            }
+            break;
         case 'h':
         case '?':
             printf("Usage: %s [OPTIONS] [seqNumber_0] [seqNumber_1]...\r\n", argv[0]);
             printf("\t -a All notifications\r\n");
             printf("\t -r Automatically remove processed notifications\r\n");
+            printf("\t -q Move the notifications to LPAC_NOTIFICATION_OUTBOX and off the eUICC, and send them in the background\r\n");
+            printf("\t -o All notifications of these comma separated operations: install,enable,disable,delete\r\n");
             return -1;
         default:
             goto run;
@@ -95,32 +292,72 @@ static int applet_main(int argc, char **argv)
     }
 
 run:
-    if (all)
+    if (operations)
     {
-        struct es10b_notification_metadata_list *notifications, *rptr;
+        struct process_list list = {0};
 
+        // Only the metadata is listed, just the notifications picked are retrieved in full
         jprint_progress("es10b_list_notification", NULL);
-        if (es10b_list_notification(&euicc_ctx, &notifications))
+        if (es10b_list_notification_filtered_iter(&euicc_ctx, operations, iter_process_list, &list))
         {
+            free(list.items);
             jprint_error("es10b_list_notification", NULL);
             return -1;
         }
 
-        rptr = notifications;
-        while (rptr)
+        items = list.items ? list.items : calloc(1, sizeof(struct process_item));
+        count = list.count;
+        if (items == NULL)
         {
-            if (_process_single(rptr->seqNumber, autoremove))
-            {
-                fret = -1;
-                break;
-            }
-            rptr = rptr->next;
+            jprint_error("malloc", NULL);
+            return -1;
+        }
+    }
+    else if (all)
+    {
+        struct es10b_pending_notification_list *notifications, *rptr;
+
+        jprint_progress("es10b_retrieve_notifications_list_all", NULL);
+        if (es10b_retrieve_notifications_list_all(&euicc_ctx, &notifications))
+        {
+            jprint_error("es10b_retrieve_notifications_list_all", NULL);
+            return -1;
+        }
+
+        for (rptr = notifications; rptr; rptr = rptr->next)
+        {
+            count++;
         }
 
-        es10b_notification_metadata_list_free_all(notifications);
+        items = calloc(count ? count : 1, sizeof(struct process_item));
+        if (items == NULL)
+        {
+            es10b_pending_notification_list_free_all(notifications);
+            jprint_error("malloc", NULL);
+            return -1;
+        }
+
+        // The items take over the retrieved notifications
+        count = 0;
+        for (rptr = notifications; rptr; rptr = rptr->next)
+        {
+            items[count].seqNumber = rptr->seqNumber;
+            items[count].notification = rptr->notification;
+            memset(&rptr->notification, 0, sizeof(rptr->notification));
+            count++;
+        }
+
+        es10b_pending_notification_list_free_all(notifications);
     }
     else
     {
+        items = calloc(argc > argc_seq_offset ? argc - argc_seq_offset : 1, sizeof(struct process_item));
+        if (items == NULL)
+        {
+            jprint_error("malloc", NULL);
+            return -1;
+        }
+
         for (int i = argc_seq_offset; i < argc; i++)
         {
             unsigned long seqNumber;
@@ -131,14 +368,35 @@ run:
             {
                 continue;
             }
-            if (_process_single(seqNumber, autoremove))
-            {
-                fret = -1;
-                break;
-            }
+            items[count++].seqNumber = seqNumber;
         }
     }
 
+    for (uint32_t i = 0; i < count; i++)
+    {
+        snprintf(items[i].str_seqNumber, sizeof(items[i].str_seqNumber), "%lu", items[i].seqNumber);
+    }
+
+    if (queue && !outbox_enabled())
+    {
+        jprint_error("notification process", "LPAC_NOTIFICATION_OUTBOX is not set");
+        fret = -1;
+    }
+    else if (queue)
+    {
+        fret = _process_queue(items, count);
+    }
+    else
+    {
+        fret = _process_all(items, count, autoremove);
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        es10b_pending_notification_free(&items[i].notification);
+    }
+    free(items);
+
     if (fret == 0)
     {
         jprint_success(NULL);
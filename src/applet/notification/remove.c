@@ -35,63 +35,107 @@ static int _delete_single(uint32_t seqNumber)
     return 0;
 }
 
+// Everything the one list holds, or below older_than, removed in one batch
+static int _delete_listed(unsigned long older_than)
+{
+    int fret = 0;
+    struct es10b_notification_metadata_array notifications = {0};
+    unsigned long *seqNumbers = NULL;
+    int *results = NULL;
+    uint32_t count = 0;
+
+    jprint_progress("es10b_list_notification", NULL);
+    if (es10b_list_notification_v(&euicc_ctx, &notifications))
+    {
+        jprint_error("es10b_list_notification", NULL);
+        return -1;
+    }
+
+    seqNumbers = malloc((notifications.count ? notifications.count : 1) * sizeof(unsigned long));
+    results = malloc((notifications.count ? notifications.count : 1) * sizeof(int));
+    if (seqNumbers == NULL || results == NULL)
+    {
+        jprint_error("malloc", NULL);
+        goto err;
+    }
+
+    for (uint32_t i = 0; i < notifications.count; i++)
+    {
+        if (older_than && notifications.notifications[i].seqNumber >= older_than)
+        {
+            continue;
+        }
+        seqNumbers[count++] = notifications.notifications[i].seqNumber;
+    }
+
+    jprint_progress("es10b_remove_notification_from_list", NULL);
+    if (es10b_remove_notification_from_list_multi(&euicc_ctx, seqNumbers, results, count))
+    {
+        jprint_error("es10b_remove_notification_from_list", "unknown");
+        goto err;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (results[i])
+        {
+            jprint_error("es10b_remove_notification_from_list", results[i] == 1 ? "seqNumber not found" : "unknown");
+            goto err;
+        }
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    free(seqNumbers);
+    free(results);
+    es10b_notification_metadata_array_free(&notifications);
+    return fret;
+}
+
 static int applet_main(int argc, char **argv)
 {
-    static const char *opt_string = "ah?";
+    static const char *opt_string = "ao:h?";
 
     int fret = 0;
     int all = 0;
-    int argc_seq_offset = 1;
+    unsigned long older_than = 0;
 
     int opt = getopt(argc, argv, opt_string);
-    for (int i = 0; opt != -1; i++)
+    while (opt != -1)
     {
         switch (opt)
         {
         case 'a':
             all = 1;
             break;
+        case 'o':
+            older_than = strtoul(optarg, NULL, 10);
+            if (older_than == 0)
+            {
+                jprint_error("notification remove", "invalid seqNumber");
+                return -1;
+            }
+            break;
         case 'h':
         case '?':
             printf("Usage: %s [OPTIONS] [seqNumber_0] [seqNumber_1]...\r\n", argv[0]);
             printf("\t -a All notifications\r\n");
+            printf("\t -o seqNumber, all notifications older than this one\r\n");
             return -1;
-        default:
-            goto run;
-            break;
         }
-        argc_seq_offset++;
         opt = getopt(argc, argv, opt_string);
     }
 
-run:
-    if (all)
+    if (all || older_than)
     {
-        struct es10b_notification_metadata_list *notifications, *rptr;
-
-        jprint_progress("es10b_list_notification", NULL);
-        if (es10b_list_notification(&euicc_ctx, &notifications))
-        {
-            jprint_error("es10b_list_notification", NULL);
-            return -1;
-        }
-
-        rptr = notifications;
-        while (rptr)
-        {
-            if (_delete_single(rptr->seqNumber))
-            {
-                fret = -1;
-                break;
-            }
-            rptr = rptr->next;
-        }
-
-        es10b_notification_metadata_list_free_all(notifications);
+        fret = _delete_listed(all ? 0 : older_than);
     }
     else
     {
-        for (int i = argc_seq_offset; i < argc; i++)
+        for (int i = optind; i < argc; i++)
         {
             unsigned long seqNumber;
 
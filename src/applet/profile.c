@@ -13,21 +13,29 @@
 #include "profile/delete.h"
 #include "profile/download.h"
 #include "profile/discovery.h"
+#include "profile/switch.h"
+#include "profile/split.h"
 
 static const struct applet_entry *applets[] = {
     &applet_profile_list,
     &applet_profile_enable,
+    &applet_profile_switch,
     &applet_profile_disable,
     &applet_profile_nickname,
     &applet_profile_delete,
     &applet_profile_download,
     &applet_profile_discovery,
+    &applet_profile_split,
     NULL,
 };
 
 static int applet_main(int argc, char **argv)
 {
-    main_init_euicc();
+    // The ES9+ legs of a split download run without the eUICC
+    if (argc < 3 || strcmp(argv[1], applet_profile_split.name) != 0 || strcmp(argv[2], "server") != 0)
+    {
+        main_init_euicc();
+    }
     return applet_entry(argc, argv, applets);
 }
 
@@ -0,0 +1,157 @@
+#include "batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <main.h>
+
+#include <euicc/es10b.h>
+#include <euicc/es9p.h>
+
+struct batch_notification
+{
+    unsigned long seqNumber;
+    char *iccid;
+    struct es10b_pending_notification notification;
+};
+
+struct batch_notifications
+{
+    unsigned long mark;
+    struct batch_notification *items;
+    uint32_t count;
+};
+
+void profile_batch_result(cJSON *jprofiles, const char *id, int ret, const char *reason)
+{
+    cJSON *jprofile = cJSON_CreateObject();
+
+    cJSON_AddStringOrNullToObject(jprofile, "id", id);
+    cJSON_AddNumberToObject(jprofile, "result", ret);
+    cJSON_AddStringOrNullToObject(jprofile, "reason", ret ? reason : NULL);
+    cJSON_AddItemToArray(jprofiles, jprofile);
+}
+
+static int iter_batch_mark(struct es10b_notification_metadata_list *notification, void *userdata)
+{
+    unsigned long *mark = (unsigned long *)userdata;
+
+    if (notification->seqNumber > *mark)
+    {
+        *mark = notification->seqNumber;
+    }
+    es10b_notification_metadata_list_free_all(notification);
+
+    return 0;
+}
+
+int profile_batch_mark(unsigned long *mark)
+{
+    *mark = 0;
+    jprint_progress("es10b_list_notification", NULL);
+    return es10b_list_notification_filtered_iter(&euicc_ctx, 0, iter_batch_mark, mark);
+}
+
+static int iter_batch_notification(struct es10b_notification_metadata_list *notification, void *userdata)
+{
+    struct batch_notifications *ud = (struct batch_notifications *)userdata;
+    int fret = 0;
+
+    if (notification->seqNumber > ud->mark)
+    {
+        struct batch_notification *items;
+
+        items = realloc(ud->items, (ud->count + 1) * sizeof(struct batch_notification));
+        if (items == NULL)
+        {
+            fret = -1;
+        }
+        else
+        {
+            ud->items = items;
+            memset(&items[ud->count], 0, sizeof(struct batch_notification));
+            items[ud->count].seqNumber = notification->seqNumber;
+            items[ud->count].iccid = notification->iccid ? strdup(notification->iccid) : NULL;
+            ud->count++;
+        }
+    }
+
+    es10b_notification_metadata_list_free_all(notification);
+
+    return fret;
+}
+
+void profile_batch_flush(unsigned long mark, uint8_t operations, cJSON *jnotifications)
+{
+    struct batch_notifications ud = {
+        .mark = mark,
+    };
+    const char **addresses = NULL;
+    const char **notifications = NULL;
+    int *results = NULL;
+    char str_seqNumber[11];
+
+    jprint_progress("es10b_list_notification", NULL);
+    if (es10b_list_notification_filtered_iter(&euicc_ctx, operations, iter_batch_notification, &ud) || ud.count == 0)
+    {
+        goto exit;
+    }
+
+    addresses = malloc(ud.count * sizeof(char *));
+    notifications = malloc(ud.count * sizeof(char *));
+    results = malloc(ud.count * sizeof(int));
+    if (addresses == NULL || notifications == NULL || results == NULL)
+    {
+        goto exit;
+    }
+
+    for (uint32_t i = 0; i < ud.count; i++)
+    {
+        snprintf(str_seqNumber, sizeof(str_seqNumber), "%lu", ud.items[i].seqNumber);
+        jprint_progress("es10b_retrieve_notifications_list", str_seqNumber);
+        if (es10b_retrieve_notifications_list(&euicc_ctx, &ud.items[i].notification, ud.items[i].seqNumber))
+        {
+            goto exit;
+        }
+        addresses[i] = ud.items[i].notification.notificationAddress;
+        notifications[i] = ud.items[i].notification.b64_PendingNotification;
+    }
+
+    jprint_progress("es9p_handle_notification", NULL);
+    if (es9p_handle_notification_multi(&euicc_ctx, addresses, notifications, results, ud.count))
+    {
+        goto exit;
+    }
+    jprint_progress_http("es9p_handle_notification", NULL);
+
+    for (uint32_t i = 0; i < ud.count; i++)
+    {
+        cJSON *jnotification = cJSON_CreateObject();
+
+        // Only acknowledged notifications are removed, the rest stays for notification process
+        if (results[i] == 0)
+        {
+            snprintf(str_seqNumber, sizeof(str_seqNumber), "%lu", ud.items[i].seqNumber);
+            jprint_progress("es10b_remove_notification_from_list", str_seqNumber);
+            if (es10b_remove_notification_from_list(&euicc_ctx, ud.items[i].seqNumber))
+            {
+                results[i] = -1;
+            }
+        }
+
+        cJSON_AddNumberToObject(jnotification, "seqNumber", ud.items[i].seqNumber);
+        cJSON_AddStringOrNullToObject(jnotification, "iccid", ud.items[i].iccid);
+        cJSON_AddBoolToObject(jnotification, "sent", results[i] == 0);
+        cJSON_AddItemToArray(jnotifications, jnotification);
+    }
+
+exit:
+    for (uint32_t i = 0; i < ud.count; i++)
+    {
+        free(ud.items[i].iccid);
+        es10b_pending_notification_free(&ud.items[i].notification);
+    }
+    free(ud.items);
+    free(addresses);
+    free(notifications);
+    free(results);
+}
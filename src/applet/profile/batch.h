@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+#include <cjson/cJSON_ex.h>
+
+// Shared by delete, disable and nickname when given several profiles, which go back to back on one ISD-R channel
+
+// Appends {"id","result","reason"} to jprofiles, result being what the ES10c call returned and reason its meaning
+void profile_batch_result(cJSON *jprofiles, const char *id, int ret, const char *reason);
+// Highest seqNumber pending on the eUICC now, 0 when there is none, so the notifications queued from here can be told apart
+int profile_batch_mark(unsigned long *mark);
+// Sends the notifications of operations queued after mark in one pipelined ES9+ round and removes the acknowledged
+// ones, each one goes into jnotifications as {"seqNumber","iccid","sent"}
+void profile_batch_flush(unsigned long mark, uint8_t operations, cJSON *jnotifications);
@@ -1,55 +1,122 @@
 #include "delete.h"
+#include "batch.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <getopt.h>
 #include <main.h>
+#include <cache.h>
 
+#include <euicc/es10b.h>
 #include <euicc/es10c.h>
 
+static const char *opt_string = "fh?";
+
+static const struct option long_options[] = {
+    {"flush-notifications", no_argument, NULL, 'f'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0},
+};
+
+static const char *delete_reason(int ret)
+{
+    switch (ret)
+    {
+    case 1:
+        return "iccid or aid not found";
+    case 2:
+        return "profile not in disabled state";
+    case 3:
+        return "disallowed by policy";
+    case -1:
+        return "internal error, maybe illegal iccid/aid coding";
+    default:
+        return "unknown";
+    }
+}
+
 static int applet_main(int argc, char **argv)
 {
+    int opt;
     int ret;
-    const char *param;
+    int fret = 0;
+    int flush = 0;
+    unsigned long mark = 0;
+    cJSON *jdata = NULL;
+    cJSON *jprofiles = NULL;
+    cJSON *jnotifications = NULL;
 
-    if (argc < 2)
+    opt = getopt_long(argc, argv, opt_string, long_options, NULL);
+    while (opt != -1)
     {
-        printf("Usage: %s [iccid/aid]\n", argv[0]);
-        return -1;
+        switch (opt)
+        {
+        case 'f':
+            flush = 1;
+            break;
+        case 'h':
+        case '?':
+            printf("Usage: %s [OPTIONS] [iccid/aid]...\r\n", argv[0]);
+            printf("\t -f, --flush-notifications  Send the delete notifications afterwards in one go\r\n");
+            printf("\t -h, --help                 This help info\r\n");
+            return -1;
+        }
+        opt = getopt_long(argc, argv, opt_string, long_options, NULL);
     }
 
-    param = argv[1];
+    if (optind >= argc)
+    {
+        printf("Usage: %s [OPTIONS] [iccid/aid]...\n", argv[0]);
+        return -1;
+    }
 
-    ret = es10c_delete_profile(&euicc_ctx, param);
+    cache_invalidate();
 
-    if (ret)
+    // One profile without notifications reports as it always did
+    if (argc - optind == 1 && !flush)
     {
-        const char *reason;
-        switch (ret)
+        ret = es10c_delete_profile(&euicc_ctx, argv[optind]);
+        if (ret)
         {
-        case 1:
-            reason = "iccid or aid not found";
-            break;
-        case 2:
-            reason = "profile not in disabled state";
-            break;
-        case 3:
-            reason = "disallowed by policy";
-            break;
-        case -1:
-            reason = "internal error, maybe illegal iccid/aid coding";
-            break;
-        default:
-            reason = "unknown";
-            break;
+            jprint_error("es10c_delete_profile", delete_reason(ret));
+            return -1;
         }
-        jprint_error("es10c_delete_profile", reason);
+        jprint_success(NULL);
+        return 0;
+    }
+
+    if (flush && profile_batch_mark(&mark))
+    {
+        jprint_error("es10b_list_notification", NULL);
         return -1;
     }
 
-    jprint_success(NULL);
+    // A failed profile does not stop the rest, the summary tells which ones went through
+    jprofiles = cJSON_CreateArray();
+    for (int i = optind; i < argc; i++)
+    {
+        jprint_progress("es10c_delete_profile", argv[i]);
+        ret = es10c_delete_profile(&euicc_ctx, argv[i]);
+        if (ret)
+        {
+            fret = -1;
+        }
+        profile_batch_result(jprofiles, argv[i], ret, delete_reason(ret));
+    }
+
+    jnotifications = cJSON_CreateArray();
+    if (flush)
+    {
+        profile_batch_flush(mark, ES10B_PROFILE_MANAGEMENT_OPERATION_DELETE, jnotifications);
+    }
+
+    jdata = cJSON_CreateObject();
+    cJSON_AddItemToObject(jdata, "profiles", jprofiles);
+    cJSON_AddItemToObject(jdata, "notifications", jnotifications);
+    jprint_success(jdata);
 
-    return 0;
+    return fret;
 }
 
 struct applet_entry applet_profile_delete = {
@@ -1,63 +1,133 @@
 #include "disable.h"
+#include "batch.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <getopt.h>
 #include <main.h>
+#include <cache.h>
 
+#include <euicc/es10b.h>
 #include <euicc/es10c.h>
 
+static const char *opt_string = "fh?";
+
+static const struct option long_options[] = {
+    {"flush-notifications", no_argument, NULL, 'f'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0},
+};
+
+static const char *disable_reason(int ret)
+{
+    switch (ret)
+    {
+    case 1:
+        return "iccid or aid not found";
+    case 2:
+        return "profile not in enabled state";
+    case 3:
+        return "disallowed by policy";
+    case -1:
+        return "internal error, maybe illegal iccid/aid coding";
+    default:
+        return "unknown";
+    }
+}
+
 static int applet_main(int argc, char **argv)
 {
+    int opt;
     int ret;
-    const char *param;
+    int fret = 0;
+    int flush = 0;
     int refreshflag;
+    unsigned long mark = 0;
+    cJSON *jdata = NULL;
+    cJSON *jprofiles = NULL;
+    cJSON *jnotifications = NULL;
 
-    if (argc < 2)
+    opt = getopt_long(argc, argv, opt_string, long_options, NULL);
+    while (opt != -1)
     {
-        printf("Usage: %s [iccid/aid] [refreshflag]\n", argv[0]);
+        switch (opt)
+        {
+        case 'f':
+            flush = 1;
+            break;
+        case 'h':
+        case '?':
+            printf("Usage: %s [OPTIONS] [iccid/aid]... [refreshflag]\r\n", argv[0]);
+            printf("\t[refreshflag]: optional\r\n");
+            printf("\t -f, --flush-notifications  Send the disable notifications afterwards in one go\r\n");
+            printf("\t -h, --help                 This help info\r\n");
+            return -1;
+        }
+        opt = getopt_long(argc, argv, opt_string, long_options, NULL);
+    }
+
+    if (optind >= argc)
+    {
+        printf("Usage: %s [OPTIONS] [iccid/aid]... [refreshflag]\n", argv[0]);
         printf("\t[refreshflag]: optional\n");
         return -1;
     }
 
-    param = argv[1];
-
+    // A trailing 0 or 1 is the refreshflag, no ICCID or AID is that short
     refreshflag = 0;
-    if (argc > 2)
+    if (argc - optind > 1 && strlen(argv[argc - 1]) == 1)
     {
-        refreshflag = atoi(argv[2]);
+        refreshflag = atoi(argv[argc - 1]);
+        argc--;
     }
 
-    ret = es10c_disable_profile(&euicc_ctx, param, refreshflag);
+    cache_invalidate();
 
-    if (ret)
+    // One profile without notifications reports as it always did
+    if (argc - optind == 1 && !flush)
     {
-        const char *reason;
-        switch (ret)
+        ret = es10c_disable_profile(&euicc_ctx, argv[optind], refreshflag);
+        if (ret)
         {
-        case 1:
-            reason = "iccid or aid not found";
-            break;
-        case 2:
-            reason = "profile not in enabled state";
-            break;
-        case 3:
-            reason = "disallowed by policy";
-            break;
-        case -1:
-            reason = "internal error, maybe illegal iccid/aid coding";
-            break;
-        default:
-            reason = "unknown";
-            break;
+            jprint_error("es10c_disable_profile", disable_reason(ret));
+            return -1;
         }
-        jprint_error("es10c_disable_profile", reason);
+        jprint_success(NULL);
+        return 0;
+    }
+
+    if (flush && profile_batch_mark(&mark))
+    {
+        jprint_error("es10b_list_notification", NULL);
         return -1;
     }
 
-    jprint_success(NULL);
+    // A failed profile does not stop the rest, the summary tells which ones went through
+    jprofiles = cJSON_CreateArray();
+    for (int i = optind; i < argc; i++)
+    {
+        jprint_progress("es10c_disable_profile", argv[i]);
+        ret = es10c_disable_profile(&euicc_ctx, argv[i], refreshflag);
+        if (ret)
+        {
+            fret = -1;
+        }
+        profile_batch_result(jprofiles, argv[i], ret, disable_reason(ret));
+    }
+
+    jnotifications = cJSON_CreateArray();
+    if (flush)
+    {
+        profile_batch_flush(mark, ES10B_PROFILE_MANAGEMENT_OPERATION_DISABLE, jnotifications);
+    }
+
+    jdata = cJSON_CreateObject();
+    cJSON_AddItemToObject(jdata, "profiles", jprofiles);
+    cJSON_AddItemToObject(jdata, "notifications", jnotifications);
+    jprint_success(jdata);
 
-    return 0;
+    return fret;
 }
 
 struct applet_entry applet_profile_disable = {
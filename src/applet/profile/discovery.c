@@ -11,16 +11,76 @@
 
 static const char *opt_string = "s:i:h?";
 
+#define DISCOVERY_SMDS_MAX 16
+
+struct discovery_failure
+{
+    const char *function;
+    const char *smds;
+    char message[sizeof(((struct euicc_ctx *)0)->http.status.message)];
+};
+
+static void discovery_failed(struct discovery_failure *failure, const char *function, const char *smds, const char *message)
+{
+    failure->function = function;
+    failure->smds = smds;
+    snprintf(failure->message, sizeof(failure->message), "%s", message ? message : "");
+}
+
+// Card challenge, InitiateAuthentication and AuthenticateServer of one SM-DS, leaving the session in transaction_id and asr
+static int discovery_authenticate(const char *smds, const char *imei, char **transaction_id, struct euicc_blob *asr, struct discovery_failure *failure)
+{
+    euicc_ctx.http.server_address = smds;
+
+    jprint_progress("es10b_get_euicc_challenge_and_info", smds);
+    if (es10b_get_euicc_challenge_and_info(&euicc_ctx))
+    {
+        discovery_failed(failure, "es10b_get_euicc_challenge_and_info", smds, NULL);
+        return -1;
+    }
+
+    jprint_progress("es9p_initiate_authentication", smds);
+    if (es9p_initiate_authentication(&euicc_ctx))
+    {
+        discovery_failed(failure, "es9p_initiate_authentication", smds, euicc_ctx.http.status.message);
+        return -1;
+    }
+
+    jprint_progress("es10b_authenticate_server", smds);
+    if (es10b_authenticate_server(&euicc_ctx, NULL, imei))
+    {
+        discovery_failed(failure, "es10b_authenticate_server", smds, NULL);
+        return -1;
+    }
+
+    // The next server's challenge starts a new session on the eUICC, this one only has its ES11 leg left
+    *transaction_id = euicc_ctx.http._internal.transaction_id_http;
+    *asr = euicc_ctx.http._internal.authenticate_server_response;
+    euicc_ctx.http._internal.transaction_id_http = NULL;
+    memset(&euicc_ctx.http._internal.authenticate_server_response, 0, sizeof(struct euicc_blob));
+
+    return 0;
+}
+
 static int applet_main(int argc, char **argv)
 {
     int fret;
 
     int opt;
 
-    char *smds = NULL;
+    const char *smds[DISCOVERY_SMDS_MAX];
+    uint32_t smds_count = 0;
+    char *smds_args[DISCOVERY_SMDS_MAX];
+    uint32_t smds_args_count = 0;
     char *imei = NULL;
 
-    char **smdp_list = NULL;
+    const char *session_smds[DISCOVERY_SMDS_MAX];
+    char *transaction_id[DISCOVERY_SMDS_MAX];
+    struct euicc_blob asr[DISCOVERY_SMDS_MAX];
+    char **smdp_list[DISCOVERY_SMDS_MAX];
+    uint32_t session_count = 0;
+    struct discovery_failure failure = {0};
+    int found = 0;
 
     cJSON *jdata = NULL;
 
@@ -30,15 +90,33 @@ static int applet_main(int argc, char **argv)
         switch (opt)
         {
         case 's':
-            smds = strdup(optarg);
+        {
+            char *token, *saveptr = NULL;
+
+            if (smds_args_count >= DISCOVERY_SMDS_MAX)
+            {
+                jprint_error("too many SM-DS", NULL);
+                goto err;
+            }
+            smds_args[smds_args_count] = strdup(optarg);
+            for (token = strtok_r(smds_args[smds_args_count++], ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr))
+            {
+                if (smds_count >= DISCOVERY_SMDS_MAX)
+                {
+                    jprint_error("too many SM-DS", NULL);
+                    goto err;
+                }
+                smds[smds_count++] = token;
+            }
             break;
+        }
         case 'i':
             imei = strdup(optarg);
             break;
         case 'h':
         case '?':
             printf("Usage: %s [OPTIONS]\r\n", argv[0]);
-            printf("\t -s SM-DS Domain\r\n");
+            printf("\t -s SM-DS Domain, repeated or comma separated to ask several at once\r\n");
             printf("\t -i IMEI\r\n");
             printf("\t -h This help info\r\n");
             return -1;
@@ -47,38 +125,46 @@ static int applet_main(int argc, char **argv)
         opt = getopt(argc, argv, opt_string);
     }
 
-    if (smds == NULL)
+    if (smds_count == 0)
     {
         // smds = "prod.smds.rsp.goog";
         // smds = "lpa.live.esimdiscovery.com";
-        smds = "lpa.ds.gsma.com";
+        smds[smds_count++] = "lpa.ds.gsma.com";
     }
 
-    euicc_ctx.http.server_address = smds;
-
-    jprint_progress("es10b_get_euicc_challenge_and_info", smds);
-    if (es10b_get_euicc_challenge_and_info(&euicc_ctx))
+    // The eUICC keeps one session at a time, so the card legs run one server after another
+    for (uint32_t i = 0; i < smds_count; i++)
     {
-        jprint_error("es10b_get_euicc_challenge_and_info", NULL);
-        goto err;
+        if (discovery_authenticate(smds[i], imei, &transaction_id[session_count], &asr[session_count], &failure) == 0)
+        {
+            session_smds[session_count++] = smds[i];
+        }
+        if (i + 1 < smds_count)
+        {
+            euicc_http_cleanup(&euicc_ctx);
+        }
     }
 
-    jprint_progress("es9p_initiate_authentication", smds);
-    if (es9p_initiate_authentication(&euicc_ctx))
+    if (session_count == 0)
     {
-        jprint_error("es9p_initiate_authentication", euicc_ctx.http.status.message);
+        jprint_error(failure.function, failure.message[0] ? failure.message : NULL);
         goto err;
     }
 
-    jprint_progress("es10b_authenticate_server", smds);
-    if (es10b_authenticate_server(&euicc_ctx, NULL, imei))
+    // and the ES11 legs all at once. A single server keeps the connection InitiateAuthentication opened.
+    for (uint32_t i = 0; i < session_count; i++)
     {
-        jprint_error("es10b_authenticate_server", NULL);
-        goto err;
+        jprint_progress("es11_authenticate_client", session_smds[i]);
     }
-
-    jprint_progress("es11_authenticate_client", smds);
-    if (es11_authenticate_client(&euicc_ctx, &smdp_list))
+    if (session_count == 1)
+    {
+        euicc_ctx.http.server_address = session_smds[0];
+        if (es11_authenticate_client_r(&euicc_ctx, &smdp_list[0], session_smds[0], transaction_id[0], &asr[0]))
+        {
+            smdp_list[0] = NULL;
+        }
+    }
+    else if (es11_authenticate_client_multi(&euicc_ctx, session_smds, (const char *const *)transaction_id, asr, smdp_list, session_count))
     {
         jprint_error("es11_authenticate_client", NULL);
         goto err;
@@ -90,17 +176,50 @@ static int applet_main(int argc, char **argv)
         goto err;
     }
 
-    for (int i = 0; smdp_list[i] != NULL; i++)
+    for (uint32_t i = 0; i < session_count; i++)
     {
-        cJSON *jsmdp = cJSON_CreateString(smdp_list[i]);
-        if (jsmdp == NULL)
+        if (smdp_list[i] == NULL)
+        {
+            discovery_failed(&failure, "es11_authenticate_client", session_smds[i], NULL);
+            continue;
+        }
+        found = 1;
+
+        for (int j = 0; smdp_list[i][j] != NULL; j++)
         {
-            goto err;
+            cJSON *jsmdp;
+            int duplicate = 0;
+
+            cJSON_ArrayForEach(jsmdp, jdata)
+            {
+                if (strcasecmp(jsmdp->valuestring, smdp_list[i][j]) == 0)
+                {
+                    duplicate = 1;
+                    break;
+                }
+            }
+            if (duplicate)
+            {
+                continue;
+            }
+
+            jsmdp = cJSON_CreateString(smdp_list[i][j]);
+            if (jsmdp == NULL)
+            {
+                goto err;
+            }
+            cJSON_AddItemToArray(jdata, jsmdp);
         }
-        cJSON_AddItemToArray(jdata, jsmdp);
+    }
+
+    if (!found)
+    {
+        jprint_error("es11_authenticate_client", NULL);
+        goto err;
     }
 
     jprint_success(jdata);
+    jdata = NULL;
 
     fret = 0;
     goto exit;
@@ -108,7 +227,17 @@ static int applet_main(int argc, char **argv)
 err:
     fret = -1;
 exit:
-    es11_smdp_list_free_all(smdp_list);
+    cJSON_Delete(jdata);
+    for (uint32_t i = 0; i < session_count; i++)
+    {
+        free(transaction_id[i]);
+        euicc_blob_free(&asr[i]);
+        es11_smdp_list_free_all(smdp_list[i]);
+    }
+    for (uint32_t i = 0; i < smds_args_count; i++)
+    {
+        free(smds_args[i]);
+    }
     euicc_http_cleanup(&euicc_ctx);
     return fret;
 }
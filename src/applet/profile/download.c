@@ -5,30 +5,122 @@
 #include <string.h>
 #include <getopt.h>
 #include <main.h>
+#include <cache.h>
+#include <journal.h>
+#include <icon.h>
+#include <applet/fleet.h>
 
 #include <euicc/es10a.h>
 #include <euicc/es10b.h>
-#include <euicc/es9p.h>
+#include <euicc/download.h>
 #include <euicc/tostr.h>
 
-static const char *opt_string = "s:m:i:c:a:h?";
+static const char *opt_string = "s:m:i:c:a:M:ph?";
+
+static const struct option long_options[] = {
+    {"preview", no_argument, NULL, 'p'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0},
+};
+
+struct download_progress
+{
+    const char *smdp;
+    uint32_t bpp_max_length;
+    cJSON *jmetadata;
+};
+
+static void download_progress(struct euicc_ctx *ctx, const char *step, int done, void *userdata)
+{
+    struct download_progress *progress = userdata;
+
+    if (!done)
+    {
+        jprint_progress(step, progress->smdp);
+        return;
+    }
+
+    if (strcmp(step, "es9p_cancel_session") == 0)
+    {
+        journal_clear();
+    }
+    else
+    {
+        journal_write(ctx, step);
+    }
+
+    if (strcmp(step, "es10c_ex_get_euiccinfo2") == 0)
+    {
+        // Only sized for the download, the size-refusal message needs it afterwards
+        progress->bpp_max_length = ctx->http.bpp_max_length;
+    }
+    else if (strcmp(step, "es9p_initiate_authentication") == 0 || strcmp(step, "es9p_authenticate_client") == 0)
+    {
+        jprint_progress_http(step, progress->smdp);
+    }
+}
+
+// Only set with --preview, which declines every profile once it printed what it is
+static int download_metadata(struct euicc_ctx *ctx, const struct es10c_profile_metadata *metadata, void *userdata)
+{
+    struct download_progress *progress = userdata;
+    cJSON *jmetadata, *jowner;
+
+    jmetadata = cJSON_CreateObject();
+    cJSON_AddStringOrNullToObject(jmetadata, "iccid", metadata->iccid[0] ? metadata->iccid : NULL);
+    cJSON_AddStringOrNullToObject(jmetadata, "serviceProviderName", metadata->serviceProviderName);
+    cJSON_AddStringOrNullToObject(jmetadata, "profileName", metadata->profileName);
+    cJSON_AddStringOrNullToObject(jmetadata, "iconType", euicc_icontype2str(metadata->iconType));
+    icon_json_add(jmetadata, metadata->icon.data, metadata->icon.length, icon_store_enabled());
+    cJSON_AddStringOrNullToObject(jmetadata, "profileClass", euicc_profileclass2str(metadata->profileClass));
+    if (metadata->profileOwner.mccmnc)
+    {
+        jowner = cJSON_AddObjectToObject(jmetadata, "profileOwner");
+        cJSON_AddStringOrNullToObject(jowner, "mccmnc", metadata->profileOwner.mccmnc);
+        cJSON_AddStringOrNullToObject(jowner, "gid1", metadata->profileOwner.gid1);
+        cJSON_AddStringOrNullToObject(jowner, "gid2", metadata->profileOwner.gid2);
+    }
+    else
+    {
+        cJSON_AddNullToObject(jmetadata, "profileOwner");
+    }
+    {
+        cJSON *jrules = cJSON_AddArrayToObject(jmetadata, "profilePolicyRules");
+
+        for (int i = 0; metadata->profilePolicyRules && metadata->profilePolicyRules[i]; i++)
+        {
+            cJSON_AddItemToArray(jrules, cJSON_CreateString(metadata->profilePolicyRules[i]));
+        }
+    }
+
+    progress->jmetadata = jmetadata;
+    return 1;
+}
 
 static int applet_main(int argc, char **argv)
 {
     int fret;
 
     int opt;
+    int ret;
 
     char *smdp = NULL;
     char *matchingId = NULL;
     char *imei = NULL;
     char *confirmation_code = NULL;
     char *activation_code = NULL;
+    int memory_report = 0;
+    cJSON *jdata = NULL;
 
     struct es10a_euicc_configured_addresses configured_addresses = {0};
     struct es10b_load_bound_profile_package_result download_result = {0};
+    struct download_progress progress = {0};
+    struct euicc_download_params params = {
+        .progress = download_progress,
+    };
+    const char *failed = NULL;
 
-    opt = getopt(argc, argv, opt_string);
+    opt = getopt_long(argc, argv, opt_string, long_options, NULL);
     while (opt != -1)
     {
         switch (opt)
@@ -52,6 +144,13 @@ static int applet_main(int argc, char **argv)
                 activation_code += 4; // ignore uri scheme
             }
             break;
+        case 'M':
+            euicc_ctx.http.bpp_memory_max = strtoul(optarg, NULL, 0);
+            memory_report = 1;
+            break;
+        case 'p':
+            params.metadata = download_metadata;
+            break;
         case 'h':
         case '?':
             printf("Usage: %s [OPTIONS]\r\n", argv[0]);
@@ -60,12 +159,14 @@ static int applet_main(int argc, char **argv)
             printf("\t -i IMEI\r\n");
             printf("\t -c Confirmation Code (Password)\r\n");
             printf("\t -a Activation Code (e.g: 'LPA:***')\r\n");
+            printf("\t -M Bytes of the profile package held in memory at once, reports the peak [0: no limit]\r\n");
+            printf("\t -p, --preview Print the profile metadata and cancel the session, before anything is loaded\r\n");
             printf("\t -h This help info\r\n");
             return -1;
         default:
             break;
         }
-        opt = getopt(argc, argv, opt_string);
+        opt = getopt_long(argc, argv, opt_string, long_options, NULL);
     }
 
     if (activation_code != NULL)
@@ -132,58 +233,79 @@ static int applet_main(int argc, char **argv)
 
     euicc_ctx.http.server_address = smdp;
 
-    jprint_progress("es10b_get_euicc_challenge_and_info", smdp);
-    if (es10b_get_euicc_challenge_and_info(&euicc_ctx))
+    // The cached profile list and free memory are stale once the download starts
+    cache_invalidate();
+
+    // Within lpac fleet, waits here until the SM-DP+ may take another session
+    fleet_gate_acquire(smdp);
+
+    params.matchingId = matchingId;
+    params.imei = imei;
+    params.confirmationCode = confirmation_code;
+    params.userdata = &progress;
+    progress.smdp = smdp;
+    ret = euicc_download(&euicc_ctx, &params, &download_result, &failed);
+    fleet_gate_release();
+    // A step that failed midway may leave the session open, the next start cancels it
+    if (ret != -1)
     {
-        jprint_error("es10b_get_euicc_challenge_and_info", NULL);
-        goto err;
+        journal_clear();
     }
-
-    jprint_progress("es9p_initiate_authentication", smdp);
-    if (es9p_initiate_authentication(&euicc_ctx))
+    if (ret == 1)
     {
-        jprint_error("es9p_initiate_authentication", euicc_ctx.http.status.message);
-        goto err;
+        jprint_success(progress.jmetadata);
+        progress.jmetadata = NULL;
+        fret = 0;
+        goto exit;
     }
-
-    jprint_progress("es10b_authenticate_server", smdp);
-    if (es10b_authenticate_server(&euicc_ctx, matchingId, imei))
+    if (ret == -1 && strncmp(failed, "es9p_", 5) == 0)
     {
-        jprint_error("es10b_authenticate_server", NULL);
+        if (strcmp(failed, "es9p_get_bound_profile_package") == 0)
+        {
+            jprint_progress_http(failed, smdp);
+        }
+        jprint_error(failed, euicc_ctx.http.status.message);
         goto err;
     }
-
-    jprint_progress("es9p_authenticate_client", smdp);
-    if (es9p_authenticate_client(&euicc_ctx))
+    if (ret == -1)
     {
-        jprint_error("es9p_authenticate_client", euicc_ctx.http.status.message);
+        jprint_error(failed, NULL);
         goto err;
     }
-
-    jprint_progress("es10b_prepare_download", smdp);
-    if (es10b_prepare_download(&euicc_ctx, confirmation_code))
+    jprint_progress_http("es9p_get_bound_profile_package", smdp);
+    if (ret == -3 || ret == -4)
     {
-        jprint_error("es10b_prepare_download", NULL);
+        char buffer[256];
+        if (ret == -3)
+        {
+            snprintf(buffer, sizeof(buffer), "%s,profile package is larger than the %u bytes of free memory", euicc_errorreason2str(download_result.errorReason), progress.bpp_max_length);
+        }
+        else
+        {
+            snprintf(buffer, sizeof(buffer), "profile package cannot be loaded within %u bytes of memory", euicc_ctx.http.bpp_memory_max);
+        }
+        jprint_error(failed, buffer);
         goto err;
     }
-
-    jprint_progress("es9p_get_bound_profile_package", smdp);
-    if (es9p_get_bound_profile_package(&euicc_ctx))
+    if (ret < 0 && euicc_aborted(&euicc_ctx))
     {
-        jprint_error("es9p_get_bound_profile_package", euicc_ctx.http.status.message);
+        jprint_error(failed, "timed out");
         goto err;
     }
-
-    jprint_progress("es10b_load_bound_profile_package", smdp);
-    if (es10b_load_bound_profile_package(&euicc_ctx, &download_result))
+    if (ret < 0)
     {
         char buffer[256];
         snprintf(buffer, sizeof(buffer), "%s,%s", euicc_bppcommandid2str(download_result.bppCommandId), euicc_errorreason2str(download_result.errorReason));
-        jprint_error("es10b_load_bound_profile_package", buffer);
+        jprint_error(failed, buffer);
         goto err;
     }
 
-    jprint_success(NULL);
+    if (memory_report)
+    {
+        jdata = cJSON_CreateObject();
+        cJSON_AddNumberToObject(jdata, "bppMemoryPeak", euicc_ctx.http.bpp_memory_peak);
+    }
+    jprint_success(jdata);
 
     fret = 0;
     goto exit;
@@ -191,6 +313,9 @@ static int applet_main(int argc, char **argv)
 err:
     fret = -1;
 exit:
+    cJSON_Delete(progress.jmetadata);
+    fleet_gate_release();
+    euicc_ctx.http.bpp_memory_max = 0;
     es10a_euicc_configured_addresses_free(&configured_addresses);
     euicc_http_cleanup(&euicc_ctx);
     return fret;
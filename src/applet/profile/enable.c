@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <main.h>
+#include <cache.h>
 
 #include <euicc/es10c.h>
 
@@ -28,6 +29,8 @@ static int applet_main(int argc, char **argv)
         refreshflag = atoi(argv[2]);
     }
 
+    cache_invalidate();
+
     ret = es10c_enable_profile(&euicc_ctx, param, refreshflag);
 
     if (ret)
@@ -3,46 +3,626 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <getopt.h>
+#include <signal.h>
 #include <main.h>
+#include <cache.h>
+#include <icon.h>
 
 #include <euicc/es10c.h>
+#include <euicc/base64.h>
 #include <euicc/tostr.h>
 
-static int applet_main(int argc, char **argv)
+enum list_field
+{
+    LIST_FIELD_ICCID,
+    LIST_FIELD_ISDP_AID,
+    LIST_FIELD_PROFILE_STATE,
+    LIST_FIELD_PROFILE_NICKNAME,
+    LIST_FIELD_SERVICE_PROVIDER_NAME,
+    LIST_FIELD_PROFILE_NAME,
+    LIST_FIELD_ICON_TYPE,
+    LIST_FIELD_ICON,
+    LIST_FIELD_PROFILE_CLASS,
+    LIST_FIELD_COUNT,
+};
+
+// Output key, short name for --fields and the ProfileInfo tag asked for in tagList
+static const struct
+{
+    const char *key;
+    const char *name;
+    uint16_t tag;
+} list_fields[LIST_FIELD_COUNT] = {
+    [LIST_FIELD_ICCID] = {"iccid", "iccid", 0x5A},
+    [LIST_FIELD_ISDP_AID] = {"isdpAid", "aid", 0x4F},
+    [LIST_FIELD_PROFILE_STATE] = {"profileState", "state", 0x9F70},
+    [LIST_FIELD_PROFILE_NICKNAME] = {"profileNickname", "nickname", 0x90},
+    [LIST_FIELD_SERVICE_PROVIDER_NAME] = {"serviceProviderName", "provider", 0x91},
+    [LIST_FIELD_PROFILE_NAME] = {"profileName", "name", 0x92},
+    [LIST_FIELD_ICON_TYPE] = {"iconType", "icontype", 0x93},
+    [LIST_FIELD_ICON] = {"icon", "icon", 0x94},
+    [LIST_FIELD_PROFILE_CLASS] = {"profileClass", "class", 0x95},
+};
+
+#define LIST_WATCH_INTERVAL_DEFAULT 1000
+
+static const char *opt_string = "f:ni:a:c:wt:h?";
+
+static const struct option long_options[] = {
+    {"fields", required_argument, NULL, 'f'},
+    {"no-icons", no_argument, NULL, 'n'},
+    {"iccid", required_argument, NULL, 'i'},
+    {"aid", required_argument, NULL, 'a'},
+    {"class", required_argument, NULL, 'c'},
+    {"watch", no_argument, NULL, 'w'},
+    {"interval", required_argument, NULL, 't'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0},
+};
+
+static int list_fields_parse(uint32_t *fields, const char *str)
+{
+    char *dup, *name, *saveptr = NULL;
+    int fret = 0;
+
+    dup = strdup(str);
+    if (dup == NULL)
+    {
+        return -1;
+    }
+
+    *fields = 0;
+    for (name = strtok_r(dup, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr))
+    {
+        int i;
+
+        for (i = 0; i < LIST_FIELD_COUNT; i++)
+        {
+            if (strcmp(name, list_fields[i].name) == 0 || strcmp(name, list_fields[i].key) == 0)
+            {
+                break;
+            }
+        }
+        if (i == LIST_FIELD_COUNT)
+        {
+            fret = -1;
+            break;
+        }
+        *fields |= 1 << i;
+    }
+
+    free(dup);
+    if (*fields == 0)
+    {
+        return -1;
+    }
+    return fret;
+}
+
+static int list_class_parse(enum es10c_profile_class *profileClass, const char *str)
+{
+    static const enum es10c_profile_class classes[] = {ES10C_PROFILE_CLASS_TEST, ES10C_PROFILE_CLASS_PROVISIONING, ES10C_PROFILE_CLASS_OPERATIONAL};
+
+    for (uint32_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+    {
+        if (strcmp(str, euicc_profileclass2str(classes[i])) == 0)
+        {
+            *profileClass = classes[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void list_add_string(cJSON *jprofile, uint32_t fields, enum list_field field, const char *value)
+{
+    if (fields & (1 << field))
+    {
+        cJSON_AddStringOrNullToObject(jprofile, list_fields[field].key, value);
+    }
+}
+
+static cJSON *list_profile_json(const struct es10c_profile_info_list *profile, uint32_t fields, int store_icon)
+{
+    cJSON *jprofile = NULL;
+
+    jprofile = cJSON_CreateObject();
+    list_add_string(jprofile, fields, LIST_FIELD_ICCID, profile->iccid);
+    list_add_string(jprofile, fields, LIST_FIELD_ISDP_AID, profile->isdpAid);
+    list_add_string(jprofile, fields, LIST_FIELD_PROFILE_STATE, euicc_profilestate2str(profile->profileState));
+    list_add_string(jprofile, fields, LIST_FIELD_PROFILE_NICKNAME, profile->profileNickname);
+    list_add_string(jprofile, fields, LIST_FIELD_SERVICE_PROVIDER_NAME, profile->serviceProviderName);
+    list_add_string(jprofile, fields, LIST_FIELD_PROFILE_NAME, profile->profileName);
+    list_add_string(jprofile, fields, LIST_FIELD_ICON_TYPE, euicc_icontype2str(profile->iconType));
+    if (fields & (1 << LIST_FIELD_ICON))
+    {
+        // Encoded only here, callers that leave out the icon never pay for it
+        icon_json_add(jprofile, profile->icon.data, profile->icon.length, store_icon);
+    }
+    list_add_string(jprofile, fields, LIST_FIELD_PROFILE_CLASS, euicc_profileclass2str(profile->profileClass));
+
+    return jprofile;
+}
+
+static int iter_profile_info(struct es10c_profile_info_list *profile, void *userdata)
+{
+    uint32_t fields = *(uint32_t *)userdata;
+
+    jprint_success_array_append(list_profile_json(profile, fields, icon_store_enabled()));
+    es10c_profile_info_list_free_all(profile);
+
+    return 0;
+}
+
+static int iter_profile_info_cache(struct es10c_profile_info_list *profile, void *userdata)
+{
+    cJSON *jprofiles = (cJSON *)userdata;
+
+    // The cache keeps the icon itself, whichever way it is listed
+    cJSON_AddItemToArray(jprofiles, list_profile_json(profile, (1 << LIST_FIELD_COUNT) - 1, 0));
+    es10c_profile_info_list_free_all(profile);
+
+    return 0;
+}
+
+static int list_cached_match(const struct es10c_profile_info_filter *filter, const cJSON *jprofile)
+{
+    const char *iccid = cJSON_GetStringValue(cJSON_GetObjectItem(jprofile, list_fields[LIST_FIELD_ICCID].key));
+    const char *isdpAid = cJSON_GetStringValue(cJSON_GetObjectItem(jprofile, list_fields[LIST_FIELD_ISDP_AID].key));
+    const char *profileClass = cJSON_GetStringValue(cJSON_GetObjectItem(jprofile, list_fields[LIST_FIELD_PROFILE_CLASS].key));
+
+    if (filter->isdpAid)
+    {
+        return isdpAid && strcasecmp(isdpAid, filter->isdpAid) == 0;
+    }
+    if (filter->iccid)
+    {
+        return iccid && strcasecmp(iccid, filter->iccid) == 0;
+    }
+    if (filter->profileClass)
+    {
+        return profileClass && strcmp(profileClass, euicc_profileclass2str(*filter->profileClass)) == 0;
+    }
+    return 1;
+}
+
+static cJSON *list_cached_profiles(void)
 {
-    struct es10c_profile_info_list *profiles, *rptr;
-    cJSON *jdata = NULL;
+    cJSON *jprofiles = NULL;
 
-    if (es10c_get_profiles_info(&euicc_ctx, &profiles))
+    jprofiles = cache_get("profiles");
+    if (jprofiles == NULL)
+    {
+        jprofiles = cJSON_CreateArray();
+        if (es10c_get_profiles_info_iter(&euicc_ctx, iter_profile_info_cache, jprofiles))
+        {
+            cJSON_Delete(jprofiles);
+            return NULL;
+        }
+        cache_put("profiles", jprofiles);
+    }
+    return jprofiles;
+}
+
+// The cache holds the icon as base64, it is decoded to be stored
+static void list_cached_icon(cJSON *jselected, const char *b64)
+{
+    uint8_t *icon = NULL;
+    int length = 0;
+
+    if (b64)
+    {
+        icon = malloc(euicc_base64_decode_len(b64));
+        if (icon)
+        {
+            length = euicc_base64_decode(icon, b64);
+        }
+    }
+    if (b64 && (icon == NULL || length < 0))
+    {
+        // Listed as cached rather than dropped
+        cJSON_AddStringToObject(jselected, list_fields[LIST_FIELD_ICON].key, b64);
+    }
+    else
+    {
+        icon_json_add(jselected, icon, length, 1);
+    }
+    free(icon);
+}
+
+static cJSON *list_cached_select(const cJSON *jprofile, uint32_t fields)
+{
+    cJSON *jselected;
+
+    jselected = cJSON_CreateObject();
+    for (int i = 0; i < LIST_FIELD_COUNT; i++)
+    {
+        if (i == LIST_FIELD_ICON && (fields & (1 << i)) && icon_store_enabled())
+        {
+            list_cached_icon(jselected, cJSON_GetStringValue(cJSON_GetObjectItem(jprofile, list_fields[i].key)));
+        }
+        else if (fields & (1 << i))
+        {
+            cJSON_AddItemToObject(jselected, list_fields[i].key, cJSON_Duplicate(cJSON_GetObjectItem(jprofile, list_fields[i].key), 1));
+        }
+    }
+    return jselected;
+}
+
+// The full list is cached once and every filter is applied to it, so a poll with any options is served from the cache
+static int list_cached(const struct es10c_profile_info_filter *filter, uint32_t fields)
+{
+    cJSON *jprofiles = NULL;
+    const cJSON *jprofile = NULL;
+
+    jprofiles = list_cached_profiles();
+    if (jprofiles == NULL)
     {
         jprint_error("es10c_get_profiles_info", NULL);
         return -1;
     }
 
-    jdata = cJSON_CreateArray();
-    rptr = profiles;
+    jprint_success_array_begin();
+    cJSON_ArrayForEach(jprofile, jprofiles)
+    {
+        if (!list_cached_match(filter, jprofile))
+        {
+            continue;
+        }
+        jprint_success_array_append(list_cached_select(jprofile, fields));
+    }
+    jprint_success_array_end();
+
+    cJSON_Delete(jprofiles);
+
+    return 0;
+}
 
-    while (rptr)
+static volatile sig_atomic_t list_watching;
+
+static void list_watch_signal_handler(int signo)
+{
+    list_watching = 0;
+}
+
+// The watch polls only what it compares: presence, state and nickname
+static const uint16_t list_watch_tags[] = {0x5A, 0x9F70, 0x90};
+
+static int iter_profile_info_watch(struct es10c_profile_info_list *profile, void *userdata)
+{
+    cJSON *jsnapshot = (cJSON *)userdata;
+    cJSON *jprofile;
+
+    if (profile->iccid[0])
     {
-        cJSON *jprofile = NULL;
+        jprofile = cJSON_AddObjectToObject(jsnapshot, profile->iccid);
+        cJSON_AddStringOrNullToObject(jprofile, list_fields[LIST_FIELD_PROFILE_STATE].key, euicc_profilestate2str(profile->profileState));
+        cJSON_AddStringOrNullToObject(jprofile, list_fields[LIST_FIELD_PROFILE_NICKNAME].key, profile->profileNickname);
+    }
+    es10c_profile_info_list_free_all(profile);
+
+    return 0;
+}
+
+struct list_profiles
+{
+    cJSON *jarray;
+    uint32_t fields;
+};
+
+static int iter_profile_info_array(struct es10c_profile_info_list *profile, void *userdata)
+{
+    struct list_profiles *list = userdata;
+
+    cJSON_AddItemToArray(list->jarray, list_profile_json(profile, list->fields, icon_store_enabled()));
+    es10c_profile_info_list_free_all(profile);
+
+    return 0;
+}
 
-        jprofile = cJSON_CreateObject();
-        cJSON_AddStringOrNullToObject(jprofile, "iccid", rptr->iccid);
-        cJSON_AddStringOrNullToObject(jprofile, "isdpAid", rptr->isdpAid);
-        cJSON_AddStringOrNullToObject(jprofile, "profileState", euicc_profilestate2str(rptr->profileState));
-        cJSON_AddStringOrNullToObject(jprofile, "profileNickname", rptr->profileNickname);
-        cJSON_AddStringOrNullToObject(jprofile, "serviceProviderName", rptr->serviceProviderName);
-        cJSON_AddStringOrNullToObject(jprofile, "profileName", rptr->profileName);
-        cJSON_AddStringOrNullToObject(jprofile, "iconType", euicc_icontype2str(rptr->iconType));
-        cJSON_AddStringOrNullToObject(jprofile, "icon", rptr->icon);
-        cJSON_AddStringOrNullToObject(jprofile, "profileClass", euicc_profileclass2str(rptr->profileClass));
-        cJSON_AddItemToArray(jdata, jprofile);
+// The profiles matching filter with the fields asked for, NULL on error
+static cJSON *list_profiles_json(const struct es10c_profile_info_filter *filter, uint32_t fields)
+{
+    struct list_profiles list = {
+        .jarray = cJSON_CreateArray(),
+        .fields = fields,
+    };
 
-        rptr = rptr->next;
+    if (es10c_get_profiles_info_filtered_iter(&euicc_ctx, filter, iter_profile_info_array, &list))
+    {
+        cJSON_Delete(list.jarray);
+        return NULL;
+    }
+    return list.jarray;
+}
+
+// The icon is the bulk of a ProfileInfoList, the tagList leaves it out
+cJSON *profile_list_brief_json(void)
+{
+    uint32_t fields = ((1 << LIST_FIELD_COUNT) - 1) & ~((1 << LIST_FIELD_ICON_TYPE) | (1 << LIST_FIELD_ICON));
+    uint16_t tagList[LIST_FIELD_COUNT];
+    struct es10c_profile_info_filter filter = {
+        .tagList = tagList,
+    };
+    cJSON *jprofiles, *jbrief;
+    const cJSON *jprofile;
+
+    if (!cache_enabled())
+    {
+        for (int i = 0; i < LIST_FIELD_COUNT; i++)
+        {
+            if (fields & (1 << i))
+            {
+                tagList[filter.tagList_count++] = list_fields[i].tag;
+            }
+        }
+        return list_profiles_json(&filter, fields);
+    }
+
+    jprofiles = list_cached_profiles();
+    if (jprofiles == NULL)
+    {
+        return NULL;
+    }
+    jbrief = cJSON_CreateArray();
+    cJSON_ArrayForEach(jprofile, jprofiles)
+    {
+        cJSON_AddItemToArray(jbrief, list_cached_select(jprofile, fields));
+    }
+    cJSON_Delete(jprofiles);
+
+    return jbrief;
+}
+
+static cJSON *list_watch_snapshot(const struct es10c_profile_info_filter *filter)
+{
+    struct es10c_profile_info_filter watch_filter = *filter;
+    cJSON *jsnapshot = cJSON_CreateObject();
+
+    watch_filter.tagList = list_watch_tags;
+    watch_filter.tagList_count = sizeof(list_watch_tags) / sizeof(list_watch_tags[0]);
+    if (es10c_get_profiles_info_filtered_iter(&euicc_ctx, &watch_filter, iter_profile_info_watch, jsnapshot))
+    {
+        cJSON_Delete(jsnapshot);
+        return NULL;
+    }
+    return jsnapshot;
+}
+
+static cJSON *list_watch_change(const char *iccid, const char *change, const cJSON *jprofile)
+{
+    cJSON *jchange = cJSON_CreateObject();
+
+    cJSON_AddStringToObject(jchange, list_fields[LIST_FIELD_ICCID].key, iccid);
+    cJSON_AddStringToObject(jchange, "change", change);
+    if (jprofile)
+    {
+        for (const cJSON *jitem = jprofile->child; jitem; jitem = jitem->next)
+        {
+            cJSON_AddItemToObject(jchange, jitem->string, cJSON_Duplicate(jitem, 1));
+        }
+    }
+    return jchange;
+}
+
+// Added profiles come with every field asked for, the others with their state and nickname
+static int list_watch_diff(const cJSON *jold, const cJSON *jnew, const struct es10c_profile_info_filter *filter, uint32_t fields, cJSON *jchanges)
+{
+    const cJSON *jprofile;
+    const cJSON *jprevious;
+
+    cJSON_ArrayForEach(jprofile, jnew)
+    {
+        jprevious = cJSON_GetObjectItemCaseSensitive(jold, jprofile->string);
+        if (jprevious == NULL)
+        {
+            struct es10c_profile_info_filter added = {
+                .iccid = jprofile->string,
+                .tagList = filter->tagList,
+                .tagList_count = filter->tagList_count,
+            };
+            cJSON *jadded = list_profiles_json(&added, fields);
+
+            if (jadded == NULL)
+            {
+                return -1;
+            }
+            cJSON_AddItemToArray(jchanges, list_watch_change(jprofile->string, "added", cJSON_GetArrayItem(jadded, 0)));
+            cJSON_Delete(jadded);
+        }
+        else if (!cJSON_Compare(jprofile, jprevious, 1))
+        {
+            cJSON_AddItemToArray(jchanges, list_watch_change(jprofile->string, "changed", jprofile));
+        }
+    }
+    cJSON_ArrayForEach(jprevious, jold)
+    {
+        if (cJSON_GetObjectItemCaseSensitive(jnew, jprevious->string) == NULL)
+        {
+            cJSON_AddItemToArray(jchanges, list_watch_change(jprevious->string, "removed", NULL));
+        }
+    }
+    return 0;
+}
+
+// Prints the list once, then one event per poll that found a profile added, removed, or with another state or
+// nickname, until SIGINT or SIGTERM
+static int list_watch(const struct es10c_profile_info_filter *filter, uint32_t fields, uint32_t interval_ms)
+{
+    int fret = 0;
+    cJSON *jsnapshot = NULL;
+    cJSON *jprofiles = NULL;
+    void (*sigint_saved)(int);
+    void (*sigterm_saved)(int);
+
+    list_watching = 1;
+    sigint_saved = signal(SIGINT, list_watch_signal_handler);
+    sigterm_saved = signal(SIGTERM, list_watch_signal_handler);
+
+    jsnapshot = list_watch_snapshot(filter);
+    jprofiles = list_profiles_json(filter, fields);
+    if (jsnapshot == NULL || jprofiles == NULL)
+    {
+        goto err;
+    }
+    jprint_progress_with("es10c_get_profiles_info", NULL, "profiles", jprofiles);
+    jprofiles = NULL;
+
+    while (list_watching)
+    {
+        cJSON *jnext, *jchanges;
+
+        for (uint32_t slept = 0; slept < interval_ms && list_watching; slept += 100)
+        {
+            usleep((interval_ms - slept < 100 ? interval_ms - slept : 100) * 1000);
+        }
+        if (!list_watching)
+        {
+            break;
+        }
+
+        jnext = list_watch_snapshot(filter);
+        if (jnext == NULL)
+        {
+            goto err;
+        }
+
+        jchanges = cJSON_CreateArray();
+        if (list_watch_diff(jsnapshot, jnext, filter, fields, jchanges) < 0)
+        {
+            cJSON_Delete(jchanges);
+            cJSON_Delete(jnext);
+            goto err;
+        }
+        if (cJSON_GetArraySize(jchanges) > 0)
+        {
+            // Whatever the cache held is stale now
+            cache_invalidate();
+            jprint_progress_with("profile_changed", NULL, "changes", jchanges);
+            if (ferror(stdout))
+            {
+                // Nobody reads the events anymore
+                list_watching = 0;
+            }
+        }
+        else
+        {
+            cJSON_Delete(jchanges);
+        }
+
+        cJSON_Delete(jsnapshot);
+        jsnapshot = jnext;
+    }
+
+    jprint_success(NULL);
+    goto exit;
+
+err:
+    jprint_error("es10c_get_profiles_info", NULL);
+    fret = -1;
+exit:
+    signal(SIGINT, sigint_saved);
+    signal(SIGTERM, sigterm_saved);
+    cJSON_Delete(jsnapshot);
+    cJSON_Delete(jprofiles);
+    return fret;
+}
+
+static int applet_main(int argc, char **argv)
+{
+    int opt;
+    uint32_t fields = (1 << LIST_FIELD_COUNT) - 1;
+    int watch = 0;
+    uint32_t interval_ms = LIST_WATCH_INTERVAL_DEFAULT;
+    enum es10c_profile_class profileClass;
+    uint16_t tagList[LIST_FIELD_COUNT];
+    struct es10c_profile_info_filter filter = {
+        .tagList = tagList,
+    };
+
+    opt = getopt_long(argc, argv, opt_string, long_options, NULL);
+    while (opt != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            if (list_fields_parse(&fields, optarg) < 0)
+            {
+                jprint_error("profile list", "unknown field");
+                return -1;
+            }
+            break;
+        case 'n':
+            fields &= ~((1 << LIST_FIELD_ICON_TYPE) | (1 << LIST_FIELD_ICON));
+            break;
+        case 'i':
+            filter.iccid = optarg;
+            break;
+        case 'a':
+            filter.isdpAid = optarg;
+            break;
+        case 'c':
+            if (list_class_parse(&profileClass, optarg) < 0)
+            {
+                jprint_error("profile list", "unknown profile class");
+                return -1;
+            }
+            filter.profileClass = &profileClass;
+            break;
+        case 'w':
+            watch = 1;
+            break;
+        case 't':
+            interval_ms = strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+        case '?':
+            printf("Usage: %s [OPTIONS]\r\n", argv[0]);
+            printf("\t -f, --fields  Comma separated fields to list: iccid,aid,state,nickname,provider,name,icontype,icon,class\r\n");
+            printf("\t -n, --no-icons  Leave out iconType and icon\r\n");
+            printf("\t -i, --iccid  Only the profile with this ICCID\r\n");
+            printf("\t -a, --aid  Only the profile with this ISD-P AID\r\n");
+            printf("\t -c, --class  Only profiles of this class: test, provisioning or operational\r\n");
+            printf("\t -w, --watch  Keep polling and report every profile added, removed, enabled, disabled or renamed\r\n");
+            printf("\t -t, --interval  Milliseconds between polls with --watch [default: %d]\r\n", LIST_WATCH_INTERVAL_DEFAULT);
+            printf("\t -h, --help  This help info\r\n");
+            return -1;
+        }
+        opt = getopt_long(argc, argv, opt_string, long_options, NULL);
+    }
+
+    if (cache_enabled() && !watch)
+    {
+        return list_cached(&filter, fields);
+    }
+
+    // Without every field asked for, the card is told to leave the rest out
+    if (fields != (1 << LIST_FIELD_COUNT) - 1)
+    {
+        for (int i = 0; i < LIST_FIELD_COUNT; i++)
+        {
+            if (fields & (1 << i))
+            {
+                tagList[filter.tagList_count++] = list_fields[i].tag;
+            }
+        }
+    }
+
+    if (watch)
+    {
+        return list_watch(&filter, fields, interval_ms);
+    }
+
+    jprint_success_array_begin();
+
+    if (es10c_get_profiles_info_filtered_iter(&euicc_ctx, &filter, iter_profile_info, &fields))
+    {
+        jprint_success_array_abort("es10c_get_profiles_info", NULL);
+        return -1;
     }
-    es10c_profile_info_list_free_all(profiles);
 
-    jprint_success(jdata);
+    jprint_success_array_end();
 
     return 0;
 }
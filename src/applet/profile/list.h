@@ -1,5 +1,9 @@
 #pragma once
 
 #include <applet.h>
+#include <cjson/cJSON_ex.h>
 
 extern struct applet_entry applet_profile_list;
+
+// Every profile with every field of profile list but iconType and icon, from the cache when enabled, NULL on error
+cJSON *profile_list_brief_json(void);
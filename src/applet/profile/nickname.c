@@ -1,54 +1,78 @@
 #include "nickname.h"
+#include "batch.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <main.h>
+#include <cache.h>
 
 #include <euicc/es10c.h>
 
+static const char *nickname_reason(int ret)
+{
+    switch (ret)
+    {
+    case 1:
+        return "iccid not found";
+    default:
+        return "unknown";
+    }
+}
+
 static int applet_main(int argc, char **argv)
 {
     int ret;
+    int fret = 0;
     const char *iccid;
     const char *new_name;
+    cJSON *jdata = NULL;
+    cJSON *jprofiles = NULL;
 
     if (argc < 2)
     {
-        printf("Usage: %s [iccid] [new_name]\n", argv[0]);
-        printf("\t[new_name]: optional\n");
+        printf("Usage: %s [iccid] [new_name] [iccid] [new_name]...\n", argv[0]);
+        printf("\t[new_name]: optional for the last iccid\n");
         return -1;
     }
 
-    iccid = argv[1];
-    if (argc > 2)
-    {
-        new_name = argv[2];
-    }
-    else
+    cache_invalidate();
+
+    // One profile reports as it always did
+    if (argc <= 3)
     {
-        new_name = "";
+        iccid = argv[1];
+        new_name = argc > 2 ? argv[2] : "";
+        if ((ret = es10c_set_nickname(&euicc_ctx, iccid, new_name)))
+        {
+            jprint_error("es10c_set_nickname", nickname_reason(ret));
+            return -1;
+        }
+        jprint_success(NULL);
+        return 0;
     }
 
-    if ((ret = es10c_set_nickname(&euicc_ctx, iccid, new_name)))
+    // Names are taken as they are, even with a leading '-', so there are no options here
+    jprofiles = cJSON_CreateArray();
+    for (int i = 1; i < argc; i += 2)
     {
-        const char *reason;
-        switch (ret)
+        iccid = argv[i];
+        new_name = i + 1 < argc ? argv[i + 1] : "";
+
+        jprint_progress("es10c_set_nickname", iccid);
+        ret = es10c_set_nickname(&euicc_ctx, iccid, new_name);
+        if (ret)
         {
-        case 1:
-            reason = "iccid not found";
-            break;
-        default:
-            reason = "unknown";
-            break;
+            fret = -1;
         }
-        jprint_error("es10c_set_nickname", reason);
-        return -1;
+        profile_batch_result(jprofiles, iccid, ret, nickname_reason(ret));
     }
 
-    jprint_success(NULL);
+    jdata = cJSON_CreateObject();
+    cJSON_AddItemToObject(jdata, "profiles", jprofiles);
+    jprint_success(jdata);
 
-    return 0;
+    return fret;
 }
 
 struct applet_entry applet_profile_nickname = {
@@ -0,0 +1,492 @@
+#include "split.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <main.h>
+#include <cache.h>
+
+#include <euicc/es10b.h>
+#include <euicc/es9p.h>
+#include <euicc/base64.h>
+#include <euicc/hexutil.h>
+#include <euicc/tostr.h>
+
+// A profile download cut into the ES10b legs, run on the device, and the ES9+ legs, run wherever the SM-DP+ is
+// cheap to reach. Both sides take the session file in turn, each run does the next leg of its side and leaves the
+// artifacts the other side needs.
+static const char *opt_string = "s:m:i:c:h?";
+
+static char *split_read(const char *path)
+{
+    FILE *fp;
+    char *buf = NULL;
+    long len;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+    if (fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0)
+    {
+        buf = malloc(len + 1);
+        if (buf && fread(buf, 1, len, fp) == (size_t)len)
+        {
+            buf[len] = '\0';
+        }
+        else
+        {
+            free(buf);
+            buf = NULL;
+        }
+    }
+    fclose(fp);
+    return buf;
+}
+
+// Written next to the file and renamed over it, so the other side never picks up half a session
+static int split_write(const char *path, const cJSON *jstate)
+{
+    char *jstr;
+    char *tmp;
+    FILE *fp;
+    int fret = -1;
+
+    jstr = cJSON_PrintUnformatted(jstate);
+    tmp = malloc(strlen(path) + sizeof(".tmp"));
+    if (jstr == NULL || tmp == NULL)
+    {
+        goto exit;
+    }
+    sprintf(tmp, "%s.tmp", path);
+
+    fp = fopen(tmp, "w");
+    if (fp == NULL)
+    {
+        goto exit;
+    }
+    fputs(jstr, fp);
+    if (fclose(fp) != 0 || rename(tmp, path) != 0)
+    {
+        remove(tmp);
+        goto exit;
+    }
+    fret = 0;
+
+exit:
+    free(jstr);
+    free(tmp);
+    return fret;
+}
+
+static int split_take(cJSON *jstate, const char *name, char **value)
+{
+    cJSON *jitem = cJSON_GetObjectItem(jstate, name);
+
+    if (!cJSON_IsString(jitem))
+    {
+        return 0;
+    }
+    *value = strdup(jitem->valuestring);
+    return *value ? 1 : -1;
+}
+
+// The session file keeps the binary artifacts in the same base64 the SM-DP+ speaks
+static int split_take_blob(cJSON *jstate, const char *name, struct euicc_blob *blob)
+{
+    cJSON *jitem = cJSON_GetObjectItem(jstate, name);
+
+    if (!cJSON_IsString(jitem))
+    {
+        return 0;
+    }
+    blob->data = malloc(euicc_base64_decode_len(jitem->valuestring));
+    if (blob->data == NULL)
+    {
+        return -1;
+    }
+    blob->length = euicc_base64_decode(blob->data, jitem->valuestring);
+    return 1;
+}
+
+static void split_put_blob(cJSON *jstate, const char *name, const struct euicc_blob *blob)
+{
+    char *b64;
+
+    if (blob->data == NULL)
+    {
+        cJSON_AddNullToObject(jstate, name);
+        return;
+    }
+    b64 = malloc(euicc_base64_encode_len(blob->length));
+    if (b64 == NULL)
+    {
+        return;
+    }
+    euicc_base64_encode(b64, blob->data, blob->length);
+    cJSON_AddStringToObject(jstate, name, b64);
+    free(b64);
+}
+
+// Moves the artifacts into ctx->http._internal, where the blocking ES9+ and ES10b functions look for them
+static int split_load(cJSON *jstate)
+{
+    struct euicc_ctx *ctx = &euicc_ctx;
+
+    if (split_take(jstate, "transactionId", &ctx->http._internal.transaction_id_http) < 0 || split_take_blob(jstate, "euiccChallenge", &ctx->http._internal.euicc_challenge) < 0 || split_take_blob(jstate, "euiccInfo1", &ctx->http._internal.euicc_info_1) < 0 || split_take_blob(jstate, "authenticateServerResponse", &ctx->http._internal.authenticate_server_response) < 0 || split_take_blob(jstate, "prepareDownloadResponse", &ctx->http._internal.prepare_download_response) < 0 || split_take_blob(jstate, "boundProfilePackage", &ctx->http._internal.bound_profile_package) < 0)
+    {
+        return -1;
+    }
+
+    if (cJSON_IsString(cJSON_GetObjectItem(jstate, "serverSigned1")))
+    {
+        struct es10b_authenticate_server_param *param = calloc(1, sizeof(struct es10b_authenticate_server_param));
+
+        ctx->http._internal.authenticate_server_param = param;
+        if (param == NULL || split_take_blob(jstate, "serverSigned1", &param->serverSigned1) < 0 || split_take_blob(jstate, "serverSignature1", &param->serverSignature1) < 0 || split_take_blob(jstate, "euiccCiPKIdToBeUsed", &param->euiccCiPKIdToBeUsed) < 0 || split_take_blob(jstate, "serverCertificate", &param->serverCertificate) < 0)
+        {
+            return -1;
+        }
+    }
+
+    if (cJSON_IsString(cJSON_GetObjectItem(jstate, "smdpSigned2")))
+    {
+        struct es10b_prepare_download_param *param = calloc(1, sizeof(struct es10b_prepare_download_param));
+
+        ctx->http._internal.prepare_download_param = param;
+        if (param == NULL || split_take_blob(jstate, "profileMetadata", &param->profileMetadata) < 0 || split_take_blob(jstate, "smdpSigned2", &param->smdpSigned2) < 0 || split_take_blob(jstate, "smdpSignature2", &param->smdpSignature2) < 0 || split_take_blob(jstate, "smdpCertificate", &param->smdpCertificate) < 0)
+        {
+            return -1;
+        }
+    }
+
+    // The eUICC's copy of the transaction ID, for es10b_cancel_session after a failed leg
+    if (ctx->http._internal.transaction_id_http)
+    {
+        uint32_t len = strlen(ctx->http._internal.transaction_id_http) / 2;
+        int ret;
+
+        ctx->http._internal.transaction_id_bin = malloc(len ? len : 1);
+        if (ctx->http._internal.transaction_id_bin == NULL)
+        {
+            return -1;
+        }
+        ret = euicc_hexutil_hex2bin(ctx->http._internal.transaction_id_bin, len, ctx->http._internal.transaction_id_http);
+        ctx->http._internal.transaction_id_bin_len = ret < 0 ? 0 : ret;
+    }
+
+    return 0;
+}
+
+// Whatever the leg consumed is gone from ctx->http._internal by now, the session keeps the rest
+static cJSON *split_store(const char *smdp, const char *matchingId, const char *imei)
+{
+    struct euicc_ctx *ctx = &euicc_ctx;
+    const struct es10b_authenticate_server_param *asp = ctx->http._internal.authenticate_server_param;
+    const struct es10b_prepare_download_param *pdp = ctx->http._internal.prepare_download_param;
+    cJSON *jstate = cJSON_CreateObject();
+
+    if (jstate == NULL)
+    {
+        return NULL;
+    }
+
+    cJSON_AddStringOrNullToObject(jstate, "smdpAddress", smdp);
+    if (matchingId)
+    {
+        cJSON_AddStringOrNullToObject(jstate, "matchingId", matchingId);
+    }
+    if (imei)
+    {
+        cJSON_AddStringOrNullToObject(jstate, "imei", imei);
+    }
+    if (ctx->http._internal.transaction_id_http)
+    {
+        cJSON_AddStringOrNullToObject(jstate, "transactionId", ctx->http._internal.transaction_id_http);
+    }
+    if (ctx->http._internal.euicc_challenge.data)
+    {
+        split_put_blob(jstate, "euiccChallenge", &ctx->http._internal.euicc_challenge);
+    }
+    if (ctx->http._internal.euicc_info_1.data)
+    {
+        split_put_blob(jstate, "euiccInfo1", &ctx->http._internal.euicc_info_1);
+    }
+    if (asp)
+    {
+        split_put_blob(jstate, "serverSigned1", &asp->serverSigned1);
+        split_put_blob(jstate, "serverSignature1", &asp->serverSignature1);
+        split_put_blob(jstate, "euiccCiPKIdToBeUsed", &asp->euiccCiPKIdToBeUsed);
+        split_put_blob(jstate, "serverCertificate", &asp->serverCertificate);
+    }
+    if (ctx->http._internal.authenticate_server_response.data)
+    {
+        split_put_blob(jstate, "authenticateServerResponse", &ctx->http._internal.authenticate_server_response);
+    }
+    if (pdp)
+    {
+        split_put_blob(jstate, "profileMetadata", &pdp->profileMetadata);
+        split_put_blob(jstate, "smdpSigned2", &pdp->smdpSigned2);
+        split_put_blob(jstate, "smdpSignature2", &pdp->smdpSignature2);
+        split_put_blob(jstate, "smdpCertificate", &pdp->smdpCertificate);
+    }
+    if (ctx->http._internal.prepare_download_response.data)
+    {
+        split_put_blob(jstate, "prepareDownloadResponse", &ctx->http._internal.prepare_download_response);
+    }
+    if (ctx->http._internal.bound_profile_package.data)
+    {
+        split_put_blob(jstate, "boundProfilePackage", &ctx->http._internal.bound_profile_package);
+    }
+
+    return jstate;
+}
+
+static int split_device(const char *smdp, const char *matchingId, const char *imei, const char *confirmation_code, const char **step, const char **next, int *installed)
+{
+    struct euicc_ctx *ctx = &euicc_ctx;
+    struct es10b_load_bound_profile_package_result result = {0};
+    char buffer[256];
+
+    *installed = 0;
+    *next = "server";
+
+    if (ctx->http._internal.bound_profile_package.data)
+    {
+        *step = "es10b_load_bound_profile_package";
+        *next = NULL;
+        jprint_progress(*step, smdp);
+        result.bppCommandId = ES10B_BPP_COMMAND_ID_UNDEFINED;
+        result.errorReason = ES10B_ERROR_REASON_UNDEFINED;
+        if (es10b_load_bound_profile_package(ctx, &result))
+        {
+            snprintf(buffer, sizeof(buffer), "%s,%s", euicc_bppcommandid2str(result.bppCommandId), euicc_errorreason2str(result.errorReason));
+            jprint_error(*step, buffer);
+            return -1;
+        }
+        *installed = 1;
+        return 0;
+    }
+    if (ctx->http._internal.prepare_download_param)
+    {
+        *step = "es10b_prepare_download";
+        jprint_progress(*step, smdp);
+        if (es10b_prepare_download(ctx, confirmation_code))
+        {
+            jprint_error(*step, NULL);
+            return -1;
+        }
+        return 0;
+    }
+    if (ctx->http._internal.authenticate_server_param)
+    {
+        *step = "es10b_authenticate_server";
+        jprint_progress(*step, smdp);
+        if (es10b_authenticate_server(ctx, matchingId, imei))
+        {
+            jprint_error(*step, NULL);
+            return -1;
+        }
+        return 0;
+    }
+    if (ctx->http._internal.transaction_id_http == NULL && ctx->http._internal.euicc_challenge.data == NULL)
+    {
+        *step = "es10b_get_euicc_challenge_and_info";
+        jprint_progress(*step, smdp);
+        if (es10b_get_euicc_challenge_and_info(ctx))
+        {
+            jprint_error(*step, NULL);
+            return -1;
+        }
+        return 0;
+    }
+
+    jprint_error("profile split", "waiting for the server leg");
+    return -1;
+}
+
+static int split_server(const char *smdp, const char **step, const char **next)
+{
+    struct euicc_ctx *ctx = &euicc_ctx;
+    int ret;
+
+    *next = "device";
+
+    if (ctx->http._internal.prepare_download_response.data)
+    {
+        *step = "es9p_get_bound_profile_package";
+        jprint_progress(*step, smdp);
+        ret = es9p_get_bound_profile_package(ctx);
+    }
+    else if (ctx->http._internal.authenticate_server_response.data)
+    {
+        *step = "es9p_authenticate_client";
+        jprint_progress(*step, smdp);
+        ret = es9p_authenticate_client(ctx);
+    }
+    else if (ctx->http._internal.euicc_challenge.data && ctx->http._internal.euicc_info_1.data)
+    {
+        *step = "es9p_initiate_authentication";
+        jprint_progress(*step, smdp);
+        ret = es9p_initiate_authentication(ctx);
+    }
+    else
+    {
+        jprint_error("profile split", "waiting for the device leg");
+        return -1;
+    }
+
+    if (ret)
+    {
+        jprint_error(*step, ctx->http.status.message);
+        return -1;
+    }
+    jprint_progress_http(*step, smdp);
+    return 0;
+}
+
+static int applet_main(int argc, char **argv)
+{
+    int fret = 0;
+    int opt;
+    int server;
+    int installed = 0;
+    const char *path;
+    const char *step = NULL, *next = NULL;
+    char *smdp = NULL, *matchingId = NULL, *imei = NULL;
+    const char *confirmation_code = NULL;
+    char *jstr = NULL;
+    cJSON *jstate = NULL;
+    cJSON *jdata = NULL;
+
+    if (argc < 2 || (strcmp(argv[1], "device") != 0 && strcmp(argv[1], "server") != 0))
+    {
+        printf("Usage: %s <device|server> [OPTIONS] <file>\r\n", argv[0]);
+        printf("\t device: runs the next ES10b leg on the eUICC\r\n");
+        printf("\t server: runs the next ES9+ leg against the SM-DP+, without an eUICC\r\n");
+        printf("\t -s SM-DP+ Domain, for the first device leg\r\n");
+        printf("\t -m Matching ID, for the first device leg\r\n");
+        printf("\t -i IMEI, for the first device leg\r\n");
+        printf("\t -c Confirmation Code (Password), for the device leg that prepares the download\r\n");
+        printf("\t -h This help info\r\n");
+        return -1;
+    }
+    server = strcmp(argv[1], "server") == 0;
+    argc--;
+    argv++;
+
+    opt = getopt(argc, argv, opt_string);
+    while (opt != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            smdp = strdup(optarg);
+            break;
+        case 'm':
+            matchingId = strdup(optarg);
+            break;
+        case 'i':
+            imei = strdup(optarg);
+            break;
+        case 'c':
+            confirmation_code = optarg;
+            break;
+        case 'h':
+        case '?':
+            printf("Usage: split %s [OPTIONS] <file>\r\n", server ? "server" : "device");
+            return -1;
+        default:
+            break;
+        }
+        opt = getopt(argc, argv, opt_string);
+    }
+
+    if (optind >= argc)
+    {
+        jprint_error("profile split", "no session file specified");
+        goto err;
+    }
+    path = argv[optind];
+
+    // A device starts the session, so only its first leg may run without the file
+    jstr = split_read(path);
+    jstate = jstr ? cJSON_Parse(jstr) : cJSON_CreateObject();
+    if (!cJSON_IsObject(jstate) || (jstr == NULL && server))
+    {
+        jprint_error("profile split", "cannot read the session file");
+        goto err;
+    }
+    if (smdp == NULL && split_take(jstate, "smdpAddress", &smdp) < 0)
+    {
+        goto err;
+    }
+    if (matchingId == NULL && split_take(jstate, "matchingId", &matchingId) < 0)
+    {
+        goto err;
+    }
+    if (imei == NULL && split_take(jstate, "imei", &imei) < 0)
+    {
+        goto err;
+    }
+    if (smdp == NULL || strlen(smdp) == 0)
+    {
+        jprint_error("smdp is null", NULL);
+        goto err;
+    }
+    if (split_load(jstate) < 0)
+    {
+        jprint_error("profile split", "invalid session file");
+        goto err;
+    }
+    cJSON_Delete(jstate);
+    jstate = NULL;
+
+    euicc_ctx.http.server_address = smdp;
+
+    if (server ? split_server(smdp, &step, &next) : split_device(smdp, matchingId, imei, confirmation_code, &step, &next, &installed))
+    {
+        goto err;
+    }
+
+    if (installed)
+    {
+        cache_invalidate();
+        remove(path);
+    }
+    else
+    {
+        jstate = split_store(smdp, matchingId, imei);
+        if (jstate == NULL || split_write(path, jstate) < 0)
+        {
+            jprint_error("profile split", "cannot write the session file");
+            goto err;
+        }
+    }
+
+    jdata = cJSON_CreateObject();
+    cJSON_AddStringOrNullToObject(jdata, "step", step);
+    cJSON_AddStringOrNullToObject(jdata, "next", next);
+    jprint_success(jdata);
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    cJSON_Delete(jstate);
+    free(jstr);
+    euicc_http_cleanup(&euicc_ctx);
+    euicc_ctx.http.server_address = NULL;
+    free(smdp);
+    free(matchingId);
+    free(imei);
+    return fret;
+}
+
+struct applet_entry applet_profile_split = {
+    .name = "split",
+    .main = applet_main,
+};
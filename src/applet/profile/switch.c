@@ -0,0 +1,295 @@
+#include "switch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <main.h>
+#include <cache.h>
+
+#include <euicc/es10b.h>
+#include <euicc/es10c.h>
+#include <euicc/es9p.h>
+#include <euicc/tostr.h>
+
+static const char *opt_string = "r:nh?";
+
+struct switch_state
+{
+    const char *id;
+    char target[(10 * 2) + 1];
+    char previous[(10 * 2) + 1];
+    int found;
+    int enabled;
+};
+
+static int iter_switch_profile(struct es10c_profile_info_list *profile, void *userdata)
+{
+    struct switch_state *state = (struct switch_state *)userdata;
+
+    if (strcasecmp(profile->iccid, state->id) == 0 || strcasecmp(profile->isdpAid, state->id) == 0)
+    {
+        snprintf(state->target, sizeof(state->target), "%s", profile->iccid);
+        state->found = 1;
+        state->enabled = profile->profileState == ES10C_PROFILE_STATE_ENABLED;
+    }
+    else if (profile->profileState == ES10C_PROFILE_STATE_ENABLED)
+    {
+        snprintf(state->previous, sizeof(state->previous), "%s", profile->iccid);
+    }
+
+    es10c_profile_info_list_free_all(profile);
+
+    return 0;
+}
+
+struct switch_notification
+{
+    unsigned long seqNumber;
+    char *iccid;
+    struct es10b_pending_notification notification;
+};
+
+struct switch_notifications
+{
+    const struct switch_state *state;
+    struct switch_notification *items;
+    uint32_t count;
+};
+
+static int iter_switch_notification(struct es10b_notification_metadata_list *notification, void *userdata)
+{
+    struct switch_notifications *ud = (struct switch_notifications *)userdata;
+    int fret = 0;
+
+    if (notification->iccid &&
+        ((notification->profileManagementOperation == ES10B_PROFILE_MANAGEMENT_OPERATION_ENABLE && strcmp(notification->iccid, ud->state->target) == 0) ||
+         (notification->profileManagementOperation == ES10B_PROFILE_MANAGEMENT_OPERATION_DISABLE && strcmp(notification->iccid, ud->state->previous) == 0)))
+    {
+        struct switch_notification *items;
+
+        items = realloc(ud->items, (ud->count + 1) * sizeof(struct switch_notification));
+        if (items == NULL)
+        {
+            fret = -1;
+        }
+        else
+        {
+            ud->items = items;
+            memset(&items[ud->count], 0, sizeof(struct switch_notification));
+            items[ud->count].seqNumber = notification->seqNumber;
+            items[ud->count].iccid = strdup(notification->iccid);
+            ud->count++;
+        }
+    }
+
+    es10b_notification_metadata_list_free_all(notification);
+
+    return fret;
+}
+
+// Sends the enable and disable notifications of the switch, the outcome of each one goes into jnotifications
+static void switch_flush_notifications(const struct switch_state *state, cJSON *jnotifications)
+{
+    struct switch_notifications ud = {
+        .state = state,
+    };
+    const char **addresses = NULL;
+    const char **notifications = NULL;
+    int *results = NULL;
+    char str_seqNumber[11];
+
+    jprint_progress("es10b_list_notification", NULL);
+    if (es10b_list_notification_iter(&euicc_ctx, iter_switch_notification, &ud) || ud.count == 0)
+    {
+        goto exit;
+    }
+
+    addresses = malloc(ud.count * sizeof(char *));
+    notifications = malloc(ud.count * sizeof(char *));
+    results = malloc(ud.count * sizeof(int));
+    if (addresses == NULL || notifications == NULL || results == NULL)
+    {
+        goto exit;
+    }
+
+    for (uint32_t i = 0; i < ud.count; i++)
+    {
+        snprintf(str_seqNumber, sizeof(str_seqNumber), "%lu", ud.items[i].seqNumber);
+        jprint_progress("es10b_retrieve_notifications_list", str_seqNumber);
+        if (es10b_retrieve_notifications_list(&euicc_ctx, &ud.items[i].notification, ud.items[i].seqNumber))
+        {
+            goto exit;
+        }
+        addresses[i] = ud.items[i].notification.notificationAddress;
+        notifications[i] = ud.items[i].notification.b64_PendingNotification;
+    }
+
+    jprint_progress("es9p_handle_notification", NULL);
+    if (es9p_handle_notification_multi(&euicc_ctx, addresses, notifications, results, ud.count))
+    {
+        goto exit;
+    }
+    jprint_progress_http("es9p_handle_notification", NULL);
+
+    for (uint32_t i = 0; i < ud.count; i++)
+    {
+        cJSON *jnotification = cJSON_CreateObject();
+
+        // Only acknowledged notifications are removed, the rest stays for notification process
+        if (results[i] == 0)
+        {
+            snprintf(str_seqNumber, sizeof(str_seqNumber), "%lu", ud.items[i].seqNumber);
+            jprint_progress("es10b_remove_notification_from_list", str_seqNumber);
+            if (es10b_remove_notification_from_list(&euicc_ctx, ud.items[i].seqNumber))
+            {
+                results[i] = -1;
+            }
+        }
+
+        cJSON_AddNumberToObject(jnotification, "seqNumber", ud.items[i].seqNumber);
+        cJSON_AddStringOrNullToObject(jnotification, "iccid", ud.items[i].iccid);
+        cJSON_AddBoolToObject(jnotification, "sent", results[i] == 0);
+        cJSON_AddItemToArray(jnotifications, jnotification);
+    }
+
+exit:
+    for (uint32_t i = 0; i < ud.count; i++)
+    {
+        free(ud.items[i].iccid);
+        es10b_pending_notification_free(&ud.items[i].notification);
+    }
+    free(ud.items);
+    free(addresses);
+    free(notifications);
+    free(results);
+}
+
+static int applet_main(int argc, char **argv)
+{
+    static const uint16_t tagList[] = {0x5A, 0x4F, 0x9F70};
+    const struct es10c_profile_info_filter filter = {
+        .tagList = tagList,
+        .tagList_count = sizeof(tagList) / sizeof(tagList[0]),
+    };
+    struct switch_state state = {0};
+    int opt;
+    int ret;
+    int refreshflag = 0;
+    int flush = 1;
+    cJSON *jdata = NULL;
+    cJSON *jnotifications = NULL;
+
+    opt = getopt(argc, argv, opt_string);
+    while (opt != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            refreshflag = atoi(optarg);
+            break;
+        case 'n':
+            flush = 0;
+            break;
+        case 'h':
+        case '?':
+            printf("Usage: %s [OPTIONS] <iccid/aid>\r\n", argv[0]);
+            printf("\t -r refreshFlag, 1 lets the eUICC ask the modem for a REFRESH [default: 0]\r\n");
+            printf("\t -n Leave the enable and disable notifications pending\r\n");
+            printf("\t -h This help info\r\n");
+            return -1;
+        }
+        opt = getopt(argc, argv, opt_string);
+    }
+
+    if (optind >= argc)
+    {
+        jprint_error("profile switch", "no iccid or aid specified");
+        return -1;
+    }
+    state.id = argv[optind];
+
+    // Only ICCID, AID and state of each profile, a few bytes per profile instead of the full list with icons
+    jprint_progress("es10c_get_profiles_info", state.id);
+    if (es10c_get_profiles_info_filtered_iter(&euicc_ctx, &filter, iter_switch_profile, &state))
+    {
+        jprint_error("es10c_get_profiles_info", NULL);
+        return -1;
+    }
+    if (!state.found)
+    {
+        jprint_error("es10c_enable_profile", "iccid or aid not found");
+        return -1;
+    }
+
+    if (!state.enabled)
+    {
+        cache_invalidate();
+
+        // EnableProfile disables the enabled profile itself, no DisableProfile round trip is needed
+        jprint_progress("es10c_enable_profile", state.target);
+        ret = es10c_enable_profile(&euicc_ctx, state.target, refreshflag);
+        if (ret)
+        {
+            const char *reason;
+            switch (ret)
+            {
+            case 1:
+                reason = "iccid or aid not found";
+                break;
+            case 2:
+                reason = "profile not in disabled state";
+                break;
+            case 3:
+                reason = "disallowed by policy";
+                break;
+            case 4:
+                reason = "wrong profile reenabling";
+                break;
+            case 5:
+                reason = "cat busy";
+                break;
+            case -1:
+                reason = "internal error, maybe illegal iccid/aid coding";
+                break;
+            default:
+                reason = "unknown";
+                break;
+            }
+            jprint_error("es10c_enable_profile", reason);
+            return -1;
+        }
+    }
+
+    jdata = cJSON_CreateObject();
+    cJSON_AddStringOrNullToObject(jdata, "iccid", state.target);
+    cJSON_AddStringOrNullToObject(jdata, "profileState", euicc_profilestate2str(ES10C_PROFILE_STATE_ENABLED));
+    if (state.previous[0])
+    {
+        cJSON *jprevious = cJSON_CreateObject();
+
+        cJSON_AddStringOrNullToObject(jprevious, "iccid", state.previous);
+        cJSON_AddStringOrNullToObject(jprevious, "profileState", euicc_profilestate2str(ES10C_PROFILE_STATE_DISABLED));
+        cJSON_AddItemToObject(jdata, "previous", jprevious);
+    }
+    else
+    {
+        cJSON_AddNullToObject(jdata, "previous");
+    }
+
+    jnotifications = cJSON_CreateArray();
+    if (flush && !state.enabled)
+    {
+        switch_flush_notifications(&state, jnotifications);
+    }
+    cJSON_AddItemToObject(jdata, "notifications", jnotifications);
+
+    jprint_success(jdata);
+
+    return 0;
+}
+
+struct applet_entry applet_profile_switch = {
+    .name = "switch",
+    .main = applet_main,
+};
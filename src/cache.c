@@ -0,0 +1,347 @@
+#include "cache.h"
+#include "main.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <euicc/es10b.h>
+#include <euicc/es10c.h>
+
+#define CACHE_ISD_R_AID "isd-r"
+#define CACHE_TRANSPORT "transport"
+
+static char cache_eid[32 + 1];
+static char cache_probe[64];
+static int cache_probe_reused;
+
+int cache_enabled(void)
+{
+    return getenv("LPAC_CACHE_DIR") != NULL;
+}
+
+static char *cache_path(const char *name, const char *suffix)
+{
+    const char *dir = getenv("LPAC_CACHE_DIR");
+    char *path;
+
+    path = malloc(strlen(dir) + 1 + strlen(name) + sizeof(".json") + strlen(suffix));
+    if (path == NULL)
+    {
+        return NULL;
+    }
+    sprintf(path, "%s/%s.json%s", dir, name, suffix);
+    return path;
+}
+
+static int cache_read_eid(void)
+{
+    char *eid = NULL;
+
+    if (es10c_get_eid(&euicc_ctx, &eid) < 0)
+    {
+        return -1;
+    }
+    snprintf(cache_eid, sizeof(cache_eid), "%s", eid);
+    free(eid);
+    return 0;
+}
+
+struct cache_probe_userdata
+{
+    uint32_t count;
+    unsigned long seqNumber;
+};
+
+static int iter_cache_probe(struct es10b_notification_metadata_list *notification, void *userdata)
+{
+    struct cache_probe_userdata *ud = (struct cache_probe_userdata *)userdata;
+
+    ud->count++;
+    if (notification->seqNumber > ud->seqNumber)
+    {
+        ud->seqNumber = notification->seqNumber;
+    }
+    es10b_notification_metadata_list_free_all(notification);
+    return 0;
+}
+
+// Installing, enabling, disabling and deleting a profile queue a notification with the next seqNumber,
+// so the pending ones tell whether another LPA changed the card
+static int cache_take_probe(void)
+{
+    struct cache_probe_userdata ud = {0};
+
+    if (cache_read_eid() < 0)
+    {
+        return -1;
+    }
+
+    if (es10b_list_notification_iter(&euicc_ctx, iter_cache_probe, &ud) < 0)
+    {
+        return -1;
+    }
+    snprintf(cache_probe, sizeof(cache_probe), "%lu/%u", ud.seqNumber, ud.count);
+    return 0;
+}
+
+static cJSON *cache_read(const char *name)
+{
+    char *path;
+    FILE *fp;
+    char *buf = NULL;
+    long len;
+    cJSON *jcache = NULL;
+
+    path = cache_path(name, "");
+    if (path == NULL)
+    {
+        return NULL;
+    }
+    fp = fopen(path, "rb");
+    free(path);
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+
+    if (fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0)
+    {
+        buf = malloc(len + 1);
+        if (buf && fread(buf, 1, len, fp) == (size_t)len)
+        {
+            buf[len] = '\0';
+            jcache = cJSON_Parse(buf);
+        }
+        free(buf);
+    }
+    fclose(fp);
+
+    return jcache;
+}
+
+// Written next to the target and renamed over it, so a concurrent reader never sees half a file
+static void cache_write(const char *name, const cJSON *jcache)
+{
+    char *path = NULL, *tmp = NULL, *jstr = NULL;
+    FILE *fp;
+
+    jstr = cJSON_PrintUnformatted(jcache);
+    path = cache_path(name, "");
+    tmp = cache_path(name, ".tmp");
+    if (jstr == NULL || path == NULL || tmp == NULL)
+    {
+        goto exit;
+    }
+
+    fp = fopen(tmp, "w");
+    if (fp == NULL)
+    {
+        goto exit;
+    }
+    fputs(jstr, fp);
+    if (fclose(fp) != 0 || rename(tmp, path) != 0)
+    {
+        remove(tmp);
+    }
+
+exit:
+    free(jstr);
+    free(path);
+    free(tmp);
+}
+
+static cJSON *cache_load(void)
+{
+    cJSON *jcache;
+
+    jcache = cache_read(cache_eid);
+    if (jcache == NULL)
+    {
+        return NULL;
+    }
+
+    if (!cJSON_IsString(cJSON_GetObjectItem(jcache, "probe")) || strcmp(cJSON_GetObjectItem(jcache, "probe")->valuestring, cache_probe) != 0)
+    {
+        cJSON_Delete(jcache);
+        return NULL;
+    }
+
+    return jcache;
+}
+
+cJSON *cache_get(const char *name)
+{
+    cJSON *jcache;
+    cJSON *jdata = NULL;
+
+    if (!cache_enabled())
+    {
+        return NULL;
+    }
+    if (!cache_probe_reused || cache_eid[0] == '\0')
+    {
+        if (cache_take_probe() < 0)
+        {
+            cache_eid[0] = '\0';
+            return NULL;
+        }
+    }
+
+    jcache = cache_load();
+    if (jcache == NULL)
+    {
+        return NULL;
+    }
+
+    if (cJSON_GetObjectItem(jcache, name))
+    {
+        jdata = cJSON_Duplicate(cJSON_GetObjectItem(jcache, name), 1);
+    }
+    cJSON_Delete(jcache);
+
+    return jdata;
+}
+
+void cache_probe_reuse(int reuse)
+{
+    cache_probe_reused = reuse;
+}
+
+void cache_put(const char *name, const cJSON *jdata)
+{
+    cJSON *jcache;
+
+    if (!cache_enabled() || cache_eid[0] == '\0')
+    {
+        return;
+    }
+
+    jcache = cache_load();
+    if (jcache == NULL)
+    {
+        jcache = cJSON_CreateObject();
+        cJSON_AddStringToObject(jcache, "probe", cache_probe);
+    }
+    cJSON_DeleteItemFromObject(jcache, name);
+    cJSON_AddItemToObject(jcache, name, cJSON_Duplicate(jdata, 1));
+
+    cache_write(cache_eid, jcache);
+    cJSON_Delete(jcache);
+}
+
+void cache_invalidate(void)
+{
+    char *path;
+
+    if (!cache_enabled() || cache_read_eid() < 0)
+    {
+        return;
+    }
+
+    path = cache_path(cache_eid, "");
+    if (path)
+    {
+        remove(path);
+        free(path);
+    }
+    cache_eid[0] = '\0';
+}
+
+// Not tied to an EID, the card cannot be asked for one before its ISD-R is open
+const char *cache_isd_r_aid_get(const char *identity)
+{
+    static char aid[32 + 1];
+    cJSON *jcache;
+    cJSON *jaid;
+
+    if (!cache_enabled())
+    {
+        return NULL;
+    }
+
+    jcache = cache_read(CACHE_ISD_R_AID);
+    jaid = cJSON_GetObjectItem(jcache, identity);
+    if (!cJSON_IsString(jaid) || strlen(jaid->valuestring) >= sizeof(aid))
+    {
+        cJSON_Delete(jcache);
+        return NULL;
+    }
+    strcpy(aid, jaid->valuestring);
+    cJSON_Delete(jcache);
+
+    return aid;
+}
+
+void cache_isd_r_aid_put(const char *identity, const char *aid)
+{
+    cJSON *jcache;
+
+    if (!cache_enabled())
+    {
+        return;
+    }
+
+    jcache = cache_read(CACHE_ISD_R_AID);
+    if (!cJSON_IsObject(jcache))
+    {
+        cJSON_Delete(jcache);
+        jcache = cJSON_CreateObject();
+    }
+    if (cJSON_IsString(cJSON_GetObjectItem(jcache, identity)) && strcmp(cJSON_GetObjectItem(jcache, identity)->valuestring, aid) == 0)
+    {
+        cJSON_Delete(jcache);
+        return;
+    }
+    cJSON_DeleteItemFromObject(jcache, identity);
+    cJSON_AddStringToObject(jcache, identity, aid);
+
+    cache_write(CACHE_ISD_R_AID, jcache);
+    cJSON_Delete(jcache);
+}
+
+uint32_t cache_segment_size_get(const char *identity)
+{
+    cJSON *jcache;
+    cJSON *jsize;
+    uint32_t segment_size = 0;
+
+    if (!cache_enabled())
+    {
+        return 0;
+    }
+
+    jcache = cache_read(CACHE_TRANSPORT);
+    jsize = cJSON_GetObjectItem(cJSON_GetObjectItem(jcache, identity), "segment_size");
+    if (cJSON_IsNumber(jsize) && jsize->valuedouble > 0 && jsize->valuedouble <= 0xFFFF)
+    {
+        segment_size = jsize->valuedouble;
+    }
+    cJSON_Delete(jcache);
+
+    return segment_size;
+}
+
+void cache_segment_size_put(const char *identity, uint32_t segment_size)
+{
+    cJSON *jcache;
+    cJSON *jentry;
+
+    if (!cache_enabled())
+    {
+        return;
+    }
+
+    jcache = cache_read(CACHE_TRANSPORT);
+    if (!cJSON_IsObject(jcache))
+    {
+        cJSON_Delete(jcache);
+        jcache = cJSON_CreateObject();
+    }
+    cJSON_DeleteItemFromObject(jcache, identity);
+    jentry = cJSON_AddObjectToObject(jcache, identity);
+    cJSON_AddNumberToObject(jentry, "segment_size", segment_size);
+
+    cache_write(CACHE_TRANSPORT, jcache);
+    cJSON_Delete(jcache);
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <cjson/cJSON_ex.h>
+#include <stdint.h>
+
+// Decoded card data kept per EID under LPAC_CACHE_DIR, checked against a cheap probe of the card on each use
+int cache_enabled(void);
+// Returns a copy of the cached entry, NULL when it is missing or the card changed since it was stored
+cJSON *cache_get(const char *name);
+// Stores a copy of jdata along with the probe taken by the last cache_get
+void cache_put(const char *name, const cJSON *jdata);
+// While set, cache_get trusts the probe taken by the last one instead of taking another, for a command that reads
+// several entries and changes nothing on the card
+void cache_probe_reuse(int reuse);
+// Drops everything cached for the card, to be called once lpac changed its state
+void cache_invalidate(void);
+// The ISD-R AID that opened last on the card or reader named by identity, as hex, NULL when none is known
+const char *cache_isd_r_aid_get(const char *identity);
+void cache_isd_r_aid_put(const char *identity, const char *aid);
+// The STORE DATA segment size calibration chose for the card or reader named by identity, 0 when none is known
+uint32_t cache_segment_size_get(const char *identity);
+void cache_segment_size_put(const char *identity, uint32_t segment_size);
@@ -0,0 +1,197 @@
+#include "calibrate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Large enough for several segments at every candidate, small enough for a slow modem at first contact
+#define CALIBRATE_REQUEST_SIZE 2048
+
+static const uint32_t calibrate_short_sizes[] = {120, 255};
+// Only on interfaces with extended_length, the card may still reject them
+static const uint32_t calibrate_extended_sizes[] = {512, 1024, 2048};
+
+static uint32_t calibrate_der_length(uint8_t *out, uint32_t len)
+{
+    if (len < 0x80)
+    {
+        out[0] = len;
+        return 1;
+    }
+    if (len <= 0xFF)
+    {
+        out[0] = 0x81;
+        out[1] = len;
+        return 2;
+    }
+    if (len <= 0xFFFF)
+    {
+        out[0] = 0x82;
+        out[1] = len >> 8;
+        out[2] = len;
+        return 3;
+    }
+    out[0] = 0x83;
+    out[1] = len >> 16;
+    out[2] = len >> 8;
+    out[3] = len;
+    return 4;
+}
+
+uint8_t *calibrate_padded_request(uint32_t size, uint32_t *req_len)
+{
+    uint8_t inner[4], outer[4];
+    uint32_t inner_len, outer_len, body_len;
+    uint8_t *req, *p;
+
+    inner_len = calibrate_der_length(inner, size);
+    body_len = 1 + inner_len + size;
+    outer_len = calibrate_der_length(outer, body_len);
+
+    *req_len = 2 + outer_len + body_len;
+    req = malloc(*req_len);
+    if (req == NULL)
+    {
+        return NULL;
+    }
+
+    p = req;
+    *p++ = 0xBF;
+    *p++ = 0x2D;
+    memcpy(p, outer, outer_len);
+    p += outer_len;
+    *p++ = 0x5C;
+    memcpy(p, inner, inner_len);
+    p += inner_len;
+    memset(p, 0x5A, size);
+
+    return req;
+}
+
+static int calibrate_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Median request time in microseconds, 0 when the card failed or fell back to short APDUs
+static uint64_t calibrate_candidate(struct euicc_ctx *ctx, uint32_t segment_size, const uint8_t *req, uint32_t req_len, uint32_t iterations, cJSON *jcandidates)
+{
+    uint64_t *durations_us;
+    uint64_t start_us, median_us = 0;
+    uint32_t apdus, get_responses, failures = 0;
+    const uint8_t *resp;
+    uint32_t resp_len;
+    cJSON *jcandidate;
+    const char *status = "ok";
+
+    durations_us = calloc(iterations, sizeof(uint64_t));
+    if (durations_us == NULL)
+    {
+        return 0;
+    }
+
+    ctx->apdu.segment_size = segment_size;
+    ctx->apdu._internal.extended_length_rejected = 0;
+
+    // Warm-up, not counted
+    euicc_es10x_transceive(ctx, req, req_len, &resp, &resp_len);
+
+    apdus = ctx->apdu.stats.apdus;
+    get_responses = ctx->apdu.stats.get_responses;
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        start_us = euicc_now_us();
+        if (euicc_es10x_transceive(ctx, req, req_len, &resp, &resp_len) < 0)
+        {
+            failures++;
+            continue;
+        }
+        durations_us[i - failures] = euicc_now_us() - start_us;
+    }
+    apdus = ctx->apdu.stats.apdus - apdus;
+    get_responses = ctx->apdu.stats.get_responses - get_responses;
+
+    if (ctx->apdu._internal.extended_length_rejected)
+    {
+        status = "rejected";
+    }
+    else if (failures == iterations)
+    {
+        status = "failed";
+    }
+    else
+    {
+        qsort(durations_us, iterations - failures, sizeof(uint64_t), calibrate_compare);
+        median_us = durations_us[(iterations - failures) / 2];
+        if (median_us == 0)
+        {
+            median_us = 1;
+        }
+    }
+    free(durations_us);
+
+    if (jcandidates)
+    {
+        jcandidate = cJSON_CreateObject();
+        cJSON_AddNumberToObject(jcandidate, "segment_size", segment_size);
+        cJSON_AddStringToObject(jcandidate, "status", status);
+        cJSON_AddNumberToObject(jcandidate, "request_bytes", req_len);
+        cJSON_AddNumberToObject(jcandidate, "failures", failures);
+        cJSON_AddNumberToObject(jcandidate, "apdus_per_request", (double)apdus / iterations);
+        cJSON_AddNumberToObject(jcandidate, "get_responses_per_request", (double)get_responses / iterations);
+        if (median_us)
+        {
+            cJSON_AddNumberToObject(jcandidate, "p50_ms", median_us / 1000.0);
+            cJSON_AddNumberToObject(jcandidate, "tx_bytes_per_second", req_len * 1000000.0 / median_us);
+        }
+        cJSON_AddItemToArray(jcandidates, jcandidate);
+    }
+
+    return median_us;
+}
+
+uint32_t calibrate_segment_size(struct euicc_ctx *ctx, uint32_t iterations, cJSON *jcandidates)
+{
+    uint32_t segment_size_prev = ctx->apdu.segment_size;
+    uint8_t rejected = ctx->apdu._internal.extended_length_rejected;
+    uint32_t best = 0;
+    uint64_t best_us = 0, median_us;
+    uint8_t *req;
+    uint32_t req_len;
+    size_t short_count = sizeof(calibrate_short_sizes) / sizeof(calibrate_short_sizes[0]);
+    size_t extended_count = ctx->apdu.interface->extended_length ? sizeof(calibrate_extended_sizes) / sizeof(calibrate_extended_sizes[0]) : 0;
+
+    if (iterations == 0)
+    {
+        return 0;
+    }
+
+    req = calibrate_padded_request(CALIBRATE_REQUEST_SIZE, &req_len);
+    if (req == NULL)
+    {
+        return 0;
+    }
+
+    for (size_t i = 0; i < short_count + extended_count; i++)
+    {
+        uint32_t segment_size = i < short_count ? calibrate_short_sizes[i] : calibrate_extended_sizes[i - short_count];
+
+        median_us = calibrate_candidate(ctx, segment_size, req, req_len, iterations, jcandidates);
+        if (i >= short_count && ctx->apdu._internal.extended_length_rejected)
+        {
+            rejected = 1;
+        }
+        // Ties go to the smaller segment, the one more readers and cards handle
+        if (median_us && (best == 0 || median_us < best_us))
+        {
+            best = segment_size;
+            best_us = median_us;
+        }
+    }
+    free(req);
+
+    ctx->apdu.segment_size = segment_size_prev;
+    ctx->apdu._internal.extended_length_rejected = rejected;
+
+    return best;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <cjson/cJSON_ex.h>
+#include <euicc/euicc.h>
+
+#define CALIBRATE_ITERATIONS_DEFAULT 3
+
+// ProfileInfoListRequest whose tagList carries size bytes, so the request spreads over several STORE DATA segments
+uint8_t *calibrate_padded_request(uint32_t size, uint32_t *req_len);
+// Times a padded request with each candidate STORE DATA segment size and returns the fastest one the card took, 0 when
+// none worked. Leaves ctx->apdu.segment_size as it was. Adds one object per candidate to jcandidates when not NULL.
+uint32_t calibrate_segment_size(struct euicc_ctx *ctx, uint32_t iterations, cJSON *jcandidates);
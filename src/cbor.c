@@ -0,0 +1,283 @@
+#include "cbor.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <euicc/base64.h>
+#include <euicc/hexutil.h>
+
+#define CBOR_MAJOR_UNSIGNED 0
+#define CBOR_MAJOR_NEGATIVE 1
+#define CBOR_MAJOR_BYTES 2
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+#define CBOR_NULL 0xF6
+#define CBOR_FLOAT64 0xFB
+
+enum cbor_string
+{
+    CBOR_STRING_TEXT,
+    CBOR_STRING_BASE64,
+    CBOR_STRING_HEX,
+};
+
+// The value under the key, or each element of the array under it
+static const struct
+{
+    const char *key;
+    enum cbor_string encoding;
+} cbor_binary_fields[] = {
+    {"icon", CBOR_STRING_BASE64},
+    {"euiccCiPKIdListForVerification", CBOR_STRING_HEX},
+    {"euiccCiPKIdListForSigning", CBOR_STRING_HEX},
+};
+
+struct cbor_buffer
+{
+    uint8_t *data;
+    uint32_t length;
+    uint32_t capacity;
+    int failed;
+};
+
+static uint8_t *cbor_reserve(struct cbor_buffer *buffer, uint32_t length)
+{
+    uint8_t *data_new;
+    uint32_t capacity;
+
+    if (buffer->failed)
+    {
+        return NULL;
+    }
+    if (buffer->length + length > buffer->capacity)
+    {
+        capacity = buffer->capacity ? buffer->capacity : 256;
+        while (capacity < buffer->length + length)
+        {
+            capacity *= 2;
+        }
+        data_new = realloc(buffer->data, capacity);
+        if (data_new == NULL)
+        {
+            buffer->failed = 1;
+            return NULL;
+        }
+        buffer->data = data_new;
+        buffer->capacity = capacity;
+    }
+
+    data_new = buffer->data + buffer->length;
+    buffer->length += length;
+    return data_new;
+}
+
+static void cbor_put(struct cbor_buffer *buffer, const void *data, uint32_t length)
+{
+    uint8_t *p = cbor_reserve(buffer, length);
+
+    if (p && length)
+    {
+        memcpy(p, data, length);
+    }
+}
+
+// Initial byte and argument, in the shortest form
+static void cbor_head(struct cbor_buffer *buffer, uint8_t major, uint64_t value)
+{
+    uint8_t head[9];
+    uint32_t length, bytes;
+
+    if (value < 24)
+    {
+        head[0] = (major << 5) | value;
+        cbor_put(buffer, head, 1);
+        return;
+    }
+
+    if (value <= 0xFF)
+    {
+        head[0] = (major << 5) | 24;
+        bytes = 1;
+    }
+    else if (value <= 0xFFFF)
+    {
+        head[0] = (major << 5) | 25;
+        bytes = 2;
+    }
+    else if (value <= 0xFFFFFFFF)
+    {
+        head[0] = (major << 5) | 26;
+        bytes = 4;
+    }
+    else
+    {
+        head[0] = (major << 5) | 27;
+        bytes = 8;
+    }
+    for (length = 0; length < bytes; length++)
+    {
+        head[1 + length] = value >> (8 * (bytes - 1 - length));
+    }
+    cbor_put(buffer, head, 1 + bytes);
+}
+
+static void cbor_byte(struct cbor_buffer *buffer, uint8_t byte)
+{
+    cbor_put(buffer, &byte, 1);
+}
+
+static void cbor_text(struct cbor_buffer *buffer, const char *str)
+{
+    uint32_t length = strlen(str);
+
+    cbor_head(buffer, CBOR_MAJOR_TEXT, length);
+    cbor_put(buffer, str, length);
+}
+
+// Integers that a double holds exactly go out as such, the rest as float64
+static void cbor_number(struct cbor_buffer *buffer, double number)
+{
+    uint8_t head[9];
+    uint64_t bits;
+
+    if (number >= -9007199254740992.0 && number <= 9007199254740992.0 && (double)(int64_t)number == number)
+    {
+        int64_t integer = (int64_t)number;
+
+        if (integer >= 0)
+        {
+            cbor_head(buffer, CBOR_MAJOR_UNSIGNED, integer);
+        }
+        else
+        {
+            cbor_head(buffer, CBOR_MAJOR_NEGATIVE, -1 - integer);
+        }
+        return;
+    }
+
+    memcpy(&bits, &number, sizeof(bits));
+    head[0] = CBOR_FLOAT64;
+    for (int i = 0; i < 8; i++)
+    {
+        head[1 + i] = bits >> (8 * (7 - i));
+    }
+    cbor_put(buffer, head, sizeof(head));
+}
+
+// A value that does not decode is kept as text
+static void cbor_string(struct cbor_buffer *buffer, const char *str, enum cbor_string encoding)
+{
+    uint8_t *bytes = NULL;
+    int length = -1;
+
+    switch (encoding)
+    {
+    case CBOR_STRING_BASE64:
+        bytes = malloc(euicc_base64_decode_len(str));
+        if (bytes)
+        {
+            length = euicc_base64_decode(bytes, str);
+        }
+        break;
+    case CBOR_STRING_HEX:
+        bytes = malloc(strlen(str) / 2 + 1);
+        if (bytes)
+        {
+            length = euicc_hexutil_hex2bin_r(bytes, strlen(str) / 2 + 1, str, strlen(str));
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (length < 0)
+    {
+        cbor_text(buffer, str);
+    }
+    else
+    {
+        cbor_head(buffer, CBOR_MAJOR_BYTES, length);
+        cbor_put(buffer, bytes, length);
+    }
+    free(bytes);
+}
+
+static enum cbor_string cbor_field_encoding(const char *key)
+{
+    if (key == NULL)
+    {
+        return CBOR_STRING_TEXT;
+    }
+    for (size_t i = 0; i < sizeof(cbor_binary_fields) / sizeof(cbor_binary_fields[0]); i++)
+    {
+        if (strcmp(cbor_binary_fields[i].key, key) == 0)
+        {
+            return cbor_binary_fields[i].encoding;
+        }
+    }
+    return CBOR_STRING_TEXT;
+}
+
+static void cbor_item(struct cbor_buffer *buffer, const cJSON *item, enum cbor_string encoding)
+{
+    const cJSON *child;
+    uint32_t count;
+
+    switch (item->type & 0xFF)
+    {
+    case cJSON_False:
+        cbor_byte(buffer, CBOR_FALSE);
+        break;
+    case cJSON_True:
+        cbor_byte(buffer, CBOR_TRUE);
+        break;
+    case cJSON_Number:
+        cbor_number(buffer, item->valuedouble);
+        break;
+    case cJSON_String:
+        cbor_string(buffer, item->valuestring, encoding);
+        break;
+    case cJSON_Raw:
+        cbor_text(buffer, item->valuestring);
+        break;
+    case cJSON_Array:
+        count = cJSON_GetArraySize(item);
+        cbor_head(buffer, CBOR_MAJOR_ARRAY, count);
+        cJSON_ArrayForEach(child, item)
+        {
+            cbor_item(buffer, child, encoding);
+        }
+        break;
+    case cJSON_Object:
+        count = cJSON_GetArraySize(item);
+        cbor_head(buffer, CBOR_MAJOR_MAP, count);
+        cJSON_ArrayForEach(child, item)
+        {
+            cbor_text(buffer, child->string ? child->string : "");
+            cbor_item(buffer, child, cbor_field_encoding(child->string));
+        }
+        break;
+    default:
+        cbor_byte(buffer, CBOR_NULL);
+        break;
+    }
+}
+
+uint8_t *cbor_encode(const cJSON *item, uint32_t *len)
+{
+    struct cbor_buffer buffer = {0};
+
+    cbor_item(&buffer, item, CBOR_STRING_TEXT);
+    if (buffer.failed)
+    {
+        free(buffer.data);
+        return NULL;
+    }
+
+    *len = buffer.length;
+    return buffer.data;
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include <stdint.h>
+#include <cjson/cJSON_ex.h>
+
+// CBOR (RFC 8949) encoding of a cJSON tree. Strings of the fields known to carry binary data, base64 or hex in the
+// JSON output, become byte strings.
+uint8_t *cbor_encode(const cJSON *item, uint32_t *len);
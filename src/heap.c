@@ -0,0 +1,257 @@
+#include "heap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Operations nested deeper are counted in the ones around them only
+#define HEAP_FRAMES_MAX 8
+
+// Replaces malloc for the whole binary, so only built on request
+#if defined(LPAC_HEAP_STATS) && defined(__GLIBC__)
+#include <malloc.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static int heap_enabled;
+
+// Totals since heap_stats_init, the HTTP backends may allocate from threads of their own
+static uint64_t heap_allocs;
+static uint64_t heap_frees;
+static uint64_t heap_bytes;
+// Blocks allocated before counting began are freed too, so this may go below 0
+static int64_t heap_level;
+
+static struct heap_frame
+{
+    const char *name;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t bytes;
+    int64_t level;
+    int64_t level_max;
+} heap_frames[HEAP_FRAMES_MAX];
+// Only the main thread opens and closes frames, allocations on any thread raise level_max of the open ones
+static uint32_t heap_depth;
+
+static struct heap_stats heap_stats;
+
+static void heap_count_alloc(void *ptr)
+{
+    size_t size;
+    int64_t level;
+    uint32_t depth;
+
+    if (!heap_enabled || ptr == NULL)
+    {
+        return;
+    }
+
+    size = malloc_usable_size(ptr);
+    __atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&heap_bytes, size, __ATOMIC_RELAXED);
+    level = __atomic_add_fetch(&heap_level, size, __ATOMIC_RELAXED);
+
+    depth = __atomic_load_n(&heap_depth, __ATOMIC_ACQUIRE);
+    if (depth > HEAP_FRAMES_MAX)
+    {
+        depth = HEAP_FRAMES_MAX;
+    }
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        int64_t level_max = __atomic_load_n(&heap_frames[i].level_max, __ATOMIC_RELAXED);
+
+        while (level > level_max && !__atomic_compare_exchange_n(&heap_frames[i].level_max, &level_max, level, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+        }
+    }
+}
+
+static void heap_count_free(void *ptr)
+{
+    if (!heap_enabled || ptr == NULL)
+    {
+        return;
+    }
+
+    __atomic_fetch_add(&heap_frees, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&heap_level, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+
+    heap_count_alloc(ptr);
+    return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *ptr = __libc_calloc(nmemb, size);
+
+    heap_count_alloc(ptr);
+    return ptr;
+}
+
+// Counted as a free of the old block and an allocation of the new one, even when it grew in place
+void *realloc(void *ptr, size_t size)
+{
+    void *ptr_new;
+
+    heap_count_free(ptr);
+    ptr_new = __libc_realloc(ptr, size);
+    if (ptr_new == NULL && size)
+    {
+        // The old block is still there
+        heap_count_alloc(ptr);
+        return NULL;
+    }
+    heap_count_alloc(ptr_new);
+    return ptr_new;
+}
+
+void free(void *ptr)
+{
+    heap_count_free(ptr);
+    __libc_free(ptr);
+}
+
+static void heap_operation(struct euicc_ctx *ctx, const char *name, int end)
+{
+    struct heap_frame *frame;
+    struct heap_stats_operation *operation = NULL;
+    int64_t level_max;
+
+    if (!end)
+    {
+        if (heap_depth < HEAP_FRAMES_MAX)
+        {
+            frame = &heap_frames[heap_depth];
+            frame->name = name;
+            frame->allocs = __atomic_load_n(&heap_allocs, __ATOMIC_RELAXED);
+            frame->frees = __atomic_load_n(&heap_frees, __ATOMIC_RELAXED);
+            frame->bytes = __atomic_load_n(&heap_bytes, __ATOMIC_RELAXED);
+            frame->level = __atomic_load_n(&heap_level, __ATOMIC_RELAXED);
+            __atomic_store_n(&frame->level_max, frame->level, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&heap_depth, heap_depth + 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    if (heap_depth == 0)
+    {
+        return;
+    }
+    __atomic_store_n(&heap_depth, heap_depth - 1, __ATOMIC_RELEASE);
+    if (heap_depth >= HEAP_FRAMES_MAX)
+    {
+        return;
+    }
+    frame = &heap_frames[heap_depth];
+    level_max = __atomic_load_n(&frame->level_max, __ATOMIC_RELAXED);
+
+    for (uint32_t i = 0; i < heap_stats.operation_count; i++)
+    {
+        if (strcmp(heap_stats.operations[i].name, frame->name) == 0)
+        {
+            operation = &heap_stats.operations[i];
+            break;
+        }
+    }
+    if (operation == NULL)
+    {
+        if (heap_stats.operation_count == HEAP_STATS_OPERATIONS_MAX)
+        {
+            return;
+        }
+        operation = &heap_stats.operations[heap_stats.operation_count++];
+        memset(operation, 0, sizeof(*operation));
+        operation->name = frame->name;
+    }
+
+    operation->calls++;
+    operation->allocs += __atomic_load_n(&heap_allocs, __ATOMIC_RELAXED) - frame->allocs;
+    operation->frees += __atomic_load_n(&heap_frees, __ATOMIC_RELAXED) - frame->frees;
+    operation->bytes += __atomic_load_n(&heap_bytes, __ATOMIC_RELAXED) - frame->bytes;
+    if ((uint64_t)(level_max - frame->level) > operation->peak_bytes)
+    {
+        operation->peak_bytes = level_max - frame->level;
+    }
+}
+
+void heap_stats_init(struct euicc_ctx *ctx)
+{
+    if (getenv("LPAC_APDU_STATS") == NULL)
+    {
+        return;
+    }
+
+    ctx->operation = heap_operation;
+    heap_enabled = 1;
+}
+
+void heap_stats_reset(void)
+{
+    heap_stats.operation_count = 0;
+}
+
+void heap_stats_save(struct heap_stats *stats)
+{
+    *stats = heap_stats;
+}
+
+void heap_stats_restore(const struct heap_stats *stats)
+{
+    heap_stats = *stats;
+}
+
+cJSON *heap_stats_json(void)
+{
+    cJSON *jheap;
+
+    if (!heap_enabled)
+    {
+        return NULL;
+    }
+
+    jheap = cJSON_CreateObject();
+    for (uint32_t i = 0; i < heap_stats.operation_count; i++)
+    {
+        const struct heap_stats_operation *operation = &heap_stats.operations[i];
+        cJSON *joperation = cJSON_CreateObject();
+
+        cJSON_AddNumberToObject(joperation, "calls", operation->calls);
+        cJSON_AddNumberToObject(joperation, "allocs", operation->allocs);
+        cJSON_AddNumberToObject(joperation, "frees", operation->frees);
+        cJSON_AddNumberToObject(joperation, "bytes", operation->bytes);
+        cJSON_AddNumberToObject(joperation, "peak_bytes", operation->peak_bytes);
+        cJSON_AddItemToObject(jheap, operation->name, joperation);
+    }
+
+    return jheap;
+}
+#else
+void heap_stats_init(struct euicc_ctx *ctx)
+{
+}
+
+void heap_stats_reset(void)
+{
+}
+
+void heap_stats_save(struct heap_stats *stats)
+{
+}
+
+void heap_stats_restore(const struct heap_stats *stats)
+{
+}
+
+cJSON *heap_stats_json(void)
+{
+    return NULL;
+}
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+#include <euicc/euicc.h>
+#include <cjson/cJSON_ex.h>
+
+#define HEAP_STATS_OPERATIONS_MAX 16
+
+// Heap use of each ctx->operation, counted by interposing malloc, available with glibc and -DLPAC_HEAP_STATS=ON only
+struct heap_stats_operation
+{
+    const char *name;
+    uint32_t calls;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t bytes;
+    // Highest heap size above the one the operation started at, over all calls
+    uint64_t peak_bytes;
+};
+
+struct heap_stats
+{
+    struct heap_stats_operation operations[HEAP_STATS_OPERATIONS_MAX];
+    uint32_t operation_count;
+};
+
+// Starts counting when LPAC_APDU_STATS is set
+void heap_stats_init(struct euicc_ctx *ctx);
+void heap_stats_reset(void);
+void heap_stats_save(struct heap_stats *stats);
+void heap_stats_restore(const struct heap_stats *stats);
+// Object keyed by operation name, NULL when nothing is counted
+cJSON *heap_stats_json(void);
@@ -0,0 +1,104 @@
+#include "icon.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <euicc/base64.h>
+#include <euicc/hexutil.h>
+#include <euicc/sha256.h>
+
+int icon_store_enabled(void)
+{
+    return getenv("LPAC_ICON_DIR") != NULL;
+}
+
+int icon_store_put(char hash[ICON_HASH_LEN + 1], const uint8_t *data, uint32_t length)
+{
+    const char *dir = getenv("LPAC_ICON_DIR");
+    EUICC_SHA256_CTX sha256ctx;
+    uint8_t digest[SHA256_BLOCK_SIZE];
+    char *path = NULL, *tmp = NULL;
+    FILE *fp;
+    int fret = 0;
+
+    euicc_sha256_init(&sha256ctx);
+    euicc_sha256_update(&sha256ctx, data, length);
+    euicc_sha256_final(&sha256ctx, digest);
+    if (euicc_hexutil_bin2hex(hash, ICON_HASH_LEN + 1, digest, sizeof(digest)) < 0)
+    {
+        goto err;
+    }
+
+    path = malloc(strlen(dir) + 1 + ICON_HASH_LEN + 1);
+    // Named by the writer, two lpac storing the same icon at once each rename a whole file into place
+    tmp = malloc(strlen(dir) + 1 + ICON_HASH_LEN + sizeof(".tmp.") + 20);
+    if (path == NULL || tmp == NULL)
+    {
+        goto err;
+    }
+    sprintf(path, "%s/%s", dir, hash);
+    sprintf(tmp, "%s.tmp.%ld", path, (long)getpid());
+
+    // The name is the content, a file that is there holds this very icon
+    if (access(path, F_OK) == 0)
+    {
+        goto exit;
+    }
+
+    fp = fopen(tmp, "wb");
+    if (fp == NULL)
+    {
+        goto err;
+    }
+    if (fwrite(data, 1, length, fp) != length)
+    {
+        fclose(fp);
+        remove(tmp);
+        goto err;
+    }
+    if (fclose(fp) != 0 || rename(tmp, path) != 0)
+    {
+        remove(tmp);
+        // Windows renames over no file, not even one another lpac stored meanwhile
+        if (access(path, F_OK) != 0)
+        {
+            goto err;
+        }
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    free(path);
+    free(tmp);
+    return fret;
+}
+
+void icon_json_add(cJSON *jobject, const uint8_t *data, uint32_t length, int store)
+{
+    char hash[ICON_HASH_LEN + 1];
+    char *icon;
+
+    if (data == NULL)
+    {
+        cJSON_AddNullToObject(jobject, store ? "iconSha256" : "icon");
+        return;
+    }
+    if (store && icon_store_put(hash, data, length) == 0)
+    {
+        cJSON_AddStringToObject(jobject, "iconSha256", hash);
+        return;
+    }
+
+    icon = malloc(euicc_base64_encode_len(length));
+    if (icon)
+    {
+        euicc_base64_encode(icon, data, length);
+    }
+    cJSON_AddStringOrNullToObject(jobject, "icon", icon);
+    free(icon);
+}
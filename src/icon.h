@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+#include <cjson/cJSON_ex.h>
+
+#define ICON_HASH_LEN (32 * 2)
+
+// Profile icons kept once each under LPAC_ICON_DIR, in files named by the hex SHA-256 of their bytes, so the JSON
+// carries that name in place of the base64 icon
+int icon_store_enabled(void);
+// Writes the icon unless its file is there already, and its name into hash. Returns 0 on success.
+int icon_store_put(char hash[ICON_HASH_LEN + 1], const uint8_t *data, uint32_t length);
+// Adds the icon to jobject as base64 in "icon", or with store as the name in "iconSha256". Should the store fail, the
+// icon is added as base64 all the same.
+void icon_json_add(cJSON *jobject, const uint8_t *data, uint32_t length, int store);
@@ -0,0 +1,254 @@
+#include "journal.h"
+#include "main.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <euicc/es10b.h>
+#include <euicc/es9p.h>
+#include <euicc/hexutil.h>
+#include <euicc/base64.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+int journal_enabled(void)
+{
+    return getenv("LPAC_SESSION_JOURNAL") != NULL;
+}
+
+static char *journal_path(const char *suffix)
+{
+    const char *file = getenv("LPAC_SESSION_JOURNAL");
+    char *path;
+
+    path = malloc(strlen(file) + strlen(suffix) + 1);
+    if (path == NULL)
+    {
+        return NULL;
+    }
+    sprintf(path, "%s%s", file, suffix);
+    return path;
+}
+
+static cJSON *journal_load(void)
+{
+    char *path;
+    FILE *fp;
+    char *buf = NULL;
+    long len;
+    cJSON *jjournal = NULL;
+
+    path = journal_path("");
+    if (path == NULL)
+    {
+        return NULL;
+    }
+    fp = fopen(path, "rb");
+    free(path);
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+
+    if (fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) > 0 && fseek(fp, 0, SEEK_SET) == 0)
+    {
+        buf = malloc(len + 1);
+        if (buf && fread(buf, 1, len, fp) == (size_t)len)
+        {
+            buf[len] = '\0';
+            jjournal = cJSON_Parse(buf);
+        }
+        free(buf);
+    }
+    fclose(fp);
+
+    return jjournal;
+}
+
+// Written next to the target, synced and renamed over it, so a kill at any point leaves the old or the new journal
+static int journal_store(const cJSON *jjournal)
+{
+    int fret = 0;
+    char *path = NULL, *tmp = NULL, *jstr = NULL;
+    FILE *fp;
+
+    jstr = cJSON_PrintUnformatted(jjournal);
+    path = journal_path("");
+    tmp = journal_path(".tmp");
+    if (jstr == NULL || path == NULL || tmp == NULL)
+    {
+        goto err;
+    }
+
+    fp = fopen(tmp, "w");
+    if (fp == NULL)
+    {
+        goto err;
+    }
+    fputs(jstr, fp);
+#ifndef WIN32
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+    {
+        fclose(fp);
+        remove(tmp);
+        goto err;
+    }
+#endif
+    if (fclose(fp) != 0 || rename(tmp, path) != 0)
+    {
+        remove(tmp);
+        goto err;
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    free(jstr);
+    free(path);
+    free(tmp);
+    return fret;
+}
+
+void journal_write(struct euicc_ctx *ctx, const char *step)
+{
+    cJSON *jjournal = NULL;
+    char *transaction_id = NULL, *cancel_session_response = NULL;
+    const struct euicc_blob *response = &ctx->http._internal.cancel_session_response;
+
+    // Nothing the eUICC could cancel before it has the transaction ID
+    if (!journal_enabled() || ctx->http._internal.transaction_id_bin == NULL || ctx->http._internal.transaction_id_http == NULL)
+    {
+        return;
+    }
+
+    transaction_id = malloc(ctx->http._internal.transaction_id_bin_len * 2 + 1);
+    if (transaction_id == NULL || euicc_hexutil_bin2hex(transaction_id, ctx->http._internal.transaction_id_bin_len * 2 + 1, ctx->http._internal.transaction_id_bin, ctx->http._internal.transaction_id_bin_len) < 0)
+    {
+        goto exit;
+    }
+    // Signed by the eUICC, which forgot the session once it handed this out
+    if (response->data)
+    {
+        cancel_session_response = malloc(euicc_base64_encode_len(response->length));
+        if (cancel_session_response == NULL)
+        {
+            goto exit;
+        }
+        euicc_base64_encode(cancel_session_response, response->data, response->length);
+    }
+
+    jjournal = cJSON_CreateObject();
+    cJSON_AddStringOrNullToObject(jjournal, "step", step);
+    cJSON_AddStringOrNullToObject(jjournal, "smdp", ctx->http.server_address);
+    cJSON_AddStringOrNullToObject(jjournal, "transactionId", ctx->http._internal.transaction_id_http);
+    cJSON_AddStringOrNullToObject(jjournal, "euiccTransactionId", transaction_id);
+    cJSON_AddStringOrNullToObject(jjournal, "cancelSessionResponse", cancel_session_response);
+    journal_store(jjournal);
+
+exit:
+    cJSON_Delete(jjournal);
+    free(transaction_id);
+    free(cancel_session_response);
+}
+
+void journal_clear(void)
+{
+    char *path;
+
+    if (!journal_enabled())
+    {
+        return;
+    }
+    path = journal_path("");
+    if (path)
+    {
+        remove(path);
+        free(path);
+    }
+}
+
+int journal_recover(struct euicc_ctx *ctx)
+{
+    int fret = 0;
+    cJSON *jjournal;
+    const char *smdp, *transaction_id, *euicc_transaction_id, *cancel_session_response;
+    const char *server_address = ctx->http.server_address;
+    struct euicc_blob *response = &ctx->http._internal.cancel_session_response;
+    int retry = 0;
+
+    if (!journal_enabled() || (jjournal = journal_load()) == NULL)
+    {
+        return 0;
+    }
+
+    smdp = cJSON_GetStringValue(cJSON_GetObjectItem(jjournal, "smdp"));
+    transaction_id = cJSON_GetStringValue(cJSON_GetObjectItem(jjournal, "transactionId"));
+    euicc_transaction_id = cJSON_GetStringValue(cJSON_GetObjectItem(jjournal, "euiccTransactionId"));
+    cancel_session_response = cJSON_GetStringValue(cJSON_GetObjectItem(jjournal, "cancelSessionResponse"));
+    // Unreadable, there is nothing to go on
+    if (smdp == NULL || transaction_id == NULL || euicc_transaction_id == NULL || strlen(euicc_transaction_id) % 2)
+    {
+        goto exit;
+    }
+
+    ctx->http.server_address = smdp;
+    ctx->http._internal.transaction_id_http = strdup(transaction_id);
+    ctx->http._internal.transaction_id_bin_len = strlen(euicc_transaction_id) / 2;
+    ctx->http._internal.transaction_id_bin = malloc(ctx->http._internal.transaction_id_bin_len);
+    if (ctx->http._internal.transaction_id_http == NULL || ctx->http._internal.transaction_id_bin == NULL || euicc_hexutil_hex2bin(ctx->http._internal.transaction_id_bin, ctx->http._internal.transaction_id_bin_len, euicc_transaction_id) < 0)
+    {
+        retry = 1;
+        goto err;
+    }
+
+    if (cancel_session_response)
+    {
+        response->data = malloc(euicc_base64_decode_len(cancel_session_response));
+        if (response->data == NULL)
+        {
+            retry = 1;
+            goto err;
+        }
+        response->length = euicc_base64_decode(response->data, cancel_session_response);
+    }
+    else
+    {
+        jprint_progress("es10b_cancel_session", smdp);
+        // The eUICC no longer knowing the session, after a reset or a newer one, leaves the SM-DP+ to its own timeout
+        if (es10b_cancel_session(ctx, ES10B_CANCEL_SESSION_REASON_TIMEOUT) || response->data == NULL)
+        {
+            goto err;
+        }
+        // Should the SM-DP+ be unreachable, the next start only resends this
+        journal_write(ctx, "es10b_cancel_session");
+    }
+
+    jprint_progress("es9p_cancel_session", smdp);
+    memset(&ctx->http.status, 0, sizeof(ctx->http.status));
+    if (es9p_cancel_session(ctx))
+    {
+        // Only a failure before any ES9+ answer is worth another try, the SM-DP+ rejecting the cancel is final
+        retry = strcmp(ctx->http.status.subjectCode, "0.0.0") == 0;
+        goto err;
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    if (!retry)
+    {
+        journal_clear();
+    }
+    euicc_http_cleanup(ctx);
+    ctx->http.server_address = server_address;
+    cJSON_Delete(jjournal);
+    return fret;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <euicc/euicc.h>
+
+// The session of a running download, kept in the LPAC_SESSION_JOURNAL file from the moment the eUICC holds it, so
+// the next lpac can close a session that a killed one left open on the eUICC and the SM-DP+
+int journal_enabled(void);
+// Records the session in ctx->http as it stands once step is done. A journal that cannot be written is not an
+// error, the download just goes on without one.
+void journal_write(struct euicc_ctx *ctx, const char *step);
+// Drops the journal once the session ended
+void journal_clear(void);
+// Cancels the session left in the journal, if any, with ctx->http. The journal stays when the SM-DP+ could not be
+// reached, so a later start tries again. Returns 0 when there was nothing to cancel or it is cancelled now.
+int journal_recover(struct euicc_ctx *ctx);
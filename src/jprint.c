@@ -1,41 +1,181 @@
 #include "jprint.h"
+#include "main.h"
+#include "cbor.h"
+#include "heap.h"
+#include "trace_event.h"
+#include <euicc/tostr.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+static uint64_t jprint_epoch;
+static uint64_t jprint_last;
+static int jprint_array_count = -1;
+static cJSON *jprint_array_held = NULL;
+static int jprint_index = -1;
+static int jprint_cbor = 0;
+
+int jprint_format_set(const char *format)
+{
+    if (format == NULL || strcmp(format, "json") == 0)
+    {
+        jprint_cbor = 0;
+        return 0;
+    }
+    if (strcmp(format, "cbor") == 0)
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        jprint_cbor = 1;
+        return 0;
+    }
+    return -1;
+}
+
+void jprint_line(cJSON *jroot)
+{
+    char *jstr;
+    uint8_t *frame;
+    uint8_t header[4];
+    uint32_t frame_len;
+
+    if (jprint_cbor)
+    {
+        frame = cbor_encode(jroot, &frame_len);
+        cJSON_Delete(jroot);
+        if (frame == NULL)
+        {
+            return;
+        }
+        header[0] = frame_len >> 24;
+        header[1] = frame_len >> 16;
+        header[2] = frame_len >> 8;
+        header[3] = frame_len;
+        fwrite(header, 1, sizeof(header), stdout);
+        fwrite(frame, 1, frame_len, stdout);
+        fflush(stdout);
+        free(frame);
+        return;
+    }
+
+    jstr = cJSON_PrintUnformatted(jroot);
+    cJSON_Delete(jroot);
+    if (jstr == NULL)
+    {
+        return;
+    }
+
+    printf("%s\r\n", jstr);
+    fflush(stdout);
+    free(jstr);
+}
+
+void jprint_line_text(const char *line)
+{
+    if (jprint_cbor)
+    {
+        jprint_line(cJSON_CreateString(line));
+        return;
+    }
+
+    printf("%s\r\n", line);
+    fflush(stdout);
+}
+
+void jprint_set_index(int index)
+{
+    jprint_index = index;
+}
+
+// Lines of a command run by lpac batch carry its position in the script
+static void jprint_add_index(cJSON *jroot)
+{
+    if (jprint_index >= 0)
+    {
+        cJSON_AddNumberToObject(jroot, "index", jprint_index);
+    }
+}
+
+void jprint_timing_reset(void)
+{
+    jprint_epoch = jprint_last = euicc_now_us();
+}
+
+void jprint_state_save(struct jprint_state *state)
+{
+    state->epoch = jprint_epoch;
+    state->last = jprint_last;
+    state->array_count = jprint_array_count;
+    state->array_held = jprint_array_held;
+    state->index = jprint_index;
+
+    jprint_array_count = -1;
+    jprint_array_held = NULL;
+    jprint_index = -1;
+    jprint_timing_reset();
+}
+
+void jprint_state_restore(const struct jprint_state *state)
+{
+    jprint_epoch = state->epoch;
+    jprint_last = state->last;
+    jprint_array_count = state->array_count;
+    jprint_array_held = state->array_held;
+    jprint_index = state->index;
+}
+
+// elapsed_ms counts from the last jprint_timing_reset, stage_ms from the line printed before
+static void jprint_timing(cJSON *jpayload)
+{
+    uint64_t now;
+
+    if (!getenv("LPAC_JSON_TIMING"))
+    {
+        return;
+    }
+
+    now = euicc_now_us();
+    cJSON_AddNumberToObject(jpayload, "elapsed_ms", (now - jprint_epoch) / 1000.0);
+    cJSON_AddNumberToObject(jpayload, "stage_ms", (now - jprint_last) / 1000.0);
+    jprint_last = now;
+}
+
 void jprint_error(const char *function_name, const char *detail)
 {
     cJSON *jroot = NULL;
     cJSON *jpayload = NULL;
-    char *jstr = NULL;
 
     if (detail == NULL)
     {
         detail = "";
     }
 
+    trace_event_stage(NULL, NULL);
+
     jroot = cJSON_CreateObject();
     cJSON_AddStringOrNullToObject(jroot, "type", "lpa");
     jpayload = cJSON_CreateObject();
     cJSON_AddNumberToObject(jpayload, "code", -1);
     cJSON_AddStringOrNullToObject(jpayload, "message", function_name);
     cJSON_AddStringOrNullToObject(jpayload, "data", detail);
+    jprint_timing(jpayload);
     cJSON_AddItemToObject(jroot, "payload", jpayload);
+    jprint_add_index(jroot);
 
-    jstr = cJSON_PrintUnformatted(jroot);
-    cJSON_Delete(jroot);
-
-    printf("%s\r\n", jstr);
-    fflush(stdout);
-    free(jstr);
+    jprint_line(jroot);
 }
 
-void jprint_progress(const char *function_name, const char *detail)
+void jprint_progress_with(const char *function_name, const char *detail, const char *key, cJSON *jextra)
 {
     cJSON *jroot = NULL;
     cJSON *jpayload = NULL;
-    char *jstr = NULL;
 
     jroot = cJSON_CreateObject();
     cJSON_AddStringOrNullToObject(jroot, "type", "progress");
@@ -43,21 +183,188 @@ void jprint_progress(const char *function_name, const char *detail)
     cJSON_AddNumberToObject(jpayload, "code", 0);
     cJSON_AddStringOrNullToObject(jpayload, "message", function_name);
     cJSON_AddStringOrNullToObject(jpayload, "data", detail);
+    if (jextra)
+    {
+        cJSON_AddItemToObject(jpayload, key, jextra);
+    }
+    jprint_timing(jpayload);
     cJSON_AddItemToObject(jroot, "payload", jpayload);
+    jprint_add_index(jroot);
 
-    jstr = cJSON_PrintUnformatted(jroot);
-    cJSON_Delete(jroot);
+    jprint_line(jroot);
+}
 
-    printf("%s\r\n", jstr);
-    fflush(stdout);
-    free(jstr);
+void jprint_progress(const char *function_name, const char *detail)
+{
+    trace_event_stage(function_name, detail);
+    jprint_progress_with(function_name, detail, NULL, NULL);
+}
+
+void jprint_progress_http(const char *function_name, const char *detail)
+{
+    struct euicc_http_timing *timing = &euicc_ctx.http.timing;
+    cJSON *jhttp = NULL;
+
+    if (getenv("LPAC_HTTP_TIMING") && timing->requests)
+    {
+        jhttp = cJSON_CreateObject();
+        cJSON_AddNumberToObject(jhttp, "requests", timing->requests);
+        cJSON_AddNumberToObject(jhttp, "namelookup_us", timing->namelookup_us);
+        cJSON_AddNumberToObject(jhttp, "connect_us", timing->connect_us);
+        cJSON_AddNumberToObject(jhttp, "appconnect_us", timing->appconnect_us);
+        cJSON_AddNumberToObject(jhttp, "starttransfer_us", timing->starttransfer_us);
+        cJSON_AddNumberToObject(jhttp, "total_us", timing->total_us);
+        cJSON_AddNumberToObject(jhttp, "bytes_sent", timing->bytes_sent);
+        cJSON_AddNumberToObject(jhttp, "bytes_received", timing->bytes_received);
+        cJSON_AddNumberToObject(jhttp, "bytes_decoded", timing->bytes_decoded);
+        jprint_progress_with(function_name, detail, "http", jhttp);
+    }
+
+    memset(timing, 0, sizeof(*timing));
+}
+
+void jprint_progress_transfer(struct euicc_ctx *ctx, const struct euicc_progress *progress)
+{
+    cJSON *jtransfer;
+    double elapsed_s = progress->elapsed_us / 1000000.0;
+    uint64_t last;
+    char tag[5];
+
+    jtransfer = cJSON_CreateObject();
+    cJSON_AddNumberToObject(jtransfer, "bytes", progress->done);
+    if (progress->total)
+    {
+        cJSON_AddNumberToObject(jtransfer, "total", progress->total);
+    }
+    else
+    {
+        cJSON_AddNullToObject(jtransfer, "total");
+    }
+    if (progress->phase == EUICC_PROGRESS_LOAD)
+    {
+        snprintf(tag, sizeof(tag), "%02X", progress->tag);
+        cJSON_AddStringOrNullToObject(jtransfer, "element", progress->tag ? tag : NULL);
+        cJSON_AddNumberToObject(jtransfer, "index", progress->index);
+        cJSON_AddNumberToObject(jtransfer, "apdus", progress->apdus);
+        cJSON_AddNumberToObject(jtransfer, "apdus_per_second", elapsed_s > 0 ? (uint64_t)(progress->apdus / elapsed_s) : 0);
+    }
+    cJSON_AddNumberToObject(jtransfer, "bytes_per_second", elapsed_s > 0 ? (uint64_t)(progress->done / elapsed_s) : 0);
+    cJSON_AddNumberToObject(jtransfer, "elapsed_ms", progress->elapsed_us / 1000);
+    // The rate so far applied to what is left
+    if (progress->total && progress->done && !progress->finished)
+    {
+        cJSON_AddNumberToObject(jtransfer, "eta_ms", progress->elapsed_us / 1000 * (progress->total > progress->done ? progress->total - progress->done : 0) / progress->done);
+    }
+    else
+    {
+        cJSON_AddNullToObject(jtransfer, "eta_ms");
+    }
+    cJSON_AddBoolToObject(jtransfer, "finished", progress->finished);
+
+    // stage_ms keeps counting from the stage line
+    last = jprint_last;
+    jprint_progress_with(progress->phase == EUICC_PROGRESS_LOAD ? "es10b_load_bound_profile_package" : "es9p_get_bound_profile_package", NULL, "transfer", jtransfer);
+    jprint_last = last;
+}
+
+static void jprint_sum_number(cJSON *jobject, const char *name, double value)
+{
+    cJSON *jitem = cJSON_GetObjectItem(jobject, name);
+
+    if (jitem)
+    {
+        cJSON_SetNumberValue(jitem, jitem->valuedouble + value);
+    }
+    else
+    {
+        cJSON_AddNumberToObject(jobject, name, value);
+    }
+}
+
+static cJSON *jprint_apdu_stats(const struct euicc_apdu_stats *stats)
+{
+    cJSON *jstats = NULL;
+    cJSON *jsw = NULL;
+    cJSON *jretries = NULL;
+    cJSON *jcommands = NULL;
+    uint64_t time_us = 0;
+    char key[4 + 1];
+
+    jstats = cJSON_CreateObject();
+    cJSON_AddNumberToObject(jstats, "apdus", stats->apdus);
+    cJSON_AddNumberToObject(jstats, "bytes_sent", stats->bytes_sent);
+    cJSON_AddNumberToObject(jstats, "bytes_received", stats->bytes_received);
+    cJSON_AddNumberToObject(jstats, "get_responses", stats->get_responses);
+    cJSON_AddNumberToObject(jstats, "cache_hits", stats->cache_hits);
+
+    jretries = cJSON_CreateObject();
+    cJSON_AddNumberToObject(jretries, "transport", stats->retries.transport);
+    cJSON_AddNumberToObject(jretries, "busy", stats->retries.busy);
+    cJSON_AddNumberToObject(jretries, "technical", stats->retries.technical);
+    cJSON_AddNumberToObject(jretries, "wrong_le", stats->retries.wrong_le);
+    cJSON_AddItemToObject(jstats, "retries", jretries);
+
+    jsw = cJSON_CreateObject();
+    for (uint32_t i = 0; i < stats->sw_count; i++)
+    {
+        snprintf(key, sizeof(key), "%04X", stats->sw[i].sw);
+        cJSON_AddNumberToObject(jsw, key, stats->sw[i].count);
+    }
+    cJSON_AddItemToObject(jstats, "sw", jsw);
+
+    // Tags belonging to the same ES10 function are summed up under its name
+    jcommands = cJSON_CreateObject();
+    for (uint32_t i = 0; i < stats->command_count; i++)
+    {
+        const char *name = euicc_es10xcommand2str(stats->commands[i].tag);
+        cJSON *jcommand;
+
+        if (name == NULL)
+        {
+            snprintf(key, sizeof(key), "%02X", stats->commands[i].tag);
+            name = key;
+        }
+
+        jcommand = cJSON_GetObjectItem(jcommands, name);
+        if (jcommand == NULL)
+        {
+            jcommand = cJSON_CreateObject();
+            cJSON_AddItemToObject(jcommands, name, jcommand);
+        }
+        jprint_sum_number(jcommand, "calls", stats->commands[i].calls);
+        jprint_sum_number(jcommand, "apdus", stats->commands[i].apdus);
+        jprint_sum_number(jcommand, "time_us", stats->commands[i].time_us);
+        time_us += stats->commands[i].time_us;
+    }
+    cJSON_AddItemToObject(jstats, "commands", jcommands);
+    cJSON_AddNumberToObject(jstats, "time_us", time_us);
+
+    return jstats;
+}
+
+// Fields following data in a success payload
+static void jprint_success_tail(cJSON *jpayload)
+{
+    if (getenv("LPAC_APDU_STATS"))
+    {
+        cJSON *jstats = jprint_apdu_stats(&euicc_ctx.apdu.stats);
+        cJSON *jheap = heap_stats_json();
+
+        if (jheap)
+        {
+            cJSON_AddItemToObject(jstats, "heap", jheap);
+        }
+        cJSON_AddItemToObject(jpayload, "stats", jstats);
+    }
+    jprint_timing(jpayload);
 }
 
 void jprint_success(cJSON *jdata)
 {
     cJSON *jroot = NULL;
     cJSON *jpayload = NULL;
-    char *jstr = NULL;
+
+    trace_event_stage(NULL, NULL);
 
     jroot = cJSON_CreateObject();
     cJSON_AddStringOrNullToObject(jroot, "type", "lpa");
@@ -72,12 +379,109 @@ void jprint_success(cJSON *jdata)
     {
         cJSON_AddNullToObject(jpayload, "data");
     }
+    jprint_success_tail(jpayload);
     cJSON_AddItemToObject(jroot, "payload", jpayload);
+    jprint_add_index(jroot);
 
-    jstr = cJSON_PrintUnformatted(jroot);
-    cJSON_Delete(jroot);
+    jprint_line(jroot);
+}
 
-    printf("%s\r\n", jstr);
+// The line is produced byte for byte like jprint_success with an array, while only one element is held at a time
+void jprint_success_array_begin(void)
+{
+    const char *apdu = getenv("LPAC_APDU");
+    const char *http = getenv("LPAC_HTTP");
+
+    jprint_array_count = 0;
+
+    // The stdio drivers talk over stdout between elements, the array has to be held until the end then.
+    // So does a CBOR frame, whose length comes first.
+    if (jprint_cbor || (apdu && strcmp(apdu, "stdio") == 0) || (http && strcmp(http, "stdio") == 0))
+    {
+        jprint_array_held = cJSON_CreateArray();
+    }
+}
+
+void jprint_success_array_append(cJSON *jitem)
+{
+    char *jstr = NULL;
+
+    if (jprint_array_held)
+    {
+        cJSON_AddItemToArray(jprint_array_held, jitem);
+        return;
+    }
+
+    jstr = cJSON_PrintUnformatted(jitem);
+    cJSON_Delete(jitem);
+    if (jstr == NULL)
+    {
+        return;
+    }
+
+    // The head is held back until the first element, so a failure before it is a plain error line
+    if (jprint_array_count == 0)
+    {
+        fputs("{\"type\":\"lpa\",\"payload\":{\"code\":0,\"message\":\"success\",\"data\":[", stdout);
+    }
+    else
+    {
+        fputc(',', stdout);
+    }
+    fputs(jstr, stdout);
+    jprint_array_count++;
+    free(jstr);
+}
+
+void jprint_success_array_end(void)
+{
+    cJSON *jpayload = NULL;
+    char *jstr = NULL;
+
+    if (jprint_array_held || jprint_array_count == 0)
+    {
+        jprint_success(jprint_array_held ? jprint_array_held : cJSON_CreateArray());
+        jprint_array_held = NULL;
+        jprint_array_count = -1;
+        return;
+    }
+    jprint_array_count = -1;
+
+    trace_event_stage(NULL, NULL);
+
+    jpayload = cJSON_CreateObject();
+    jprint_success_tail(jpayload);
+    jstr = cJSON_PrintUnformatted(jpayload);
+    cJSON_Delete(jpayload);
+
+    // The tail object is spliced in without its opening brace
+    if (jstr && jstr[1] != '}')
+    {
+        printf("],%s", jstr + 1);
+    }
+    else
+    {
+        printf("]}");
+    }
+    if (jprint_index >= 0)
+    {
+        printf(",\"index\":%d", jprint_index);
+    }
+    printf("}\r\n");
     fflush(stdout);
     free(jstr);
 }
+
+void jprint_success_array_abort(const char *function_name, const char *detail)
+{
+    // A line cut short is not valid JSON, so it can't be taken for a successful result
+    if (jprint_array_count > 0 && jprint_array_held == NULL)
+    {
+        printf("\r\n");
+    }
+    cJSON_Delete(jprint_array_held);
+    jprint_array_held = NULL;
+    jprint_array_count = -1;
+
+    jprint_error(function_name, detail);
+}
@@ -1,6 +1,42 @@
 #pragma once
 #include <cjson/cJSON_ex.h>
+#include <euicc/euicc.h>
 
+// "json" (or NULL) for a JSON object per line, "cbor" for a CBOR item per frame behind its length as 4 bytes big
+// endian, -1 for anything else
+int jprint_format_set(const char *format);
+// Writes jroot as one line or frame and frees it
+void jprint_line(cJSON *jroot);
+// A line that is not JSON, a CBOR text string in a frame of its own
+void jprint_line_text(const char *line);
+void jprint_timing_reset(void);
+// What jprint keeps between the lines of a subcommand, set aside while another one runs inside it
+struct jprint_state
+{
+    uint64_t epoch;
+    uint64_t last;
+    int array_count;
+    cJSON *array_held;
+    int index;
+};
+// Saves the state to *state and starts afresh, jprint_state_restore brings it back
+void jprint_state_save(struct jprint_state *state);
+void jprint_state_restore(const struct jprint_state *state);
+// Adds "index" to every line printed from now on, -1 to stop
+void jprint_set_index(int index);
 void jprint_error(const char *function_name, const char *detail);
 void jprint_progress(const char *function_name, const char *detail);
+// A progress event carrying jextra under key, which it frees
+void jprint_progress_with(const char *function_name, const char *detail, const char *key, cJSON *jextra);
+// Repeats the progress event of an ES9+/ES11 call once it is done, with the HTTP timing collected by the driver
+void jprint_progress_http(const char *function_name, const char *detail);
+// For euicc_ctx.progress: a progress event with a "transfer" object, not a stage of its own
+void jprint_progress_transfer(struct euicc_ctx *ctx, const struct euicc_progress *progress);
 void jprint_success(cJSON *jdata);
+// Streams the data array of a success line, for lists that would otherwise be held in memory at once
+void jprint_success_array_begin(void);
+// Writes jitem and frees it
+void jprint_success_array_append(cJSON *jitem);
+void jprint_success_array_end(void);
+// Elements written already are left on an unterminated line before the error
+void jprint_success_array_abort(const char *function_name, const char *detail);
@@ -4,16 +4,27 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <getopt.h>
 
 #include <euicc/interface.h>
 #include <euicc/euicc.h>
+#include <euicc/hexutil.h>
 #include <driver.h>
 
 #include "applet.h"
+#include "cache.h"
+#include "calibrate.h"
+#include "heap.h"
+#include "journal.h"
+#include "trace_event.h"
 #include "applet/chip.h"
 #include "applet/profile.h"
 #include "applet/notification.h"
 #include "applet/version.h"
+#include "applet/daemon.h"
+#include "applet/fleet.h"
+#include "applet/batch.h"
+#include "applet/bench.h"
 
 #ifdef WIN32
 #include <windef.h>
@@ -50,20 +61,164 @@ static const struct applet_entry *applets[] = {
     &applet_profile,
     &applet_notification,
     &applet_version,
+    &applet_daemon,
+    &applet_fleet,
+    &applet_batch,
+    &applet_bench,
     NULL,
 };
 
+void main_reset_getopt(void)
+{
+#ifdef __GLIBC__
+    optind = 0;
+#else
+    optind = 1;
+#endif
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+    optreset = 1;
+#endif
+}
+
+// LPAC_TIMEOUT bounds each command, lpac batch and lpac daemon start it again per command
+void main_reset_deadline(void)
+{
+    euicc_deadline_set(&euicc_ctx, getenv("LPAC_TIMEOUT") ? strtoul(getenv("LPAC_TIMEOUT"), NULL, 10) : 0);
+}
+
+int main_applet_entry(int argc, char **argv)
+{
+    return applet_entry(argc, argv, applets);
+}
+
 static int euicc_ctx_inited = 0;
 struct euicc_ctx euicc_ctx = {0};
 
+// GSMA, then the ones 5ber and eSIM.me cards use instead
+#define ISD_R_AID_DEFAULT "A0000005591010FFFFFFFF8900000100,A0000005591010FFFFFFFF8900050500,A0000005591010000000008900000300"
+#define ISD_R_AID_MAX 8
+
+static struct euicc_aid isd_r_aids[ISD_R_AID_MAX];
+
+static int parse_isd_r_aids(const char *list, struct euicc_aid *aids, uint32_t aids_max)
+{
+    uint32_t count = 0;
+
+    while (*list)
+    {
+        size_t len = strcspn(list, ",");
+        int aid_len;
+
+        if (count >= aids_max)
+        {
+            return -1;
+        }
+        aid_len = euicc_hexutil_hex2bin_r(aids[count].aid, sizeof(aids[count].aid), list, len);
+        // ISO 7816-4 AIDs are 5 to 16 bytes
+        if (aid_len < 5)
+        {
+            return -1;
+        }
+        aids[count].length = aid_len;
+        count++;
+
+        list += len;
+        if (*list == ',')
+        {
+            list++;
+        }
+    }
+
+    return count;
+}
+
+// Moves the AID that opened on this card last time to the front of the list
+static void isd_r_aid_prefer(struct euicc_aid *aids, uint32_t count, const char *preferred)
+{
+    char hex[sizeof(aids[0].aid) * 2 + 1];
+
+    for (uint32_t i = 1; i < count; i++)
+    {
+        struct euicc_aid aid = aids[i];
+
+        if (euicc_hexutil_bin2hex(hex, sizeof(hex), aid.aid, aid.length) < 0 || strcasecmp(hex, preferred) != 0)
+        {
+            continue;
+        }
+        memmove(&aids[1], &aids[0], i * sizeof(aids[0]));
+        aids[0] = aid;
+        return;
+    }
+}
+
 void main_init_euicc()
 {
-    if (euicc_init(&euicc_ctx))
+    const char *aid_list = getenv("LPAC_ISD_R_AID");
+    char identity[256];
+    char aid[sizeof(isd_r_aids[0].aid) * 2 + 1];
+    const char *cached;
+    uint32_t segment_size;
+    int count;
+
+    // Already connected when an applet runs inside lpac daemon or lpac batch
+    if (euicc_ctx_inited)
+    {
+        return;
+    }
+
+    count = parse_isd_r_aids(aid_list ? aid_list : ISD_R_AID_DEFAULT, isd_r_aids, ISD_R_AID_MAX);
+    if (count <= 0)
+    {
+        jprint_error("euicc_init", "invalid LPAC_ISD_R_AID");
+        exit(-1);
+    }
+    euicc_ctx.apdu.isd_r_aids = isd_r_aids;
+    euicc_ctx.apdu.isd_r_aid_count = count;
+
+    if (euicc_connect(&euicc_ctx))
+    {
+        jprint_error("euicc_init", NULL);
+        exit(-1);
+    }
+
+    identity[0] = '\0';
+    if (cache_enabled() && euicc_ctx.apdu.interface->identity && euicc_ctx.apdu.interface->identity(&euicc_ctx, identity, sizeof(identity)) < 0)
+    {
+        identity[0] = '\0';
+    }
+    if (identity[0] && (cached = cache_isd_r_aid_get(identity)))
+    {
+        isd_r_aid_prefer(isd_r_aids, count, cached);
+    }
+
+    if (euicc_open_isd_r(&euicc_ctx))
     {
         jprint_error("euicc_init", NULL);
         exit(-1);
     }
     euicc_ctx_inited = 1;
+
+    if (identity[0] && euicc_hexutil_bin2hex(aid, sizeof(aid), isd_r_aids[euicc_ctx.apdu.isd_r_aid_index].aid, isd_r_aids[euicc_ctx.apdu.isd_r_aid_index].length) == 0)
+    {
+        cache_isd_r_aid_put(identity, aid);
+    }
+
+    // LPAC_APDU_SEGMENT_SIZE wins over what calibration found
+    if (identity[0] && !getenv("LPAC_APDU_SEGMENT_SIZE"))
+    {
+        segment_size = cache_segment_size_get(identity);
+        if (segment_size == 0 && getenv("LPAC_APDU_CALIBRATE") && (segment_size = calibrate_segment_size(&euicc_ctx, CALIBRATE_ITERATIONS_DEFAULT, NULL)))
+        {
+            cache_segment_size_put(identity, segment_size);
+        }
+        if (segment_size)
+        {
+            euicc_ctx.apdu.segment_size = segment_size;
+        }
+    }
+
+    // A download killed midway left its session open, and a new one may be refused until it times out
+    journal_recover(&euicc_ctx);
 }
 
 void main_fini_euicc()
@@ -76,6 +231,17 @@ void main_fini_euicc()
     euicc_ctx_inited = 0;
 }
 
+void main_swap_euicc(struct euicc_ctx *ctx, int *inited)
+{
+    struct euicc_ctx ctx_prev = euicc_ctx;
+    int inited_prev = euicc_ctx_inited;
+
+    euicc_ctx = *ctx;
+    euicc_ctx_inited = *inited;
+    *ctx = ctx_prev;
+    *inited = inited_prev;
+}
+
 #ifdef WIN32
 static char **warg_to_arg(const int wargc, wchar_t **wargv)
 {
@@ -107,6 +273,8 @@ int main(int argc, char **argv)
 {
     int ret = 0;
 
+    jprint_timing_reset();
+
     memset(&euicc_ctx, 0, sizeof(euicc_ctx));
 
     if (euicc_driver_init(getenv("LPAC_APDU"), getenv("LPAC_HTTP")))
@@ -117,6 +285,60 @@ int main(int argc, char **argv)
     euicc_ctx.apdu.interface = &euicc_driver_interface_apdu;
     euicc_ctx.http.interface = &euicc_driver_interface_http;
 
+    if (getenv("LPAC_APDU_SEGMENT_SIZE"))
+    {
+        euicc_ctx.apdu.segment_size = atoi(getenv("LPAC_APDU_SEGMENT_SIZE"));
+    }
+
+    if (getenv("LPAC_APDU_TIMEOUT"))
+    {
+        euicc_ctx.apdu.timeout_ms = strtoul(getenv("LPAC_APDU_TIMEOUT"), NULL, 10);
+    }
+
+    euicc_ctx.apdu.retry_max = getenv("LPAC_APDU_RETRY") ? atoi(getenv("LPAC_APDU_RETRY")) : 3;
+
+    if (getenv("LPAC_HTTP_TIMEOUT"))
+    {
+        euicc_ctx.http.timeout_ms = strtoul(getenv("LPAC_HTTP_TIMEOUT"), NULL, 10);
+    }
+
+    if (getenv("LPAC_HTTP_COMPRESSION") && strcmp(getenv("LPAC_HTTP_COMPRESSION"), "0") == 0)
+    {
+        euicc_ctx.http.no_compression = 1;
+    }
+
+    if (getenv("LPAC_HTTP_RETRY"))
+    {
+        euicc_ctx.http.retry_max = atoi(getenv("LPAC_HTTP_RETRY"));
+    }
+
+    if (getenv("LPAC_HTTP_RETRY_DELAY"))
+    {
+        euicc_ctx.http.retry_delay_ms = strtoul(getenv("LPAC_HTTP_RETRY_DELAY"), NULL, 10);
+    }
+
+    if (getenv("LPAC_PROGRESS_INTERVAL"))
+    {
+        euicc_ctx.progress = jprint_progress_transfer;
+        euicc_ctx.progress_interval_ms = strtoul(getenv("LPAC_PROGRESS_INTERVAL"), NULL, 10);
+    }
+
+    if (trace_event_init(&euicc_ctx))
+    {
+        jprint_error("trace_event_init", getenv("LPAC_TRACE_FILE"));
+        euicc_driver_fini();
+        return -1;
+    }
+
+    heap_stats_init(&euicc_ctx);
+
+    if (jprint_format_set(getenv("LPAC_OUTPUT")))
+    {
+        jprint_error("jprint_format_set", getenv("LPAC_OUTPUT"));
+        euicc_driver_fini();
+        return -1;
+    }
+
 #ifdef WIN32
     argv = warg_to_arg(argc, CommandLineToArgvW(GetCommandLineW(), &argc));
     if (argv == NULL)
@@ -125,10 +347,13 @@ int main(int argc, char **argv)
     }
 #endif
 
-    ret = applet_entry(argc, argv, applets);
+    main_reset_deadline();
+    ret = main_applet_entry(argc, argv);
 
     main_fini_euicc();
 
+    trace_event_fini();
+
     euicc_driver_fini();
 
     return ret;
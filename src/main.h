@@ -7,3 +7,8 @@ extern struct euicc_ctx euicc_ctx;
 
 void main_init_euicc(void);
 void main_fini_euicc(void);
+int main_applet_entry(int argc, char **argv);
+void main_reset_getopt(void);
+void main_reset_deadline(void);
+// Makes *ctx the context applets run on and leaves the previous one in *ctx, *inited goes along with it
+void main_swap_euicc(struct euicc_ctx *ctx, int *inited);
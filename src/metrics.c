@@ -0,0 +1,437 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <euicc/es10b.h>
+#include <euicc/tostr.h>
+
+#define METRICS_LABELS_MAX 256
+
+struct metrics_series
+{
+    char *labels;
+    uint64_t *buckets;
+    uint64_t count;
+    double sum;
+    struct metrics_series *next;
+};
+
+// A histogram when bounds is set, a counter or gauge otherwise
+struct metrics_family
+{
+    const char *name;
+    const char *type;
+    const char *help;
+    const double *bounds;
+    uint32_t bounds_count;
+    struct metrics_series *series;
+};
+
+static const double metrics_bounds_es10[] = {0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+static const double metrics_bounds_es9p[] = {0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+static const double metrics_bounds_bpp[] = {8192, 16384, 32768, 65536, 131072, 262144, 524288, 1048576, 2097152};
+static const double metrics_bounds_throughput[] = {1024, 4096, 16384, 65536, 262144, 1048576, 4194304};
+static const double metrics_bounds_queue_wait[] = {0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 300};
+
+#define METRICS_HISTOGRAM(name, help, bounds) {name, "histogram", help, bounds, sizeof(bounds) / sizeof(bounds[0]), NULL}
+
+static struct metrics_family metrics_es10_duration = METRICS_HISTOGRAM("lpac_es10_command_duration_seconds", "ES10 command latency, segments and GET RESPONSE included", metrics_bounds_es10);
+static struct metrics_family metrics_es9p_duration = METRICS_HISTOGRAM("lpac_es9p_request_duration_seconds", "ES9+/ES11 request latency by function and SM-DP+ host", metrics_bounds_es9p);
+static struct metrics_family metrics_bpp_bytes = METRICS_HISTOGRAM("lpac_bpp_bytes", "Size of the BoundProfilePackages loaded", metrics_bounds_bpp);
+static struct metrics_family metrics_download_throughput = METRICS_HISTOGRAM("lpac_download_throughput_bytes_per_second", "BoundProfilePackage bytes loaded per second of getBoundProfilePackage", metrics_bounds_throughput);
+static struct metrics_family metrics_sw_failures = {"lpac_apdu_failures_total", "counter", "APDU responses with an error status word", NULL, 0, NULL};
+static struct metrics_family metrics_es9p_failures = {"lpac_es9p_failures_total", "counter", "Failed ES9+/ES11 calls by subject and reason code", NULL, 0, NULL};
+static struct metrics_family metrics_requests = {"lpac_daemon_requests_total", "counter", "Daemon requests by result", NULL, 0, NULL};
+static struct metrics_family metrics_notifications = {"lpac_notifications_pending", "gauge", "Notifications waiting on the eUICC after the last request", NULL, 0, NULL};
+static struct metrics_family metrics_queue_wait = METRICS_HISTOGRAM("lpac_daemon_queue_wait_seconds", "Time daemon requests waited for the card, by priority", metrics_bounds_queue_wait);
+static struct metrics_family metrics_queue_depth = {"lpac_daemon_queue_depth", "gauge", "Daemon requests waiting for the card when the last one started", NULL, 0, NULL};
+
+static struct metrics_family *metrics_families[] = {
+    &metrics_es10_duration,
+    &metrics_es9p_duration,
+    &metrics_bpp_bytes,
+    &metrics_download_throughput,
+    &metrics_sw_failures,
+    &metrics_es9p_failures,
+    &metrics_requests,
+    &metrics_notifications,
+    &metrics_queue_wait,
+    &metrics_queue_depth,
+    NULL,
+};
+
+static const char *metrics_path = NULL;
+static struct euicc_ctx *metrics_ctx = NULL;
+static void (*metrics_trace_next)(struct euicc_ctx *ctx, const struct euicc_trace_span *span) = NULL;
+static int metrics_paused;
+
+// Per request, to relate the BPP to the time it took to fetch and load
+static struct
+{
+    uint64_t bpp_bytes;
+    uint64_t bpp_duration_us;
+} metrics_request;
+
+static struct metrics_series *metrics_series_get(struct metrics_family *family, const char *labels)
+{
+    struct metrics_series *series;
+
+    for (series = family->series; series; series = series->next)
+    {
+        if (strcmp(series->labels, labels) == 0)
+        {
+            return series;
+        }
+    }
+
+    series = calloc(1, sizeof(struct metrics_series));
+    if (series == NULL)
+    {
+        return NULL;
+    }
+    series->labels = strdup(labels);
+    if (family->bounds)
+    {
+        series->buckets = calloc(family->bounds_count, sizeof(uint64_t));
+    }
+    if (series->labels == NULL || (family->bounds && series->buckets == NULL))
+    {
+        free(series->labels);
+        free(series->buckets);
+        free(series);
+        return NULL;
+    }
+
+    series->next = family->series;
+    family->series = series;
+
+    return series;
+}
+
+static void metrics_observe(struct metrics_family *family, const char *labels, double value)
+{
+    struct metrics_series *series = metrics_series_get(family, labels);
+
+    if (series == NULL)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < family->bounds_count; i++)
+    {
+        if (value <= family->bounds[i])
+        {
+            series->buckets[i]++;
+        }
+    }
+    series->count++;
+    series->sum += value;
+}
+
+static void metrics_set(struct metrics_family *family, const char *labels, double value)
+{
+    struct metrics_series *series = metrics_series_get(family, labels);
+
+    if (series)
+    {
+        series->sum = value;
+    }
+}
+
+// Appends name="value" to labels, escaped as the exposition format requires
+static void metrics_label(char *labels, const char *name, const char *value, uint32_t value_len)
+{
+    size_t n = strlen(labels);
+
+    n += snprintf(labels + n, METRICS_LABELS_MAX - n, "%s%s=\"", n ? "," : "", name);
+    for (uint32_t i = 0; i < value_len && value[i] && n + 3 < METRICS_LABELS_MAX; i++)
+    {
+        switch (value[i])
+        {
+        case '\\':
+        case '"':
+            labels[n++] = '\\';
+            labels[n++] = value[i];
+            break;
+        case '\n':
+            labels[n++] = '\\';
+            labels[n++] = 'n';
+            break;
+        default:
+            labels[n++] = value[i];
+            break;
+        }
+    }
+    if (n + 1 < METRICS_LABELS_MAX)
+    {
+        labels[n++] = '"';
+    }
+    labels[n] = '\0';
+}
+
+// https://host/gsma/rsp2/es9plus/initiateAuthentication gives host and initiateAuthentication
+static void metrics_url_labels(char *labels, const char *url)
+{
+    const char *host, *host_end, *function;
+
+    if (url == NULL)
+    {
+        url = "";
+    }
+
+    host = strstr(url, "://");
+    host = host ? host + 3 : url;
+    host_end = strchr(host, '/');
+    if (host_end == NULL)
+    {
+        host_end = host + strlen(host);
+    }
+    function = strrchr(host_end, '/');
+    function = function ? function + 1 : "";
+
+    metrics_label(labels, "function", function, strlen(function));
+    metrics_label(labels, "host", host, host_end - host);
+}
+
+static int metrics_es10x_bpp(uint16_t tag)
+{
+    const char *name = euicc_es10xcommand2str(tag);
+
+    return name && strcmp(name, "es10b_load_bound_profile_package") == 0;
+}
+
+static void metrics_span(struct euicc_ctx *ctx, const struct euicc_trace_span *span)
+{
+    char labels[METRICS_LABELS_MAX] = "";
+    char hex[8 + 1];
+    const char *name;
+
+    if (metrics_trace_next)
+    {
+        metrics_trace_next(ctx, span);
+    }
+    if (metrics_paused)
+    {
+        return;
+    }
+
+    switch (span->category)
+    {
+    case EUICC_TRACE_ES10X:
+        snprintf(hex, sizeof(hex), "%02X", span->tag);
+        name = euicc_es10xcommand2str(span->tag);
+        if (name == NULL)
+        {
+            name = hex;
+        }
+        metrics_label(labels, "function", name, strlen(name));
+        metrics_observe(&metrics_es10_duration, labels, span->duration_us / 1e6);
+        if (span->ret == 0 && metrics_es10x_bpp(span->tag))
+        {
+            metrics_request.bpp_bytes += span->tx_len;
+        }
+        break;
+    case EUICC_TRACE_APDU:
+        // 90xx, 61xx and 91xx are all success
+        if (span->tx_len && span->ret >= 0 && (span->status >> 8) != 0x90 && (span->status >> 8) != 0x61 && (span->status >> 8) != 0x91)
+        {
+            snprintf(hex, sizeof(hex), "%04X", span->status);
+            metrics_label(labels, "sw", hex, strlen(hex));
+            metrics_observe(&metrics_sw_failures, labels, 1);
+        }
+        break;
+    case EUICC_TRACE_HTTP:
+        metrics_url_labels(labels, span->name);
+        metrics_observe(&metrics_es9p_duration, labels, span->duration_us / 1e6);
+        if (span->name && strstr(span->name, "/getBoundProfilePackage"))
+        {
+            metrics_request.bpp_duration_us += span->duration_us;
+        }
+        break;
+    }
+}
+
+static void metrics_write_value(FILE *fp, const char *name, const char *suffix, const char *labels, const char *extra, double value)
+{
+    int braces = labels[0] || extra;
+
+    fprintf(fp, "%s%s%s%s%s%s%s %.9g\n", name, suffix, braces ? "{" : "", labels, labels[0] && extra ? "," : "", extra ? extra : "", braces ? "}" : "", value);
+}
+
+// Written next to the target and renamed over it, as the textfile collector expects
+static void metrics_write(void)
+{
+    char *tmp;
+    FILE *fp;
+
+    tmp = malloc(strlen(metrics_path) + sizeof(".tmp"));
+    if (tmp == NULL)
+    {
+        return;
+    }
+    sprintf(tmp, "%s.tmp", metrics_path);
+
+    fp = fopen(tmp, "w");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "metrics: cannot open %s\n", tmp);
+        free(tmp);
+        return;
+    }
+
+    for (struct metrics_family **family = metrics_families; *family; family++)
+    {
+        struct metrics_family *f = *family;
+
+        fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", f->name, f->help, f->name, f->type);
+        for (struct metrics_series *series = f->series; series; series = series->next)
+        {
+            if (f->bounds == NULL)
+            {
+                metrics_write_value(fp, f->name, "", series->labels, NULL, f->type[0] == 'g' ? series->sum : series->count);
+                continue;
+            }
+            for (uint32_t i = 0; i < f->bounds_count; i++)
+            {
+                char le[32];
+
+                snprintf(le, sizeof(le), "le=\"%g\"", f->bounds[i]);
+                metrics_write_value(fp, f->name, "_bucket", series->labels, le, series->buckets[i]);
+            }
+            metrics_write_value(fp, f->name, "_bucket", series->labels, "le=\"+Inf\"", series->count);
+            metrics_write_value(fp, f->name, "_sum", series->labels, NULL, series->sum);
+            metrics_write_value(fp, f->name, "_count", series->labels, NULL, series->count);
+        }
+    }
+
+    if (fclose(fp) != 0 || rename(tmp, metrics_path) != 0)
+    {
+        fprintf(stderr, "metrics: cannot write %s\n", metrics_path);
+        remove(tmp);
+    }
+    free(tmp);
+}
+
+static void metrics_update_notifications(void)
+{
+    struct es10b_notification_metadata_list *list = NULL;
+    uint32_t count = 0;
+
+    // Not part of any request, so kept out of the latency histograms
+    metrics_paused = 1;
+    if (es10b_list_notification(metrics_ctx, &list) == 0)
+    {
+        for (struct es10b_notification_metadata_list *item = list; item; item = item->next)
+        {
+            count++;
+        }
+        metrics_set(&metrics_notifications, "", count);
+    }
+    metrics_paused = 0;
+
+    es10b_notification_metadata_list_free_all(list);
+}
+
+int metrics_init(struct euicc_ctx *ctx, const char *path)
+{
+    metrics_path = path;
+    metrics_ctx = ctx;
+    metrics_trace_next = ctx->trace;
+    ctx->trace = metrics_span;
+
+    metrics_update_notifications();
+    metrics_write();
+
+    return 0;
+}
+
+void metrics_fini(void)
+{
+    if (metrics_ctx == NULL)
+    {
+        return;
+    }
+
+    metrics_ctx->trace = metrics_trace_next;
+    for (struct metrics_family **family = metrics_families; *family; family++)
+    {
+        struct metrics_series *series = (*family)->series;
+
+        while (series)
+        {
+            struct metrics_series *next = series->next;
+
+            free(series->labels);
+            free(series->buckets);
+            free(series);
+            series = next;
+        }
+        (*family)->series = NULL;
+    }
+    metrics_ctx = NULL;
+}
+
+void metrics_request_begin(void)
+{
+    if (metrics_ctx == NULL)
+    {
+        return;
+    }
+
+    memset(&metrics_request, 0, sizeof(metrics_request));
+    memset(&metrics_ctx->http.status, 0, sizeof(metrics_ctx->http.status));
+}
+
+void metrics_request_queued(const char *priority, double wait_seconds, uint32_t depth)
+{
+    char labels[METRICS_LABELS_MAX] = "";
+
+    if (metrics_ctx == NULL)
+    {
+        return;
+    }
+
+    metrics_label(labels, "priority", priority, strlen(priority));
+    metrics_observe(&metrics_queue_wait, labels, wait_seconds);
+    metrics_set(&metrics_queue_depth, "", depth);
+}
+
+void metrics_request_end(int ret)
+{
+    char labels[METRICS_LABELS_MAX] = "";
+    const char *message;
+
+    if (metrics_ctx == NULL)
+    {
+        return;
+    }
+
+    metrics_label(labels, "result", ret == 0 ? "success" : "failure", 7);
+    metrics_observe(&metrics_requests, labels, 1);
+
+    // ES9+ leaves its status behind only when a call was made, and "unknown" when that call succeeded.
+    // Local failures all carry 0.0.0, so their message tells them apart.
+    if (ret != 0 && metrics_ctx->http.status.subjectCode[0] && strcmp(metrics_ctx->http.status.message, "unknown") != 0)
+    {
+        labels[0] = '\0';
+        metrics_label(labels, "subject_code", metrics_ctx->http.status.subjectCode, sizeof(metrics_ctx->http.status.subjectCode));
+        metrics_label(labels, "reason_code", metrics_ctx->http.status.reasonCode, sizeof(metrics_ctx->http.status.reasonCode));
+        message = strcmp(metrics_ctx->http.status.subjectCode, "0.0.0") == 0 ? metrics_ctx->http.status.message : "";
+        metrics_label(labels, "message", message, strlen(message));
+        metrics_observe(&metrics_es9p_failures, labels, 1);
+    }
+
+    if (metrics_request.bpp_bytes)
+    {
+        metrics_observe(&metrics_bpp_bytes, "", metrics_request.bpp_bytes);
+        if (metrics_request.bpp_duration_us)
+        {
+            metrics_observe(&metrics_download_throughput, "", metrics_request.bpp_bytes * 1e6 / metrics_request.bpp_duration_us);
+        }
+    }
+
+    metrics_update_notifications();
+    metrics_write();
+}
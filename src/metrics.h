@@ -0,0 +1,11 @@
+#pragma once
+#include <euicc/euicc.h>
+
+// Prometheus text exposition of the daemon's card and SM-DP+ timings, for node_exporter's textfile collector
+int metrics_init(struct euicc_ctx *ctx, const char *path);
+void metrics_fini(void);
+void metrics_request_begin(void);
+// When the daemon starts a request: how long it waited for the card and how many still wait behind it
+void metrics_request_queued(const char *priority, double wait_seconds, uint32_t depth);
+// Rewrites the file, ret is what the applet returned
+void metrics_request_end(int ret);
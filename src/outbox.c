@@ -0,0 +1,458 @@
+#include "outbox.h"
+#include "main.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <euicc/es9p.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#endif
+
+int outbox_enabled(void)
+{
+    return getenv("LPAC_NOTIFICATION_OUTBOX") != NULL;
+}
+
+static char *outbox_path(const char *suffix)
+{
+    const char *file = getenv("LPAC_NOTIFICATION_OUTBOX");
+    char *path;
+
+    path = malloc(strlen(file) + strlen(suffix) + 1);
+    if (path == NULL)
+    {
+        return NULL;
+    }
+    sprintf(path, "%s%s", file, suffix);
+    return path;
+}
+
+// .lock guards reading and rewriting the file, .send is held by the process delivering it. Both are advisory and
+// only taken where flock exists.
+static int outbox_lock(const char *suffix, int wait)
+{
+#ifndef WIN32
+    char *path;
+    int fd;
+
+    path = outbox_path(suffix);
+    if (path == NULL)
+    {
+        return -1;
+    }
+    fd = open(path, O_RDWR | O_CREAT, 0600);
+    free(path);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (flock(fd, wait ? LOCK_EX : LOCK_EX | LOCK_NB) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    return 0;
+#endif
+}
+
+static void outbox_unlock(int fd)
+{
+#ifndef WIN32
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+#endif
+}
+
+// A missing file is an empty outbox, one that cannot be parsed is left alone for someone to look at
+static cJSON *outbox_load(void)
+{
+    char *path;
+    FILE *fp;
+    char *buf = NULL;
+    long len;
+    cJSON *joutbox = NULL;
+
+    path = outbox_path("");
+    if (path == NULL)
+    {
+        return NULL;
+    }
+    fp = fopen(path, "rb");
+    free(path);
+    if (fp == NULL)
+    {
+        return cJSON_CreateArray();
+    }
+
+    if (fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0)
+    {
+        buf = malloc(len + 1);
+        if (buf && fread(buf, 1, len, fp) == (size_t)len)
+        {
+            buf[len] = '\0';
+            joutbox = len ? cJSON_Parse(buf) : cJSON_CreateArray();
+        }
+        free(buf);
+    }
+    fclose(fp);
+
+    if (!cJSON_IsArray(joutbox))
+    {
+        cJSON_Delete(joutbox);
+        return NULL;
+    }
+    return joutbox;
+}
+
+// Written next to the target, synced and renamed over it, so the file is either the old or the new outbox
+static int outbox_store(const cJSON *joutbox)
+{
+    int fret = 0;
+    char *path = NULL, *tmp = NULL, *jstr = NULL;
+    FILE *fp;
+
+    jstr = cJSON_PrintUnformatted(joutbox);
+    path = outbox_path("");
+    tmp = outbox_path(".tmp");
+    if (jstr == NULL || path == NULL || tmp == NULL)
+    {
+        goto err;
+    }
+
+    fp = fopen(tmp, "w");
+    if (fp == NULL)
+    {
+        goto err;
+    }
+    fputs(jstr, fp);
+#ifndef WIN32
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+    {
+        fclose(fp);
+        remove(tmp);
+        goto err;
+    }
+#endif
+    if (fclose(fp) != 0 || rename(tmp, path) != 0)
+    {
+        remove(tmp);
+        goto err;
+    }
+
+#ifndef WIN32
+    // The rename itself only lasts once the directory is synced
+    {
+        char *slash = strrchr(path, '/');
+        int fd;
+
+        if (slash)
+        {
+            slash[slash == path ? 1 : 0] = '\0';
+        }
+        fd = open(slash ? path : ".", O_RDONLY);
+        if (fd >= 0)
+        {
+            fsync(fd);
+            close(fd);
+        }
+    }
+#endif
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    free(jstr);
+    free(path);
+    free(tmp);
+    return fret;
+}
+
+static cJSON *outbox_find(cJSON *joutbox, const char *b64_PendingNotification)
+{
+    cJSON *jentry;
+
+    cJSON_ArrayForEach(jentry, joutbox)
+    {
+        cJSON *jpending = cJSON_GetObjectItem(jentry, "pendingNotification");
+
+        if (cJSON_IsString(jpending) && strcmp(jpending->valuestring, b64_PendingNotification) == 0)
+        {
+            return jentry;
+        }
+    }
+    return NULL;
+}
+
+int outbox_append(const unsigned long *seqNumber, const struct es10b_pending_notification *notifications, uint32_t count)
+{
+    int fret = 0;
+    int lock;
+    cJSON *joutbox = NULL;
+
+    lock = outbox_lock(".lock", 1);
+    if (lock < 0)
+    {
+        return -1;
+    }
+
+    joutbox = outbox_load();
+    if (joutbox == NULL)
+    {
+        goto err;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        cJSON *jentry;
+
+        // Queued before, by a run that stopped short of removing it from the eUICC
+        if (outbox_find(joutbox, notifications[i].b64_PendingNotification))
+        {
+            continue;
+        }
+
+        jentry = cJSON_CreateObject();
+        cJSON_AddNumberToObject(jentry, "seqNumber", seqNumber[i]);
+        cJSON_AddStringOrNullToObject(jentry, "notificationAddress", notifications[i].notificationAddress);
+        cJSON_AddStringOrNullToObject(jentry, "pendingNotification", notifications[i].b64_PendingNotification);
+        cJSON_AddNumberToObject(jentry, "queuedAt", (double)time(NULL));
+        cJSON_AddNumberToObject(jentry, "attempts", 0);
+        cJSON_AddItemToArray(joutbox, jentry);
+    }
+
+    if (outbox_store(joutbox) < 0)
+    {
+        goto err;
+    }
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    cJSON_Delete(joutbox);
+    outbox_unlock(lock);
+    return fret;
+}
+
+int outbox_count(void)
+{
+    int count;
+    int lock;
+    cJSON *joutbox;
+
+    lock = outbox_lock(".lock", 1);
+    if (lock < 0)
+    {
+        return -1;
+    }
+    joutbox = outbox_load();
+    outbox_unlock(lock);
+    if (joutbox == NULL)
+    {
+        return -1;
+    }
+
+    count = cJSON_GetArraySize(joutbox);
+    cJSON_Delete(joutbox);
+    return count;
+}
+
+// The file is only locked while it is read and rewritten, notifications queued meanwhile are kept
+int outbox_deliver(struct euicc_ctx *ctx, uint32_t *sent, uint32_t *left)
+{
+    int fret = 0;
+    int send_lock = -1, lock = -1;
+    cJSON *joutbox = NULL;
+    cJSON *jentry;
+    uint32_t size, count = 0;
+    char **addresses = NULL;
+    char **notifications = NULL;
+    int *results = NULL;
+
+    *sent = 0;
+    *left = 0;
+
+    send_lock = outbox_lock(".send", 0);
+    if (send_lock < 0)
+    {
+        return 1;
+    }
+
+    lock = outbox_lock(".lock", 1);
+    if (lock < 0)
+    {
+        goto err;
+    }
+    joutbox = outbox_load();
+    outbox_unlock(lock);
+    lock = -1;
+    if (joutbox == NULL)
+    {
+        goto err;
+    }
+
+    size = cJSON_GetArraySize(joutbox);
+    addresses = calloc(size ? size : 1, sizeof(char *));
+    notifications = calloc(size ? size : 1, sizeof(char *));
+    results = malloc((size ? size : 1) * sizeof(int));
+    if (addresses == NULL || notifications == NULL || results == NULL)
+    {
+        goto err;
+    }
+
+    cJSON_ArrayForEach(jentry, joutbox)
+    {
+        cJSON *jaddress = cJSON_GetObjectItem(jentry, "notificationAddress");
+        cJSON *jpending = cJSON_GetObjectItem(jentry, "pendingNotification");
+
+        if (!cJSON_IsString(jaddress) || !cJSON_IsString(jpending))
+        {
+            continue;
+        }
+        addresses[count] = strdup(jaddress->valuestring);
+        notifications[count] = strdup(jpending->valuestring);
+        if (addresses[count] == NULL || notifications[count] == NULL)
+        {
+            free(addresses[count]);
+            free(notifications[count]);
+            goto err;
+        }
+        count++;
+    }
+    cJSON_Delete(joutbox);
+    joutbox = NULL;
+
+    if (count == 0)
+    {
+        goto exit;
+    }
+
+    if (es9p_handle_notification_multi(ctx, (const char *const *)addresses, (const char *const *)notifications, results, count) < 0)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            results[i] = -1;
+        }
+    }
+
+    lock = outbox_lock(".lock", 1);
+    if (lock < 0)
+    {
+        goto err;
+    }
+    joutbox = outbox_load();
+    if (joutbox == NULL)
+    {
+        goto err;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        jentry = outbox_find(joutbox, notifications[i]);
+        if (jentry == NULL)
+        {
+            continue;
+        }
+        if (results[i] == 0)
+        {
+            cJSON_DetachItemViaPointer(joutbox, jentry);
+            cJSON_Delete(jentry);
+            (*sent)++;
+        }
+        else
+        {
+            cJSON *jattempts = cJSON_GetObjectItem(jentry, "attempts");
+
+            cJSON_DeleteItemFromObject(jentry, "attempts");
+            cJSON_AddNumberToObject(jentry, "attempts", (cJSON_IsNumber(jattempts) ? jattempts->valuedouble : 0) + 1);
+        }
+    }
+
+    if (outbox_store(joutbox) < 0)
+    {
+        goto err;
+    }
+    *left = cJSON_GetArraySize(joutbox);
+
+    goto exit;
+
+err:
+    fret = -1;
+exit:
+    cJSON_Delete(joutbox);
+    outbox_unlock(lock);
+    outbox_unlock(send_lock);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        free(addresses[i]);
+        free(notifications[i]);
+    }
+    free(addresses);
+    free(notifications);
+    free(results);
+    return fret;
+}
+
+int outbox_deliver_background(struct euicc_ctx *ctx)
+{
+#ifndef WIN32
+    pid_t pid;
+    int wstatus;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    pid = fork();
+    if (pid < 0)
+    {
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        uint32_t sent, left;
+        int fd;
+
+        // The grandchild is adopted by init, nobody has to wait for it
+        if (fork() != 0)
+        {
+            _exit(0);
+        }
+        setsid();
+        fd = open("/dev/null", O_RDWR);
+        if (fd >= 0)
+        {
+            dup2(fd, STDIN_FILENO);
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        main_reset_deadline();
+        outbox_deliver(ctx, &sent, &left);
+        euicc_http_cleanup(ctx);
+        _exit(0);
+    }
+
+    if (waitpid(pid, &wstatus, 0) != pid || !WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0)
+    {
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <euicc/euicc.h>
+#include <euicc/es10b.h>
+
+// Notifications taken off the eUICC, kept in the LPAC_NOTIFICATION_OUTBOX file until their SM-DP+ acknowledged them
+int outbox_enabled(void);
+// Adds the notifications, they are on disk once this returns 0 and may then be removed from the eUICC
+int outbox_append(const unsigned long *seqNumber, const struct es10b_pending_notification *notifications, uint32_t count);
+// Sends every queued notification once through ctx->http and keeps the ones that failed. Returns -1 when the outbox
+// could not be read or written, 1 when another process is delivering it already.
+int outbox_deliver(struct euicc_ctx *ctx, uint32_t *sent, uint32_t *left);
+// Number of queued notifications, -1 when the outbox cannot be read
+int outbox_count(void);
+// Runs outbox_deliver in a detached process and returns at once, -1 where that is not possible
+int outbox_deliver_background(struct euicc_ctx *ctx);
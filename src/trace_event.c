@@ -0,0 +1,176 @@
+#include "trace_event.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cjson/cJSON_ex.h>
+#include <euicc/tostr.h>
+
+#define TRACE_EVENT_TID_LPAC 1
+#define TRACE_EVENT_TID_CARD 2
+#define TRACE_EVENT_TID_NETWORK 3
+
+static FILE *trace_event_fp = NULL;
+static uint64_t trace_event_epoch;
+static int trace_event_count;
+
+static struct
+{
+    char *name;
+    char *detail;
+    uint64_t start;
+} trace_event_current;
+
+// Events are appended as a JSON array, which viewers accept even when a crash left it unterminated
+static void trace_event_write(cJSON *jevent)
+{
+    char *jstr;
+
+    cJSON_AddNumberToObject(jevent, "pid", 1);
+    jstr = cJSON_PrintUnformatted(jevent);
+    cJSON_Delete(jevent);
+    if (jstr == NULL)
+    {
+        return;
+    }
+
+    fprintf(trace_event_fp, "%s%s", trace_event_count++ ? ",\n" : "", jstr);
+    free(jstr);
+}
+
+static void trace_event_thread_name(int tid, const char *name)
+{
+    cJSON *jevent = cJSON_CreateObject();
+    cJSON *jargs = cJSON_CreateObject();
+
+    cJSON_AddStringToObject(jevent, "name", "thread_name");
+    cJSON_AddStringToObject(jevent, "ph", "M");
+    cJSON_AddNumberToObject(jevent, "tid", tid);
+    cJSON_AddStringToObject(jargs, "name", name);
+    cJSON_AddItemToObject(jevent, "args", jargs);
+    trace_event_write(jevent);
+}
+
+static void trace_event_complete(int tid, const char *category, const char *name, uint64_t start, uint64_t duration, cJSON *jargs)
+{
+    cJSON *jevent = cJSON_CreateObject();
+
+    cJSON_AddStringToObject(jevent, "name", name);
+    cJSON_AddStringToObject(jevent, "cat", category);
+    cJSON_AddStringToObject(jevent, "ph", "X");
+    cJSON_AddNumberToObject(jevent, "ts", start - trace_event_epoch);
+    cJSON_AddNumberToObject(jevent, "dur", duration);
+    cJSON_AddNumberToObject(jevent, "tid", tid);
+    cJSON_AddItemToObject(jevent, "args", jargs);
+    trace_event_write(jevent);
+}
+
+static void trace_event_span(struct euicc_ctx *ctx, const struct euicc_trace_span *span)
+{
+    cJSON *jargs = cJSON_CreateObject();
+    char hex[8 + 1];
+    const char *name;
+
+    switch (span->category)
+    {
+    case EUICC_TRACE_ES10X:
+        snprintf(hex, sizeof(hex), "%02X", span->tag);
+        name = euicc_es10xcommand2str(span->tag);
+        cJSON_AddStringToObject(jargs, "tag", hex);
+        cJSON_AddNumberToObject(jargs, "tx_len", span->tx_len);
+        cJSON_AddNumberToObject(jargs, "apdus", span->count);
+        cJSON_AddNumberToObject(jargs, "ret", span->ret);
+        trace_event_complete(TRACE_EVENT_TID_CARD, "es10x", name ? name : hex, span->start_us, span->duration_us, jargs);
+        break;
+    case EUICC_TRACE_APDU:
+        if (span->tx_len)
+        {
+            snprintf(hex, sizeof(hex), "%04X", span->status);
+            cJSON_AddNumberToObject(jargs, "tx_len", span->tx_len);
+            cJSON_AddNumberToObject(jargs, "rx_len", span->rx_len);
+            cJSON_AddStringToObject(jargs, "sw", hex);
+            cJSON_AddNumberToObject(jargs, "apdus", span->count);
+        }
+        cJSON_AddNumberToObject(jargs, "ret", span->ret);
+        trace_event_complete(TRACE_EVENT_TID_CARD, "apdu", span->name, span->start_us, span->duration_us, jargs);
+        break;
+    case EUICC_TRACE_HTTP:
+        cJSON_AddStringOrNullToObject(jargs, "url", span->name);
+        cJSON_AddNumberToObject(jargs, "rcode", span->status);
+        cJSON_AddNumberToObject(jargs, "tx_len", span->tx_len);
+        cJSON_AddNumberToObject(jargs, "rx_len", span->rx_len);
+        cJSON_AddNumberToObject(jargs, "ret", span->ret);
+        trace_event_complete(TRACE_EVENT_TID_NETWORK, "http", span->name ? span->name : "http", span->start_us, span->duration_us, jargs);
+        break;
+    default:
+        cJSON_Delete(jargs);
+        break;
+    }
+}
+
+int trace_event_init(struct euicc_ctx *ctx)
+{
+    const char *path = getenv("LPAC_TRACE_FILE");
+
+    if (path == NULL)
+    {
+        return 0;
+    }
+
+    trace_event_fp = fopen(path, "w");
+    if (trace_event_fp == NULL)
+    {
+        return -1;
+    }
+    fprintf(trace_event_fp, "[\n");
+
+    trace_event_epoch = euicc_now_us();
+    trace_event_thread_name(TRACE_EVENT_TID_LPAC, "lpac");
+    trace_event_thread_name(TRACE_EVENT_TID_CARD, "card");
+    trace_event_thread_name(TRACE_EVENT_TID_NETWORK, "network");
+
+    ctx->trace = trace_event_span;
+
+    return 0;
+}
+
+void trace_event_stage(const char *name, const char *detail)
+{
+    uint64_t now;
+
+    if (trace_event_fp == NULL)
+    {
+        return;
+    }
+
+    now = euicc_now_us();
+    if (trace_event_current.name)
+    {
+        cJSON *jargs = cJSON_CreateObject();
+
+        cJSON_AddStringOrNullToObject(jargs, "data", trace_event_current.detail);
+        trace_event_complete(TRACE_EVENT_TID_LPAC, "applet", trace_event_current.name, trace_event_current.start, now - trace_event_current.start, jargs);
+    }
+
+    free(trace_event_current.name);
+    free(trace_event_current.detail);
+    trace_event_current.name = name ? strdup(name) : NULL;
+    trace_event_current.detail = detail ? strdup(detail) : NULL;
+    trace_event_current.start = now;
+
+    fflush(trace_event_fp);
+}
+
+void trace_event_fini(void)
+{
+    if (trace_event_fp == NULL)
+    {
+        return;
+    }
+
+    trace_event_stage(NULL, NULL);
+    fprintf(trace_event_fp, "\n]\n");
+    fclose(trace_event_fp);
+    trace_event_fp = NULL;
+}
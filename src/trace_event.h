@@ -0,0 +1,8 @@
+#pragma once
+#include <euicc/euicc.h>
+
+// Trace Event Format JSON (chrome://tracing, Perfetto) of the session, written to LPAC_TRACE_FILE
+int trace_event_init(struct euicc_ctx *ctx);
+void trace_event_fini(void);
+// Starts the applet stage shown as name, ending the previous one. A NULL name only ends it.
+void trace_event_stage(const char *name, const char *detail);